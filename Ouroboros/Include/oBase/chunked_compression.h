@@ -0,0 +1,133 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+// A container that splits its content into independently compressed blocks so
+// large buffers compress and decompress in parallel, a byte range can be
+// decompressed by touching only the blocks that overlap it, and the container
+// can be written and read as a stream without all of it in memory.
+
+// Layout (little endian):
+// header: uint32 magic, uint8 version, uint8 compression, uint16 0,
+//         uint32 block size
+// blocks: uint32 stored size with the high bit set if stored uncompressed, then
+//         the compressed block
+// uint32  0 to end the blocks
+// index:  uint64 offset of each block's stored size from the container start
+// footer: uint64 uncompressed size, uint32 number of blocks, uint32 magic
+
+#pragma once
+#include <oBase/compression.h>
+#include <functional>
+#include <vector>
+
+namespace ouro {
+
+// larger blocks compress better, smaller blocks make range reads cheaper
+static const uint32_t default_chunked_block_size = 1 << 20;
+
+// how many blocks streams compress or decompress in parallel at once, which
+// bounds how much they buffer
+static const uint32_t default_chunked_batch_blocks = 32;
+
+static const uint32_t max_chunked_block_size = 1 << 30;
+
+struct chunked_info
+{
+	compression type;
+	uint32_t block_size;
+	uint32_t num_blocks;
+	uint64_t uncompressed_size;
+};
+
+// If dst is nullptr returns the worst-case container size, otherwise compresses
+// all blocks in parallel into dst and returns the container size.
+size_t compress_chunked(const compression& type, void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size, uint32_t block_size = default_chunked_block_size);
+
+// Reads and validates the header and footer of a whole container.
+chunked_info get_chunked_info(const void* src, size_t src_size);
+
+// If dst is nullptr returns the uncompressed size, otherwise decompresses all
+// blocks in parallel into dst and returns the uncompressed size.
+size_t decompress_chunked(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size);
+
+// Decompresses only uncompressed bytes [offset, offset + size) into dst, which
+// must be at least size bytes.
+void decompress_chunked_range(void* oRESTRICT dst, uint64_t offset, size_t size, const void* oRESTRICT src, size_t src_size);
+
+// Receives stream output in order.
+typedef std::function<void(const void* data, size_t size)> chunked_write_fn;
+
+// Writes a container in pieces as its content is produced.
+class chunked_compress_stream
+{
+public:
+	chunked_compress_stream(const compression& type, const chunked_write_fn& write, uint32_t block_size = default_chunked_block_size, uint32_t batch_blocks = default_chunked_batch_blocks);
+
+	// Buffers src and compresses and writes whole batches as they fill.
+	void write(const void* src, size_t src_size);
+
+	// Compresses anything buffered and writes the index and footer. No more
+	// writes are allowed after this.
+	void finish();
+
+	uint64_t uncompressed_size() const { return uncompressed_size_; }
+	uint64_t compressed_size() const { return offset_; }
+
+private:
+	chunked_compress_stream(const chunked_compress_stream&); /* = delete */
+	const chunked_compress_stream& operator=(const chunked_compress_stream&); /* = delete */
+
+	void emit(const void* data, size_t size);
+	void compress_batch(const uint8_t* src, size_t src_size);
+
+	chunked_write_fn write_;
+	compression type_;
+	uint32_t block_size_;
+	uint32_t batch_blocks_;
+	bool finished_;
+	uint64_t offset_;
+	uint64_t uncompressed_size_;
+	std::vector<uint8_t> pending_;
+	std::vector<uint8_t> scratch_;
+	std::vector<size_t> stored_sizes_;
+	std::vector<uint64_t> index_;
+};
+
+// Reads a container from pieces of any size and writes its content in order.
+class chunked_decompress_stream
+{
+public:
+	chunked_decompress_stream(const chunked_write_fn& write, uint32_t batch_blocks = default_chunked_batch_blocks);
+
+	// Consumes src and decompresses and writes whole batches of blocks as they
+	// arrive.
+	void write(const void* src, size_t src_size);
+
+	// Writes whatever is left and throws if the container was incomplete.
+	void finish();
+
+	uint64_t uncompressed_size() const { return uncompressed_size_; }
+
+private:
+	chunked_decompress_stream(const chunked_decompress_stream&); /* = delete */
+	const chunked_decompress_stream& operator=(const chunked_decompress_stream&); /* = delete */
+
+	enum class state { header, block_size, block, index, done };
+
+	size_t consume(const uint8_t* src, size_t src_size);
+	void decompress_batch();
+
+	chunked_write_fn write_;
+	chunked_info info_;
+	state state_;
+	uint32_t batch_blocks_;
+	uint32_t stored_size_;
+	uint64_t offset_;
+	uint64_t uncompressed_size_;
+	std::vector<uint8_t> pending_;
+	std::vector<uint8_t> batch_;
+	std::vector<uint32_t> batch_sizes_;
+	std::vector<uint8_t> scratch_;
+	std::vector<uint64_t> index_;
+};
+
+}
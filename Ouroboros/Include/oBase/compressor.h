@@ -0,0 +1,204 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+// Reusable compression state for callers that compress many buffers. Where
+// compress() and decompress() set up and tear down a codec on every call, a
+// compressor or decompressor keeps its codec's tables and work buffers
+// between streams and allocates them from the specified allocator. Output is
+// the same format compress() produces and decompress() reads unless a
+// dictionary is set, in which case only a decompressor with the same
+// dictionary can read it.
+
+// gzip and lz4 compress as they're fed. lzma and snappy can only compress
+// whole buffers, so they gather what they're fed until finish() and compress()
+// is the better choice for them.
+
+#pragma once
+#include <oCore/assert.h>
+#include <oBase/compression.h>
+#include <oMemory/allocate.h>
+#include <cstring>
+#include <new>
+
+namespace ouro {
+
+// codec-specific: gzip and lzma 0-9, lz4 levels in oBase/lz4.h, snappy has none
+static const int default_compression_level = -1;
+
+class compressor
+{
+public:
+	// Implemented by each compression type. Dictionaries are only supported by
+	// gzip and lz4.
+	class codec
+	{
+	public:
+		virtual ~codec() {}
+		virtual size_t max_compressed_size(size_t src_size) const = 0;
+		virtual void set_dictionary(const void* dict, size_t dict_size) = 0;
+		virtual void begin(void* dst, size_t dst_size) = 0;
+		virtual void feed(const void* src, size_t src_size) = 0;
+		virtual size_t finish() = 0;
+		virtual size_t compress(void* dst, size_t dst_size, const void* src, size_t src_size) { begin(dst, dst_size); feed(src, src_size); return finish(); }
+	};
+
+	compressor() : type_(compression::none), codec_(nullptr) {}
+	compressor(const compression& type, const allocator& alloc = default_allocator, int level = default_compression_level);
+	~compressor() { deinitialize(); }
+
+	compressor(compressor&& that) : type_(that.type_), alloc_(that.alloc_), codec_(that.codec_) { that.codec_ = nullptr; }
+	compressor& operator=(compressor&& that);
+
+	void initialize(const compression& type, const allocator& alloc = default_allocator, int level = default_compression_level);
+	void deinitialize();
+
+	operator bool() const { return !!codec_; }
+	compression type() const { return type_; }
+
+	// Returns the largest output compressing src_size bytes can produce no
+	// matter how they're fed.
+	size_t max_compressed_size(size_t src_size) const { return codec_->max_compressed_size(src_size); }
+
+	// Copies dict and uses it to prime every stream that begins after this. An
+	// empty dict stops using one.
+	void set_dictionary(const void* dict, size_t dict_size) { codec_->set_dictionary(dict, dict_size); }
+
+	// Starts a new stream that writes into dst, abandoning any unfinished one.
+	void begin(void* dst, size_t dst_size) { codec_->begin(dst, dst_size); }
+
+	// Appends src to the stream. Throws if dst is too small.
+	void feed(const void* src, size_t src_size) { codec_->feed(src, src_size); }
+
+	// Completes the stream and returns its compressed size.
+	size_t finish() { return codec_->finish(); }
+
+	// Compresses src as a whole stream, which avoids buffering for codecs that
+	// can't otherwise compress incrementally.
+	size_t compress(void* dst, size_t dst_size, const void* src, size_t src_size) { return codec_->compress(dst, dst_size, src, src_size); }
+
+private:
+	compressor(const compressor&); /* = delete */
+	const compressor& operator=(const compressor&); /* = delete */
+
+	compression type_;
+	allocator alloc_;
+	codec* codec_;
+};
+
+class decompressor
+{
+public:
+	// Implemented by each compression type.
+	class codec
+	{
+	public:
+		virtual ~codec() {}
+		virtual void set_dictionary(const void* dict, size_t dict_size) = 0;
+		virtual void begin(void* dst, size_t dst_size) = 0;
+		virtual void feed(const void* src, size_t src_size) = 0;
+		virtual size_t finish() = 0;
+		virtual size_t decompress(void* dst, size_t dst_size, const void* src, size_t src_size) { begin(dst, dst_size); feed(src, src_size); return finish(); }
+	};
+
+	decompressor() : type_(compression::none), codec_(nullptr) {}
+	decompressor(const compression& type, const allocator& alloc = default_allocator);
+	~decompressor() { deinitialize(); }
+
+	decompressor(decompressor&& that) : type_(that.type_), alloc_(that.alloc_), codec_(that.codec_) { that.codec_ = nullptr; }
+	decompressor& operator=(decompressor&& that);
+
+	void initialize(const compression& type, const allocator& alloc = default_allocator);
+	void deinitialize();
+
+	operator bool() const { return !!codec_; }
+	compression type() const { return type_; }
+
+	// Copies dict, which must match the one the data was compressed with.
+	void set_dictionary(const void* dict, size_t dict_size) { codec_->set_dictionary(dict, dict_size); }
+
+	// Starts a new stream that writes into dst, which must be large enough for
+	// all of it (decompress() with a nullptr dst returns the size).
+	void begin(void* dst, size_t dst_size) { codec_->begin(dst, dst_size); }
+
+	// Consumes the next part of the compressed stream.
+	void feed(const void* src, size_t src_size) { codec_->feed(src, src_size); }
+
+	// Throws if the stream is incomplete or corrupt, otherwise returns its
+	// uncompressed size.
+	size_t finish() { return codec_->finish(); }
+
+	size_t decompress(void* dst, size_t dst_size, const void* src, size_t src_size) { return codec_->decompress(dst, dst_size, src, src_size); }
+
+private:
+	decompressor(const decompressor&); /* = delete */
+	const decompressor& operator=(const decompressor&); /* = delete */
+
+	compression type_;
+	allocator alloc_;
+	codec* codec_;
+};
+
+// _____________________________________________________________________________
+// Support for codec implementations
+
+// A growable buffer for codec work memory that comes from an allocator and is
+// kept between streams.
+class codec_buffer
+{
+public:
+	codec_buffer(const allocator& alloc, const char* label) : alloc_(alloc), label_(label), data_(nullptr), size_(0), capacity_(0) {}
+	~codec_buffer() { if (data_) alloc_.deallocate(data_); }
+
+	uint8_t* data() const { return data_; }
+	size_t size() const { return size_; }
+	size_t capacity() const { return capacity_; }
+	bool empty() const { return !size_; }
+
+	void clear() { size_ = 0; }
+	void resize(size_t size) { reserve(size); size_ = size; }
+	void append(const void* src, size_t src_size) { reserve(size_ + src_size); if (src_size) memcpy(data_ + size_, src, src_size); size_ += src_size; }
+
+	// grows geometrically, preserving contents
+	void reserve(size_t capacity)
+	{
+		if (capacity <= capacity_)
+			return;
+		capacity = capacity_ * 2 > capacity ? capacity_ * 2 : capacity;
+		uint8_t* data = (uint8_t*)alloc_.allocate(capacity, label_);
+		oCheck(data, std::errc::not_enough_memory, "%s: out of memory allocating %u bytes", label_, uint32_t(capacity));
+		if (size_)
+			memcpy(data, data_, size_);
+		if (data_)
+			alloc_.deallocate(data_);
+		data_ = data;
+		capacity_ = capacity;
+	}
+
+private:
+	codec_buffer(const codec_buffer&); /* = delete */
+	const codec_buffer& operator=(const codec_buffer&); /* = delete */
+
+	allocator alloc_;
+	const char* label_;
+	uint8_t* data_;
+	size_t size_;
+	size_t capacity_;
+};
+
+// Constructs a codec in memory from alloc, releasing it if construction throws.
+template<typename codec_t> codec_t* new_codec(const allocator& alloc, const char* label)
+{
+	void* p = alloc.allocate(sizeof(codec_t), label);
+	oCheck(p, std::errc::not_enough_memory, "%s: out of memory", label);
+	try { return new (p) codec_t(alloc); }
+	catch (...) { alloc.deallocate(p); throw; }
+}
+
+template<typename codec_t> codec_t* new_codec(const allocator& alloc, int level, const char* label)
+{
+	void* p = alloc.allocate(sizeof(codec_t), label);
+	oCheck(p, std::errc::not_enough_memory, "%s: out of memory", label);
+	try { return new (p) codec_t(alloc, level); }
+	catch (...) { alloc.deallocate(p); throw; }
+}
+
+}
@@ -52,21 +52,6 @@ public:
 	// be called when other threads might be allocating or deallocating memory.
 	void shrink(size_type capacity);
 
-	// SLOW! walks the chunks list to count them
-	size_type num_chunks() const;
-
-	// SLOW! returns the current capacity without (auto)growing or shrinking
-	inline size_type capacity() const { return num_chunks() * chunk_capacity(); }
-
-	// SLOW! walks the free list and returns the count of all chunk pools
-	size_type count_free() const;
-
-	// SLOW! returns the number of allocated elements
-	inline size_type size() const { return capacity() - count_free(); }
-
-	// SLOW! returns true of there are no outstanding allocations
-	inline bool full() const { return capacity() == count_free(); }
-
 	// Returns true if the specified pointer was allocated by this allocator.
 	bool owns(void* pointer) const;
 
@@ -76,6 +61,22 @@ public:
 	// returns the number of blocks per chunk as specified at initialization
 	inline size_type chunk_capacity() const { return capacity_per_chunk; }
 
+	// returns the number of chunks currently allocated
+	inline size_type num_chunks() const { return nchunks; }
+
+	// returns the current capacity without (auto)growing or shrinking
+	inline size_type capacity() const { return num_chunks() * chunk_capacity(); }
+
+	// sums each chunk's O(1) free count, so this is O(num_chunks()) and 
+	// approximate while there are concurrent operations
+	size_type count_free() const;
+
+	// returns the number of allocated elements
+	inline size_type size() const { return capacity() - count_free(); }
+
+	// returns true of there are no outstanding allocations
+	inline bool full() const { return capacity() == count_free(); }
+
 	// Allocates a block. If there isn't enough memory this will allocate more
 	// memory from the underlying platform. Such allocations occur in chunks. The 
 	// memory is not yielded back to the platform automatically: use shrink() to 
@@ -83,6 +84,15 @@ public:
 	void* allocate_pointer();
 	void deallocate(void* pointer);
 
+	// Allocates count blocks, taking runs from each chunk with one CAS and 
+	// growing as needed. Returns the number allocated, which is only less than
+	// count if a new chunk could not be allocated.
+	size_type allocate_n(void** pointers, size_type count);
+
+	// Frees count blocks, returning each run of blocks from the same chunk with 
+	// one CAS.
+	void deallocate_n(void* const* pointers, size_type count);
+
 private:
 	struct chunk_t
 	{
@@ -92,6 +102,7 @@ private:
 
 	std::atomic<concurrent_pool*> last_allocate;
 	std::atomic<concurrent_pool*> last_deallocate;
+	std::atomic<size_type> nchunks;
 	size_type block_size;
 	size_type block_alignment;
 	size_type capacity_per_chunk;
@@ -101,6 +112,9 @@ private:
 	// allocates and initializes a new chunk for when out of currently reserved memory
 	chunk_t* allocate_chunk();
 
+	// pushes a newly allocated chunk
+	void push_chunk(chunk_t* c);
+
 	// maps a pointer back to the pool it came from
 	concurrent_pool* find_pool(void* _Pointer) const;
 
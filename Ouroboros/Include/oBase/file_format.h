@@ -24,11 +24,14 @@ struct file_chunk
 	template<typename T> T* data() { return (T*)(this + 1); }
 	template<typename T> const T* data() const { return (const T*)(this + 1); }
 
+	// true if this header and the chunk_bytes of data after it are within buffer
 	bool in_range(const void* buffer, size_t size) const
 	{
 		auto ths = (const uint8_t*)this;
 		auto buf = (const uint8_t*)buffer;
-		return ths >= buffer && (ths + chunk_bytes) <= (buf + size);
+		if (ths < buf || size_t(ths - buf) > size || size - size_t(ths - buf) < sizeof(file_chunk))
+			return false;
+		return chunk_bytes <= size - size_t(ths - buf) - sizeof(file_chunk);
 	}
 };
 static_assert(sizeof(file_chunk) == 12, "size mismatch");
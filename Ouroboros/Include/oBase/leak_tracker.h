@@ -3,10 +3,10 @@
 // Interface for maintaining details of an allocator, mainly for leak tracking.
 
 #pragma once
-#include <oConcurrency/concurrent_hash_map.h>
+#include <oConcurrency/concurrent_growable_hash_map.h>
 #include <oConcurrency/countdown_latch.h>
 #include <oMemory/allocate.h>
-#include <oMemory/concurrent_object_pool.h>
+#include <oMemory/concurrent_chunked_object_pool.h>
 #include <atomic>
 #include <cstdint>
 
@@ -69,7 +69,10 @@ public:
 		bool capture_callstack;
 	};
 
-	// returns the number of bytes to record the specified number of allocs
+	// returns the number of bytes to record the specified number of allocs. The
+	// map of outstanding allocations and any entries past capacity are grown 
+	// from the allocator passed to initialize(), so this is only the memory for
+	// the first capacity entries.
 	static size_type calc_size(size_type capacity);
 
 	
@@ -77,7 +80,7 @@ public:
 	
 	leak_tracker();
 	leak_tracker(const init_t& i, size_type capacity, const char* alloc_label = "leak_tracker", const allocator& a = default_allocator);
-	leak_tracker(const init_t& i, void* memory, size_type capacity);
+	leak_tracker(const init_t& i, void* memory, size_type capacity, const allocator& a = default_allocator);
 	leak_tracker(leak_tracker&& that);
 	~leak_tracker();
 	leak_tracker& operator=(leak_tracker&& that);
@@ -85,10 +88,11 @@ public:
 	// initializes the queue with memory allocated from allocator
 	void initialize(const init_t& i, size_type capacity, const char* alloc_label = "leak_tracker", const allocator& a = default_allocator);
 
-	// use calc_size() to determine memory size
-	void initialize(const init_t& i, void* memory, size_type capacity);
+	// use calc_size() to determine memory size. The allocator is used to grow
+	// the map and entries, so it must not itself be tracked.
+	void initialize(const init_t& i, void* memory, size_type capacity, const allocator& a = default_allocator);
 
-	// deinitializes the hash map and returns the memory passed to initialize()
+	// deinitializes the tracker and returns the memory passed to initialize()
 	void* deinitialize();
 
 	// ?
@@ -149,8 +153,10 @@ private:
 
 	static const uint32_t nullidx = uint32_t(-1);
 
-	typedef concurrent_hash_map<uint64_t, uint32_t> hash_map_t;
-	typedef concurrent_object_pool<entry> pool_t;
+	// the map only holds 32-bit values, so it maps pointers to indices into a
+	// pool of entries that grows in chunks of the capacity given to initialize()
+	typedef concurrent_growable_hash_map<uint64_t, uint32_t> hash_map_t;
+	typedef concurrent_chunked_object_pool<entry> pool_t;
 
 	hash_map_t allocs;
 	pool_t pool;
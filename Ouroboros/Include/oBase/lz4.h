@@ -0,0 +1,47 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+// LZ4 block and frame formats as specified at https://github.com/lz4/lz4/tree/dev/doc
+// so buffers are interchangeable with other LZ4 implementations. compress() and
+// decompress() with compression::lz4 use frames at fast_level.
+
+#pragma once
+#include <oCore/restrict.h>
+#include <cstdint>
+
+namespace ouro { namespace lz4 {
+
+// fast_level is a single-probe greedy matcher. Levels 1 to max_level search
+// hash chains (HC) 2^(level-1) deep and trade compression time for ratio
+// without affecting decompression speed.
+static const int fast_level = 0;
+static const int default_hc_level = 9;
+static const int max_level = 12;
+
+// largest src a single block can compress
+static const size_t max_block_input = 0x7e000000;
+
+// Returns the worst-case size of compressing src_size bytes into a block.
+size_t compress_block_bound(size_t src_size);
+
+// Compresses src as a single raw block with no header: the size of src must be
+// recorded elsewhere. If dst is nullptr this returns compress_block_bound().
+// Throws if dst_size is too small.
+size_t compress_block(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size, int level = fast_level);
+
+// Decompresses a raw block into dst and returns the number of bytes written.
+// Throws if src is malformed or dst_size is too small.
+size_t decompress_block(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size);
+
+// Compresses src into a frame of independent 4 MB blocks with the content size
+// and a checksum of the content. If dst is nullptr this returns the worst-case
+// size.
+size_t compress_frame(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size, int level = fast_level);
+
+// Decompresses a frame produced by any LZ4 implementation, verifying whatever
+// checksums it has. If dst is nullptr this returns the uncompressed size,
+// which is stored in the header by compress_frame but otherwise requires a
+// pass over the blocks. Frames compressed with a dictionary require a
+// decompressor (oBase/compressor.h) with the same dictionary.
+size_t decompress_frame(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size);
+
+}}
@@ -22,13 +22,17 @@
 // 7. Consolidate the master_tasklist into a plan and then execute the plan.
 // 8. reset the master_tasklist and plan to begin the next cycle of main app logic.
 //
+// A plan's transient memory comes from a concurrent_ring_allocator. A plan can
+// own one or several plans can share one so that a plan's memory is retired
+// once it has executed rather than by resetting the whole allocator.
+//
 // There is also a plan_thread that will double-buffer plans so one can be built
 // while another one is executing. Execution happens in a separate thread. See
 // plan_thread.h for more details.
 
 #pragma once
 #include <oArch/arch.h>
-#include <oMemory/concurrent_linear_allocator.h>
+#include <oMemory/concurrent_ring_allocator.h>
 #include <atomic>
 
 namespace ouro {
@@ -170,18 +174,31 @@ class alignas(oCACHE_LINE_SIZE) plan
 public:
 	static const uint32_t default_alignment = oDEFAULT_MEMORY_ALIGNMENT;
 
+	// allocator_bytes can be 0 if the plan will share an allocator
 	static uint32_t calc_size(uint32_t allocator_bytes, uint32_t num_phases);
 	
-	plan() : phase_tasks(nullptr), overflow(false) {}
+	plan() : allocator(nullptr), phase_tasks(nullptr), begin_marker(0), end_marker(0), overflow(false) {}
 	~plan() { deinitialize(); }
 
 	// memory must be oCACHE_LINE_SIZE-aligned. Bytes is the value returned from
-	// calc_size.
+	// calc_size. The first form allocates from a ring in memory, the second
+	// allocates from shared_allocator and memory holds only phase bookkeeping.
 	void initialize(void* memory, uint32_t bytes, uint32_t num_phases);
+	void initialize(void* memory, uint32_t bytes, uint32_t num_phases, concurrent_ring_allocator* shared_allocator);
 	void* deinitialize();
 
 	void* allocate(uint32_t size, uint32_t align = default_alignment);
-	inline void reset() { allocator.reset(); }
+
+	// discards everything allocated since the plan began and starts over
+	inline void reset() { allocator->rewind(begin_marker); overflow = false; }
+
+	// starts a new plan whose allocations follow any from before that have not
+	// been retired. Use this rather than reset() when another plan sharing the 
+	// allocator may still be executing.
+	inline void begin() { begin_marker = allocator->marker(); overflow = false; }
+
+	// releases the memory of a consolidated plan once it has been executed
+	inline void retire() { allocator->retire(end_marker); }
 
 	// combines the various tasklists into phases and sorts each phase, then 
 	// resets the master tasklist. If either the master overflowed or the 
@@ -195,8 +212,11 @@ public:
 	void execute(uint32_t phase, const technique_t* techniques);
 
 private:
-	concurrent_linear_allocator allocator;
+	concurrent_ring_allocator ring;
+	concurrent_ring_allocator* allocator;
 	void* phase_tasks;
+	uint32_t begin_marker;
+	uint32_t end_marker;
 	bool overflow;
 };
 
@@ -8,9 +8,9 @@
 #pragma once
 #include <atomic>
 #include <cstdint>
-#include <oConcurrency/concurrent_hash_map.h>
+#include <oConcurrency/concurrent_growable_hash_map.h>
 #include <oConcurrency/concurrent_stack.h>
-#include <oMemory/concurrent_object_pool.h>
+#include <oMemory/concurrent_chunked_object_pool.h>
 #include <oString/uri.h>
 
 namespace ouro {
@@ -88,7 +88,9 @@ public:
 
 	static const memory_alignment required_alignment = memory_alignment::cacheline;
 
-	// returns the minimum size in bytes required of memory passed to initialize_base()
+	// returns the minimum size in bytes required of memory passed to initialize_base().
+	// This covers the resource and queue pools up to capacity; past that they and
+	// the key lookup grow from the io allocator passed to initialize_base().
 	static size_type calc_size(size_type capacity);
 
 	// returns the max block count that fits into the specified bytes
@@ -126,7 +128,8 @@ protected:
 	// calls deinitialize on this before move
 	base_resource_registry& operator=(base_resource_registry&& that);
 
-	// derived classes should set up all apparatus for create/destroy to work, then call this - placeholder is immediately created
+	// derived classes should set up all apparatus for create/destroy to work, then call this - placeholder is immediately created.
+	// io_alloc is also where the key lookup and pools grow from once memory is full.
 	void initialize_base(const char* registry_label, void* memory, size_type bytes, blob& error_placeholder, const allocator& io_alloc, bool concurrent_create);
 	
 	// destroys the internals of the instance and returns the memory passed to initialize_base()
@@ -210,9 +213,9 @@ private:
 		};
 	};
 
-	typedef concurrent_hash_map<key_type, uint32_t> lookup_t;
-	typedef concurrent_object_pool<queued_t>        queued_pool_t;
-	typedef concurrent_object_pool<handle::type>    res_pool_t;
+	typedef concurrent_growable_hash_map<key_type, uint32_t> lookup_t;
+	typedef concurrent_chunked_object_pool<queued_t>     queued_pool_t;
+	typedef concurrent_chunked_object_pool<handle::type> res_pool_t; // handles point into this, so it grows in chunks that never move
 	typedef concurrent_stack<queued_t>              queue_t;
 	typedef std::atomic<handle::type>               atm_resource_t;
 
@@ -6,6 +6,7 @@
 #include <oCore/assert.h>
 #include <oCore/blob.h>
 #include <oCore/filter_chain.h> // unit_test needs to operate without this. Only needed by infrastructure, not in-each-unit-test header.
+#include <oCore/timer.h>
 #include <cstdarg>
 #include <cstdint>
 #include <stdexcept>
@@ -21,10 +22,14 @@ oTEST(my_test)
 	srv.status("all good");
 }
 
+Benchmarks are declared with oBENCHMARK(my_test_benchmark) the same way and
+are skipped in debug builds.
+
 */
 
 // Flags used to describe tests (not much here yet)
 #define oTEST_NORMAL 0
+#define oTEST_BENCHMARK 1 // timings aren't meaningful in debug builds, so it's skipped there
 
 #define oTEST2(test_name, test_flags, bug) \
 	namespace ouro { namespace unit_test { void test_##test_name(ouro::unit_test::services&); }} \
@@ -32,6 +37,7 @@ oTEST(my_test)
 	void ouro::unit_test::test_##test_name(ouro::unit_test::services& srv)
 
 #define oTEST(test_name) oTEST2(test_name, oTEST_NORMAL, 0)
+#define oBENCHMARK(test_name) oTEST2(test_name, oTEST_BENCHMARK, 0)
 
 // _____________________________________________________________________________
 // Error handling and checking
@@ -149,6 +155,29 @@ public:
 	// returns string of last call to report or vreport
 	virtual const char* status() const = 0;
 
+	// Benchmark helpers: best_seconds() runs fn nruns times and returns the
+	// fastest run so one-time costs like cold caches don't skew the result.
+	// trace_rate() traces "label: amount/seconds units/s" and returns the rate.
+	template<typename FnT> double best_seconds(uint32_t nruns, const FnT& fn)
+	{
+		double best = 0.0;
+		for (uint32_t i = 0; i < nruns; i++)
+		{
+			timer tm;
+			fn();
+			const double seconds = tm.seconds();
+			best = (i && best < seconds) ? best : seconds;
+		}
+		return best;
+	}
+
+	inline double trace_rate(const char* label, double amount, const char* units, double seconds)
+	{
+		const double rate = amount / seconds;
+		trace("%s: %.1f %s/s", label, rate, units);
+		return rate;
+	}
+
 	// all data loaded should be relative to this path
 	virtual const char* root_path() const = 0;
 
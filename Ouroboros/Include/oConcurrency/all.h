@@ -5,16 +5,23 @@
 #pragma once
 #include <oConcurrency/backoff.h>
 #include <oConcurrency/concurrency.h>
+#include <oConcurrency/concurrent_growable_hash_map.h>
 #include <oConcurrency/concurrent_hash_map.h>
 #include <oConcurrency/concurrent_queue.h>
 #include <oConcurrency/concurrent_queue_opt.h>
+#include <oConcurrency/concurrent_ring_queue.h>
 #include <oConcurrency/concurrent_stack.h>
 #include <oConcurrency/coroutine.h>
 #include <oConcurrency/countdown_latch.h>
 #include <oConcurrency/event.h>
 #include <oConcurrency/future.h>
+#include <oConcurrency/inline_task.h>
 #include <oConcurrency/lock_free_queue.h>
 #include <oConcurrency/mutex.h>
+#include <oConcurrency/parallel_for_range.h>
 #include <oConcurrency/plan_thread.h>
 #include <oConcurrency/tagged_pointer.h>
+#include <oConcurrency/task.h>
 #include <oConcurrency/threadpool.h>
+#include <oConcurrency/work_stealing_deque.h>
+#include <oConcurrency/work_stealing_threadpool.h>
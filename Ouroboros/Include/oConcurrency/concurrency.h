@@ -6,8 +6,10 @@
 // implement these interfaces.
 
 #pragma once
+#include <oConcurrency/inline_task.h>
 #include <functional>
 #include <memory>
+#include <utility>
 
 namespace ouro {
 
@@ -22,7 +24,11 @@ public:
 	virtual ~task_group() {}
 
 	// dispatches a task flagged as part of this group
-	virtual void run(const std::function<void()>& task) = 0;
+	virtual void run(inline_task<>&& task) = 0;
+
+	// Any void() callable is moved straight into an inline_task, so lambdas 
+	// that fit are neither wrapped in a std::function nor put on the heap.
+	template<typename TaskT> void run(TaskT&& task) { run(inline_task<>(std::forward<TaskT>(task))); }
 
 	// waits for only tasks dispatched with run() to finish
 	virtual void wait() = 0;
@@ -55,12 +61,22 @@ void ensure_scheduler_initialized();
 
 // issues a task for asynchronous execution on any thread in the underlying
 // threadpool.
-void dispatch(const std::function<void()>& task);
+void dispatch(inline_task<>&& task);
+
+// Any void() callable is moved straight into an inline_task, so lambdas that
+// fit are neither wrapped in a std::function nor put on the heap.
+template<typename TaskT> void dispatch(TaskT&& task) { dispatch(inline_task<>(std::forward<TaskT>(task))); }
 
 // Implements the parallel for pattern, executing the specified task with the index
-// from begin to end.
+// from begin to end. This is implemented on top of parallel_for_range.
 void parallel_for(size_t begin, size_t end, const std::function<void(size_t index)>& task);
 
+// Implements the parallel for pattern by recursively splitting [begin,end) and 
+// calling task once per subrange. The subrange size is chosen by the scheduler
+// from the measured cost of task, so loops over cheap elements should prefer 
+// this to parallel_for to amortize per-call overhead.
+void parallel_for_range(size_t begin, size_t end, const std::function<void(size_t begin, size_t end)>& task);
+
 // For debugging
 inline void serial_for(size_t begin, size_t end, const std::function<void(size_t index)>& task)
 {
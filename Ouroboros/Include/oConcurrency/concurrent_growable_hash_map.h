@@ -0,0 +1,777 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+// A concurrent hash map that grows itself. It uses the same linear-probe layout
+// as concurrent_hash_map, but when a table gets too full (including derelict
+// keys) a new table is allocated and entries are migrated a chunk at a time by
+// whichever writers come along, in the style of Cliff Click's non-blocking
+// hash table: http://www.azulsystems.com/events/javaone_2007/2007_LockFreeHash.pdf
+// Readers and writers keep running against either table during a migration.
+// Only the root table migrates. If its next table fills up before the
+// migration is done, keys that don't fit, including copies, go to a table
+// chained after that one, which migrates once the table before it has been
+// promoted. So a migration never runs out of room. Running out of memory
+// while copying terminates instead of leaving other threads waiting on a
+// migration that can't finish.
+//
+// Each slot's value lives in the low 32 bits of a 64-bit word whose upper bits
+// say whether the slot has ever been written (live) and whether it has been
+// frozen for migration (moved). A frozen slot keeps its value so any thread
+// that encounters it can finish copying it to the next table before reading or
+// writing there, so a newer write in the next table is never overwritten by an
+// older copy.
+//
+// nix() erases a key: the value is set to the invalid value and the key is
+// left as a tombstone so probe sequences stay intact. Tombstones are not
+// copied by a migration, so they are physically reclaimed the next time the
+// table migrates, which is triggered by claimed keys rather than live entries.
+// A migration sizes the next table by the live count, so a table full of
+// tombstones is rebuilt at the same size rather than doubling.
+//
+// Retired tables are freed by epoch-based reclamation: each operation pins
+// the current epoch on a per-thread stripe and a retired table is freed once
+// the epoch has advanced twice past its retirement.
+//
+// size() is O(1): each thread adds its inserts and erases to its own stripe
+// and size() sums the stripes, so it's approximate while there are writes in
+// flight.
+//
+// Keys cannot be 0 and should be well-distributed hashes. Values must be
+// integral types no larger than 32 bits.
+
+#pragma once
+#include <oArch/arch.h>
+#include <oConcurrency/backoff.h>
+#include <oCore/bit.h>
+#include <oCore/byte.h>
+#include <oMemory/allocate.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+
+namespace ouro {
+
+template<typename keyT, typename valT>
+class concurrent_growable_hash_map
+{
+	static_assert(std::is_integral<valT>::value && sizeof(valT) <= sizeof(uint32_t), "values must be integral and no larger than 32 bits");
+
+public:
+	typedef uint32_t size_type;
+	typedef keyT     key_type;
+	typedef valT     val_type;
+
+	// return true to keep traversing, false to exit early
+	typedef bool (*visitor_fn)(key_type key, val_type value, void* user);
+
+	// return true if the key can be retired, false if value is still valid
+	typedef bool (*retire_fn)(const val_type& value, const val_type& nul_value, void* user);
+
+	static const size_type default_capacity = 1024;
+	static const size_type num_stripes = 16;
+
+
+	// === non-concurrent api ===
+
+	concurrent_growable_hash_map();                                                 // constructs an empty hash map
+	concurrent_growable_hash_map(concurrent_growable_hash_map&& that);              // moves another hash map into a new one
+	concurrent_growable_hash_map(const val_type& invalid, size_type capacity = default_capacity, const char* label = "concurrent_growable_hash_map", const allocator& a = default_allocator);
+	~concurrent_growable_hash_map();                                                // dtor
+	concurrent_growable_hash_map& operator=(concurrent_growable_hash_map&& that);   // assignment via move
+
+	// capacity is the initial number of key-value pairs and the minimum size the
+	// map will shrink back to when compacting
+	void      initialize(const val_type& invalid, size_type capacity = default_capacity, const char* label = "concurrent_growable_hash_map", const allocator& a = default_allocator);
+	void      deinitialize();                                                       // frees all tables
+	bool      valid()        const { return !!root_.load(std::memory_order_relaxed); } // true if this has been initialized
+	void      clear();                                                              // returns the hash map to the empty state
+	size_type reclaim_keys();                                                       // finishes any migration, frees retired tables and compacts out tombstones; returns the number of keys removed
+	size_type reclaim_keys(retire_fn retire, void* user);                           // reclaim_keys, but additionally erase keys based on a value test other than for nul
+	void      visit(visitor_fn visitor, void* user);                                // visit valid values
+
+	template<typename visitorT>
+	void visit(visitorT visitor); // std::function form (must be bool visit(key_type k, val_type v)) (return true to keep traversing, false to exit early)
+
+
+	// === concurrent api ===
+
+	size_type size()         const;                                                 // approximate number of valid entries (sums per-thread stripes)
+	bool      empty()        const { return size() == 0; }                          // true if no entries are valid
+	size_type capacity()     const;                                                 // key-value pairs the current table can hold before it must grow
+	val_type  nul()          const { return nul_val_; }                             // returns the nul val set at init time
+	val_type  nix(const key_type& key);                                             // erases key and returns its prior value
+	val_type  set(const key_type& key, const val_type& value);                      // sets key to value and returns prior
+	bool      cas(const key_type& key, val_type& old_value, const val_type& new_value); // compare-and-swap rules: a missing key compares equal to nul; on failure old_value receives the current value
+	val_type  get(const key_type& key) const;                                       // returns nul if no key/value exists
+
+private:
+	static const key_type nul_key_ = key_type(0);
+
+	// slot states; 0 means the slot's value has never been written
+	static const uint64_t live_bit  = 1ull << 32;
+	static const uint64_t moved_bit = 1ull << 33;
+	static const uint64_t val_mask  = 0xffffffffull;
+
+	static const size_type npos = size_type(-1);
+	static const size_type migrate_chunk_size = 256;
+
+	typedef std::atomic<key_type> atm_key_t;
+	typedef std::atomic<uint64_t> atm_slot_t;
+
+	struct table
+	{
+		std::atomic<table*>    next;         // table being migrated into
+		std::atomic<size_type> used;         // keys claimed, including tombstones
+		std::atomic<size_type> copy_cursor;  // next slot to migrate
+		std::atomic<size_type> copied;       // slots migrated
+		table*                 retired_next; // list of tables waiting to be freed
+		uint32_t               retire_epoch;
+		size_type              mod;          // modulo treated as a pow-of-two size - 1 'and' mask
+		atm_key_t*             keys;
+		atm_slot_t*            slots;
+
+		size_type capacity()  const { return mod + 1; }
+		size_type threshold() const { return capacity() - (capacity() >> 2); }
+	};
+
+	// per-thread-stripe counters for epoch pins and the size delta
+	struct stripe
+	{
+		alignas(oCACHE_LINE_SIZE) std::atomic<int32_t> pins[2];
+		std::atomic<int32_t> size;
+	};
+
+	class pin_scope
+	{
+	public:
+		pin_scope(const concurrent_growable_hash_map* m);
+		~pin_scope() { s.pins[parity].fetch_sub(1, std::memory_order_release); }
+	private:
+		stripe& s;
+		uint32_t parity;
+		pin_scope(const pin_scope&); /* = delete */
+		const pin_scope& operator=(const pin_scope&); /* = delete */
+	};
+
+	mutable stripe        stripes_[num_stripes];
+	std::atomic<table*>   root_;
+	std::atomic<table*>   retired_;
+	std::atomic<uint32_t> epoch_;
+	std::atomic_flag      reclaiming_;
+	val_type              nul_val_;
+	size_type             min_capacity_;
+	allocator             alloc_;
+	const char*           label_;
+
+	static size_type this_stripe();
+	static uint64_t  pack(const val_type& value) { return live_bit | uint64_t(uint32_t(value)); }
+	static val_type  unpack(uint64_t word)       { return val_type(uint32_t(word & val_mask)); }
+
+	val_type  value_of(uint64_t word) const      { return (word & live_bit) ? unpack(word) : nul_val_; }
+	void      add_size(int32_t delta) const      { stripes_[this_stripe()].size.fetch_add(delta, std::memory_order_relaxed); }
+
+	table*    new_table(size_type capacity);
+	void      free_table(table* t);
+	void      free_retired();
+
+	// returns the slot index of key or npos if it's not in t. If claim is true
+	// and key isn't in t this tries to claim a slot for it and returns npos only
+	// if t is full.
+	static size_type find(table* t, const key_type& key, bool claim);
+
+	// migration
+	table*    append_next(table* t);
+	table*    ensure_next(table* t);
+	void      start_migration(table* t);
+	void      copy_slot(table* t, table* n, size_type index, uint64_t word) noexcept;
+	bool      migrate_chunk(table* t) noexcept;
+	void      finish_migration(table* t);
+	void      promote(table* t);
+	void      try_reclaim();
+
+	// reads or updates key, following it into newer tables as needed. fn
+	// receives the current value and returns true with the new value to write
+	// it, or false to leave it as is.
+	template<typename fnT> val_type update(const key_type& key, bool insert, fnT fn);
+
+	concurrent_growable_hash_map(const concurrent_growable_hash_map&); /* = delete */
+	const concurrent_growable_hash_map& operator=(const concurrent_growable_hash_map&); /* = delete */
+};
+
+template<typename keyT, typename valT>
+concurrent_growable_hash_map<keyT, valT>::pin_scope::pin_scope(const concurrent_growable_hash_map* m)
+	: s(m->stripes_[this_stripe()])
+{
+	parity = m->epoch_.load(std::memory_order_acquire) & 1;
+	s.pins[parity].fetch_add(1, std::memory_order_seq_cst);
+}
+
+template<typename keyT, typename valT>
+typename concurrent_growable_hash_map<keyT, valT>::size_type concurrent_growable_hash_map<keyT, valT>::this_stripe()
+{
+	static std::atomic<size_type> next_stripe(0);
+	static thread_local size_type index = npos;
+	if (index == npos)
+		index = next_stripe.fetch_add(1, std::memory_order_relaxed) & (num_stripes - 1);
+	return index;
+}
+
+template<typename keyT, typename valT>
+concurrent_growable_hash_map<keyT, valT>::concurrent_growable_hash_map()
+	: root_(nullptr)
+	, retired_(nullptr)
+	, epoch_(0)
+	, nul_val_(0)
+	, min_capacity_(0)
+	, label_(nullptr)
+{
+	reclaiming_.clear();
+	for (auto& s : stripes_)
+		s.pins[0] = s.pins[1] = s.size = 0;
+}
+
+template<typename keyT, typename valT>
+concurrent_growable_hash_map<keyT, valT>::concurrent_growable_hash_map(concurrent_growable_hash_map&& that)
+	: root_(nullptr)
+	, retired_(nullptr)
+	, epoch_(0)
+	, nul_val_(0)
+	, min_capacity_(0)
+	, label_(nullptr)
+{
+	reclaiming_.clear();
+	for (auto& s : stripes_)
+		s.pins[0] = s.pins[1] = s.size = 0;
+	*this = std::move(that);
+}
+
+template<typename keyT, typename valT>
+concurrent_growable_hash_map<keyT, valT>::concurrent_growable_hash_map(const val_type& invalid, size_type capacity, const char* label, const allocator& a)
+	: root_(nullptr)
+	, retired_(nullptr)
+	, epoch_(0)
+	, nul_val_(0)
+	, min_capacity_(0)
+	, label_(nullptr)
+{
+	reclaiming_.clear();
+	for (auto& s : stripes_)
+		s.pins[0] = s.pins[1] = s.size = 0;
+	initialize(invalid, capacity, label, a);
+}
+
+template<typename keyT, typename valT>
+concurrent_growable_hash_map<keyT, valT>::~concurrent_growable_hash_map()
+{
+	deinitialize();
+}
+
+template<typename keyT, typename valT>
+concurrent_growable_hash_map<keyT, valT>& concurrent_growable_hash_map<keyT, valT>::operator=(concurrent_growable_hash_map&& that)
+{
+	if (this != &that)
+	{
+		deinitialize();
+		root_         = that.root_.exchange(nullptr);
+		retired_      = that.retired_.exchange(nullptr);
+		epoch_        = that.epoch_.exchange(0);
+		nul_val_      = that.nul_val_;      that.nul_val_      = 0;
+		min_capacity_ = that.min_capacity_; that.min_capacity_ = 0;
+		alloc_        = that.alloc_;        that.alloc_        = allocator();
+		label_        = that.label_;        that.label_        = nullptr;
+		for (size_type i = 0; i < num_stripes; i++)
+			stripes_[i].size = that.stripes_[i].size.exchange(0);
+	}
+	return *this;
+}
+
+template<typename keyT, typename valT>
+void concurrent_growable_hash_map<keyT, valT>::initialize(const val_type& invalid, size_type capacity, const char* label, const allocator& a)
+{
+	deinitialize();
+	nul_val_      = invalid;
+	alloc_        = a;
+	label_        = label;
+	min_capacity_ = std::max(size_type(8), (size_type)nextpow2(capacity * 2)); // 2x memory and a power-of-two size is required for performance
+	root_         = new_table(min_capacity_);
+}
+
+template<typename keyT, typename valT>
+void concurrent_growable_hash_map<keyT, valT>::deinitialize()
+{
+	table* t = root_.exchange(nullptr);
+	while (t)
+	{
+		table* n = t->next;
+		free_table(t);
+		t = n;
+	}
+
+	free_retired();
+
+	for (auto& s : stripes_)
+		s.size = 0;
+}
+
+template<typename keyT, typename valT>
+typename concurrent_growable_hash_map<keyT, valT>::table* concurrent_growable_hash_map<keyT, valT>::new_table(size_type capacity)
+{
+	const size_type header_bytes = (size_type)align(sizeof(table), oCACHE_LINE_SIZE);
+	const size_type key_bytes    = (size_type)align(capacity * sizeof(atm_key_t), sizeof(atm_slot_t));
+	const size_type slot_bytes   = capacity * (size_type)sizeof(atm_slot_t);
+
+	void* mem = alloc_.allocate(header_bytes + key_bytes + slot_bytes, label_, memory_alignment::cacheline);
+	if (!mem)
+		throw std::bad_alloc();
+
+	table* t        = new (mem) table();
+	t->next         = nullptr;
+	t->used         = 0;
+	t->copy_cursor  = 0;
+	t->copied       = 0;
+	t->retired_next = nullptr;
+	t->retire_epoch = 0;
+	t->mod          = capacity - 1;
+	t->keys         = (atm_key_t*)((uint8_t*)mem + header_bytes);
+	t->slots        = (atm_slot_t*)((uint8_t*)t->keys + key_bytes);
+
+	memset(t->keys,  0, capacity * sizeof(atm_key_t)); // zero key implied an available slot, so no user key can be zero
+	memset(t->slots, 0, slot_bytes);
+	return t;
+}
+
+template<typename keyT, typename valT>
+void concurrent_growable_hash_map<keyT, valT>::free_table(table* t)
+{
+	t->~table();
+	alloc_.deallocate(t);
+}
+
+template<typename keyT, typename valT>
+void concurrent_growable_hash_map<keyT, valT>::free_retired()
+{
+	table* t = retired_.exchange(nullptr);
+	while (t)
+	{
+		table* n = t->retired_next;
+		free_table(t);
+		t = n;
+	}
+}
+
+template<typename keyT, typename valT>
+void concurrent_growable_hash_map<keyT, valT>::clear()
+{
+	finish_migration(root_);
+	free_retired();
+
+	table* t = root_;
+	memset(t->keys,  0, t->capacity() * sizeof(atm_key_t));
+	memset(t->slots, 0, t->capacity() * sizeof(atm_slot_t));
+	t->used = 0;
+
+	for (auto& s : stripes_)
+		s.size = 0;
+}
+
+template<typename keyT, typename valT>
+typename concurrent_growable_hash_map<keyT, valT>::size_type concurrent_growable_hash_map<keyT, valT>::size() const
+{
+	int32_t n = 0;
+	for (const auto& s : stripes_)
+		n += s.size.load(std::memory_order_relaxed);
+	return n > 0 ? size_type(n) : 0;
+}
+
+template<typename keyT, typename valT>
+typename concurrent_growable_hash_map<keyT, valT>::size_type concurrent_growable_hash_map<keyT, valT>::capacity() const
+{
+	pin_scope pin(this);
+	table* t = root_.load(std::memory_order_acquire);
+	table* n = t->next.load(std::memory_order_acquire);
+	return (n ? n : t)->threshold();
+}
+
+template<typename keyT, typename valT>
+typename concurrent_growable_hash_map<keyT, valT>::size_type concurrent_growable_hash_map<keyT, valT>::find(table* t, const key_type& key, bool claim)
+{
+	size_type i = size_type(key) & t->mod;
+	for (size_type j = 0; j <= t->mod; j++, i = (i + 1) & t->mod)
+	{
+		key_type probed = t->keys[i].load(std::memory_order_acquire);
+		if (probed == key)
+			return i;
+
+		// invoke the 'linear' in linear probe hashmap: skip a seemingly valid key and look for the next available slot
+		if (probed != nul_key_)
+			continue;
+
+		// a nul key ends the probe: the key was never inserted
+		if (!claim)
+			return npos;
+
+		// try inserting a new key and double-test to protect against another thread inserting the same key
+		if (t->keys[i].compare_exchange_strong(probed, key, std::memory_order_acq_rel))
+		{
+			t->used.fetch_add(1, std::memory_order_relaxed);
+			return i;
+		}
+
+		if (probed == key)
+			return i;
+	}
+
+	return npos;
+}
+
+template<typename keyT, typename valT>
+typename concurrent_growable_hash_map<keyT, valT>::table* concurrent_growable_hash_map<keyT, valT>::ensure_next(table* t)
+{
+	table* n = t->next.load(std::memory_order_acquire);
+	if (!n)
+	{
+		start_migration(t);
+		n = t->next.load(std::memory_order_acquire);
+	}
+	return n;
+}
+
+template<typename keyT, typename valT>
+void concurrent_growable_hash_map<keyT, valT>::start_migration(table* t)
+{
+	if (t->next.load(std::memory_order_acquire))
+		return;
+
+	// only the root migrates, so if t is itself the target of a migration then
+	// finish that first
+	table* r = root_.load(std::memory_order_acquire);
+	if (r != t)
+	{
+		finish_migration(r);
+		if (t->next.load(std::memory_order_acquire))
+			return;
+	}
+
+	try_reclaim();
+	append_next(t);
+}
+
+template<typename keyT, typename valT>
+typename concurrent_growable_hash_map<keyT, valT>::table* concurrent_growable_hash_map<keyT, valT>::append_next(table* t)
+{
+	table* n = t->next.load(std::memory_order_acquire);
+	if (n)
+		return n;
+
+	// size for the live entries only so tombstones are dropped: a table full of
+	// live entries doubles while one mostly full of tombstones is rebuilt at the
+	// same or a smaller size
+	const size_type live = std::max(size(), size_type(1));
+	n = new_table(std::max(min_capacity_, (size_type)nextpow2(live * 2)));
+	table* expected = nullptr;
+	if (t->next.compare_exchange_strong(expected, n, std::memory_order_acq_rel))
+		return n;
+
+	free_table(n); // another thread won
+	return expected;
+}
+
+template<typename keyT, typename valT>
+void concurrent_growable_hash_map<keyT, valT>::copy_slot(table* t, table* n, size_type index, uint64_t word) noexcept
+{
+	// copy a frozen value into the next table only if no newer write has
+	// occurred there. Tombstones and never-written slots are dropped.
+	if (!(word & live_bit) || unpack(word) == nul_val_)
+		return;
+
+	const key_type key = t->keys[index].load(std::memory_order_acquire);
+	for (;;)
+	{
+		const size_type i = find(n, key, true);
+		if (i != npos)
+		{
+			// done if this copied the value or a newer write got there first (which
+			// n's own migration carries forward if it's frozen)
+			uint64_t expected = 0;
+			if (n->slots[i].compare_exchange_strong(expected, word & ~moved_bit, std::memory_order_acq_rel) || expected != moved_bit)
+				return;
+		}
+
+		// n is full or it froze the key's slot before anything was written there,
+		// so the value belongs in the table after n
+		n = append_next(n);
+	}
+}
+
+template<typename keyT, typename valT>
+bool concurrent_growable_hash_map<keyT, valT>::migrate_chunk(table* t) noexcept
+{
+	// a chained table waits for the tables before it to be promoted so copies
+	// into it are never lost
+	if (root_.load(std::memory_order_acquire) != t)
+		return false;
+
+	table* n = t->next.load(std::memory_order_acquire);
+	const size_type start = t->copy_cursor.fetch_add(migrate_chunk_size, std::memory_order_relaxed);
+	if (start > t->mod)
+		return false;
+
+	const size_type end = std::min(start + migrate_chunk_size, t->capacity());
+	for (size_type i = start; i < end; i++)
+	{
+		// freezing every slot, even unused ones, ensures no write can land in t
+		// after its slot has been copied
+		const uint64_t word = t->slots[i].fetch_or(moved_bit, std::memory_order_acq_rel);
+		if (!(word & moved_bit))
+			copy_slot(t, n, i, word);
+	}
+
+	if (t->copied.fetch_add(end - start, std::memory_order_acq_rel) + (end - start) == t->capacity())
+		promote(t);
+
+	return true;
+}
+
+template<typename keyT, typename valT>
+void concurrent_growable_hash_map<keyT, valT>::finish_migration(table* t)
+{
+	while (t->next.load(std::memory_order_acquire))
+	{
+		while (migrate_chunk(t));
+
+		// wait for other threads to finish chunks they've claimed
+		backoff bo;
+		while (root_.load(std::memory_order_acquire) == t)
+			bo.pause();
+
+		t = root_.load(std::memory_order_acquire);
+	}
+}
+
+template<typename keyT, typename valT>
+void concurrent_growable_hash_map<keyT, valT>::promote(table* t)
+{
+	table* n = t->next.load(std::memory_order_acquire);
+	root_.store(n, std::memory_order_seq_cst);
+
+	t->retire_epoch = epoch_.load(std::memory_order_seq_cst);
+	table* head = retired_.load(std::memory_order_relaxed);
+	do { t->retired_next = head; } while (!retired_.compare_exchange_weak(head, t, std::memory_order_release));
+
+	try_reclaim();
+}
+
+template<typename keyT, typename valT>
+void concurrent_growable_hash_map<keyT, valT>::try_reclaim()
+{
+	if (reclaiming_.test_and_set(std::memory_order_acquire))
+		return;
+
+	// advance the epoch if no thread is still pinned in the previous one
+	uint32_t e = epoch_.load(std::memory_order_seq_cst);
+	int32_t pinned = 0;
+	for (const auto& s : stripes_)
+		pinned += s.pins[(e + 1) & 1].load(std::memory_order_seq_cst);
+	if (!pinned && epoch_.compare_exchange_strong(e, e + 1, std::memory_order_seq_cst))
+		e++;
+
+	// free tables retired at least two epochs ago
+	table* t = retired_.exchange(nullptr, std::memory_order_acquire);
+	while (t)
+	{
+		table* next = t->retired_next;
+		if (e - t->retire_epoch >= 2)
+			free_table(t);
+		else
+		{
+			table* head = retired_.load(std::memory_order_relaxed);
+			do { t->retired_next = head; } while (!retired_.compare_exchange_weak(head, t, std::memory_order_release));
+		}
+		t = next;
+	}
+
+	reclaiming_.clear(std::memory_order_release);
+}
+
+template<typename keyT, typename valT> template<typename fnT>
+typename concurrent_growable_hash_map<keyT, valT>::val_type concurrent_growable_hash_map<keyT, valT>::update(const key_type& key, bool insert, fnT fn)
+{
+	if (key == nul_key_)
+		throw std::invalid_argument("key must be non-zero");
+
+	pin_scope pin(this);
+	table* t = root_.load(std::memory_order_acquire);
+	for (;;)
+	{
+		table* n = t->next.load(std::memory_order_acquire);
+		if (n)
+			migrate_chunk(t);
+
+		const size_type i = find(t, key, insert);
+		if (insert && !n && t->used.load(std::memory_order_relaxed) >= t->threshold())
+			start_migration(t);
+
+		if (i == npos)
+		{
+			// the key isn't here and t can't take it, so it goes in the next table
+			if (insert)
+				n = ensure_next(t);
+			if (!n)
+				return nul_val_;
+			t = n;
+			continue;
+		}
+
+		uint64_t word = t->slots[i].load(std::memory_order_acquire);
+		for (;;)
+		{
+			if (word & moved_bit)
+				break;
+
+			const val_type prior = value_of(word);
+			val_type value = prior;
+			if (!fn(value))
+				return prior;
+
+			if (t->slots[i].compare_exchange_weak(word, pack(value), std::memory_order_acq_rel))
+			{
+				if (prior == nul_val_ && value != nul_val_)
+					add_size(1);
+				else if (prior != nul_val_ && value == nul_val_)
+					add_size(-1);
+				return prior;
+			}
+		}
+
+		// the slot has been frozen for migration: make sure its value made it to
+		// the next table, then continue there
+		n = t->next.load(std::memory_order_acquire);
+		copy_slot(t, n, i, word);
+		t = n;
+	}
+}
+
+template<typename keyT, typename valT>
+typename concurrent_growable_hash_map<keyT, valT>::val_type concurrent_growable_hash_map<keyT, valT>::nix(const key_type& key)
+{
+	const val_type nul = nul_val_;
+	return update(key, false, [&](val_type& value) { if (value == nul) return false; value = nul; return true; });
+}
+
+template<typename keyT, typename valT>
+typename concurrent_growable_hash_map<keyT, valT>::val_type concurrent_growable_hash_map<keyT, valT>::set(const key_type& key, const val_type& value)
+{
+	return update(key, true, [&](val_type& v) { v = value; return true; });
+}
+
+template<typename keyT, typename valT>
+bool concurrent_growable_hash_map<keyT, valT>::cas(const key_type& key, val_type& old_value, const val_type& new_value)
+{
+	const val_type expected = old_value;
+	old_value = update(key, true, [&](val_type& v) { if (v != expected) return false; v = new_value; return true; });
+	return old_value == expected;
+}
+
+template<typename keyT, typename valT>
+typename concurrent_growable_hash_map<keyT, valT>::val_type concurrent_growable_hash_map<keyT, valT>::get(const key_type& key) const
+{
+	if (key == nul_key_)
+		throw std::invalid_argument("key must be non-zero");
+
+	auto self = const_cast<concurrent_growable_hash_map*>(this);
+
+	pin_scope pin(this);
+	table* t = root_.load(std::memory_order_acquire);
+	for (;;)
+	{
+		const size_type i = find(t, key, false);
+		if (i == npos)
+		{
+			// a writer that found t full may have put the key in the next table
+			table* n = t->next.load(std::memory_order_acquire);
+			if (!n)
+				return nul_val_;
+			t = n;
+			continue;
+		}
+
+		const uint64_t word = t->slots[i].load(std::memory_order_acquire);
+		if (!(word & moved_bit))
+			return value_of(word);
+
+		// the slot was frozen so the next table is set
+		table* n = t->next.load(std::memory_order_acquire);
+		self->copy_slot(t, n, i, word);
+		t = n;
+	}
+}
+
+template<typename keyT, typename valT>
+typename concurrent_growable_hash_map<keyT, valT>::size_type concurrent_growable_hash_map<keyT, valT>::reclaim_keys()
+{
+	return reclaim_keys([](const val_type& value, const val_type& nul_value, void* user) { return false; }, nullptr);
+}
+
+template<typename keyT, typename valT>
+typename concurrent_growable_hash_map<keyT, valT>::size_type concurrent_growable_hash_map<keyT, valT>::reclaim_keys(retire_fn retire, void* user)
+{
+	finish_migration(root_);
+	free_retired();
+
+	// erase keys whose value is retired, then rebuild to drop all tombstones
+	table* t = root_;
+	size_type n = 0;
+	for (size_type i = 0; i <= t->mod; i++)
+	{
+		if (t->keys[i] == nul_key_)
+			continue;
+
+		const uint64_t word = t->slots[i];
+		const val_type value = value_of(word);
+		if (value == nul_val_ || retire(value, nul_val_, user))
+		{
+			if (value != nul_val_)
+				add_size(-1);
+			t->slots[i] = pack(nul_val_);
+			n++;
+		}
+	}
+
+	if (n)
+	{
+		start_migration(t);
+		finish_migration(t);
+		free_retired();
+	}
+
+	return n;
+}
+
+template<typename keyT, typename valT>
+void concurrent_growable_hash_map<keyT, valT>::visit(visitor_fn visitor, void* user)
+{
+	visit([&](key_type key, val_type value) { return visitor(key, value, user); });
+}
+
+template<typename keyT, typename valT> template<typename visitorT>
+void concurrent_growable_hash_map<keyT, valT>::visit(visitorT visitor)
+{
+	// visit the latest table; if another migration starts meanwhile, frozen
+	// slots still hold their last value
+	pin_scope pin(this);
+	finish_migration(root_);
+	table* t = root_.load(std::memory_order_acquire);
+	for (size_type i = 0; i <= t->mod; i++)
+	{
+		const key_type key = t->keys[i].load(std::memory_order_acquire);
+		const val_type value = value_of(t->slots[i].load(std::memory_order_acquire));
+		if (key != nul_key_ && value != nul_val_)
+			if (!visitor(key, value))
+				return;
+	}
+}
+
+}
@@ -0,0 +1,343 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+// Bounded array-based concurrent FIFO queue based on:
+// http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+// Each cell carries a sequence number that says whether it's ready to be
+// written or read for a given lap around the ring, so a push or pop is one CAS
+// on a position counter and one store to the cell, with no node allocation.
+// The producer and consumer positions are on separate cachelines.
+//
+// The policy specifies whether there can be more than one producer and/or
+// consumer. A side with only one thread claims positions with a plain store
+// rather than a CAS.
+//
+// try_push_n/try_pop_n claim a run of positions with one CAS. Because a
+// claimed cell may still be in use by a thread from the other side that has
+// claimed but not yet finished with it from the previous lap, the batch
+// versions briefly spin on such cells.
+
+#pragma once
+#include <oArch/arch.h>
+#include <oConcurrency/backoff.h>
+#include <oMemory/allocate.h>
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace ouro {
+
+struct ring_queue_mpmc { static const bool multi_producer = true;  static const bool multi_consumer = true;  };
+struct ring_queue_mpsc { static const bool multi_producer = true;  static const bool multi_consumer = false; };
+struct ring_queue_spsc { static const bool multi_producer = false; static const bool multi_consumer = false; };
+
+template<typename T, typename Policy = ring_queue_mpmc>
+class concurrent_ring_queue
+{
+public:
+	typedef uint32_t size_type;
+	typedef T value_type;
+	typedef value_type& reference;
+	typedef const value_type& const_reference;
+	typedef value_type* pointer;
+	typedef const value_type* const_pointer;
+	typedef Policy policy_type;
+
+	static const size_type default_capacity = 65536;
+
+
+	// non-concurrent api
+
+	// capacity is rounded up to a power of two.
+	concurrent_ring_queue(size_type capacity = default_capacity, const char* label = "concurrent_ring_queue", const allocator& a = default_allocator);
+	~concurrent_ring_queue();
+
+	size_type capacity() const { return size_type(mask + 1); }
+
+
+	// concurrent api
+
+	// Returns false if the queue is full
+	bool try_push(const_reference val);
+	bool try_push(value_type&& val);
+
+	// Spins until there is room in the queue
+	void push(const_reference val);
+	void push(value_type&& val);
+
+	// Copies up to count elements from vals and returns the number pushed,
+	// which is less than count only if the queue filled up.
+	size_type try_push_n(const_pointer vals, size_type count);
+
+	// Returns false if the queue is empty
+	bool try_pop(reference val);
+
+	// Spins until an element can be popped from the queue
+	void pop(reference val);
+
+	// Moves up to count elements into vals and returns the number popped.
+	size_type try_pop_n(pointer vals, size_type count);
+
+	// Spins until the queue is empty
+	void clear();
+
+	// Returns true if no elements are in the queue
+	bool empty() const;
+
+	// Returns the number of elements, which is only exact if there are no
+	// concurrent operations.
+	size_type size() const;
+
+private:
+	struct cell
+	{
+		std::atomic<size_t> sequence;
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+		pointer value() { return reinterpret_cast<pointer>(&storage); }
+	};
+
+	alignas(oCACHE_LINE_SIZE) std::atomic<size_t> enqueue_pos;
+	alignas(oCACHE_LINE_SIZE) std::atomic<size_t> dequeue_pos;
+	alignas(oCACHE_LINE_SIZE) cell* cells;
+	size_t mask;
+	allocator alloc;
+
+	// Claims count positions starting at pos if the side is still at pos. For a
+	// single-threaded side this always succeeds.
+	static bool claim(std::atomic<size_t>& side, size_t& pos, size_t count, std::true_type);
+	static bool claim(std::atomic<size_t>& side, size_t& pos, size_t count, std::false_type);
+
+	cell* claim_push();
+	cell* claim_pop();
+
+	concurrent_ring_queue(const concurrent_ring_queue&); /* = delete */
+	const concurrent_ring_queue& operator=(const concurrent_ring_queue&); /* = delete */
+};
+
+template<typename T, typename Policy>
+concurrent_ring_queue<T, Policy>::concurrent_ring_queue(size_type capacity, const char* label, const allocator& a)
+	: enqueue_pos(0)
+	, dequeue_pos(0)
+	, alloc(a)
+{
+	size_t pot = 2;
+	while (pot < capacity)
+		pot <<= 1;
+	mask = pot - 1;
+
+	cells = (cell*)alloc.allocate(sizeof(cell) * pot, label, memory_alignment::cacheline);
+	if (!cells)
+		throw std::bad_alloc();
+	for (size_t i = 0; i < pot; i++)
+		cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+template<typename T, typename Policy>
+concurrent_ring_queue<T, Policy>::~concurrent_ring_queue()
+{
+	for (size_t pos = dequeue_pos, end = enqueue_pos; pos != end; pos++)
+		cells[pos & mask].value()->~T();
+	alloc.deallocate(cells);
+}
+
+template<typename T, typename Policy>
+bool concurrent_ring_queue<T, Policy>::claim(std::atomic<size_t>& side, size_t& pos, size_t count, std::true_type)
+{
+	return side.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed);
+}
+
+template<typename T, typename Policy>
+bool concurrent_ring_queue<T, Policy>::claim(std::atomic<size_t>& side, size_t& pos, size_t count, std::false_type)
+{
+	side.store(pos + count, std::memory_order_relaxed);
+	return true;
+}
+
+template<typename T, typename Policy>
+typename concurrent_ring_queue<T, Policy>::cell* concurrent_ring_queue<T, Policy>::claim_push()
+{
+	size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		cell* c = &cells[pos & mask];
+		const intptr_t dif = intptr_t(c->sequence.load(std::memory_order_acquire)) - intptr_t(pos);
+		if (dif == 0)
+		{
+			if (claim(enqueue_pos, pos, 1, std::integral_constant<bool, Policy::multi_producer>()))
+				return c;
+		}
+		else if (dif < 0)
+			return nullptr; // full
+		else
+			pos = enqueue_pos.load(std::memory_order_relaxed);
+	}
+}
+
+template<typename T, typename Policy>
+typename concurrent_ring_queue<T, Policy>::cell* concurrent_ring_queue<T, Policy>::claim_pop()
+{
+	size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		cell* c = &cells[pos & mask];
+		const intptr_t dif = intptr_t(c->sequence.load(std::memory_order_acquire)) - intptr_t(pos + 1);
+		if (dif == 0)
+		{
+			if (claim(dequeue_pos, pos, 1, std::integral_constant<bool, Policy::multi_consumer>()))
+				return c;
+		}
+		else if (dif < 0)
+			return nullptr; // empty
+		else
+			pos = dequeue_pos.load(std::memory_order_relaxed);
+	}
+}
+
+template<typename T, typename Policy>
+bool concurrent_ring_queue<T, Policy>::try_push(const_reference val)
+{
+	cell* c = claim_push();
+	if (!c)
+		return false;
+	const size_t pos = c->sequence.load(std::memory_order_relaxed);
+	::new (c->value()) T(val);
+	c->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+template<typename T, typename Policy>
+bool concurrent_ring_queue<T, Policy>::try_push(value_type&& val)
+{
+	cell* c = claim_push();
+	if (!c)
+		return false;
+	const size_t pos = c->sequence.load(std::memory_order_relaxed);
+	::new (c->value()) T(std::move(val));
+	c->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+template<typename T, typename Policy>
+void concurrent_ring_queue<T, Policy>::push(const_reference val)
+{
+	backoff bo;
+	while (!try_push(val))
+		bo.pause();
+}
+
+template<typename T, typename Policy>
+void concurrent_ring_queue<T, Policy>::push(value_type&& val)
+{
+	backoff bo;
+	while (!try_push(std::move(val)))
+		bo.pause();
+}
+
+template<typename T, typename Policy>
+bool concurrent_ring_queue<T, Policy>::try_pop(reference val)
+{
+	cell* c = claim_pop();
+	if (!c)
+		return false;
+	const size_t pos = c->sequence.load(std::memory_order_relaxed) - 1;
+	pointer p = c->value();
+	val = std::move(*p);
+	p->~T();
+	c->sequence.store(pos + mask + 1, std::memory_order_release);
+	return true;
+}
+
+template<typename T, typename Policy>
+void concurrent_ring_queue<T, Policy>::pop(reference val)
+{
+	backoff bo;
+	while (!try_pop(val))
+		bo.pause();
+}
+
+template<typename T, typename Policy>
+typename concurrent_ring_queue<T, Policy>::size_type concurrent_ring_queue<T, Policy>::try_push_n(const_pointer vals, size_type count)
+{
+	size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+	size_t n = 0;
+	do
+	{
+		// positions below dequeue_pos have been claimed by consumers, so cells
+		// up to a lap beyond it will become free without any further pops
+		const size_t limit = dequeue_pos.load(std::memory_order_acquire) + mask + 1;
+		n = limit > pos ? (limit - pos) : 0;
+		if (n > count)
+			n = count;
+		if (!n)
+			return 0;
+	} while (!claim(enqueue_pos, pos, n, std::integral_constant<bool, Policy::multi_producer>()));
+
+	for (size_t i = 0; i < n; i++)
+	{
+		cell* c = &cells[(pos + i) & mask];
+		backoff bo;
+		while (c->sequence.load(std::memory_order_acquire) != pos + i)
+			bo.pause();
+		::new (c->value()) T(vals[i]);
+		c->sequence.store(pos + i + 1, std::memory_order_release);
+	}
+
+	return size_type(n);
+}
+
+template<typename T, typename Policy>
+typename concurrent_ring_queue<T, Policy>::size_type concurrent_ring_queue<T, Policy>::try_pop_n(pointer vals, size_type count)
+{
+	size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+	size_t n = 0;
+	do
+	{
+		// positions below enqueue_pos have been claimed by producers that will
+		// publish them without any further pushes
+		const size_t limit = enqueue_pos.load(std::memory_order_acquire);
+		n = limit > pos ? (limit - pos) : 0;
+		if (n > count)
+			n = count;
+		if (!n)
+			return 0;
+	} while (!claim(dequeue_pos, pos, n, std::integral_constant<bool, Policy::multi_consumer>()));
+
+	for (size_t i = 0; i < n; i++)
+	{
+		cell* c = &cells[(pos + i) & mask];
+		backoff bo;
+		while (c->sequence.load(std::memory_order_acquire) != pos + i + 1)
+			bo.pause();
+		pointer p = c->value();
+		vals[i] = std::move(*p);
+		p->~T();
+		c->sequence.store(pos + i + mask + 1, std::memory_order_release);
+	}
+
+	return size_type(n);
+}
+
+template<typename T, typename Policy>
+void concurrent_ring_queue<T, Policy>::clear()
+{
+	value_type e;
+	while (try_pop(e));
+}
+
+template<typename T, typename Policy>
+bool concurrent_ring_queue<T, Policy>::empty() const
+{
+	return size() == 0;
+}
+
+template<typename T, typename Policy>
+typename concurrent_ring_queue<T, Policy>::size_type concurrent_ring_queue<T, Policy>::size() const
+{
+	const size_t d = dequeue_pos.load(std::memory_order_relaxed);
+	const size_t e = enqueue_pos.load(std::memory_order_relaxed);
+	return e > d ? size_type(e - d) : 0;
+}
+
+}
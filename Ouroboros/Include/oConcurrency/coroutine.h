@@ -2,6 +2,9 @@
 
 // An implementation of a stack based co-routine using a Duffs device
 // http://www.chiark.greenend.org.uk/~sgtatham/coroutines.html
+// Locals don't survive a yield here. Where the compiler supports coroutines, 
+// prefer task<T> in oConcurrency/task.h, which can also await futures, 
+// countdown_latches and events.
 
 // Example usage:
 /*
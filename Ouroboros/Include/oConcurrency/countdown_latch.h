@@ -8,8 +8,10 @@
 #pragma once
 #include <chrono>
 #include <condition_variable>
+#include <functional>
 #include <mutex>
 #include <stdexcept>
+#include <vector>
 
 namespace ouro {
 
@@ -73,10 +75,20 @@ public:
 	template<typename Rep, typename Period>
 	std::cv_status wait_for(const std::chrono::duration<Rep, Period>& relative_time);
 
+	// Calls fn once the number of outstanding items reaches zero rather than 
+	// blocking. fn is called immediately if the count is already zero, 
+	// otherwise it's called from the thread making the final release() so it 
+	// should be short, such as dispatching the real work. Each fn is called 
+	// once; reset() does not re-arm it.
+	void add_waiter(const std::function<void()>& fn);
+
 private:
 	std::condition_variable zero_references;
 	std::mutex mtx;
 	int num_outstanding;
+	std::vector<std::function<void()>> waiters;
+
+	void notify_zero(std::unique_lock<std::mutex>& lock);
 
 	countdown_latch(const countdown_latch&); /* = delete */
 	const countdown_latch& operator=(const countdown_latch&); /* = delete */
@@ -97,9 +109,10 @@ inline countdown_latch::countdown_latch(int initial_count)
 }
 
 inline countdown_latch::countdown_latch(countdown_latch&& that)
-	: num_outstanding(that.num_outstanding)
 {
-	std::lock_guard<std::mutex> Lock(that.mtx);
+	std::unique_lock<std::mutex> Lock(that.mtx);
+	num_outstanding = that.num_outstanding;
+	waiters = std::move(that.waiters);
 	that.num_outstanding = 0;
 	that.zero_references.notify_all();
 }
@@ -108,18 +121,30 @@ inline countdown_latch& countdown_latch::operator=(countdown_latch&& that)
 {
 	if (this != &that)
 	{
-		std::lock_guard<std::mutex> Lock1(mtx);
+		std::unique_lock<std::mutex> Lock1(mtx);
 		std::lock_guard<std::mutex> Lock2(that.mtx);
 
 		num_outstanding = that.num_outstanding; that.num_outstanding = 0;
-		if (--num_outstanding <= 0)
-			zero_references.notify_all();
-
+		waiters.insert(waiters.end(), that.waiters.begin(), that.waiters.end());
+		that.waiters.clear();
 		that.zero_references.notify_all();
+
+		if (--num_outstanding <= 0)
+			notify_zero(Lock1);
 	}
 	return *this;
 }
 
+inline void countdown_latch::notify_zero(std::unique_lock<std::mutex>& lock)
+{
+	std::vector<std::function<void()>> ready;
+	ready.swap(waiters);
+	lock.unlock();
+	zero_references.notify_all();
+	for (const auto& fn : ready)
+		fn();
+}
+
 inline int countdown_latch::outstanding() const
 {
 	return num_outstanding;
@@ -150,9 +175,9 @@ inline void countdown_latch::reference()
 
 inline void countdown_latch::release()
 {
-	std::lock_guard<std::mutex> Lock(mtx);
+	std::unique_lock<std::mutex> Lock(mtx);
 	if (--num_outstanding <= 0)
-		zero_references.notify_all();
+		notify_zero(Lock);
 }
 
 inline void countdown_latch::wait()
@@ -162,6 +187,18 @@ inline void countdown_latch::wait()
 		zero_references.wait(Lock);
 }
 
+inline void countdown_latch::add_waiter(const std::function<void()>& fn)
+{
+	std::unique_lock<std::mutex> Lock(mtx);
+	if (num_outstanding > 0)
+	{
+		waiters.push_back(fn);
+		return;
+	}
+	Lock.unlock();
+	fn();
+}
+
 template<typename Rep, typename Period>
 std::cv_status countdown_latch::wait_for(const std::chrono::duration<Rep, Period>& relative_time)
 {
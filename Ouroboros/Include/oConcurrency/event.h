@@ -11,7 +11,9 @@
 
 #pragma once
 #include <condition_variable>
+#include <functional>
 #include <mutex>
+#include <vector>
 
 namespace ouro {
 
@@ -74,9 +76,22 @@ public:
 	// Like is_set, but will return true if any bit in the mask is set
 	bool is_any_set(int mask = 1) const;
 
+	// Calls fn once all bits in mask are set rather than blocking. fn is called
+	// immediately if they already are, otherwise it's called from the thread
+	// calling set() so it should be short, such as dispatching the real work. 
+	// For an autoreset event each set() releases at most one such waiter.
+	void add_waiter(const std::function<void()>& fn, int mask = 1);
+
 private:
+	struct waiter
+	{
+		std::function<void()> fn;
+		int mask;
+	};
+
 	std::mutex mtx;
 	std::condition_variable cv;
+	std::vector<waiter> waiters;
 	int set_mask;
 	bool do_auto_reset;
 };
@@ -95,15 +110,43 @@ inline void event::set(int mask)
 {
 	if (!is_set(mask))
 	{
+		std::vector<waiter> ready;
+		std::unique_lock<std::mutex> lock(mtx);
 		if (do_auto_reset)
-			cv.notify_one();
+		{
+			for (auto it = waiters.begin(); it != waiters.end(); ++it)
+			{
+				if ((it->mask & mask) == it->mask)
+				{
+					ready.push_back(std::move(*it));
+					waiters.erase(it);
+					break;
+				}
+			}
+			lock.unlock();
+			if (ready.empty())
+				cv.notify_one();
+		}
 		else
 		{
-			mtx.lock();
 			set_mask |= mask;
-			mtx.unlock();
+			for (size_t i = 0; i < waiters.size();)
+			{
+				if (is_set(waiters[i].mask))
+				{
+					std::swap(waiters[i], waiters.back());
+					ready.push_back(std::move(waiters.back()));
+					waiters.pop_back();
+				}
+				else
+					i++;
+			}
+			lock.unlock();
 			cv.notify_all();
 		}
+
+		for (const auto& w : ready)
+			w.fn();
 	}
 }
 
@@ -134,7 +177,7 @@ inline bool event::wait_until(
 {
 	std::unique_lock<std::mutex> lock(mtx);
 	while (!is_set(mask))
-		if (ouro::cv_status::timeout == cv.wait_until(lock, absolute_time))
+		if (std::cv_status::timeout == cv.wait_until(lock, absolute_time))
 			return false;
 	return true;
 }
@@ -145,7 +188,7 @@ inline int event::wait_until_any(
 {
 	std::unique_lock<std::mutex> lock(mtx);
 	while (!is_any_set(mask))
-		if (ouro::cv_status::timeout == cv.wait_until(lock, absolute_time))
+		if (std::cv_status::timeout == cv.wait_until(lock, absolute_time))
 			return 0;
 	return set_mask;
 }
@@ -165,7 +208,7 @@ inline int event::wait_for_any(const std::chrono::duration<Rep, Period>& relativ
 {
 	std::unique_lock<std::mutex> lock(mtx);
 	while (!is_any_set(mask))
-		if (ouro::cv_status::timeout == cv.wait_for(lock, relative_time))
+		if (std::cv_status::timeout == cv.wait_for(lock, relative_time))
 			return 0;
 	return set_mask;
 }
@@ -180,4 +223,19 @@ inline bool event::is_any_set(int mask) const
 	return !!(set_mask & mask);
 }
 
+inline void event::add_waiter(const std::function<void()>& fn, int mask)
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	if (!is_set(mask))
+	{
+		waiter w;
+		w.fn = fn;
+		w.mask = mask;
+		waiters.push_back(std::move(w));
+		return;
+	}
+	lock.unlock();
+	fn();
+}
+
 }
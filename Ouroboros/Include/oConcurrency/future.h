@@ -6,16 +6,25 @@
 // GCC, VS2010, just::thread: all implement std::async as a right-now-alloc-a-
 // thread-and-exec-task style system which has a lot more overhead than a more 
 // robust scheduler.
+//
+// Results can also be consumed without blocking: future::then() attaches a
+// continuation that is dispatched to the scheduler when the value (or 
+// exception) arrives, and when_all/when_any combine several futures into one.
+// No thread is parked waiting on an intermediate stage of a chain.
 
 #pragma once
 #include <oCore/assert.h>
 #include <oConcurrency/concurrency.h>
 #include <oMemory/std_allocator.h>
 
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <iterator>
 #include <memory>
 #include <mutex>
+#include <type_traits>
+#include <vector>
 
 // Vardiatic templates replaces this, but until they're available use callable
 // macros even though it pokes back into oBase.
@@ -41,8 +50,25 @@ public:
 template<typename T> class future;
 template<typename T> class promise;
 
+// The result of when_any: futures is the whole input sequence and index 
+// identifies the first one that became ready.
+template<typename SequenceT> struct when_any_result
+{
+	when_any_result() : index(size_t(-1)) {}
+	size_t index;
+	SequenceT futures;
+};
+
 namespace future_detail {
 
+	struct continuation_access;
+
+	// the type returned by a continuation fn called with a ready future
+	template<typename FnT, typename FutureT> struct continuation_result
+	{
+		typedef decltype(std::declval<typename std::decay<FnT>::type&>()(std::declval<FutureT>())) type;
+	};
+
 	template<typename T> struct commitment_allocator
 	{
 		oDEFINE_STD_ALLOCATOR_BOILERPLATE(commitment_allocator)
@@ -102,20 +128,54 @@ namespace future_detail {
 			}
 		}
 
+		// Ready state is always signaled through CV, so this works the same for 
+		// promise- and task-backed commitments. Unlike wait() a task-backed 
+		// commitment doesn't help run tasks here since that could overrun the 
+		// timeout by the length of whatever task gets picked up.
 		template<typename Rep, typename Period>
 		future_status wait_for(std::chrono::duration<Rep,Period> const& relative_time)
 		{
 			std::unique_lock<std::mutex> lock(mtx);
-			if (task)
-				throw future_error(future_errc::no_implementation);
 			if (is_deferred())
 				return future_status::deferred;
+			const auto until = std::chrono::steady_clock::now() + relative_time;
 			while (!is_ready()) // Guarded Suspension
-				if (future_status::timeout == CV.wait_for(lock, relative_time))
-					return future_status::timeout;
+				if (std::cv_status::timeout == CV.wait_until(lock, until))
+					return is_ready() ? future_status::ready : future_status::timeout;
 			return future_status::ready;
 		}
 
+		// Dispatches fn to the scheduler once this commitment is ready, or 
+		// immediately if it already is. Continuations run exactly once and are
+		// moved out as they're dispatched, so they may own move-only state.
+		void add_continuation(inline_task<>&& fn)
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			if (!is_ready())
+			{
+				continuations.push_back(std::move(fn));
+				return;
+			}
+			lock.unlock();
+			dispatch(std::move(fn));
+		}
+
+		template<typename FnT> void add_continuation(FnT&& fn) { add_continuation(inline_task<>(std::forward<FnT>(fn))); }
+
+		// Called when a promise lets go of this commitment without satisfying it.
+		// Like std::promise this stores a broken_promise error so waiters wake 
+		// and pending continuations run. A continuation holds the future it was
+		// attached to, so until it runs this commitment keeps itself alive.
+		void abandon()
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			if (is_ready() || state.value_at_thread_exit || state.except_at_thread_exit)
+				return;
+			ex = std::make_exception_ptr(future_error(future_errc::broken_promise));
+			state.except = true;
+			make_ready(lock);
+		}
+
 		void set_exception(std::exception_ptr e)
 		{
 			std::unique_lock<std::mutex> lock(mtx);
@@ -124,7 +184,7 @@ namespace future_detail {
 			ex = e;
 			state.except = true;
 			state.except_at_thread_exit = true;
-			state.ready = true;
+			make_ready(lock);
 		}
 
 		void set_exception_at_thread_exit(std::exception_ptr e)
@@ -155,9 +215,7 @@ namespace future_detail {
 				throw future_error(future_errc::promise_already_satisfied);
 			state.value = true;
 			state.value_at_thread_exit = true;
-			lock.unlock();
-			if (!task)
-				CV.notify_all();
+			make_ready(lock);
 		}
 
 		void notify_value_set_from_thread_exit(std::shared_ptr<commitment_base> refkeeper)
@@ -168,11 +226,11 @@ namespace future_detail {
 
 		void set_void_value()
 		{
-			//std::unique_lock<std::mutex> lock(mtx); // no lock required for this trivial case
-			state.ready = true;
-			//lock.unlock();
-			if (!task)
-				CV.notify_all();
+			std::unique_lock<std::mutex> lock(mtx);
+			if (is_ready())
+				throw future_error(future_errc::promise_already_satisfied);
+			state.value = true;
+			make_ready(lock);
 		}
 
 		template<typename T, typename U> void internal_set_value_ref(void* out_mem, const U& val)
@@ -184,10 +242,7 @@ namespace future_detail {
 				throw future_error(future_errc::no_implementation);
 			*(T**)out_mem = &const_cast<U&>(val);
 			state.value = true;
-			state.ready = true;
-			lock.unlock();
-			if (!task)
-				CV.notify_all();
+			make_ready(lock);
 		}
 
 		template<typename T, typename U> void internal_set_value(void* out_mem, const U& val)
@@ -199,7 +254,7 @@ namespace future_detail {
 				throw future_error(future_errc::no_implementation);
 			::new(out_mem) T(val);
 			state.value = true;
-			state.ready = true;
+			make_ready(lock);
 		}
 
 		template<typename T, typename U> void internal_set_value(void* out_mem, U&& val)
@@ -211,7 +266,7 @@ namespace future_detail {
 				throw future_error(future_errc::no_implementation);
 			::new(out_mem) T(std::forward<U>(val));
 			state.value = true;
-			state.ready = true;
+			make_ready(lock);
 		}
 		
 		template <typename T, typename U> void set_value_at_thread_exit(void* out_mem, U&& val)
@@ -243,6 +298,21 @@ namespace future_detail {
 		}
 
 protected:
+		typedef std::vector<inline_task<>, commitment_allocator<inline_task<>>> continuation_list;
+
+		// Called with mtx locked once a value or exception is stored: wakes all 
+		// waiters and dispatches continuations. This releases the lock.
+		void make_ready(std::unique_lock<std::mutex>& lock)
+		{
+			state.ready = true;
+			continuation_list ready_continuations;
+			ready_continuations.swap(continuations);
+			lock.unlock();
+			CV.notify_all();
+			for (auto& c : ready_continuations)
+				dispatch(std::move(c));
+		}
+
 		struct state_t
 		{
 			state_t() { static_assert(sizeof(state_t) == sizeof(char), "size mismatch"); *(char*)this = 0;  }
@@ -260,6 +330,7 @@ protected:
 		std::condition_variable CV;
 		state_t state;
 		std::exception_ptr ex;
+		continuation_list continuations;
 	};
 
 	template<typename T> class commitment_t : public commitment_base<commitment_t<T>>
@@ -346,11 +417,16 @@ protected:
 		future_status wait_until(std::chrono::time_point<Clock,Duration> const& absolute_time)
 		{
 			oFUTURE_VALIDATE(); 
-			chrono::high_resolution_clock::duration duration = 
-				time_point_cast<chrono::high_resolution_clock::time_point>(absolute_time) 
-				- chrono::high_resolution_clock::now();
-			return wait_for(duration);
+			return wait_for(absolute_time - Clock::now());
 		}
+
+		// Returns a future for fn(ready_future) where ready_future is this future
+		// once it has a value or exception. fn is dispatched to the scheduler 
+		// rather than waited on, so chains of then() don't block any thread. 
+		// This future is no longer valid after the call. An exception thrown by 
+		// fn is stored in the returned future.
+		template<typename FnT>
+		future<typename continuation_result<FnT, DerivedT>::type> then(FnT&& fn);
 		
 	private:
 		DerivedT* This() { return static_cast<DerivedT*>(this); }
@@ -387,8 +463,9 @@ protected:
 		template <typename> friend class promise; \
 		template <typename> friend class shared_future; \
 		template <typename> friend class packaged_task; \
+		friend struct future_detail::continuation_access; \
 
-	#define oPROMISE_CTORS() ~promise() { if (commitment && !commitment->is_ready() && commitment->has_future()) oAssert(0, "broken promise"); } oFUTURE_MOVE_CTOR(promise)
+	#define oPROMISE_CTORS() ~promise() { if (commitment) commitment->abandon(); } oFUTURE_MOVE_CTOR(promise)
 
 	#define oPROMISE_SET_EXCEPTION() \
 		void set_exception(std::exception_ptr e) { if (!commitment) throw future_error(future_errc::no_state); commitment->set_exception(e); } \
@@ -477,6 +554,11 @@ namespace future_detail {
 	oCALLABLE_TEMPLATE0
 	class packaged_task {};
 
+	// fulfill_promise takes its promise by reference so commit_to_task's bound
+	// promise is released along with the task rather than on return from the 
+	// call. If the future has already gone, that promise holds the last 
+	// reference to the commitment, and this way the task group that owns the 
+	// task isn't destroyed from inside one of its own tasks.
 	#define oPACKAGEDTASK(nargs) \
 	template<typename result_type oCALLABLE_CONCAT(oARG_COMMA_TYPENAMES,nargs)> \
 	class packaged_task<result_type(oCALLABLE_CONCAT(oARG_PARTIAL_TYPENAMES,nargs))> \
@@ -498,14 +580,15 @@ namespace future_detail {
 		\
 		void operator ()(oCALLABLE_CONCAT(oARG_DECL,nargs)) \
 		{ \
-			std::function<result_type()> function1 = std::tr1::bind(func oCALLABLE_CONCAT(oARG_COMMA_PASS,nargs)); \
-			fulfill_promise(std::move(promise<result_type>(commitment)), function1); \
+			std::function<result_type()> function1 = std::bind(func oCALLABLE_CONCAT(oARG_COMMA_PASS,nargs)); \
+			promise<result_type> p(commitment); \
+			fulfill_promise(p, function1); \
 		} \
 		\
 		void commit_to_task(oCALLABLE_CONCAT(oARG_DECL,nargs)) \
 		{ \
-			std::function<result_type()> function1 = std::tr1::bind(func oCALLABLE_CONCAT(oARG_COMMA_PASS,nargs)); \
-			std::function<void()> function2 = std::tr1::bind(packaged_task::fulfill_promise, std::move(promise<result_type>(commitment)), function1); \
+			std::function<result_type()> function1 = std::bind(func oCALLABLE_CONCAT(oARG_COMMA_PASS,nargs)); \
+			std::function<void()> function2 = std::bind(packaged_task::fulfill_promise, std::move(promise<result_type>(commitment)), function1); \
 			commitment.get()->commit_to_task(function2); \
 		} \
 		\
@@ -515,7 +598,7 @@ namespace future_detail {
 		std::shared_ptr<future_detail::commitment_t<result_type>> commitment; \
 		Callable func; \
 		\
-		static void fulfill_promise(promise<result_type> p, std::function<result_type(void)> f) \
+		static void fulfill_promise(promise<result_type>& p, std::function<result_type(void)>& f) \
 		{ try { future_detail::fulfill_promise_helper(p, f); } catch (std::exception&) { p.set_exception(std::current_exception()); } } \
 	};
 	oCALLABLE_PROPAGATE(oPACKAGEDTASK)
@@ -533,4 +616,146 @@ namespace future_detail {
 	oCALLABLE_PROPAGATE(oASYNC)
 #endif
 
+namespace future_detail {
+
+	// then() and when_all/when_any attach continuations directly to the 
+	// commitment of a future so that the future itself can be moved along.
+	struct continuation_access
+	{
+		template<typename FutureT> static auto commitment(FutureT& f) -> typename std::decay<decltype(f.commitment)>::type
+		{
+			if (!f.commitment)
+				throw future_error(future_errc::no_state);
+			return f.commitment;
+		}
+	};
+
+	template<typename R, typename FnT, typename ArgT>
+	inline void fulfill_continuation(promise<R>& p, FnT& fn, ArgT& arg, std::false_type) { p.set_value(fn(std::move(arg))); }
+	template<typename R, typename FnT, typename ArgT>
+	inline void fulfill_continuation(promise<R>& p, FnT& fn, ArgT& arg, std::true_type) { fn(std::move(arg)); p.set_value(); }
+
+	template<typename R, typename FnT, typename ArgT>
+	void run_continuation(promise<R>& p, FnT& fn, ArgT& arg)
+	{
+		try { fulfill_continuation(p, fn, arg, std::is_void<R>()); }
+		catch (...) { p.set_exception(std::current_exception()); }
+	}
+
+} // namespace future_detail
+
+template<typename DerivedT> template<typename FnT>
+future<typename future_detail::continuation_result<FnT, DerivedT>::type> future_detail::future_base<DerivedT>::then(FnT&& fn)
+{
+	typedef typename std::decay<FnT>::type fn_type;
+	typedef typename future_detail::continuation_result<FnT, DerivedT>::type result_type;
+
+	auto c = future_detail::continuation_access::commitment(*This());
+	promise<result_type> p;
+	future<result_type> f = p.get_future();
+	c->add_continuation([p = std::move(p), self = std::move(*This()), fn = fn_type(std::forward<FnT>(fn))]() mutable
+	{
+		future_detail::run_continuation(p, fn, self);
+	});
+	return f;
+}
+
+// Returns a future that becomes ready when all futures in [first,last) are 
+// ready. The futures are moved into the result, where each holds its own value
+// or exception. No thread waits: each input dispatches a counting continuation.
+template<typename InputIt>
+future<std::vector<typename std::iterator_traits<InputIt>::value_type>> when_all(InputIt first, InputIt last)
+{
+	typedef std::vector<typename std::iterator_traits<InputIt>::value_type> sequence_type;
+
+	struct state_t
+	{
+		sequence_type futures;
+		promise<sequence_type> p;
+		std::atomic<size_t> remaining;
+	};
+
+	auto s = std::allocate_shared<state_t>(future_detail::commitment_allocator<state_t>());
+	for (; first != last; ++first)
+	{
+		oFUTURE_CHECK(first->valid(), no_state);
+		s->futures.push_back(std::move(*first));
+	}
+	future<sequence_type> f = s->p.get_future();
+
+	// one extra count keeps the result from being published while the loop 
+	// below is still reading s->futures
+	const size_t n = s->futures.size();
+	s->remaining = n + 1;
+	for (size_t i = 0; i < n; i++)
+		future_detail::continuation_access::commitment(s->futures[i])->add_continuation([s]
+		{
+			if (--s->remaining == 0)
+				s->p.set_value(std::move(s->futures));
+		});
+
+	if (--s->remaining == 0)
+		s->p.set_value(std::move(s->futures));
+	return f;
+}
+
+// Returns a future that becomes ready when the first of the futures in 
+// [first,last) is ready. All futures are moved into the result and index 
+// identifies the first. An empty range yields an immediately ready result 
+// with index size_t(-1).
+template<typename InputIt>
+future<when_any_result<std::vector<typename std::iterator_traits<InputIt>::value_type>>> when_any(InputIt first, InputIt last)
+{
+	typedef std::vector<typename std::iterator_traits<InputIt>::value_type> sequence_type;
+	typedef when_any_result<sequence_type> result_type;
+
+	struct state_t
+	{
+		sequence_type futures;
+		promise<result_type> p;
+		std::atomic<size_t> index;
+		std::atomic<int> gate;
+
+		void publish()
+		{
+			result_type r;
+			r.index = index;
+			r.futures = std::move(futures);
+			p.set_value(std::move(r));
+		}
+	};
+
+	auto s = std::allocate_shared<state_t>(future_detail::commitment_allocator<state_t>());
+	for (; first != last; ++first)
+	{
+		oFUTURE_CHECK(first->valid(), no_state);
+		s->futures.push_back(std::move(*first));
+	}
+	future<result_type> f = s->p.get_future();
+
+	const size_t n = s->futures.size();
+	if (!n)
+	{
+		s->p.set_value(result_type());
+		return f;
+	}
+
+	// The first ready future claims index, then both it and this thread pass a 
+	// gate; whichever is last publishes so s->futures isn't moved while the 
+	// loop below is still reading it.
+	s->index = size_t(-1);
+	s->gate = 2;
+	for (size_t i = 0; i < n; i++)
+		future_detail::continuation_access::commitment(s->futures[i])->add_continuation([s, i]
+		{
+			size_t expected = size_t(-1);
+			if (s->index.compare_exchange_strong(expected, i) && --s->gate == 0)
+				s->publish();
+		});
+
+	if (--s->gate == 0)
+		s->publish();
+	return f;
+}
+
 }
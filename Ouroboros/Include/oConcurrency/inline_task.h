@@ -0,0 +1,284 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+// A move-only void() callable sized to one cacheline. Callables that fit in
+// capacity bytes (and are nothrow-movable with at most pointer alignment) are
+// stored inline with no allocation. Larger ones spill to a block from the
+// calling thread's task_slab, a concurrent_object_pool that any thread can
+// free into, so a task created on one worker and run on another never touches
+// the general heap in steady state. Only callables larger than a slab block 
+// fall back to default_allocate.
+
+#pragma once
+#include <oArch/arch.h>
+#include <oMemory/allocate.h>
+#include <oMemory/concurrent_object_pool.h>
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace ouro {
+
+	namespace detail {
+
+class task_slab
+{
+public:
+	static const size_t block_size = 128;
+	static const size_t header_size = 16;
+	static const size_t max_payload = block_size - header_size;
+	static const size_t num_blocks = 512;
+
+	// Returns 16-byte aligned memory for task state. This never returns nullptr.
+	static void* allocate(size_t bytes);
+
+	// Frees memory from allocate() from any thread.
+	static void deallocate(void* p);
+
+private:
+	struct block
+	{
+		task_slab* owner;
+		char padding[header_size - sizeof(task_slab*)];
+		char payload[max_payload];
+	};
+	static_assert(sizeof(block) == block_size, "size mismatch");
+
+	// Each thread owns a list of slabs, most recently useful first. When the 
+	// front slab runs dry the others are checked for blocks freed since, and 
+	// only if all are exhausted is a new slab added, so the list settles at 
+	// the thread's peak number of in-flight spilled tasks. At thread exit the
+	// list releases its references and outstanding blocks keep each slab 
+	// alive until they're freed.
+	struct holder
+	{
+		task_slab* slabs;
+		holder() : slabs(nullptr) {}
+		~holder();
+		block* allocate();
+	};
+
+	concurrent_object_pool<block> pool;
+	std::atomic<size_t> refs;
+	task_slab* next;
+
+	static holder& this_thread_holder() { static thread_local holder h; return h; }
+	static task_slab* new_slab();
+	void release();
+};
+
+inline task_slab* task_slab::new_slab()
+{
+	const size_t header = (sizeof(task_slab) + oCACHE_LINE_SIZE - 1) & ~size_t(oCACHE_LINE_SIZE - 1);
+	const size_t arena_bytes = concurrent_object_pool<block>::calc_size(num_blocks);
+	void* mem = default_allocate(header + arena_bytes, "task_slab", memory_alignment::cacheline);
+	if (!mem)
+		return nullptr;
+	task_slab* s = new (mem) task_slab();
+	s->pool.initialize((char*)mem + header, concurrent_object_pool<block>::size_type(arena_bytes));
+	s->refs = 1;
+	s->next = nullptr;
+	return s;
+}
+
+inline void task_slab::release()
+{
+	if (--refs == 0)
+	{
+		pool.deinitialize();
+		this->~task_slab();
+		default_deallocate(this);
+	}
+}
+
+inline task_slab::holder::~holder()
+{
+	while (slabs)
+	{
+		task_slab* s = slabs;
+		slabs = s->next;
+		s->release();
+	}
+}
+
+inline task_slab::block* task_slab::holder::allocate()
+{
+	task_slab* prev = nullptr;
+	for (task_slab* s = slabs; s; prev = s, s = s->next)
+	{
+		block* b = (block*)s->pool.allocate();
+		if (b)
+		{
+			if (prev) // move to front so the next allocation hits it first
+			{
+				prev->next = s->next;
+				s->next = slabs;
+				slabs = s;
+			}
+			s->refs++;
+			b->owner = s;
+			return b;
+		}
+	}
+
+	task_slab* s = new_slab();
+	if (!s)
+		return nullptr;
+	s->next = slabs;
+	slabs = s;
+	block* b = (block*)s->pool.allocate();
+	s->refs++;
+	b->owner = s;
+	return b;
+}
+
+inline void* task_slab::allocate(size_t bytes)
+{
+	block* b = bytes <= max_payload ? this_thread_holder().allocate() : nullptr;
+	if (!b)
+	{
+		b = (block*)default_allocate(header_size + bytes, "task_slab overflow", memory_alignment::align16);
+		if (!b)
+			throw std::bad_alloc();
+		b->owner = nullptr;
+	}
+
+	return b->payload;
+}
+
+inline void task_slab::deallocate(void* p)
+{
+	block* b = (block*)((char*)p - header_size);
+	task_slab* s = b->owner;
+	if (s)
+	{
+		s->pool.deallocate(b);
+		s->release();
+	}
+	else
+		default_deallocate(b);
+}
+
+struct inline_task_vtable
+{
+	void (*invoke)(void* storage);
+	void (*move)(void* dst, void* src);
+	void (*destroy)(void* storage);
+};
+
+template<typename FnT>
+struct inline_task_local
+{
+	static void invoke(void* storage) { (*(FnT*)storage)(); }
+	static void move(void* dst, void* src) { new (dst) FnT(std::move(*(FnT*)src)); ((FnT*)src)->~FnT(); }
+	static void destroy(void* storage) { ((FnT*)storage)->~FnT(); }
+	static const inline_task_vtable table;
+};
+
+template<typename FnT>
+const inline_task_vtable inline_task_local<FnT>::table = { &invoke, &move, &destroy };
+
+template<typename FnT>
+struct inline_task_spilled
+{
+	static void invoke(void* storage) { (**(FnT**)storage)(); }
+	static void move(void* dst, void* src) { *(FnT**)dst = *(FnT**)src; }
+	static void destroy(void* storage) { FnT* p = *(FnT**)storage; p->~FnT(); task_slab::deallocate(p); }
+	static const inline_task_vtable table;
+};
+
+template<typename FnT>
+const inline_task_vtable inline_task_spilled<FnT>::table = { &invoke, &move, &destroy };
+
+	} // namespace detail
+
+template<size_t Capacity = oCACHE_LINE_SIZE - sizeof(void*)>
+class inline_task
+{
+public:
+	static const size_t capacity = Capacity;
+
+	// returns true if a callable of type FnT is stored without allocation
+	template<typename FnT> static bool fits_inline()
+	{
+		typedef typename std::decay<FnT>::type fn_type;
+		return stores_inline<fn_type>::value;
+	}
+
+	inline_task() : ops(nullptr) {}
+	~inline_task() { reset(); }
+
+	template<typename FnT, typename = typename std::enable_if<!std::is_same<typename std::decay<FnT>::type, inline_task>::value>::type>
+	inline_task(FnT&& fn) : ops(nullptr) { assign(std::forward<FnT>(fn), stores_inline<typename std::decay<FnT>::type>()); }
+
+	inline_task(inline_task&& that) : ops(that.ops)
+	{
+		if (ops)
+		{
+			ops->move(&storage, &that.storage);
+			that.ops = nullptr;
+		}
+	}
+
+	inline_task& operator=(inline_task&& that)
+	{
+		if (this != &that)
+		{
+			reset();
+			ops = that.ops;
+			if (ops)
+			{
+				ops->move(&storage, &that.storage);
+				that.ops = nullptr;
+			}
+		}
+		return *this;
+	}
+
+	explicit operator bool() const { return !!ops; }
+
+	void operator()() { ops->invoke(&storage); }
+
+	void reset()
+	{
+		if (ops)
+		{
+			ops->destroy(&storage);
+			ops = nullptr;
+		}
+	}
+
+private:
+	typedef typename std::aligned_storage<Capacity, alignof(void*)>::type storage_type;
+
+	template<typename FnT> struct stores_inline : std::integral_constant<bool,
+		sizeof(FnT) <= Capacity && alignof(FnT) <= alignof(void*) && std::is_nothrow_move_constructible<FnT>::value> {};
+
+	storage_type storage;
+	const detail::inline_task_vtable* ops;
+
+	template<typename FnT> void assign(FnT&& fn, std::true_type)
+	{
+		typedef typename std::decay<FnT>::type fn_type;
+		new (&storage) fn_type(std::forward<FnT>(fn));
+		ops = &detail::inline_task_local<fn_type>::table;
+	}
+
+	template<typename FnT> void assign(FnT&& fn, std::false_type)
+	{
+		typedef typename std::decay<FnT>::type fn_type;
+		static_assert(alignof(fn_type) <= detail::task_slab::header_size, "inline_task callables must not require more than 16-byte alignment");
+		void* p = detail::task_slab::allocate(sizeof(fn_type));
+		try { *(fn_type**)&storage = new (p) fn_type(std::forward<FnT>(fn)); }
+		catch (...) { detail::task_slab::deallocate(p); throw; }
+		ops = &detail::inline_task_spilled<fn_type>::table;
+	}
+
+	inline_task(const inline_task&); /* = delete */
+	const inline_task& operator=(const inline_task&); /* = delete */
+};
+
+static_assert(sizeof(inline_task<>) == oCACHE_LINE_SIZE, "inline_task<> should be exactly one cacheline");
+
+}
@@ -0,0 +1,105 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+// Threadpool-agnostic recursive range splitting for parallel_for. A range is
+// halved repeatedly: the upper half is run as a task and the lower half is
+// kept by the splitting thread until it is no larger than the grain, at which
+// point the body is called once with the whole [begin,end) subrange. This
+// creates O(n/grain) tasks rather than one per index and, with a work-stealing
+// pool, thieves take the largest remaining pieces first.
+//
+// The adaptive variant picks the grain from measured cost: it runs a probe of
+// doubling size on the calling thread (the probe is real work, not wasted)
+// until it is long enough to time, then sizes leaves to take about
+// target_leaf_seconds while still leaving min_leaves_per_worker leaves per
+// worker for load balancing.
+
+#pragma once
+#include <oCore/timer.h>
+#include <algorithm>
+#include <cstddef>
+
+namespace ouro { namespace detail {
+
+struct parallel_for_range_tuning
+{
+	static const size_t min_leaves_per_worker = 4;
+	static double target_leaf_seconds() { return 100e-6; }
+	static double min_probe_seconds() { return 10e-6; }
+};
+
+// Calls body(begin, end) for subranges no larger than grain, running all but
+// the first on group. This does not wait on group.
+template<typename TaskGroupT, typename BodyT>
+void split_range(TaskGroupT& group, size_t begin, size_t end, size_t grain, const BodyT& body)
+{
+	grain = std::max(grain, size_t(1));
+	while ((end - begin) > grain)
+	{
+		const size_t mid = begin + (end - begin) / 2;
+		group.run([&group, &body, mid, end, grain] { split_range(group, mid, end, grain, body); });
+		end = mid;
+	}
+
+	if (begin < end)
+		body(begin, end);
+}
+
+// Returns a grain that makes each leaf take about target_leaf_seconds given
+// the measured seconds_per_item, clamped so there's enough parallel slack. If
+// the whole range costs less than one leaf this returns num_items so the
+// caller runs it serially.
+inline size_t calc_grain(size_t num_items, size_t num_workers, double seconds_per_item)
+{
+	typedef parallel_for_range_tuning tuning;
+	const size_t max_grain = std::max(size_t(1), num_items / (std::max(num_workers, size_t(1)) * tuning::min_leaves_per_worker));
+	if (seconds_per_item <= 0.0)
+		return max_grain;
+	const double ideal = tuning::target_leaf_seconds() / seconds_per_item;
+	if (ideal >= double(num_items))
+		return num_items;
+	return ideal >= double(max_grain) ? max_grain : std::max(size_t(1), size_t(ideal));
+}
+
+// Measures body on the calling thread, then splits the rest of the range with
+// a grain derived from that measurement and waits for it to complete.
+template<typename TaskGroupT, typename PoolT, typename BodyT>
+void adaptive_parallel_for(PoolT& pool, size_t begin, size_t end, const BodyT& body)
+{
+	typedef parallel_for_range_tuning tuning;
+
+	if (begin >= end)
+		return;
+
+	const size_t num_workers = pool.num_workers();
+	const size_t max_probe = std::max(size_t(1), (end - begin) / (std::max(num_workers, size_t(1)) * tuning::min_leaves_per_worker));
+
+	size_t probe = 1;
+	size_t probed = 0;
+	double elapsed = 0.0;
+	while (begin < end && elapsed < tuning::min_probe_seconds() && probed < max_probe)
+	{
+		const size_t n = std::min(probe, end - begin);
+		const double start = timer::now();
+		body(begin, begin + n);
+		elapsed += timer::now() - start;
+		begin += n;
+		probed += n;
+		probe *= 2;
+	}
+
+	if (begin >= end)
+		return;
+
+	const size_t grain = calc_grain(end - begin, num_workers, elapsed / double(probed));
+	if ((end - begin) <= grain)
+	{
+		body(begin, end);
+		return;
+	}
+
+	TaskGroupT g(pool);
+	split_range(g, begin, end, grain, body);
+	g.wait();
+}
+
+}}
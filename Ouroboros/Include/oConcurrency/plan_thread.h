@@ -51,7 +51,8 @@ public:
 		
 		// This number of bytes will be allocated for each plan being assembled. There
 		// are two: one being built and one being worked on (double-buffered) so this
-		// size is allocated twice.
+		// size is allocated twice. Both plans draw from one ring so a plan that 
+		// needs more can use what the other doesn't.
 		uint32_t plan_allocator_bytes;
 	};
 
@@ -69,7 +70,7 @@ public:
 	tasklist make_tasklist(const phase_enum& phase) { return tasklists.make_tasklist(phase); }
 
 	// Draws from the same heap as a tasklist's allocate(): the current producer-
-	// side plan's allocate()
+	// side plan's allocate(). Memory is retired once the plan has executed.
 	inline void* allocate(uint32_t bytes, uint32_t align = default_alignment) { return producer_plan->allocate(bytes, align); }
 	
 	template<typename T>
@@ -108,6 +109,7 @@ private:
 	void run();
 
 	master_tasklist tasklists;
+	concurrent_ring_allocator plan_allocator;
 
 	// static config items
 	deallocate_fn dealloc;
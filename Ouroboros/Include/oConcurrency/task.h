@@ -0,0 +1,350 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+// A coroutine task<T> for writing asynchronous code as straight-line code.
+// Unlike the oCoBegin/oCoYield macros in coroutine.h, locals survive across
+// suspension and a task can co_await:
+//   - another task<T>: the awaited task starts and the awaiter resumes when
+//     it completes, on whichever thread completed it.
+//   - ouro::future<T>: the awaiter resumes on a scheduler worker once the
+//     value or exception is set (see future::then()).
+//   - countdown_latch and event (when_set() for a specific mask): the awaiter
+//     resumes on a scheduler worker once the latch reaches zero or the mask
+//     is set.
+//   - schedule(): moves the rest of the coroutine onto a scheduler worker.
+// No thread is blocked while a task is suspended, so thousands of in-flight
+// tasks cost only their coroutine frames, which come from
+// commitment_allocate().
+//
+// A task is lazy: it doesn't run until it is awaited or passed to spawn(),
+// which starts it on the scheduler and returns a future for its result.
+//
+// This requires compiler support for coroutines (C++20 or the Coroutines TS,
+// /await on MSVC). oHAS_COROUTINES is 0 otherwise and this header declares
+// nothing. Only what VS2015's /await provides is used: there is no symmetric
+// transfer or noop_coroutine, so awaiting a task that completes synchronously
+// resumes the awaiter on the same stack.
+
+#pragma once
+#include <oConcurrency/concurrency.h>
+#include <oConcurrency/countdown_latch.h>
+#include <oConcurrency/event.h>
+#include <oConcurrency/future.h>
+#include <atomic>
+#include <exception>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+	#include <coroutine>
+	#define oHAS_COROUTINES 1
+	namespace ouro { namespace coro = std; }
+#elif defined(_MSC_VER) && _MSC_VER < 1910 && defined(_RESUMABLE_FUNCTIONS_SUPPORTED)
+	#include <experimental/resumable>
+	#define oHAS_COROUTINES 1
+	namespace ouro { namespace coro = std::experimental; }
+#elif defined(__cpp_coroutines) || defined(_RESUMABLE_FUNCTIONS_SUPPORTED)
+	#include <experimental/coroutine>
+	#define oHAS_COROUTINES 1
+	namespace ouro { namespace coro = std::experimental; }
+#else
+	#define oHAS_COROUTINES 0
+#endif
+
+#if oHAS_COROUTINES
+
+namespace ouro {
+
+template<typename T = void> class task;
+
+	namespace detail {
+
+// The Coroutines TS in VS2015 takes a pointer here.
+template<typename HandleT, typename PromiseT> HandleT handle_from_promise(PromiseT& p)
+{
+	#if defined(_MSC_VER) && _MSC_VER < 1910
+		return HandleT::from_promise(&p);
+	#else
+		return HandleT::from_promise(p);
+	#endif
+}
+
+class task_promise_base
+{
+public:
+	task_promise_base() : continuation(nullptr) { finished_or_awaited.store(false); }
+
+	// Both the awaiter (after starting this task) and the final suspend point
+	// set finished_or_awaited and whichever is second resumes the awaiter.
+	// This way a task that completes before its awaiter suspends doesn't
+	// resume it twice.
+	struct final_awaiter
+	{
+		bool await_ready() noexcept { return false; }
+		template<typename PromiseT> void await_suspend(coro::coroutine_handle<PromiseT> h) noexcept
+		{
+			task_promise_base& p = h.promise();
+			if (p.finished_or_awaited.exchange(true, std::memory_order_acq_rel))
+				p.continuation.resume();
+		}
+		void await_resume() noexcept {}
+	};
+
+	coro::suspend_always initial_suspend() noexcept { return coro::suspend_always(); }
+	final_awaiter final_suspend() noexcept { return final_awaiter(); }
+	void unhandled_exception() { ex = std::current_exception(); }
+	void set_exception(std::exception_ptr e) { ex = e; } // VS2015 name for unhandled_exception()
+
+	static void* operator new(size_t bytes)
+	{
+		void* p = commitment_allocate(bytes);
+		if (!p)
+			throw std::bad_alloc();
+		return p;
+	}
+
+	static void operator delete(void* p) { commitment_deallocate(p); }
+
+	coro::coroutine_handle<> continuation;
+	std::atomic<bool> finished_or_awaited;
+
+protected:
+	std::exception_ptr ex;
+};
+
+template<typename T>
+class task_promise : public task_promise_base
+{
+public:
+	task_promise() : has_value(false) {}
+	~task_promise() { if (has_value) reinterpret_cast<T*>(&value)->~T(); }
+
+	task<T> get_return_object();
+
+	template<typename U> void return_value(U&& val)
+	{
+		::new (&value) T(std::forward<U>(val));
+		has_value = true;
+	}
+
+	T result()
+	{
+		if (ex)
+			std::rethrow_exception(ex);
+		return std::move(*reinterpret_cast<T*>(&value));
+	}
+
+private:
+	typename std::aligned_storage<sizeof(T), alignof(T)>::type value;
+	bool has_value;
+};
+
+template<typename T>
+class task_promise<T&> : public task_promise_base
+{
+public:
+	task_promise() : value(nullptr) {}
+
+	task<T&> get_return_object();
+	void return_value(T& val) { value = &val; }
+
+	T& result()
+	{
+		if (ex)
+			std::rethrow_exception(ex);
+		return *value;
+	}
+
+private:
+	T* value;
+};
+
+template<>
+class task_promise<void> : public task_promise_base
+{
+public:
+	task<void> get_return_object();
+	void return_void() {}
+
+	void result()
+	{
+		if (ex)
+			std::rethrow_exception(ex);
+	}
+};
+
+	} // namespace detail
+
+template<typename T>
+class task
+{
+public:
+	typedef detail::task_promise<T> promise_type;
+	typedef coro::coroutine_handle<promise_type> handle_type;
+
+	task() : h(nullptr) {}
+	explicit task(handle_type h) : h(h) {}
+	~task() { if (h) h.destroy(); }
+
+	task(task&& that) : h(that.h) { that.h = nullptr; }
+	task& operator=(task&& that)
+	{
+		if (this != &that)
+		{
+			if (h)
+				h.destroy();
+			h = that.h;
+			that.h = nullptr;
+		}
+		return *this;
+	}
+
+	bool valid() const { return !!h; }
+
+	// returns true once the coroutine has run to completion
+	bool is_ready() const { return h && h.done(); }
+
+	struct awaiter
+	{
+		handle_type h;
+		bool await_ready() const noexcept { return !h || h.done(); }
+
+		// starts the task and suspends the awaiter unless the task already
+		// finished
+		bool await_suspend(coro::coroutine_handle<> awaiting) noexcept
+		{
+			h.promise().continuation = awaiting;
+			h.resume();
+			return !h.promise().finished_or_awaited.exchange(true, std::memory_order_acq_rel);
+		}
+		T await_resume()
+		{
+			if (!h)
+				throw future_error(future_errc::no_state);
+			return h.promise().result();
+		}
+	};
+
+	awaiter operator co_await() const noexcept { awaiter a; a.h = h; return a; }
+
+private:
+	handle_type h;
+
+	task(const task&); /* = delete */
+	const task& operator=(const task&); /* = delete */
+};
+
+	namespace detail {
+
+template<typename T> task<T> task_promise<T>::get_return_object() { return task<T>(handle_from_promise<typename task<T>::handle_type>(*this)); }
+template<typename T> task<T&> task_promise<T&>::get_return_object() { return task<T&>(handle_from_promise<typename task<T&>::handle_type>(*this)); }
+inline task<void> task_promise<void>::get_return_object() { return task<void>(handle_from_promise<task<void>::handle_type>(*this)); }
+
+// A coroutine that starts immediately and frees itself on completion. It's
+// only used to bridge a task to a promise, which catches all exceptions.
+struct detached_task
+{
+	struct promise_type
+	{
+		detached_task get_return_object() { return detached_task(); }
+		coro::suspend_never initial_suspend() noexcept { return coro::suspend_never(); }
+		coro::suspend_never final_suspend() noexcept { return coro::suspend_never(); }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+		void set_exception(std::exception_ptr) { std::terminate(); }
+
+		static void* operator new(size_t bytes)
+		{
+			void* p = commitment_allocate(bytes);
+			if (!p)
+				throw std::bad_alloc();
+			return p;
+		}
+
+		static void operator delete(void* p) { commitment_deallocate(p); }
+	};
+};
+
+	} // namespace detail
+
+// co_await schedule() continues the calling coroutine on a scheduler worker.
+struct schedule_awaiter
+{
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(coro::coroutine_handle<> h) { dispatch([h] { h.resume(); }); }
+	void await_resume() const noexcept {}
+};
+
+inline schedule_awaiter schedule() { return schedule_awaiter(); }
+
+// co_await on a future resumes on a scheduler worker once it is ready and
+// evaluates to future::get().
+template<typename T>
+struct future_awaiter
+{
+	future<T>& f;
+	bool await_ready() const { return f.is_ready(); }
+	void await_suspend(coro::coroutine_handle<> h) { future_detail::continuation_access::commitment(f)->add_continuation([h] { h.resume(); }); }
+	T await_resume() { return f.get(); }
+};
+
+template<typename T> future_awaiter<T> operator co_await(future<T>& f) { future_awaiter<T> a = { f }; return a; }
+template<typename T> future_awaiter<T> operator co_await(future<T>&& f) { future_awaiter<T> a = { f }; return a; }
+
+// co_await on a countdown_latch resumes on a scheduler worker once its count
+// reaches zero.
+struct countdown_latch_awaiter
+{
+	countdown_latch& latch;
+	bool await_ready() const { return latch.outstanding() <= 0; }
+	void await_suspend(coro::coroutine_handle<> h) { latch.add_waiter([h] { dispatch([h] { h.resume(); }); }); }
+	void await_resume() const noexcept {}
+};
+
+inline countdown_latch_awaiter operator co_await(countdown_latch& latch) { countdown_latch_awaiter a = { latch }; return a; }
+
+// co_await when_set(e, mask) resumes on a scheduler worker once all bits in
+// mask are set. co_await e is the same as co_await when_set(e, 1).
+struct event_awaiter
+{
+	event& e;
+	int mask;
+	bool await_ready() const { return e.is_set(mask); }
+	void await_suspend(coro::coroutine_handle<> h) { e.add_waiter([h] { dispatch([h] { h.resume(); }); }, mask); }
+	void await_resume() const noexcept {}
+};
+
+inline event_awaiter when_set(event& e, int mask = 1) { event_awaiter a = { e, mask }; return a; }
+inline event_awaiter operator co_await(event& e) { return when_set(e); }
+
+	namespace detail {
+
+template<typename T> detached_task fulfill(task<T> t, promise<T> p)
+{
+	co_await schedule();
+	try { p.set_value(co_await t); }
+	catch (...) { p.set_exception(std::current_exception()); }
+}
+
+inline detached_task fulfill(task<void> t, promise<void> p)
+{
+	co_await schedule();
+	try { co_await t; p.set_value(); }
+	catch (...) { p.set_exception(std::current_exception()); }
+}
+
+	} // namespace detail
+
+// Starts t on a scheduler worker and returns a future for its result. This
+// is how non-coroutine code consumes a task.
+template<typename T> future<T> spawn(task<T>&& t)
+{
+	promise<T> p;
+	future<T> f = p.get_future();
+	detail::fulfill(std::move(t), std::move(p));
+	return f;
+}
+
+}
+
+#endif
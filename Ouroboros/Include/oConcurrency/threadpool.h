@@ -4,8 +4,11 @@
 // guarantees).
 
 #pragma once
+#include <oCore/assert.h>
 #include <oConcurrency/backoff.h>
 #include <oConcurrency/countdown_latch.h>
+#include <oConcurrency/inline_task.h>
+#include <oConcurrency/parallel_for_range.h>
 #include <atomic>
 #include <condition_variable>
 #include <deque>
@@ -30,13 +33,13 @@ struct threadpool_default_traits
 	static void end_thread() {}
 };
 
-namespace detail { template<typename Traits, typename Alloc = std::allocator<std::function<void()>>> class task_group; }
+namespace detail { template<typename Traits, typename Alloc = std::allocator<inline_task<>>> class task_group; }
 
 template<typename Alloc>
 class threadpool_base
 {
 public:
-	typedef std::function<void()> task_type;
+	typedef inline_task<> task_type;
 	typedef Alloc allocator_type;
 
 	// Call construct_workers in most-derived ctor to initialize values.
@@ -55,6 +58,9 @@ public:
 	// Blocks until all workers are joined.
 	void join();
 
+	// Returns the number of worker threads.
+	size_t num_workers() const { return workers.size(); }
+
 protected:
 	template<typename, typename> friend class detail::task_group;
 	std::vector<std::thread> workers;
@@ -69,7 +75,7 @@ protected:
 
 	// To ensure all members are constructed at time of worker instantiation, 
 	// separate out a call to be called from the most-derived constructor.
-	void construct_workers(const task_type& do_work, size_t num_workers = 0);
+	void construct_workers(const std::function<void()>& do_work, size_t num_workers = 0);
 
 	threadpool_base(const threadpool_base&); /* = delete */
 	const threadpool_base& operator=(const threadpool_base&); /* = delete */
@@ -85,7 +91,7 @@ size_t threadpool_base<Alloc>::calc_num_workers(size_t num_workers_requested) co
 }
 
 template<typename Alloc>
-inline void threadpool_base<Alloc>::construct_workers(const task_type& do_work, size_t num_workers)
+inline void threadpool_base<Alloc>::construct_workers(const std::function<void()>& do_work, size_t num_workers)
 {
 	num_working = calc_num_workers(num_workers);
 	workers.resize(num_working);
@@ -139,7 +145,7 @@ inline void threadpool_base<Alloc>::join()
 		w.join();
 }
 
-template<typename Traits, typename Alloc = std::allocator<std::function<void()>>>
+template<typename Traits, typename Alloc = std::allocator<inline_task<>>>
 class threadpool : public threadpool_base<Alloc>
 {
 public:
@@ -150,8 +156,9 @@ public:
 	threadpool(size_t num_workers = 0, const allocator_type& alloc = allocator_type());
 
 	// The task will execute on any given worker thread. There is no order-of-
-	// execution guarantee.
-	void dispatch(const task_type& task);
+	// execution guarantee. Any void() callable is accepted and stored in a 
+	// task_type without type-erasing it onto the heap.
+	template<typename TaskT> void dispatch(TaskT&& task);
 
 private:
 	void work();
@@ -170,13 +177,14 @@ inline threadpool<Traits, Alloc>::threadpool(size_t num_workers, const allocator
 	construct_workers(std::bind(&threadpool::work, this), num_workers);
 }
 
-template<typename Traits, typename Alloc>
-inline void threadpool<Traits, Alloc>::dispatch(const task_type& task)
+template<typename Traits, typename Alloc> template<typename TaskT>
+inline void threadpool<Traits, Alloc>::dispatch(TaskT&& task)
 {
 	if (running)
 	{
+		task_type t(std::forward<TaskT>(task));
 		std::unique_lock<std::mutex> lock(mtx);
-		global_queue.push_back(task);
+		global_queue.push_back(std::move(t));
 		if (num_working == 0)
 			work_available.notify_one();
 	}
@@ -229,10 +237,11 @@ public:
 	~task_group();
 
 	// Run a task as part of this task group
-	void run(const std::function<void()>& task);
+	template<typename TaskT> void run(TaskT&& task);
 
 	// blocks until all tasks associated with this task group are finished. While
-	// waiting, this work steals.
+	// waiting, this work steals. If a task threw, the rest of the group is 
+	// canceled and the first exception is rethrown here.
 	void wait();
 
 	// Cancels executing of all pending tasks in this group. If a task has already
@@ -247,6 +256,10 @@ private:
 	threadpool_type& tp;
 	ouro::countdown_latch latch;
 	std::atomic_bool canceling;
+	std::mutex exception_mtx;
+	std::exception_ptr exception;
+
+	void set_exception(std::exception_ptr e);
 };
 
 template<typename Traits, typename Alloc>
@@ -261,21 +274,40 @@ task_group<Traits, Alloc>::~task_group()
 	wait();
 }
 
-template<typename Traits, typename Alloc>
-void task_group<Traits, Alloc>::run(const std::function<void()>& task)
+template<typename Traits, typename Alloc> template<typename TaskT>
+void task_group<Traits, Alloc>::run(TaskT&& task)
 {
 	if (!canceling)
 	{
 		latch.reference();
-		tp.dispatch([&,this,task] { if (!this->canceling) { task(); } latch.release(); });
+		tp.dispatch([this, fn = typename std::decay<TaskT>::type(std::forward<TaskT>(task))]() mutable
+		{
+			if (!this->canceling)
+			{
+				try { fn(); }
+				catch (...) { this->set_exception(std::current_exception()); }
+			}
+			latch.release();
+		});
 	}
 }
 
+template<typename Traits, typename Alloc>
+void task_group<Traits, Alloc>::set_exception(std::exception_ptr e)
+{
+	std::lock_guard<std::mutex> lock(exception_mtx);
+	if (!exception)
+		exception = e;
+	canceling.store(true);
+}
+
 template<typename Traits, typename Alloc>
 void task_group<Traits, Alloc>::wait()
 {
 	// should this do a num_working++ somewhere?
 
+	// help with queued work, but once there is none block on the latch rather
+	// than spin: the group's remaining tasks may run for a long time.
 	latch.release();
 	while (latch.outstanding())
 	{
@@ -301,6 +333,15 @@ void task_group<Traits, Alloc>::wait()
 
 	latch.reset(1); // allow task group to be reused
 	canceling.store(false);
+
+	std::exception_ptr e;
+	{
+		std::lock_guard<std::mutex> lock(exception_mtx);
+		std::swap(e, exception);
+	}
+
+	if (e)
+		std::rethrow_exception(e);
 }
 
 template<typename Traits, typename Alloc>
@@ -315,24 +356,24 @@ bool task_group<Traits, Alloc>::is_canceling()
 	return canceling;
 }
 
-template<typename Traits, typename Alloc>
-inline void thread_local_parallel_for(task_group<Traits, Alloc>& group, size_t begin, size_t end, const std::function<void(size_t index)>& task)
-{
-	for (; begin < end; begin++)
-		group.run(std::bind(task, begin));
-}
-
+// Calls task for each index in [begin,end) by recursively splitting the range 
+// down to WorkChunkSize indices per task.
 template<size_t WorkChunkSize /* = 16*/, typename Traits, typename Alloc>
 inline void parallel_for(threadpool<Traits, Alloc>& pool, size_t begin, size_t end, const std::function<void(size_t index)>& task)
 {
+	auto body = [&](size_t b, size_t e) { for (; b < e; b++) task(b); }; // must outlive g.wait()
 	task_group<Traits, Alloc> g(pool);
-	const size_t kNumSteps = (end - begin) / WorkChunkSize;
-	for (size_t i = 0; i < kNumSteps; i++, begin += WorkChunkSize)
-		g.run(std::bind(thread_local_parallel_for<Traits, Alloc>, std::ref(g), begin, begin + WorkChunkSize, task));
-	if (begin < end)
-		g.run(std::bind(thread_local_parallel_for<Traits, Alloc>, std::ref(g), begin, end, task));
+	split_range(g, begin, end, WorkChunkSize, body);
 	g.wait();
 }
 
-	}
+// Calls body(begin, end) on subranges of [begin,end) sized from the measured 
+// cost of body.
+template<typename Traits, typename Alloc, typename BodyT>
+inline void parallel_for_range(threadpool<Traits, Alloc>& pool, size_t begin, size_t end, const BodyT& body)
+{
+	adaptive_parallel_for<task_group<Traits, Alloc>>(pool, begin, end, body);
 }
+
+	}
+}
\ No newline at end of file
@@ -0,0 +1,202 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+// A Chase-Lev work-stealing deque with the C11 memory orderings from "Correct
+// and Efficient Work-Stealing for Weak Memory Models" (Le, Pop, Cohen,
+// Zappa Nardelli 2013). Exactly one thread (the owner) may push and pop from
+// the bottom in LIFO order while any number of other threads steal from the
+// top in FIFO order. T must be trivially copyable; typically it's a pointer.
+// The ring grows on demand and retired rings are kept until destruction
+// because a concurrent thief may still be reading one.
+
+#pragma once
+#include <oArch/arch.h>
+#include <oMemory/allocate.h>
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+
+namespace ouro {
+
+template<typename T>
+class work_stealing_deque
+{
+	static_assert(std::is_trivially_copyable<T>::value, "work_stealing_deque<T> requires a trivially copyable T");
+
+public:
+	typedef int64_t size_type;
+	typedef T value_type;
+
+	static const size_type default_capacity = 256;
+
+
+	// === non-concurrent api ===
+
+	// capacity is rounded up to a power of two.
+	work_stealing_deque(size_type capacity = default_capacity, const char* label = "work_stealing_deque", const allocator& a = default_allocator);
+	~work_stealing_deque();
+
+	// returns the number of elements, which is only exact if there are no
+	// concurrent operations.
+	size_type size() const;
+
+
+	// === owner-thread api ===
+
+	// pushes an element to the bottom, growing the ring if necessary
+	void push(const value_type& val);
+
+	// pops the most-recently pushed element. Returns false if empty or if the
+	// last element was lost to a thief.
+	bool pop(value_type& val);
+
+
+	// === concurrent api ===
+
+	// removes the oldest element from the top. Returns false if empty or if the
+	// race for the element was lost to the owner or another thief.
+	bool steal(value_type& val);
+
+	// returns true if the deque appeared empty at the time of the call
+	bool empty() const;
+
+private:
+	struct ring
+	{
+		size_type mask;
+		ring* retired;
+		std::atomic<value_type>* items;
+
+		size_type capacity() const { return mask + 1; }
+		value_type get(size_type i) const { return items[i & mask].load(std::memory_order_relaxed); }
+		void put(size_type i, const value_type& val) { items[i & mask].store(val, std::memory_order_relaxed); }
+	};
+
+	alignas(oCACHE_LINE_SIZE) std::atomic<size_type> top;
+	alignas(oCACHE_LINE_SIZE) std::atomic<size_type> bottom;
+	std::atomic<ring*> active;
+	allocator alloc;
+	const char* label;
+
+	ring* new_ring(size_type capacity);
+	ring* grow(ring* r, size_type b, size_type t);
+
+	work_stealing_deque(const work_stealing_deque&); /* = delete */
+	const work_stealing_deque& operator=(const work_stealing_deque&); /* = delete */
+};
+
+template<typename T>
+typename work_stealing_deque<T>::ring* work_stealing_deque<T>::new_ring(size_type capacity)
+{
+	size_type pot = 2;
+	while (pot < capacity)
+		pot <<= 1;
+
+	const size_t bytes = sizeof(ring) + sizeof(std::atomic<value_type>) * size_t(pot);
+	ring* r = (ring*)alloc.allocate(bytes, label, memory_alignment::cacheline);
+	r->mask = pot - 1;
+	r->retired = nullptr;
+	r->items = (std::atomic<value_type>*)(r + 1);
+	return r;
+}
+
+template<typename T>
+typename work_stealing_deque<T>::ring* work_stealing_deque<T>::grow(ring* r, size_type b, size_type t)
+{
+	ring* bigger = new_ring(r->capacity() * 2);
+	for (size_type i = t; i < b; i++)
+		bigger->put(i, r->get(i));
+	bigger->retired = r;
+	active.store(bigger, std::memory_order_release);
+	return bigger;
+}
+
+template<typename T>
+work_stealing_deque<T>::work_stealing_deque(size_type capacity, const char* label, const allocator& a)
+	: top(0)
+	, bottom(0)
+	, alloc(a)
+	, label(label)
+{
+	active.store(new_ring(capacity), std::memory_order_relaxed);
+}
+
+template<typename T>
+work_stealing_deque<T>::~work_stealing_deque()
+{
+	ring* r = active.load(std::memory_order_relaxed);
+	while (r)
+	{
+		ring* retired = r->retired;
+		alloc.deallocate(r);
+		r = retired;
+	}
+}
+
+template<typename T>
+typename work_stealing_deque<T>::size_type work_stealing_deque<T>::size() const
+{
+	const size_type b = bottom.load(std::memory_order_relaxed);
+	const size_type t = top.load(std::memory_order_relaxed);
+	return b > t ? (b - t) : 0;
+}
+
+template<typename T>
+bool work_stealing_deque<T>::empty() const
+{
+	return size() == 0;
+}
+
+template<typename T>
+void work_stealing_deque<T>::push(const value_type& val)
+{
+	const size_type b = bottom.load(std::memory_order_relaxed);
+	const size_type t = top.load(std::memory_order_acquire);
+	ring* r = active.load(std::memory_order_relaxed);
+	if ((b - t) > r->mask)
+		r = grow(r, b, t);
+	r->put(b, val);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+template<typename T>
+bool work_stealing_deque<T>::pop(value_type& val)
+{
+	const size_type b = bottom.load(std::memory_order_relaxed) - 1;
+	ring* r = active.load(std::memory_order_relaxed);
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	size_type t = top.load(std::memory_order_relaxed);
+
+	if (t > b) // empty
+	{
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return false;
+	}
+
+	val = r->get(b);
+	if (t == b) // last element: race thieves for it
+	{
+		const bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return won;
+	}
+
+	return true;
+}
+
+template<typename T>
+bool work_stealing_deque<T>::steal(value_type& val)
+{
+	size_type t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	const size_type b = bottom.load(std::memory_order_acquire);
+	if (t >= b)
+		return false;
+
+	ring* r = active.load(std::memory_order_acquire);
+	val = r->get(t);
+	return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+}
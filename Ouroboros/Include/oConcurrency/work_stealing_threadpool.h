@@ -0,0 +1,557 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+// A threadpool where each worker owns a work_stealing_deque. Tasks dispatched
+// from a worker go to the bottom of that worker's deque and are run LIFO by
+// the owner for cache locality. Idle workers steal FIFO from the top of a
+// randomly-chosen victim. Tasks dispatched from non-worker threads go to a
+// shared injection list that is drained in batches into a worker's deque, so
+// the only lock left is touched once per batch rather than once per task.
+// Task nodes come from the per-thread task_slab, so dispatching a small 
+// callable does not touch the heap. This has the same api as threadpool so 
+// the two can be swapped freely.
+
+#pragma once
+#include <oArch/arch.h>
+#include <oCore/assert.h>
+#include <oCore/finally.h>
+#include <oConcurrency/backoff.h>
+#include <oConcurrency/inline_task.h>
+#include <oConcurrency/parallel_for_range.h>
+#include <oConcurrency/work_stealing_deque.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ouro {
+
+namespace detail { template<typename Traits, typename Alloc> class work_stealing_task_group; }
+
+template<typename Traits, typename Alloc = std::allocator<inline_task<>>>
+class work_stealing_threadpool
+{
+public:
+	typedef inline_task<> task_type;
+	typedef Alloc allocator_type;
+
+	// Pass 0 to allocate a worker thread for each hardware process found.
+	work_stealing_threadpool(size_t num_workers = 0, const allocator_type& alloc = allocator_type());
+
+	// Calls std::terminate() if join() wasn't explicitly called in client code,
+	// the same as the behavior of std::thread.
+	~work_stealing_threadpool();
+
+	// The task will execute on any given worker thread. There is no order-of-
+	// execution guarantee. Any void() callable is accepted and stored in a 
+	// task_type without type-erasing it onto the heap.
+	template<typename TaskT> void dispatch(TaskT&& task);
+
+	// Block until all dispatched tasks have completed.
+	void flush();
+
+	// Returns true if the thread pool can still be joined.
+	bool joinable() const;
+
+	// Blocks until all workers are joined.
+	void join();
+
+	// Runs one pending task on the calling thread if one can be found. This is
+	// how waiting threads help out rather than block. Returns false if no task
+	// could be found.
+	bool try_run_one();
+
+	// Returns the number of worker threads.
+	size_t num_workers() const { return workers.size(); }
+
+private:
+	template<typename, typename> friend class detail::work_stealing_task_group;
+
+	struct task_node
+	{
+		template<typename TaskT> task_node(TaskT&& task) : task(std::forward<TaskT>(task)) {}
+		task_type task;
+	};
+
+	typedef typename std::allocator_traits<allocator_type>::template rebind_alloc<task_node*> injected_allocator_type;
+
+	struct worker
+	{
+		worker(work_stealing_threadpool* owner, uint32_t seed) : owner(owner), seed(seed) {}
+		work_stealing_deque<task_node*> deque;
+		work_stealing_threadpool* owner;
+		uint32_t seed;
+		std::thread thread;
+	};
+
+	// Per-worker state is cacheline-aligned by the deque's members so workers
+	// don't false-share; the vector only holds pointers.
+	std::vector<std::unique_ptr<worker>> workers;
+
+	std::mutex injected_mtx;
+	std::vector<task_node*, injected_allocator_type> injected;
+	alignas(oCACHE_LINE_SIZE) std::atomic<size_t> num_injected;
+	alignas(oCACHE_LINE_SIZE) std::atomic<size_t> num_pending;
+	alignas(oCACHE_LINE_SIZE) std::atomic<size_t> num_sleeping;
+	std::atomic<size_t> num_searching;
+	std::atomic<bool> running;
+
+	std::mutex mtx;
+	std::condition_variable work_available;
+
+	// how many times an idle worker yields, still searching, before it parks
+	static const uint32_t idle_yield_rounds = 64;
+
+	static worker*& this_thread_worker() { static thread_local worker* w = nullptr; return w; }
+	worker* find_worker() const { worker* w = this_thread_worker(); return (w && w->owner == this) ? w : nullptr; }
+
+	template<typename TaskT> task_node* new_node(TaskT&& task);
+	void delete_node(task_node* n);
+	void execute(task_node* n);
+
+	void wake_one();
+	void sleep();
+	bool has_work() const;
+
+	task_node* take_injected(worker* w);
+	task_node* steal(worker* w, uint32_t& seed);
+	task_node* find_task(worker* w, uint32_t& seed);
+
+	void work(worker* w);
+
+	work_stealing_threadpool(const work_stealing_threadpool&); /* = delete */
+	const work_stealing_threadpool& operator=(const work_stealing_threadpool&); /* = delete */
+
+	work_stealing_threadpool(work_stealing_threadpool&&); /* = delete */
+	work_stealing_threadpool& operator=(work_stealing_threadpool&&); /* = delete */
+};
+
+template<typename Traits, typename Alloc>
+inline work_stealing_threadpool<Traits, Alloc>::work_stealing_threadpool(size_t num_workers, const allocator_type& alloc)
+	: injected(alloc)
+	, num_injected(0)
+	, num_pending(0)
+	, num_sleeping(0)
+	, num_searching(0)
+	, running(true)
+{
+	if (!num_workers)
+		num_workers = std::thread::hardware_concurrency();
+
+	// construct all worker state before any thread can try to steal from it
+	workers.resize(num_workers);
+	for (size_t i = 0; i < num_workers; i++)
+		workers[i].reset(new worker(this, uint32_t(i * 2654435761u + 1)));
+
+	for (auto& w : workers)
+		w->thread = std::thread(std::bind(&work_stealing_threadpool::work, this, w.get()));
+}
+
+template<typename Traits, typename Alloc>
+inline work_stealing_threadpool<Traits, Alloc>::~work_stealing_threadpool()
+{
+	if (joinable())
+		std::terminate();
+
+	// anything dispatched after the workers drained is dropped
+	for (auto& w : workers)
+	{
+		task_node* n = nullptr;
+		while (w->deque.pop(n))
+			delete_node(n);
+	}
+
+	for (auto n : injected)
+		delete_node(n);
+}
+
+template<typename Traits, typename Alloc> template<typename TaskT>
+inline typename work_stealing_threadpool<Traits, Alloc>::task_node* work_stealing_threadpool<Traits, Alloc>::new_node(TaskT&& task)
+{
+	void* p = detail::task_slab::allocate(sizeof(task_node));
+	try { return new (p) task_node(std::forward<TaskT>(task)); }
+	catch (...) { detail::task_slab::deallocate(p); throw; }
+}
+
+template<typename Traits, typename Alloc>
+inline void work_stealing_threadpool<Traits, Alloc>::delete_node(task_node* n)
+{
+	n->~task_node();
+	detail::task_slab::deallocate(n);
+}
+
+template<typename Traits, typename Alloc>
+inline void work_stealing_threadpool<Traits, Alloc>::execute(task_node* n)
+{
+	// a throwing task is still retired so flush() doesn't wait on it forever
+	oFinally { delete_node(n); num_pending--; };
+	n->task();
+}
+
+template<typename Traits, typename Alloc> template<typename TaskT>
+inline void work_stealing_threadpool<Traits, Alloc>::dispatch(TaskT&& task)
+{
+	if (!running)
+		oThrow(std::errc::invalid_argument, "dispatch called after join");
+
+	task_node* n = new_node(std::forward<TaskT>(task));
+	num_pending++;
+
+	worker* w = find_worker();
+	if (w)
+		w->deque.push(n);
+	else
+	{
+		std::lock_guard<std::mutex> lock(injected_mtx);
+		injected.push_back(n);
+		num_injected.store(injected.size());
+	}
+
+	wake_one();
+}
+
+template<typename Traits, typename Alloc>
+inline void work_stealing_threadpool<Traits, Alloc>::wake_one()
+{
+	// pairs with the fence in sleep(): either the sleeper sees the new task or
+	// this sees the sleeper. A worker that is already searching will find the 
+	// task, so don't pay for a wake.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (!num_searching.load(std::memory_order_relaxed) && num_sleeping.load(std::memory_order_relaxed))
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		work_available.notify_one();
+	}
+}
+
+template<typename Traits, typename Alloc>
+inline bool work_stealing_threadpool<Traits, Alloc>::has_work() const
+{
+	if (num_injected.load(std::memory_order_relaxed))
+		return true;
+	for (const auto& w : workers)
+		if (!w->deque.empty())
+			return true;
+	return false;
+}
+
+template<typename Traits, typename Alloc>
+inline void work_stealing_threadpool<Traits, Alloc>::sleep()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	num_sleeping++;
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (running && !has_work())
+		work_available.wait(lock);
+	num_sleeping--;
+}
+
+template<typename Traits, typename Alloc>
+inline typename work_stealing_threadpool<Traits, Alloc>::task_node* work_stealing_threadpool<Traits, Alloc>::take_injected(worker* w)
+{
+	if (!num_injected.load(std::memory_order_relaxed))
+		return nullptr;
+
+	std::unique_lock<std::mutex> lock(injected_mtx);
+	if (injected.empty())
+		return nullptr;
+
+	task_node* n = injected.back();
+	injected.pop_back();
+
+	// a worker takes the whole batch so the lock is paid once and the rest is
+	// spread by stealing. A non-worker only takes what it will run.
+	if (w)
+	{
+		for (auto extra : injected)
+			w->deque.push(extra);
+		injected.clear();
+	}
+
+	num_injected.store(injected.size());
+	lock.unlock();
+
+	if (w && !w->deque.empty())
+		wake_one();
+
+	return n;
+}
+
+template<typename Traits, typename Alloc>
+inline typename work_stealing_threadpool<Traits, Alloc>::task_node* work_stealing_threadpool<Traits, Alloc>::steal(worker* w, uint32_t& seed)
+{
+	const size_t n = workers.size();
+
+	// xorshift32: cheap and good enough to spread thieves across victims
+	seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+	const size_t start = seed % n;
+
+	task_node* t = nullptr;
+	for (size_t i = 0; i < n; i++)
+	{
+		worker* victim = workers[(start + i) % n].get();
+		if (victim != w && victim->deque.steal(t))
+			return t;
+	}
+	return nullptr;
+}
+
+template<typename Traits, typename Alloc>
+inline typename work_stealing_threadpool<Traits, Alloc>::task_node* work_stealing_threadpool<Traits, Alloc>::find_task(worker* w, uint32_t& seed)
+{
+	task_node* n = nullptr;
+	if (w && w->deque.pop(n))
+		return n;
+	n = take_injected(w);
+	if (n)
+		return n;
+	return steal(w, seed);
+}
+
+template<typename Traits, typename Alloc>
+inline bool work_stealing_threadpool<Traits, Alloc>::try_run_one()
+{
+	static thread_local uint32_t external_seed = 0x9e3779b9u;
+	worker* w = find_worker();
+	task_node* n = find_task(w, w ? w->seed : external_seed);
+	if (!n)
+		return false;
+	execute(n);
+	return true;
+}
+
+template<typename Traits, typename Alloc>
+inline void work_stealing_threadpool<Traits, Alloc>::work(worker* w)
+{
+	Traits::begin_thread("work_stealing_threadpool Worker");
+	this_thread_worker() = w;
+
+	// A worker with nothing to do is "searching" while it spins. Dispatch only 
+	// wakes a sleeper when nobody is searching, and a searcher that finds work
+	// hands the search off by waking one more, so wakes scale with demand 
+	// rather than with the number of dispatches. The backoff's spins are over
+	// in a handful of rounds, far less than the gap between dispatches of a
+	// typical producer, so a searcher then yields for a while before it parks.
+	// Otherwise nearly every dispatch would pay for a condition variable wake.
+	ouro::backoff bo;
+	uint32_t idle_yields = 0;
+	bool searching = false;
+	while (true)
+	{
+		task_node* n = find_task(w, w->seed);
+		if (n)
+		{
+			if (searching)
+			{
+				searching = false;
+				if (--num_searching == 0)
+					wake_one();
+			}
+
+			execute(n);
+			Traits::update_thread();
+			bo.reset();
+			idle_yields = 0;
+			continue;
+		}
+
+		if (!searching)
+		{
+			searching = true;
+			num_searching++;
+		}
+
+		if (!running)
+			break;
+
+		if (bo.try_pause())
+			continue;
+
+		if (idle_yields < idle_yield_rounds)
+		{
+			idle_yields++;
+			std::this_thread::yield();
+			continue;
+		}
+
+		searching = false;
+		num_searching--;
+		sleep();
+		bo.reset();
+		idle_yields = 0;
+	}
+
+	if (searching)
+		num_searching--;
+
+	this_thread_worker() = nullptr;
+	Traits::end_thread();
+}
+
+template<typename Traits, typename Alloc>
+inline void work_stealing_threadpool<Traits, Alloc>::flush()
+{
+	ouro::backoff bo;
+	while (running && num_pending)
+		bo.pause();
+}
+
+template<typename Traits, typename Alloc>
+inline bool work_stealing_threadpool<Traits, Alloc>::joinable() const
+{
+	return running && !workers.empty() && workers.front()->thread.joinable();
+}
+
+template<typename Traits, typename Alloc>
+inline void work_stealing_threadpool<Traits, Alloc>::join()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+	running = false;
+	work_available.notify_all();
+	lock.unlock();
+	for (auto& w : workers)
+		w->thread.join();
+}
+
+	namespace detail {
+
+// Same contract as detail::task_group, but wait() never takes a lock: the
+// waiting thread runs whatever it can find until its group's tasks are done.
+template<typename Traits, typename Alloc>
+class work_stealing_task_group
+{
+public:
+	typedef Alloc allocator_type;
+	typedef work_stealing_threadpool<Traits, Alloc> threadpool_type;
+	work_stealing_task_group(threadpool_type& pool);
+	~work_stealing_task_group();
+
+	// Run a task as part of this task group
+	template<typename TaskT> void run(TaskT&& task);
+
+	// blocks until all tasks associated with this task group are finished. While
+	// waiting, this work steals. If a task threw, the rest of the group is 
+	// canceled and the first exception is rethrown here.
+	void wait();
+
+	// Cancels executing of all pending tasks in this group. If a task has already
+	// executed, then it will be complete.
+	void cancel();
+
+	// Returns true if in the canceling state. The state is set on a call to cancel()
+	// and is reset at the end of a wait.
+	bool is_canceling();
+
+private:
+	threadpool_type& tp;
+	std::atomic<int> outstanding;
+	std::atomic_bool canceling;
+	std::mutex exception_mtx;
+	std::exception_ptr exception;
+
+	void set_exception(std::exception_ptr e);
+};
+
+template<typename Traits, typename Alloc>
+work_stealing_task_group<Traits, Alloc>::work_stealing_task_group(threadpool_type& pool)
+	: tp(pool)
+	, outstanding(0)
+{ canceling = false; }
+
+template<typename Traits, typename Alloc>
+work_stealing_task_group<Traits, Alloc>::~work_stealing_task_group()
+{
+	wait();
+}
+
+template<typename Traits, typename Alloc> template<typename TaskT>
+void work_stealing_task_group<Traits, Alloc>::run(TaskT&& task)
+{
+	if (!canceling)
+	{
+		outstanding++;
+		tp.dispatch([this, fn = typename std::decay<TaskT>::type(std::forward<TaskT>(task))]() mutable
+		{
+			if (!this->canceling)
+			{
+				try { fn(); }
+				catch (...) { this->set_exception(std::current_exception()); }
+			}
+			outstanding--;
+		});
+	}
+}
+
+template<typename Traits, typename Alloc>
+void work_stealing_task_group<Traits, Alloc>::set_exception(std::exception_ptr e)
+{
+	std::lock_guard<std::mutex> lock(exception_mtx);
+	if (!exception)
+		exception = e;
+	canceling.store(true);
+}
+
+template<typename Traits, typename Alloc>
+void work_stealing_task_group<Traits, Alloc>::wait()
+{
+	ouro::backoff bo;
+	while (outstanding)
+	{
+		if (!tp.running)
+			oThrow(std::errc::invalid_argument, "threadpool shut down before task group could complete");
+
+		if (tp.try_run_one())
+			bo.reset();
+		else
+			bo.pause();
+	}
+
+	canceling.store(false);
+
+	std::exception_ptr e;
+	{
+		std::lock_guard<std::mutex> lock(exception_mtx);
+		std::swap(e, exception);
+	}
+
+	if (e)
+		std::rethrow_exception(e);
+}
+
+template<typename Traits, typename Alloc>
+void work_stealing_task_group<Traits, Alloc>::cancel()
+{
+	canceling.store(true);
+}
+
+template<typename Traits, typename Alloc>
+bool work_stealing_task_group<Traits, Alloc>::is_canceling()
+{
+	return canceling;
+}
+
+// Calls task for each index in [begin,end) by recursively splitting the range 
+// down to WorkChunkSize indices per task.
+template<size_t WorkChunkSize /* = 16*/, typename Traits, typename Alloc>
+inline void parallel_for(work_stealing_threadpool<Traits, Alloc>& pool, size_t begin, size_t end, const std::function<void(size_t index)>& task)
+{
+	auto body = [&](size_t b, size_t e) { for (; b < e; b++) task(b); }; // must outlive g.wait()
+	work_stealing_task_group<Traits, Alloc> g(pool);
+	split_range(g, begin, end, WorkChunkSize, body);
+	g.wait();
+}
+
+// Calls body(begin, end) on subranges of [begin,end) sized from the measured 
+// cost of body.
+template<typename Traits, typename Alloc, typename BodyT>
+inline void parallel_for_range(work_stealing_threadpool<Traits, Alloc>& pool, size_t begin, size_t end, const BodyT& body)
+{
+	adaptive_parallel_for<work_stealing_task_group<Traits, Alloc>>(pool, begin, end, body);
+}
+
+	}
+}
@@ -4,8 +4,10 @@
 // this to be lazy when including headers in .cpp files. Be explicit.
 
 #pragma once
+#include <oMemory/concurrent_chunked_object_pool.h>
 #include <oMemory/concurrent_linear_allocator.h>
 #include <oMemory/concurrent_pool.h>
+#include <oMemory/concurrent_ring_allocator.h>
 #include <oMemory/concurrent_object_pool.h>
 #include <oMemory/djb2.h>
 #include <oMemory/fnv1a.h>
@@ -14,8 +16,10 @@
 #include <oMemory/murmur3.h>
 #include <oMemory/object_pool.h>
 #include <oMemory/pool.h>
+#include <oMemory/pool_magazine.h>
 #include <oMemory/spatial_hash.h>
 #include <oMemory/std_allocator.h>
 #include <oMemory/std_linear_allocator.h>
+#include <oMemory/thread_caching_allocator.h>
 #include <oMemory/wang.h>
 #include <oMemory/xxhash.h>
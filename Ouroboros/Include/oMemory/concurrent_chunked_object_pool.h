@@ -0,0 +1,209 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+// A concurrent_object_pool that adds chunks instead of failing when it runs
+// out. The first chunk is the memory passed to initialize() and each further
+// chunk of the same capacity comes from the allocator passed with it. Blocks
+// never move and an index is chunk * chunk_capacity() + the index within that
+// chunk, so indices stay 32 bits for containers that can only hold that, such
+// as concurrent_growable_hash_map. One thread at a time adds a chunk; others
+// that also ran out yield until it's published.
+
+#pragma once
+#include <oMemory/allocate.h>
+#include <oMemory/concurrent_object_pool.h>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+namespace ouro {
+
+template<typename T>
+class concurrent_chunked_object_pool
+{
+public:
+	typedef concurrent_pool::index_type index_type;
+	typedef concurrent_pool::size_type size_type;
+	typedef T value_type;
+
+	static const index_type nullidx = concurrent_pool::nullidx;                   // returned if no chunk can be added
+	static const size_type max_chunks = 16;                                       // most chunks a pool will grow to
+
+	static size_type calc_size(size_type chunk_capacity) { return concurrent_object_pool<T>::calc_size(chunk_capacity); } // required bytes for the memory passed to initialize()
+	static size_type calc_capacity(size_type bytes) { return concurrent_object_pool<T>::calc_capacity(bytes); }          // max block count of each chunk for the specified bytes
+
+
+	// === non-concurrent api ===
+
+	concurrent_chunked_object_pool() : nchunks_(0), growing_(false), chunk_capacity_(0), max_chunks_(0), label_(nullptr) {}
+	concurrent_chunked_object_pool(concurrent_chunked_object_pool&& that) : nchunks_(0), growing_(false), chunk_capacity_(0), max_chunks_(0), label_(nullptr) { *this = std::move(that); }
+	~concurrent_chunked_object_pool() { deinitialize(); }
+	concurrent_chunked_object_pool& operator=(concurrent_chunked_object_pool&& that);
+
+	// the first chunk is memory and later chunks are allocated from a
+	void initialize(void* memory, size_type bytes, const char* label = "concurrent_chunked_object_pool", const allocator& a = default_allocator);
+
+	// frees all chunks added since initialize() and returns the memory passed to it
+	void* deinitialize();
+
+	bool valid() const { return num_chunks() != 0; }
+	size_type chunk_capacity() const { return chunk_capacity_; }
+
+
+	// === concurrent api ===
+
+	size_type num_chunks() const { return nchunks_.load(std::memory_order_acquire); }
+	size_type capacity() const { return num_chunks() * chunk_capacity_; }
+	size_type count_free() const;                                                 // approximate while there are concurrent operations
+	size_type size() const { return capacity() - count_free(); }                  // approximate while there are concurrent operations
+	bool full() const { return capacity() == count_free(); }                      // true if there are no outstanding allocations
+
+	index_type allocate_index();                                                  // nullidx only if a chunk is needed and can't be added
+	void deallocate(index_type index) { chunks_[index / chunk_capacity_].deallocate(index % chunk_capacity_); }
+
+	void* allocate() { return pointer(allocate_index()); }
+	void deallocate(void* ptr) { deallocate(index(ptr)); }
+
+	T* create() { void* p = allocate(); return p ? new (p) T() : nullptr; }
+	template<typename A> T* create(const A& a) { void* p = allocate(); return p ? new (p) T(a) : nullptr; }
+	void destroy(T* ptr) { ptr->T::~T(); deallocate(ptr); }
+
+	void* pointer(index_type index) const { return index != nullidx ? chunks_[index / chunk_capacity_].pointer(index % chunk_capacity_) : nullptr; }
+	T* typed_pointer(index_type index) const { return (T*)pointer(index); }
+	index_type index(void* ptr) const;
+
+private:
+	concurrent_object_pool<T> chunks_[max_chunks];
+	std::atomic<size_type> nchunks_;
+	std::atomic<bool> growing_;
+	size_type chunk_capacity_;
+	size_type max_chunks_; // fewer than max_chunks if indices would reach nullidx
+	const char* label_;
+	allocator alloc_;
+
+	// adds a chunk unless another thread already has since nchunks was read,
+	// returns false if no chunk could be added
+	bool grow(size_type nchunks);
+
+	concurrent_chunked_object_pool(const concurrent_chunked_object_pool&); /* = delete; */
+	const concurrent_chunked_object_pool& operator=(const concurrent_chunked_object_pool&); /* = delete; */
+};
+
+template<typename T>
+concurrent_chunked_object_pool<T>& concurrent_chunked_object_pool<T>::operator=(concurrent_chunked_object_pool&& that)
+{
+	if (this != &that)
+	{
+		deinitialize();
+		const size_type n = that.num_chunks();
+		for (size_type i = 0; i < n; i++)
+			chunks_[i] = std::move(that.chunks_[i]);
+		chunk_capacity_ = that.chunk_capacity_; that.chunk_capacity_ = 0;
+		max_chunks_ = that.max_chunks_; that.max_chunks_ = 0;
+		label_ = that.label_; that.label_ = nullptr;
+		alloc_ = that.alloc_; that.alloc_ = allocator();
+		nchunks_.store(n); that.nchunks_.store(0);
+	}
+	return *this;
+}
+
+template<typename T>
+void concurrent_chunked_object_pool<T>::initialize(void* memory, size_type bytes, const char* label, const allocator& a)
+{
+	deinitialize();
+	chunks_[0].initialize(memory, bytes);
+	chunk_capacity_ = chunks_[0].capacity();
+	if (!chunk_capacity_)
+		throw allocate_error(allocate_errc::invalid_capacity);
+	max_chunks_ = nullidx / chunk_capacity_ < max_chunks ? nullidx / chunk_capacity_ : max_chunks;
+	label_ = label;
+	alloc_ = a;
+	nchunks_.store(1);
+}
+
+template<typename T>
+void* concurrent_chunked_object_pool<T>::deinitialize()
+{
+	const size_type n = num_chunks();
+	if (!n)
+		return nullptr;
+	for (size_type i = 1; i < n; i++)
+		alloc_.deallocate(chunks_[i].deinitialize());
+	nchunks_.store(0);
+	return chunks_[0].deinitialize();
+}
+
+template<typename T>
+typename concurrent_chunked_object_pool<T>::size_type concurrent_chunked_object_pool<T>::count_free() const
+{
+	const size_type n = num_chunks();
+	size_type nfree = 0;
+	for (size_type i = 0; i < n; i++)
+		nfree += chunks_[i].count_free();
+	return nfree;
+}
+
+template<typename T>
+typename concurrent_chunked_object_pool<T>::index_type concurrent_chunked_object_pool<T>::allocate_index()
+{
+	for (;;)
+	{
+		// newest chunk first: older ones are the ones that filled up
+		const size_type n = num_chunks();
+		for (size_type i = n; i-- > 0;)
+		{
+			const index_type index = chunks_[i].allocate_index();
+			if (index != concurrent_pool::nullidx)
+				return i * chunk_capacity_ + index;
+		}
+
+		if (!grow(n))
+			return nullidx;
+	}
+}
+
+template<typename T>
+typename concurrent_chunked_object_pool<T>::index_type concurrent_chunked_object_pool<T>::index(void* ptr) const
+{
+	const size_type n = num_chunks();
+	const size_t chunk_bytes = size_t(chunk_capacity_) * chunks_[0].block_size();
+	for (size_type i = 0; i < n; i++)
+	{
+		const uint8_t* first = (const uint8_t*)chunks_[i].pointer(0);
+		if ((const uint8_t*)ptr >= first && (const uint8_t*)ptr < first + chunk_bytes)
+			return i * chunk_capacity_ + chunks_[i].index(ptr);
+	}
+	return nullidx;
+}
+
+template<typename T>
+bool concurrent_chunked_object_pool<T>::grow(size_type nchunks)
+{
+	if (nchunks >= max_chunks_)
+		return false;
+
+	bool expected = false;
+	if (!growing_.compare_exchange_strong(expected, true, std::memory_order_acquire))
+	{
+		while (growing_.load(std::memory_order_acquire))
+			std::this_thread::yield();
+		return true;
+	}
+
+	bool grown = num_chunks() != nchunks;
+	if (!grown)
+	{
+		const size_type bytes = calc_size(chunk_capacity_);
+		void* mem = alloc_.allocate(bytes, label_, memory_alignment::cacheline);
+		if (mem)
+		{
+			chunks_[nchunks].initialize(mem, bytes);
+			nchunks_.store(nchunks + 1, std::memory_order_release);
+			grown = true;
+		}
+	}
+
+	growing_.store(false, std::memory_order_release);
+	return grown;
+}
+
+}
@@ -1,7 +1,8 @@
 // Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
 
 // O(1) fine-grained concurrent block allocator: uses space inside free blocks_ to 
-// maintain freelist.
+// maintain freelist. allocate_n/deallocate_n move a run of blocks with one CAS
+// and are what pool_magazine uses to cache blocks per thread.
 
 #pragma once
 #include <oArch/arch.h>
@@ -38,16 +39,16 @@ public:
 	void* deinitialize();                                                          // returns the memory passed to initialize()
 
 	size_type  block_size()           const { return stride_; }                    // size of each allocated block
-	size_type  count_free()           const;                                       // SLOW! (walks freelist) number of items available
-	size_type  size()                 const { return capacity() - count_free(); }  // SLOW! number of allocated elements
 	bool       valid()                const { return !!blocks_; }                  // true if the pool has been initialized
-	bool       full()                 const { return capacity() == count_free(); } // SLOW! true if there are no outstanding allocations
 
 
 	// === concurrent api ===
 
 	size_type  capacity()             const { return nblocks_; }                   // max number of items that can be available
 	bool       empty()                const;                                       // true if all items have been allocated
+	size_type  count_free()           const;                                       // number of items available (approximate while there are concurrent operations)
+	size_type  size()                 const { return capacity() - count_free(); }  // number of allocated elements (approximate while there are concurrent operations)
+	bool       full()                 const { return capacity() == count_free(); } // true if there are no outstanding allocations
 
 	bool       owns(index_type index) const { return index < nblocks_; }			     // range-check the pointer to within the pool
 	bool       owns(void* ptr)        const { return owns(index(ptr)); }			     // range-check the pointer to within the pool
@@ -58,6 +59,11 @@ public:
 	void*      allocate()                { return pointer(allocate_index()); }     // allocation returns a pointer to a block_size chunk
 	void       deallocate(void* pointer) { deallocate(index(pointer)); }           // free by pointer
 
+	size_type  allocate_n(index_type* indices, size_type count);                  // allocates up to count blocks with one CAS, returns the number allocated
+	size_type  allocate_n(void** pointers, size_type count);                      // same as above, by pointer
+	void       deallocate_n(const index_type* indices, size_type count);          // frees count blocks with one CAS
+	void       deallocate_n(void* const* pointers, size_type count);              // same as above, by pointer
+
 	void*      pointer(index_type index) const;                                   // pointer from index
 	index_type index(void* ptr)          const;                                   // index from pointer
 
@@ -72,8 +78,17 @@ private:
 			size_type stride_;
 			size_type nblocks_;
 			std::atomic_uint head_;
+			std::atomic_int nfree_; // maintained alongside the freelist so count_free() is O(1)
 		};
 	};
+
+	index_type& link(index_type index) const { return *(index_type*)(stride_*index + blocks_); }
+
+	// pops up to count linked blocks, returning the first and setting count to the number popped
+	index_type pop_chain(size_type& count);
+
+	// pushes count blocks already linked from first to last
+	void push_chain(index_type first, index_type last, size_type count);
 };
 static_assert(sizeof(concurrent_pool) == oCACHE_LINE_SIZE, "size mismatch");
 
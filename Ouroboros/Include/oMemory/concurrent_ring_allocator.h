@@ -1,14 +1,27 @@
 // Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
 
-// O(1) fine-grained concurrent ring allocator: behaves like a linear 
-// allocator but blocks on OOM. Memory is reclaimed by calling retire().
-
-// Use case: allocating commands to a GPU. Once GPU is finished, call
-// retire to notify that allocated memory is no longer in use.
+// O(1) fine-grained concurrent ring allocator: behaves like a linear
+// allocator, but memory is reclaimed in allocation order by retiring markers.
+
+// Use case: per-frame transient data with several frames in flight, such as
+// commands to a GPU or the task data of a double-buffered plan. At the end of a
+// frame record marker(). Once whoever consumes the frame is finished, pass that
+// marker to retire() to make everything allocated up to it available again.
+// Markers must be retired in the order they were taken.
+
+// Head and tail are byte positions that count up modulo twice the capacity and
+// are packed into one 64-bit atomic so allocate, retire and rewind are each a
+// single CAS. The extra lap bit distinguishes a full ring from an empty one and
+// lets a marker that has already been retired be detected and ignored, but only
+// until positions come around again: markers carry no generation, so once the
+// ring has allocated 2 * capacity bytes past a marker it aliases a newer 
+// position and is no longer recognized as stale. An allocation that doesn't fit
+// before the end of the buffer skips the remaining bytes and wraps to the start.
 
 #pragma once
 #include <oArch/arch.h>
 #include <oCore/byte.h>
+#include <oMemory/allocate.h>
 #include <atomic>
 #include <cstdint>
 
@@ -18,19 +31,31 @@ class concurrent_ring_allocator
 {
 public:
 	static const size_t default_alignment = oDEFAULT_MEMORY_ALIGNMENT;
+	static const size_t max_capacity = 0x7fffffff;
+
+	typedef uint32_t marker_type;
+
+	struct stats_t
+	{
+		size_t capacity;
+		size_t size;        // bytes between the oldest unretired allocation and the newest
+		size_t peak_size;   // high-water mark of size
+		uint32_t num_wraps; // times allocation skipped the end of the buffer
+		uint32_t num_failed_allocations;
+	};
 
 	// === non-concurrent api ===
 
 	// ctor creates as empty
-	concurrent_ring_allocator() : base_(nullptr), end_(nullptr) { head_tail_ = 0; }
+	concurrent_ring_allocator() : base_(nullptr), cap_(0) { head_tail_.store(0); peak_.store(0); nwraps_.store(0); nfailed_.store(0); }
 
-	// ctor moves an existing pool into this one
+	// ctor moves an existing ring into this one
 	concurrent_ring_allocator(concurrent_ring_allocator&& that)
-		: base_(that.base_), end_(that.end_)
-	{ head_tail_ = that.head_tail_; that = concurrent_ring_allocator(); }
+		: base_(that.base_), cap_(that.cap_)
+	{ head_tail_.store(that.head_tail_.load()); peak_.store(that.peak_.load()); nwraps_.store(that.nwraps_.load()); nfailed_.store(that.nfailed_.load()); that.base_ = nullptr; that.cap_ = 0; }
 
-	// ctor creates as a valid pool using external memory
-	concurrent_ring_allocator(void* arena, size_t bytes) { initialize(arena, bytes); }
+	// ctor creates as a valid ring using external memory
+	concurrent_ring_allocator(void* arena, size_t bytes) : concurrent_ring_allocator() { initialize(arena, bytes); }
 
 	// dtor
 	~concurrent_ring_allocator() { deinitialize(); }
@@ -42,108 +67,178 @@ public:
 		{
 			deinitialize();
 			base_ = that.base_; that.base_ = nullptr;
-			end_ = that.end_; that.end_ = nullptr;
-			head_.store(that.head_.load()); that.head_.store(nullptr);
+			cap_ = that.cap_; that.cap_ = 0;
+			head_tail_.store(that.head_tail_.load()); that.head_tail_.store(0);
+			peak_.store(that.peak_.load()); that.peak_.store(0);
+			nwraps_.store(that.nwraps_.load()); that.nwraps_.store(0);
+			nfailed_.store(that.nfailed_.load()); that.nfailed_.store(0);
 		}
 		return *this;
 	}
-	
+
 	void initialize(void* arena, size_t bytes)
 	{
+		if (!arena)
+			throw allocate_error(allocate_errc::invalid_ptr);
+		if (!bytes || bytes > max_capacity)
+			throw allocate_error(allocate_errc::invalid_capacity);
+
 		base_ = (uint8_t*)arena;
-		end_ = base_ + bytes;
-		head_tail_ = 0;
+		cap_ = uint32_t(bytes);
+		reset();
 	}
 
-	// deinitializes the pool and returns the memory passed to initialize()
+	// deinitializes the ring and returns the memory passed to initialize()
 	void* deinitialize()
 	{
-		return base_;
+		void* p = base_;
+		base_ = nullptr;
+		cap_ = 0;
+		head_tail_.store(0);
+		return p;
 	}
 
 	// returns the max number of bytes that can be allocated
-	inline size_t capacity() const { return size_t(end_ - base_); }
+	inline size_t capacity() const { return cap_; }
 
-	// returns the number of bytes available
-	inline size_t size_free() const { HT o; o.head_tail = head_tail; return (o.head < o.tail) ? (capacity() - o.tail + o.head) : (o.tail - o.head); }
+	// returns the number of bytes available, some of which may be lost to
+	// alignment or skipped when wrapping
+	inline size_t size_free() const { return cap_ - size(); }
 
-	// returns the number of allocated bytes
-	inline size_t size() const { HT o; o.head_tail = head_tail; return (o.head < o.tail) ? (o.tail - o.head) : (capacity() - o.head + o.tail); }
+	// returns the number of bytes from the oldest outstanding allocation to the newest
+	inline size_t size() const { ht o; o.head_tail = head_tail_.load(); return used(o.head, o.tail); }
 
 	// returns true of there are no outstanding allocations
 	inline bool full() const { return capacity() == size_free(); }
 
-	// returns the allocator to an empty state
+	// returns true if there is no room for any further allocation
+	inline bool empty() const { return size() == capacity(); }
+
+	stats_t get_stats() const
+	{
+		stats_t s;
+		s.capacity = capacity();
+		s.size = size();
+		s.peak_size = peak_.load(std::memory_order_relaxed);
+		s.num_wraps = nwraps_.load(std::memory_order_relaxed);
+		s.num_failed_allocations = nfailed_.load(std::memory_order_relaxed);
+		return s;
+	}
+
+	// returns the ring to an empty state, invalidating all outstanding markers
 	void reset()
 	{
-		head_tail_ = 0;
+		head_tail_.store(0);
+		peak_.store(0);
+		nwraps_.store(0);
+		nfailed_.store(0);
 	}
 
 	// === concurrent api ===
 
-	// simple range check that returns true if this index/pointer could have been allocated from this pool
-	bool owns(void* ptr) const { return ptr >= base_ && ptr < end_; }
+	// simple range check that returns true if this index/pointer could have been allocated from this ring
+	bool owns(void* ptr) const { return ptr >= base_ && ptr < base_ + cap_; }
 
-	// allocates memory of the specified size and alignment
-	void* allocate(size_t bytes, size_t alignment)
+	// allocates memory of the specified size and alignment or returns nullptr if
+	// it would overwrite memory that hasn't been retired
+	void* allocate(size_t bytes, size_t alignment = default_alignment)
 	{
-		uint8_t *p, *t;
-		HT o, n;
+		ht o, n;
+		uint32_t offset, need;
+		bool wrapped;
 		do
 		{
-			o.head_tail = head_tail;
-
-			p = align(base + o.tail, alignment);
-			n = p + bytes;
+			o.head_tail = head_tail_.load();
+			uint32_t start = o.tail;
+			offset = lap_offset(start);
+			uint32_t p = uint32_t(align(base_ + offset, alignment) - base_);
+			wrapped = size_t(p) + bytes > cap_;
+			n.head = o.head;
 
-			if (o.head < o.tail)
+			if (wrapped)
 			{
-				if (n > end_)
+				// skip what's left at the end of the buffer. If nothing is outstanding
+				// the skipped bytes are retired immediately.
+				start = advance(start, cap_ - offset);
+				if (o.head == o.tail)
+					n.head = start;
+				offset = 0;
+				p = uint32_t(align(base_, alignment) - base_);
+				if (size_t(p) + bytes > cap_)
 				{
-					// naive OOM, try wrapping
-					p = align(base, alignment);
-					n = p + bytes;
-
-					if (n > o.head)
-						return nullptr; // or spin waiting for a free
+					nfailed_++;
+					return nullptr;
 				}
 			}
 
-			else if (n > o.head)
-				return nullptr; // or spin waiting for a free
+			need = p + uint32_t(bytes) - offset;
+			n.tail = advance(start, need);
 
-			n.head = o.head;
-			n.tail = uint32_t(n - base_);
+			if (used(n.head, start) + size_t(need) > cap_)
+			{
+				nfailed_++;
+				return nullptr;
+			}
+
+			offset = p;
 
 		} while (!head_tail_.compare_exchange_strong(o.head_tail, n.head_tail));
-		return p;
+
+		if (wrapped)
+			nwraps_++;
+
+		const uint32_t sz = used(n.head, n.tail);
+		uint32_t peak = peak_.load(std::memory_order_relaxed);
+		while (sz > peak && !peak_.compare_exchange_weak(peak, sz, std::memory_order_relaxed));
+
+		return base_ + offset;
 	}
 
-	// returns the extent of allocates so far. Pass this value to reclaim() when
-	// these allocates aren't required anymore.
-	uint32_t marker()
+	template<typename T> T* allocate(size_t size = sizeof(T), size_t alignment = default_alignment) { return (T*)allocate(size, alignment); }
+
+	// returns the end of allocations so far. Pass this to retire() when the
+	// memory isn't required anymore or to rewind() to undo later allocations.
+	marker_type marker() const { ht o; o.head_tail = head_tail_.load(); return o.tail; }
+
+	// like free() this makes memory available again up until the specified
+	// marker. Retiring a marker that's already been retired is a noop that
+	// returns false, as long as fewer than 2 * capacity bytes have been 
+	// allocated since the marker was taken (see above).
+	bool retire(marker_type marker)
 	{
-		return head_tail_.tail;
+		ht o, n;
+		do
+		{
+			o.head_tail = head_tail_.load();
+			if (!contains(o, marker))
+				return false;
+			n.head = marker;
+			n.tail = o.tail;
+
+		} while (!head_tail_.compare_exchange_strong(o.head_tail, n.head_tail));
+		return true;
 	}
 
-	// like free() this makes memory available again up until the specified marker
-	void reclaim(uint32_t marker)
+	// releases everything allocated after the specified marker. If the marker
+	// has already been retired everything outstanding is released, with the
+	// same 2 * capacity limit on recognizing it as retire().
+	void rewind(marker_type marker)
 	{
-		HT o, n;
+		ht o, n;
 		do
 		{
-			o.head_tail = head_tail_;
-			n.head = frame;
-			n.tail = o.tail;
+			o.head_tail = head_tail_.load();
+			n.head = o.head;
+			n.tail = contains(o, marker) ? marker : o.head;
 
-		} while(!head_tail_.compare_exchange_strong(o.head_tail, n.head_tail));
+		} while (!head_tail_.compare_exchange_strong(o.head_tail, n.head_tail));
 	}
 
 private:
-	concurrent_ring_allocator(concurrent_ring_allocator&);
-	const concurrent_ring_allocator& operator=(const concurrent_ring_allocator&);
+	concurrent_ring_allocator(const concurrent_ring_allocator&); /* = delete */
+	const concurrent_ring_allocator& operator=(const concurrent_ring_allocator&); /* = delete */
 
-	union HT
+	union ht
 	{
 		uint64_t head_tail;
 		struct
@@ -154,8 +249,20 @@ private:
 	};
 
 	uint8_t* base_;
-	uint8_t* end_;
+	uint32_t cap_;
 	std::atomic<uint64_t> head_tail_;
+	std::atomic<uint32_t> peak_;
+	std::atomic<uint32_t> nwraps_;
+	std::atomic<uint32_t> nfailed_;
+
+	// positions are in [0, 2 * capacity)
+	inline uint32_t lap_offset(uint32_t pos) const { return pos >= cap_ ? pos - cap_ : pos; }
+	inline uint32_t advance(uint32_t pos, uint32_t bytes) const { const uint32_t twocap = cap_ * 2; pos += bytes; return pos >= twocap ? pos - twocap : pos; }
+	inline uint32_t used(uint32_t head, uint32_t tail) const { return tail >= head ? tail - head : tail + cap_ * 2 - head; }
+
+	// true if pos is in [head, tail]. A position more than one lap of the 
+	// 2 * capacity modulus old can't be told apart from a current one.
+	inline bool contains(const ht& o, uint32_t pos) const { return used(o.head, pos) <= used(o.head, o.tail); }
 };
 
 }
@@ -0,0 +1,121 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+// A per-thread cache of blocks in front of a concurrent pool, based on:
+// Bonwick & Adams, "Magazines and Vmem" (USENIX 2001).
+// concurrent_pool allocates and deallocates with a CAS on a single head, so
+// when many threads hit the same pool that cacheline bounces between them. A
+// magazine keeps a small stack of blocks owned by one thread and exchanges
+// them with the pool batch_size at a time using allocate_n/deallocate_n, so
+// most operations touch no shared memory at all.
+//
+// A magazine is not thread-safe: create one per thread (e.g. on the stack of a
+// worker's main loop) and let it go out of scope or call flush() before the
+// pool is deinitialized. Blocks held by a magazine count as allocated from the
+// pool's point of view. Blocks may be deallocated into a different magazine
+// (or directly to the pool) than the one that allocated them.
+//
+// poolT is any pool with allocate_n(void**, n) and deallocate_n(void* const*, n):
+// concurrent_pool, concurrent_object_pool, concurrent_growable_pool and
+// concurrent_growable_object_pool.
+
+#pragma once
+#include <cstdint>
+#include <new>
+
+namespace ouro {
+
+template<typename poolT, uint32_t BatchSize = 32>
+class pool_magazine
+{
+public:
+	typedef poolT pool_type;
+	typedef uint32_t size_type;
+
+	static const size_type batch_size = BatchSize;
+	static const size_type capacity = BatchSize * 2; // a full magazine returns half so alternating allocs and frees don't thrash
+
+
+	// non-concurrent api
+
+	pool_magazine() : pool_(nullptr), count_(0) {}
+	explicit pool_magazine(pool_type& pool) : pool_(&pool), count_(0) {}
+	~pool_magazine() { deinitialize(); }
+
+	// binds to pool, flushing anything cached from a prior pool
+	void initialize(pool_type& pool) { deinitialize(); pool_ = &pool; }
+
+	// returns all cached blocks and unbinds from the pool
+	void deinitialize() { flush(); pool_ = nullptr; }
+
+	// returns all cached blocks to the pool
+	void flush()
+	{
+		if (count_)
+		{
+			pool_->deallocate_n(blocks_, count_);
+			count_ = 0;
+		}
+	}
+
+	bool valid() const { return !!pool_; }
+
+	// number of blocks currently cached by this magazine
+	size_type size() const { return count_; }
+
+	pool_type* pool() const { return pool_; }
+
+	// returns a block from the magazine, refilling it from the pool when empty.
+	// Returns nullptr if the pool is exhausted.
+	void* allocate()
+	{
+		if (!count_)
+			count_ = pool_->allocate_n(blocks_, batch_size);
+		return count_ ? blocks_[--count_] : nullptr;
+	}
+
+	// caches the block, returning a batch to the pool when the magazine is full
+	void deallocate(void* pointer)
+	{
+		if (count_ == capacity)
+		{
+			pool_->deallocate_n(blocks_ + batch_size, batch_size);
+			count_ = batch_size;
+		}
+		blocks_[count_++] = pointer;
+	}
+
+private:
+	pool_type* pool_;
+	size_type count_;
+	void* blocks_[capacity];
+
+	pool_magazine(const pool_magazine&); /* = delete */
+	const pool_magazine& operator=(const pool_magazine&); /* = delete */
+};
+
+// adds typed create/destroy for concurrent_object_pool and
+// concurrent_growable_object_pool
+template<typename object_poolT, uint32_t BatchSize = 32>
+class object_pool_magazine : public pool_magazine<object_poolT, BatchSize>
+{
+public:
+	typedef typename object_poolT::value_type value_type;
+
+	object_pool_magazine() {}
+	explicit object_pool_magazine(object_poolT& pool) : pool_magazine<object_poolT, BatchSize>(pool) {}
+
+	value_type* create() { void* p = this->allocate(); return p ? new (p) value_type() : nullptr; }
+
+	template<typename A>
+	value_type* create(const A& a) { void* p = this->allocate(); return p ? new (p) value_type(a) : nullptr; }
+
+	template<typename A, typename B>
+	value_type* create(const A& a, const B& b) { void* p = this->allocate(); return p ? new (p) value_type(a,b) : nullptr; }
+
+	template<typename A, typename B, typename C>
+	value_type* create(const A& a, const B& b, const C& c) { void* p = this->allocate(); return p ? new (p) value_type(a,b,c) : nullptr; }
+
+	void destroy(value_type* ptr) { ptr->value_type::~value_type(); this->deallocate(ptr); }
+};
+
+}
@@ -39,6 +39,7 @@ public:
 	void* allocate(size_t size);                                                                             // if a best-fit is not available, this will allocate 1-size larger - careful with alignment relating to block size
 	void  deallocate(void* ptr);
 	bool  owns(void* ptr) const { return chunks_.owns(ptr); }                                                // range-check the pointer to within the allocator
+	size_type block_size(void* ptr) const;                                                                   // the block size that serviced an allocated pointer
 
 private:
 	struct chunk_t
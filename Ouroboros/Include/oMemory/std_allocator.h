@@ -5,6 +5,7 @@
 #pragma once
 #include <oMemory/allocate.h>
 #include <memory.h> // malloc/free
+#include <utility>
 
 #define oDEFINE_STD_ALLOCATOR_BOILERPLATE(ClassName) \
 	typedef size_t size_type; typedef ptrdiff_t difference_type; typedef T value_type; typedef T* pointer; typedef T const* const_pointer; typedef T& reference; typedef T const& const_reference; \
@@ -14,6 +15,7 @@
 	size_type max_size() const { return static_cast<size_type>(~0) / sizeof(value_type); } \
 	void construct(pointer p) { ::new (static_cast<void*>(p)) T(); } \
 	void construct(pointer p, const T& val) { ::new (static_cast<void*>(p)) T(val); } \
+	void construct(pointer p, T&& val) { ::new (static_cast<void*>(p)) T(std::move(val)); } \
 	void destroy(pointer p) { p->~T(); }
 
 #define oDEFINE_STD_ALLOCATOR_VOID_INSTANTIATION(ClassName) \
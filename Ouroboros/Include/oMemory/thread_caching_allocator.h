@@ -0,0 +1,162 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+// A concurrent general-purpose allocator that puts per-thread heaps in front of
+// small_block_allocator and tlsf_allocator, neither of which is thread-safe.
+//
+// The arena is split into a bookkeeping header, a small-block region and a
+// large-block region. The small-block region is divided into slabs that
+// threads claim lock-free; each slab is run by its own small_block_allocator
+// and only ever touched by the thread that owns it. Sizes are rounded up to one
+// of num_size_classes size classes and each heap caches a bounded freelist per
+// size class in front of its slabs, so a small allocation or a free by the
+// owning thread takes no locks and executes no atomic read-modify-write.
+//
+// A block freed by a thread other than the one that allocated it is pushed
+// onto the owning heap's remote-free list (one CAS) and reclaimed the next
+// time the owner misses in its slabs. Large allocations, over-aligned
+// allocations and threads that arrive after all heaps are taken go to the TLSF
+// backend under a lock.
+//
+// A thread binds to a heap on its first allocation and releases it when the
+// thread exits. Released heaps keep their slabs and outstanding blocks and are
+// adopted by the next thread that needs a heap.
+
+#pragma once
+#include <oArch/arch.h>
+#include <oMemory/allocate.h>
+#include <oMemory/concurrent_pool.h>
+#include <oMemory/small_block_allocator.h>
+#include <oMemory/tlsf_allocator.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+namespace ouro {
+
+namespace detail { struct thread_heap_bindings; }
+
+class thread_caching_allocator
+{
+public:
+	static const uint32_t max_heaps = 64;
+	static const uint32_t num_size_classes = small_block_allocator::max_num_block_sizes;
+	static const uint32_t max_small_size = 4096;
+	static const uint32_t slab_size = 8 * small_block_allocator::chunk_size;
+	static const size_t min_large_bytes = 64 * 1024;
+
+	// allocation sizes that are serviced by thread heaps
+	static const std::array<uint16_t, num_size_classes>& size_classes();
+
+	// A process-wide instance and functions that match allocate_fn and
+	// deallocate_fn so it can be used as an ouro::allocator, including as
+	// default_allocator. global() must be initialize()'ed before use.
+	static thread_caching_allocator& global();
+	static void* global_allocate(size_t bytes, const char* label = "?", const allocate_options& options = allocate_options());
+	static void global_deallocate(void* ptr);
+	static allocator global_allocator() { return allocator(global_allocate, global_deallocate); }
+
+
+	// non-concurrent api
+
+	thread_caching_allocator();
+	thread_caching_allocator(void* memory, size_t bytes, size_t small_bytes) : thread_caching_allocator() { initialize(memory, bytes, small_bytes); }
+	~thread_caching_allocator();
+	thread_caching_allocator(const thread_caching_allocator&) = delete;
+	const thread_caching_allocator& operator=(const thread_caching_allocator&) = delete;
+
+	// About small_bytes of memory go to slabs for thread heaps and the rest to
+	// TLSF. memory must be 16-byte aligned and have room for bookkeeping, at
+	// least one slab and min_large_bytes of large-block space.
+	void  initialize(void* memory, size_t bytes, size_t small_bytes);
+	void* deinitialize(); // returns memory passed to initialize(), throws if there are outstanding allocations
+
+	const void*     base()      const { return memory_; } // value passed to memory in initialize()
+	bool            valid()     const { return !!memory_; }
+	uint32_t        num_slabs() const { return nslabs_; }
+
+	// Sums the per-heap counters with the TLSF stats. Blocks freed remotely
+	// count as allocated until their owning heap reclaims them.
+	allocator_stats get_stats() const;
+
+
+	// concurrent api
+
+	bool  owns(void* ptr) const { return ptr >= memory_ && ptr < end_; }
+
+	void* allocate(size_t bytes, const char* label = "?", const allocate_options& options = allocate_options());
+	void  deallocate(void* ptr);
+
+private:
+	friend struct detail::thread_heap_bindings;
+
+	static const uint16_t nullidx = uint16_t(-1);
+
+	struct slab_t
+	{
+		slab_t() : heap(nullidx), next(nullidx), live(0) {}
+		small_block_allocator sba;
+		uint16_t heap;
+		uint16_t next;
+		uint32_t live;
+	};
+
+	// fields other than remote and in_use are only accessed by the thread bound 
+	// to the heap. The counters are atomic only so get_stats() can read them.
+	struct alignas(oCACHE_LINE_SIZE) heap_t
+	{
+		std::atomic<void*> remote;
+		std::atomic<uint32_t> in_use;
+		uint16_t first_slab;
+		uint16_t current_slab;
+		std::atomic<size_t> num_allocations;
+		std::atomic<size_t> allocated_bytes;
+		void* cache[num_size_classes];
+		uint16_t cache_count[num_size_classes];
+	};
+
+	uint8_t* memory_;
+	uint8_t* end_;
+	uint8_t* small_;
+	slab_t* slabs_;
+	uint32_t nslabs_;
+	uint64_t id_;
+
+	concurrent_pool free_slabs_;
+
+	mutable std::mutex large_mutex_;
+	tlsf_allocator large_;
+
+	std::array<uint8_t, max_small_size / 16> class_of_;
+	std::array<uint16_t, num_size_classes> cache_limit_;
+	heap_t heaps_[max_heaps];
+
+	static void reset_heap(heap_t& h);
+
+	// returns the heap bound to the calling thread, optionally binding one if
+	// there is none. Returns nullidx if there's no heap for this thread.
+	uint16_t this_heap(bool bind);
+	uint16_t acquire_heap();
+	void release_heap(uint16_t heap);
+
+	uint16_t slab_of(void* ptr) const { return uint16_t(((uint8_t*)ptr - small_) / slab_size); }
+	bool is_small(void* ptr) const { return ptr >= small_ && ptr < small_ + size_t(nslabs_) * slab_size; }
+
+	// user-level operations by the thread bound to the heap that go through the cache
+	void* heap_allocate(heap_t& h, uint16_t heap, uint8_t size_class);
+	void  heap_deallocate(heap_t& h, void* ptr);
+	bool  heap_reclaim(heap_t& h);
+
+	// returns up to count cached blocks of a size class to their slabs
+	void  flush_cache(heap_t& h, uint8_t size_class, uint32_t count);
+
+	void* slab_allocate(heap_t& h, uint16_t heap, uint16_t size);
+	void  slab_deallocate(heap_t& h, void* ptr);
+	bool  claim_slab(heap_t& h, uint16_t heap);
+	void  release_slab(heap_t& h, uint16_t slab);
+
+	void* large_allocate(size_t bytes, const char* label, const allocate_options& options);
+	void  large_deallocate(void* ptr);
+};
+
+}
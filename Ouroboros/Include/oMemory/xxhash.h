@@ -11,4 +11,19 @@ namespace ouro {
 uint32_t xxhash32(const void* buf, size_t buf_size, uint32_t seed = 0);
 uint64_t xxhash64(const void* buf, size_t buf_size, uint64_t seed = 0);
 
+// Hashes data that arrives in pieces to the same value xxhash32() gives all of
+// it at once.
+class xxhash32_stream
+{
+public:
+	xxhash32_stream(uint32_t seed = 0) { reset(seed); }
+
+	void reset(uint32_t seed = 0);
+	void update(const void* buf, size_t buf_size);
+	uint32_t digest() const;
+
+private:
+	uint64_t state_[6];
+};
+
 }
@@ -5,8 +5,7 @@
 #pragma once
 #include <oMath/hlsl.h>
 #include <oMemory/allocate.h>
-#include <oMemory/std_linear_allocator.h>
-#include <unordered_map>
+#include <oMemory/std_allocator.h>
 #include <vector>
 
 namespace ouro { namespace mesh { 
@@ -73,24 +72,9 @@ public:
 	float3*         normals()                   { return normals_.empty()   ? nullptr : normals_  .data(); }
 
 private:
-	struct index_t
-	{
-		uint32_t pos, tex, nrm;
-		bool operator==(const index_t& that) const { return pos == that.pos && tex == that.tex && nrm == that.nrm; }
-		uint64_t hash() const { std::hash<uint32_t> h; return h(pos) + 37 * h(tex) + 37 * h(nrm); }
-	};
-
-	struct index_hasher : public std::unary_function<index_t, uint64_t> { uint64_t operator()(const index_t& i) const { return i.hash(); } };
-
-	typedef std::vector<uint32_t, ouro_std_allocator<uint32_t>>                                          uint_vector;
-	typedef std::vector<float3,   ouro_std_allocator<float3>>                                            float3_vector;
-	typedef std::vector<group_t,  ouro_std_allocator<group_t>>                                           group_vector;
-	typedef ouro::std_linear_allocator<std::pair<const index_t, uint32_t>>                               allocator_type;
-	typedef std::unordered_map<index_t, uint32_t, index_hasher, std::equal_to<index_t>, allocator_type> index_map;
-	
-	uint32_t push_vertex(const index_t& ptn,                                                 index_map& map, const float3_vector& psrc, const float3_vector& tsrc, const float3_vector& nsrc);
-	void     push_triangle(const index_t& ptn_a, const index_t& ptn_b, const index_t& ptn_c, index_map& map, const float3_vector& psrc, const float3_vector& tsrc, const float3_vector& nsrc);
-	void     parse_index(const char** pp_str, const index_t& counts, index_t* index);
+	typedef std::vector<uint32_t, ouro_std_allocator<uint32_t>> uint_vector;
+	typedef std::vector<float3,   ouro_std_allocator<float3>>   float3_vector;
+	typedef std::vector<group_t,  ouro_std_allocator<group_t>>  group_vector;
 
 	uint_vector   indices_;
 	float3_vector positions_;
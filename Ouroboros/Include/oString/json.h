@@ -3,10 +3,17 @@
 // json document parser. Replaces delimiters inline with null terminators 
 // and caches indices to the values
 
+// Parsing makes two passes. The first classifies 64 bytes at a time with SSE2
+// to find every structural character, unescaped quote and start of a bare
+// value outside of strings. The second visits only those positions to build
+// the nodes. The passes alternate over windows of the text so the positions
+// stay small and in cache regardless of the document's size.
+
 #pragma once
 #include <oString/text_document.h>
 #include <cstdint>
 #include <cstring>
+#include <functional>
 
 namespace ouro {
 
@@ -20,6 +27,21 @@ public:
 
 	typedef struct node__ {}* node;
 
+	class visitor
+	{
+	public:
+		// Used with json::visit and json_stream. Events arrive depth-first in 
+		// document order. name is the member's name or empty for the root and array
+		// elements. value is the text as node_value would return it, so strings 
+		// keep their quotes and escapes. Pointers are only valid during the call.
+		// If any function returns false, traversal is aborted.
+		virtual bool object_begin(const char* name) = 0;
+		virtual bool object_end(const char* name) = 0;
+		virtual bool array_begin(const char* name) = 0;
+		virtual bool array_end(const char* name) = 0;
+		virtual bool value(const char* name, json_value_type type, const char* value) = 0;
+	};
+
 	json() : size_(0) {}
 	json(const char* uri, char* data, blob::deleter_fn deleter, size_t est_num_nodes = 100)
 		: buffer_(uri, data, deleter)
@@ -27,7 +49,7 @@ public:
 		size_ = sizeof(*this) + strlen(buffer_) + 1;
 		nodes_.reserve(est_num_nodes);
 		index_buffer();
-		size_ += nodes_.capacity() * sizeof(index_type) * 7;
+		size_ += nodes_.capacity() * sizeof(node_t);
 	}
 
 	json(const char* uri, const char* data, size_t est_num_nodes = 100)
@@ -35,11 +57,11 @@ public:
 		size_t copy_size = strlen(data) + 1;
 		char* copy = new char[copy_size];
 		strlcpy(copy, data, copy_size);
-		buffer_ = std::move(detail::text_buffer(uri, copy, copy_size, [](void* p) { delete p; }));
+		buffer_ = std::move(detail::text_buffer(uri, copy, copy_size, [](void* p) { delete [] (char*)p; }));
 		size_ = sizeof(*this) + copy_size;
 		nodes_.reserve(est_num_nodes);
 		index_buffer();
-		size_ += nodes_.capacity() * sizeof(index_type) * 7;
+		size_ += nodes_.capacity() * sizeof(node_t);
 	}
 
 	json(json&& that) { operator=(std::move(that)); }
@@ -49,6 +71,7 @@ public:
 		{
 			buffer_ = std::move(that.buffer_);
 			nodes_ = std::move(that.nodes_);
+			keys_ = std::move(that.keys_);
 			size_ = std::move(that.size_);
 		}
 		return *this;
@@ -67,9 +90,28 @@ public:
 	json_node_type node_type(node n) const { return Node(n).type; }
 	json_value_type value_type(node n) const { return Node(n).value_type; }
 
+	// Converts values from their text. as_int64 throws unless the value is an
+	// integer that fits, as_double unless it is a number and as_bool unless it
+	// is true or false.
+	int64_t as_int64(node n) const;
+	double as_double(node n) const;
+	bool as_bool(node n) const;
+
+	// Hashes the names of all object members so first_child(parent, name) no 
+	// longer compares against each sibling. This is worth it for documents with
+	// large objects whose members are looked up by name.
+	void index_keys();
+	inline bool has_key_index() const { return !keys_.empty(); }
+
+	// Returns false if the visitor aborted.
+	bool visit(visitor& visitor) const;
+
 	// Convenience functions that use the above API
 	inline node first_child(node parent_node, const char* name) const
 	{
+		if (!keys_.empty())
+			return find_key(parent_node, name);
+
 		node n = first_child(parent_node);
 		while (n && _stricmp(node_name(n), name))
 			n = next_sibling(n);
@@ -89,187 +131,85 @@ private:
 
 	struct node_t
 	{
-		node_t() : next(0), down(0), attr(0), name(0), value(0), type(json_node_type::object), value_type(json_value_type::object) {}
-		index_type next, down, attr, name, value;
+		node_t() : next(0), down(0), name(0), value(0), type(json_node_type::object), value_type(json_value_type::object) {}
+		index_type next, down, name, value;
 		json_node_type type;
 		json_value_type value_type;
 	};
 
+	struct key_slot
+	{
+		key_slot() : parent(0), child(0), hash(0) {}
+		index_type parent, child;
+		uint32_t hash;
+	};
+
 	typedef detail::text_buffer::std_vector<node_t> nodes_t;
+	typedef detail::text_buffer::std_vector<key_slot> keys_t;
 
 	nodes_t nodes_;
+	keys_t keys_; // open addressed, empty unless index_keys() was called
 	size_t size_;
 
 	inline const node_t& Node(node n) const { return nodes_[(size_t)n]; }
 
 	inline node_t& Node(node n) { return nodes_[(size_t)n]; }
 
-	// Parsing functions
-	inline void index_buffer();
-	inline node make_next_node(char*& json_buffer, node parent, node previous, bool is_array, int& open_tag_count, int& close_tag_count);
+	void index_buffer();
+	node find_key(node parent_node, const char* name) const;
+	bool visit(node n, visitor& visitor) const;
 };
 
-namespace detail
+// Parses json as it arrives in pieces of any size, such as from a file, a pipe
+// or a decompressor, and reports it to a visitor in the order json::visit 
+// does. Rather than the whole document, memory holds the value being parsed
+// and the names of the objects and arrays that enclose it.
+class json_stream
 {
-	inline bool skip_string(char*& json_buffer)
-	{
-		// json_buffer should point to the first character after the initial quote and 
-		// will then skip to the terminating quote.
-		do 
-		{
-			json_buffer += strcspn(json_buffer, "\\\"");
-			if (*json_buffer == '\\')
-			{
-				size_t numBackslashes = strspn(json_buffer, "\\");
-				json_buffer += numBackslashes;
-				if (*json_buffer == '\"' && (numBackslashes & 1) != 0)
-					++json_buffer;
-			}
-		}
-		while (*json_buffer != '\"' && *json_buffer != 0);
-		return *json_buffer == '\"';
-	}
-}
-
-void json::index_buffer()
-{
-	nodes_.push_back(node_t()); // use up slot 0 so it can be used as a null handle
-	nodes_.push_back(node_t()); // add root node
-
-	char* start = buffer_.c_str() + strcspn(buffer_.c_str(), "{[");
-	bool isArray = *start++ == '[';
-	*buffer_ = 0; // make the first char nul so 0 offsets are the empty string
-
-	int OpenTagCount = 0, CloseTagCount = 0; // these should be equal by the end
-	make_next_node(start, root(), 0, isArray, OpenTagCount, CloseTagCount); // start recursing
-	if (OpenTagCount != CloseTagCount) throw text_document_error(text_document_errc::unclosed_scope); // if not equal, something went wrong
-}
-
-json::node json::make_next_node(char*& json_buffer, node parent, node previous, bool is_array, int& open_tag_count, int& close_tag_count)
-{
-	open_tag_count++;
-
-	index_type newNode = static_cast<index_type>(nodes_.size());
-	if (parent) nodes_[(size_t)parent].down = newNode;
-
-	node hPreviousNode = previous;
-	bool hasMoreSiblings = false;
-	do 
-	{
-		newNode = static_cast<index_type>(nodes_.size());
-		if (hPreviousNode) nodes_[(size_t)hPreviousNode].next = newNode;
-
-		node_t n;
-		n.type = json_node_type::value;
-
-		if (is_array)
-		{
-			n.name = 0;
-
-			// Skip whitespace
-			json_buffer += strspn(json_buffer, " \t\v\r\n");
-		}
-		else
-		{
-			// Set name without the quotes, so zero terminate on the end quote
-			json_buffer += strcspn(json_buffer, "\"");
-			n.name = static_cast<index_type>(std::distance(buffer_.c_str(), ++json_buffer));
-			if (!detail::skip_string(json_buffer))
-				return 0;
-			*json_buffer++ = 0;
-
-			// Skip to value begin
-			json_buffer += strspn(json_buffer, " \t\v\r\n:");
-		}
-
-		// Set value
-		n.value = static_cast<index_type>(std::distance(buffer_.c_str(), json_buffer));
-
-		// Push new node
-		nodes_.push_back(n);
-
-		parent = node(uintptr_t(newNode));
-		node prev = 0;
-
-		// Determine node type and process it
-		if (*json_buffer == '{')
-		{
-			nodes_[newNode].type = json_node_type::object;
-			nodes_[newNode].value = 0;
-			nodes_[newNode].value_type = json_value_type::object;
-
-			// CreateNextNode sets down and next for newNode
-			hPreviousNode = make_next_node(++json_buffer, parent, prev, false, open_tag_count, close_tag_count);
-			if (!hPreviousNode) return 0;
-		}
-		else if (*json_buffer == '[')
-		{
-			nodes_[newNode].type = json_node_type::array;
-			nodes_[newNode].value = 0;
-			nodes_[newNode].value_type = json_value_type::array;
-
-			// CreateNextNode sets down and next for newNode
-			hPreviousNode = make_next_node(++json_buffer, parent, prev, true, open_tag_count, close_tag_count);
-			if (!hPreviousNode) return 0;
-		}
-		else if (*json_buffer == '\"')
-		{
-			nodes_[newNode].value_type = json_value_type::string;
-			detail::skip_string(++json_buffer);
-			json_buffer++;
-		}
-		else if (*json_buffer == 't')
-		{
-			nodes_[newNode].value_type = json_value_type::true_;
-			if (0 != memcmp(json_buffer, "true", 4)) return 0;
-			json_buffer += 4;
-		}
-		else if (*json_buffer == 'f')
-		{
-			nodes_[newNode].value_type = json_value_type::false_;
-			if (0 != memcmp(json_buffer, "false", 5)) return 0;
-			json_buffer += 5;
-
-		}
-		else if (*json_buffer == 'n')
-		{
-			nodes_[newNode].value_type = json_value_type::null;
-			if (0 != memcmp(json_buffer, "null", 4)) return 0;
-			json_buffer += 4;
-		}
-		else if (*json_buffer != 0)
-		{
-			nodes_[newNode].value_type = json_value_type::number;
-			json_buffer += strspn(json_buffer, "0123456789eE+-.");
-		}
-		else
-		{
-			return 0;
-		}
+public:
+	// Returns the number of bytes copied into dst, 0 at the end of the input.
+	typedef std::function<size_t(void* dst, size_t dst_size)> read_fn;
 
-		char* Marker = json_buffer;
+	json_stream(json::visitor& visitor);
 
-		// Skip whitespace to either the next name/value pair
-		// or end of Object/Array marker
-		if (is_array)
-			json_buffer += strcspn(json_buffer, ",]");
-		else
-			json_buffer += strcspn(json_buffer, ",}");
+	// Consumes the next piece of the document. Returns false once the visitor
+	// has aborted, after which input is ignored.
+	bool write(const void* src, size_t src_size);
 
-		hasMoreSiblings = (*json_buffer == ',');
+	// Throws if the document is incomplete, otherwise returns false if the 
+	// visitor aborted.
+	bool finish();
 
-		// Clear from the marker to current pos to make sure the value above
-		// gets zero terminated. We have to do that here because there is not
-		// guaranteed room for a zero terminator until we've parsed until here.
-		memset(Marker, 0, std::distance(Marker, ++json_buffer));
+	// Writes whatever read returns in pieces of up to chunk_size, then finishes.
+	bool read(const read_fn& read, size_t chunk_size = 64 * 1024);
 
-		hPreviousNode = node(uintptr_t(newNode));
+private:
+	json_stream(const json_stream&); /* = delete */
+	const json_stream& operator=(const json_stream&); /* = delete */
 
-	} while (hasMoreSiblings);
+	enum class state { root, value, member, colon, after_value, string, scalar, done };
 
-	close_tag_count++;
+	struct scope
+	{
+		uint32_t name; // offset into names_
+		bool is_array;
+	};
 
-	return (*json_buffer != 0) ? node(uintptr_t(newNode)) : 0;
-}
+	void open(bool is_array);
+	void close();
+	void end_scalar();
+	inline const char* member_name() const { return scopes_.back().is_array ? "" : name_.data(); }
+
+	json::visitor& visitor_;
+	state state_;
+	bool in_name_;
+	bool escaped_;
+	bool empty_scope_;
+	bool aborted_;
+	detail::text_buffer::std_vector<char> token_;
+	detail::text_buffer::std_vector<char> name_;
+	detail::text_buffer::std_vector<char> names_;
+	detail::text_buffer::std_vector<scope> scopes_;
+};
 
 }
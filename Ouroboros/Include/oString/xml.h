@@ -17,6 +17,7 @@
 #include <oString/text_document.h>
 #include <cstdint>
 #include <cstring>
+#include <functional>
 
 // Convenience macros for iterating through a list of child nodes_ and attrs_
 #define oString_xml_foreach_child(child__, xml__, parent__) for (ouro::xml::node (child__) = (xml__).first_child(parent__); (child__); (child__) = (xml__).next_sibling(child__))
@@ -66,7 +67,7 @@ public:
 		size_t copy_size = strlen(data) + 1;
 		char* copy = new char[copy_size];
 		strlcpy(copy, data, copy_size);
-		buffer_ = std::move(detail::text_buffer(uri, copy, copy_size, [](void* p) { delete p; }));
+		buffer_ = std::move(detail::text_buffer(uri, copy, copy_size, [](void* p) { delete [] (char*)p; }));
 		size_ = sizeof(*this) + copy_size;
 		nodes_.reserve(est_num_nodes_);
 		attrs_.reserve(est_num_attrs_);
@@ -101,7 +102,7 @@ public:
 	
 	// Attribute API
 	inline attr first_attr(node n) const { return attr(uintptr_t(Node(n).Attr)); }
-	inline attr next_attr(attr a) const { return Attr(a).name ? attr(a + 1) : 0; }
+	inline attr next_attr(attr a) const { return Attr(a + 1).name ? attr(a + 1) : 0; }
 	inline const char_type* attr_name(attr a) const { return buffer_.c_str() + Attr(a).name; }
 	inline const char_type* attr_value(attr a) const { return buffer_.c_str() + Attr(a).value; }
 	
@@ -423,6 +424,63 @@ private:
 	}
 };
 
+// Parses xml as it arrives in pieces of any size, such as from a file, a pipe
+// or a decompressor, and reports it to a visitor in the order xml::visit does
+// except that every top-level node is visited. Rather than the whole document,
+// memory holds the tag or text being parsed and the names and xrefs of the 
+// nodes that enclose it. CDATA sections are reported as text.
+class xml_stream
+{
+public:
+	// Returns the number of bytes copied into dst, 0 at the end of the input.
+	typedef std::function<size_t(void* dst, size_t dst_size)> read_fn;
+
+	xml_stream(xml::visitor& visitor);
+
+	// Consumes the next piece of the document. Returns false once the visitor
+	// has aborted, after which input is ignored.
+	bool write(const void* src, size_t src_size);
+
+	// Throws if the document is incomplete, otherwise returns false if the 
+	// visitor aborted.
+	bool finish();
+
+	// Writes whatever read returns in pieces of up to chunk_size, then finishes.
+	bool read(const read_fn& read, size_t chunk_size = 64 * 1024);
+
+private:
+	xml_stream(const xml_stream&); /* = delete */
+	const xml_stream& operator=(const xml_stream&); /* = delete */
+
+	enum class state { text, markup, tag, comment, declaration, cdata };
+
+	struct scope
+	{
+		uint32_t name; // offset into names_
+		uint32_t xref; // offset into xrefs_
+		uint32_t num_children;
+	};
+
+	void classify_markup();
+	void end_tag();
+	void start_tag();
+	inline bool keeps_text() const { return !scopes_.empty() && !scopes_.back().num_children; }
+
+	xml::visitor& visitor_;
+	state state_;
+	char quote_;         // the quote a tag's attribute value is in, if any
+	uint32_t run_;       // closing characters seen at the end of a comment or CDATA
+	uint32_t depth_;     // brackets open in a declaration
+	uint32_t num_roots_;
+	bool aborted_;
+	detail::text_buffer::std_vector<char> text_;
+	detail::text_buffer::std_vector<char> unit_;
+	detail::text_buffer::std_vector<char> names_;
+	detail::text_buffer::std_vector<char> xrefs_;
+	detail::text_buffer::std_vector<scope> scopes_;
+	detail::text_buffer::std_vector<xml::visitor::attr_type> attrs_;
+};
+
 	namespace detail
 	{
 		// _xml must be pointing at a '<' char_type. This will leave _xml point at a '<'
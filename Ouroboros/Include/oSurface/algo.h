@@ -44,22 +44,53 @@ void enumerate_pixels(const info_t& input_info
 	, mapped_subresource& mapped_output
 	, const std::function<void(const void* oRESTRICT pixel1, const void* oRESTRICT pixel2, void* oRESTRICT out_pixel)>& enumerator);
 
+// Comparisons below work on luminance (BT.709 weights on the stored values) in 
+// [0,255]. Inputs can be r8_unorm, r8g8b8_unorm, b8g8r8_unorm, r8g8b8a8_unorm,
+// r8g8b8x8_unorm, b8g8r8a8_unorm or b8g8r8x8_unorm.
+struct diff_stats_t
+{
+	float rms;         // root mean square of the per-pixel difference
+	float psnr;        // peak signal-to-noise ratio in dB, infinity if identical
+	uint32_t max_diff; // largest per-pixel difference
+};
+
+// Returns statistics on the difference between the two surfaces.
+diff_stats_t calc_diff_stats(const info_t& info
+	, const const_mapped_subresource& mapped1
+	, const const_mapped_subresource& mapped2);
+
+// Same as above but also fills the output surface with abs(Input1 - Input2) * 
+// diff_scale for each pixel, clamped to 255. The output must be r8_unorm.
+diff_stats_t calc_diff_stats(const info_t& input_info
+	, const const_mapped_subresource& mapped_input1
+	, const const_mapped_subresource& mapped_input2
+	, const info_t& output_info
+	, mapped_subresource& mapped_output
+	, uint32_t diff_scale = 1);
+
 // Returns the root mean square of the difference between the two surfaces.
 float calc_rms(const info_t& info
 	, const const_mapped_subresource& mapped1
 	, const const_mapped_subresource& mapped2);
 
-// Fills the output surface with abs(Input1 - Input2) for each pixel and returns 
-// the root mean square. Currently the only supportedoutput image is r8_unorm.
-// Inputs can be r8_unorm, b8g8r8_unorm, b8g8r8a8_unorm
 float calc_rms(const info_t& input_info
-	, const const_mapped_subresource& mappedInput1
-	, const const_mapped_subresource& mappedInput2
+	, const const_mapped_subresource& mapped_input1
+	, const const_mapped_subresource& mapped_input2
 	, const info_t& output_info
-	, mapped_subresource& mapped_output);
+	, mapped_subresource& mapped_output
+	, uint32_t diff_scale = 1);
+
+// Returns the mean structural similarity of the two surfaces in [-1,1] where 1 
+// is identical. Unlike rms this is sensitive to changes in structure (blur, 
+// banding, shifted edges) more than to uniform changes in brightness.
+float calc_ssim(const info_t& info
+	, const const_mapped_subresource& mapped1
+	, const const_mapped_subresource& mapped2);
 
 // Fills the specified array with the count of pixels at each luminance value.
-// (lum [0,1] mapped to [0,255] or [0,65536]).
+// histogram8 takes the same formats as the comparisons above. histogram16 
+// takes r16_unorm or r16_float, the latter clamped to [0,1] and mapped to 
+// [0,65535].
 void histogram8(const info_t& info, const const_mapped_subresource& mapped, uint32_t histogram[256]);
 void histogram16(const info_t& info, const const_mapped_subresource& mapped, uint32_t histogram[65536]);
 
@@ -15,3 +15,4 @@
 #include <oSurface/subresource.h>
 #include <oSurface/surface.h>
 #include <oSurface/tile.h>
+#include <oSurface/tiled_image.h>
@@ -8,6 +8,8 @@
 
 namespace ouro { namespace surface {
 
+namespace detail { class row_decoder; class row_encoder; }
+
 enum class file_format : uint8_t
 {
 	unknown,
@@ -20,6 +22,8 @@ enum class file_format : uint8_t
 	oimg,
 };
 
+// oimg compresses each subresource with lz4 for low, gzip for medium and lzma
+// for high. Other codecs map these to their own settings.
 enum class compression : uint8_t
 {
 	none,
@@ -42,15 +46,19 @@ inline info_t get_info(const blob& buffer) { return get_info(buffer, buffer.size
 
 // returns a buffer ready to be written to disk in the specified format.
 // this may use the specified allocator to convert the texel buffer to 
-// the input format for the codec.
+// the input format for the codec. If desired_format is block-compressed every
+// subresource, including mips smaller than a block, is compressed with the
+// specified quality.
 blob encode(const image& img, const file_format& fmt
 	, const allocator& file_alloc = default_allocator
 	, const allocator& temp_alloc = default_allocator
 	, const format& desired_format = format::unknown
-	, const compression& compression = compression::low);
+	, const compression& compression = compression::low
+	, const bc_quality& quality = bc_quality::fast);
 
 inline blob encode(const image& img, const file_format& fmt, const format& desired_format
-	, const compression& compression = compression::low) { return encode(img, fmt, default_allocator, default_allocator, desired_format, compression); }
+	, const compression& compression = compression::low
+	, const bc_quality& quality = bc_quality::fast) { return encode(img, fmt, default_allocator, default_allocator, desired_format, compression, quality); }
 
 // Parses the in-memory formatted buffer into a surface. temp_alloc will be used
 // for any conversion or temporary storage, texel_alloc will be used for image.
@@ -73,4 +81,116 @@ inline image decode(const blob& buffer
 	, const format& desired_format
 	, const mip_layout& layout = mip_layout::none) { return decode(buffer, buffer.size(), default_allocator, default_allocator, desired_format, layout); }
 
+// oimg files encoded with compression::none store texels exactly as an image 
+// lays them out starting at a 64-byte aligned offset so they can be used in 
+// place, such as from a memory-mapped file. If buffer holds such a file (at 
+// least through the start of the texels) this returns true along with the 
+// info and where the texels are in the file. It returns false otherwise, in 
+// which case decode() is required.
+bool get_oimg_bits(const void* buffer, size_t size, info_t* out_info, uint64_t* out_offset, uint64_t* out_size);
+
+// _____________________________________________________________________________
+// Streaming
+
+// The codecs below store images as scanlines so they can be processed in 
+// bands of rows with memory bounded by the band size rather than the image 
+// size. Supported for bmp, jpg, png (not interlaced) and tga.
+bool supports_streaming(const file_format& fmt);
+
+// Pulls rows out of an encoded buffer top to bottom. The buffer must remain 
+// valid for the life of the decoder.
+class decoder
+{
+public:
+	decoder() : impl_(nullptr) {}
+	decoder(const void* buffer, size_t size, const allocator& temp_alloc = default_allocator) : impl_(nullptr) { initialize(buffer, size, temp_alloc); }
+	decoder(decoder&& that) : impl_(that.impl_), alloc_(that.alloc_) { that.impl_ = nullptr; }
+	~decoder() { deinitialize(); }
+	decoder& operator=(decoder&& that);
+
+	void initialize(const void* buffer, size_t size, const allocator& temp_alloc = default_allocator);
+	void deinitialize();
+
+	// format and dimensions of the rows produced by read()
+	info_t info() const;
+
+	// the index of the next row read() will produce
+	uint32_t row() const;
+	bool done() const { return row() >= info().dimensions.y; }
+
+	// decodes up to num_rows rows into dst and returns the number decoded
+	uint32_t read(const mapped_subresource& dst, uint32_t num_rows);
+
+private:
+	decoder(const decoder&); /* = delete */
+	const decoder& operator=(const decoder&); /* = delete */
+
+	detail::row_decoder* impl_;
+	allocator alloc_;
+};
+
+// Accepts rows top to bottom and returns the encoded file from finish(). 
+// info() reports the format the codec requires for the rows passed to write(), 
+// which may differ from the requested one.
+class encoder
+{
+public:
+	encoder() : impl_(nullptr) {}
+	encoder(const file_format& fmt, const info_t& info
+		, const allocator& file_alloc = default_allocator
+		, const allocator& temp_alloc = default_allocator
+		, const compression& compression = compression::low) : impl_(nullptr) { initialize(fmt, info, file_alloc, temp_alloc, compression); }
+	encoder(encoder&& that) : impl_(that.impl_), alloc_(that.alloc_) { that.impl_ = nullptr; }
+	~encoder() { deinitialize(); }
+	encoder& operator=(encoder&& that);
+
+	void initialize(const file_format& fmt, const info_t& info
+		, const allocator& file_alloc = default_allocator
+		, const allocator& temp_alloc = default_allocator
+		, const compression& compression = compression::low);
+	void deinitialize();
+
+	// format and dimensions of the rows expected by write()
+	info_t info() const;
+
+	// the index of the next row write() will consume
+	uint32_t row() const;
+	bool done() const { return row() >= info().dimensions.y; }
+
+	// encodes num_rows rows from src, throws if that's more than remain
+	void write(const const_mapped_subresource& src, uint32_t num_rows);
+
+	// returns the encoded file, throws if not all rows have been written
+	blob finish();
+
+private:
+	encoder(const encoder&); /* = delete */
+	const encoder& operator=(const encoder&); /* = delete */
+
+	detail::row_encoder* impl_;
+	allocator alloc_;
+};
+
+// Re-encodes buffer as fmt rows_per_band rows at a time, converting to 
+// desired_format (or the closest format fmt supports) along the way. Peak 
+// temporary memory is about two bands.
+blob transcode(const void* buffer, size_t size, const file_format& fmt
+	, const format& desired_format = format::unknown
+	, uint32_t rows_per_band = 64
+	, const allocator& file_alloc = default_allocator
+	, const allocator& temp_alloc = default_allocator
+	, const compression& compression = compression::low);
+
+// Same as above but also resizes to dimensions with f. Bands are rows_per_band 
+// destination rows and only the source rows their filter taps reach (see 
+// resize_source_rows) are kept, already converted to the encoded format.
+blob transcode(const void* buffer, size_t size, const file_format& fmt
+	, const uint2& dimensions
+	, const filter& f = filter::lanczos3
+	, const format& desired_format = format::unknown
+	, uint32_t rows_per_band = 64
+	, const allocator& file_alloc = default_allocator
+	, const allocator& temp_alloc = default_allocator
+	, const compression& compression = compression::low);
+
 }}
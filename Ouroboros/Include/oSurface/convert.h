@@ -1,9 +1,12 @@
 // Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
 
-// Facade for various conversion formats. Not all are supported but as 
-// easy to add over time.
+// Facade for various conversion formats. Any two formats whose texels can be
+// described channel by channel convert to each other; planar, paletted, 
+// subsampled and typeless formats can only be copied to the same format and
+// block-compressed formats can only be a destination.
 
 #pragma once
+#include <oMemory/allocate.h>
 #include <oSurface/subresource.h>
 
 namespace ouro { namespace surface {
@@ -14,9 +17,20 @@ namespace ouro { namespace surface {
 // must match the width * format size for each respectively. Otherwise row pitches 
 // can differ so that copying a subsurface out of a larger surface or copying into 
 // a part of a surface can be done.
+// Block compression runs in parallel bands of block rows and converts the 
+// source to the compressor's input format a band at a time in scratch from 
+// temp_alloc, which is called from worker threads so must be thread-safe. 
+// Dimensions that aren't a multiple of the block size are padded by repeating 
+// edge texels.
+// Channels missing from the source are 0 except alpha, which is 1. uint and 
+// sint channels convert as integer values, not normalized ones. An 8-bit rgb 
+// source converted to r8_unorm becomes luminance. Throws std::errc::not_supported
+// for formats that can't be converted.
 void convert_formatted(const mapped_subresource& dst, const format& dst_format
 	, const const_mapped_subresource& src, const format& src_format
-	, const uint3& dimensions, const copy_option& option = copy_option::none);
+	, const uint3& dimensions, const copy_option& option = copy_option::none
+	, const bc_quality& quality = bc_quality::fast
+	, const allocator& temp_alloc = default_allocator);
 
 // Copies elements from one buffer to another, one format/layout to another. Instead 
 // of rows and depth slices this concentrates on element pitch enabling homogenous 
@@ -7,6 +7,7 @@
 #pragma once
 #include <oMemory/allocate.h>
 #include <oConcurrency/mutex.h>
+#include <oSurface/algo.h>
 #include <oSurface/box.h>
 #include <oSurface/surface.h>
 #include <oSurface/resize.h>
@@ -17,9 +18,9 @@ namespace ouro { namespace surface {
 class image
 {
 public:
-	image() : bits_(nullptr) {}
-	image(const info_t& info, const allocator& alloc = default_allocator) { initialize(info, alloc); }
-	image(const info_t& info, const void* data, const allocator& alloc = noop_allocator) { initialize(info, data, alloc); }
+	image() : bits_(nullptr), read_only_(false) {}
+	image(const info_t& info, const allocator& alloc = default_allocator) : bits_(nullptr), read_only_(false) { initialize(info, alloc); }
+	image(const info_t& info, const void* data, const allocator& alloc = noop_allocator) : bits_(nullptr), read_only_(false) { initialize(info, data, alloc); }
 
 	~image() { deinitialize(); }
 
@@ -32,6 +33,11 @@ public:
 	// create a buffer using the specified pointer; alloc will be used to manage its lifetime.
 	void initialize(const info_t& info, const void* data, const allocator& alloc = noop_allocator);
 
+	// same as above, but data is never written, i.e. it's a read-only file 
+	// mapping. The image is immutable(): map() and anything else that writes 
+	// texels throws, so use map_const() and shared_lock to read it.
+	void initialize_read_only(const info_t& info, const void* data, const allocator& alloc = noop_allocator);
+
 	// create an array buffer out of several subbuffers of the same format
 	void initialize_array(const image* const* sources, uint32_t num_sources, bool mips = false);
 	template<size_t N> void initialize_array(const image* const (&sources)[N], bool mips = false) { initialize_array(sources, N, mips); }
@@ -43,7 +49,7 @@ public:
 	void deinitialize();
 
 	operator bool() const { return !!bits_; }
-	inline bool immutable() const { return !!bits_ && !alloc_; }
+	inline bool immutable() const { return !!bits_ && (read_only_ || !alloc_); }
 
 	inline info_t info() const { return info_; }
 	inline void set_semantic(const semantic& s) { info_.semantic = s; }
@@ -67,7 +73,8 @@ public:
 	void update_subresource(uint32_t subresource, const const_mapped_subresource& src, const copy_option& option = copy_option::none);
 	void update_subresource(uint32_t subresource, const box_t& box, const const_mapped_subresource& src, const copy_option& option = copy_option::none);
 
-	// locks internal memory for read/write and returns parameters for working with it
+	// locks internal memory for read/write and returns parameters for working with it. 
+	// This throws if the image is immutable().
 	void map(uint32_t subresource, mapped_subresource* out_mapped, uint2* out_byte_dimensions = nullptr);
 	void unmap(uint32_t subresource);
 
@@ -80,13 +87,14 @@ public:
 	inline void copy_from(uint32_t subresource, const const_mapped_subresource& src, const copy_option& option = copy_option::none) { update_subresource(subresource, src, option); }
 	inline void copy_from(uint32_t subresource, const image& src, uint32_t src_subresource, const copy_option& option = copy_option::none);
 
-	// initializes a resized and reformatted copy of this buffer allocated from the same or a user-specified allocator
-	image convert(const info_t& dst_info) const;
-	image convert(const info_t& dst_info, const allocator& alloc) const;
+	// initializes a resized and reformatted copy of this buffer allocated from the same or a user-specified allocator.
+	// Block compression also takes its scratch from that allocator on worker threads.
+	image convert(const info_t& dst_info, const bc_quality& quality = bc_quality::fast) const;
+	image convert(const info_t& dst_info, const allocator& alloc, const bc_quality& quality = bc_quality::fast) const;
 
 	// initializes a reformatted copy of this buffer allocated from the same or a user-specified allocator
-	inline image convert(const format& dst_format) const { info_t si = info(); si.format = dst_format; return convert(si); }
-	inline image convert(const format& dst_format, const allocator& alloc) const { info_t si = info(); si.format = dst_format; return convert(si, alloc); }
+	inline image convert(const format& dst_format, const bc_quality& quality = bc_quality::fast) const { info_t si = info(); si.format = dst_format; return convert(si, quality); }
+	inline image convert(const format& dst_format, const allocator& alloc, const bc_quality& quality = bc_quality::fast) const { info_t si = info(); si.format = dst_format; return convert(si, alloc, quality); }
 
 	// copies to a mapped subresource of the same dimension but the specified format
 	void convert_to(uint32_t subresource, const mapped_subresource& dst, const format& dst_format, const copy_option& option = copy_option::none) const;
@@ -97,13 +105,18 @@ public:
 	// For compatible types such as RGB <-> BGR do conversion in-place
 	void convert_in_place(const format& fmt);
 
-	// Uses the top-level mip as a source and replaces all other mips with a filtered version
-	void generate_mips(const filter& f = filter::lanczos2);
+	// Replaces all mips below the top level, filtering each from the one above it. 
+	// sRGB formats are filtered in linear space. filter::box on power-of-two 
+	// levels takes a 2x2 average fast path. If alpha_test_ref is greater than 0
+	// alpha is rescaled at each level so the fraction of texels with alpha above
+	// it matches the top level, which keeps alpha-tested cutouts from thinning.
+	void generate_mips(const filter& f = filter::lanczos2, float alpha_test_ref = 0.0f);
 
 private:
 	info_t info_;
 	void* bits_;
 	allocator alloc_;
+	bool read_only_;
 	
 	typedef ouro::shared_mutex mutex_t;
 	typedef ouro::lock_guard<mutex_t> lock_t;
@@ -113,6 +126,8 @@ private:
 	inline void lock_shared() const { mtx.lock_shared(); }
 	inline void unlock_shared() const { mtx.unlock_shared(); }
 
+	void check_mutable() const;
+
 	image(const image&);
 	const image& operator=(const image&);
 };
@@ -192,4 +207,12 @@ inline void image::copy_from(uint32_t subresource, const image& src, uint32_t sr
 float calc_rms(const image& b1, const image& b2);
 float calc_rms(const image& b1, const image& b2, image* out_diffs, int diff_scale = 1, const allocator& alloc = default_allocator);
 
+// same as calc_rms but returns psnr and the largest difference as well. All
+// subresources are compared and weighted by their size.
+diff_stats_t calc_diff_stats(const image& b1, const image& b2, image* out_diffs = nullptr, int diff_scale = 1, const allocator& alloc = default_allocator);
+
+// returns the mean structural similarity of the two surfaces (1 is identical)
+// with the same requirements as calc_rms.
+float calc_ssim(const image& b1, const image& b2);
+
 }}
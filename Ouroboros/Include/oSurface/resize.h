@@ -1,10 +1,12 @@
 // Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
 
 // API to change the size of a surface through filtering, clipping or padding.
-// These APIs do not allocate memory so all buffers should be valid before
-// calling any of these.
+// All buffers should be valid before calling any of these. Only resize 
+// allocates: scratch memory for intermediate rows comes from the specified
+// allocator.
 
 #pragma once
+#include <oMemory/allocate.h>
 #include <oSurface/subresource.h>
 
 namespace ouro { namespace surface {
@@ -20,7 +22,19 @@ enum class filter : uint8_t
 	count,
 };
 
-void resize(const info_t& src_info, const const_mapped_subresource& src, const info_t& dst_info, const mapped_subresource& dst, const filter& f = filter::lanczos3);
+// Filters destination rows in parallel. Output is the same no matter how many
+// threads participate. scratch is called from those threads, so it must be
+// thread-safe.
+void resize(const info_t& src_info, const const_mapped_subresource& src, const info_t& dst_info, const mapped_subresource& dst, const filter& f = filter::lanczos3, const allocator& scratch = default_allocator);
+
+// Resizing a band at a time: returns the source rows [x,y) that filtering 
+// destination rows [dst_begin,dst_end) reads. resize_rows writes only those 
+// destination rows, the first of them at dst.data, from src whose data is 
+// source row src_first_row and which holds through the end of that range. Each 
+// row comes out exactly as resize would write it, so streams such as 
+// transcode can resize without the whole source or destination in memory.
+uint2 resize_source_rows(uint32_t src_height, uint32_t dst_height, const filter& f, uint32_t dst_begin, uint32_t dst_end);
+void resize_rows(const info_t& src_info, const const_mapped_subresource& src, uint32_t src_first_row, const info_t& dst_info, const mapped_subresource& dst, uint32_t dst_begin, uint32_t dst_end, const filter& f = filter::lanczos3, const allocator& scratch = default_allocator);
 void clip(const info_t& src_info, const const_mapped_subresource& src, const info_t& dst_info, const mapped_subresource& dst, uint2 src_offset = uint2(0, 0));
 void pad(const info_t& src_info, const const_mapped_subresource& src, const info_t& dst_info, const mapped_subresource& dst, uint2 dst_offset = uint2(0, 0));
 
@@ -157,6 +157,18 @@ enum class copy_option : uint8_t
 	flip_vertically,
 };
 
+// Speed vs. quality of block compression. This selects the encoder profile for
+// formats that have them (bc6h, bc7) and is ignored by the others.
+enum class bc_quality : uint8_t
+{
+	ultrafast,
+	fast,
+	basic,
+	slow,
+
+	count,
+};
+
 struct info_t
 {
 	info_t()
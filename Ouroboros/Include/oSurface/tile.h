@@ -21,7 +21,7 @@ uint3 dimensions_in_tiles(const uint3& mip_dimensions, const uint2& tile_dimensi
 uint32_t num_tiles(const uint2& mip_dimensions, const uint2& tile_dimensions);           // total tile count for the specified mip dimensions
 uint32_t num_tiles(const uint3& mip_dimensions, const uint2& tile_dimensions);           //
 uint32_t num_slice_tiles(const info_t& info, const uint2& tile_dimensions);              // total tile count for all in an array_slice's mip chain
-uint32_t calc_tile(const info_t& info, const tile_info& tile_info, uint2* out_position); // like calc_subresource, but for tiles
-tile_info tileinfo(const info_t& info, const uint2& tile_dimensions, uint32_t tile);     //
+uint32_t calc_tile_id(const info_t& info, const tile_info& tile_info, uint2* out_position); // like calc_subresource, but for tiles
+tile_info get_tile(const info_t& info, const uint2& tile_dimensions, uint32_t tileid);     //
 
 }}
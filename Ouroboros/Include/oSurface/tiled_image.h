@@ -0,0 +1,175 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+// A surface stored as fixed-size tiles behind a page table so only the tiles
+// that are used take memory. This is for surfaces too large to keep resident
+// such as terrain textures: tiles are committed on first write, optionally
+// paged in from a source on first read and evicted least-recently-used first
+// when over a residency budget.
+
+#pragma once
+#include <oConcurrency/mutex.h>
+#include <oSurface/box.h>
+#include <oSurface/subresource.h>
+#include <oSurface/tile.h>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+
+namespace ouro { namespace surface {
+
+// Where tile memory comes from. If reserve is specified, address space for
+// every tile is reserved up front and commit/decommit back and release each
+// tile in place (see page_tile_storage() in oSystem/filesystem_util.h).
+// Otherwise commit is passed nullptr and allocates each tile on its own.
+struct tile_storage
+{
+	void* (*reserve)(size_t bytes);
+	void (*unreserve)(void* base);
+	void* (*commit)(void* tile, size_t bytes);
+	void (*decommit)(void* tile, size_t bytes);
+	size_t alignment; // tiles are padded to this, i.e. the page size
+};
+
+// allocates each tile from default_allocator
+extern const tile_storage heap_tile_storage;
+
+enum class tile_access
+{
+	read,
+	write,         // the tile's prior contents are kept
+	write_discard, // the tile's prior contents are undefined
+};
+
+// Called with texels of one tile of a subresource, where tile.position is the
+// tile's upper-left texel in the mip and tile.dimensions is clipped to the
+// edge of the mip. mapped.data points at tile.position.
+typedef std::function<void(uint32_t subresource, const tile_info& tile, const mapped_subresource& mapped)> tile_fn;
+typedef std::function<void(uint32_t subresource, const tile_info& tile, const const_mapped_subresource& mapped)> const_tile_fn;
+
+// returns a loader that copies tiles from an image laid out as info describes,
+// such as the texels of a mapped uncompressed oimg (see get_oimg_bits). bits
+// must remain valid as long as the loader is used.
+tile_fn image_tile_loader(const info_t& info, const void* bits);
+
+class tiled_image
+{
+public:
+	struct init_t
+	{
+		init_t()
+			: tile_dimensions(128, 128)
+			, residency_budget(0)
+			, storage(heap_tile_storage)
+		{}
+
+		info_t info;
+
+		uint2 tile_dimensions;
+
+		// bytes of tile memory to keep resident, 0 means no limit. Tiles in use
+		// and tiles that have been written but have no store can't be evicted so
+		// the budget can be exceeded.
+		size_t residency_budget;
+
+		tile_storage storage;
+
+		// fills a tile the first time it's read. If not specified new tiles are 0.
+		tile_fn loader;
+
+		// called with a written tile before it's evicted so it can be saved. If
+		// not specified written tiles stay resident.
+		const_tile_fn store;
+	};
+
+	tiled_image() : base_(nullptr), tile_bytes_(0), tile_pitch_(0), resident_bytes_(0), lru_head_(nil), lru_tail_(nil) {}
+	tiled_image(const init_t& init) : base_(nullptr), resident_bytes_(0), lru_head_(nil), lru_tail_(nil) { initialize(init); }
+	~tiled_image() { deinitialize(); }
+
+	tiled_image(tiled_image&& that);
+	tiled_image& operator=(tiled_image&& that);
+
+	// Only non-planar, non-block-compressed 2D surfaces are supported.
+	void initialize(const init_t& init);
+	void deinitialize();
+
+	operator bool() const { return !pages_.empty(); }
+
+	inline info_t info() const { return init_.info; }
+	inline uint2 tile_dimensions() const { return init_.tile_dimensions; }
+	inline uint32_t num_tiles() const { return uint32_t(pages_.size()); }
+	uint32_t num_resident_tiles() const;
+	size_t resident_bytes() const;
+
+	// Calls fn for every tile box overlaps, each from whichever thread is free.
+	// Only those tiles are paged in and they stay resident until fn returns.
+	// mapped covers the whole tile, not just the part in box.
+	void map(uint32_t subresource, const box_t& box, const tile_access& access, const tile_fn& fn);
+	void map_const(uint32_t subresource, const box_t& box, const const_tile_fn& fn) const;
+
+	// copies between a region of a subresource and linear memory. Tiles that
+	// are completely covered by an update aren't paged in first. Reading a
+	// tile that was never written and has no loader returns 0's without
+	// committing it.
+	void update_subresource(uint32_t subresource, const box_t& box, const const_mapped_subresource& src);
+	void copy_to(uint32_t subresource, const box_t& box, const mapped_subresource& dst) const;
+
+	// stores written tiles (if there's a store) and evicts everything not in use
+	void evict_all();
+
+private:
+	static const uint32_t nil = ~0u;
+
+	struct page
+	{
+		page() : bits(nullptr), prev(nil), next(nil), pins(0), dirty(false), loading(false) {}
+		void* bits;    // nullptr if not resident
+		uint32_t prev; // lru links, most recently used at the head
+		uint32_t next;
+		uint32_t pins; // count of maps in progress
+		bool dirty;    // written since it was last loaded or stored
+		bool loading;  // being filled outside mtx_, don't touch until loaded_
+	};
+
+	struct tile_ref
+	{
+		uint32_t id;
+		uint32_t subresource;
+		tile_info info;
+		bool covered; // the region being worked on covers the whole tile
+	};
+
+	init_t init_;
+	std::vector<uint32_t> first_tile_; // per subresource with the total at the end
+	std::vector<page> pages_;
+	void* base_;                       // reserved address space if storage reserves
+	size_t tile_bytes_;                // padded to storage alignment
+	uint32_t tile_pitch_;
+	size_t resident_bytes_;
+	uint32_t lru_head_;
+	uint32_t lru_tail_;
+
+	typedef ouro::mutex mutex_t;
+	typedef ouro::lock_guard<mutex_t> lock_t;
+	typedef ouro::unique_lock<mutex_t> unique_lock_t;
+	mutable mutex_t mtx_;
+	std::condition_variable_any loaded_; // signaled when pages stop loading
+
+	tile_ref ref(uint32_t id) const;
+	void tiles(uint32_t subresource, const box_t& box, std::vector<tile_ref>* out_tiles) const;
+	mapped_subresource mapped(uint32_t id) const;
+
+	// these require mtx_ to be locked. acquire unlocks it while loading.
+	void acquire(unique_lock_t& lock, const tile_ref* refs, uint32_t num_refs, const tile_access& access);
+	void release(const tile_ref* refs, uint32_t num_refs);
+	bool evict(uint32_t id);
+	void enforce_budget();
+	void lru_remove(uint32_t id);
+	void lru_push_front(uint32_t id);
+
+	void process(std::vector<tile_ref>& refs, const tile_access& access, const std::function<void(const tile_ref& t, const mapped_subresource& mapped)>& fn);
+
+	tiled_image(const tiled_image&);
+	const tiled_image& operator=(const tiled_image&);
+};
+
+}}
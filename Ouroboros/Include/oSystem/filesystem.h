@@ -3,6 +3,7 @@
 // file system abstraction
 
 #pragma once
+#include <oConcurrency/future.h>
 #include <oMemory/allocate.h>
 #include <oString/path.h>
 #include <cstdio>
@@ -257,6 +258,12 @@ void load_async(const path_t& path, completion_fn on_complete, void* user
 								, load_option opt = load_option::binary_read
 								, const allocator& alloc = default_allocator);
 
+// Like the above, but the buffer or error is delivered through a future so the
+// load can be chained with future::then() or co_await'ed from a task<>.
+future<blob> load_async(const path_t& path
+								, load_option opt = load_option::binary_read
+								, const allocator& alloc = default_allocator);
+
 // Similar to save, this will save the specified buffer call on_complete. The open
 // write and close will occur on another thread so ensure on_complete's implementation
 // is thread safe. The blob must be moved initially, but will resurface
@@ -4,8 +4,12 @@
 
 #pragma once
 #include <oSystem/filesystem.h>
+#include <oSystem/page_allocator.h>
 #include <oString/ini.h>
 #include <oString/xml.h>
+#include <oSurface/codec.h>
+#include <oSurface/tiled_image.h>
+#include <memory>
 
 namespace ouro { namespace filesystem {
 
@@ -21,4 +25,81 @@ inline std::unique_ptr<ini> load_ini(const path_t& _Path)
 	return std::unique_ptr<ini>(new ini(_Path, (char*)a.release(), a.deleter()));
 }
 
+// Uncompressed oimg files are mapped read-only and the image uses the texels 
+// in place, so nothing is read until it's touched and the file stays mapped 
+// until the image is destroyed. Such an image is immutable(): read it with 
+// shared_lock since lock_guard and other writes throw. Anything else is 
+// loaded and decoded.
+inline surface::image map_image(const path_t& _Path, const allocator& _TexelAlloc = default_allocator)
+{
+	const uint64_t FileSize = file_size(_Path);
+	surface::info_t Info;
+	uint64_t Offset = 0, Size = 0;
+	{
+		void* pFile = map(_Path, map_option::binary_read, 0, FileSize);
+		bool Mappable = false;
+		try { Mappable = surface::get_oimg_bits(pFile, size_t(FileSize), &Info, &Offset, &Size); }
+		catch (...) { unmap(pFile); throw; }
+		unmap(pFile);
+
+		if (!Mappable)
+		{
+			blob b = load(_Path);
+			return surface::decode(b, _TexelAlloc);
+		}
+	}
+
+	// map again starting at the texels so unmap gets back to the view when 
+	// passed the image's bits
+	void* pBits = map(_Path, map_option::binary_read, Offset, Size);
+	surface::image img;
+	img.initialize_read_only(Info, pBits, allocator(noop_allocate, unmap));
+	return img;
+}
+
+// Tile storage that reserves address space for all tiles and commits pages as
+// tiles become resident.
+inline surface::tile_storage page_tile_storage()
+{
+	surface::tile_storage s;
+	s.reserve = [](size_t _Size) { return page_allocator::reserve(nullptr, _Size); };
+	s.unreserve = page_allocator::unreserve;
+	s.commit = [](void* _pTile, size_t _Size) { return page_allocator::commit(_pTile, _Size); };
+	s.decommit = [](void* _pTile, size_t _Size) { page_allocator::decommit(_pTile, _Size); };
+	s.alignment = page_allocator::pagesize();
+	return s;
+}
+
+// Pages tiles in from an uncompressed oimg file as they're read. The file stays
+// mapped until the tiled image is destroyed and only the tiles read are kept 
+// resident, up to _ResidencyBudget bytes if non-zero. Written tiles stay 
+// resident since there's nowhere to store them.
+inline surface::tiled_image map_tiled_image(const path_t& _Path, const uint2& _TileDimensions = uint2(128, 128), size_t _ResidencyBudget = 0)
+{
+	const uint64_t FileSize = file_size(_Path);
+	surface::info_t Info;
+	uint64_t Offset = 0, Size = 0;
+	{
+		void* pFile = map(_Path, map_option::binary_read, 0, FileSize);
+		bool Mappable = false;
+		try { Mappable = surface::get_oimg_bits(pFile, size_t(FileSize), &Info, &Offset, &Size); }
+		catch (...) { unmap(pFile); throw; }
+		unmap(pFile);
+
+		if (!Mappable)
+			oThrow(std::errc::not_supported, "only uncompressed oimg files can be paged: %s", _Path.c_str());
+	}
+
+	std::shared_ptr<void> Bits(map(_Path, map_option::binary_read, Offset, Size), unmap);
+	auto Load = surface::image_tile_loader(Info, Bits.get());
+
+	surface::tiled_image::init_t i;
+	i.info = Info;
+	i.tile_dimensions = _TileDimensions;
+	i.residency_budget = _ResidencyBudget;
+	i.storage = page_tile_storage();
+	i.loader = [=](uint32_t _Subresource, const surface::tile_info& _Tile, const surface::mapped_subresource& _Mapped) { (void)Bits; Load(_Subresource, _Tile, _Mapped); };
+	return surface::tiled_image(i);
+}
+
 }}
@@ -40,8 +40,10 @@ public:
 	void deinitialize();
 
 	// Compares against the matching golden image. If there is a mismatch this 
-	// throws a system_error and generates a failure and diff image.
-	void test(const char* test_name, const surface::image& img, uint32_t nth_img, float max_rms_error, uint32_t diff_img_multiplier);
+	// throws a system_error and generates a failure and diff image. If min_ssim
+	// is non-zero the structural similarity must also be at least that (1 is
+	// identical) which catches blurring and banding that rms can miss.
+	void test(const char* test_name, const surface::image& img, uint32_t nth_img, float max_rms_error, uint32_t diff_img_multiplier, float min_ssim = 0.0f);
 
 private:
 
@@ -71,6 +71,10 @@ void* commit(void* base_address, size_t size, bool readwrite = true, bool use_la
 // will succeed/noop on already-decommited memory.
 void decommit(void* _Pointer);
 
+// Removes storage from only the pages spanning the specified range, leaving it
+// reserved.
+void decommit(void* base_address, size_t size);
+
 // Accomplishes reserve and commit in one operation
 void* reserve_and_commit(void* base_address, size_t size, bool readwrite = true, bool use_large_page_size = false);
 
@@ -0,0 +1,493 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+#include <oCore/assert.h>
+#include <oBase/chunked_compression.h>
+#include <oConcurrency/concurrency.h>
+#include <algorithm>
+#include <cstring>
+#include <exception>
+
+namespace ouro {
+
+static const uint32_t chunked_magic   = 0x4b48436f; // "oCHK"
+static const uint8_t  chunked_version = 1;
+static const uint32_t raw_block_bit   = 0x80000000;
+
+#pragma pack(push, 1)
+struct chunked_header
+{
+	uint32_t magic;
+	uint8_t version;
+	compression type;
+	uint16_t reserved;
+	uint32_t block_size;
+};
+
+struct chunked_footer
+{
+	uint64_t uncompressed_size;
+	uint32_t num_blocks;
+	uint32_t magic;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(chunked_header) == 12, "size mismatch");
+static_assert(sizeof(chunked_footer) == 16, "size mismatch");
+
+static inline uint32_t read32(const uint8_t* p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+static inline uint64_t read64(const uint8_t* p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; }
+
+static uint32_t num_blocks(uint64_t uncompressed_size, uint32_t block_size)
+{
+	const uint64_t n = (uncompressed_size + block_size - 1) / block_size;
+	oCheck(n <= UINT32_MAX, std::errc::file_too_large, "too many blocks for a chunked container");
+	return uint32_t(n);
+}
+
+static size_t block_bound(const compression& type, uint32_t block_size)
+{
+	return type == compression::none ? block_size : std::max(size_t(block_size), compress(type, nullptr, 0, nullptr, block_size));
+}
+
+// blocks that don't get smaller are stored as-is
+static uint32_t compress_block(const compression& type, uint8_t* oRESTRICT dst, size_t dst_size, const uint8_t* oRESTRICT src, size_t src_size)
+{
+	if (type != compression::none)
+	{
+		const size_t compressed_size = compress(type, dst, dst_size, src, src_size);
+		if (compressed_size < src_size)
+			return uint32_t(compressed_size);
+	}
+
+	memcpy(dst, src, src_size);
+	return uint32_t(src_size) | raw_block_bit;
+}
+
+// returns the decompressed size of the block, which can't be larger than dst_size
+static size_t decompress_block(const compression& type, uint8_t* oRESTRICT dst, size_t dst_size, const uint8_t* oRESTRICT src, uint32_t stored_size)
+{
+	const size_t size = stored_size & ~raw_block_bit;
+	if (stored_size & raw_block_bit)
+	{
+		oCheck(size <= dst_size, std::errc::protocol_error, "chunked block is larger than the block size");
+		memcpy(dst, src, size);
+		return size;
+	}
+
+	const size_t uncompressed_size = decompress(type, nullptr, 0, src, size);
+	oCheck(uncompressed_size <= dst_size, std::errc::protocol_error, "chunked block is larger than the block size");
+	decompress(type, dst, uncompressed_size, src, size);
+	return uncompressed_size;
+}
+
+// rethrows the first error in block order
+static void rethrow_first(const std::vector<std::exception_ptr>& errors)
+{
+	for (const auto& e : errors)
+		if (e)
+			std::rethrow_exception(e);
+}
+
+// a validated view of a whole container in memory
+struct chunked_view
+{
+	chunked_info info;
+	const uint8_t* base;
+	const uint8_t* index;
+	size_t blocks_end;
+
+	chunked_view(const void* src, size_t src_size)
+	{
+		base = (const uint8_t*)src;
+		oCheck(src_size >= sizeof(chunked_header) + sizeof(uint32_t) + sizeof(chunked_footer), std::errc::protocol_error, "not a chunked container");
+
+		chunked_header h;
+		memcpy(&h, base, sizeof(h));
+		chunked_footer f;
+		memcpy(&f, base + src_size - sizeof(f), sizeof(f));
+		oCheck(h.magic == chunked_magic && f.magic == chunked_magic, std::errc::protocol_error, "not a chunked container");
+		oCheck(h.version == chunked_version, std::errc::not_supported, "unsupported chunked container version %u", h.version);
+		oCheck(h.type < compression::count, std::errc::protocol_error, "invalid compression in chunked container");
+		oCheck(h.block_size && h.block_size <= max_chunked_block_size, std::errc::protocol_error, "invalid chunked block size");
+		oCheck(f.num_blocks == num_blocks(f.uncompressed_size, h.block_size), std::errc::protocol_error, "chunked block count doesn't match the content size");
+		oCheck(f.uncompressed_size == size_t(f.uncompressed_size), std::errc::file_too_large, "chunked content is too large for this platform");
+
+		const size_t index_size = size_t(f.num_blocks) * sizeof(uint64_t);
+		oCheck(src_size - sizeof(chunked_header) - sizeof(uint32_t) - sizeof(chunked_footer) >= index_size, std::errc::protocol_error, "truncated chunked container");
+		index = base + src_size - sizeof(chunked_footer) - index_size;
+		blocks_end = size_t(index - base) - sizeof(uint32_t);
+		oCheck(read32(base + blocks_end) == 0, std::errc::protocol_error, "chunked blocks don't end where the index starts");
+
+		info.type = h.type;
+		info.block_size = h.block_size;
+		info.num_blocks = f.num_blocks;
+		info.uncompressed_size = f.uncompressed_size;
+	}
+
+	size_t block_offset(uint32_t block) const { return size_t(block) * info.block_size; }
+	size_t block_size(uint32_t block) const { return size_t(std::min(uint64_t(info.block_size), info.uncompressed_size - block_offset(block))); }
+
+	// decompresses exactly block_size(block) bytes into dst
+	void decompress(uint32_t block, uint8_t* dst) const
+	{
+		const uint64_t offset = read64(index + block * sizeof(uint64_t));
+		oCheck(offset >= sizeof(chunked_header) && offset <= blocks_end - sizeof(uint32_t), std::errc::protocol_error, "chunked block %u is out of range", block);
+
+		const uint32_t stored_size = read32(base + offset);
+		const size_t size = stored_size & ~raw_block_bit;
+		oCheck(size && size <= blocks_end - offset - sizeof(uint32_t), std::errc::protocol_error, "chunked block %u is out of range", block);
+
+		const size_t expected = block_size(block);
+		const size_t actual = decompress_block(info.type, dst, expected, base + offset + sizeof(uint32_t), stored_size);
+		oCheck(actual == expected, std::errc::protocol_error, "chunked block %u decompressed to %u bytes, expected %u", block, uint32_t(actual), uint32_t(expected));
+	}
+};
+
+size_t compress_chunked(const compression& type, void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size, uint32_t block_size)
+{
+	oCheck(block_size && block_size <= max_chunked_block_size, std::errc::invalid_argument, "invalid chunked block size");
+
+	// a block is never stored larger than it is
+	const size_t n = num_blocks(src_size, block_size);
+	const size_t bound = sizeof(chunked_header) + n * sizeof(uint32_t) + src_size + sizeof(uint32_t) + n * sizeof(uint64_t) + sizeof(chunked_footer);
+	if (!dst)
+		return bound;
+
+	oCheck(dst_size >= bound, std::errc::no_buffer_space, "");
+
+	uint8_t* d = (uint8_t*)dst;
+	chunked_compress_stream stream(type, [&](const void* data, size_t size) { memcpy(d, data, size); d += size; }, block_size);
+	stream.write(src, src_size);
+	stream.finish();
+	return size_t(stream.compressed_size());
+}
+
+chunked_info get_chunked_info(const void* src, size_t src_size)
+{
+	return chunked_view(src, src_size).info;
+}
+
+size_t decompress_chunked(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size)
+{
+	const chunked_view view(src, src_size);
+	const size_t uncompressed_size = size_t(view.info.uncompressed_size);
+	if (!dst)
+		return uncompressed_size;
+
+	oCheck(dst_size >= uncompressed_size, std::errc::no_buffer_space, "");
+
+	std::vector<std::exception_ptr> errors(view.info.num_blocks);
+	parallel_for(0, view.info.num_blocks, [&](size_t index)
+	{
+		const uint32_t block = uint32_t(index);
+		try { view.decompress(block, (uint8_t*)dst + view.block_offset(block)); }
+		catch (...) { errors[index] = std::current_exception(); }
+	});
+
+	rethrow_first(errors);
+	return uncompressed_size;
+}
+
+void decompress_chunked_range(void* oRESTRICT dst, uint64_t offset, size_t size, const void* oRESTRICT src, size_t src_size)
+{
+	const chunked_view view(src, src_size);
+	oCheck(offset <= view.info.uncompressed_size && size <= view.info.uncompressed_size - offset, std::errc::invalid_argument, "range is outside the chunked content");
+	if (!size)
+		return;
+
+	const uint32_t first = uint32_t(offset / view.info.block_size);
+	const uint32_t last = uint32_t((offset + size - 1) / view.info.block_size);
+
+	std::vector<std::exception_ptr> errors(last - first + 1);
+	parallel_for(first, last + 1, [&](size_t index)
+	{
+		const uint32_t block = uint32_t(index);
+		const uint64_t block_begin = view.block_offset(block);
+		const uint64_t block_end = block_begin + view.block_size(block);
+		const uint64_t begin = std::max(block_begin, offset);
+		const uint64_t end = std::min(block_end, offset + size);
+		uint8_t* d = (uint8_t*)dst + size_t(begin - offset);
+
+		try
+		{
+			// blocks at the ends of the range are usually only partly needed
+			if (begin == block_begin && end == block_end)
+				view.decompress(block, d);
+			else
+			{
+				std::vector<uint8_t> whole(view.block_size(block));
+				view.decompress(block, whole.data());
+				memcpy(d, whole.data() + size_t(begin - block_begin), size_t(end - begin));
+			}
+		}
+		catch (...) { errors[index - first] = std::current_exception(); }
+	});
+
+	rethrow_first(errors);
+}
+
+chunked_compress_stream::chunked_compress_stream(const compression& type, const chunked_write_fn& write, uint32_t block_size, uint32_t batch_blocks)
+	: write_(write)
+	, type_(type)
+	, block_size_(block_size)
+	, batch_blocks_(batch_blocks)
+	, finished_(false)
+	, offset_(0)
+	, uncompressed_size_(0)
+{
+	oCheck(type < compression::count, std::errc::invalid_argument, "unknown compression format");
+	oCheck(block_size && block_size <= max_chunked_block_size, std::errc::invalid_argument, "invalid chunked block size");
+	oCheck(batch_blocks, std::errc::invalid_argument, "at least one block must be compressed at a time");
+
+	chunked_header h;
+	h.magic = chunked_magic;
+	h.version = chunked_version;
+	h.type = type;
+	h.reserved = 0;
+	h.block_size = block_size;
+	emit(&h, sizeof(h));
+}
+
+void chunked_compress_stream::emit(const void* data, size_t size)
+{
+	if (!size)
+		return;
+
+	write_(data, size);
+	offset_ += size;
+}
+
+void chunked_compress_stream::write(const void* src, size_t src_size)
+{
+	oCheck(!finished_, std::errc::operation_not_permitted, "chunked stream is already finished");
+
+	const uint8_t* s = (const uint8_t*)src;
+	const size_t batch_size = size_t(block_size_) * batch_blocks_;
+	uncompressed_size_ += src_size;
+
+	if (!pending_.empty())
+	{
+		const size_t n = std::min(src_size, batch_size - pending_.size());
+		pending_.insert(pending_.end(), s, s + n);
+		s += n;
+		src_size -= n;
+
+		if (pending_.size() < batch_size)
+			return;
+
+		compress_batch(pending_.data(), pending_.size());
+		pending_.clear();
+	}
+
+	// whole batches don't need to be buffered
+	for (; src_size >= batch_size; s += batch_size, src_size -= batch_size)
+		compress_batch(s, batch_size);
+
+	pending_.insert(pending_.end(), s, s + src_size);
+}
+
+void chunked_compress_stream::finish()
+{
+	oCheck(!finished_, std::errc::operation_not_permitted, "chunked stream is already finished");
+
+	if (!pending_.empty())
+		compress_batch(pending_.data(), pending_.size());
+	pending_.clear();
+	pending_.shrink_to_fit();
+	scratch_.clear();
+	scratch_.shrink_to_fit();
+
+	const uint32_t end_of_blocks = 0;
+	emit(&end_of_blocks, sizeof(end_of_blocks));
+	emit(index_.data(), index_.size() * sizeof(uint64_t));
+
+	chunked_footer f;
+	f.uncompressed_size = uncompressed_size_;
+	f.num_blocks = uint32_t(index_.size());
+	f.magic = chunked_magic;
+	emit(&f, sizeof(f));
+
+	finished_ = true;
+}
+
+void chunked_compress_stream::compress_batch(const uint8_t* src, size_t src_size)
+{
+	const size_t n = num_blocks(src_size, block_size_);
+	const size_t bound = block_bound(type_, block_size_);
+	scratch_.resize(n * bound);
+	stored_sizes_.resize(n);
+
+	std::vector<std::exception_ptr> errors(n);
+	parallel_for(0, n, [&](size_t index)
+	{
+		const size_t offset = index * block_size_;
+		const size_t size = std::min(size_t(block_size_), src_size - offset);
+		try { stored_sizes_[index] = compress_block(type_, scratch_.data() + index * bound, bound, src + offset, size); }
+		catch (...) { errors[index] = std::current_exception(); }
+	});
+
+	rethrow_first(errors);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		const uint32_t stored_size = uint32_t(stored_sizes_[i]);
+		index_.push_back(offset_);
+		emit(&stored_size, sizeof(stored_size));
+		emit(scratch_.data() + i * bound, stored_size & ~raw_block_bit);
+	}
+}
+
+chunked_decompress_stream::chunked_decompress_stream(const chunked_write_fn& write, uint32_t batch_blocks)
+	: write_(write)
+	, state_(state::header)
+	, batch_blocks_(batch_blocks)
+	, stored_size_(0)
+	, offset_(0)
+	, uncompressed_size_(0)
+{
+	oCheck(batch_blocks, std::errc::invalid_argument, "at least one block must be decompressed at a time");
+	memset(&info_, 0, sizeof(info_));
+}
+
+void chunked_decompress_stream::write(const void* src, size_t src_size)
+{
+	const uint8_t* s = (const uint8_t*)src;
+	while (src_size)
+	{
+		const size_t n = consume(s, src_size);
+		s += n;
+		src_size -= n;
+	}
+}
+
+void chunked_decompress_stream::finish()
+{
+	oCheck(state_ == state::done, std::errc::protocol_error, "truncated chunked container");
+}
+
+// gathers the bytes the current state needs and acts on them once they're all
+// there, returning how many bytes of src were used
+size_t chunked_decompress_stream::consume(const uint8_t* src, size_t src_size)
+{
+	size_t need = 0;
+	switch (state_)
+	{
+		case state::header: need = sizeof(chunked_header); break;
+		case state::block_size: need = sizeof(uint32_t); break;
+		case state::block: need = stored_size_ & ~raw_block_bit; break;
+		case state::index: need = index_.size() * sizeof(uint64_t) + sizeof(chunked_footer); break;
+		default: oThrow(std::errc::protocol_error, "data after the end of the chunked container");
+	}
+
+	const size_t n = std::min(src_size, need - pending_.size());
+	pending_.insert(pending_.end(), src, src + n);
+	if (pending_.size() < need)
+		return n;
+
+	const uint8_t* p = pending_.data();
+	switch (state_)
+	{
+		case state::header:
+		{
+			chunked_header h;
+			memcpy(&h, p, sizeof(h));
+			oCheck(h.magic == chunked_magic, std::errc::protocol_error, "not a chunked container");
+			oCheck(h.version == chunked_version, std::errc::not_supported, "unsupported chunked container version %u", h.version);
+			oCheck(h.type < compression::count, std::errc::protocol_error, "invalid compression in chunked container");
+			oCheck(h.block_size && h.block_size <= max_chunked_block_size, std::errc::protocol_error, "invalid chunked block size");
+			info_.type = h.type;
+			info_.block_size = h.block_size;
+			state_ = state::block_size;
+			break;
+		}
+
+		case state::block_size:
+		{
+			const uint32_t stored_size = read32(p);
+			if (stored_size)
+			{
+				const size_t size = stored_size & ~raw_block_bit;
+				oCheck(size && size <= block_bound(info_.type, info_.block_size), std::errc::protocol_error, "chunked block %u is too large", uint32_t(index_.size()));
+				index_.push_back(offset_);
+				stored_size_ = stored_size;
+				state_ = state::block;
+			}
+			else
+			{
+				decompress_batch();
+				state_ = state::index;
+			}
+			break;
+		}
+
+		case state::block:
+		{
+			batch_sizes_.push_back(stored_size_);
+			batch_.insert(batch_.end(), pending_.begin(), pending_.end());
+			if (batch_sizes_.size() == batch_blocks_)
+				decompress_batch();
+			state_ = state::block_size;
+			break;
+		}
+
+		case state::index:
+		{
+			for (size_t i = 0; i < index_.size(); i++)
+				oCheck(read64(p + i * sizeof(uint64_t)) == index_[i], std::errc::protocol_error, "chunked index doesn't match block %u", uint32_t(i));
+
+			chunked_footer f;
+			memcpy(&f, p + index_.size() * sizeof(uint64_t), sizeof(f));
+			oCheck(f.magic == chunked_magic, std::errc::protocol_error, "invalid chunked container footer");
+			oCheck(f.num_blocks == index_.size() && f.uncompressed_size == uncompressed_size_, std::errc::protocol_error, "chunked footer doesn't match the content");
+			info_.num_blocks = f.num_blocks;
+			info_.uncompressed_size = f.uncompressed_size;
+			state_ = state::done;
+			break;
+		}
+
+		default:
+			break;
+	}
+
+	offset_ += need;
+	pending_.clear();
+	return n;
+}
+
+void chunked_decompress_stream::decompress_batch()
+{
+	const size_t n = batch_sizes_.size();
+	if (!n)
+		return;
+
+	// only the last block in the container can be partial
+	oCheck(uncompressed_size_ == uint64_t(index_.size() - n) * info_.block_size, std::errc::protocol_error, "a chunked block before the last is partial");
+
+	std::vector<size_t> offsets(n);
+	for (size_t i = 1; i < n; i++)
+		offsets[i] = offsets[i - 1] + (batch_sizes_[i - 1] & ~raw_block_bit);
+
+	const size_t block_size = info_.block_size;
+	scratch_.resize(n * block_size);
+	std::vector<size_t> sizes(n);
+	std::vector<std::exception_ptr> errors(n);
+	parallel_for(0, n, [&](size_t index)
+	{
+		try { sizes[index] = decompress_block(info_.type, scratch_.data() + index * block_size, block_size, batch_.data() + offsets[index], batch_sizes_[index]); }
+		catch (...) { errors[index] = std::current_exception(); }
+	});
+
+	rethrow_first(errors);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		oCheck(i == n - 1 || sizes[i] == block_size, std::errc::protocol_error, "a chunked block before the last is partial");
+		write_(scratch_.data() + i * block_size, sizes[i]);
+		uncompressed_size_ += sizes[i];
+	}
+
+	batch_.clear();
+	batch_sizes_.clear();
+}
+
+}
@@ -2,6 +2,7 @@
 
 #include <oCore/assert.h>
 #include <oBase/compression.h>
+#include <oBase/compressor.h>
 
 #define FOREACH_EXT(macro) macro(gzip) macro(lz4) macro(lzma) macro(snappy)
 
@@ -9,12 +10,19 @@
 	size_t compress_##codec(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size); \
 	size_t decompress_##codec(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size);
 
+#define DECLARE_CODEC_CONTEXT(name) \
+	compressor::codec* new_##name##_compressor(const allocator& alloc, int level); \
+	decompressor::codec* new_##name##_decompressor(const allocator& alloc);
+
 #define COMPRESS(codec)   case compression::##codec: return   compress_##codec(dst, dst_size, src, src_size);
 #define DECOMPRESS(codec) case compression::##codec: return decompress_##codec(dst, dst_size, src, src_size);
+#define NEW_COMPRESSOR(name)   case compression::##name: codec_ = new_##name##_compressor(alloc, level); break;
+#define NEW_DECOMPRESSOR(name) case compression::##name: codec_ = new_##name##_decompressor(alloc); break;
 
 namespace ouro {
 
 FOREACH_EXT(DECLARE_CODEC)
+FOREACH_EXT(DECLARE_CODEC_CONTEXT)
 
 size_t compress(const compression& type, void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size)
 {
@@ -38,4 +46,92 @@ size_t decompress(const compression& type, void* oRESTRICT dst, size_t dst_size,
 	oThrow(std::errc::invalid_argument, "unknown compression format");
 }
 
+compressor::compressor(const compression& type, const allocator& alloc, int level)
+	: type_(compression::none)
+	, codec_(nullptr)
+{
+	initialize(type, alloc, level);
+}
+
+compressor& compressor::operator=(compressor&& that)
+{
+	if (this != &that)
+	{
+		deinitialize();
+		type_ = that.type_; that.type_ = compression::none;
+		alloc_ = that.alloc_;
+		codec_ = that.codec_; that.codec_ = nullptr;
+	}
+	return *this;
+}
+
+void compressor::initialize(const compression& type, const allocator& alloc, int level)
+{
+	deinitialize();
+
+	switch (type)
+	{
+		FOREACH_EXT(NEW_COMPRESSOR)
+		default: oThrow(std::errc::invalid_argument, "unknown compression format");
+	}
+
+	type_ = type;
+	alloc_ = alloc;
+}
+
+void compressor::deinitialize()
+{
+	if (codec_)
+	{
+		codec_->~codec();
+		alloc_.deallocate(codec_);
+		codec_ = nullptr;
+	}
+	type_ = compression::none;
+}
+
+decompressor::decompressor(const compression& type, const allocator& alloc)
+	: type_(compression::none)
+	, codec_(nullptr)
+{
+	initialize(type, alloc);
+}
+
+decompressor& decompressor::operator=(decompressor&& that)
+{
+	if (this != &that)
+	{
+		deinitialize();
+		type_ = that.type_; that.type_ = compression::none;
+		alloc_ = that.alloc_;
+		codec_ = that.codec_; that.codec_ = nullptr;
+	}
+	return *this;
+}
+
+void decompressor::initialize(const compression& type, const allocator& alloc)
+{
+	deinitialize();
+
+	switch (type)
+	{
+		FOREACH_EXT(NEW_DECOMPRESSOR)
+		default: oThrow(std::errc::invalid_argument, "unknown compression format");
+	}
+
+	type_ = type;
+	alloc_ = alloc;
+}
+
+void decompressor::deinitialize()
+{
+	if (codec_)
+	{
+		codec_->~codec();
+		alloc_.deallocate(codec_);
+		codec_ = nullptr;
+	}
+	type_ = compression::none;
+}
+
 }
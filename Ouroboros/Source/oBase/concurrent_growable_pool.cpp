@@ -11,6 +11,7 @@ namespace ouro {
 concurrent_growable_pool::concurrent_growable_pool()
 	: last_allocate(nullptr)
 	, last_deallocate(nullptr)
+	, nchunks(0)
 	, block_size(0)
 	, block_alignment(0)
 	, capacity_per_chunk(0)
@@ -20,6 +21,7 @@ concurrent_growable_pool::concurrent_growable_pool(concurrent_growable_pool&& th
 {
 	last_allocate = that.last_allocate.exchange(0);
 	last_deallocate = that.last_deallocate.exchange(0);
+	nchunks = that.nchunks.exchange(0);
 	block_size = that.block_size; that.block_size = 0;
 	block_alignment = that.block_alignment; that.block_alignment = 0;
 	capacity_per_chunk = that.capacity_per_chunk; that.capacity_per_chunk = 0;
@@ -29,6 +31,7 @@ concurrent_growable_pool::concurrent_growable_pool(concurrent_growable_pool&& th
 concurrent_growable_pool::concurrent_growable_pool(size_type block_size, size_type capacity_per_chunk, size_type block_alignment)
 	: last_allocate(nullptr)
 	, last_deallocate(nullptr)
+	, nchunks(0)
 	, block_size(0)
 	, block_alignment(0)
 	, capacity_per_chunk(0)
@@ -48,10 +51,11 @@ concurrent_growable_pool& concurrent_growable_pool::operator=(concurrent_growabl
 	{
 		last_allocate = that.last_allocate.exchange(0);
 		last_deallocate = that.last_deallocate.exchange(0);
+		nchunks = that.nchunks.exchange(0);
 		block_size = that.block_size; that.block_size = 0;
 		block_alignment = that.block_alignment; that.block_alignment = 0;
 		capacity_per_chunk = that.capacity_per_chunk; that.capacity_per_chunk = 0;
-		chunks = std::move(chunks);
+		chunks = std::move(that.chunks);
 	}
 	return *this;
 }
@@ -78,16 +82,22 @@ void concurrent_growable_pool::deinitialize()
 	
 concurrent_growable_pool::chunk_t* concurrent_growable_pool::allocate_chunk()
 {
-	concurrent_pool pool;
-	size_type req = pool.calc_size(block_size, capacity_per_chunk);
-	req = align((size_type)sizeof(chunk_t), oCACHE_LINE_SIZE) + align(req, block_alignment);
+	const size_type pool_bytes = concurrent_pool::calc_size(capacity_per_chunk, block_size);
+	const size_type req = align((size_type)sizeof(chunk_t), oCACHE_LINE_SIZE) + align(pool_bytes, block_alignment);
 	chunk_t* c = new (default_allocate(req, "concurrent_growable_pool", memory_alignment::cacheline)) chunk_t();
 	void* p = align(c + 1, block_alignment);
-	c->pool.initialize(p, block_size, capacity_per_chunk);
+	c->pool.initialize(p, pool_bytes, block_size);
 	c->next = nullptr;
 	return c;
 }
 
+void concurrent_growable_pool::push_chunk(chunk_t* c)
+{
+	chunks.push(c);
+	nchunks++;
+	last_allocate = &c->pool; // racy but only an optimization hint
+}
+
 concurrent_pool* concurrent_growable_pool::find_pool(void* _Pointer) const
 {
 	concurrent_pool* pool = last_deallocate; // racy but only an optimization hint
@@ -113,13 +123,9 @@ concurrent_pool* concurrent_growable_pool::find_pool(void* _Pointer) const
 void concurrent_growable_pool::grow(size_type capacity)
 {
 	const size_type target_nchunks = (capacity + capacity_per_chunk - 1) / capacity_per_chunk;
-	size_type nchunks = num_chunks();
-	while (nchunks++ < target_nchunks)
-	{
-		chunk_t* c = allocate_chunk();
-		last_allocate = &c->pool; // racy but only an optimization hint
-		chunks.push(c);
-	}
+	size_type n = num_chunks();
+	while (n++ < target_nchunks)
+		push_chunk(allocate_chunk());
 }
 
 void concurrent_growable_pool::shrink(size_type capacity)
@@ -127,7 +133,7 @@ void concurrent_growable_pool::shrink(size_type capacity)
 	chunk_t* c = chunks.pop_all();
 	chunk_t* to_free = nullptr;
 	const size_type target_nchunks = (capacity + capacity_per_chunk - 1) / capacity_per_chunk;
-	size_type nchunks = 0;
+	size_type n = 0;
 	while (c)
 	{
 		chunk_t* tmp = c;
@@ -142,17 +148,17 @@ void concurrent_growable_pool::shrink(size_type capacity)
 		else
 			chunks.push(tmp);
 
-		nchunks++;
+		n++;
 	}
 
 	c = to_free;
-	while (c && nchunks > target_nchunks)
+	while (c && n > target_nchunks)
 	{
 		chunk_t* tmp = c;
 		c->pool.deinitialize();
 		c = c->next;
 		default_deallocate(tmp);
-		nchunks--;
+		n--;
 	}
 
 	while (c)
@@ -163,21 +169,10 @@ void concurrent_growable_pool::shrink(size_type capacity)
 	}
 
 	// reset cached values
+	nchunks = n;
 	last_allocate = last_deallocate = nullptr;
 }
 
-concurrent_growable_pool::size_type concurrent_growable_pool::num_chunks() const
-{
-	size_type n = 0;
-	chunk_t* c = chunks.peek();
-	while (c)
-	{
-		n++;
-		c = c->next;
-	}
-	return n;
-}
-
 concurrent_growable_pool::size_type concurrent_growable_pool::count_free() const
 {
 	size_type n = 0;
@@ -237,8 +232,7 @@ void* concurrent_growable_pool::allocate_pointer()
 		{
 			chunk_t* new_chunk = allocate_chunk();
 			p = new_chunk->pool.allocate();
-			chunks.push(new_chunk);
-			last_allocate = &new_chunk->pool; // racy but only an optimization hint
+			push_chunk(new_chunk);
 		}
 	}
 
@@ -254,4 +248,54 @@ void concurrent_growable_pool::deallocate(void* pointer)
 	pool->deallocate(pointer);
 }
 
+concurrent_growable_pool::size_type concurrent_growable_pool::allocate_n(void** pointers, size_type count)
+{
+	size_type n = 0;
+
+	// check cached last-used chunk (racy but it's only an optimization hint)
+	concurrent_pool* pool = last_allocate;
+	if (pool)
+		n = pool->allocate_n(pointers, count);
+
+	// take what's left from other chunks
+	chunk_t* c = chunks.peek();
+	while (c && n < count)
+	{
+		const size_type got = c->pool.allocate_n(pointers + n, count - n);
+		if (got)
+			last_allocate = &c->pool; // racy but only an optimization hint
+		n += got;
+		c = c->next;
+	}
+
+	// add chunks until satisfied
+	while (n < count)
+	{
+		chunk_t* new_chunk = allocate_chunk();
+		n += new_chunk->pool.allocate_n(pointers + n, count - n);
+		push_chunk(new_chunk);
+	}
+
+	return n;
+}
+
+void concurrent_growable_pool::deallocate_n(void* const* pointers, size_type count)
+{
+	size_type start = 0;
+	while (start < count)
+	{
+		concurrent_pool* pool = find_pool(pointers[start]);
+		if (!pool)
+			throw std::exception("deallocate called on a dangling pointer from a chunk that has probably been shrink()'ed");
+		last_deallocate = pool; // racy but only an optimization hint
+
+		size_type end = start + 1;
+		while (end < count && pool->owns(pointers[end]))
+			end++;
+
+		pool->deallocate_n(pointers + start, end - start);
+		start = end;
+	}
+}
+
 }
@@ -2,7 +2,9 @@
 
 #include <oCore/assert.h>
 #include <oBase/compression.h>
+#include <oBase/compressor.h>
 #include <zlib/zlib.h>
+#include <algorithm>
 
 namespace ouro {
 
@@ -41,6 +43,7 @@ struct GZIP_HDR
 	uint8_t XFL;
 	uint8_t OS;
 };
+#pragma pack()
 
 size_t compress_gzip(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size)
 {
@@ -138,4 +141,291 @@ size_t decompress_gzip(void* oRESTRICT dst, size_t dst_size, const void* oRESTRI
 	return UncompressedSize;
 }
 
+// The streaming codecs keep a zlib stream between streams and reset it rather
+// than setting it up again, and zlib allocates from the codec's allocator. zlib
+// takes 32-bit counts, so larger buffers are passed in pieces.
+
+static const size_t ZLibMaxAvail = 1 << 30;
+
+static voidpf zlib_allocate(voidpf opaque, uInt items, uInt size) { return static_cast<const allocator*>(opaque)->allocate(size_t(items) * size, "zlib"); }
+static void zlib_deallocate(voidpf opaque, voidpf address) { static_cast<const allocator*>(opaque)->deallocate(address); }
+
+class gzip_compressor : public compressor::codec
+{
+public:
+	gzip_compressor(const allocator& alloc, int level)
+		: alloc_(alloc)
+		, dict_(alloc, "gzip dictionary")
+		, dst_(nullptr)
+		, op_(nullptr)
+		, oend_(nullptr)
+		, crc_(0)
+		, size_(0)
+	{
+		level = level == default_compression_level ? 9 : level;
+		oCheck(level >= 0 && level <= 9, std::errc::invalid_argument, "gzip levels are 0-9");
+		memset(&z_, 0, sizeof(z_));
+		z_.zalloc = zlib_allocate;
+		z_.zfree = zlib_deallocate;
+		z_.opaque = &alloc_;
+		oCheck(deflateInit(&z_, level) == Z_OK, std::errc::not_enough_memory, "gzip compressor initialization failed");
+	}
+
+	~gzip_compressor() { deflateEnd(&z_); }
+
+	// compressBound() and 4 bytes for a dictionary id
+	size_t max_compressed_size(size_t src_size) const override
+	{
+		return sizeof(GZIP_HDR) + src_size + (src_size >> 12) + (src_size >> 14) + (src_size >> 25) + 13 + 4 + GZipFooterSize;
+	}
+
+	void set_dictionary(const void* dict, size_t dict_size) override
+	{
+		dict_.clear();
+		dict_.append(dict, dict_size);
+	}
+
+	void begin(void* dst, size_t dst_size) override
+	{
+		oCheck(deflateReset(&z_) == Z_OK, std::errc::protocol_error, "gzip compressor reset failed");
+		if (!dict_.empty())
+			oCheck(deflateSetDictionary(&z_, dict_.data(), uInt(std::min(dict_.size(), ZLibMaxAvail))) == Z_OK, std::errc::invalid_argument, "invalid gzip dictionary");
+
+		oCheck(dst_size >= sizeof(GZIP_HDR), std::errc::no_buffer_space, "");
+
+		GZIP_HDR h;
+		h.ID1 = GZipID1;
+		h.ID2 = GZipID2;
+		h.CM = GZipCM;
+		h.FLG = 0x00;
+		h.MTIME = 0;
+		h.XFL = 0x02;
+		h.OS = 0xff;
+		memcpy(dst, &h, sizeof(h));
+
+		dst_ = static_cast<uint8_t*>(dst);
+		op_ = dst_ + sizeof(h);
+		oend_ = dst_ + dst_size;
+		crc_ = crc32(0, Z_NULL, 0);
+		size_ = 0;
+	}
+
+	void feed(const void* src, size_t src_size) override
+	{
+		const uint8_t* s = static_cast<const uint8_t*>(src);
+		for (size_t remaining = src_size; remaining;)
+		{
+			const uInt n = uInt(std::min(remaining, ZLibMaxAvail));
+			crc_ = crc32(crc_, s + src_size - remaining, n);
+			remaining -= n;
+		}
+
+		size_ += src_size;
+		deflate_all(s, src_size, Z_NO_FLUSH);
+	}
+
+	size_t finish() override
+	{
+		deflate_all(nullptr, 0, Z_FINISH);
+		oCheck(size_t(oend_ - op_) >= GZipFooterSize, std::errc::no_buffer_space, "");
+
+		const uint32_t ISIZE = static_cast<uint32_t>(size_);
+		memcpy(op_, &crc_, sizeof(crc_));
+		memcpy(op_ + sizeof(crc_), &ISIZE, sizeof(ISIZE));
+		op_ += GZipFooterSize;
+
+		return size_t(op_ - dst_);
+	}
+
+private:
+	void deflate_all(const uint8_t* src, size_t src_size, int flush)
+	{
+		for (;;)
+		{
+			const uInt in = uInt(std::min(src_size, ZLibMaxAvail));
+			const uInt out = uInt(std::min(size_t(oend_ - op_), ZLibMaxAvail));
+			z_.next_in = const_cast<Bytef*>(src);
+			z_.avail_in = in;
+			z_.next_out = op_;
+			z_.avail_out = out;
+
+			const int err = deflate(&z_, in == src_size ? flush : Z_NO_FLUSH);
+			src += in - z_.avail_in;
+			src_size -= in - z_.avail_in;
+			op_ += out - z_.avail_out;
+
+			if (err == Z_STREAM_END)
+				return;
+
+			oCheck(err == Z_OK || err == Z_BUF_ERROR, std::errc::protocol_error, "compression failed");
+
+			if (flush == Z_NO_FLUSH && !src_size)
+				return;
+
+			oCheck(op_ != oend_, std::errc::no_buffer_space, "");
+		}
+	}
+
+	allocator alloc_;
+	z_stream z_;
+	codec_buffer dict_;
+	uint8_t* dst_;
+	uint8_t* op_;
+	uint8_t* oend_;
+	uint32_t crc_;
+	size_t size_;
+};
+
+class gzip_decompressor : public decompressor::codec
+{
+public:
+	gzip_decompressor(const allocator& alloc)
+		: alloc_(alloc)
+		, dict_(alloc, "gzip dictionary")
+		, state_(state::header)
+		, have_(0)
+		, dst_(nullptr)
+		, op_(nullptr)
+		, oend_(nullptr)
+	{
+		memset(&z_, 0, sizeof(z_));
+		z_.zalloc = zlib_allocate;
+		z_.zfree = zlib_deallocate;
+		z_.opaque = &alloc_;
+		oCheck(inflateInit(&z_) == Z_OK, std::errc::not_enough_memory, "gzip decompressor initialization failed");
+	}
+
+	~gzip_decompressor() { inflateEnd(&z_); }
+
+	void set_dictionary(const void* dict, size_t dict_size) override
+	{
+		dict_.clear();
+		dict_.append(dict, dict_size);
+	}
+
+	void begin(void* dst, size_t dst_size) override
+	{
+		oCheck(inflateReset(&z_) == Z_OK, std::errc::protocol_error, "gzip decompressor reset failed");
+		state_ = state::header;
+		have_ = 0;
+		dst_ = static_cast<uint8_t*>(dst);
+		op_ = dst_;
+		oend_ = dst_ + (dst ? dst_size : 0);
+	}
+
+	void feed(const void* src, size_t src_size) override
+	{
+		const uint8_t* s = static_cast<const uint8_t*>(src);
+		while (src_size && state_ != state::done)
+		{
+			if (state_ == state::body)
+			{
+				const uInt in = uInt(std::min(src_size, ZLibMaxAvail));
+				const uInt out = uInt(std::min(size_t(oend_ - op_), ZLibMaxAvail));
+				uint8_t no_output;
+				z_.next_in = const_cast<Bytef*>(s);
+				z_.avail_in = in;
+				z_.next_out = out ? op_ : &no_output; // zlib requires somewhere even to write nothing
+				z_.avail_out = out;
+
+				const int err = inflate(&z_, Z_NO_FLUSH);
+				const size_t consumed = in - z_.avail_in;
+				const size_t produced = out - z_.avail_out;
+				s += consumed;
+				src_size -= consumed;
+				op_ += produced;
+
+				if (err == Z_NEED_DICT)
+				{
+					oCheck(!dict_.empty(), std::errc::invalid_argument, "gzip stream requires a dictionary");
+					oCheck(inflateSetDictionary(&z_, dict_.data(), uInt(std::min(dict_.size(), ZLibMaxAvail))) == Z_OK, std::errc::invalid_argument, "gzip stream was compressed with a different dictionary");
+				}
+
+				else if (err == Z_STREAM_END)
+				{
+					state_ = state::trailer;
+					have_ = 0;
+				}
+
+				else
+				{
+					oCheck(err == Z_OK || err == Z_BUF_ERROR, std::errc::protocol_error, "decompression error");
+					oCheck(consumed || produced, std::errc::no_buffer_space, "");
+				}
+
+				continue;
+			}
+
+			// header and trailer are fixed size so gather them in case they're split
+			uint8_t* part = state_ == state::header ? header_ : trailer_;
+			const size_t part_size = state_ == state::header ? sizeof(header_) : sizeof(trailer_);
+			const size_t n = std::min(part_size - have_, src_size);
+			memcpy(part + have_, s, n);
+			have_ += n;
+			s += n;
+			src_size -= n;
+
+			if (have_ == part_size)
+			{
+				if (state_ == state::header)
+				{
+					const GZIP_HDR& h = *(const GZIP_HDR*)header_;
+					oCheck(h.ID1 == GZipID1 && h.ID2 == GZipID2 && h.CM == GZipCM, std::errc::protocol_error, "Not a valid GZip stream");
+					oCheck(!h.FLG, std::errc::not_supported, "optional GZip header fields are not supported");
+					state_ = state::body;
+				}
+				else
+					state_ = state::done;
+			}
+		}
+	}
+
+	size_t finish() override
+	{
+		oCheck(state_ != state::body || op_ != oend_, std::errc::no_buffer_space, "");
+		oCheck(state_ == state::done, std::errc::protocol_error, "truncated GZip stream");
+
+		const size_t size = size_t(op_ - dst_);
+		uint32_t CRC32 = crc32(0, Z_NULL, 0);
+		for (size_t offset = 0; offset < size;)
+		{
+			const uInt n = uInt(std::min(size - offset, ZLibMaxAvail));
+			CRC32 = crc32(CRC32, dst_ + offset, n);
+			offset += n;
+		}
+
+		uint32_t expectedCRC32, ISIZE;
+		memcpy(&expectedCRC32, trailer_, sizeof(expectedCRC32));
+		memcpy(&ISIZE, trailer_ + sizeof(expectedCRC32), sizeof(ISIZE));
+		oCheck(CRC32 == expectedCRC32, std::errc::protocol_error, "CRC mismatch in GZip stream");
+		oCheck(ISIZE == static_cast<uint32_t>(size), std::errc::protocol_error, "size mismatch in GZip stream");
+
+		return size;
+	}
+
+private:
+	enum class state { header, body, trailer, done };
+
+	allocator alloc_;
+	z_stream z_;
+	codec_buffer dict_;
+	state state_;
+	size_t have_;
+	uint8_t header_[sizeof(GZIP_HDR)];
+	uint8_t trailer_[GZipFooterSize];
+	uint8_t* dst_;
+	uint8_t* op_;
+	uint8_t* oend_;
+};
+
+compressor::codec* new_gzip_compressor(const allocator& alloc, int level)
+{
+	return new_codec<gzip_compressor>(alloc, level, "gzip compressor");
+}
+
+decompressor::codec* new_gzip_decompressor(const allocator& alloc)
+{
+	return new_codec<gzip_decompressor>(alloc, "gzip decompressor");
+}
+
 }
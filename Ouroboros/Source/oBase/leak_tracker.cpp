@@ -19,9 +19,7 @@ static inline uint64_t leak_tracker_hash(uintptr_t key)
 
 leak_tracker::size_type leak_tracker::calc_size(size_type capacity)
 {
-	return align(concurrent_object_pool<entry>::calc_size(capacity)
-		+ hash_map_t::calc_size(capacity)
-		, oCACHE_LINE_SIZE);
+	return align(pool_t::calc_size(capacity), oCACHE_LINE_SIZE);
 }
 
 leak_tracker::leak_tracker()
@@ -34,9 +32,9 @@ leak_tracker::leak_tracker(const init_t& i, size_type capacity, const char* allo
 	initialize(i, capacity, alloc_label, a);
 }
 
-leak_tracker::leak_tracker(const init_t& i, void* memory, size_type capacity)
+leak_tracker::leak_tracker(const init_t& i, void* memory, size_type capacity, const allocator& a)
 {
-	initialize(i, memory, capacity);
+	initialize(i, memory, capacity, a);
 }
 
 leak_tracker::leak_tracker(leak_tracker&& that)
@@ -73,40 +71,27 @@ void leak_tracker::initialize(const init_t& i, size_type capacity, const char* a
 	
 	allocate_options opts(memory_alignment::cacheline);
 
-	auto allocs_bytes = opts.align(allocs.calc_size(capacity));
 	auto pool_bytes = pool.calc_size(capacity);
-	auto total_size = allocs_bytes + pool_bytes;
-
-	auto allocs_mem = (uint8_t*)a.allocate(total_size, "leak_tracker", opts);
-	auto pool_mem = allocs_mem + allocs_bytes;
+	auto pool_mem = a.allocate(pool_bytes, alloc_label, opts);
 	
-	allocs.initialize(nullidx, allocs_mem, capacity);
-	pool.initialize(pool_mem, pool_bytes);
+	allocs.initialize(nullidx, capacity, alloc_label, a);
+	pool.initialize(pool_mem, pool_bytes, alloc_label, a);
 }
 
-void leak_tracker::initialize(const init_t& i, void* memory, size_type capacity)
+void leak_tracker::initialize(const init_t& i, void* memory, size_type capacity, const allocator& a)
 {
 	this->init = i;
 	current_context.store(0);
 
-	allocate_options opts(memory_alignment::cacheline);
-
-	auto allocs_bytes = opts.align(allocs.calc_size(capacity));
-
-	auto allocs_mem = (uint8_t*)memory;
-	auto pool_mem = allocs_mem + allocs_bytes;
-
-	allocs.initialize(nullidx, memory, capacity);
-	auto req = pool.calc_size(capacity);
-	void* mem = align((uint8_t*)memory + allocs_bytes, oCACHE_LINE_SIZE);
-	pool.initialize(mem, req);
+	allocs.initialize(nullidx, capacity, "leak_tracker", a);
+	pool.initialize(memory, pool.calc_size(capacity), "leak_tracker", a);
 }
 
 void* leak_tracker::deinitialize()
 {
 	current_context.store(0);
-	pool.deinitialize();
-	return allocs.deinitialize();
+	allocs.deinitialize();
+	return pool.deinitialize();
 }
 
 void leak_tracker::on_stat(const allocation_stats& stats, void* old_ptr)
@@ -134,39 +119,38 @@ void leak_tracker::internal_on_stat(uintptr_t new_ptr, const allocation_stats& s
 		case memory_operation::allocate:
 		{
 			if (idx == nullidx)
+			{
 				idx = pool.allocate_index();
+				if (idx == pool.nullidx)
+					idx = nullidx;
+			}
 
+			if (idx == nullidx)
+			{
+				init.print("[leak_tracker] out of tracking entries, this allocation won't be reported if it leaks\n");
+				break;
+			}
+
+			entry* e = pool.typed_pointer(idx);
+			e->label = stats.label;
+			e->size = stats.size;
+			e->num_stack_entries = init.capture_callstack ? static_cast<uint8_t>(init.callstack(e->stack, stack_trace_max_depth, stack_trace_offset)) : 0;
+			e->tracked = init.thread_local_tracking_enabled();
+			e->context = current_context;
+			e->id = stats.ordinal;
+
+			idx = allocs.set(leak_tracker_hash(new_ptr), idx);
 			if (idx != nullidx)
 			{
-				entry* e = pool.typed_pointer(idx);
-				if (e)
-				{
-					e->label = stats.label;
-					e->size = stats.size;
-					e->num_stack_entries = init.capture_callstack ? static_cast<uint8_t>(init.callstack(e->stack, stack_trace_max_depth, stack_trace_offset)) : 0;
-					e->tracked = init.thread_local_tracking_enabled();
-					e->context = current_context;
-					e->id = stats.ordinal;
-
-					idx = allocs.set(leak_tracker_hash(new_ptr), idx);
-					if (idx != nullidx)
-					{
-						e = pool.typed_pointer(idx);
-
-						char buf[1024];
-						snprintf(	buf,
-							"[leak_tracker] hash collision:\n  incoming: ordinal=%u size=%u new_ptr=%p old_ptr=%p ptr=%p\n"
-							"  outgoing: ordinal=%u size=%u\n"
-							, stats.ordinal, uint32_t(stats.size), new_ptr, old_ptr, stats.pointer, e->id, uint32_t(e->size));
-
-						init.print(buf);
-					}
-				}
-
-				else
-				{
-					init.print("[leak_tracker] out of tracking entries\n");
-				}
+				e = pool.typed_pointer(idx);
+
+				char buf[1024];
+				snprintf(	buf,
+					"[leak_tracker] hash collision:\n  incoming: ordinal=%u size=%u new_ptr=%p old_ptr=%p ptr=%p\n"
+					"  outgoing: ordinal=%u size=%u\n"
+					, stats.ordinal, uint32_t(stats.size), new_ptr, old_ptr, stats.pointer, e->id, uint32_t(e->size));
+
+				init.print(buf);
 			}
 
 			break;
@@ -1,19 +1,1147 @@
 // Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
 
 #include <oCore/assert.h>
+#include <oCore/bit.h>
 #include <oCore/byte.h>
 #include <oBase/compression.h>
+#include <oBase/compressor.h>
+#include <oBase/lz4.h>
+#include <oMemory/xxhash.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
 
-namespace ouro {
+namespace ouro { namespace lz4 {
+
+// A block is a series of sequences, each a token, literals and a match:
+// token:    high 4 bits literal length, low 4 bits match length - min_match,
+//           15 in either means more length follows as bytes summed until one
+//           isn't 255
+// literals: copied as-is
+// offset:   2 bytes back from the current output position to copy from
+// The last sequence is only literals and the last last_literals bytes of a
+// block are always literals.
+
+static const uint32_t min_match     = 4;
+static const uint32_t last_literals = 5;
+static const uint32_t mf_limit      = 12; // a match can't start closer than this to the end
+static const uint32_t max_distance  = 65535;
+static const uint32_t run_mask      = 15;
+static const uint32_t ml_mask       = 15;
+
+static const uint32_t fast_hash_log = 12;
+static const uint32_t skip_trigger  = 6;  // fast: skip ahead faster the longer there's no match
+static const uint32_t hc_hash_log   = 15;
+static const int      hc_lazy_level = 3;  // hc: from here on check if the next byte starts a longer match
+
+static inline uint16_t read16(const uint8_t* p) { uint16_t v; memcpy(&v, p, sizeof(v)); return v; }
+static inline uint32_t read32(const uint8_t* p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; }
+static inline uint64_t read64(const uint8_t* p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; }
+static inline void write16(uint8_t* p, uint16_t v) { memcpy(p, &v, sizeof(v)); }
+static inline void write32(uint8_t* p, uint32_t v) { memcpy(p, &v, sizeof(v)); }
+
+static inline uint32_t hash4(uint32_t sequence, uint32_t hash_log) { return (sequence * 2654435761u) >> (32 - hash_log); }
+
+// Hashing 5 bytes finds fewer but longer matches than 4 with the small fast
+// table, which is both a better ratio and fewer sequences to decode.
+static inline uint32_t hash5(const uint8_t* p, uint32_t hash_log) { return uint32_t(((read64(p) << 24) * 889523592379ull) >> (64 - hash_log)); }
+
+// returns how many bytes from p match those from m without reaching limit
+static inline size_t count_match(const uint8_t* p, const uint8_t* m, const uint8_t* limit)
+{
+	const uint8_t* start = p;
+	while (p + sizeof(uint64_t) <= limit)
+	{
+		const uint64_t diff = read64(p) ^ read64(m);
+		if (diff)
+			return size_t(p - start) + (bitlow(diff) >> 3);
+		p += sizeof(uint64_t);
+		m += sizeof(uint64_t);
+	}
+
+	while (p < limit && *p == *m)
+		p++, m++;
+
+	return size_t(p - start);
+}
+
+static inline uint8_t* write_length(uint8_t* op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = uint8_t(len);
+	return op;
+}
+
+// writes a sequence or returns false if it wouldn't fit in oend
+static inline bool emit_sequence(uint8_t*& op, const uint8_t* oend, const uint8_t* anchor, size_t num_literals, size_t offset, size_t match_len)
+{
+	const size_t ml = match_len - min_match;
+	if (size_t(oend - op) < 1 + num_literals + num_literals / 255 + 1 + 2 + ml / 255 + 1)
+		return false;
+
+	uint8_t* token = op++;
+	if (num_literals >= run_mask)
+	{
+		*token = uint8_t(run_mask << 4);
+		op = write_length(op, num_literals - run_mask);
+	}
+	else
+		*token = uint8_t(num_literals << 4);
+
+	memcpy(op, anchor, num_literals);
+	op += num_literals;
+
+	write16(op, uint16_t(offset));
+	op += 2;
+
+	if (ml >= ml_mask)
+	{
+		*token |= ml_mask;
+		op = write_length(op, ml - ml_mask);
+	}
+	else
+		*token |= uint8_t(ml);
+
+	return true;
+}
+
+// writes the final literals-only sequence or returns false if it wouldn't fit
+static inline bool emit_last_literals(uint8_t*& op, const uint8_t* oend, const uint8_t* anchor, size_t num_literals)
+{
+	if (size_t(oend - op) < 1 + num_literals + (num_literals + 255 - run_mask) / 255)
+		return false;
+
+	if (num_literals >= run_mask)
+	{
+		*op++ = uint8_t(run_mask << 4);
+		op = write_length(op, num_literals - run_mask);
+	}
+	else
+		*op++ = uint8_t(num_literals << 4);
+
+	if (num_literals)
+		memcpy(op, anchor, num_literals);
+	op += num_literals;
+	return true;
+}
+
+// The compressors return 0 if the result doesn't fit in dst_size. They compress
+// [src,src+src_size) where matches can also reach back into a prefix from base
+// to src, such as a dictionary, whose positions their tables already hold.
+
+// fills a fast table with positions in the prefix [base,base+prefix_size)
+static void fast_load_prefix(uint32_t* table, const uint8_t* base, size_t prefix_size)
+{
+	memset(table, 0, sizeof(uint32_t) << fast_hash_log);
+	for (size_t pos = 0; pos + sizeof(uint64_t) <= prefix_size; pos++)
+		table[hash5(base + pos, fast_hash_log)] = uint32_t(pos);
+}
+
+static size_t compress_fast(uint8_t* oRESTRICT dst, size_t dst_size, const uint8_t* base, const uint8_t* src, size_t src_size, uint32_t* table)
+{
+	uint8_t*       op     = dst;
+	const uint8_t* oend   = dst + dst_size;
+	const uint8_t* ip     = src;
+	const uint8_t* anchor = src;
+	const uint8_t* iend   = src + src_size;
+
+	if (src_size > mf_limit)
+	{
+		const uint8_t* mflimit    = iend - mf_limit;
+		const uint8_t* matchlimit = iend - last_literals;
+
+		// positions relative to base, a stale or empty entry is caught by comparing bytes
+		table[hash5(ip, fast_hash_log)] = uint32_t(ip - base);
+		ip++;
+
+		for (;;)
+		{
+			const uint8_t* match;
+			uint32_t attempts = 1 << skip_trigger;
+			for (;;)
+			{
+				if (ip > mflimit)
+					goto done;
+
+				const uint32_t sequence = read32(ip);
+				const uint32_t h = hash5(ip, fast_hash_log);
+				match = base + table[h];
+				table[h] = uint32_t(ip - base);
+				if (match < ip && size_t(ip - match) <= max_distance && read32(match) == sequence)
+					break;
+
+				ip += attempts++ >> skip_trigger;
+			}
+
+			while (ip > anchor && match > base && ip[-1] == match[-1])
+				ip--, match--;
+
+			const size_t match_len = min_match + count_match(ip + min_match, match + min_match, matchlimit);
+			if (!emit_sequence(op, oend, anchor, size_t(ip - anchor), size_t(ip - match), match_len))
+				return 0;
+
+			ip += match_len;
+			anchor = ip;
+
+			if (ip > mflimit)
+				break;
+
+			// fill in a position skipped over by the match
+			table[hash5(ip - 2, fast_hash_log)] = uint32_t(ip - 2 - base);
+		}
+	}
+
+done:
+	if (!emit_last_literals(op, oend, anchor, size_t(iend - anchor)))
+		return 0;
+
+	return size_t(op - dst);
+}
+
+// positions + 1 by hash (0 is empty) and the distance back to the previous
+// position with the same hash (0 is none) in a window of the last 64 KB
+struct hc_tables
+{
+	uint32_t head[1 << hc_hash_log];
+	uint16_t chain[max_distance + 1];
+};
+
+static inline void hc_insert(hc_tables& t, const uint8_t* base, uint32_t* next, uint32_t target)
+{
+	for (uint32_t pos = *next; pos < target; pos++)
+	{
+		const uint32_t h = hash4(read32(base + pos), hc_hash_log);
+		const uint32_t prev = t.head[h];
+		const uint32_t delta = prev ? pos - (prev - 1) : 0;
+		t.chain[pos & max_distance] = delta > max_distance ? 0 : uint16_t(delta);
+		t.head[h] = pos + 1;
+	}
+
+	*next = std::max(*next, target);
+}
+
+// returns the longest match for ip in the window or 0 if there is none
+static size_t hc_find(const hc_tables& t, const uint8_t* base, const uint8_t* ip, const uint8_t* limit, uint32_t attempts, const uint8_t** out_match)
+{
+	const uint32_t pos = uint32_t(ip - base);
+	const uint32_t sequence = read32(ip);
+	size_t best = min_match - 1;
+
+	for (uint32_t candidate = t.head[hash4(sequence, hc_hash_log)]; candidate && attempts; attempts--)
+	{
+		const uint32_t c = candidate - 1;
+		if (pos - c > max_distance)
+			break;
+
+		const uint8_t* m = base + c;
+		if (m[best] == ip[best] && read32(m) == sequence)
+		{
+			const size_t len = min_match + count_match(ip + min_match, m + min_match, limit);
+			if (len > best)
+			{
+				best = len;
+				*out_match = m;
+			}
+		}
+
+		const uint16_t delta = t.chain[c & max_distance];
+		if (!delta || delta > c)
+			break;
+		candidate = c - delta + 1;
+	}
+
+	return best >= min_match ? best : 0;
+}
+
+static size_t compress_hc(uint8_t* oRESTRICT dst, size_t dst_size, const uint8_t* base, const uint8_t* src, size_t src_size, int level, hc_tables& t)
+{
+	uint8_t*       op     = dst;
+	const uint8_t* oend   = dst + dst_size;
+	const uint8_t* ip     = src;
+	const uint8_t* anchor = src;
+	const uint8_t* iend   = src + src_size;
+
+	if (src_size > mf_limit)
+	{
+		const uint8_t* mflimit    = iend - mf_limit;
+		const uint8_t* matchlimit = iend - last_literals;
+		const uint32_t attempts   = 1u << (std::min(level, max_level) - 1);
+		const bool     lazy       = level >= hc_lazy_level;
+
+		memset(t.head, 0, sizeof(t.head));
+		uint32_t next = 0;
+		hc_insert(t, base, &next, uint32_t(src - base));
+
+		const uint8_t* match = nullptr;
+		size_t match_len = 0;
+		while (ip <= mflimit)
+		{
+			if (!match_len)
+			{
+				hc_insert(t, base, &next, uint32_t(ip - base));
+				match_len = hc_find(t, base, ip, matchlimit, attempts, &match);
+				if (!match_len)
+				{
+					ip++;
+					continue;
+				}
+			}
+
+			if (lazy && ip < mflimit)
+			{
+				hc_insert(t, base, &next, uint32_t(ip + 1 - base));
+				const uint8_t* next_match = nullptr;
+				const size_t next_len = hc_find(t, base, ip + 1, matchlimit, attempts, &next_match);
+				if (next_len > match_len)
+				{
+					ip++;
+					match = next_match;
+					match_len = next_len;
+					continue;
+				}
+			}
+
+			if (!emit_sequence(op, oend, anchor, size_t(ip - anchor), size_t(ip - match), match_len))
+				return 0;
+
+			ip += match_len;
+			anchor = ip;
+			match_len = 0;
+		}
+	}
+
+	if (!emit_last_literals(op, oend, anchor, size_t(iend - anchor)))
+		return 0;
+
+	return size_t(op - dst);
+}
+
+static size_t compress_limited(uint8_t* oRESTRICT dst, size_t dst_size, const uint8_t* oRESTRICT src, size_t src_size, int level)
+{
+	oCheck(src_size <= max_block_input, std::errc::invalid_argument, "lz4 blocks are limited to %u bytes", uint32_t(max_block_input));
+
+	if (level <= fast_level)
+	{
+		uint32_t table[1 << fast_hash_log];
+		memset(table, 0, sizeof(table));
+		return compress_fast(dst, dst_size, src, src, src_size, table);
+	}
+
+	std::unique_ptr<hc_tables> t(new hc_tables);
+	return compress_hc(dst, dst_size, src, src, src_size, level, *t);
+}
+
+static inline size_t read_length(const uint8_t*& ip, const uint8_t* iend)
+{
+	size_t len = 0;
+	uint8_t b;
+	do
+	{
+		oCheck(ip < iend, std::errc::protocol_error, "truncated lz4 block");
+		b = *ip++;
+		len += b;
+	} while (b == 255);
+	return len;
+}
+
+// copies 16 bytes at a time so up to 15 bytes past d + n are written and s + n read
+static inline void wild_copy16(uint8_t* d, const uint8_t* s, size_t n)
+{
+	uint8_t* end = d + n;
+	do
+	{
+		memcpy(d, s, 16);
+		d += 16;
+		s += 16;
+	} while (d < end);
+}
+
+// as above for sources at least 8 bytes behind d
+static inline void wild_copy8(uint8_t* d, const uint8_t* s, size_t n)
+{
+	uint8_t* end = d + n;
+	do
+	{
+		memcpy(d, s, 8);
+		d += 8;
+		s += 8;
+	} while (d < end);
+}
+
+// Decodes the block [ip,iend) into [op,oend) where matches can reach back as
+// far as low, and from there into the end of a dictionary if there is one, and
+// returns the end of the output.
+static uint8_t* decode(uint8_t* op, uint8_t* oend, const uint8_t* low, const uint8_t* ip, const uint8_t* iend, const uint8_t* dict = nullptr, size_t dict_size = 0)
+{
+	for (;;)
+	{
+		oCheck(ip < iend, std::errc::protocol_error, "truncated lz4 block");
+		const uint32_t token = *ip++;
+		size_t num_literals = token >> 4;
+		size_t match_len = token & ml_mask;
+
+		// most sequences are short: copy them whole when there's room for the excess
+		if (num_literals != run_mask && size_t(iend - ip) >= 32 && size_t(oend - op) >= 32)
+		{
+			memcpy(op, ip, 16);
+			op += num_literals;
+			ip += num_literals;
+		}
+		else
+		{
+			if (num_literals == run_mask)
+				num_literals += read_length(ip, iend);
+
+			const size_t src_left = size_t(iend - ip);
+			const size_t dst_left = size_t(oend - op);
+			oCheck(num_literals <= src_left, std::errc::protocol_error, "truncated lz4 block");
+			oCheck(num_literals <= dst_left, std::errc::no_buffer_space, "lz4 block decompresses larger than the destination");
+
+			if (num_literals + 16 <= src_left && num_literals + 16 <= dst_left)
+				wild_copy16(op, ip, num_literals);
+			else
+				memcpy(op, ip, num_literals);
+
+			op += num_literals;
+			ip += num_literals;
+
+			if (ip == iend)
+				return op;
+		}
+
+		oCheck(iend - ip >= 2, std::errc::protocol_error, "truncated lz4 block");
+		const size_t offset = read16(ip);
+		ip += 2;
+
+		const size_t window = size_t(op - low);
+		if (offset > window)
+		{
+			// the match starts in the dictionary and may continue from low
+			oCheck(offset - window <= dict_size, std::errc::protocol_error, "lz4 match offset is out of range");
+			if (match_len == ml_mask)
+				match_len += read_length(ip, iend);
+			match_len += min_match;
+			oCheck(match_len <= size_t(oend - op), std::errc::no_buffer_space, "lz4 block decompresses larger than the destination");
+
+			const size_t from_dict = std::min(match_len, offset - window);
+			memcpy(op, dict + dict_size - (offset - window), from_dict);
+			for (size_t i = from_dict; i < match_len; i++)
+				op[i] = low[i - from_dict];
+			op += match_len;
+			continue;
+		}
+
+		oCheck(offset, std::errc::protocol_error, "lz4 match offset is out of range");
+
+		if (match_len != ml_mask && offset >= 8 && size_t(oend - op) >= 18)
+		{
+			memcpy(op, op - offset, 8);
+			memcpy(op + 8, op - offset + 8, 8);
+			memcpy(op + 16, op - offset + 16, 2);
+			op += match_len + min_match;
+			continue;
+		}
+
+		if (match_len == ml_mask)
+			match_len += read_length(ip, iend);
+		match_len += min_match;
+		oCheck(match_len <= size_t(oend - op), std::errc::no_buffer_space, "lz4 block decompresses larger than the destination");
+
+		const uint8_t* match = op - offset;
+		if (match_len + 16 <= size_t(oend - op))
+		{
+			if (offset >= 16)
+				wild_copy16(op, match, match_len);
+			else if (offset >= 8)
+				wild_copy8(op, match, match_len);
+			else
+			{
+				// repeat the first 8 bytes one at a time, then copy from a whole
+				// number of periods back, which is far enough to not overlap
+				for (size_t i = 0; i < 8; i++)
+					op[i] = match[i];
+				if (match_len > 8)
+				{
+					size_t period = offset;
+					while (period < 8)
+						period += offset;
+					wild_copy8(op + 8, op + 8 - period, match_len - 8);
+				}
+			}
+		}
+		else
+		{
+			// [match,op) repeats with a period of offset, so keep doubling how much
+			// can be copied from it without overlap
+			const uint8_t* end = op + match_len;
+			for (uint8_t* o = op; o < end;)
+			{
+				const size_t n = std::min(size_t(o - match), size_t(end - o));
+				memcpy(o, match, n);
+				o += n;
+			}
+		}
+
+		op += match_len;
+	}
+}
+
+// returns how many bytes the block [ip,iend) decodes to without decoding it
+static size_t decoded_size(const uint8_t* ip, const uint8_t* iend)
+{
+	size_t size = 0;
+	for (;;)
+	{
+		oCheck(ip < iend, std::errc::protocol_error, "truncated lz4 block");
+		const uint32_t token = *ip++;
+
+		size_t num_literals = token >> 4;
+		if (num_literals == run_mask)
+			num_literals += read_length(ip, iend);
+		oCheck(num_literals <= size_t(iend - ip), std::errc::protocol_error, "truncated lz4 block");
+		ip += num_literals;
+		size += num_literals;
+
+		if (ip == iend)
+			return size;
+
+		oCheck(iend - ip >= 2, std::errc::protocol_error, "truncated lz4 block");
+		ip += 2;
+
+		size_t match_len = token & ml_mask;
+		if (match_len == ml_mask)
+			match_len += read_length(ip, iend);
+		size += match_len + min_match;
+	}
+}
+
+size_t compress_block_bound(size_t src_size)
+{
+	return src_size + src_size / 255 + 16;
+}
+
+size_t compress_block(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size, int level)
+{
+	if (!dst)
+		return compress_block_bound(src_size);
+
+	const size_t compressed_size = compress_limited((uint8_t*)dst, dst_size, (const uint8_t*)src, src_size, level);
+	oCheck(compressed_size, std::errc::no_buffer_space, "");
+	return compressed_size;
+}
+
+size_t decompress_block(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size)
+{
+	uint8_t* d = (uint8_t*)dst;
+	return size_t(decode(d, d + dst_size, d, (const uint8_t*)src, (const uint8_t*)src + src_size) - d);
+}
+
+// Frame format (all little endian)
+// 4 bytes magic
+// 1 byte  FLG: version (2 bits), block independence, block checksums, content
+//         size, content checksum, reserved, dictionary id
+// 1 byte  BD: block max size as 4 (64 KB) to 7 (4 MB) in bits 4-6
+// 8 bytes content size (optional)
+// 4 bytes dictionary id (optional)
+// 1 byte  second byte of xxhash32 of the descriptor from FLG on
+// blocks: 4 byte size with the high bit set if stored uncompressed, data, then
+//         4 byte xxhash32 of the data if there are block checksums
+// 4 bytes 0 to end the blocks
+// 4 bytes xxhash32 of the content (optional)
+
+static const uint32_t frame_magic             = 0x184d2204;
+static const uint32_t skippable_magic_mask    = 0xfffffff0;
+static const uint32_t skippable_magic         = 0x184d2a50;
+static const uint8_t  flg_version             = 0x40;
+static const uint8_t  flg_version_mask        = 0xc0;
+static const uint8_t  flg_block_independence  = 0x20;
+static const uint8_t  flg_block_checksum      = 0x10;
+static const uint8_t  flg_content_size        = 0x08;
+static const uint8_t  flg_content_checksum    = 0x04;
+static const uint8_t  flg_dictionary_id       = 0x01;
+static const uint32_t uncompressed_block_bit  = 0x80000000;
+static const uint32_t frame_block_size_id     = 7;
+static const size_t   frame_block_size        = size_t(1) << (2 * frame_block_size_id + 8);
+static const size_t   frame_header_size       = 4 + 1 + 1 + 8 + 1;
+static const size_t   frame_footer_size       = 4 + 4;
+
+static inline uint8_t header_checksum(const uint8_t* descriptor, size_t size)
+{
+	return uint8_t(xxhash32(descriptor, size) >> 8);
+}
+
+// writes the header for frames of independent blocks and returns its size
+static size_t write_frame_header(uint8_t* op, uint64_t content_size, bool has_dict, uint32_t dict_id)
+{
+	write32(op, frame_magic);
+	op[4] = flg_version | flg_block_independence | flg_content_size | flg_content_checksum | (has_dict ? flg_dictionary_id : 0);
+	op[5] = uint8_t(frame_block_size_id << 4);
+	memcpy(op + 6, &content_size, sizeof(content_size));
+	size_t descriptor_size = 10;
+	if (has_dict)
+	{
+		write32(op + 14, dict_id);
+		descriptor_size += sizeof(dict_id);
+	}
+
+	op[4 + descriptor_size] = header_checksum(op + 4, descriptor_size);
+	return 4 + descriptor_size + 1;
+}
+
+size_t compress_frame(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size, int level)
+{
+	// blocks that don't compress are stored as-is so each costs at most its size field
+	const size_t num_blocks = (src_size + frame_block_size - 1) / frame_block_size;
+	const size_t bound = frame_header_size + num_blocks * sizeof(uint32_t) + src_size + frame_footer_size;
+	if (!dst)
+		return bound;
+
+	oCheck(dst_size >= bound, std::errc::no_buffer_space, "");
+
+	uint8_t* op = (uint8_t*)dst;
+	op += write_frame_header(op, src_size, false, 0);
+
+	const uint8_t* ip = (const uint8_t*)src;
+	for (size_t remaining = src_size; remaining;)
+	{
+		const size_t block_size = std::min(remaining, frame_block_size);
+		const size_t compressed_size = compress_limited(op + sizeof(uint32_t), block_size - 1, ip, block_size, level);
+		if (compressed_size)
+		{
+			write32(op, uint32_t(compressed_size));
+			op += sizeof(uint32_t) + compressed_size;
+		}
+		else
+		{
+			write32(op, uint32_t(block_size) | uncompressed_block_bit);
+			memcpy(op + sizeof(uint32_t), ip, block_size);
+			op += sizeof(uint32_t) + block_size;
+		}
+
+		ip += block_size;
+		remaining -= block_size;
+	}
+
+	write32(op, 0);
+	write32(op + sizeof(uint32_t), xxhash32(src, src_size));
+	op += frame_footer_size;
+
+	return size_t(op - (uint8_t*)dst);
+}
+
+size_t decompress_frame(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size)
+{
+	const uint8_t* ip = (const uint8_t*)src;
+	const uint8_t* iend = ip + src_size;
+
+	// skip any leading skippable frames
+	while (iend - ip >= 8 && (read32(ip) & skippable_magic_mask) == skippable_magic)
+	{
+		const size_t skip_size = read32(ip + 4);
+		oCheck(skip_size <= size_t(iend - ip - 8), std::errc::protocol_error, "truncated lz4 frame");
+		ip += 8 + skip_size;
+	}
+
+	oCheck(iend - ip >= 7 && read32(ip) == frame_magic, std::errc::protocol_error, "not an lz4 frame");
+	const uint8_t* descriptor = ip + 4;
+	const uint8_t flg = descriptor[0];
+	const uint8_t bd = descriptor[1];
+	oCheck((flg & flg_version_mask) == flg_version, std::errc::not_supported, "unsupported lz4 frame version");
+	oCheck(!(flg & flg_dictionary_id), std::errc::not_supported, "lz4 frames with a dictionary require a decompressor with the dictionary");
+
+	const size_t block_max = size_t(1) << (2 * ((bd >> 4) & 7) + 8);
+	oCheck(block_max >= (64 << 10), std::errc::protocol_error, "invalid lz4 block max size");
+
+	const size_t descriptor_size = 2 + ((flg & flg_content_size) ? 8 : 0);
+	oCheck(size_t(iend - descriptor) > descriptor_size, std::errc::protocol_error, "truncated lz4 frame");
+	oCheck(descriptor[descriptor_size] == header_checksum(descriptor, descriptor_size), std::errc::protocol_error, "lz4 frame header checksum mismatch");
+	ip = descriptor + descriptor_size + 1;
+
+	const bool independent = !!(flg & flg_block_independence);
+	const bool block_checksums = !!(flg & flg_block_checksum);
+
+	uint64_t content_size = 0;
+	if (flg & flg_content_size)
+	{
+		memcpy(&content_size, descriptor + 2, sizeof(content_size));
+		oCheck(content_size == size_t(content_size), std::errc::file_too_large, "lz4 frame content is too large for this platform");
+		if (!dst)
+			return size_t(content_size);
+		oCheck(dst_size >= content_size, std::errc::no_buffer_space, "");
+	}
+
+	uint8_t* obegin = (uint8_t*)dst;
+	uint8_t* op = obegin;
+	uint8_t* oend = obegin + (dst ? dst_size : 0);
+	size_t size = 0;
+
+	for (;;)
+	{
+		oCheck(iend - ip >= 4, std::errc::protocol_error, "truncated lz4 frame");
+		const uint32_t block_header = read32(ip);
+		ip += 4;
+		if (!block_header)
+			break;
+
+		const size_t block_size = block_header & ~uncompressed_block_bit;
+		oCheck(block_size <= block_max && block_size + (block_checksums ? 4 : 0) <= size_t(iend - ip), std::errc::protocol_error, "truncated lz4 frame");
+
+		if (block_checksums)
+			oCheck(read32(ip + block_size) == xxhash32(ip, block_size), std::errc::protocol_error, "lz4 block checksum mismatch");
+
+		if (!dst)
+			size += (block_header & uncompressed_block_bit) ? block_size : decoded_size(ip, ip + block_size);
+		else if (block_header & uncompressed_block_bit)
+		{
+			oCheck(block_size <= size_t(oend - op), std::errc::no_buffer_space, "");
+			memcpy(op, ip, block_size);
+			op += block_size;
+		}
+		else
+			op = decode(op, oend, independent ? op : obegin, ip, ip + block_size);
+
+		ip += block_size + (block_checksums ? 4 : 0);
+	}
+
+	if (!dst)
+		return size;
+
+	size = size_t(op - obegin);
+	oCheck(!(flg & flg_content_size) || size == content_size, std::errc::protocol_error, "lz4 frame content size mismatch");
+
+	if (flg & flg_content_checksum)
+	{
+		oCheck(iend - ip >= 4, std::errc::protocol_error, "truncated lz4 frame");
+		oCheck(read32(ip) == xxhash32(obegin, size), std::errc::protocol_error, "lz4 content checksum mismatch");
+	}
+
+	return size;
+}
+
+// Streams produce the same frames as compress_frame() and keep their tables
+// and buffers between streams. Input is gathered into whole blocks, except that
+// whole blocks fed at once without a dictionary are compressed where they are.
+// A dictionary is placed in front of each block so matches can reach into it,
+// and its fast table is built once.
+class compressor_context : public compressor::codec
+{
+public:
+	compressor_context(const allocator& alloc, int level)
+		: alloc_(alloc)
+		, level_(level == default_compression_level ? fast_level : level)
+		, hc_(nullptr)
+		, work_(alloc, "lz4 compressor")
+		, has_dict_(false)
+		, dict_size_(0)
+		, dict_id_(0)
+		, dst_(nullptr)
+		, op_(nullptr)
+		, oend_(nullptr)
+		, size_(0)
+	{
+		oCheck(level_ >= fast_level && level_ <= max_level, std::errc::invalid_argument, "lz4 levels are %d-%d", fast_level, max_level);
+	}
+
+	~compressor_context() { if (hc_) alloc_.deallocate(hc_); }
+
+	size_t max_compressed_size(size_t src_size) const override { return compress_frame(nullptr, 0, nullptr, src_size) + sizeof(uint32_t); }
+
+	void set_dictionary(const void* dict, size_t dict_size) override
+	{
+		// only the end of a dictionary is in reach of a block
+		has_dict_ = !!dict_size;
+		dict_size_ = std::min(dict_size, size_t(max_distance));
+		dict_id_ = has_dict_ ? xxhash32(dict, dict_size) : 0;
+		work_.clear();
+		work_.append((const uint8_t*)dict + dict_size - dict_size_, dict_size_);
+		fast_load_prefix(dict_table_, work_.data(), dict_size_);
+	}
+
+	void begin(void* dst, size_t dst_size) override
+	{
+		oCheck(dst_size >= frame_header_size + (has_dict_ ? sizeof(uint32_t) : 0), std::errc::no_buffer_space, "");
+		dst_ = (uint8_t*)dst;
+		oend_ = dst_ + dst_size;
+
+		// the content size is filled in by finish()
+		op_ = dst_ + write_frame_header(dst_, 0, has_dict_, dict_id_);
+
+		work_.resize(dict_size_);
+		checksum_.reset();
+		size_ = 0;
+	}
+
+	void feed(const void* src, size_t src_size) override
+	{
+		const uint8_t* s = (const uint8_t*)src;
+		checksum_.update(s, src_size);
+		size_ += src_size;
+
+		for (; !has_dict_ && work_.empty() && src_size >= frame_block_size; s += frame_block_size, src_size -= frame_block_size)
+			emit_block(s, s, frame_block_size);
+
+		while (src_size)
+		{
+			const size_t n = std::min(src_size, frame_block_size - (work_.size() - dict_size_));
+			work_.append(s, n);
+			s += n;
+			src_size -= n;
+
+			if (work_.size() - dict_size_ == frame_block_size)
+			{
+				emit_block(work_.data(), work_.data() + dict_size_, frame_block_size);
+				work_.resize(dict_size_);
+			}
+		}
+	}
+
+	size_t finish() override
+	{
+		if (work_.size() > dict_size_)
+			emit_block(work_.data(), work_.data() + dict_size_, work_.size() - dict_size_);
+		work_.resize(dict_size_);
+
+		oCheck(size_t(oend_ - op_) >= frame_footer_size, std::errc::no_buffer_space, "");
+		write32(op_, 0);
+		write32(op_ + sizeof(uint32_t), checksum_.digest());
+		op_ += frame_footer_size;
+
+		write_frame_header(dst_, size_, has_dict_, dict_id_);
+		return size_t(op_ - dst_);
+	}
+
+	size_t compress(void* dst, size_t dst_size, const void* src, size_t src_size) override
+	{
+		if (has_dict_)
+			return codec::compress(dst, dst_size, src, src_size);
+
+		// every block, even the last partial one, can compress where it is
+		begin(dst, dst_size);
+		checksum_.update(src, src_size);
+		size_ = src_size;
+		for (const uint8_t* s = (const uint8_t*)src; src_size;)
+		{
+			const size_t n = std::min(src_size, frame_block_size);
+			emit_block(s, s, n);
+			s += n;
+			src_size -= n;
+		}
+		return finish();
+	}
+
+private:
+	// compresses [src,src+src_size) with matches back to base into the next block
+	// of the frame, storing it as-is if that's smaller
+	void emit_block(const uint8_t* base, const uint8_t* src, size_t src_size)
+	{
+		const size_t room = size_t(oend_ - op_);
+		oCheck(room >= sizeof(uint32_t), std::errc::no_buffer_space, "");
+		const size_t limit = std::min(room - sizeof(uint32_t), src_size - 1);
+
+		size_t compressed_size = 0;
+		if (level_ <= fast_level)
+		{
+			if (has_dict_)
+				memcpy(table_, dict_table_, sizeof(table_));
+			else
+				memset(table_, 0, sizeof(table_));
+			compressed_size = compress_fast(op_ + sizeof(uint32_t), limit, base, src, src_size, table_);
+		}
+		else
+		{
+			if (!hc_)
+			{
+				hc_ = (hc_tables*)alloc_.allocate(sizeof(hc_tables), "lz4 hc tables");
+				oCheck(hc_, std::errc::not_enough_memory, "lz4 hc tables allocation failed");
+			}
+			compressed_size = compress_hc(op_ + sizeof(uint32_t), limit, base, src, src_size, level_, *hc_);
+		}
+
+		if (compressed_size)
+		{
+			write32(op_, uint32_t(compressed_size));
+			op_ += sizeof(uint32_t) + compressed_size;
+		}
+		else
+		{
+			oCheck(room - sizeof(uint32_t) >= src_size, std::errc::no_buffer_space, "");
+			write32(op_, uint32_t(src_size) | uncompressed_block_bit);
+			memcpy(op_ + sizeof(uint32_t), src, src_size);
+			op_ += sizeof(uint32_t) + src_size;
+		}
+	}
+
+	allocator alloc_;
+	int level_;
+	hc_tables* hc_;
+	codec_buffer work_; // dictionary then pending input
+	bool has_dict_;
+	size_t dict_size_;
+	uint32_t dict_id_;
+	uint8_t* dst_;
+	uint8_t* op_;
+	uint8_t* oend_;
+	uint64_t size_;
+	xxhash32_stream checksum_;
+	uint32_t table_[1 << fast_hash_log];
+	uint32_t dict_table_[1 << fast_hash_log];
+};
+
+// Decodes frames from any LZ4 implementation as they arrive. Blocks decode
+// where they are in the input and only pieces split across feeds are gathered.
+class decompressor_context : public decompressor::codec
+{
+public:
+	decompressor_context(const allocator& alloc)
+		: dict_(alloc, "lz4 dictionary")
+		, pending_(alloc, "lz4 decompressor")
+		, has_dict_(false)
+		, dict_id_(0)
+		, state_(state::magic)
+		, flg_(0)
+		, bd_(0)
+		, block_max_(0)
+		, block_size_(0)
+		, skip_size_(0)
+		, content_size_(0)
+		, stored_(false)
+		, obegin_(nullptr)
+		, op_(nullptr)
+		, oend_(nullptr)
+	{}
+
+	void set_dictionary(const void* dict, size_t dict_size) override
+	{
+		has_dict_ = !!dict_size;
+		dict_id_ = has_dict_ ? xxhash32(dict, dict_size) : 0;
+		const size_t keep = std::min(dict_size, size_t(max_distance));
+		dict_.clear();
+		dict_.append((const uint8_t*)dict + dict_size - keep, keep);
+	}
+
+	void begin(void* dst, size_t dst_size) override
+	{
+		obegin_ = op_ = (uint8_t*)dst;
+		oend_ = obegin_ + (dst ? dst_size : 0);
+		state_ = state::magic;
+		pending_.clear();
+		checksum_.reset();
+	}
+
+	void feed(const void* src, size_t src_size) override
+	{
+		const uint8_t* s = (const uint8_t*)src;
+		while (state_ != state::done)
+		{
+			if (state_ == state::skip)
+			{
+				const size_t n = std::min(skip_size_, src_size);
+				s += n;
+				src_size -= n;
+				skip_size_ -= n;
+				if (skip_size_)
+					break;
+				state_ = state::magic;
+				continue;
+			}
+
+			const uint8_t* p = take(s, src_size, needed());
+			if (!p)
+				break;
+			consume(p);
+			pending_.clear();
+		}
+	}
+
+	size_t finish() override
+	{
+		oCheck(state_ == state::done, std::errc::protocol_error, "truncated lz4 frame");
+		return size_t(op_ - obegin_);
+	}
+
+private:
+	enum class state { magic, skip_size, skip, descriptor, descriptor_rest, block_header, block, content_checksum, done };
+
+	size_t needed() const
+	{
+		switch (state_)
+		{
+			case state::descriptor: return 2;
+			case state::descriptor_rest: return ((flg_ & flg_content_size) ? 8 : 0) + ((flg_ & flg_dictionary_id) ? 4 : 0) + 1;
+			case state::block: return block_size_ + ((flg_ & flg_block_checksum) ? 4 : 0);
+			default: break;
+		}
+		return 4;
+	}
+
+	// returns size contiguous bytes from src if it has them and nothing is
+	// pending, otherwise gathers them and returns nullptr until there are enough
+	const uint8_t* take(const uint8_t*& src, size_t& src_size, size_t size)
+	{
+		if (pending_.empty() && src_size >= size)
+		{
+			const uint8_t* p = src;
+			src += size;
+			src_size -= size;
+			return p;
+		}
+
+		const size_t n = std::min(size - pending_.size(), src_size);
+		pending_.append(src, n);
+		src += n;
+		src_size -= n;
+		return pending_.size() == size ? pending_.data() : nullptr;
+	}
+
+	void consume(const uint8_t* p)
+	{
+		switch (state_)
+		{
+			case state::magic:
+			{
+				const uint32_t magic = read32(p);
+				if ((magic & skippable_magic_mask) == skippable_magic)
+					state_ = state::skip_size;
+				else
+				{
+					oCheck(magic == frame_magic, std::errc::protocol_error, "not an lz4 frame");
+					state_ = state::descriptor;
+				}
+				break;
+			}
+
+			case state::skip_size:
+				skip_size_ = read32(p);
+				state_ = state::skip;
+				break;
+
+			case state::descriptor:
+				flg_ = p[0];
+				bd_ = p[1];
+				oCheck((flg_ & flg_version_mask) == flg_version, std::errc::not_supported, "unsupported lz4 frame version");
+				block_max_ = size_t(1) << (2 * ((bd_ >> 4) & 7) + 8);
+				oCheck(block_max_ >= (64 << 10), std::errc::protocol_error, "invalid lz4 block max size");
+				state_ = state::descriptor_rest;
+				break;
+
+			case state::descriptor_rest:
+			{
+				uint8_t descriptor[2 + 8 + 4];
+				const size_t rest_size = needed() - 1;
+				descriptor[0] = flg_;
+				descriptor[1] = bd_;
+				memcpy(descriptor + 2, p, rest_size);
+				oCheck(p[rest_size] == header_checksum(descriptor, 2 + rest_size), std::errc::protocol_error, "lz4 frame header checksum mismatch");
+
+				if (flg_ & flg_content_size)
+				{
+					memcpy(&content_size_, p, sizeof(content_size_));
+					oCheck(content_size_ == size_t(content_size_), std::errc::file_too_large, "lz4 frame content is too large for this platform");
+					oCheck(content_size_ <= size_t(oend_ - obegin_), std::errc::no_buffer_space, "");
+				}
+
+				// the id is optional, so a dictionary is always available to frames without one
+				if (flg_ & flg_dictionary_id)
+				{
+					oCheck(has_dict_, std::errc::invalid_argument, "lz4 frame requires a dictionary");
+					oCheck(read32(p + rest_size - 4) == dict_id_, std::errc::invalid_argument, "lz4 frame was compressed with a different dictionary");
+				}
+
+				state_ = state::block_header;
+				break;
+			}
+
+			case state::block_header:
+			{
+				const uint32_t block_header = read32(p);
+				if (!block_header)
+				{
+					oCheck(!(flg_ & flg_content_size) || size_t(op_ - obegin_) == content_size_, std::errc::protocol_error, "lz4 frame content size mismatch");
+					state_ = (flg_ & flg_content_checksum) ? state::content_checksum : state::done;
+					break;
+				}
+
+				block_size_ = block_header & ~uncompressed_block_bit;
+				stored_ = !!(block_header & uncompressed_block_bit);
+				oCheck(block_size_ <= block_max_, std::errc::protocol_error, "invalid lz4 block size");
+				state_ = state::block;
+				break;
+			}
+
+			case state::block:
+			{
+				if (flg_ & flg_block_checksum)
+					oCheck(read32(p + block_size_) == xxhash32(p, block_size_), std::errc::protocol_error, "lz4 block checksum mismatch");
+
+				uint8_t* block = op_;
+				if (stored_)
+				{
+					oCheck(block_size_ <= size_t(oend_ - op_), std::errc::no_buffer_space, "");
+					memcpy(op_, p, block_size_);
+					op_ += block_size_;
+				}
+				else
+				{
+					const uint8_t* low = (flg_ & flg_block_independence) ? op_ : obegin_;
+					op_ = decode(op_, oend_, low, p, p + block_size_, dict_.data(), dict_.size());
+				}
+
+				if (flg_ & flg_content_checksum)
+					checksum_.update(block, size_t(op_ - block));
+
+				state_ = state::block_header;
+				break;
+			}
+
+			case state::content_checksum:
+				oCheck(read32(p) == checksum_.digest(), std::errc::protocol_error, "lz4 content checksum mismatch");
+				state_ = state::done;
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	codec_buffer dict_;
+	codec_buffer pending_;
+	bool has_dict_;
+	uint32_t dict_id_;
+	state state_;
+	uint8_t flg_;
+	uint8_t bd_;
+	size_t block_max_;
+	size_t block_size_;
+	size_t skip_size_;
+	uint64_t content_size_;
+	bool stored_;
+	uint8_t* obegin_;
+	uint8_t* op_;
+	uint8_t* oend_;
+	xxhash32_stream checksum_;
+};
+
+} // namespace lz4
 
 size_t compress_lz4(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size)
 {
-	oThrow(std::errc::invalid_argument, "not yet implemented");
+	return lz4::compress_frame(dst, dst_size, src, src_size);
+}
+
+size_t decompress_lz4(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size)
+{
+	return lz4::decompress_frame(dst, dst_size, src, src_size);
+}
+
+compressor::codec* new_lz4_compressor(const allocator& alloc, int level)
+{
+	return new_codec<lz4::compressor_context>(alloc, level, "lz4 compressor");
 }
 
-size_t decompress_lz4(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT in_src, size_t src_size)
+decompressor::codec* new_lz4_decompressor(const allocator& alloc)
 {
-	oThrow(std::errc::invalid_argument, "not yet implemented");
+	return new_codec<lz4::decompressor_context>(alloc, "lz4 decompressor");
 }
 
 }
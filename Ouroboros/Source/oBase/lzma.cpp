@@ -2,7 +2,11 @@
 
 #include <oCore/assert.h>
 #include <oBase/compression.h>
+#include <oBase/compressor.h>
+#include <Lzma/C/LzmaDec.h>
+#include <Lzma/C/LzmaEnc.h>
 #include <Lzma/C/LzmaLib.h>
+#include <algorithm>
 
 namespace ouro {
 
@@ -22,6 +26,7 @@ struct HDR
 {
 	size_t UncompressedSize;
 };
+#pragma pack()
 
 static size_t lzma_estimate_compressed_size(size_t src_size)
 {
@@ -63,7 +68,7 @@ size_t compress_lzma(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT
 		oCheck(!dst || dst_size >= EstSize, std::errc::no_buffer_space, "");
 
 		((HDR*)dst)->UncompressedSize = src_size;
-		CompressedSize = dst_size;
+		CompressedSize = dst_size - sizeof(HDR);
 		size_t outPropsSize = LZMA_PROPS_SIZE;
 		unsigned char outProps[LZMA_PROPS_SIZE];
 		int LZMAError = LzmaCompress(
@@ -82,6 +87,7 @@ size_t compress_lzma(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT
 			, LZMADEFAULT_numThreads);
 
 		oCheck(!LZMAError, std::errc::protocol_error, "compression failed: %s", as_string_lzma_error(LZMAError));
+		CompressedSize += sizeof(HDR);
 	}
 
 	else
@@ -92,11 +98,15 @@ size_t compress_lzma(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT
 
 size_t decompress_lzma(void* oRESTRICT dst, size_t dst_size, const void* oRESTRICT src, size_t src_size)
 {
+	oCheck(src_size >= sizeof(HDR), std::errc::protocol_error, "truncated lzma stream");
 	size_t UncompressedSize = ((const HDR*)src)->UncompressedSize;
-	oCheck(!dst || dst_size >= UncompressedSize, std::errc::no_buffer_space, "");
+	if (!dst)
+		return UncompressedSize;
+
+	oCheck(dst_size >= UncompressedSize, std::errc::no_buffer_space, "");
 
 	size_t destLen = dst_size;
-	size_t srcLen = src_size;
+	size_t srcLen = src_size - sizeof(HDR);
 	int LZMAError = LzmaUncompress(
 		static_cast<unsigned char*>(dst)
 		, &destLen
@@ -110,4 +120,193 @@ size_t decompress_lzma(void* oRESTRICT dst, size_t dst_size, const void* oRESTRI
 	return UncompressedSize;
 }
 
+// routes LZMA SDK allocations to an allocator
+struct lzma_alloc : ISzAlloc
+{
+	lzma_alloc(const allocator& alloc) : alloc_(alloc) { Alloc = allocate; Free = deallocate; }
+
+	static void* allocate(void* p, size_t size) { return static_cast<lzma_alloc*>((ISzAlloc*)p)->alloc_.allocate(size, "lzma"); }
+	static void deallocate(void* p, void* address) { if (address) static_cast<lzma_alloc*>((ISzAlloc*)p)->alloc_.deallocate(address); }
+
+	allocator alloc_;
+};
+
+// The encoder only compresses whole buffers, so streams are buffered until
+// finish(). It keeps its match finder between streams as long as the window
+// doesn't change size, and the window is fit to the content so small buffers
+// don't pay to set up for 16 MB. The decoder's fixed properties allow any
+// window up to that.
+class lzma_compressor : public compressor::codec
+{
+public:
+	lzma_compressor(const allocator& alloc, int level)
+		: alloc_(alloc)
+		, level_(level == default_compression_level ? LZMADEFAULT_level : level)
+		, dict_size_(0)
+		, dst_(nullptr)
+		, dst_size_(0)
+		, pending_(alloc, "lzma compressor")
+	{
+		oCheck(level_ >= 0 && level_ <= 9, std::errc::invalid_argument, "lzma levels are 0-9");
+		enc_ = LzmaEnc_Create(&alloc_);
+		oCheck(enc_, std::errc::not_enough_memory, "lzma encoder allocation failed");
+	}
+
+	~lzma_compressor() { LzmaEnc_Destroy(enc_, &alloc_, &alloc_); }
+
+	size_t max_compressed_size(size_t src_size) const override { return sizeof(HDR) + lzma_estimate_compressed_size(src_size); }
+
+	void set_dictionary(const void* dict, size_t dict_size) override
+	{
+		oCheck(!dict_size, std::errc::not_supported, "lzma does not support dictionaries");
+	}
+
+	void begin(void* dst, size_t dst_size) override
+	{
+		dst_ = dst;
+		dst_size_ = dst_size;
+		pending_.clear();
+	}
+
+	void feed(const void* src, size_t src_size) override
+	{
+		pending_.append(src, src_size);
+	}
+
+	size_t finish() override
+	{
+		return compress(dst_, dst_size_, pending_.data(), pending_.size());
+	}
+
+	size_t compress(void* dst, size_t dst_size, const void* src, size_t src_size) override
+	{
+		oCheck(dst_size >= sizeof(HDR), std::errc::no_buffer_space, "");
+
+		unsigned int dict_size = 1 << 12;
+		while (dict_size < src_size && dict_size < LZMADEFAULT_dictSize)
+			dict_size <<= 1;
+
+		if (dict_size != dict_size_)
+		{
+			CLzmaEncProps props;
+			LzmaEncProps_Init(&props);
+			props.level = level_;
+			props.dictSize = dict_size;
+			props.lc = LZMADEFAULT_lc;
+			props.lp = LZMADEFAULT_lp;
+			props.pb = LZMADEFAULT_pb;
+			props.fb = LZMADEFAULT_fb;
+			props.numThreads = LZMADEFAULT_numThreads;
+			int LZMAError = LzmaEnc_SetProps(enc_, &props);
+			oCheck(!LZMAError, std::errc::invalid_argument, "invalid lzma properties: %s", as_string_lzma_error(LZMAError));
+			dict_size_ = dict_size;
+		}
+
+		HDR h;
+		h.UncompressedSize = src_size;
+		memcpy(dst, &h, sizeof(h));
+
+		SizeT CompressedSize = dst_size - sizeof(HDR);
+		int LZMAError = LzmaEnc_MemEncode(enc_, (uint8_t*)dst + sizeof(HDR), &CompressedSize, static_cast<const unsigned char*>(src), src_size, 0, nullptr, &alloc_, &alloc_);
+		oCheck(LZMAError != SZ_ERROR_OUTPUT_EOF, std::errc::no_buffer_space, "");
+		oCheck(!LZMAError, std::errc::protocol_error, "compression failed: %s", as_string_lzma_error(LZMAError));
+
+		return sizeof(HDR) + CompressedSize;
+	}
+
+private:
+	lzma_alloc alloc_;
+	CLzmaEncHandle enc_;
+	int level_;
+	unsigned int dict_size_;
+	void* dst_;
+	size_t dst_size_;
+	codec_buffer pending_;
+};
+
+// Decodes as input arrives directly into dst, which the decoder uses as its
+// window.
+class lzma_decompressor : public decompressor::codec
+{
+public:
+	lzma_decompressor(const allocator& alloc)
+		: alloc_(alloc)
+		, header_size_(0)
+		, size_(0)
+	{
+		LzmaDec_Construct(&dec_);
+		int LZMAError = LzmaDec_AllocateProbs(&dec_, LZMADEFAULT_Props, LZMA_PROPS_SIZE, &alloc_);
+		oCheck(!LZMAError, std::errc::not_enough_memory, "lzma decoder allocation failed: %s", as_string_lzma_error(LZMAError));
+	}
+
+	~lzma_decompressor() { LzmaDec_FreeProbs(&dec_, &alloc_); }
+
+	void set_dictionary(const void* dict, size_t dict_size) override
+	{
+		oCheck(!dict_size, std::errc::not_supported, "lzma does not support dictionaries");
+	}
+
+	void begin(void* dst, size_t dst_size) override
+	{
+		dec_.dic = static_cast<Byte*>(dst);
+		dec_.dicBufSize = dst ? dst_size : 0;
+		LzmaDec_Init(&dec_);
+		header_size_ = 0;
+		size_ = 0;
+	}
+
+	void feed(const void* src, size_t src_size) override
+	{
+		const uint8_t* s = static_cast<const uint8_t*>(src);
+		if (header_size_ < sizeof(HDR))
+		{
+			const size_t n = std::min(sizeof(HDR) - header_size_, src_size);
+			memcpy(header_ + header_size_, s, n);
+			header_size_ += n;
+			s += n;
+			src_size -= n;
+			if (header_size_ < sizeof(HDR))
+				return;
+
+			size_ = ((const HDR*)header_)->UncompressedSize;
+			oCheck(size_ <= dec_.dicBufSize, std::errc::no_buffer_space, "");
+		}
+
+		while (src_size && dec_.dicPos < size_)
+		{
+			SizeT srcLen = src_size;
+			ELzmaStatus status;
+			int LZMAError = LzmaDec_DecodeToDic(&dec_, size_, s, &srcLen, LZMA_FINISH_ANY, &status);
+			oCheck(!LZMAError, std::errc::protocol_error, "decompression failed: %s", as_string_lzma_error(LZMAError));
+			if (!srcLen)
+				break;
+			s += srcLen;
+			src_size -= srcLen;
+		}
+	}
+
+	size_t finish() override
+	{
+		oCheck(header_size_ == sizeof(HDR) && dec_.dicPos == size_, std::errc::protocol_error, "truncated lzma stream");
+		return size_;
+	}
+
+private:
+	lzma_alloc alloc_;
+	CLzmaDec dec_;
+	uint8_t header_[sizeof(HDR)];
+	size_t header_size_;
+	size_t size_;
+};
+
+compressor::codec* new_lzma_compressor(const allocator& alloc, int level)
+{
+	return new_codec<lzma_compressor>(alloc, level, "lzma compressor");
+}
+
+decompressor::codec* new_lzma_decompressor(const allocator& alloc)
+{
+	return new_codec<lzma_decompressor>(alloc, "lzma decompressor");
+}
+
 }
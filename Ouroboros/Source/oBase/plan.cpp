@@ -139,29 +139,55 @@ void plan::initialize(void* memory, uint32_t bytes, uint32_t num_phases)
 	const uint32_t AllocBytes = bytes - PhaseTasklistsBytes;
 	memset(memory, 0, bytes);
 
-	allocator.initialize(memory, AllocBytes);
+	ring.initialize(memory, AllocBytes);
+	allocator = &ring;
 	phase_tasks = (flushed_tasklist*)((uint8_t*)memory + AllocBytes);
-	overflow = false;
+	begin();
+	end_marker = begin_marker;
+}
+
+void plan::initialize(void* memory, uint32_t bytes, uint32_t num_phases, concurrent_ring_allocator* shared_allocator)
+{
+	if (!aligned(memory, oCACHE_LINE_SIZE))
+		oThrow(std::errc::invalid_argument, "memory must be cacheline size aligned");
+
+	if (!shared_allocator)
+		oThrow(std::errc::invalid_argument, "a shared allocator must be specified");
+
+	memset(memory, 0, bytes);
+
+	allocator = shared_allocator;
+	phase_tasks = memory;
+	begin();
+	end_marker = begin_marker;
 }
 
 void* plan::deinitialize()
 {
+	if (!allocator)
+		return nullptr;
+
+	void* p = allocator == &ring ? ring.deinitialize() : phase_tasks;
+	allocator = nullptr;
 	phase_tasks = nullptr;
+	begin_marker = end_marker = 0;
 	overflow = false;
-	return allocator.deinitialize();
+	return p;
 }
 
 void* plan::allocate(uint32_t size, uint32_t align)
 {
-	void* p = allocator.allocate(size, align);
-	// if no memory, reset allocator and follow through on a non-null pointer so 
-	// calling code never receives a nullptr. Consolidation will abort early with
-	// an error code in such cases.
+	void* p = allocator->allocate(size, align);
+	// if no memory, discard this plan's allocations and follow through on a 
+	// non-null pointer so calling code never receives a nullptr. Consolidation
+	// will abort early with an error code in such cases. Only this plan's 
+	// allocations are discarded, so a plan sharing the allocator that is still
+	// executing is unaffected.
 	if (!p)
 	{
 		overflow = true;
-		allocator.reset();
-		p = allocator.allocate(size, align);
+		allocator->rewind(begin_marker);
+		p = allocator->allocate(size, align);
 	}
 
 	return p;
@@ -214,7 +240,7 @@ start:
 	}
 
 	// allocate space for all phase items
-	plan_task* tasks = (plan_task*)allocator.allocate(TotalBytes);
+	plan_task* tasks = (plan_task*)allocator->allocate(TotalBytes);
 	if (!tasks)
 	{
 		memset(phase_tasks, 0, PhaseTasklistsBytes);
@@ -244,6 +270,7 @@ start:
 		}
 	}
 
+	end_marker = allocator->marker();
 	master->reset();
 	return TotalNumItems;
 }
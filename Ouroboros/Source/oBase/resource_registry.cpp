@@ -120,10 +120,9 @@ void base_resource_registry::handle::release()
 base_resource_registry::size_type base_resource_registry::calc_size(size_type capacity)
 {
 	allocate_options opts(required_alignment);
-	const size_type lookup_bytes = opts.align(lookup_t::calc_size(capacity));
 	const size_type res_bytes    = opts.align(res_pool_t::calc_size(capacity));
 	const size_type queued_bytes = opts.align(queued_pool_t::calc_size(capacity));
-  return lookup_bytes + res_bytes + queued_bytes;
+  return res_bytes + queued_bytes;
 }
 
 base_resource_registry::size_type base_resource_registry::calc_capacity(size_type bytes)
@@ -192,17 +191,15 @@ void base_resource_registry::initialize_base(const char* registry_label, void* m
 
 	auto capacity = calc_capacity(bytes);
 
-	const size_type lookup_bytes = opts.align(lookup_t::calc_size(capacity));
 	const size_type res_bytes    = opts.align(res_pool_t::calc_size(capacity));
 	const size_type queued_bytes = opts.align(queued_pool_t::calc_size(capacity));
 
-	auto lookup_mem              = (uint8_t*)memory;
-	auto res_mem                 = lookup_mem + lookup_bytes;
+	auto res_mem                 = (uint8_t*)memory;
 	auto queued_mem              = res_mem    + res_bytes;
 	
-	lookup_     .initialize(res_pool_.nullidx, memory, capacity);
-	res_pool_   .initialize(res_mem, res_bytes);
-	queued_pool_.initialize(queued_mem, queued_bytes);
+	lookup_     .initialize(res_pool_.nullidx, capacity, "resource_registry lookup", io_alloc);
+	res_pool_   .initialize(res_mem, res_bytes, "resource_registry resources", io_alloc);
+	queued_pool_.initialize(queued_mem, queued_bytes, "resource_registry queue", io_alloc);
 
 	error_placeholder_           = create_resource("error_placeholder", error_placeholder);
 	io_alloc_                    = io_alloc;
@@ -227,8 +224,8 @@ void* base_resource_registry::deinitialize_base()
 		io_alloc_          = allocator();
 
 		queued_pool_.deinitialize();
-		res_pool_.deinitialize();
-		p = lookup_.deinitialize();
+		p = res_pool_.deinitialize();
+		lookup_.deinitialize();
 
 		label_.clear();
 	}
@@ -268,7 +265,7 @@ bool base_resource_registry::insert_or_resolve(const key_type& key, void* placeh
 		// create a new entry
 		index = res_pool_.allocate_index();
 		if (index == res_pool_.nullidx)
-			throw std::invalid_argument("out of slots");
+			oThrow(std::errc::no_buffer_space, "[%s] out of resource slots", label_.c_str());
 
 		// initialize the entry
 		out_handle  = res_pool_.typed_pointer(index);
@@ -395,7 +392,7 @@ void base_resource_registry::queue_create(const uri_t& uri_ref, blob& compiled,
 		creates_.push(q);
 	}
 	else
-		oTrace("queue overflow: ignoring %s", uri_ref.c_str());
+		oThrow(std::errc::no_buffer_space, "[%s] create queue overflow: dropping %s", label_.c_str(), uri_ref.c_str());
 }
 
 void base_resource_registry::queue_destroy(void* resource)
@@ -407,7 +404,7 @@ void base_resource_registry::queue_destroy(void* resource)
 		destroys_.push(q);
 	}
 	else
-		oTrace("queue overflow: leaking resource %p", resource);
+		oThrow(std::errc::no_buffer_space, "[%s] destroy queue overflow: leaking resource %p", label_.c_str(), resource);
 }
 
 void base_resource_registry::destroy_indexed()
@@ -463,7 +460,8 @@ base_resource_registry::size_type base_resource_registry::flush(size_type max_op
 	// reclaim keys, nothing about this is concurrent
 	// if there are any modifications during this period, this all breaks down
 	// so although there is optimism in the above operations, overall flush is
-	// non-concurrent because of this.
+	// non-concurrent because of this. This also compacts out erased keys and
+	// frees lookup tables retired by growth.
 
 	struct this_ctx
 	{
@@ -2,6 +2,7 @@
 
 #include <oCore/assert.h>
 #include <oBase/compression.h>
+#include <oBase/compressor.h>
 #include <snappy/snappy.h>
 
 namespace ouro {
@@ -26,4 +27,102 @@ size_t decompress_snappy(void* oRESTRICT dst, size_t dst_size, const void* oREST
 	return UncompressedSize;
 }
 
+// snappy only compresses whole buffers, so streams are buffered until finish()
+// and whole buffers passed to compress() and decompress() are not copied.
+
+class snappy_compressor : public compressor::codec
+{
+public:
+	snappy_compressor(const allocator& alloc) : dst_(nullptr), dst_size_(0), pending_(alloc, "snappy compressor") {}
+
+	size_t max_compressed_size(size_t src_size) const override { return snappy::MaxCompressedLength(src_size); }
+
+	void set_dictionary(const void* dict, size_t dict_size) override
+	{
+		oCheck(!dict_size, std::errc::not_supported, "snappy does not support dictionaries");
+	}
+
+	void begin(void* dst, size_t dst_size) override
+	{
+		dst_ = dst;
+		dst_size_ = dst_size;
+		pending_.clear();
+	}
+
+	void feed(const void* src, size_t src_size) override
+	{
+		pending_.append(src, src_size);
+	}
+
+	size_t finish() override
+	{
+		return compress(dst_, dst_size_, pending_.data(), pending_.size());
+	}
+
+	size_t compress(void* dst, size_t dst_size, const void* src, size_t src_size) override
+	{
+		size_t CompressedSize = snappy::MaxCompressedLength(src_size);
+		oCheck(dst_size >= CompressedSize, std::errc::no_buffer_space, "");
+		snappy::RawCompress(static_cast<const char*>(src), src_size, static_cast<char*>(dst), &CompressedSize);
+		return CompressedSize;
+	}
+
+private:
+	void* dst_;
+	size_t dst_size_;
+	codec_buffer pending_;
+};
+
+class snappy_decompressor : public decompressor::codec
+{
+public:
+	snappy_decompressor(const allocator& alloc) : dst_(nullptr), dst_size_(0), pending_(alloc, "snappy decompressor") {}
+
+	void set_dictionary(const void* dict, size_t dict_size) override
+	{
+		oCheck(!dict_size, std::errc::not_supported, "snappy does not support dictionaries");
+	}
+
+	void begin(void* dst, size_t dst_size) override
+	{
+		dst_ = dst;
+		dst_size_ = dst_size;
+		pending_.clear();
+	}
+
+	void feed(const void* src, size_t src_size) override
+	{
+		pending_.append(src, src_size);
+	}
+
+	size_t finish() override
+	{
+		return decompress(dst_, dst_size_, pending_.data(), pending_.size());
+	}
+
+	size_t decompress(void* dst, size_t dst_size, const void* src, size_t src_size) override
+	{
+		size_t UncompressedSize = 0;
+		oCheck(snappy::GetUncompressedLength(static_cast<const char*>(src), src_size, &UncompressedSize), std::errc::protocol_error, "not a valid snappy stream");
+		oCheck(dst_size >= UncompressedSize, std::errc::no_buffer_space, "");
+		oCheck(snappy::RawUncompress(static_cast<const char*>(src), src_size, static_cast<char*>(dst)), std::errc::protocol_error, "snappy decompression failed");
+		return UncompressedSize;
+	}
+
+private:
+	void* dst_;
+	size_t dst_size_;
+	codec_buffer pending_;
+};
+
+compressor::codec* new_snappy_compressor(const allocator& alloc, int level)
+{
+	return new_codec<snappy_compressor>(alloc, "snappy compressor");
+}
+
+decompressor::codec* new_snappy_decompressor(const allocator& alloc)
+{
+	return new_codec<snappy_decompressor>(alloc, "snappy decompressor");
+}
+
 }
@@ -0,0 +1,144 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+#include <oBase/unit_test.h>
+
+#include <oBase/chunked_compression.h>
+#include <algorithm>
+#include <vector>
+
+using namespace ouro;
+
+static const uint32_t kBlockSize = 64 * 1024;
+
+static std::vector<uint8_t> compress_all(const compression& type, const void* src, size_t src_size, uint32_t block_size = kBlockSize)
+{
+	std::vector<uint8_t> compressed(compress_chunked(type, nullptr, 0, src, src_size, block_size));
+	compressed.resize(compress_chunked(type, compressed.data(), compressed.size(), src, src_size, block_size));
+	return compressed;
+}
+
+static void test_roundtrip(unit_test::services& srv, const compression& type, const blob& src)
+{
+	auto compressed = compress_all(type, src, src.size());
+
+	const chunked_info info = get_chunked_info(compressed.data(), compressed.size());
+	oCHECK(info.type == type && info.block_size == kBlockSize, "wrong chunked info");
+	oCHECK(info.uncompressed_size == src.size(), "wrong chunked content size");
+	oCHECK(info.num_blocks == (src.size() + kBlockSize - 1) / kBlockSize, "wrong number of chunked blocks");
+
+	std::vector<uint8_t> uncompressed(decompress_chunked(nullptr, 0, compressed.data(), compressed.size()));
+	oCHECK(uncompressed.size() == src.size(), "loaded and uncompressed sizes don't match");
+	decompress_chunked(uncompressed.data(), uncompressed.size(), compressed.data(), compressed.size());
+	oCHECK(!memcmp(src, uncompressed.data(), src.size()), "chunked roundtrip failed");
+
+	// ranges within a block, across blocks, at the ends and everything
+	const uint64_t ranges[][2] =
+	{
+		{ 0, 1 },
+		{ 100, 200 },
+		{ kBlockSize - 10, 20 },
+		{ kBlockSize, kBlockSize },
+		{ kBlockSize / 2, 5 * kBlockSize },
+		{ src.size() - 1, 1 },
+		{ 0, src.size() },
+		{ 12345, 0 },
+	};
+
+	for (const auto& r : ranges)
+	{
+		std::vector<uint8_t> part(size_t(r[1]) + 1, 0xcd);
+		decompress_chunked_range(part.data(), r[0], size_t(r[1]), compressed.data(), compressed.size());
+		oCHECK(!memcmp((const uint8_t*)src + r[0], part.data(), size_t(r[1])), "range [%u,%u) is wrong", uint32_t(r[0]), uint32_t(r[0] + r[1]));
+		oCHECK(part.back() == 0xcd, "range [%u,%u) wrote past its end", uint32_t(r[0]), uint32_t(r[0] + r[1]));
+	}
+}
+
+static void test_streams(unit_test::services& srv, const blob& src)
+{
+	auto expected = compress_all(compression::lz4, src, src.size());
+
+	// feeding pieces of any size produces the same container as all at once
+	std::vector<uint8_t> compressed;
+	chunked_compress_stream cs(compression::lz4, [&](const void* data, size_t size)
+	{
+		compressed.insert(compressed.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+	}, kBlockSize, 3);
+
+	const uint8_t* s = src;
+	for (size_t offset = 0; offset < src.size();)
+	{
+		const size_t n = std::min(src.size() - offset, size_t(srv.rand() % (2 * kBlockSize)));
+		cs.write(s + offset, n);
+		offset += n;
+	}
+	cs.finish();
+
+	oCHECK(compressed == expected, "streamed container doesn't match");
+	oCHECK(cs.uncompressed_size() == src.size() && cs.compressed_size() == compressed.size(), "wrong streamed sizes");
+
+	std::vector<uint8_t> uncompressed;
+	chunked_decompress_stream ds([&](const void* data, size_t size)
+	{
+		uncompressed.insert(uncompressed.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+	}, 2);
+
+	for (size_t offset = 0; offset < compressed.size();)
+	{
+		const size_t n = std::min(compressed.size() - offset, size_t(1 + srv.rand() % 5000));
+		ds.write(compressed.data() + offset, n);
+		offset += n;
+	}
+	ds.finish();
+
+	oCHECK(uncompressed.size() == src.size() && !memcmp(src, uncompressed.data(), src.size()), "streamed roundtrip failed");
+
+	// a stream that stops early is an error
+	chunked_decompress_stream truncated([&](const void* data, size_t size) {}, 2);
+	truncated.write(compressed.data(), compressed.size() - 1);
+	bool threw = false;
+	try { truncated.finish(); }
+	catch (std::system_error&) { threw = true; }
+	oCHECK(threw, "a truncated chunked stream should throw");
+}
+
+static void test_edge_cases(unit_test::services& srv)
+{
+	// no content is still a valid container
+	auto empty = compress_all(compression::lz4, nullptr, 0);
+	oCHECK(decompress_chunked(nullptr, 0, empty.data(), empty.size()) == 0, "empty container should have no content");
+	oCHECK(get_chunked_info(empty.data(), empty.size()).num_blocks == 0, "empty container should have no blocks");
+
+	// incompressible blocks are stored and never grow past the bound
+	std::vector<uint8_t> noise(300 * 1000);
+	for (auto& b : noise)
+		b = uint8_t(srv.rand());
+
+	auto stored = compress_all(compression::lz4, noise.data(), noise.size());
+	oCHECK(stored.size() <= compress_chunked(compression::lz4, nullptr, 0, noise.data(), noise.size(), kBlockSize), "stored container exceeds its bound");
+
+	std::vector<uint8_t> uncompressed(noise.size());
+	decompress_chunked(uncompressed.data(), uncompressed.size(), stored.data(), stored.size());
+	oCHECK(uncompressed == noise, "stored roundtrip failed");
+
+	auto none = compress_all(compression::none, noise.data(), noise.size());
+	decompress_chunked(uncompressed.data(), uncompressed.size(), none.data(), none.size());
+	oCHECK(uncompressed == noise, "uncompressed roundtrip failed");
+
+	// a bad footer is caught before any decompression
+	stored.back() ^= 1;
+	bool threw = false;
+	try { decompress_chunked(uncompressed.data(), uncompressed.size(), stored.data(), stored.size()); }
+	catch (std::system_error&) { threw = true; }
+	oCHECK(threw, "a corrupt chunked footer should throw");
+}
+
+oTEST(oBase_chunked_compression)
+{
+	blob src = srv.load_buffer("Test/Geometry/buddha.obj");
+
+	test_roundtrip(srv, compression::lz4, src);
+	test_roundtrip(srv, compression::gzip, src);
+	test_roundtrip(srv, compression::snappy, src);
+	test_streams(srv, src);
+	test_edge_cases(srv);
+}
@@ -2,10 +2,13 @@
 
 #include <oBase/unit_test.h>
 
+#include <oCore/countof.h>
 #include <oCore/finally.h>
 #include <oBase/compression.h>
+#include <oBase/lz4.h>
 #include <oString/path.h>
 #include <oCore/timer.h>
+#include <vector>
 
 using namespace ouro;
 
@@ -34,8 +37,8 @@ oTEST(oBase_compression)
 
 	blob OBJBuffer = srv.load_buffer(TestPath);
 
-	double timeSnappy, timeLZMA, timeGZip;
-	size_t CompressedSize0, CompressedSize1, CompressedSize2;
+	double timeSnappy, timeLZMA, timeGZip, timeLZ4;
+	size_t CompressedSize0, CompressedSize1, CompressedSize2, CompressedSize3;
 
 	timer t;
 	TestCompress(OBJBuffer, OBJBuffer.size(), compression::snappy, &CompressedSize0);
@@ -47,18 +50,23 @@ oTEST(oBase_compression)
 	TestCompress(OBJBuffer, OBJBuffer.size(), compression::gzip, &CompressedSize2);
 	timeGZip = t.seconds();
 	t.reset();
+	TestCompress(OBJBuffer, OBJBuffer.size(), compression::lz4, &CompressedSize3);
+	timeLZ4 = t.seconds();
+	t.reset();
 
-	sstring strUncompressed, strSnappy, strLZMA, strGZip, strSnappyTime, strLZMATime, strGZipTime;
+	sstring strUncompressed, strSnappy, strLZMA, strGZip, strLZ4, strSnappyTime, strLZMATime, strGZipTime, strLZ4Time;
 	format_bytes(strUncompressed, OBJBuffer.size(), 2);
 	format_bytes(strSnappy, CompressedSize0, 2);
 	format_bytes(strLZMA, CompressedSize1, 2);
 	format_bytes(strGZip, CompressedSize2, 2);
+	format_bytes(strLZ4, CompressedSize3, 2);
 	
 	format_duration(strSnappyTime, timeSnappy, true);
 	format_duration(strLZMATime, timeLZMA, true);
 	format_duration(strGZipTime, timeGZip, true);
+	format_duration(strLZ4Time, timeLZ4, true);
 
-	srv.status("Compressed %s from %s to Snappy: %s in %s, LZMA: %s in %s, GZip: %s in %s"
+	srv.status("Compressed %s from %s to Snappy: %s in %s, LZMA: %s in %s, GZip: %s in %s, LZ4: %s in %s"
 		, TestPath
 		, strUncompressed.c_str()
 		, strSnappy.c_str()
@@ -66,5 +74,194 @@ oTEST(oBase_compression)
 		, strLZMA.c_str()
 		, strLZMATime.c_str()
 		, strGZip.c_str()
-		, strGZipTime.c_str());
+		, strGZipTime.c_str()
+		, strLZ4.c_str()
+		, strLZ4Time.c_str());
+}
+
+static bool lz4_roundtrips(const void* src, size_t src_size, int level)
+{
+	std::vector<uint8_t> compressed(lz4::compress_frame(nullptr, 0, src, src_size));
+	compressed.resize(lz4::compress_frame(compressed.data(), compressed.size(), src, src_size, level));
+
+	if (lz4::decompress_frame(nullptr, 0, compressed.data(), compressed.size()) != src_size)
+		return false;
+
+	std::vector<uint8_t> uncompressed(src_size + 1);
+	if (lz4::decompress_frame(uncompressed.data(), uncompressed.size(), compressed.data(), compressed.size()) != src_size)
+		return false;
+	return !src_size || !memcmp(src, uncompressed.data(), src_size);
+}
+
+static bool lz4_throws(const void* src, size_t src_size)
+{
+	uint8_t dst[4096];
+	try { lz4::decompress_frame(dst, sizeof(dst), src, src_size); }
+	catch (std::system_error&) { return true; }
+	return false;
+}
+
+oTEST(oBase_compression_lz4)
+{
+	std::vector<uint8_t> buf(300 * 1024);
+
+	oCHECK(lz4_roundtrips(nullptr, 0, lz4::fast_level), "empty lz4 roundtrip failed");
+	oCHECK(lz4_roundtrips("lz4", 3, lz4::fast_level), "tiny lz4 roundtrip failed");
+
+	// incompressible data is stored
+	for (auto& b : buf)
+		b = uint8_t(srv.rand());
+	oCHECK(lz4_roundtrips(buf.data(), buf.size(), lz4::fast_level), "random lz4 roundtrip failed");
+	oCHECK(lz4_roundtrips(buf.data(), buf.size(), lz4::default_hc_level), "random lz4 hc roundtrip failed");
+
+	// matches that overlap their own output
+	for (int period : { 1, 2, 3, 7, 8, 15, 16, 17, 1000 })
+	{
+		for (size_t i = 0; i < buf.size(); i++)
+			buf[i] = uint8_t((i % period) * 37);
+
+		for (int level = lz4::fast_level; level <= lz4::max_level; level += 3)
+			oCHECK(lz4_roundtrips(buf.data(), buf.size(), level), "lz4 level %d roundtrip with period %d failed", level, period);
+	}
+
+	// hc should beat fast on text
+	blob text = srv.load_buffer("Test/Geometry/buddha.obj");
+	std::vector<uint8_t> compressed(lz4::compress_frame(nullptr, 0, text, text.size()));
+	const size_t fast_actual = lz4::compress_frame(compressed.data(), compressed.size(), text, text.size(), lz4::fast_level);
+	const size_t hc_actual = lz4::compress_frame(compressed.data(), compressed.size(), text, text.size(), lz4::default_hc_level);
+	oCHECK(hc_actual < fast_actual, "lz4 hc (%u bytes) should be smaller than fast (%u bytes)", uint32_t(hc_actual), uint32_t(fast_actual));
+
+	// a raw block with the size recorded by the caller
+	std::vector<uint8_t> block(lz4::compress_block_bound(text.size()));
+	block.resize(lz4::compress_block(block.data(), block.size(), text, text.size()));
+	std::vector<uint8_t> uncompressed(text.size());
+	oCHECK(lz4::decompress_block(uncompressed.data(), uncompressed.size(), block.data(), block.size()) == text.size(), "lz4 block size mismatch");
+	oCHECK(!memcmp(text, uncompressed.data(), text.size()), "lz4 block roundtrip failed");
+
+	// corruption is caught by bounds or checksums
+	const char* msg = "the quick brown fox jumps over the lazy dog, the quick brown fox jumps over the lazy dog";
+	compressed.resize(lz4::compress_frame(nullptr, 0, msg, strlen(msg)));
+	compressed.resize(lz4::compress_frame(compressed.data(), compressed.size(), msg, strlen(msg)));
+
+	oCHECK(lz4_throws(compressed.data(), compressed.size() - 1), "truncated lz4 frame should throw");
+
+	std::vector<uint8_t> corrupt(compressed);
+	corrupt[5] ^= 0x10;
+	oCHECK(lz4_throws(corrupt.data(), corrupt.size()), "lz4 header corruption should throw");
+
+	corrupt = compressed;
+	corrupt[corrupt.size() - 1] ^= 1;
+	oCHECK(lz4_throws(corrupt.data(), corrupt.size()), "lz4 content checksum mismatch should throw");
+
+	corrupt = compressed;
+	corrupt[22] ^= 0x20;
+	oCHECK(lz4_throws(corrupt.data(), corrupt.size()), "lz4 literal corruption should throw");
+
+	uint8_t small[8];
+	bool threw = false;
+	try { lz4::decompress_frame(small, sizeof(small), compressed.data(), compressed.size()); }
+	catch (std::system_error&) { threw = true; }
+	oCHECK(threw, "lz4 decompress into too small a buffer should throw");
+}
+
+// frames written by the reference lz4 command line tool (lz4 v1.9.4):
+//   bunny.obj.lz4:        lz4 bunny.obj (one independent 4 MB block, no content size)
+//   bunny_linked.obj.lz4: lz4 -9 -B4 -BD -BX --content-size bunny.obj (linked 64 KB 
+//                         blocks with block checksums and the content size)
+oTEST(oBase_compression_lz4_interop)
+{
+	static const char* kFrames[] = 
+	{
+		"Test/Compression/bunny.obj.lz4",
+		"Test/Compression/bunny_linked.obj.lz4",
+	};
+
+	blob source = srv.load_buffer("Test/Geometry/bunny.obj");
+
+	for (const char* path : kFrames)
+	{
+		blob frame = srv.load_buffer(path);
+		const size_t size = lz4::decompress_frame(nullptr, 0, frame, frame.size());
+		oCHECK(size == source.size(), "%s: expected %u bytes, got %u", path, uint32_t(source.size()), uint32_t(size));
+
+		std::vector<uint8_t> uncompressed(size);
+		oCHECK(lz4::decompress_frame(uncompressed.data(), uncompressed.size(), frame, frame.size()) == size, "%s: decompressed size mismatch", path);
+		oCHECK(!memcmp(source, uncompressed.data(), size), "%s does not match its source", path);
+	}
+}
+
+oBENCHMARK(oBase_compression_benchmark)
+{
+	// text geometry, uncompressed and block-compressed textures and some that are
+	// already compressed
+	static const char* kCorpus[] = 
+	{
+		"Test/Geometry/buddha.obj",
+		"Test/Geometry/hunter.obj",
+		"Test/Geometry/hunter_textures/Map__57_Normal_Bump.tga",
+		"Test/Geometry/hunter_textures/34da927a.dds",
+		"Test/Textures/lena_1.bmp",
+		"Test/Textures/lena_1.psd",
+		"Test/Textures/lena_layout_below.png",
+	};
+
+	struct codec_t
+	{
+		const char* name;
+		compression type;
+		int lz4_level;
+	};
+
+	static const codec_t kCodecs[] = 
+	{
+		{ "gzip", compression::gzip, 0 },
+		{ "lzma", compression::lzma, 0 },
+		{ "snappy", compression::snappy, 0 },
+		{ "lz4", compression::lz4, lz4::fast_level },
+		{ "lz4 hc", compression::lz4, lz4::default_hc_level },
+	};
+
+	static const uint32_t nruns = 3;
+
+	std::vector<blob> corpus;
+	size_t total_size = 0;
+	for (const char* path : kCorpus)
+	{
+		corpus.push_back(srv.load_buffer(path));
+		total_size += corpus.back().size();
+	}
+
+	const double total_mb = total_size / (1024.0 * 1024.0);
+
+	for (const auto& codec : kCodecs)
+	{
+		auto compress_codec = [&](void* dst, size_t dst_size, const void* src, size_t src_size)
+		{
+			return codec.type == compression::lz4 
+				? lz4::compress_frame(dst, dst_size, src, src_size, codec.lz4_level)
+				: compress(codec.type, dst, dst_size, src, src_size);
+		};
+
+		double compress_seconds = 0.0, decompress_seconds = 0.0;
+		size_t total_compressed = 0;
+		for (const auto& file : corpus)
+		{
+			std::vector<uint8_t> compressed(compress_codec(nullptr, 0, file, file.size()));
+			std::vector<uint8_t> uncompressed(file.size());
+
+			size_t compressed_size = 0;
+			const double best_compress = srv.best_seconds(nruns, [&] { compressed_size = compress_codec(compressed.data(), compressed.size(), file, file.size()); });
+			const double best_decompress = srv.best_seconds(nruns, [&] { decompress(codec.type, uncompressed.data(), uncompressed.size(), compressed.data(), compressed_size); });
+
+			oCHECK(!memcmp(file, uncompressed.data(), file.size()), "%s roundtrip failed", codec.name);
+			compress_seconds += best_compress;
+			decompress_seconds += best_decompress;
+			total_compressed += compressed_size;
+		}
+
+		srv.trace("%-6s ratio %.3f compress %7.1f MB/s decompress %7.1f MB/s"
+			, codec.name, total_compressed / double(total_size), total_mb / compress_seconds, total_mb / decompress_seconds);
+	}
+
+	srv.status("compared codecs over %.1f MB in %u files (see trace)", total_mb, uint32_t(countof(kCorpus)));
 }
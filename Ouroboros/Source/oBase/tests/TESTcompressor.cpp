@@ -0,0 +1,233 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+#include <oBase/unit_test.h>
+
+#include <oBase/compressor.h>
+#include <oBase/lz4.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+using namespace ouro;
+
+static std::atomic<int> s_num_allocations;
+static std::atomic<int> s_num_outstanding;
+
+static void* counting_allocate(size_t bytes, const char* label, const allocate_options& options)
+{
+	s_num_allocations++;
+	s_num_outstanding++;
+	return default_allocate(bytes, label, options);
+}
+
+static void counting_deallocate(void* pointer)
+{
+	s_num_outstanding--;
+	default_deallocate(pointer);
+}
+
+static const allocator counting_allocator(counting_allocate, counting_deallocate);
+
+static const char* as_string(const compression& type)
+{
+	static const char* s_names[] = { "none", "gzip", "lz4", "lzma", "snappy" };
+	return s_names[(int)type];
+}
+
+// feeds src in random pieces, some empty
+static void feed_pieces(unit_test::services& srv, const uint8_t* src, size_t src_size, size_t max_piece, const std::function<void(const void*, size_t)>& feed)
+{
+	for (size_t offset = 0; offset < src_size;)
+	{
+		const size_t n = std::min(src_size - offset, size_t(srv.rand()) % max_piece);
+		feed(src + offset, n);
+		offset += n;
+	}
+}
+
+static void test_roundtrip(unit_test::services& srv, const compression& type, const uint8_t* src, size_t src_size, int level = default_compression_level)
+{
+	compressor c(type, counting_allocator, level);
+	std::vector<uint8_t> compressed(c.max_compressed_size(src_size));
+
+	c.begin(compressed.data(), compressed.size());
+	feed_pieces(srv, src, src_size, 300 * 1024, [&](const void* data, size_t size) { c.feed(data, size); });
+	compressed.resize(c.finish());
+
+	// whatever compress() makes decompress() reads and vice versa
+	std::vector<uint8_t> uncompressed(src_size);
+	oCHECK(decompress(type, uncompressed.data(), uncompressed.size(), compressed.data(), compressed.size()) == src_size, "%s: wrong decompressed size", as_string(type));
+	oCHECK(!memcmp(src, uncompressed.data(), src_size), "%s: streamed compression doesn't decompress", as_string(type));
+
+	decompressor d(type, counting_allocator);
+	memset(uncompressed.data(), 0, src_size);
+	d.begin(uncompressed.data(), uncompressed.size());
+	feed_pieces(srv, compressed.data(), compressed.size(), 64 * 1024, [&](const void* data, size_t size) { d.feed(data, size); });
+	oCHECK(d.finish() == src_size, "%s: wrong streamed decompressed size", as_string(type));
+	oCHECK(!memcmp(src, uncompressed.data(), src_size), "%s: streamed roundtrip failed", as_string(type));
+
+	if (level == default_compression_level)
+	{
+		std::vector<uint8_t> expected(compress(type, nullptr, 0, src, src_size));
+		expected.resize(compress(type, expected.data(), expected.size(), src, src_size));
+		memset(uncompressed.data(), 0, src_size);
+		oCHECK(d.decompress(uncompressed.data(), uncompressed.size(), expected.data(), expected.size()) == src_size, "%s: wrong decompressed size", as_string(type));
+		oCHECK(!memcmp(src, uncompressed.data(), src_size), "%s: decompressor can't read compress()", as_string(type));
+
+		// lz4 streams are the same frames regardless of how they're fed
+		if (type == compression::lz4)
+			oCHECK(compressed == expected, "lz4 streams differ from compress()");
+	}
+
+	// a stream that stops early is an error
+	d.begin(uncompressed.data(), uncompressed.size());
+	d.feed(compressed.data(), compressed.size() / 2);
+	bool threw = false;
+	try { d.finish(); }
+	catch (std::system_error&) { threw = true; }
+	oCHECK(threw, "%s: a truncated stream should throw", as_string(type));
+
+	// as is output that doesn't fit
+	c.begin(compressed.data(), compressed.size() / 4);
+	threw = false;
+	try { c.feed(src, src_size); c.finish(); }
+	catch (std::system_error& e) { threw = e.code() == std::errc::no_buffer_space; }
+	oCHECK(threw, "%s: compressing into too small a buffer should throw no_buffer_space", as_string(type));
+}
+
+// log lines like those a log or telemetry writer compresses one at a time
+static std::vector<std::vector<uint8_t>> make_messages(unit_test::services& srv, size_t num_messages)
+{
+	static const char* s_events[] = { "entity moved", "asset streamed in", "asset evicted", "frame presented", "input received" };
+
+	std::vector<std::vector<uint8_t>> messages(num_messages);
+	for (auto& m : messages)
+	{
+		char line[1024];
+		int len = 0;
+		for (int i = 0, n = 1 + srv.rand() % 8; i < n; i++)
+			len += snprintf(line + len, sizeof(line) - len, "[%08u] %s: id=%u pos=(%d, %d, %d)\n", srv.rand(), s_events[srv.rand() % 5], srv.rand() % 1000, srv.rand() % 100, srv.rand() % 100, srv.rand() % 100);
+		m.assign(line, line + len);
+	}
+
+	return messages;
+}
+
+static void test_reuse(unit_test::services& srv, const compression& type, const std::vector<std::vector<uint8_t>>& messages)
+{
+	compressor c(type, counting_allocator);
+	decompressor d(type, counting_allocator);
+
+	std::vector<uint8_t> compressed(c.max_compressed_size(1024));
+	std::vector<uint8_t> uncompressed(1024);
+
+	int num_allocations = 0;
+	for (size_t i = 0; i < messages.size(); i++)
+	{
+		// after the largest message, contexts need nothing more from the allocator
+		if (i == 1)
+			num_allocations = s_num_allocations;
+
+		const auto& m = messages[i];
+		const size_t compressed_size = c.compress(compressed.data(), compressed.size(), m.data(), m.size());
+		oCHECK(compressed_size <= c.max_compressed_size(m.size()), "%s: exceeded max_compressed_size", as_string(type));
+		const size_t uncompressed_size = d.decompress(uncompressed.data(), uncompressed.size(), compressed.data(), compressed_size);
+		oCHECK(uncompressed_size == m.size() && !memcmp(m.data(), uncompressed.data(), m.size()), "%s: message %u roundtrip failed", as_string(type), uint32_t(i));
+	}
+
+	oCHECK(s_num_allocations == num_allocations, "%s: reused contexts allocated %d times", as_string(type), s_num_allocations - num_allocations);
+}
+
+static void test_dictionaries(unit_test::services& srv, const compression& type, const std::vector<std::vector<uint8_t>>& messages)
+{
+	// prime with earlier messages so later ones match against them
+	std::vector<uint8_t> dict;
+	for (size_t i = 0; i < 200; i++)
+		dict.insert(dict.end(), messages[i].begin(), messages[i].end());
+
+	compressor plain(type, counting_allocator);
+	compressor primed(type, counting_allocator);
+	primed.set_dictionary(dict.data(), dict.size());
+
+	decompressor d(type, counting_allocator);
+	d.set_dictionary(dict.data(), dict.size());
+
+	std::vector<uint8_t> compressed(primed.max_compressed_size(1024));
+	std::vector<uint8_t> uncompressed(1024);
+
+	size_t plain_size = 0, primed_size = 0;
+	for (size_t i = 200; i < messages.size(); i++)
+	{
+		const auto& m = messages[i];
+		plain_size += plain.compress(compressed.data(), compressed.size(), m.data(), m.size());
+		const size_t compressed_size = primed.compress(compressed.data(), compressed.size(), m.data(), m.size());
+		primed_size += compressed_size;
+
+		d.begin(uncompressed.data(), uncompressed.size());
+		feed_pieces(srv, compressed.data(), compressed_size, 16, [&](const void* data, size_t size) { d.feed(data, size); });
+		oCHECK(d.finish() == m.size() && !memcmp(m.data(), uncompressed.data(), m.size()), "%s: message %u dictionary roundtrip failed", as_string(type), uint32_t(i));
+	}
+
+	srv.trace("%s: %u messages are %u bytes, %u bytes with a dictionary", as_string(type), uint32_t(messages.size() - 200), uint32_t(plain_size), uint32_t(primed_size));
+	oCHECK(primed_size < plain_size, "%s: a dictionary of similar messages should help", as_string(type));
+
+	// a dictionary is required to read what it primed
+	const auto& m = messages.back();
+	const size_t compressed_size = primed.compress(compressed.data(), compressed.size(), m.data(), m.size());
+	decompressor none(type, counting_allocator);
+	bool threw = false;
+	try { none.decompress(uncompressed.data(), uncompressed.size(), compressed.data(), compressed_size); }
+	catch (std::system_error&) { threw = true; }
+	oCHECK(threw, "%s: decompressing without the dictionary should throw", as_string(type));
+
+	// and an empty one goes back to the format compress() makes
+	primed.set_dictionary(nullptr, 0);
+	const size_t unprimed_size = primed.compress(compressed.data(), compressed.size(), m.data(), m.size());
+	oCHECK(decompress(type, uncompressed.data(), uncompressed.size(), compressed.data(), unprimed_size) == m.size(), "%s: clearing the dictionary failed", as_string(type));
+}
+
+oTEST(oBase_compressor)
+{
+	blob buddha = srv.load_buffer("Test/Geometry/buddha.obj");
+	const uint8_t* src = buddha;
+	const int num_outstanding = s_num_outstanding;
+
+	// more than one 4 MB lz4 block
+	std::vector<uint8_t> doubled(src, src + buddha.size());
+	doubled.insert(doubled.end(), src, src + buddha.size());
+
+	test_roundtrip(srv, compression::gzip, src, buddha.size());
+	test_roundtrip(srv, compression::lzma, src, buddha.size());
+	test_roundtrip(srv, compression::snappy, src, buddha.size());
+	test_roundtrip(srv, compression::lz4, doubled.data(), doubled.size());
+	test_roundtrip(srv, compression::lz4, doubled.data(), doubled.size(), lz4::default_hc_level);
+
+	// empty streams are still complete streams
+	for (int i = (int)compression::gzip; i < (int)compression::count; i++)
+	{
+		compressor c((compression)i, counting_allocator);
+		std::vector<uint8_t> compressed(c.max_compressed_size(0));
+		c.begin(compressed.data(), compressed.size());
+		const size_t compressed_size = c.finish();
+		oCHECK(decompress((compression)i, nullptr, 0, compressed.data(), compressed_size) == 0, "%s: empty stream isn't empty", as_string((compression)i));
+	}
+
+	auto messages = make_messages(srv, 1000);
+	std::sort(messages.begin(), messages.end(), [](const std::vector<uint8_t>& a, const std::vector<uint8_t>& b) { return a.size() > b.size(); });
+
+	test_reuse(srv, compression::gzip, messages);
+	test_reuse(srv, compression::lzma, messages);
+	test_reuse(srv, compression::snappy, messages);
+	test_reuse(srv, compression::lz4, messages);
+
+	test_dictionaries(srv, compression::gzip, messages);
+	test_dictionaries(srv, compression::lz4, messages);
+
+	bool threw = false;
+	try { compressor(compression::snappy).set_dictionary(src, 1024); }
+	catch (std::system_error& e) { threw = e.code() == std::errc::not_supported; }
+	oCHECK(threw, "snappy should not support dictionaries");
+
+	oCHECK(s_num_outstanding == num_outstanding, "compressors leaked %d allocations", s_num_outstanding - num_outstanding);
+}
@@ -6,7 +6,9 @@
 #include <oBase/concurrent_growable_object_pool.h>
 #include <oCore/assert.h>
 #include <oConcurrency/concurrency.h>
+#include <oMemory/pool_magazine.h>
 #include <oSystem/windows/win_crt_leak_tracker.h>
+#include <thread>
 #include <vector>
 
 using namespace ouro;
@@ -103,6 +105,31 @@ oTEST(oBase_concurrent_growable_object_pool)
 				Allocator.destroy(tests[i]);
 			}
 		}
+
+		oTrace("per-thread object_pool_magazine { create, destroy }");
+
+		Allocator.shrink(0);
+		std::vector<std::thread> threads(4);
+		for (size_t t = 0; t < threads.size(); t++)
+			threads[t] = std::thread([&, t]
+			{
+				object_pool_magazine<concurrent_growable_object_pool<test_obj>> mag(Allocator);
+				for (size_t i = t; i < NumBlocks; i += threads.size())
+				{
+					tests[i] = mag.create(&destroyed[i]);
+					tests[i]->Value = i;
+				}
+				for (size_t i = t; i < NumBlocks; i += threads.size())
+					if (tests[i]->Value == i)
+						mag.destroy(tests[i]);
+			});
+
+		for (auto& t : threads)
+			t.join();
+
+		for (size_t i = 0; i < NumBlocks; i++)
+			oCHECK(destroyed[i], "magazine did not create/destroy allocation %d", i);
+		oCHECK(Allocator.full(), "magazines did not return all blocks to the growable pool");
 	}
 
 	catch (std::exception&)
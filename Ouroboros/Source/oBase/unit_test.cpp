@@ -201,6 +201,11 @@ static result run(framework_services& fw, const info_t& info, const registered*
 				timer test_timer;
 				try
 				{
+					#ifdef _DEBUG
+						if (test->flags & oTEST_BENCHMARK)
+							throw skip_test("Benchmarks are not meaningful in debug builds.");
+					#endif
+
 					test->run(srv);
 					res = result::success;
 				}
@@ -26,21 +26,26 @@ void plan_thread::initialize(const init_t& init, const allocator& a)
 {
 	// calculate how much memory will be required by components
 	const uint32_t TasklistSetBytes = master_tasklist::calc_size(init.max_num_tasklists);
-	const uint32_t PlanBytes = plan::calc_size(init.plan_allocator_bytes, init.num_phases);
-	const uint32_t TotalBytes = TasklistSetBytes + 2*PlanBytes + 2*sizeof(plan);
+	const uint32_t PlanBytes = plan::calc_size(0, init.num_phases);
+	const uint32_t AllocatorBytes = 2 * align(init.plan_allocator_bytes, oCACHE_LINE_SIZE);
+	const uint32_t TotalBytes = TasklistSetBytes + AllocatorBytes + 2*PlanBytes + 2*sizeof(plan);
 
 	// allocate and offset the memory
 	void* l = a.allocate(TotalBytes, "plan_thread memory");
-	void* r = (uint8_t*)l + TasklistSetBytes;
+	void* m = (uint8_t*)l + TasklistSetBytes;
+	void* r = (uint8_t*)m + AllocatorBytes;
 	void* w = (uint8_t*)r + PlanBytes;
 
 	producer_plan = (plan*)((uint8_t*)w + PlanBytes);
 	consumer_plan = (plan*)((uint8_t*)producer_plan + sizeof(plan));
 	memset(l, 0, TotalBytes);
+	new (producer_plan) plan();
+	new (consumer_plan) plan();
 
 	// initialize components
-	producer_plan->initialize(w, PlanBytes, init.num_phases);
-	consumer_plan->initialize(r, PlanBytes, init.num_phases);
+	plan_allocator.initialize(m, AllocatorBytes);
+	producer_plan->initialize(w, PlanBytes, init.num_phases, &plan_allocator);
+	consumer_plan->initialize(r, PlanBytes, init.num_phases, &plan_allocator);
 	tasklists.initialize(producer_plan, l, init.max_num_tasklists);
 
 	// initialize fields
@@ -80,6 +85,7 @@ void plan_thread::deinitialize()
 	void* p = tasklists.deinitialize();
 	consumer_plan->deinitialize();
 	producer_plan->deinitialize();
+	plan_allocator.deinitialize();
 
 	// free memory
 	if (dealloc)
@@ -106,7 +112,8 @@ void plan_thread::kick()
 	state = swapping;
 	std::swap(consumer_plan, producer_plan);
 
-	// if there's work, fire up the work thread
+	// if there's work, fire up the work thread, which retires the plan's memory
+	// once it has executed
 	if (n)
 	{
 		state = executing;
@@ -114,11 +121,15 @@ void plan_thread::kick()
 		cv_consumer.notify_all();
 	}
 	else
+	{
+		consumer_plan->retire();
 		state = idle;
+	}
 
-	// reset the consumed plan and attach it to the master worklist
+	// the consumed plan was retired after it executed, so begin a new plan after
+	// the one that's executing and attach it to the master worklist
 	tasklists.set_plan(producer_plan);
-	producer_plan->reset();
+	producer_plan->begin();
 }
 
 void plan_thread::sync()
@@ -152,6 +163,8 @@ void plan_thread::run()
 			end_phase(phases[phase].name);
 		}
 
+		consumer_plan->retire();
+
 		// frame is done: release the lock so frames can be flipped and notify the 
 		// producer
 		state = idle;
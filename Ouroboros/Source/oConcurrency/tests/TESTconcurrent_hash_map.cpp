@@ -3,8 +3,11 @@
 #include <oBase/unit_test.h>
 
 #include <oConcurrency/concurrent_hash_map.h>
+#include <oConcurrency/concurrent_growable_hash_map.h>
 #include <oMemory/fnv1a.h>
+#include <oMemory/wang.h>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace ouro;
@@ -73,3 +76,154 @@ oTEST(oConcurrency_concurrent_hash_map)
 {
 	TEST_chm_basics(srv);
 }
+
+typedef concurrent_growable_hash_map<uint64_t, uint32_t> growable_hash_map_t;
+
+static uint64_t growable_key(uint32_t i)
+{
+	return wang_hash(uint64_t(i) + 1);
+}
+
+static void TEST_cghm_basics(unit_test::services& srv)
+{
+	static const uint32_t kNumKeys = 20000;
+
+	growable_hash_map_t h(uint32_t(-1), 8);
+	const auto initial_capacity = h.capacity();
+	oCHECK(h.empty(), "should be empty");
+
+	for (uint32_t i = 0; i < kNumKeys; i++)
+		oCHECK(h.set(growable_key(i), i) == h.nul(), "new key %u had a prior value", i);
+
+	oCHECK(h.size() == kNumKeys, "size is %u, expected %u", h.size(), kNumKeys);
+	oCHECK(h.capacity() >= kNumKeys && h.capacity() > initial_capacity, "did not grow (capacity %u)", h.capacity());
+
+	for (uint32_t i = 0; i < kNumKeys; i++)
+		oCHECK(h.get(growable_key(i)) == i, "get failed after growth");
+
+	for (uint32_t i = 0; i < kNumKeys; i += 2)
+		oCHECK(h.nix(growable_key(i)) == i, "nix failed");
+
+	oCHECK(h.size() == kNumKeys / 2, "size after nix is %u, expected %u", h.size(), kNumKeys / 2);
+	oCHECK(h.get(growable_key(0)) == h.nul(), "nix'ed key is still valid");
+
+	uint32_t prior = h.nul();
+	oCHECK(h.cas(growable_key(0), prior, 100), "cas on an erased key should insert");
+	prior = h.nul();
+	oCHECK(!h.cas(growable_key(0), prior, 200) && prior == 100, "cas should have failed and returned the current value");
+
+	// retire every value divisible by 3 and compact out tombstones
+	const auto n = h.reclaim_keys([](const uint32_t& value, const uint32_t& nul, void* user) { return (value % 3) == 0; }, nullptr);
+	oCHECK(n > 0, "reclaim failed");
+
+	uint32_t visited = 0;
+	h.visit([&](uint64_t key, uint32_t value)->bool
+	{
+		visited++;
+		return (value % 3) != 0 && h.get(key) == value;
+	});
+
+	oCHECK(visited == h.size(), "visited %u of %u entries or visited an invalid entry", visited, h.size());
+
+	h.clear();
+	oCHECK(h.empty() && h.get(growable_key(1)) == h.nul(), "clear failed");
+}
+
+static void TEST_cghm_concurrency(unit_test::services& srv)
+{
+	static const uint32_t kNumKeysPerThread = 20000;
+	static const uint32_t kNumChurns = 100000;
+
+	growable_hash_map_t h(uint32_t(-1), 64);
+
+	std::vector<std::thread> threads(std::thread::hardware_concurrency() + 3);
+	const uint32_t nthreads = uint32_t(threads.size());
+
+	// each thread inserts its own keys, erases every other one and checks the
+	// rest, while the map grows under it
+	for (uint32_t t = 0; t < nthreads; t++)
+		threads[t] = std::thread([&, t]
+		{
+			const uint32_t base = t * kNumKeysPerThread;
+			for (uint32_t i = base; i < base + kNumKeysPerThread; i++)
+				h.set(growable_key(i), i);
+			for (uint32_t i = base; i < base + kNumKeysPerThread; i += 2)
+				h.nix(growable_key(i));
+		});
+
+	for (auto& t : threads)
+		t.join();
+
+	const uint32_t expected = nthreads * kNumKeysPerThread / 2;
+	oCHECK(h.size() == expected, "size is %u, expected %u", h.size(), expected);
+
+	for (uint32_t i = 0; i < nthreads * kNumKeysPerThread; i++)
+	{
+		const uint32_t v = h.get(growable_key(i));
+		oCHECK(v == ((i & 1) ? i : h.nul()), "key %u has value %u", i, v);
+	}
+
+	// inserting and erasing the same number of short-lived keys should reclaim
+	// tombstones rather than keep growing
+	h.clear();
+	const auto capacity = h.capacity();
+	for (uint32_t t = 0; t < nthreads; t++)
+		threads[t] = std::thread([&, t]
+		{
+			const uint32_t base = (nthreads + t) * kNumChurns;
+			for (uint32_t i = base; i < base + kNumChurns; i++)
+			{
+				h.set(growable_key(i), i);
+				h.nix(growable_key(i));
+			}
+		});
+
+	for (auto& t : threads)
+		t.join();
+
+	oCHECK(h.empty(), "churn left %u entries", h.size());
+	oCHECK(h.capacity() <= capacity * 2, "churn grew the map from %u to %u", capacity, h.capacity());
+}
+
+static void TEST_cghm_migration_overflow(unit_test::services& srv)
+{
+	static const uint32_t kNumKeysPerThread = 20000;
+
+	// starting tiny with many writers fills each next table before the
+	// migration into it is done, so keys have to go to tables chained after it
+	growable_hash_map_t h(uint32_t(-1), 8);
+
+	std::vector<std::thread> threads(2 * std::thread::hardware_concurrency() + 8);
+	const uint32_t nthreads = uint32_t(threads.size());
+
+	for (uint32_t t = 0; t < nthreads; t++)
+		threads[t] = std::thread([&, t]
+		{
+			const uint32_t base = t * kNumKeysPerThread;
+			for (uint32_t i = base; i < base + kNumKeysPerThread; i++)
+				h.set(growable_key(i), i);
+		});
+
+	for (auto& t : threads)
+		t.join();
+
+	const uint32_t expected = nthreads * kNumKeysPerThread;
+	oCHECK(h.size() == expected, "size is %u, expected %u", h.size(), expected);
+
+	for (uint32_t i = 0; i < expected; i++)
+	{
+		const uint32_t v = h.get(growable_key(i));
+		oCHECK(v == i, "key %u has value %u", i, v);
+	}
+
+	uint32_t visited = 0;
+	h.visit([&](uint64_t key, uint32_t value) { visited++; return true; });
+	oCHECK(visited == expected, "visited %u entries, expected %u", visited, expected);
+}
+
+oTEST(oConcurrency_concurrent_growable_hash_map)
+{
+	TEST_cghm_basics(srv);
+	TEST_cghm_concurrency(srv);
+	TEST_cghm_migration_overflow(srv);
+}
@@ -3,11 +3,15 @@
 #include <oBase/unit_test.h>
 
 #include <oCore/finally.h>
+#include <oCore/timer.h>
+#include <oConcurrency/backoff.h>
 #include <oConcurrency/concurrency.h>
 #include <oConcurrency/concurrent_queue.h>
 #include <oConcurrency/concurrent_queue_opt.h>
+#include <oConcurrency/concurrent_ring_queue.h>
 #include <oConcurrency/threadpool.h>
 #include <oConcurrency/event.h>
+#include <algorithm>
 #include <atomic>
 #include <thread>
 #include <vector>
@@ -117,19 +121,31 @@ static void push_and_pop_task_performance(QueueT* _pQueue, size_t _NumPushPops,
 	oTrace("Done thread.");
 }
 
+// The contention tests below scale with the number of hardware threads and
+// can hold every push at once, so queues are built with room for all of them
+// (plus the node queues' sentinel) rather than the default capacity, which 
+// would bound them on machines with many threads.
+static size_t num_contending_threads() { return std::thread::hardware_concurrency() + 5; }
+
+template<typename QueueT>
+static typename QueueT::size_type contention_capacity(size_t items_per_thread)
+{
+	return typename QueueT::size_type(items_per_thread * num_contending_threads() + 1);
+}
+
 template<typename T, typename QueueT>
 static void test_concurrent_pushes(unit_test::services& services, const char* queue_name)
 {
-	QueueT q;
+	const size_t NumPushes = 1000;
+	QueueT q(contention_capacity<QueueT>(NumPushes), queue_name);
 	oFinally { q.clear(); };
 
-	const size_t NumPushes = 1000;
 	size_t ExpectedSize = 0;
 	oCHECK(q.size() == ExpectedSize, "Empty queue not reporting 0 elements");
 
 	// Scope to ensure queue is cleaned up AFTER all threads.
 	{
-		std::vector<std::thread> threadArray(std::thread::hardware_concurrency() + 5); // throw in some contention
+		std::vector<std::thread> threadArray(num_contending_threads()); // throw in some contention
 		ExpectedSize = NumPushes * threadArray.size();
 
 		for (size_t i = 0; i < threadArray.size(); i++)
@@ -146,16 +162,16 @@ static void test_concurrent_pushes(unit_test::services& services, const char* qu
 template<typename T, typename QueueT>
 static void test_concurrent_pops(unit_test::services& services, const char* queue_name)
 {
-	QueueT q;
+	const size_t NumPops = 100;
+	QueueT q(contention_capacity<QueueT>(NumPops), queue_name);
 	try
 	{
 		size_t ActualSize = q.size();
 		oCHECK(ActualSize == 0, "Queue should have initialized to zero items, but has %u", ActualSize);
 
 		// Scope to ensure queue is cleaned up AFTER all threads.
-		const size_t NumPops = 100;
 		{
-			std::vector<std::thread> threadArray(std::thread::hardware_concurrency() + 5); // throw in some contention
+			std::vector<std::thread> threadArray(num_contending_threads()); // throw in some contention
 			size_t InitialSize = T(NumPops * threadArray.size());
 			for (T i = 0; i < T(InitialSize); i++)
 				q.push(i);
@@ -184,14 +200,15 @@ static void test_concurrent_pops(unit_test::services& services, const char* queu
 template<typename T, typename QueueT>
 static void test_concurrency(unit_test::services& services, const char* queue_name)
 {
-	QueueT q;
+	const size_t NumPushPops = 1000;
+	QueueT q(contention_capacity<QueueT>(NumPushPops), queue_name);
 
 	// Scope to ensure queue is cleaned up AFTER all threads.
 	{
-		std::vector<std::thread> threadArray(std::thread::hardware_concurrency() + 5); // throw in some contention
+		std::vector<std::thread> threadArray(num_contending_threads()); // throw in some contention
 
 		for (size_t i = 0; i < threadArray.size(); i++)
-			threadArray[i] = std::thread(push_and_pop_task<T, QueueT>, &q, 1000, 100);
+			threadArray[i] = std::thread(push_and_pop_task<T, QueueT>, &q, NumPushPops, 100);
 
 		for (size_t i = 0; i < threadArray.size(); i++)
 			threadArray[i].join();
@@ -316,6 +333,268 @@ oTEST(oConcurrency_concurrent_queue_opt)
 	oTEST_QUEUET(concurrent_queue_opt);
 }
 
+oTEST(oConcurrency_concurrent_ring_queue)
+{
+	oTEST_QUEUET(concurrent_ring_queue);
+}
+
+// Each producer pushes (id << 24) | sequence, alternating single and batch 
+// pushes. A single consumer can verify per-producer FIFO order; with several 
+// consumers only the totals are checked.
+template<typename Policy>
+static void test_ring_queue_policy(unit_test::services& srv, const char* policy_name, size_t num_producers, size_t num_consumers)
+{
+	static const int kNumPerProducer = 100000;
+	static const int kBatch = 16;
+
+	concurrent_ring_queue<int, Policy> q(1024);
+	std::atomic<int> num_popped(0);
+	std::atomic<long long> sum(0);
+	std::vector<int> last(num_producers, -1);
+	bool in_order = true;
+	const int total = int(num_producers) * kNumPerProducer;
+
+	std::vector<std::thread> threads;
+	for (size_t p = 0; p < num_producers; p++)
+		threads.push_back(std::thread([&, p]
+		{
+			int batch[kBatch];
+			int i = 0;
+			while (i < kNumPerProducer)
+			{
+				if (i & 1)
+				{
+					q.push((int(p) << 24) | i);
+					i++;
+				}
+				else
+				{
+					const int n = std::min(kBatch, kNumPerProducer - i);
+					for (int j = 0; j < n; j++)
+						batch[j] = (int(p) << 24) | (i + j);
+					int pushed = 0;
+					backoff bo;
+					while (pushed < n)
+					{
+						const int k = int(q.try_push_n(batch + pushed, concurrent_ring_queue<int>::size_type(n - pushed)));
+						if (!k)
+							bo.pause();
+						pushed += k;
+					}
+					i += n;
+				}
+			}
+		}));
+
+	for (size_t c = 0; c < num_consumers; c++)
+		threads.push_back(std::thread([&]
+		{
+			int batch[kBatch];
+			while (num_popped < total)
+			{
+				const int n = int(q.try_pop_n(batch, kBatch));
+				if (!n)
+				{
+					int v;
+					if (!q.try_pop(v))
+					{
+						std::this_thread::yield();
+						continue;
+					}
+					num_popped++;
+					sum += v & 0xffffff;
+					if (num_consumers == 1)
+					{
+						in_order = in_order && (v & 0xffffff) > last[v >> 24];
+						last[v >> 24] = v & 0xffffff;
+					}
+					continue;
+				}
+
+				num_popped += n;
+				for (int j = 0; j < n; j++)
+				{
+					const int v = batch[j];
+					sum += v & 0xffffff;
+					if (num_consumers == 1)
+					{
+						in_order = in_order && (v & 0xffffff) > last[v >> 24];
+						last[v >> 24] = v & 0xffffff;
+					}
+				}
+			}
+		}));
+
+	for (auto& t : threads)
+		t.join();
+
+	const long long expected_sum = (long long)num_producers * ((long long)(kNumPerProducer - 1) * kNumPerProducer / 2);
+	oCHECK(num_popped == total, "%s: popped %d of %d", policy_name, num_popped.load(), total);
+	oCHECK(sum == expected_sum, "%s: values were lost or duplicated", policy_name);
+	oCHECK(in_order, "%s: elements from one producer were popped out of order", policy_name);
+	oCHECK(q.empty(), "%s: queue not empty after all elements were popped", policy_name);
+}
+
+oTEST(oConcurrency_concurrent_ring_queue_policies)
+{
+	const size_t n = std::max(2u, std::thread::hardware_concurrency());
+
+	{
+		concurrent_ring_queue<int> q(4);
+		int vals[] = { 0, 1, 2, 3, 4, 5 };
+		oCHECK(q.capacity() == 4, "capacity should be 4");
+		oCHECK(q.try_push_n(vals, 6) == 4, "try_push_n should stop when the queue is full");
+		oCHECK(!q.try_push(5), "try_push on a full queue should fail");
+		int out[6] = { -1, -1, -1, -1, -1, -1 };
+		oCHECK(q.try_pop_n(out, 6) == 4, "try_pop_n should return all elements");
+		for (int i = 0; i < 4; i++)
+			oCHECK(out[i] == i, "try_pop_n returned elements out of order");
+		oCHECK(q.try_pop_n(out, 6) == 0 && q.empty(), "queue should be empty");
+	}
+
+	test_ring_queue_policy<ring_queue_spsc>(srv, "spsc", 1, 1);
+	test_ring_queue_policy<ring_queue_mpsc>(srv, "mpsc", n, 1);
+	test_ring_queue_policy<ring_queue_mpmc>(srv, "mpmc", n, 1);
+	test_ring_queue_policy<ring_queue_mpmc>(srv, "mpmc", n, n);
+}
+
+struct queue_single_ops
+{
+	template<typename QueueT> static void produce(QueueT& q, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+			q.push(1);
+	}
+
+	template<typename QueueT> static void consume(QueueT& q, std::atomic<size_t>& consumed, size_t total)
+	{
+		int v;
+		backoff bo;
+		while (consumed < total)
+		{
+			if (q.try_pop(v))
+			{
+				consumed++;
+				bo.reset();
+			}
+			else
+				bo.pause();
+		}
+	}
+};
+
+struct queue_batch_ops
+{
+	static const size_t batch = 32;
+
+	template<typename QueueT> static void produce(QueueT& q, size_t count)
+	{
+		int vals[batch];
+		for (auto& v : vals)
+			v = 1;
+		backoff bo;
+		while (count)
+		{
+			const size_t n = q.try_push_n(vals, typename QueueT::size_type(std::min(count, batch)));
+			if (n)
+				bo.reset();
+			else
+				bo.pause();
+			count -= n;
+		}
+	}
+
+	template<typename QueueT> static void consume(QueueT& q, std::atomic<size_t>& consumed, size_t total)
+	{
+		int vals[batch];
+		backoff bo;
+		while (consumed < total)
+		{
+			const size_t n = q.try_pop_n(vals, typename QueueT::size_type(batch));
+			if (n)
+			{
+				consumed += n;
+				bo.reset();
+			}
+			else
+				bo.pause();
+		}
+	}
+};
+
+// returns millions of elements per second moved from producers to consumers
+template<typename QueueT, typename OpsT>
+static double queue_throughput(size_t num_producers, size_t num_consumers)
+{
+	static const size_t kNumItems = 1 << 20;
+
+	QueueT q(typename QueueT::size_type(kNumItems), "queue_throughput");
+	std::atomic<size_t> consumed(0);
+	event start;
+
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < num_producers; i++)
+	{
+		const size_t count = kNumItems / num_producers + (i == 0 ? kNumItems % num_producers : 0);
+		threads.push_back(std::thread([&, count] { start.wait(); OpsT::produce(q, count); }));
+	}
+
+	for (size_t i = 0; i < num_consumers; i++)
+		threads.push_back(std::thread([&] { start.wait(); OpsT::consume(q, consumed, kNumItems); }));
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	timer tm;
+	start.set();
+	for (auto& t : threads)
+		t.join();
+	return kNumItems / (tm.seconds() * 1000000.0);
+}
+
+oBENCHMARK(oConcurrency_queue_throughput)
+{
+	const size_t hw = std::max(2u, std::thread::hardware_concurrency());
+	const size_t counts[][2] = { { 1, 1 }, { 2, 2 }, { hw / 2, hw / 2 }, { hw - 1, 1 }, { 1, hw - 1 } };
+
+	double node = 0.0, ring = 0.0;
+	size_t last_p = 0, last_n = 0;
+	for (const auto& c : counts)
+	{
+		const size_t p = c[0], n = c[1];
+		if (&c != counts && std::find_if(counts, &c, [&](const size_t* prev) { return prev[0] == p && prev[1] == n; }) != &c)
+			continue; // small machines produce duplicate configurations
+		const double queue = queue_throughput<concurrent_queue<int>, queue_single_ops>(p, n);
+		const double opt = queue_throughput<concurrent_queue_opt<int>, queue_single_ops>(p, n);
+		const double mpmc = queue_throughput<concurrent_ring_queue<int>, queue_single_ops>(p, n);
+		const double batch = queue_throughput<concurrent_ring_queue<int>, queue_batch_ops>(p, n);
+
+		srv.trace("%ux%u Mitems/s: concurrent_queue %.2f concurrent_queue_opt %.2f ring_mpmc %.2f ring_mpmc_batch %.2f"
+			, unsigned(p), unsigned(n), queue, opt, mpmc, batch);
+
+		if (n == 1)
+		{
+			const double mpsc = queue_throughput<concurrent_ring_queue<int, ring_queue_mpsc>, queue_single_ops>(p, n);
+			const double mpsc_batch = queue_throughput<concurrent_ring_queue<int, ring_queue_mpsc>, queue_batch_ops>(p, n);
+			srv.trace("%ux1 Mitems/s: ring_mpsc %.2f ring_mpsc_batch %.2f", unsigned(p), mpsc, mpsc_batch);
+		}
+
+		if (p == 1 && n == 1)
+		{
+			const double spsc = queue_throughput<concurrent_ring_queue<int, ring_queue_spsc>, queue_single_ops>(p, n);
+			const double spsc_batch = queue_throughput<concurrent_ring_queue<int, ring_queue_spsc>, queue_batch_ops>(p, n);
+			srv.trace("1x1 Mitems/s: ring_spsc %.2f ring_spsc_batch %.2f", spsc, spsc_batch);
+		}
+
+		node = queue;
+		ring = batch;
+		last_p = p;
+		last_n = n;
+	}
+
+	srv.status("%ux%u: concurrent_queue %.2f Mitems/s, ring batch %.2f Mitems/s"
+		, unsigned(last_p), unsigned(last_n), node, ring);
+}
+
 static const int kNumTasks = 50000;
 static const int kPoppedFlag = 0x80000000;
 static const int kStolenFlag = 0x40000000;
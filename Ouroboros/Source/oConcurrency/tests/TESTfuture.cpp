@@ -5,7 +5,9 @@
 #include <oCore/timer.h>
 #include <oConcurrency/concurrency.h>
 #include <oConcurrency/future.h>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include <oSystem/windows/win_crt_leak_tracker.h>
 
@@ -67,6 +69,109 @@ static void test_workstealing(ouro::unit_test::services& services)
 		services.status("");
 }
 
+oTEST(oConcurrency_future_continuations)
+{
+	// chain stages without waiting on any intermediate one
+	{
+		ouro::future<std::string> Result = ouro::async([] { return 20; })
+			.then([](ouro::future<int> f) { return f.get() + 1; })
+			.then([](ouro::future<int> f) { return std::to_string(f.get()); });
+
+		oCHECK(Result.get() == "21", "then() chain produced the wrong result");
+	}
+
+	// exceptions flow through to the end of a chain
+	{
+		ouro::future<bool> Result = ouro::async(fail_and_report)
+			.then([](ouro::future<bool> f) { return !f.get(); });
+
+		bool caught = false;
+		try { Result.get(); }
+		catch (std::invalid_argument&) { caught = true; }
+		oCHECK(caught, "then() did not propagate the exception");
+	}
+
+	// then() on a promise-backed future and void continuations
+	{
+		std::atomic_int value;
+		value.store(0);
+		ouro::promise<int> p;
+		ouro::future<void> Result = p.get_future().then([&](ouro::future<int> f) { value = f.get(); });
+		oCHECK(Result.wait_for(std::chrono::milliseconds(1)) == future_status::timeout, "continuation ran before its promise was fulfilled");
+		p.set_value(5);
+		oCHECK(Result.wait_for(std::chrono::seconds(10)) == future_status::ready, "continuation did not run");
+		Result.get();
+		oCHECK(value == 5, "continuation saw the wrong value");
+	}
+
+	// wait_for on a task-backed future
+	{
+		ouro::future<int> Result = ouro::async([] { return 3; });
+		oCHECK(Result.wait_for(std::chrono::seconds(10)) == future_status::ready, "wait_for on an async future timed out");
+		oCHECK(Result.get() == 3, "wait_for on an async future returned the wrong result");
+	}
+
+	// abandoning a promise breaks it, so pending continuations still run
+	{
+		ouro::future<bool> Result;
+		{
+			ouro::promise<int> p;
+			Result = p.get_future().then([](ouro::future<int> f)
+			{
+				try { f.get(); }
+				catch (ouro::future_error&) { return true; }
+				return false;
+			});
+		}
+
+		oCHECK(Result.wait_for(std::chrono::seconds(10)) == future_status::ready, "continuation of an abandoned promise did not run");
+		oCHECK(Result.get(), "abandoned promise did not report broken_promise");
+	}
+
+	// dropping a future doesn't wait on the task behind it
+	{
+		std::atomic_int value;
+		value.store(0);
+		timer tm;
+		ouro::async([&] { std::this_thread::sleep_for(std::chrono::milliseconds(500)); value++; });
+		oCHECK(tm.seconds() < 0.25, "destroying an async future blocked on its task");
+
+		tm.reset();
+		while (!value && tm.seconds() < 10.0)
+			std::this_thread::yield();
+		oCHECK(value != 0, "async task did not run after its future was dropped");
+	}
+
+	// when_all
+	{
+		std::vector<ouro::future<int>> futures;
+		for (int i = 0; i < 16; i++)
+			futures.push_back(ouro::async([=] { return i; }));
+
+		std::vector<ouro::future<int>> Results = ouro::when_all(futures.begin(), futures.end()).get();
+		oCHECK(Results.size() == 16, "when_all lost futures");
+		int sum = 0;
+		for (auto& f : Results)
+			sum += f.get();
+		oCHECK(sum == 120, "when_all results are wrong (sum %d)", sum);
+	}
+
+	// when_any
+	{
+		ouro::promise<int> never;
+		std::vector<ouro::future<int>> futures;
+		futures.push_back(never.get_future());
+		futures.push_back(ouro::async([] { return 7; }));
+
+		ouro::when_any_result<std::vector<ouro::future<int>>> Result = ouro::when_any(futures.begin(), futures.end()).get();
+		oCHECK(Result.index == 1, "when_any picked the wrong future");
+		oCHECK(Result.futures[1].get() == 7, "when_any result is wrong");
+		oCHECK(!Result.futures[0].is_ready(), "unfulfilled future became ready");
+		never.set_value(0);
+		Result.futures[0].get();
+	}
+}
+
 void TESTfuture(ouro::unit_test::services& services)
 {
 	{
@@ -4,6 +4,8 @@
 
 #include <oCore/countof.h>
 #include <oConcurrency/concurrency.h>
+#include <atomic>
+#include <vector>
 
 using namespace ouro;
 
@@ -60,3 +62,29 @@ oTEST(oConcurrency_parallel_for)
 
 	parallel_for(0, mArraySize, std::bind(test_ab, std::placeholders::_1, &mTestArrayB[0], 2));
 };
+
+oTEST(oConcurrency_parallel_for_range)
+{
+	static const size_t kArraySize = 1000003;
+	std::vector<int> visits(kArraySize, 0);
+
+	// every index must be visited exactly once and only inside [begin,end)
+	std::atomic<size_t> num_calls(0);
+	parallel_for_range(3, kArraySize - 3, [&](size_t begin, size_t end)
+	{
+		num_calls++;
+		for (; begin < end; begin++)
+			visits[begin]++;
+	});
+
+	for (size_t i = 0; i < kArraySize; i++)
+	{
+		const int expected = (i < 3 || i >= kArraySize - 3) ? 0 : 1;
+		oCHECK(visits[i] == expected, "parallel_for_range visited index %u %d times (expected %d)", (uint32_t)i, visits[i], expected);
+	}
+
+	// cheap bodies should be batched, not called per index
+	oCHECK(num_calls < kArraySize / 16, "parallel_for_range did not batch: %u calls for %u indices", (uint32_t)num_calls.load(), (uint32_t)kArraySize);
+
+	srv.status("%u subranges", (uint32_t)num_calls.load());
+};
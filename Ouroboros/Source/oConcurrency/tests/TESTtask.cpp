@@ -0,0 +1,101 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+#include <oBase/unit_test.h>
+
+#include <oConcurrency/task.h>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace ouro;
+
+#if oHAS_COROUTINES
+
+static task<int> add_one(future<int> f)
+{
+	const int value = co_await f;
+	co_return value + 1;
+}
+
+static task<std::string> describe(int seed)
+{
+	std::string prefix = "value: "; // locals survive suspension
+	co_await schedule();
+	const int value = co_await add_one(ouro::async([=] { return seed; }));
+	co_return prefix + std::to_string(value);
+}
+
+static task<int> fail()
+{
+	co_await schedule();
+	throw std::invalid_argument("task failure, this should have been caught");
+}
+
+static task<void> wait_for_event(event& e, countdown_latch& started, countdown_latch& finished, std::atomic<int>& counter)
+{
+	co_await schedule();
+	started.release();
+	co_await e;
+	counter++;
+	finished.release();
+}
+
+static task<int> wait_for_latch(countdown_latch& latch)
+{
+	co_await latch;
+	co_return 7;
+}
+
+static void test_tasks(unit_test::services& srv)
+{
+	oCHECK(spawn(describe(41)).get() == "value: 42", "task chain produced the wrong result");
+
+	{
+		bool caught = false;
+		try { spawn(fail()).get(); }
+		catch (std::invalid_argument&) { caught = true; }
+		oCHECK(caught, "task did not propagate its exception");
+	}
+
+	{
+		countdown_latch latch(1);
+		future<int> f = spawn(wait_for_latch(latch));
+		oCHECK(f.wait_for(std::chrono::milliseconds(1)) == future_status::timeout, "task did not wait on the countdown_latch");
+		latch.release();
+		oCHECK(f.get() == 7, "task waiting on a countdown_latch returned the wrong result");
+	}
+
+	// many suspended tasks don't hold any threads
+	{
+		static const int kNumTasks = 2000;
+		event e;
+		countdown_latch started(kNumTasks);
+		countdown_latch finished(kNumTasks);
+		std::atomic<int> counter(0);
+
+		std::vector<future<void>> futures;
+		futures.reserve(kNumTasks);
+		for (int i = 0; i < kNumTasks; i++)
+			futures.push_back(spawn(wait_for_event(e, started, finished, counter)));
+
+		started.wait();
+		oCHECK(counter == 0, "tasks ran past an unset event");
+		e.set();
+		finished.wait();
+		for (auto& f : futures)
+			f.get();
+		oCHECK(counter == kNumTasks, "not all suspended tasks resumed (%d of %d)", counter.load(), kNumTasks);
+	}
+}
+
+#endif
+
+oTEST(oConcurrency_task)
+{
+	#if oHAS_COROUTINES
+		test_tasks(srv);
+	#else
+		throw unit_test::skip_test("This compiler does not support coroutines.");
+	#endif
+}
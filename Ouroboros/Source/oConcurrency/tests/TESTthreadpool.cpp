@@ -7,6 +7,7 @@
 #include <oCore/finally.h>
 #include <oConcurrency/concurrency.h>
 #include <oConcurrency/threadpool.h>
+#include <oConcurrency/work_stealing_threadpool.h>
 #include <oString/fixed_string.h>
 #include <oSystem/thread_traits.h>
 #include <atomic>
@@ -60,6 +61,25 @@ template<typename TaskGroupT> static void test_task_group(unit_test::services& s
 		std::atomic_thread_fence(std::memory_order_seq_cst);
 		oCHECK(value == kNumRuns, "std::function<void()>group was not able to be reused or either failed to run or failed to block on wait (2nd run)");
 	}
+
+	// a throwing task cancels the rest of the group and wait() rethrows
+	{
+		std::atomic<int> value = 0;
+		for (int i = 0; i < kNumRuns; i++)
+			g.run([&, i] { if (i == kNumRuns / 2) throw std::runtime_error("task threw"); value++; });
+
+		bool threw = false;
+		try { g.wait(); }
+		catch (std::runtime_error&) { threw = true; }
+		oCHECK(threw, "task exception was not rethrown by wait()");
+		oCHECK(value < kNumRuns, "ran more tasks than were queued");
+
+		value = 0;
+		for (int i = 0; i < kNumRuns; i++)
+			g.run([&] { value++; });
+		g.wait();
+		oCHECK(value == kNumRuns, "group was not reusable after a task threw");
+	}
 }
 
 static void set_value(size_t _Index, size_t* _pArray)
@@ -95,20 +115,58 @@ template<typename ThreadpoolT> static void TestT(unit_test::services& services)
 	oCHECK(!t.joinable(), "Threadpool was joined, but remains joinable()");
 }
 
-void TESTthreadpool(unit_test::services& services)
+oTEST(oConcurrency_threadpool)
 {
-	TestT<threadpool<core_thread_traits>>(services);
+	TestT<threadpool<core_thread_traits>>(srv);
 }
 
-void TESTtask_group(unit_test::services& services)
+oTEST(oConcurrency_task_group)
 {
 	threadpool<core_thread_traits> t;
 	oFinally { if (t.joinable()) t.join(); };
 
 	detail::task_group<core_thread_traits> g(t);
-	test_task_group(services, g);
+	test_task_group(srv, g);
 	
-	test_parallel_for(services, t);
+	test_parallel_for(srv, t);
+}
+
+oTEST(oConcurrency_work_stealing_threadpool)
+{
+	TestT<work_stealing_threadpool<core_thread_traits>>(srv);
+}
+
+oTEST(oConcurrency_work_stealing_task_group)
+{
+	typedef work_stealing_threadpool<core_thread_traits> threadpool_type;
+	threadpool_type t;
+	oFinally { if (t.joinable()) t.join(); };
+
+	detail::work_stealing_task_group<core_thread_traits, threadpool_type::allocator_type> g(t);
+	test_task_group(srv, g);
+
+	// task groups waited on from inside worker tasks must make progress by 
+	// running other tasks rather than blocking the worker.
+	{
+		static const int kNumOuter = 64;
+		static const int kNumInner = 64;
+		std::atomic<int> value(0);
+		for (int i = 0; i < kNumOuter; i++)
+		{
+			g.run([&]
+			{
+				detail::work_stealing_task_group<core_thread_traits, threadpool_type::allocator_type> inner(t);
+				for (int j = 0; j < kNumInner; j++)
+					inner.run([&] { value++; });
+				inner.wait();
+			});
+		}
+
+		g.wait();
+		oCHECK(value == kNumOuter * kNumInner, "nested work_stealing_task_group did not run all tasks");
+	}
+
+	test_parallel_for(srv, t);
 }
 
 namespace RatcliffJobSwarm {
@@ -233,11 +291,14 @@ void ouro::TESTthreadpool_performance(ouro::unit_test::services& services, test_
 		, DebuggerDisclaimer, n, et.c_str(), st.c_str(), DidParallelFor ? pt.c_str() : "not supported");
 }
 
-struct threadpool_impl : test_threadpool
+template<typename ThreadpoolT>
+struct threadpool_implT : test_threadpool
 {
-	threadpool<threadpool_default_traits> t;
-	~threadpool_impl() { if (t.joinable()) t.join(); }
-	const char* name() const override { return "threadpool"; }
+	ThreadpoolT t;
+	const char* label;
+	threadpool_implT(const char* label) : label(label) {}
+	~threadpool_implT() { if (t.joinable()) t.join(); }
+	const char* name() const override { return label; }
 	void dispatch(const std::function<void()>& _Task) override { return t.dispatch(_Task); }
 	bool parallel_for(size_t _Begin, size_t _End, const std::function<void(size_t _Index)>& _Task) override
 	{
@@ -249,6 +310,39 @@ struct threadpool_impl : test_threadpool
 	void release() override { if (t.joinable()) t.join(); }
 };
 
+struct threadpool_impl : threadpool_implT<threadpool<threadpool_default_traits>>
+{
+	threadpool_impl() : threadpool_implT("threadpool") {}
+};
+
+struct work_stealing_threadpool_impl : threadpool_implT<work_stealing_threadpool<threadpool_default_traits>>
+{
+	work_stealing_threadpool_impl() : threadpool_implT("work_stealing_threadpool") {}
+};
+
+// Uses whatever scheduler is linked in through concurrency.h (ouro or tbb) so 
+// the in-tree pools can be compared against the production backend.
+struct scheduler_impl : test_threadpool
+{
+	std::atomic<size_t> num_pending;
+	scheduler_impl() : num_pending(0) {}
+	const char* name() const override { return scheduler_name(); }
+	void dispatch(const std::function<void()>& _Task) override
+	{
+		num_pending++;
+		ouro::dispatch([=] { _Task(); num_pending--; });
+	}
+
+	bool parallel_for(size_t _Begin, size_t _End, const std::function<void(size_t _Index)>& _Task) override
+	{
+		ouro::parallel_for(_Begin, _End, _Task);
+		return true;
+	}
+
+	void flush() override { backoff bo; while (num_pending) bo.pause(); }
+	void release() override {}
+};
+
 namespace {
 	// Implement this inside a TESTMyThreadpool() function.
 	template<typename test_threadpool_impl_t> void TESTthreadpool_performance_impl1(unit_test::services& services)
@@ -265,5 +359,81 @@ void TESTthreadpool_perf(unit_test::services& services)
 		throw unit_test::skip_test("This is slow in debug, and pointless as a benchmark.");
 	#else
 		TESTthreadpool_performance_impl1<threadpool_impl>(services);
+		TESTthreadpool_performance_impl1<work_stealing_threadpool_impl>(services);
+		TESTthreadpool_performance_impl1<scheduler_impl>(services);
 	#endif
 }
+
+// Empty tasks spawned from worker tasks measure scheduling overhead alone: 
+// this is where a single global queue lock shows up.
+static void contention_benchmark(unit_test::services& services, test_threadpool& thdpool)
+{
+	static const size_t kNumOuter = 4096;
+	static const size_t kNumInner = 256;
+	static const size_t kNumTasks = kNumOuter * kNumInner;
+
+	std::atomic<size_t> value(0);
+	const char* n = thdpool.name() ? thdpool.name() : "(null)";
+
+	timer tm;
+	for (size_t i = 0; i < kNumOuter; i++)
+		thdpool.dispatch([&]
+		{
+			for (size_t j = 0; j < kNumInner; j++)
+				thdpool.dispatch([&] { value++; });
+		});
+	thdpool.flush();
+	const double nested_time = tm.seconds();
+
+	oCHECK(value == kNumTasks, "%s: nested dispatch ran %u of %u tasks", n, (uint32_t)value.load(), (uint32_t)kNumTasks);
+
+	value = 0;
+	tm.reset();
+	for (size_t i = 0; i < kNumTasks; i++)
+		thdpool.dispatch([&] { value++; });
+	thdpool.flush();
+	const double flat_time = tm.seconds();
+
+	oCHECK(value == kNumTasks, "%s: flat dispatch ran %u of %u tasks", n, (uint32_t)value.load(), (uint32_t)kNumTasks);
+
+	// A producer that dispatches small bursts with gaps between them pays for
+	// a wake on every burst if idle workers park too soon.
+	static const size_t kNumBursts = 4096;
+	static const size_t kBurstSize = 8;
+	static const double kGapSeconds = 0.00002;
+
+	value = 0;
+	double burst_time = 0.0;
+	for (size_t i = 0; i < kNumBursts; i++)
+	{
+		tm.reset();
+		for (size_t j = 0; j < kBurstSize; j++)
+			thdpool.dispatch([&] { value++; });
+		thdpool.flush();
+		burst_time += tm.seconds();
+
+		tm.reset();
+		while (tm.seconds() < kGapSeconds) {}
+	}
+
+	oCHECK(value == kNumBursts * kBurstSize, "%s: bursts ran %u of %u tasks", n, (uint32_t)value.load(), (uint32_t)(kNumBursts * kBurstSize));
+
+	services.trace("%s: nested %.2f Mtasks/s, external %.2f Mtasks/s, %.1f us per burst of %u"
+		, n, kNumTasks / (nested_time * 1000000.0), kNumTasks / (flat_time * 1000000.0), burst_time * 1000000.0 / kNumBursts, (uint32_t)kBurstSize);
+}
+
+namespace {
+	template<typename test_threadpool_impl_t> void contention_benchmark_impl(unit_test::services& services)
+	{
+		test_threadpool_impl_t tp;
+		oFinally { tp.release(); };
+		contention_benchmark(services, tp);
+	}
+}
+
+oBENCHMARK(oConcurrency_threadpool_contention)
+{
+	contention_benchmark_impl<threadpool_impl>(srv);
+	contention_benchmark_impl<work_stealing_threadpool_impl>(srv);
+	contention_benchmark_impl<scheduler_impl>(srv);
+}
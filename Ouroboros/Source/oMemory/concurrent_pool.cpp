@@ -44,6 +44,7 @@ concurrent_pool::concurrent_pool()
 {
 	tagged h(nullidx);
 	head_ = h.all;
+	nfree_ = 0;
 }
 
 concurrent_pool::concurrent_pool(concurrent_pool&& that)
@@ -53,6 +54,7 @@ concurrent_pool::concurrent_pool(concurrent_pool&& that)
 	, nblocks_(that.nblocks_)
 { 
 	head_.store(that.head_);
+	nfree_.store(that.nfree_);
 	that.deinitialize();
 }
 
@@ -80,6 +82,7 @@ concurrent_pool& concurrent_pool::operator=(concurrent_pool&& that)
 		stride_ = that.stride_; that.stride_ = 0;
 		nblocks_ = that.nblocks_; that.nblocks_ = 0;
 		head_.store(that.head_); that.head_ = nullidx;
+		nfree_.store(that.nfree_); that.nfree_ = 0;
 	}
 
 	return *this;
@@ -98,6 +101,7 @@ void concurrent_pool::initialize(void* arena, size_type bytes, size_type block_s
 		throw allocate_error(allocate_errc::invalid_capacity);
 
 	head_ = 0;
+	nfree_ = capacity;
 	blocks_ = (uint8_t*)arena;
 	stride_ = block_size;
 	nblocks_ = capacity;
@@ -114,20 +118,15 @@ void* concurrent_pool::deinitialize()
 	stride_ = 0;
 	nblocks_ = 0;
 	head_ = nullidx;
+	nfree_ = 0;
 	return p;
 }
 
 concurrent_pool::size_type concurrent_pool::count_free() const
 {
-	tagged o(head_);
-	size_type n = 0;
-	index_type i = o.index;
-	while (i != nullidx)
-	{
-		n++;
-		i = *(index_type*)(stride_*i + blocks_);
-	}
-	return n;
+	// the count is updated after the freelist, so it can briefly be out of range
+	const int n = nfree_.load(std::memory_order_relaxed);
+	return n < 0 ? 0 : std::min(size_type(n), nblocks_);
 }
 
 bool concurrent_pool::empty() const
@@ -147,6 +146,8 @@ concurrent_pool::index_type concurrent_pool::allocate_index()
 		n.tag = o.tag + 1;
 		n.index = *(index_type*)(stride_*i + blocks_);
 	} while (!head_.compare_exchange_strong(o.all, n.all));
+	if (i != nullidx)
+		nfree_.fetch_sub(1, std::memory_order_relaxed);
 	return i;
 }
 
@@ -158,6 +159,95 @@ void concurrent_pool::deallocate(index_type index)
 		n.tag = o.tag + 1;
 		n.index = index;
 	} while (!head_.compare_exchange_strong(o.all, n.all));
+	nfree_.fetch_add(1, std::memory_order_relaxed);
+}
+
+concurrent_pool::index_type concurrent_pool::pop_chain(size_type& count)
+{
+	index_type first;
+	size_type n;
+	tagged nh, o(head_);
+	for (;;)
+	{
+		first = o.index;
+		index_type i = first;
+		n = 0;
+		while (i != nullidx && n < count)
+		{
+			n++;
+			i = link(i);
+
+			// another thread popped and wrote over a block after it was read, so
+			// the CAS below would fail anyway and the link can't be followed
+			if (i != nullidx && i >= nblocks_)
+				break;
+		}
+
+		if (i != nullidx && i >= nblocks_)
+		{
+			o.all = head_;
+			continue;
+		}
+
+		if (!n)
+			break;
+
+		nh.tag = o.tag + 1;
+		nh.index = i;
+		if (head_.compare_exchange_strong(o.all, nh.all))
+			break;
+	}
+
+	if (n)
+		nfree_.fetch_sub(int(n), std::memory_order_relaxed);
+	count = n;
+	return first;
+}
+
+void concurrent_pool::push_chain(index_type first, index_type last, size_type count)
+{
+	tagged n, o(head_);
+	do
+	{	link(last) = o.index;
+		n.tag = o.tag + 1;
+		n.index = first;
+	} while (!head_.compare_exchange_strong(o.all, n.all));
+	nfree_.fetch_add(int(count), std::memory_order_relaxed);
+}
+
+concurrent_pool::size_type concurrent_pool::allocate_n(index_type* indices, size_type count)
+{
+	// the popped blocks are still linked, so walk the links to fill the output
+	index_type i = pop_chain(count);
+	for (size_type k = 0; k < count; k++, i = link(i))
+		indices[k] = i;
+	return count;
+}
+
+concurrent_pool::size_type concurrent_pool::allocate_n(void** pointers, size_type count)
+{
+	index_type i = pop_chain(count);
+	for (size_type k = 0; k < count; k++, i = link(i))
+		pointers[k] = pointer(i);
+	return count;
+}
+
+void concurrent_pool::deallocate_n(const index_type* indices, size_type count)
+{
+	if (!count)
+		return;
+	for (size_type k = 1; k < count; k++)
+		link(indices[k-1]) = indices[k];
+	push_chain(indices[0], indices[count-1], count);
+}
+
+void concurrent_pool::deallocate_n(void* const* pointers, size_type count)
+{
+	if (!count)
+		return;
+	for (size_type k = 1; k < count; k++)
+		link(index(pointers[k-1])) = index(pointers[k]);
+	push_chain(index(pointers[0]), index(pointers[count-1]), count);
 }
 
 // convert between allocated index and pointer values
@@ -126,7 +126,7 @@ void* small_block_allocator::allocate(size_t size)
 		if (chunki == chunk_t::nullidx)
 			return nullptr;
 		c = (chunk_t*)chunks_.pointer(chunki);
-		void* mem = align(&c[1], sizeof(void*));
+		void* mem = align(&c[1], 16); // keeps blocks of sizes that are multiples of 16 16-byte aligned
 		const size_t bytes = (chunks_.block_size() - size_t((uint8_t*)mem - (uint8_t*)c));
 		c->pool.initialize(mem, size_type(bytes), size_type(size));
 		c->prev = chunk_t::nullidx;
@@ -144,6 +144,12 @@ void* small_block_allocator::allocate(size_t size)
 	return p;
 }
 
+small_block_allocator::size_type small_block_allocator::block_size(void* ptr) const
+{
+	const chunk_t* c = align_down((const chunk_t*)ptr, chunk_size);
+	return c->pool.block_size();
+}
+
 void small_block_allocator::deallocate(void* ptr)
 {
 	if (!ptr)
@@ -3,9 +3,16 @@
 #include <oBase/unit_test.h>
 
 #include <oCore/countof.h>
+#include <oCore/timer.h>
 #include <oMemory/concurrent_pool.h>
+#include <oMemory/concurrent_chunked_object_pool.h>
 #include <oMemory/concurrent_object_pool.h>
+#include <oMemory/pool_magazine.h>
 #include <oConcurrency/concurrency.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
 #include <vector>
 
 using namespace ouro;
@@ -156,10 +163,202 @@ static void test_concurrency(unit_test::services& services)
 	Allocator.deinitialize();
 }
 
+static void test_allocate_n(unit_test::services& services)
+{
+	static const uint32_t NumBlocks = 20;
+	static const uint32_t BlockSize = sizeof(test_obj);
+	static const uint32_t NumBytes = concurrent_pool::calc_size(NumBlocks, BlockSize);
+	std::vector<char> scopedArena(NumBytes);
+	concurrent_pool Allocator(scopedArena.data(), NumBytes, BlockSize);
+
+	void* tests[NumBlocks];
+	oCHECK(Allocator.allocate_n(tests, 8) == 8, "allocate_n should have allocated 8 blocks");
+	oCHECK(Allocator.count_free() == NumBlocks - 8 && Allocator.size() == 8, "count_free() is %u after allocate_n", Allocator.count_free());
+	oCHECK(Allocator.allocate_n(tests + 8, NumBlocks) == NumBlocks - 8, "allocate_n should have allocated only what's left");
+	oCHECK(Allocator.empty() && Allocator.count_free() == 0, "pool should be empty");
+
+	for (uint32_t i = 0; i < NumBlocks; i++)
+	{
+		oCHECK(Allocator.owns(tests[i]), "allocate_n returned a foreign pointer");
+		for (uint32_t j = 0; j < i; j++)
+			oCHECK(tests[i] != tests[j], "allocate_n returned the same block twice");
+	}
+
+	Allocator.deallocate_n(tests + 1, NumBlocks - 1);
+	Allocator.deallocate(tests[0]);
+	oCHECK(Allocator.full(), "deallocate_n failed");
+
+	concurrent_pool::index_type indices[NumBlocks];
+	oCHECK(Allocator.allocate_n(indices, NumBlocks) == NumBlocks, "allocate_n by index failed");
+	Allocator.deallocate_n(indices, NumBlocks);
+	oCHECK(Allocator.full(), "deallocate_n by index failed");
+}
+
+static void test_magazine(unit_test::services& services)
+{
+	static const uint32_t NumLive = 300;
+	static const uint32_t NumIterations = 20000;
+	static const uint32_t NumHandoffs = NumIterations / 64;
+
+	std::vector<std::thread> threads(std::thread::hardware_concurrency() + 3);
+	std::atomic<uint32_t> failures(0);
+
+	// enough for every thread's live objects, handoffs and a full magazine
+	typedef object_pool_magazine<concurrent_object_pool<test_obj>> magazine_t;
+	const uint32_t NumBlocks = uint32_t(threads.size()) * (NumLive + NumHandoffs + magazine_t::capacity);
+	const uint32_t NumBytes = concurrent_object_pool<test_obj>::calc_size(NumBlocks);
+	std::vector<char> scopedArena(NumBytes);
+	concurrent_object_pool<test_obj> Allocator(scopedArena.data(), NumBytes);
+
+	// each thread keeps a sliding window of live objects, and passes every 64th
+	// one to the next thread's magazine to free
+	std::vector<std::vector<test_obj*>> handoff(threads.size());
+	std::unique_ptr<bool[]> handoff_destroyed(new bool[threads.size()]);
+	std::vector<std::atomic<bool>> handoff_ready(threads.size());
+	for (auto& r : handoff_ready)
+		r = false;
+
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t] = std::thread([&, t]
+		{
+			magazine_t mag(Allocator);
+
+			bool destroyed = false;
+			std::vector<test_obj*> live(NumLive, nullptr);
+			for (uint32_t i = 0; i < NumIterations; i++)
+			{
+				test_obj*& o = live[i % NumLive];
+				if (o)
+				{
+					if (o->Value != i - NumLive)
+						failures++;
+					if ((i & 63) == 0)
+					{
+						o->pDestroyed = &handoff_destroyed[t];
+						handoff[t].push_back(o);
+					}
+					else
+						mag.destroy(o);
+				}
+				o = mag.create(&destroyed);
+				if (!o)
+					failures++;
+				else
+					o->Value = i;
+			}
+
+			for (auto o : live)
+				if (o)
+					mag.destroy(o);
+
+			// free another thread's objects through this thread's magazine
+			handoff_ready[t] = true;
+			const size_t next = (t + 1) % handoff.size();
+			while (!handoff_ready[next])
+				std::this_thread::yield();
+			for (auto o : handoff[next])
+				mag.destroy(o);
+		});
+
+	for (auto& t : threads)
+		t.join();
+
+	oCHECK(failures == 0, "%u allocations failed or were corrupted", failures.load());
+	oCHECK(Allocator.full(), "magazines did not return all blocks (%u outstanding)", Allocator.size());
+}
+
+static void test_chunked(unit_test::services& services)
+{
+	typedef concurrent_chunked_object_pool<uint64_t> pool_t;
+	const uint32_t CAPACITY = 4;
+	const uint32_t BYTES = pool_t::calc_size(CAPACITY);
+	std::vector<uint64_t> buffer(256, 0xcccccccccccccccc);
+	pool_t a;
+	a.initialize(buffer.data(), BYTES, "test_chunked");
+
+	oCHECK(a.full() && a.num_chunks() == 1, "chunked pool did not initialize correctly.");
+
+	std::vector<uint32_t> index;
+	for (uint32_t i = 0; i < CAPACITY * pool_t::max_chunks; i++)
+	{
+		index.push_back(a.allocate_index());
+		oCHECK(index.back() == i, "Allocation mismatch %u.", i);
+		oCHECK(a.index(a.pointer(i)) == i, "pointer %u did not map back to its index", i);
+	}
+
+	oCHECK(a.num_chunks() == pool_t::max_chunks, "chunked pool grew to %u chunks, expected %u", a.num_chunks(), pool_t::max_chunks);
+	oCHECK(a.nullidx == a.allocate_index(), "allocate succeeded past max_chunks");
+
+	for (auto i : index)
+		a.deallocate(a.pointer(i));
+
+	oCHECK(a.full(), "A deallocate failed.");
+	oCHECK(a.deinitialize() == buffer.data(), "deinitialize did not return the initial memory");
+}
+
 oTEST(oMemory_concurrent_pool)
 {
 	test_index_pool<concurrent_pool>(srv);
 	test_allocate<concurrent_pool>(srv);
 	test_create<concurrent_object_pool<test_obj>>(srv);
 	test_concurrency(srv);
+	test_allocate_n(srv);
+	test_magazine(srv);
+	test_chunked(srv);
+}
+
+template<typename FrontT, typename PoolT>
+static double pool_throughput(PoolT& pool, size_t nthreads)
+{
+	static const uint32_t NumOps = 1000000;
+	static const uint32_t NumLive = 64;
+
+	std::vector<std::thread> threads(nthreads);
+	timer t;
+	for (auto& th : threads)
+		th = std::thread([&]
+		{
+			FrontT front(pool);
+			void* live[NumLive] = {};
+			for (uint32_t i = 0; i < NumOps; i++)
+			{
+				void*& p = live[i % NumLive];
+				if (p)
+					front.deallocate(p);
+				p = front.allocate();
+			}
+			for (auto p : live)
+				if (p)
+					front.deallocate(p);
+		});
+	for (auto& th : threads)
+		th.join();
+
+	return double(NumOps) * nthreads / t.seconds() / 1e6;
+}
+
+// forwards directly to the pool to compare against a magazine
+struct direct_pool_front
+{
+	concurrent_pool& pool;
+	direct_pool_front(concurrent_pool& pool) : pool(pool) {}
+	void* allocate() { return pool.allocate(); }
+	void deallocate(void* p) { pool.deallocate(p); }
+};
+
+oBENCHMARK(oMemory_concurrent_pool_throughput)
+{
+	static const uint32_t NumBlocks = 64 * 1024;
+	static const uint32_t BlockSize = 64;
+	const uint32_t NumBytes = concurrent_pool::calc_size(NumBlocks, BlockSize);
+	std::vector<char> scopedArena(NumBytes);
+	concurrent_pool pool(scopedArena.data(), NumBytes, BlockSize);
+
+	const size_t nthreads = std::max(size_t(2), size_t(std::thread::hardware_concurrency()));
+	const double direct = pool_throughput<direct_pool_front>(pool, nthreads);
+	const double cached = pool_throughput<pool_magazine<concurrent_pool>>(pool, nthreads);
+	oCHECK(pool.full(), "blocks were lost");
+
+	srv.trace("%u threads: direct %.1f Mops/s, magazine %.1f Mops/s", uint32_t(nthreads), direct, cached);
+	srv.status("direct %.1f Mops/s, magazine %.1f Mops/s (%u threads)", direct, cached, uint32_t(nthreads));
 }
@@ -0,0 +1,156 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+#include <oBase/unit_test.h>
+
+#include <oMemory/concurrent_ring_allocator.h>
+#include <oCore/byte.h>
+#include <oConcurrency/concurrent_ring_queue.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace ouro;
+
+static void test_basics(unit_test::services& srv)
+{
+	std::vector<uint8_t> buffer(1024 + 16);
+	uint8_t* base = align(buffer.data(), 16);
+	concurrent_ring_allocator a(base, 1024);
+
+	oCHECK(a.full() && a.capacity() == 1024, "should start with no allocations");
+
+	// fill most of the ring as frame 0
+	char* f0 = a.allocate<char>(400);
+	char* f0b = a.allocate<char>(400);
+	oCHECK(f0 == (char*)base && f0b == (char*)base + 400, "allocations should be linear");
+	const auto frame0 = a.marker();
+
+	oCHECK(!a.allocate(400), "allocation should have failed on a full ring");
+	oCHECK(a.get_stats().num_failed_allocations == 1, "failure should be counted");
+
+	// retiring frame 0 makes the whole ring available. The next allocation
+	// doesn't fit at the end, so it wraps.
+	oCHECK(a.retire(frame0), "retire failed");
+	oCHECK(a.full(), "retired ring should be empty");
+	char* f1 = a.allocate<char>(400);
+	oCHECK(f1 == (char*)base, "allocation should have wrapped to the start");
+	oCHECK(a.get_stats().num_wraps == 1, "wrap should be counted");
+	const auto frame1 = a.marker();
+
+	// a stale marker is ignored rather than releasing live memory
+	oCHECK(!a.retire(frame0), "retiring a stale marker should be a noop");
+	oCHECK(a.size() == 400, "stale retire changed the ring");
+
+	// frame 2 wraps behind frame 1 and can't overrun it
+	char* f2 = a.allocate<char>(496);
+	oCHECK(f2 == (char*)base + 400, "allocation should follow the previous frame");
+	const auto frame2 = a.marker();
+	oCHECK(!a.allocate(200), "allocation overran an unretired frame");
+
+	// rewinding undoes allocations after a marker
+	char* tmp = a.allocate<char>(64);
+	oCHECK(tmp == (char*)base + 896, "allocation should follow frame 2");
+	a.rewind(frame2);
+	oCHECK(a.marker() == frame2, "rewind didn't restore the marker");
+
+	a.retire(frame1);
+	char* f3 = a.allocate<char>(300);
+	oCHECK(f3 == (char*)base, "allocation should have wrapped into retired frame 1");
+	oCHECK(a.allocate(1024) == nullptr, "allocation larger than the ring should fail");
+
+	a.retire(frame2);
+	a.retire(a.marker());
+	oCHECK(a.full(), "all frames retired should leave the ring empty");
+	oCHECK(a.get_stats().peak_size >= 900, "peak should reflect the fullest the ring has been");
+
+	void* aligned_ptr = a.allocate(10, 256);
+	oCHECK(aligned(aligned_ptr, 256), "over-aligned allocation is misaligned");
+
+	a.reset();
+	oCHECK(a.full() && a.get_stats().num_wraps == 0, "reset should clear everything");
+}
+
+// A producer fills frames with a pattern while a consumer verifies and then
+// retires them, with up to MaxFramesInFlight frames outstanding.
+static void test_frames(unit_test::services& srv)
+{
+	static const uint32_t NumFrames = 2000;
+	static const uint32_t MaxFramesInFlight = 3;
+	static const size_t RingBytes = 64 * 1024;
+
+	std::vector<uint8_t> buffer(RingBytes + 16);
+	concurrent_ring_allocator a(align(buffer.data(), 16), RingBytes);
+
+	struct frame_t
+	{
+		uint32_t index;
+		uint32_t num_allocations;
+		concurrent_ring_allocator::marker_type marker;
+		uint8_t* allocations[64];
+		uint32_t sizes[64];
+	};
+
+	std::vector<frame_t> frames(MaxFramesInFlight + 1);
+	concurrent_ring_queue<uint32_t> submitted(MaxFramesInFlight + 1), completed(MaxFramesInFlight + 1);
+	for (uint32_t i = 0; i < MaxFramesInFlight; i++)
+		completed.push(i);
+
+	std::atomic<uint32_t> failures(0);
+
+	std::thread consumer([&]
+	{
+		for (uint32_t f = 0; f < NumFrames; f++)
+		{
+			uint32_t slot;
+			submitted.pop(slot);
+			const frame_t& fr = frames[slot];
+			for (uint32_t i = 0; i < fr.num_allocations; i++)
+				for (uint32_t j = 0; j < fr.sizes[i]; j++)
+					if (fr.allocations[i][j] != uint8_t(fr.index + i))
+					{
+						failures++;
+						break;
+					}
+			a.retire(fr.marker);
+			completed.push(slot);
+		}
+	});
+
+	uint32_t seed = 1;
+	for (uint32_t f = 0; f < NumFrames; f++)
+	{
+		uint32_t slot;
+		completed.pop(slot);
+		frame_t& fr = frames[slot];
+		fr.index = f;
+		fr.num_allocations = 1 + f % 64;
+		for (uint32_t i = 0; i < fr.num_allocations; i++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			fr.sizes[i] = 1 + (seed >> 8) % 256;
+
+			// wait for the consumer to retire a frame if the ring is full
+			while (!(fr.allocations[i] = a.allocate<uint8_t>(fr.sizes[i])))
+				std::this_thread::yield();
+
+			memset(fr.allocations[i], uint8_t(f + i), fr.sizes[i]);
+		}
+		fr.marker = a.marker();
+		submitted.push(slot);
+	}
+
+	consumer.join();
+
+	oCHECK(failures == 0, "%u allocations were overwritten before being retired", failures.load());
+	oCHECK(a.full(), "retiring every frame should leave the ring empty");
+
+	const auto stats = a.get_stats();
+	srv.trace("%u frames: peak %u of %u bytes, %u wraps, %u failed allocations"
+		, NumFrames, uint32_t(stats.peak_size), uint32_t(stats.capacity), stats.num_wraps, stats.num_failed_allocations);
+}
+
+oTEST(oMemory_concurrent_ring_allocator)
+{
+	test_basics(srv);
+	test_frames(srv);
+}
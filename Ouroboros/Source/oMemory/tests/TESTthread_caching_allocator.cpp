@@ -0,0 +1,270 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+#include <oBase/unit_test.h>
+
+#include <oCore/byte.h>
+#include <oCore/timer.h>
+#include <oConcurrency/concurrent_ring_queue.h>
+#include <oMemory/thread_caching_allocator.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace ouro;
+
+#define oMB(x) ((x) * 1024ull * 1024ull)
+
+// mostly small sizes with the occasional large one, as in a typical app
+static size_t random_size(uint32_t& seed)
+{
+	seed = seed * 1664525u + 1013904223u;
+	const uint32_t r = seed >> 8;
+	const uint32_t bucket = r % 100;
+	if (bucket < 90)
+		return 1 + (r >> 7) % 512;
+	if (bucket < 99)
+		return 513 + (r >> 7) % (4096 - 512);
+	return 4097 + (r >> 7) % (64 * 1024);
+}
+
+static void fill(void* p, size_t bytes, uint8_t value)
+{
+	memset(p, value, std::min(bytes, size_t(64)));
+}
+
+static bool check(const void* p, size_t bytes, uint8_t value)
+{
+	const uint8_t* b = (const uint8_t*)p;
+	const size_t n = std::min(bytes, size_t(64));
+	for (size_t i = 0; i < n; i++)
+		if (b[i] != value)
+			return false;
+	return true;
+}
+
+static void test_basics(unit_test::services& srv, thread_caching_allocator& a)
+{
+	std::vector<void*> ptrs;
+	for (size_t bytes = 0; bytes <= 3 * thread_caching_allocator::max_small_size; bytes += 7)
+	{
+		void* p = a.allocate(bytes);
+		oCHECK(p, "allocate(%u) failed", bytes);
+		oCHECK(aligned(p, 16), "allocate(%u) is not 16-byte aligned", bytes);
+		oCHECK(a.owns(p), "allocate(%u) returned a pointer the allocator doesn't own", bytes);
+		fill(p, bytes, uint8_t(bytes));
+		ptrs.push_back(p);
+	}
+
+	oCHECK(a.get_stats().num_allocations == ptrs.size(), "stats should count %u allocations", ptrs.size());
+
+	for (size_t i = 0, bytes = 0; i < ptrs.size(); i++, bytes += 7)
+	{
+		oCHECK(check(ptrs[i], bytes, uint8_t(bytes)), "allocation of %u bytes was overwritten", bytes);
+		a.deallocate(ptrs[i]);
+	}
+
+	void* p = a.allocate(100, "aligned", memory_alignment::align256);
+	oCHECK(aligned(p, 256), "over-aligned allocation is misaligned");
+	a.deallocate(p);
+
+	oCHECK(a.get_stats().num_allocations == 0, "allocations remain after freeing everything");
+}
+
+static void test_threads(unit_test::services& srv, thread_caching_allocator& a)
+{
+	static const uint32_t NumIterations = 20000;
+	static const uint32_t NumLive = 200;
+
+	std::vector<std::thread> threads(std::max(4u, std::thread::hardware_concurrency()));
+	std::atomic<uint32_t> failures(0);
+
+	// every 16th allocation is freed by the next thread to exercise remote frees
+	struct handoff_t { void* p; size_t bytes; uint8_t value; };
+	std::vector<std::vector<handoff_t>> handoffs(threads.size());
+	std::vector<std::atomic<bool>> done(threads.size());
+	for (auto& d : done)
+		d = false;
+
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t] = std::thread([&, t]
+		{
+			uint32_t seed = uint32_t(t) + 1;
+			std::vector<handoff_t> live(NumLive, handoff_t());
+			for (uint32_t i = 0; i < NumIterations; i++)
+			{
+				handoff_t& h = live[i % NumLive];
+				if (h.p)
+				{
+					if (!check(h.p, h.bytes, h.value))
+						failures++;
+					if ((i & 15) == 0)
+						handoffs[t].push_back(h);
+					else
+						a.deallocate(h.p);
+				}
+
+				h.bytes = random_size(seed);
+				h.value = uint8_t(t * 31 + i);
+				h.p = a.allocate(h.bytes);
+				if (!h.p)
+					failures++;
+				else
+					fill(h.p, h.bytes, h.value);
+			}
+
+			for (auto& h : live)
+				a.deallocate(h.p);
+
+			done[t] = true;
+			const size_t prev = (t + threads.size() - 1) % threads.size();
+			while (!done[prev])
+				std::this_thread::yield();
+			for (auto& h : handoffs[prev])
+			{
+				if (!check(h.p, h.bytes, h.value))
+					failures++;
+				a.deallocate(h.p);
+			}
+		});
+
+	for (auto& t : threads)
+		t.join();
+
+	oCHECK(failures == 0, "%u allocations failed or were corrupted", failures.load());
+}
+
+oTEST(oMemory_thread_caching_allocator)
+{
+	std::vector<char> arena(oMB(32));
+	void* mem = align(arena.data(), 16);
+	const size_t bytes = arena.size() - 16;
+
+	{
+		bool ExpectedFail = false;
+		try { thread_caching_allocator a(mem, 64 * 1024, oMB(1)); }
+		catch (allocate_error&) { ExpectedFail = true; }
+		oCHECK(ExpectedFail, "initialize should have thrown on an arena that's too small");
+	}
+
+	thread_caching_allocator a(mem, bytes, oMB(16));
+	oCHECK(a.num_slabs() == oMB(16) / thread_caching_allocator::slab_size, "unexpected slab count");
+
+	test_basics(srv, a);
+	test_threads(srv, a);
+
+	// heaps of exited threads should be adopted and remote frees reclaimed
+	oCHECK(a.deinitialize() == mem, "deinitialize failed");
+
+	// the process-wide instance plugs into the allocator interface
+	thread_caching_allocator::global().initialize(mem, bytes, oMB(16));
+	allocator alloc = thread_caching_allocator::global_allocator();
+	int* ints = alloc.construct_array<int>(100, "ints");
+	oCHECK(thread_caching_allocator::global().owns(ints), "global allocator did not allocate");
+	alloc.destroy_array(ints, 100);
+	thread_caching_allocator::global().deinitialize();
+}
+
+struct malloc_front
+{
+	void* allocate(size_t bytes) { return malloc(bytes); }
+	void deallocate(void* p) { free(p); }
+};
+
+struct tca_front
+{
+	thread_caching_allocator* a;
+	void* allocate(size_t bytes) { return a->allocate(bytes); }
+	void deallocate(void* p) { a->deallocate(p); }
+};
+
+// each thread churns a window of live allocations of mixed sizes
+template<typename FrontT>
+static double bench_local(FrontT front, size_t nthreads)
+{
+	static const uint32_t NumOps = 500000;
+	static const uint32_t NumLive = 256;
+
+	std::vector<std::thread> threads(nthreads);
+	timer tm;
+	for (size_t t = 0; t < nthreads; t++)
+		threads[t] = std::thread([&, t]
+		{
+			uint32_t seed = uint32_t(t) + 1;
+			void* live[NumLive] = {};
+			for (uint32_t i = 0; i < NumOps; i++)
+			{
+				void*& p = live[i % NumLive];
+				front.deallocate(p);
+				p = front.allocate(random_size(seed));
+				*(uint8_t*)p = 0;
+			}
+			for (auto p : live)
+				front.deallocate(p);
+		});
+	for (auto& t : threads)
+		t.join();
+
+	return double(NumOps) * nthreads / tm.seconds() / 1e6;
+}
+
+// half the threads allocate and the other half free what they produce
+template<typename FrontT>
+static double bench_producer_consumer(FrontT front, size_t nthreads)
+{
+	static const uint32_t NumOps = 250000;
+	const size_t npairs = std::max(size_t(1), nthreads / 2);
+
+	std::vector<std::thread> threads;
+	std::vector<std::unique_ptr<concurrent_ring_queue<void*>>> queues(npairs);
+	for (auto& q : queues)
+		q.reset(new concurrent_ring_queue<void*>(1024));
+
+	timer tm;
+	for (size_t i = 0; i < npairs; i++)
+	{
+		threads.push_back(std::thread([&, i]
+		{
+			uint32_t seed = uint32_t(i) + 1;
+			for (uint32_t n = 0; n < NumOps; n++)
+				queues[i]->push(front.allocate(random_size(seed)));
+		}));
+
+		threads.push_back(std::thread([&, i]
+		{
+			void* p = nullptr;
+			for (uint32_t n = 0; n < NumOps; n++)
+			{
+				queues[i]->pop(p);
+				front.deallocate(p);
+			}
+		}));
+	}
+	for (auto& t : threads)
+		t.join();
+
+	return double(NumOps) * npairs / tm.seconds() / 1e6;
+}
+
+oBENCHMARK(oMemory_thread_caching_allocator_benchmark)
+{
+	std::vector<char> arena(oMB(512));
+	thread_caching_allocator a(align(arena.data(), 16), arena.size() - 16, oMB(256));
+	tca_front tca = { &a };
+
+	const size_t nthreads = std::max(2u, std::thread::hardware_concurrency());
+
+	const double local_malloc = bench_local(malloc_front(), nthreads);
+	const double local_tca = bench_local(tca, nthreads);
+	const double pc_malloc = bench_producer_consumer(malloc_front(), nthreads);
+	const double pc_tca = bench_producer_consumer(tca, nthreads);
+
+	oCHECK(a.deinitialize(), "allocations were lost");
+
+	srv.trace("%u threads: local churn malloc %.2f Mops/s, thread_caching_allocator %.2f Mops/s", uint32_t(nthreads), local_malloc, local_tca);
+	srv.trace("%u threads: producer/consumer malloc %.2f Mops/s, thread_caching_allocator %.2f Mops/s", uint32_t(nthreads), pc_malloc, pc_tca);
+	srv.status("local: malloc %.2f vs tca %.2f Mops/s, producer/consumer: malloc %.2f vs tca %.2f Mops/s"
+		, local_malloc, local_tca, pc_malloc, pc_tca);
+}
@@ -0,0 +1,512 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+#include <oMemory/thread_caching_allocator.h>
+#include <oCore/byte.h>
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace ouro {
+
+static const std::array<uint16_t, thread_caching_allocator::num_size_classes> sSizeClasses =
+{ {
+	16, 32, 48, 64, 80, 96, 128, 160, 192, 256, 384, 512, 768, 1024, 2048, 4096,
+} };
+
+static_assert(thread_caching_allocator::max_small_size == 4096, "size classes must end at max_small_size");
+
+// bounds the memory a thread cache holds per size class
+static const uint32_t kMaxCachedBytes = 16 * 1024;
+static const uint32_t kMinCachedBlocks = 4;
+
+namespace detail {
+
+// Threads release their heaps on exit, which must not touch an allocator that
+// has since been deinitialized, so live allocators register a unique id.
+static std::mutex& registry_mutex() { static std::mutex m; return m; }
+static std::vector<uint64_t>& registry() { static std::vector<uint64_t> ids; return ids; }
+static std::atomic<uint64_t> sNextID(1);
+
+static bool is_registered(uint64_t id)
+{
+	std::lock_guard<std::mutex> lock(registry_mutex());
+	auto& ids = registry();
+	return std::find(ids.begin(), ids.end(), id) != ids.end();
+}
+
+struct heap_binding
+{
+	thread_caching_allocator* allocator;
+	uint64_t id;
+	uint16_t heap;
+};
+
+struct thread_heap_bindings
+{
+	static const uint32_t capacity = 4;
+
+	thread_heap_bindings() { memset(bindings, 0, sizeof(bindings)); }
+	~thread_heap_bindings()
+	{
+		std::lock_guard<std::mutex> lock(registry_mutex());
+		auto& ids = registry();
+		for (const auto& b : bindings)
+			if (b.allocator && b.heap != thread_caching_allocator::nullidx && std::find(ids.begin(), ids.end(), b.id) != ids.end())
+				b.allocator->release_heap(b.heap);
+	}
+
+	heap_binding bindings[capacity];
+};
+
+static thread_local thread_heap_bindings tls_bindings;
+
+}
+
+// counters only written by the thread bound to a heap don't need a locked rmw
+static void counter_add(std::atomic<size_t>& counter, size_t n)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void thread_caching_allocator::reset_heap(heap_t& h)
+{
+	h.remote = nullptr;
+	h.in_use = 0;
+	h.first_slab = nullidx;
+	h.current_slab = nullidx;
+	h.num_allocations = 0;
+	h.allocated_bytes = 0;
+	memset(h.cache, 0, sizeof(h.cache));
+	memset(h.cache_count, 0, sizeof(h.cache_count));
+}
+
+const std::array<uint16_t, thread_caching_allocator::num_size_classes>& thread_caching_allocator::size_classes()
+{
+	return sSizeClasses;
+}
+
+thread_caching_allocator& thread_caching_allocator::global()
+{
+	// never destroyed so frees during process exit remain valid
+	static std::aligned_storage<sizeof(thread_caching_allocator), alignof(thread_caching_allocator)>::type sStorage;
+	static thread_caching_allocator* sAllocator = new (&sStorage) thread_caching_allocator();
+	return *sAllocator;
+}
+
+void* thread_caching_allocator::global_allocate(size_t bytes, const char* label, const allocate_options& options)
+{
+	return global().allocate(bytes, label, options);
+}
+
+void thread_caching_allocator::global_deallocate(void* ptr)
+{
+	global().deallocate(ptr);
+}
+
+thread_caching_allocator::thread_caching_allocator()
+	: memory_(nullptr)
+	, end_(nullptr)
+	, small_(nullptr)
+	, slabs_(nullptr)
+	, nslabs_(0)
+	, id_(0)
+{
+	for (uint32_t i = 0, c = 0; i < class_of_.size(); i++)
+	{
+		const uint32_t bytes = (i + 1) * 16;
+		while (sSizeClasses[c] < bytes)
+			c++;
+		class_of_[i] = uint8_t(c);
+	}
+
+	for (uint32_t c = 0; c < num_size_classes; c++)
+		cache_limit_[c] = uint16_t(std::max(kMinCachedBlocks, kMaxCachedBytes / sSizeClasses[c]));
+
+	for (auto& h : heaps_)
+		reset_heap(h);
+}
+
+thread_caching_allocator::~thread_caching_allocator()
+{
+	deinitialize();
+}
+
+void thread_caching_allocator::initialize(void* memory, size_t bytes, size_t small_bytes)
+{
+	if (!memory)
+		throw allocate_error(allocate_errc::invalid_bookkeeping);
+
+	if (!aligned(memory, 16))
+		throw allocate_error(allocate_errc::alignment);
+
+	if (memory_)
+		throw allocate_error(allocate_errc::invalid);
+
+	// slab indices are 16-bit and the slab pool's arena size is 32-bit
+	const size_t max_slabs = std::min(size_t(nullidx - 1), size_t(0xffffffff / slab_size));
+	const size_t nslabs = std::min(small_bytes / slab_size, max_slabs);
+
+	// small_block_allocator requires chunk-aligned memory
+	uint8_t* base = (uint8_t*)memory;
+	const size_t small_offset = size_t(align(base + sizeof(slab_t) * nslabs, small_block_allocator::chunk_size) - base);
+	const size_t large_offset = small_offset + nslabs * slab_size;
+
+	if (!nslabs || large_offset > bytes || (bytes - large_offset) < min_large_bytes)
+		throw allocate_error(allocate_errc::invalid_capacity);
+
+	large_.initialize(base + large_offset, bytes - large_offset);
+
+	slabs_ = (slab_t*)base;
+	for (size_t i = 0; i < nslabs; i++)
+		new (slabs_ + i) slab_t();
+
+	small_ = base + small_offset;
+	nslabs_ = uint32_t(nslabs);
+	free_slabs_.initialize(small_, uint32_t(nslabs * slab_size), slab_size);
+
+	memory_ = base;
+	end_ = base + bytes;
+
+	id_ = detail::sNextID++;
+	std::lock_guard<std::mutex> lock(detail::registry_mutex());
+	detail::registry().push_back(id_);
+}
+
+void* thread_caching_allocator::deinitialize()
+{
+	if (!memory_)
+		return nullptr;
+
+	// reclaim any remote frees and empty the caches so that the slab counts are exact
+	for (auto& h : heaps_)
+	{
+		heap_reclaim(h);
+		for (uint8_t c = 0; c < num_size_classes; c++)
+			flush_cache(h, c, h.cache_count[c]);
+	}
+
+	for (uint32_t i = 0; i < nslabs_; i++)
+		if (slabs_[i].live)
+			throw allocate_error(allocate_errc::outstanding_allocations);
+
+	large_.deinitialize(); // throws on outstanding allocations
+
+	{
+		std::lock_guard<std::mutex> lock(detail::registry_mutex());
+		auto& ids = detail::registry();
+		ids.erase(std::remove(ids.begin(), ids.end(), id_), ids.end());
+	}
+
+	for (uint32_t i = 0; i < nslabs_; i++)
+	{
+		if (slabs_[i].heap != nullidx)
+			slabs_[i].sba.deinitialize();
+		slabs_[i].~slab_t();
+	}
+
+	free_slabs_.deinitialize();
+
+	for (auto& h : heaps_)
+		reset_heap(h);
+
+	void* memory = memory_;
+	memory_ = end_ = small_ = nullptr;
+	slabs_ = nullptr;
+	nslabs_ = 0;
+	id_ = 0;
+	return memory;
+}
+
+allocator_stats thread_caching_allocator::get_stats() const
+{
+	allocator_stats s;
+	if (!memory_)
+		return s;
+
+	{
+		std::lock_guard<std::mutex> lock(large_mutex_);
+		s = large_.get_stats();
+	}
+
+	for (const auto& h : heaps_)
+	{
+		s.num_allocations += h.num_allocations.load(std::memory_order_relaxed);
+		s.allocated_bytes += h.allocated_bytes.load(std::memory_order_relaxed);
+	}
+
+	s.capacity_bytes += size_t(nslabs_) * slab_size;
+	return s;
+}
+
+void* thread_caching_allocator::allocate(size_t bytes, const char* label, const allocate_options& options)
+{
+	if (bytes <= max_small_size && options.alignment_bytes() <= 16)
+	{
+		const uint16_t heap = this_heap(true);
+		if (heap != nullidx)
+		{
+			void* p = heap_allocate(heaps_[heap], heap, class_of_[bytes ? (bytes - 1) / 16 : 0]);
+			if (p)
+				return p;
+		}
+	}
+
+	return large_allocate(bytes, label, options);
+}
+
+void thread_caching_allocator::deallocate(void* ptr)
+{
+	if (!ptr)
+		return;
+
+	if (!is_small(ptr))
+	{
+		large_deallocate(ptr);
+		return;
+	}
+
+	const uint16_t owner = slabs_[slab_of(ptr)].heap;
+	heap_t& h = heaps_[owner];
+	if (owner == this_heap(false))
+		heap_deallocate(h, ptr);
+
+	else
+	{
+		void* head = h.remote.load(std::memory_order_relaxed);
+		do { *(void**)ptr = head;
+		} while (!h.remote.compare_exchange_weak(head, ptr, std::memory_order_release, std::memory_order_relaxed));
+	}
+}
+
+uint16_t thread_caching_allocator::this_heap(bool bind)
+{
+	auto& bindings = detail::tls_bindings.bindings;
+	for (const auto& b : bindings)
+		if (b.allocator == this && b.id == id_)
+			return b.heap;
+
+	if (!bind)
+		return nullidx;
+
+	// reuse an empty slot or one for an allocator that has been deinitialized
+	for (auto& b : bindings)
+	{
+		if (!b.allocator || !detail::is_registered(b.id) || b.allocator == this)
+		{
+			b.allocator = this;
+			b.id = id_;
+			b.heap = acquire_heap();
+			return b.heap;
+		}
+	}
+
+	// too many allocators used by this thread: service it from the large heap
+	return nullidx;
+}
+
+uint16_t thread_caching_allocator::acquire_heap()
+{
+	for (uint16_t i = 0; i < max_heaps; i++)
+	{
+		heap_t& h = heaps_[i];
+		uint32_t expected = 0;
+		if (!h.in_use.load(std::memory_order_relaxed) && h.in_use.compare_exchange_strong(expected, 1, std::memory_order_acquire))
+		{
+			// adopt whatever a prior thread left behind
+			heap_reclaim(h);
+			return i;
+		}
+	}
+
+	return nullidx;
+}
+
+void thread_caching_allocator::release_heap(uint16_t heap)
+{
+	heaps_[heap].in_use.store(0, std::memory_order_release);
+}
+
+void* thread_caching_allocator::heap_allocate(heap_t& h, uint16_t heap, uint8_t size_class)
+{
+	const uint16_t size = sSizeClasses[size_class];
+	void* p = h.cache[size_class];
+	if (p)
+	{
+		h.cache[size_class] = *(void**)p;
+		h.cache_count[size_class]--;
+	}
+
+	else
+	{
+		p = slab_allocate(h, heap, size);
+		if (!p)
+			return nullptr;
+	}
+
+	counter_add(h.num_allocations, 1);
+	counter_add(h.allocated_bytes, size);
+	return p;
+}
+
+void thread_caching_allocator::heap_deallocate(heap_t& h, void* ptr)
+{
+	const uint16_t size = uint16_t(slabs_[slab_of(ptr)].sba.block_size(ptr));
+	const uint8_t size_class = class_of_[(size - 1) / 16];
+	counter_add(h.num_allocations, size_t(-1));
+	counter_add(h.allocated_bytes, 0 - size_t(size));
+
+	// return half rather than one so alternating frees and allocs don't thrash
+	if (h.cache_count[size_class] == cache_limit_[size_class])
+		flush_cache(h, size_class, cache_limit_[size_class] / 2);
+
+	*(void**)ptr = h.cache[size_class];
+	h.cache[size_class] = ptr;
+	h.cache_count[size_class]++;
+}
+
+bool thread_caching_allocator::heap_reclaim(heap_t& h)
+{
+	void* p = h.remote.exchange(nullptr, std::memory_order_acquire);
+	if (!p)
+		return false;
+
+	while (p)
+	{
+		void* next = *(void**)p;
+		heap_deallocate(h, p);
+		p = next;
+	}
+
+	return true;
+}
+
+void thread_caching_allocator::flush_cache(heap_t& h, uint8_t size_class, uint32_t count)
+{
+	void* p = h.cache[size_class];
+	for (uint32_t i = 0; i < count && p; i++)
+	{
+		void* next = *(void**)p;
+		slab_deallocate(h, p);
+		p = next;
+		h.cache_count[size_class]--;
+	}
+	h.cache[size_class] = p;
+}
+
+void* thread_caching_allocator::slab_allocate(heap_t& h, uint16_t heap, uint16_t size)
+{
+	for (;;)
+	{
+		if (h.current_slab != nullidx)
+		{
+			slab_t& s = slabs_[h.current_slab];
+			void* p = s.sba.allocate(size);
+			if (p)
+			{
+				s.live++;
+				return p;
+			}
+		}
+
+		// the current slab has no room for this size, so try the heap's others
+		for (uint16_t i = h.first_slab; i != nullidx; i = slabs_[i].next)
+		{
+			if (i == h.current_slab)
+				continue;
+
+			slab_t& s = slabs_[i];
+			void* p = s.sba.allocate(size);
+			if (p)
+			{
+				h.current_slab = i;
+				s.live++;
+				return p;
+			}
+		}
+
+		// then try again with what other threads have freed, then a new slab
+		if (!heap_reclaim(h) && !claim_slab(h, heap))
+			return nullptr;
+
+		// reclaimed blocks may have landed in the cache
+		const uint8_t size_class = class_of_[(size - 1) / 16];
+		void* p = h.cache[size_class];
+		if (p)
+		{
+			h.cache[size_class] = *(void**)p;
+			h.cache_count[size_class]--;
+			return p;
+		}
+	}
+}
+
+void thread_caching_allocator::slab_deallocate(heap_t& h, void* ptr)
+{
+	const uint16_t slab = slab_of(ptr);
+	slab_t& s = slabs_[slab];
+	s.sba.deallocate(ptr);
+
+	// keep the current slab around to avoid thrashing when one block is
+	// repeatedly allocated and freed
+	if (--s.live == 0 && slab != h.current_slab)
+		release_slab(h, slab);
+}
+
+bool thread_caching_allocator::claim_slab(heap_t& h, uint16_t heap)
+{
+	void* mem = free_slabs_.allocate();
+	if (!mem)
+		return false;
+
+	const uint16_t slab = slab_of(mem);
+	slab_t& s = slabs_[slab];
+	s.sba.initialize(mem, slab_size, sSizeClasses.data(), num_size_classes);
+	s.heap = heap;
+	s.live = 0;
+	s.next = h.first_slab;
+	h.first_slab = slab;
+	h.current_slab = slab;
+	return true;
+}
+
+void thread_caching_allocator::release_slab(heap_t& h, uint16_t slab)
+{
+	slab_t& s = slabs_[slab];
+
+	if (h.first_slab == slab)
+		h.first_slab = s.next;
+	else
+	{
+		uint16_t prev = h.first_slab;
+		while (slabs_[prev].next != slab)
+			prev = slabs_[prev].next;
+		slabs_[prev].next = s.next;
+	}
+
+	void* mem = s.sba.deinitialize();
+	s.heap = nullidx;
+	s.next = nullidx;
+	free_slabs_.deallocate(mem);
+}
+
+void* thread_caching_allocator::large_allocate(size_t bytes, const char* label, const allocate_options& options)
+{
+	if (!memory_)
+		throw allocate_error(allocate_errc::invalid);
+
+	std::lock_guard<std::mutex> lock(large_mutex_);
+	return large_.allocate(bytes, label, options);
+}
+
+void thread_caching_allocator::large_deallocate(void* ptr)
+{
+	if (!large_.owns(ptr))
+		throw allocate_error(allocate_errc::invalid_ptr);
+
+	std::lock_guard<std::mutex> lock(large_mutex_);
+	large_.deallocate(ptr);
+}
+
+}
@@ -104,7 +104,8 @@ void* tlsf_allocator::allocate(size_t bytes, const char* label, const allocate_o
 	#endif
 
 	size_t align = options.alignment_bytes();
-	void* p = align == 16 ? tlsf_malloc(heap_, bytes) : tlsf_memalign(heap_, align, bytes);
+	// tlsf_malloc only guarantees pointer alignment
+	void* p = align <= sizeof(void*) ? tlsf_malloc(heap_, bytes) : tlsf_memalign(heap_, align, bytes);
 	if (p)
 	{
 		size_t block_size = tlsf_block_size(p);
@@ -806,6 +806,7 @@ unsigned long long XXH64_digest (void* state_in)
 
 //-----------------------------------------------------------------------------
 // wrapper stuff
+#include <oMemory/xxhash.h>
 #include <stdexcept>
 #include <cstdint>
 
@@ -825,4 +826,28 @@ uint64_t xxhash64(const void* buf, size_t buf_size, uint64_t seed)
 	return XXH64(buf, static_cast<uint32_t>(buf_size), seed);
 }
 
-}
\ No newline at end of file
+void xxhash32_stream::reset(uint32_t seed)
+{
+	static_assert(sizeof(state_) >= XXH32_SIZEOFSTATE, "xxhash32_stream state is too small");
+	XXH32_resetState(state_, seed);
+}
+
+void xxhash32_stream::update(const void* buf, size_t buf_size)
+{
+	// feed pieces the C interface can take
+	const uint8_t* p = static_cast<const uint8_t*>(buf);
+	while (buf_size)
+	{
+		const uint32_t n = static_cast<uint32_t>(buf_size < 0x40000000 ? buf_size : 0x40000000);
+		XXH32_update(state_, p, n);
+		p += n;
+		buf_size -= n;
+	}
+}
+
+uint32_t xxhash32_stream::digest() const
+{
+	return XXH32_intermediateDigest(const_cast<uint64_t*>(state_));
+}
+
+}
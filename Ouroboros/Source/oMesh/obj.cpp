@@ -1,9 +1,13 @@
 // Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
 
 #include <oMesh/obj.h>
+#include <oConcurrency/concurrency.h>
+#include <oCore/bit.h>
 #include <oString/atof.h> // fast-path float parsing
 #include <oString/string.h>
 #include <oString/string_fast_scan.h> // fast-path string parsing
+#include <atomic>
+#include <emmintrin.h>
 
 oDEFINE_WHITESPACE_PARSING();
 
@@ -51,14 +55,275 @@ obj::obj(const init_t& init)
 	, init_(init)
 {}
 
-static void atof3(const char** oRESTRICT pp_str, float3* oRESTRICT vec)
+// Parsing is split into chunks at line boundaries. A first pass counts the
+// elements defined in each chunk so a second can parse all chunks in parallel 
+// straight into place, resolving relative indices as a serial parse would. 
+// Face vertices are then deduplicated through a concurrent hash that keeps the
+// first occurrence of each, so the result is identical to a serial parse.
+
+static const size_t   min_chunk_bytes = 256 * 1024;
+static const uint32_t max_chunks      = 64;
+
+struct vertex_key
+{
+	uint32_t pos, tex, nrm;
+	bool operator==(const vertex_key& that) const { return pos == that.pos && tex == that.tex && nrm == that.nrm; }
+};
+
+static inline uint32_t hash(const vertex_key& key)
+{
+	uint64_t h = (key.pos * 0x9e3779b97f4a7c15ull) ^ (key.tex * 0xc2b2ae3d27d4eb4full) ^ (key.nrm * 0x165667b19e3779f9ull);
+	return uint32_t(h >> 32) ^ uint32_t(h);
+}
+
+struct corner_t
+{
+	vertex_key key;
+	uint32_t   slot;   // in the vertex map
+	bool       no_tex; // tex/nrm weren't defined when the face was so they're 0
+	bool       no_nrm;
+};
+
+// a g, usemtl or mtllib line, applied in order once all chunks are parsed
+struct scope_t
+{
+	char        type;
+	uint32_t    num_corners; // counts in the chunk up to this line
+	uint32_t    num_tex;
+	uint32_t    num_nrm;
+	const char* arg;
+};
+
+typedef std::vector<corner_t, ouro_std_allocator<corner_t>> corner_vector;
+typedef std::vector<scope_t,  ouro_std_allocator<scope_t>>  scope_vector;
+
+struct obj_chunk
+{
+	obj_chunk(const allocator& alloc, const char* begin, const char* end)
+		: begin(begin)
+		, end(end)
+		, aabb_min( FLT_MAX)
+		, aabb_max(-FLT_MAX)
+		, corners(corner_vector::allocator_type(alloc, "obj chunk corners"))
+		, scopes(scope_vector::allocator_type(alloc, "obj chunk scopes"))
+		, error(nullptr)
+	{
+		num.pos = num.tex = num.nrm = 0;
+	}
+
+	const char*   begin;
+	const char*   end;
+	vertex_key    num;  // elements defined in the chunk
+	vertex_key    base; // elements defined before the chunk
+	uint32_t      corner_base;
+	uint32_t      vertex_base;
+	uint32_t      num_vertices;
+	float3        aabb_min;
+	float3        aabb_max;
+	corner_vector corners;
+	scope_vector  scopes;
+	const char*   error;
+};
+
+struct vertex_slot
+{
+	std::atomic<uint32_t> first; // 1 + ordinal of the key's first corner, 0 if empty
+	vertex_key            key;
+	uint32_t              vertex;
+};
+
+// move_to_line_end 16 characters at a time that won't read past end
+static inline void move_to_line_end_sse2(const char** pp_str, const char* end)
+{
+	const __m128i nl = _mm_set1_epi8('\n');
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i nul = _mm_setzero_si128();
+
+	const char* s = *pp_str;
+	while (end - s >= 16)
+	{
+		const __m128i c = _mm_loadu_si128((const __m128i*)s);
+		const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, nl), _mm_cmpeq_epi8(c, cr)), _mm_cmpeq_epi8(c, nul)));
+		if (mask)
+		{
+			*pp_str = s + bitlow(uint32_t(mask));
+			return;
+		}
+		s += 16;
+	}
+
+	while (s < end && *s && !is_newline(*s))
+		s++;
+	*pp_str = s;
+}
+
+// atof ends by scaling its mantissa with pow(10, decexp), which dominates the
+// cost of short numbers. The fast path only produces a small range of exponents
+// so cache what pow/frexp return for those.
+struct pow10_table
+{
+	static const int min_exp = -18;
+	double mantissa[1 - min_exp];
+	int    exponent[1 - min_exp];
+
+	pow10_table()
+	{
+		for (int i = min_exp; i <= 0; i++)
+		{
+			int e;
+			mantissa[i - min_exp] = 2.0 * frexp(pow(10.0, i), &e);
+			exponent[i - min_exp] = e - 1;
+		}
+	}
+};
+
+static const pow10_table s_pow10;
+
+// the tail of atof: encodes value * 10^decexp as atof would for the range of 
+// values the fast path parses, which can't over- or underflow.
+static float encode_float(uint32_t value, int decexp, bool negative)
+{
+	uint32_t bits = 0;
+	if (value)
+	{
+		while (value <= 0x19999999)
+		{
+			decexp--;
+			value *= 10;
+		}
+
+		int binexp = 0;
+		if (decexp)
+		{
+			if (value & 0x80000000)
+			{
+				value >>= 1;
+				binexp++;
+			}
+
+			value = uint32_t(floor(value * s_pow10.mantissa[decexp - pow10_table::min_exp]));
+			binexp += s_pow10.exponent[decexp - pow10_table::min_exp];
+		}
+
+		binexp += 23;
+
+		while (value & 0xfe000000)
+		{
+			value >>= 1;
+			binexp++;
+		}
+
+		if (value & 0x01000000)
+		{
+			if (value & 1)
+				value++;
+			value >>= 1;
+			binexp++;
+			if (value & 0x01000000)
+			{
+				value >>= 1;
+				binexp++;
+			}
+		}
+
+		while (!(value & 0x00800000))
+		{
+			value <<= 1;
+			binexp--;
+		}
+
+		bits = (value & 0x007fffff) | (uint32_t(binexp + 127) << 23);
+	}
+
+	bits |= uint32_t(negative) << 31;
+
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+// converts n <= 8 digits to their value all at once
+static inline uint32_t parse_digits(const char* s, uint32_t n)
+{
+	if (!n)
+		return 0;
+
+	uint64_t v;
+	memcpy(&v, s, sizeof(v));
+	v -= 0x3030303030303030ull;
+	v <<= 8 * (8 - n); // shift out what follows the digits leaving leading zeros
+	v = (v * 10    + (v >> 8))  & 0x00ff00ff00ff00ffull;
+	v = (v * 100   + (v >> 16)) & 0x0000ffff0000ffffull;
+	v = (v * 10000 + (v >> 32)) & 0x00000000ffffffffull;
+	return uint32_t(v);
+}
+
+// Parses the usual [+-]digits[.digits] with 9 digits or less by finding the 
+// digits with SSE2 and converting them without a loop. Anything else is left to
+// atof, and the result is identical either way.
+static bool fast_atof(const char** oRESTRICT pp_str, const char* end, float* oRESTRICT val)
+{
+	static const uint32_t pow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000 };
+
+	const char* s = *pp_str;
+	while (*s == ' ')
+		s++;
+
+	if (end - s >= 32)
+	{
+		const bool negative = *s == '-';
+		const char* digits = s + (negative || *s == '+');
+
+		const __m128i c = _mm_loadu_si128((const __m128i*)digits);
+		const uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1))));
+		const uint32_t nint = bitlow(~mask);
+
+		const char* frac = digits + nint;
+		uint32_t nfrac = 0;
+		if (*frac == '.')
+		{
+			nfrac = bitlow(~(mask >> (nint + 1)));
+			frac++;
+		}
+
+		const char* tail = frac + nfrac;
+		const uint32_t ndigits = nint + nfrac;
+		if (ndigits && ndigits <= 9 && nint <= 8 && nfrac <= 8 && *tail != '.' && *tail != ',' && *tail != 'e' && *tail != 'E')
+		{
+			*val = encode_float(parse_digits(digits, nint) * pow10[nfrac] + parse_digits(frac, nfrac), -int(nfrac), negative);
+			*pp_str = tail;
+			return true;
+		}
+	}
+
+	return atof(pp_str, val);
+}
+
+static void atof3(const char** oRESTRICT pp_str, const char* end, float3* oRESTRICT vec)
 {
-	     atof(pp_str, &vec->x);
-	     atof(pp_str, &vec->y);
-	if (!atof(pp_str, &vec->z))
+	     fast_atof(pp_str, end, &vec->x);
+	     fast_atof(pp_str, end, &vec->y);
+	if (!fast_atof(pp_str, end, &vec->z))
 		vec->z = 0.0f;
 }
 
+// atoi for face indices, which are always in range
+static int32_t parse_int(const char* s)
+{
+	while (*s == ' ' || (*s >= '\t' && *s <= '\r'))
+		s++;
+
+	const bool negative = *s == '-';
+	if (negative || *s == '+')
+		s++;
+
+	uint32_t n = 0;
+	while (*s >= '0' && *s <= '9')
+		n = n * 10 + (*s++ - '0');
+
+	return int32_t(negative ? 0u - n : n);
+}
+
 static uint32_t adjust_index(int32_t index, int32_t num_vertices)
 {
 	if (index > 0)
@@ -86,12 +351,12 @@ static void parse_string(const char** oRESTRICT pp_str, char* oRESTRICT dst, siz
 
 template<size_t size> static inline void parse_string(const char** pp_str, char (&dst)[size]) { parse_string(pp_str, dst, size); }
 
-void obj::parse_index(const char** oRESTRICT pp_str, const index_t& counts, index_t* oRESTRICT index)
+static void parse_index(const char** oRESTRICT pp_str, const vertex_key& counts, vertex_key* oRESTRICT index)
 {
 	// p  p/t  p//n  p/t/n
 
 	move_past_line_whitespace(pp_str);
-	index->pos = adjust_index(atoi(*pp_str), counts.pos);
+	index->pos = adjust_index(parse_int(*pp_str), counts.pos);
 	index->tex = uint32_t(-1);
 	index->nrm = uint32_t(-1);
 	move_past_number(pp_str);
@@ -102,55 +367,105 @@ void obj::parse_index(const char** oRESTRICT pp_str, const index_t& counts, inde
 		if (**pp_str == '/') // p//n
 		{
 			(*pp_str)++; move_past_line_whitespace(pp_str);
-			index->nrm = adjust_index(atoi(*pp_str), counts.nrm);
+			index->nrm = adjust_index(parse_int(*pp_str), counts.nrm);
 		}
 		else // p/t  p/t/n
-			index->tex = adjust_index(atoi(*pp_str), counts.tex);
+			index->tex = adjust_index(parse_int(*pp_str), counts.tex);
 
 		move_past_number(pp_str);
 		if (**pp_str == '/') // p/t/n
 		{
 			(*pp_str)++;
-			index->nrm = adjust_index(atoi(*pp_str), counts.nrm);
+			index->nrm = adjust_index(parse_int(*pp_str), counts.nrm);
 			move_past_number(pp_str);
 		}
 	} // else p
 }
 
-uint32_t obj::push_vertex(const index_t& ptn, index_map& map, const float3_vector& psrc, const float3_vector& tsrc, const float3_vector& nsrc)
+// Calls fn(c, &cur) for each line in [cur,end) with its first character after
+// leading whitespace and cur just past it. Lines are stepped exactly as one
+// serial pass over the whole file would, without reading past its end. fn 
+// returns false to stop.
+template<typename fn_t>
+static void walk_lines(const char* cur, const char* end, const char* buffer_end, const fn_t& fn)
 {
-	if (ptn.pos >= (uint32_t)psrc.size())
-		throw std::invalid_argument("invalid position index");
+	while (cur < end)
+	{
+		move_past_line_whitespace(&cur);
+		const char c = *cur++;
+		if (!fn(c, &cur))
+			return;
+		move_to_line_end_sse2(&cur, buffer_end);
+		while (cur < buffer_end && is_newline(*cur))
+			cur++;
+	}
+}
 
-	uint32_t index;
-	auto it = map.find(ptn);
-	if (it != map.end())
-		index = it->second;
-	else
+// Returns the start of the first line at or after p that a serial parse would
+// also start at: just past the newlines ending a line with something on it. A
+// line of only whitespace followed by a single '\n' hides the line after it.
+static const char* next_line_start(const char* p, const char* begin, const char* end)
+{
+	while (p < end)
 	{
-		map[ptn] = index = (uint32_t)positions_.size();
+		while (p < end && !is_newline(*p))
+			p++;
+
+		if (p == end)
+			break;
+
+		const char* line = p;
+		while (line > begin && !is_newline(line[-1]))
+			line--;
 
-		positions_.push_back(psrc[ptn.pos]);
-		texcoords_.push_back((ptn.tex < (uint32_t)tsrc.size()) ? tsrc[ptn.tex] : float3(0.0f));
-		normals_  .push_back((ptn.nrm < (uint32_t)nsrc.size()) ? nsrc[ptn.nrm] : float3(0.0f));
+		bool blank = true;
+		for (; line < p && blank; line++)
+			blank = !!is_line_whitespace(*line);
+
+		while (p < end && is_newline(*p))
+			p++;
+
+		if (!blank)
+			return p;
 	}
 
-	return index;
+	return end;
 }
 
-void obj::push_triangle(const index_t& ptn_a, const index_t& ptn_b, const index_t& ptn_c, index_map& map, const float3_vector& psrc, const float3_vector& tsrc, const float3_vector& nsrc)
+// finds or inserts key, keeping the lowest first corner ordinal and returning its slot
+static uint32_t insert_corner(vertex_slot* slots, uint32_t mask, const vertex_key& key, uint32_t first)
 {
-	indices_.push_back(push_vertex(ptn_a, map, psrc, tsrc, nsrc));
-	indices_.push_back(push_vertex(ptn_b, map, psrc, tsrc, nsrc));
-	indices_.push_back(push_vertex(ptn_c, map, psrc, tsrc, nsrc));
+	static const uint32_t claimed = ~0u;
+
+	for (uint32_t i = hash(key) & mask;; i = (i + 1) & mask)
+	{
+		auto& slot = slots[i];
+		uint32_t f = slot.first.load(std::memory_order_acquire);
+		if (f == 0 && slot.first.compare_exchange_strong(f, claimed, std::memory_order_acquire))
+		{
+			slot.key = key;
+			slot.first.store(first, std::memory_order_release);
+			return i;
+		}
+
+		while (f == claimed)
+		{
+			_mm_pause();
+			f = slot.first.load(std::memory_order_acquire);
+		}
+
+		if (slot.key == key)
+		{
+			while (first < f && !slot.first.compare_exchange_weak(f, first, std::memory_order_relaxed)) {}
+			return i;
+		}
+	}
 }
 
 void obj::parse(const char* oRESTRICT path, const void* oRESTRICT data, size_t data_size)
 {
-	const auto option           = init_.option;
 	const auto flip_handedness  = !right_handed();
 	const auto est_num_indices  = init_.est_num_indices;
-	const auto est_num_vertices = init_.est_num_vertices;
 	const auto temp_alloc       = init_.temp_alloc;
 
 	// reinitialize final storage
@@ -159,144 +474,317 @@ void obj::parse(const char* oRESTRICT path, const void* oRESTRICT data, size_t d
 	aabb_min_    = float3( FLT_MAX);
 	aabb_max_    = float3(-FLT_MAX);
 
-	indices_  .clear(); indices_  .reserve(est_num_indices);
-	positions_.clear(); positions_.reserve(est_num_vertices);
-	texcoords_.clear(); texcoords_.reserve(est_num_vertices);
-	normals_  .clear(); normals_  .reserve(est_num_vertices);
-	groups_   .clear(); groups_   .reserve(16);
+	indices_  .clear();
+	positions_.clear();
+	texcoords_.clear();
+	normals_  .clear();
+	groups_   .clear(); groups_.reserve(16);
 
-	// initialize temp containers
-	float3_vector pos(float3_vector::allocator_type(temp_alloc, "obj temp positions"));
-	float3_vector tex(float3_vector::allocator_type(temp_alloc, "obj temp texcoords"));
-	float3_vector nrm(float3_vector::allocator_type(temp_alloc, "obj temp normals"  ));
+	// split into chunks at line boundaries
+	const char* buffer = (const char*)data;
+	const char* end    = buffer + data_size;
 
-	pos.reserve(est_num_vertices);
-	tex.reserve(est_num_vertices);
-	nrm.reserve(est_num_vertices);
+	const uint32_t num_splits = (uint32_t)std::max(size_t(1), std::min(size_t(max_chunks), data_size / min_chunk_bytes));
+	std::vector<obj_chunk> chunks;
+	chunks.reserve(num_splits);
+	{
+		const char* begin = buffer;
+		for (uint32_t i = 1; i <= num_splits && begin < end; i++)
+		{
+			const char* split = i == num_splits ? end : next_line_start(buffer + data_size * i / num_splits, buffer, end);
+			if (split > begin)
+			{
+				chunks.emplace_back(temp_alloc, begin, split);
+				chunks.back().corners.reserve(est_num_indices / num_splits);
+				begin = split;
+			}
+		}
+	}
 
-	// initialize a linear allocator for index map - we won't be freeing entries individually
-	size_t   index_map_bytes  = est_num_indices * sizeof(index_map::value_type);
-	auto     index_map_memory = temp_alloc.scoped_allocate(index_map_bytes, "index_map linear_allocator");
+	const uint32_t num_chunks = (uint32_t)chunks.size();
 
-	// reindex from obj's flat list into one where all elements have the same index
-	linear_allocator index_map_linear_alloc(index_map_memory, index_map_bytes);
-	index_map        map(0, index_map::hasher(), index_map::key_equal(), allocator_type(&index_map_linear_alloc, &index_map_bytes));
+	// count elements so each chunk knows where its elements go
+	parallel_for(0, num_chunks, [&](size_t index)
+	{
+		auto& chunk = chunks[index];
+		walk_lines(chunk.begin, chunk.end, end, [&](char c, const char** pp_str)
+		{
+			switch (c)
+			{
+				case 'v':
+					switch (*(*pp_str)++)
+					{
+						case ' ': chunk.num.pos++; break;
+						case 't': chunk.num.tex++; break;
+						case 'n': chunk.num.nrm++; break;
+						default: break;
+					}
+					break;
+				case 'u': case 'm':
+					*pp_str += 6;
+					break;
+				default:
+					break;
+			}
+			return true;
+		});
+	});
 
-	// scope tracking
-	group_t     group;
-	            group.material[0]   = '\0';
-	            group.start_index   = 0;
-	            group.num_indices   = 0;
-							group.has_normals   = false;
-							group.has_texcoords = false;
-	            strlcpy(group.name, "default");
-	uint32_t    num_groups          = 0;
+	vertex_key totals = { 0, 0, 0 };
+	for (auto& chunk : chunks)
+	{
+		chunk.base = totals;
+		totals.pos += chunk.num.pos;
+		totals.tex += chunk.num.tex;
+		totals.nrm += chunk.num.nrm;
+	}
 
-	// read head
-	const char* cur                 = (const char*)data;
-	const char* end                 = cur + data_size;
+	float3_vector pos(totals.pos, float3(0.0f), float3_vector::allocator_type(temp_alloc, "obj temp positions"));
+	float3_vector tex(totals.tex, float3(0.0f), float3_vector::allocator_type(temp_alloc, "obj temp texcoords"));
+	float3_vector nrm(totals.nrm, float3(0.0f), float3_vector::allocator_type(temp_alloc, "obj temp normals"  ));
 
-	while (cur < end)
+	// parse each chunk into place, recording faces as corners and scope changes for later
+	parallel_for(0, num_chunks, [&](size_t index)
 	{
-		move_past_line_whitespace(&cur);
+		auto& chunk = chunks[index];
+		vertex_key n = { 0, 0, 0 };
 
-		switch (*cur++)
+		auto push_triangle = [&](const vertex_key& counts, const vertex_key& a, const vertex_key& b, const vertex_key& c)
 		{
-			case 'v':
+			const vertex_key* ptns[3] = { &a, &b, &c };
+			for (const auto* ptn : ptns)
 			{
-				float3 vec;
-				switch (*cur++)
+				if (ptn->pos >= counts.pos)
 				{
-					case ' ':
-						atof3(&cur, &vec);
-						if (flip_handedness) vec.z = -vec.z;
-						pos.push_back(vec);
-						aabb_min_ = min(aabb_min_, vec);
-						aabb_max_ = max(aabb_max_, vec);
-						break;
-					case 't':
-						atof3(&cur, &vec);
-						if (flip_handedness) vec.y = 1.0f - vec.y;
-						tex.push_back(vec);
-						group.has_texcoords = true;
-						break;
-					case 'n':
-						atof3(&cur, &vec);
-						if (flip_handedness) vec.z = -vec.z;
-						nrm.push_back(vec);
-						group.has_normals = true;
-						break;
-					default:
-						throw std::invalid_argument("invalid vertex token");
+					chunk.error = "invalid position index";
+					return false;
 				}
-
-				break;
+				corner_t corner = { *ptn, 0, ptn->tex >= counts.tex, ptn->nrm >= counts.nrm };
+				chunk.corners.push_back(corner);
 			}
+			return true;
+		};
 
-			case 'f': // p, p//n, p/t/n, p/t
+		auto push_scope = [&](char type, const char* arg)
+		{
+			scope_t scope = { type, (uint32_t)chunk.corners.size(), n.tex, n.nrm, arg };
+			chunk.scopes.push_back(scope);
+		};
+
+		walk_lines(chunk.begin, chunk.end, end, [&](char c, const char** pp_str)
+		{
+			switch (c)
 			{
-				index_t ptn[4];
-				index_t counts = { (uint32_t)pos.size(), (uint32_t)tex.size(), (uint32_t)nrm.size() };
-				
-				parse_index(&cur, counts, ptn + 0);
-				parse_index(&cur, counts, ptn + 1);
-				parse_index(&cur, counts, ptn + 2);
-
-				if (!is_newline(*cur))
+				case 'v':
 				{
-					parse_index(&cur, counts, ptn + 3);
-					push_triangle(ptn[0], ptn[2], ptn[3], map, pos, tex, nrm); // break up quad immediately
+					float3 vec;
+					switch (*(*pp_str)++)
+					{
+						case ' ':
+							atof3(pp_str, end, &vec);
+							if (flip_handedness) vec.z = -vec.z;
+							pos[chunk.base.pos + n.pos++] = vec;
+							chunk.aabb_min = min(chunk.aabb_min, vec);
+							chunk.aabb_max = max(chunk.aabb_max, vec);
+							break;
+						case 't':
+							atof3(pp_str, end, &vec);
+							if (flip_handedness) vec.y = 1.0f - vec.y;
+							tex[chunk.base.tex + n.tex++] = vec;
+							break;
+						case 'n':
+							atof3(pp_str, end, &vec);
+							if (flip_handedness) vec.z = -vec.z;
+							nrm[chunk.base.nrm + n.nrm++] = vec;
+							break;
+						default:
+							chunk.error = "invalid vertex token";
+							return false;
+					}
+
+					break;
 				}
-				
-				push_triangle(ptn[0], ptn[1], ptn[2], map, pos, tex, nrm);
-				break;
-			}
 
-			case 'g':
-				if (num_groups) // close out previous group
+				case 'f': // p, p//n, p/t/n, p/t
 				{
-					group.num_indices = (uint32_t)indices_.size() - group.start_index;
-					groups_.push_back(group);
-					group.start_index = (uint32_t)indices_.size();
-				}
-				num_groups++;
-				parse_string(&cur, group.name);
-				break;
+					vertex_key ptn[4];
+					const vertex_key counts = { chunk.base.pos + n.pos, chunk.base.tex + n.tex, chunk.base.nrm + n.nrm };
 
-			case 'u':
-				// if a new material is specified, but no new group, then insert one
-				// the important grouping is by material. Groups with the same material
-				// are fine to merge.
-				cur += 6;
-				if (group.material[0] == '\0')
-					parse_string(&cur, group.material);
-				else
-				{
-					// close out previous group
-					group.num_indices = (uint32_t)indices_.size() - group.start_index;
-					groups_.push_back(group);
-					group.start_index = (uint32_t)indices_.size();
-					num_groups++;
-					parse_string(&cur, group.material);
-					strlcpy(group.name, group.material);
+					parse_index(pp_str, counts, ptn + 0);
+					parse_index(pp_str, counts, ptn + 1);
+					parse_index(pp_str, counts, ptn + 2);
+
+					if (!is_newline(**pp_str))
+					{
+						parse_index(pp_str, counts, ptn + 3);
+						if (!push_triangle(counts, ptn[0], ptn[2], ptn[3])) // break up quad immediately
+							return false;
+					}
+
+					return push_triangle(counts, ptn[0], ptn[1], ptn[2]);
 				}
-				break;
 
-			case 'm':
-				cur += 6;
-				if (mtl_path_[0] != '\0')
-					throw std::invalid_argument("unsupported: two mtllibs specified");
-				parse_string(&cur, mtl_path_);
-				break;
+				case 'g':
+					push_scope(c, *pp_str);
+					break;
+
+				case 'u':
+				case 'm':
+					*pp_str += 6;
+					push_scope(c, *pp_str);
+					break;
+
+				default:
+					break;
+			}
+
+			return true;
+		});
+	});
+
+	// apply scope changes in order, which also raises any error in file order
+	uint32_t num_corners = 0;
+	for (auto& chunk : chunks)
+	{
+		chunk.corner_base = num_corners;
+		num_corners += (uint32_t)chunk.corners.size();
+	}
+
+	group_t     group;
+	            group.material[0]   = '\0';
+	            group.start_index   = 0;
+	            group.num_indices   = 0;
+	            group.has_normals   = false;
+	            group.has_texcoords = false;
+	            strlcpy(group.name, "default");
+	uint32_t    num_groups          = 0;
+
+	auto close_group = [&](uint32_t num_indices, uint32_t num_tex, uint32_t num_nrm)
+	{
+		group.num_indices   = num_indices - group.start_index;
+		group.has_texcoords = num_tex != 0;
+		group.has_normals   = num_nrm != 0;
+		groups_.push_back(group);
+		group.start_index   = num_indices;
+	};
+
+	for (const auto& chunk : chunks)
+	{
+		for (const auto& scope : chunk.scopes)
+		{
+			const char* cur = scope.arg;
+			const uint32_t num_indices = chunk.corner_base + scope.num_corners;
+			const uint32_t num_tex = chunk.base.tex + scope.num_tex;
+			const uint32_t num_nrm = chunk.base.nrm + scope.num_nrm;
+
+			switch (scope.type)
+			{
+				case 'g':
+					if (num_groups) // close out previous group
+						close_group(num_indices, num_tex, num_nrm);
+					num_groups++;
+					parse_string(&cur, group.name);
+					break;
+
+				case 'u':
+					// if a new material is specified, but no new group, then insert one
+					// the important grouping is by material. Groups with the same material
+					// are fine to merge.
+					if (group.material[0] == '\0')
+						parse_string(&cur, group.material);
+					else
+					{
+						close_group(num_indices, num_tex, num_nrm);
+						num_groups++;
+						parse_string(&cur, group.material);
+						strlcpy(group.name, group.material);
+					}
+					break;
+
+				case 'm':
+					if (mtl_path_[0] != '\0')
+						throw std::invalid_argument("unsupported: two mtllibs specified");
+					parse_string(&cur, mtl_path_);
+					break;
+			}
 		}
-		
-		move_to_line_end(&cur);
-		move_past_newline(&cur);
+
+		if (chunk.error)
+			throw std::invalid_argument(chunk.error);
+
+		aabb_min_ = min(aabb_min_, chunk.aabb_min);
+		aabb_max_ = max(aabb_max_, chunk.aabb_max);
 	}
 
 	// close out last group
-	group.num_indices = (uint32_t)indices_.size() - group.start_index;
-	groups_.push_back(group);
+	close_group(num_corners, totals.tex, totals.nrm);
+
+	if (!num_corners)
+		return;
+
+	// find each distinct corner's first occurrence: that's its order in the final vertices
+	uint32_t capacity = 16;
+	while (capacity < 2ull * num_corners)
+		capacity <<= 1;
+
+	auto slots_memory = temp_alloc.scoped_allocate(capacity * sizeof(vertex_slot), "obj vertex map");
+	vertex_slot* slots = slots_memory;
+	memset(slots, 0, capacity * sizeof(vertex_slot));
+
+	parallel_for(0, num_chunks, [&](size_t index)
+	{
+		auto& chunk = chunks[index];
+		uint32_t first = chunk.corner_base + 1;
+		for (auto& corner : chunk.corners)
+			corner.slot = insert_corner(slots, capacity - 1, corner.key, first++);
+	});
+
+	parallel_for(0, num_chunks, [&](size_t index)
+	{
+		auto& chunk = chunks[index];
+		uint32_t first = chunk.corner_base + 1, num_vertices = 0;
+		for (const auto& corner : chunk.corners)
+			num_vertices += slots[corner.slot].first.load(std::memory_order_relaxed) == first++;
+		chunk.num_vertices = num_vertices;
+	});
+
+	uint32_t num_vertices = 0;
+	for (auto& chunk : chunks)
+	{
+		chunk.vertex_base = num_vertices;
+		num_vertices += chunk.num_vertices;
+	}
+
+	indices_  .resize(num_corners);
+	positions_.resize(num_vertices);
+	texcoords_.resize(num_vertices);
+	normals_  .resize(num_vertices);
+
+	parallel_for(0, num_chunks, [&](size_t index)
+	{
+		auto& chunk = chunks[index];
+		uint32_t first = chunk.corner_base + 1, vertex = chunk.vertex_base;
+		for (const auto& corner : chunk.corners)
+		{
+			auto& slot = slots[corner.slot];
+			if (slot.first.load(std::memory_order_relaxed) == first++)
+			{
+				slot.vertex = vertex;
+				positions_[vertex] = pos[corner.key.pos];
+				texcoords_[vertex] = corner.no_tex ? float3(0.0f) : tex[corner.key.tex];
+				normals_  [vertex] = corner.no_nrm ? float3(0.0f) : nrm[corner.key.nrm];
+				vertex++;
+			}
+		}
+	});
+
+	parallel_for(0, num_chunks, [&](size_t index)
+	{
+		const auto& chunk = chunks[index];
+		uint32_t* dst = indices_.data() + chunk.corner_base;
+		for (const auto& corner : chunk.corners)
+			*dst++ = slots[corner.slot].vertex;
+	});
 }
 
 mtl::mtl()
@@ -6,6 +6,8 @@
 #include <oCore/finally.h>
 #include <oCore/timer.h>
 #include <oString/fixed_string.h>
+#include <algorithm>
+#include <vector>
 
 #include "obj_test.h"
 
@@ -40,6 +42,86 @@ static void test_correctness(tests::obj_test& expected, const mesh::obj& obj)
 	}
 }
 
+// A w x h grid of vertices with a usemtl every 16 rows and faces alternating 
+// between absolute and relative indices. This is large enough to be parsed in 
+// several chunks.
+static std::vector<char> make_grid_obj(uint32_t w, uint32_t h)
+{
+	std::vector<char> text;
+	text.reserve(w * h * 96);
+	char line[128];
+	auto append = [&](int len) { text.insert(text.end(), line, line + len); };
+
+	append(snprintf(line, sizeof(line), "# grid\nmtllib grid.mtl\n"));
+	for (uint32_t y = 0; y < h; y++)
+		for (uint32_t x = 0; x < w; x++)
+		{
+			append(snprintf(line, sizeof(line), "v %.3f %.3f -%u.5\n", x * 0.125f, y * 0.125f, x));
+			append(snprintf(line, sizeof(line), "vt %.2f %.2f\n", x * 0.25f, y * 0.25f));
+			append(snprintf(line, sizeof(line), "vn 0 0 %d\n", (x & 1) ? 1 : -1));
+		}
+
+	const uint32_t n = w * h;
+	for (uint32_t y = 0; y < h - 1; y++)
+	{
+		if ((y % 16) == 0)
+			append(snprintf(line, sizeof(line), "usemtl mat%u\n", y / 16));
+
+		for (uint32_t x = 0; x < w - 1; x++)
+		{
+			const uint32_t a = y * w + x + 1, b = a + 1, c = a + w + 1, d = a + w;
+			if (x & 1)
+				append(snprintf(line, sizeof(line), "f %u/%u/%u %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, b, b, b, c, c, c, d, d, d));
+			else
+			{
+				const int ra = int(a) - int(n) - 1, rb = int(b) - int(n) - 1, rc = int(c) - int(n) - 1, rd = int(d) - int(n) - 1;
+				append(snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", ra, ra, ra, rb, rb, rb, rc, rc, rc, rd, rd, rd));
+			}
+		}
+	}
+
+	text.push_back('\0');
+	return text;
+}
+
+static void test_grid(unit_test::services& srv)
+{
+	static const uint32_t w = 256, h = 200;
+	auto text = make_grid_obj(w, h);
+
+	mesh::obj obj(mesh::obj::init_t(), "Correctness (grid) obj", text.data(), text.size());
+	oCHECK(!strcmp(obj.mtl_path(), "grid.mtl"), "grid mtl path is wrong");
+	oCHECK(obj.num_vertices() == w * h, "grid has %u vertices, expected %u", obj.num_vertices(), w * h);
+	oCHECK(obj.num_indices() == (w - 1) * (h - 1) * 6, "grid has %u indices, expected %u", obj.num_indices(), (w - 1) * (h - 1) * 6);
+	oCHECK(obj.num_groups() == (h - 1 + 15) / 16, "grid has %u groups, expected %u", obj.num_groups(), (h - 1 + 15) / 16);
+
+	// each quad is split into (a,c,d) then (a,b,c) and vertices appear in the order first used
+	const uint32_t* indices = obj.indices();
+	for (uint32_t y = 0, i = 0; y < h - 1; y++)
+		for (uint32_t x = 0; x < w - 1; x++, i += 6)
+		{
+			const uint2 corners[6] = { uint2(x, y), uint2(x + 1, y + 1), uint2(x, y + 1), uint2(x, y), uint2(x + 1, y), uint2(x + 1, y + 1) };
+			for (uint32_t j = 0; j < 6; j++)
+			{
+				const float3 p = obj.positions()[indices[i + j]];
+				const float3 t = obj.texcoords()[indices[i + j]];
+				const float3 n = obj.normals()[indices[i + j]];
+				const uint2 c = corners[j];
+				oCHECK(p.x == c.x * 0.125f && p.y == c.y * 0.125f && p.z == -(c.x + 0.5f), "position of quad %u,%u corner %u is wrong", x, y, j);
+				oCHECK(t.x == c.x * 0.25f && t.y == c.y * 0.25f && t.z == 0.0f, "texcoord of quad %u,%u corner %u is wrong", x, y, j);
+				oCHECK(n.z == ((c.x & 1) ? 1.0f : -1.0f), "normal of quad %u,%u corner %u is wrong", x, y, j);
+			}
+		}
+
+	for (uint32_t i = 0; i < obj.num_groups(); i++)
+	{
+		const auto& g = obj.groups()[i];
+		const uint32_t nrows = std::min(16u, h - 1 - i * 16);
+		oCHECK(g.start_index == i * 16 * (w - 1) * 6 && g.num_indices == nrows * (w - 1) * 6, "group %u range is wrong", i);
+		oCHECK(g.has_texcoords && g.has_normals, "group %u should have texcoords and normals", i);
+	}
+}
+
 static void obj_load(unit_test::services& services, const char* path, double* out_load_time = nullptr)
 {
 	double start = timer::now();
@@ -61,6 +143,9 @@ oTEST(oMesh_obj)
 		test_correctness(*test.get(), obj);
 	}
 
+	// Correctness when parsed in parallel
+	test_grid(srv);
+
 	// Support for negative indices
 	{
 		obj_load(srv, "Test/Geometry/hunter.obj");
@@ -77,3 +162,21 @@ oTEST(oMesh_obj)
 		srv.status("%s to load benchmark file %s", time.c_str(), kBenchmarkPath);
 	}
 }
+
+oBENCHMARK(oMesh_obj_benchmark)
+{
+	auto text = make_grid_obj(1024, 512);
+	const double mb = text.size() / (1024.0 * 1024.0);
+
+	mesh::obj::init_t init;
+	init.est_num_vertices = 1024 * 512;
+	init.est_num_indices = 1023 * 511 * 6;
+	mesh::obj obj(init);
+
+	static const uint32_t nruns = 4;
+	const double best = srv.best_seconds(nruns, [&] { obj.parse("Benchmark (grid) obj", text.data(), text.size()); });
+
+	oCHECK(obj.num_vertices() == 1024 * 512, "benchmark grid parsed incorrectly");
+
+	srv.status("%.1f MB/s obj parse throughput", srv.trace_rate("grid obj parse", mb, "MB", best));
+}
@@ -0,0 +1,784 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+#include <oString/json.h>
+#include <oCore/assert.h>
+#include <oCore/bit.h>
+#include <emmintrin.h>
+#include <cstdlib>
+
+namespace ouro {
+namespace json_detail {
+
+static const uint64_t even_bits = 0x5555555555555555ull;
+static const uint64_t odd_bits = ~even_bits;
+
+// positions found per pass of the first stage: enough to amortize its setup
+// and small enough to stay in cache for the second stage
+static const size_t window_size = 16 * 1024;
+
+// one bit per byte of a 64-byte block
+struct block_bits
+{
+	uint64_t backslash;
+	uint64_t quote;
+	uint64_t op; // {}[]:,
+	uint64_t whitespace;
+};
+
+static inline block_bits classify(const char* p)
+{
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i quote = _mm_set1_epi8('\"');
+	const __m128i open = _mm_set1_epi8('{');
+	const __m128i close = _mm_set1_epi8('}');
+	const __m128i colon = _mm_set1_epi8(':');
+	const __m128i comma = _mm_set1_epi8(',');
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i case_bit = _mm_set1_epi8(0x20);
+	const __m128i below_tab = _mm_set1_epi8('\t' - 1);
+	const __m128i above_cr = _mm_set1_epi8('\r' + 1);
+
+	block_bits b = { 0, 0, 0, 0 };
+	for (int i = 0; i < 4; i++)
+	{
+		const __m128i c = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+		const __m128i folded = _mm_or_si128(c, case_bit); // [ and ] become { and }
+		const __m128i op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(folded, open), _mm_cmpeq_epi8(folded, close)), _mm_or_si128(_mm_cmpeq_epi8(c, colon), _mm_cmpeq_epi8(c, comma)));
+		const __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(c, space), _mm_and_si128(_mm_cmpgt_epi8(c, below_tab), _mm_cmplt_epi8(c, above_cr)));
+
+		const int shift = 16 * i;
+		b.backslash |= uint64_t(uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(c, backslash)))) << shift;
+		b.quote |= uint64_t(uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(c, quote)))) << shift;
+		b.op |= uint64_t(uint32_t(_mm_movemask_epi8(op))) << shift;
+		b.whitespace |= uint64_t(uint32_t(_mm_movemask_epi8(ws))) << shift;
+	}
+
+	return b;
+}
+
+// Returns the bits of characters that follow an odd-length run of backslashes.
+// prev_odd carries whether the last block ended in one.
+static inline uint64_t escaped_bits(uint64_t backslash, uint64_t& prev_odd)
+{
+	if (!backslash && !prev_odd)
+		return 0;
+
+	const uint64_t starts = backslash & ~(backslash << 1);
+	const uint64_t even_start_mask = even_bits ^ prev_odd;
+	const uint64_t even_starts = starts & even_start_mask;
+	const uint64_t odd_starts = starts & ~even_start_mask;
+	const uint64_t even_carries = backslash + even_starts;
+	uint64_t odd_carries = backslash + odd_starts;
+	const bool ends_odd = odd_carries < backslash;
+	odd_carries |= prev_odd;
+	prev_odd = ends_odd ? 1 : 0;
+	const uint64_t even_start_odd_end = even_carries & ~backslash & odd_bits;
+	const uint64_t odd_start_even_end = odd_carries & ~backslash & even_bits;
+	return even_start_odd_end | odd_start_even_end;
+}
+
+// each bit becomes the xor of it and all bits below it
+static inline uint64_t prefix_xor(uint64_t x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+// The first stage: produces in order the positions of structural characters
+// and quotes outside of strings and the first character of each bare value
+// (numbers, true, false, null).
+class structural_scanner
+{
+public:
+	structural_scanner(char* text, size_t size)
+		: text_(text)
+		, size_(size)
+		, offset_(0)
+		, prev_escaped_(0)
+		, prev_in_string_(0)
+		, prev_scalar_(0)
+		, count_(0)
+		, cursor_(0)
+	{
+		positions_.resize(window_size + 64);
+	}
+
+	// returns nullptr when there are no more positions
+	inline char* next()
+	{
+		if (cursor_ == count_ && !refill())
+			return nullptr;
+		return text_ + positions_[cursor_++];
+	}
+
+private:
+	bool refill();
+
+	char* text_;
+	size_t size_;
+	size_t offset_;
+	uint64_t prev_escaped_;
+	uint64_t prev_in_string_;
+	uint64_t prev_scalar_;
+	uint32_t count_;
+	uint32_t cursor_;
+	detail::text_buffer::std_vector<uint32_t> positions_;
+};
+
+bool structural_scanner::refill()
+{
+	// work on locals so writing positions doesn't reload members
+	uint32_t* positions = positions_.data();
+	uint32_t count = 0;
+	size_t offset = offset_;
+	uint64_t prev_escaped = prev_escaped_;
+	uint64_t prev_in_string = prev_in_string_;
+	uint64_t prev_scalar = prev_scalar_;
+
+	while (!count && offset < size_)
+	{
+		const size_t end = __min(offset + window_size, size_);
+		for (; offset < end; offset += 64)
+		{
+			const char* p = text_ + offset;
+
+			// pad the last partial block with whitespace, which is never a position
+			char tail[64];
+			if (size_ - offset < 64)
+			{
+				memset(tail, ' ', sizeof(tail));
+				memcpy(tail, p, size_ - offset);
+				p = tail;
+			}
+
+			const block_bits b = classify(p);
+
+			// an opening quote through the character before its closing quote
+			const uint64_t quote = b.quote & ~escaped_bits(b.backslash, prev_escaped);
+			const uint64_t in_string = prefix_xor(quote) ^ prev_in_string;
+			prev_in_string = uint64_t(int64_t(in_string) >> 63);
+
+			const uint64_t scalar = ~(in_string | quote | b.op | b.whitespace);
+			const uint64_t scalar_start = scalar & ~((scalar << 1) | prev_scalar);
+			prev_scalar = scalar >> 63;
+
+			// write positions 8 at a time even past the last one into the slack
+			// at the end of positions_, which mispredicts less than a branch per bit
+			uint64_t bits = (b.op & ~in_string) | quote | scalar_start;
+			const uint32_t num_bits = bitcount(bits);
+			const uint32_t base = static_cast<uint32_t>(offset);
+			uint32_t* out = positions + count;
+			for (uint32_t i = 0; i < num_bits; i += 8, out += 8)
+				for (int j = 0; j < 8; j++)
+				{
+					out[j] = base + bitlow(bits);
+					bits &= bits - 1;
+				}
+			count += num_bits;
+		}
+	}
+
+	count_ = count;
+	cursor_ = 0;
+	offset_ = offset;
+	prev_escaped_ = prev_escaped;
+	prev_in_string_ = prev_in_string;
+	prev_scalar_ = prev_scalar;
+	return count != 0;
+}
+
+static inline bool is_whitespace(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static inline bool is_number_char(char c)
+{
+	return (c >= '0' && c <= '9') || c == '-' || c == '.' || c == 'e' || c == 'E' || c == '+';
+}
+
+static json_value_type scalar_type(const char* value, const char* value_end)
+{
+	const size_t len = value_end - value;
+	switch (*value)
+	{
+		case 't': if (len == 4 && !memcmp(value, "true", 4)) return json_value_type::true_; break;
+		case 'f': if (len == 5 && !memcmp(value, "false", 5)) return json_value_type::false_; break;
+		case 'n': if (len == 4 && !memcmp(value, "null", 4)) return json_value_type::null; break;
+		default:
+		{
+			const char* c = value;
+			while (c < value_end && is_number_char(*c))
+				c++;
+			if (c == value_end)
+				return json_value_type::number;
+			break;
+		}
+	}
+
+	throw text_document_error(text_document_errc::generic_parse_error);
+}
+
+// case-insensitive to match _stricmp
+static inline uint32_t hash_key(const char* name, uint32_t parent)
+{
+	uint32_t h = 2166136261u;
+	for (; *name; name++)
+	{
+		const uint32_t c = uint8_t(*name);
+		h = (h ^ (c - 'A' < 26u ? c + 32 : c)) * 16777619u;
+	}
+	return h ^ (parent * 0x9e3779b1u);
+}
+
+static const double exact_pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+} // namespace json_detail
+
+void json::index_buffer()
+{
+	char* text = buffer_.c_str();
+	json_detail::structural_scanner scan(text, strlen(text));
+
+	nodes_.push_back(node_t()); // use up slot 0 so it can be used as a null handle
+	nodes_.push_back(node_t()); // add root node
+
+	// skip anything before the root such as a byte order mark
+	char* t = scan.next();
+	while (t && *t != '{' && *t != '[')
+		t = scan.next();
+	if (!t)
+		throw text_document_error(text_document_errc::generic_parse_error);
+
+	struct scope
+	{
+		index_type node, last;
+		char close;
+	};
+
+	detail::text_buffer::std_vector<scope> scopes;
+	scopes.reserve(32);
+	scope s = { 1, 0, *t == '[' ? ']' : '}' };
+	if (s.close == ']')
+	{
+		nodes_[1].type = json_node_type::array;
+		nodes_[1].value_type = json_value_type::array;
+	}
+
+	*text = 0; // make the first char nul so 0 offsets are the empty string
+
+	t = scan.next();
+	bool empty = t && *t == s.close;
+	for (;;)
+	{
+		char* delim = t;
+
+		// t is the first position of a member or element unless the scope is empty
+		if (!empty)
+		{
+			if (!t)
+				throw text_document_error(text_document_errc::unclosed_scope);
+
+			node_t n;
+			n.type = json_node_type::value;
+
+			if (s.close == '}')
+			{
+				// set name without the quotes, so zero terminate on the end quote
+				char* name_end = scan.next();
+				if (*t != '\"' || !name_end || *name_end != '\"')
+					throw text_document_error(text_document_errc::generic_parse_error);
+				*name_end = 0;
+				n.name = static_cast<index_type>(t + 1 - text);
+
+				t = scan.next();
+				if (!t || *t != ':')
+					throw text_document_error(text_document_errc::generic_parse_error);
+				t = scan.next();
+				if (!t)
+					throw text_document_error(text_document_errc::unclosed_scope);
+			}
+
+			const index_type new_node = static_cast<index_type>(nodes_.size());
+			if (s.last) nodes_[s.last].next = new_node;
+			else nodes_[s.node].down = new_node;
+			s.last = new_node;
+
+			n.value = static_cast<index_type>(t - text);
+
+			char* value_end = nullptr;
+			switch (*t)
+			{
+				case '{':
+				case '[':
+				{
+					const bool is_array = *t == '[';
+					n.type = is_array ? json_node_type::array : json_node_type::object;
+					n.value_type = is_array ? json_value_type::array : json_value_type::object;
+					n.value = 0;
+					nodes_.push_back(n);
+
+					scopes.push_back(s);
+					s.node = new_node;
+					s.last = 0;
+					s.close = is_array ? ']' : '}';
+
+					t = scan.next();
+					empty = t && *t == s.close;
+					continue;
+				}
+
+				case '\"':
+					n.value_type = json_value_type::string;
+					value_end = scan.next();
+					if (!value_end)
+						throw text_document_error(text_document_errc::unclosed_scope);
+					value_end++; // keep the end quote
+					delim = scan.next();
+					break;
+
+				case ',': case ':': case ']': case '}':
+					throw text_document_error(text_document_errc::generic_parse_error);
+
+				default:
+					delim = scan.next();
+					if (!delim)
+						throw text_document_error(text_document_errc::unclosed_scope);
+					value_end = delim;
+					while (json_detail::is_whitespace(value_end[-1]))
+						value_end--;
+					n.value_type = json_detail::scalar_type(t, value_end);
+					break;
+			}
+
+			nodes_.push_back(n);
+
+			// clear from the end of the value to the delimiter to make sure the value
+			// is zero terminated
+			if (delim)
+				while (value_end < delim)
+					*value_end++ = 0;
+		}
+
+		// delim follows a value: either a sibling follows or the scope is closing
+		for (;;)
+		{
+			if (!delim)
+				throw text_document_error(text_document_errc::unclosed_scope);
+
+			if (*delim == ',')
+			{
+				*delim = 0;
+				t = scan.next();
+				empty = false;
+				break;
+			}
+
+			if (*delim != s.close)
+				throw text_document_error(text_document_errc::generic_parse_error);
+
+			*delim = 0;
+			if (scopes.empty())
+				return;
+
+			// the container just closed is a value in its parent
+			char* value_end = delim + 1;
+			s = scopes.back();
+			scopes.pop_back();
+
+			delim = scan.next();
+			if (delim)
+				while (value_end < delim)
+					*value_end++ = 0;
+		}
+	}
+}
+
+int64_t json::as_int64(node n) const
+{
+	oCheck(value_type(n) == json_value_type::number, std::errc::invalid_argument, "%s: %s is not a number", name(), node_name(n));
+
+	const char* s = node_value(n);
+	const bool negative = *s == '-';
+	s += negative;
+
+	const char* digits = s;
+	uint64_t value = 0;
+	for (; *s >= '0' && *s <= '9'; s++)
+	{
+		const uint32_t digit = *s - '0';
+		oCheck(value <= (UINT64_MAX - digit) / 10, std::errc::result_out_of_range, "%s: %s does not fit in 64 bits", name(), node_value(n));
+		value = value * 10 + digit;
+	}
+
+	oCheck(s != digits && !*s, std::errc::invalid_argument, "%s: %s is not an integer", name(), node_value(n));
+	oCheck(value <= uint64_t(INT64_MAX) + negative, std::errc::result_out_of_range, "%s: %s does not fit in 64 bits", name(), node_value(n));
+	return negative ? -int64_t(value - 1) - 1 : int64_t(value);
+}
+
+double json::as_double(node n) const
+{
+	oCheck(value_type(n) == json_value_type::number, std::errc::invalid_argument, "%s: %s is not a number", name(), node_name(n));
+
+	// Most numbers have a mantissa that is exact as a double and a small power
+	// of ten, so one correctly rounded multiply or divide is exact (Clinger).
+	// Everything else goes through strtod.
+	const char* value = node_value(n);
+	const char* s = value;
+	const bool negative = *s == '-';
+	s += negative;
+
+	uint64_t mantissa = 0;
+	int num_digits = 0;
+	int exponent = 0;
+	for (; *s >= '0' && *s <= '9'; s++, num_digits++)
+		mantissa = mantissa * 10 + (*s - '0');
+
+	if (*s == '.')
+		for (s++; *s >= '0' && *s <= '9'; s++, num_digits++, exponent--)
+			mantissa = mantissa * 10 + (*s - '0');
+
+	if (*s == 'e' || *s == 'E')
+	{
+		s++;
+		const bool negative_exponent = *s == '-';
+		s += *s == '-' || *s == '+';
+		int e = 0;
+		for (; *s >= '0' && *s <= '9' && e < 10000; s++)
+			e = e * 10 + (*s - '0');
+		exponent += negative_exponent ? -e : e;
+	}
+
+	if (!*s && num_digits && num_digits <= 19 && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22)
+	{
+		double d = double(mantissa);
+		d = exponent < 0 ? d / json_detail::exact_pow10[-exponent] : d * json_detail::exact_pow10[exponent];
+		return negative ? -d : d;
+	}
+
+	char* end = nullptr;
+	const double d = strtod(value, &end);
+	oCheck(end != value && !*end, std::errc::invalid_argument, "%s: %s is not a valid number", name(), value);
+	return d;
+}
+
+bool json::as_bool(node n) const
+{
+	const json_value_type type = value_type(n);
+	oCheck(type == json_value_type::true_ || type == json_value_type::false_, std::errc::invalid_argument, "%s: %s is not true or false", name(), node_name(n));
+	return type == json_value_type::true_;
+}
+
+void json::index_keys()
+{
+	index_type num_keys = 0;
+	for (size_t i = 1; i < nodes_.size(); i++)
+		if (nodes_[i].name)
+			num_keys++;
+
+	keys_t keys;
+	keys.resize(nextpow2(__max(num_keys * 2, 16u)));
+	const uint32_t mask = static_cast<uint32_t>(keys.size() - 1);
+
+	// siblings are inserted in order so probing finds the first of duplicates
+	for (index_type parent = 1; parent < nodes_.size(); parent++)
+	{
+		if (nodes_[parent].type != json_node_type::object)
+			continue;
+
+		for (index_type child = nodes_[parent].down; child; child = nodes_[child].next)
+		{
+			if (!nodes_[child].name)
+				continue;
+
+			const uint32_t hash = json_detail::hash_key(buffer_.c_str() + nodes_[child].name, parent);
+			uint32_t slot = hash & mask;
+			while (keys[slot].child)
+				slot = (slot + 1) & mask;
+
+			keys[slot].parent = parent;
+			keys[slot].child = child;
+			keys[slot].hash = hash;
+		}
+	}
+
+	size_ -= keys_.capacity() * sizeof(key_slot);
+	keys_ = std::move(keys);
+	size_ += keys_.capacity() * sizeof(key_slot);
+}
+
+json::node json::find_key(node parent_node, const char* name) const
+{
+	const index_type parent = static_cast<index_type>((uintptr_t)parent_node);
+	const uint32_t hash = json_detail::hash_key(name, parent);
+	const uint32_t mask = static_cast<uint32_t>(keys_.size() - 1);
+
+	for (uint32_t slot = hash & mask; keys_[slot].child; slot = (slot + 1) & mask)
+	{
+		const key_slot& k = keys_[slot];
+		if (k.hash == hash && k.parent == parent && !_stricmp(buffer_.c_str() + nodes_[k.child].name, name))
+			return node(uintptr_t(k.child));
+	}
+
+	return node(0);
+}
+
+bool json::visit(visitor& visitor) const
+{
+	return nodes_.size() > 1 ? visit(root(), visitor) : true;
+}
+
+bool json::visit(node n, visitor& visitor) const
+{
+	const char* nname = node_name(n);
+	const json_node_type type = node_type(n);
+
+	if (type == json_node_type::value)
+		return visitor.value(nname, value_type(n), node_value(n));
+
+	if (!(type == json_node_type::object ? visitor.object_begin(nname) : visitor.array_begin(nname)))
+		return false;
+
+	for (node c = first_child(n); c; c = next_sibling(c))
+		if (!visit(c, visitor))
+			return false;
+
+	return type == json_node_type::object ? visitor.object_end(nname) : visitor.array_end(nname);
+}
+
+json_stream::json_stream(json::visitor& visitor)
+	: visitor_(visitor)
+	, state_(state::root)
+	, in_name_(false)
+	, escaped_(false)
+	, empty_scope_(false)
+	, aborted_(false)
+{
+	token_.reserve(256);
+	name_.reserve(64);
+	names_.reserve(256);
+	scopes_.reserve(32);
+}
+
+void json_stream::open(bool is_array)
+{
+	const char* name = scopes_.empty() ? "" : member_name();
+	const size_t name_len = strlen(name);
+
+	scope s;
+	s.name = static_cast<uint32_t>(names_.size());
+	s.is_array = is_array;
+	names_.insert(names_.end(), name, name + name_len + 1);
+	scopes_.push_back(s);
+
+	state_ = is_array ? state::value : state::member;
+	empty_scope_ = true;
+
+	name = names_.data() + s.name;
+	aborted_ = !(is_array ? visitor_.array_begin(name) : visitor_.object_begin(name));
+}
+
+void json_stream::close()
+{
+	const scope s = scopes_.back();
+	scopes_.pop_back();
+	state_ = scopes_.empty() ? state::done : state::after_value;
+
+	const char* name = names_.data() + s.name;
+	aborted_ = !(s.is_array ? visitor_.array_end(name) : visitor_.object_end(name));
+	names_.resize(s.name);
+}
+
+void json_stream::end_scalar()
+{
+	const size_t len = token_.size();
+	token_.push_back(0);
+	const json_value_type type = json_detail::scalar_type(token_.data(), token_.data() + len);
+	state_ = state::after_value;
+	aborted_ = !visitor_.value(member_name(), type, token_.data());
+}
+
+bool json_stream::write(const void* src, size_t src_size)
+{
+	const char* c = static_cast<const char*>(src);
+	const char* end = c + src_size;
+
+	while (c < end && !aborted_)
+	{
+		// between tokens whitespace is insignificant
+		if (state_ != state::string && state_ != state::scalar)
+		{
+			while (c < end && json_detail::is_whitespace(*c))
+				c++;
+			if (c == end)
+				break;
+		}
+
+		switch (state_)
+		{
+			case state::root:
+				// skip anything before the root such as a byte order mark
+				if (*c == '{' || *c == '[')
+					open(*c == '[');
+				c++;
+				break;
+
+			case state::value:
+				switch (*c)
+				{
+					case '{':
+					case '[':
+						open(*c++ == '[');
+						break;
+
+					case '\"':
+						token_.assign(1, '\"');
+						in_name_ = false;
+						escaped_ = false;
+						state_ = state::string;
+						c++;
+						break;
+
+					case ']':
+						// only an empty array may close where a value is expected
+						if (!empty_scope_ || !scopes_.back().is_array)
+							throw text_document_error(text_document_errc::generic_parse_error);
+						close();
+						c++;
+						break;
+
+					case ',': case ':': case '}':
+						throw text_document_error(text_document_errc::generic_parse_error);
+
+					default:
+						token_.clear();
+						state_ = state::scalar;
+						break;
+				}
+				break;
+
+			case state::member:
+				if (*c == '\"')
+				{
+					token_.clear();
+					in_name_ = true;
+					escaped_ = false;
+					empty_scope_ = false;
+					state_ = state::string;
+				}
+				else if (*c == '}' && empty_scope_)
+					close();
+				else
+					throw text_document_error(text_document_errc::generic_parse_error);
+				c++;
+				break;
+
+			case state::colon:
+				if (*c++ != ':')
+					throw text_document_error(text_document_errc::generic_parse_error);
+				state_ = state::value;
+				break;
+
+			case state::after_value:
+				if (*c == ',')
+				{
+					empty_scope_ = false;
+					state_ = scopes_.back().is_array ? state::value : state::member;
+				}
+				else if (*c == (scopes_.back().is_array ? ']' : '}'))
+					close();
+				else
+					throw text_document_error(text_document_errc::generic_parse_error);
+				c++;
+				break;
+
+			case state::string:
+			{
+				// copy up to the end quote, which may be in a later piece
+				const char* run = c;
+				for (; c < end; c++)
+				{
+					if (escaped_)
+						escaped_ = false;
+					else if (*c == '\\')
+						escaped_ = true;
+					else if (*c == '\"')
+						break;
+				}
+
+				token_.insert(token_.end(), run, c);
+				if (c == end)
+					break;
+				c++;
+
+				if (in_name_)
+				{
+					name_.assign(token_.begin(), token_.end());
+					name_.push_back(0);
+					state_ = state::colon;
+				}
+				else
+				{
+					token_.push_back('\"');
+					token_.push_back(0);
+					state_ = state::after_value;
+					aborted_ = !visitor_.value(member_name(), json_value_type::string, token_.data());
+				}
+				break;
+			}
+
+			case state::scalar:
+			{
+				const char* run = c;
+				while (c < end && !json_detail::is_whitespace(*c) && *c != ',' && *c != ']' && *c != '}')
+					c++;
+				token_.insert(token_.end(), run, c);
+				if (c < end)
+					end_scalar();
+				break;
+			}
+
+			case state::done:
+				c = end;
+				break;
+		}
+	}
+
+	return !aborted_;
+}
+
+bool json_stream::finish()
+{
+	if (aborted_)
+		return false;
+
+	if (state_ == state::scalar)
+		end_scalar();
+
+	if (state_ == state::root)
+		throw text_document_error(text_document_errc::generic_parse_error);
+
+	if (state_ != state::done)
+		throw text_document_error(text_document_errc::unclosed_scope);
+
+	return !aborted_;
+}
+
+bool json_stream::read(const read_fn& read, size_t chunk_size)
+{
+	detail::text_buffer::std_vector<char> chunk;
+	chunk.resize(chunk_size);
+
+	for (size_t n = read(chunk.data(), chunk_size); n; n = read(chunk.data(), chunk_size))
+		if (!write(chunk.data(), n))
+			return false;
+
+	return finish();
+}
+
+}
@@ -4,6 +4,10 @@
 
 #include <oString/json.h>
 #include <oString/string_codec.h>
+#include <algorithm>
+#include <climits>
+#include <string>
+#include <vector>
 
 using namespace ouro;
 
@@ -97,4 +101,213 @@ oTEST(oString_json)
 	lstring EscapedString;
 	json_escape_encode(EscapedString.c_str(), EscapedString.capacity(), "Some test text for \"JSON\" with some\r\n\tcharacters:\f\b\t\\ that need to be escaped and/or turned into unicode format:\v\a\x1b");
 	oCHECK0(0 == strcmp(EscapedString.c_str(), JSON.node_value(json::node(9))));
+
+	// Typed values
+	oCHECK0(JSON.as_bool(json::node(2)));
+	oCHECK0(JSON.as_int64(json::node(3)) == -126);
+	oCHECK0(JSON.as_int64(json::node(5)) == 518504670);
+	oCHECK0(JSON.as_int64(json::node(6)) == 54491065317ll);
+	oCHECK0(JSON.as_double(json::node(6)) == 54491065317.0);
+	oCHECK0(JSON.as_double(json::node(7)) == -1.5);
+	oCHECK0(JSON.as_double(json::node(8)) == 1.50505e-15);
+
+	bool threw = false;
+	try { JSON.as_int64(json::node(7)); }
+	catch (std::system_error&) { threw = true; }
+	oCHECK(threw, "as_int64 of a fraction should throw");
+
+	threw = false;
+	try { JSON.as_bool(json::node(3)); }
+	catch (std::system_error&) { threw = true; }
+	oCHECK(threw, "as_bool of a number should throw");
+
+	// Lookups through the key index find the same nodes
+	JSON.index_keys();
+	oCHECK0(JSON.has_key_index());
+	oCHECK0(JSON.first_child(JSON.root(), "Llong") == json::node(6));
+	oCHECK0(JSON.first_child(JSON.root(), "arrayofarray") == json::node(15));
+	oCHECK0(JSON.first_child(json::node(23), "Bool") == json::node(24));
+	oCHECK0(JSON.first_child(json::node(29), "StructValue2") == json::node(31));
+	oCHECK0(!JSON.first_child(json::node(29), "Bool"));
+	oCHECK0(!JSON.first_child(JSON.root(), "Missing"));
+
+	// Whitespace anywhere between tokens and empty containers
+	json Spaced("Spaced JSON", " \r\n{ \"a\" :\t[ 1 , { } , [ ] ,\"x\" ] ,\n \"b\" : -2.5e+3 , \"\" : false }\n");
+	auto a = Spaced.first_child(Spaced.root(), "a");
+	oCHECK0(a && Spaced.node_type(a) == json_node_type::array);
+	auto e = Spaced.first_child(a);
+	oCHECK0(!strcmp(Spaced.node_value(e), "1"));
+	e = Spaced.next_sibling(e);
+	oCHECK0(Spaced.node_type(e) == json_node_type::object && !Spaced.first_child(e));
+	e = Spaced.next_sibling(e);
+	oCHECK0(Spaced.node_type(e) == json_node_type::array && !Spaced.first_child(e));
+	e = Spaced.next_sibling(e);
+	oCHECK0(!strcmp(Spaced.node_value(e), "\"x\"") && !Spaced.next_sibling(e));
+	oCHECK0(Spaced.as_double(Spaced.first_child(Spaced.root(), "b")) == -2500.0);
+	oCHECK0(!Spaced.as_bool(Spaced.first_child(Spaced.root(), "")));
+
+	// Malformed documents
+	static const char* sMalformed[] = { "{\"a\":1", "{\"a\":\"text}", "{\"a\" 1}", "{\"a\":tru}", "[1,]", "[1 2]", "{\"a\":[1}", "no root" };
+	for (const char* m : sMalformed)
+	{
+		threw = false;
+		try { json Malformed("Malformed JSON", m); }
+		catch (std::exception&) { threw = true; }
+		oCHECK(threw, "malformed json should throw: %s", m);
+	}
+}
+
+// Returns an array of records whose strings have escapes, backslash runs and
+// characters that would be structural outside of a string at varying offsets.
+static std::string make_records(unit_test::services& srv, uint32_t num_records, std::vector<std::string>* out_names = nullptr)
+{
+	static const char sChars[] = "abc {}[]:,\"\\\t";
+
+	std::string doc("[\n");
+	char buf[256];
+	for (uint32_t i = 0; i < num_records; i++)
+	{
+		std::string name("\"");
+		for (uint32_t j = 0, n = srv.rand() % 24; j < n; j++)
+		{
+			const char c = sChars[srv.rand() % (sizeof(sChars) - 1)];
+			if (c == '\"' || c == '\\') name += '\\';
+			name += c;
+		}
+		name += '\"';
+
+		snprintf(buf, sizeof(buf), "%s{\"id\":%u,\"name\":%s,\"pos\":[%d.%02d, %d, %de-3],\"visible\":%s,\"parent\":null,\"tags\":{}}\n"
+			, i ? "," : "", i, name.c_str(), srv.rand() % 1000, srv.rand() % 100, -(srv.rand() % 1000), srv.rand() % 1000, (i & 1) ? "true" : "false");
+		doc += buf;
+
+		if (out_names)
+			out_names->push_back(name);
+	}
+
+	doc += "]";
+	return doc;
+}
+
+oTEST(oString_json_records)
+{
+	std::vector<std::string> names;
+	const std::string doc = make_records(srv, 5000, &names);
+
+	for (int indexed = 0; indexed < 2; indexed++)
+	{
+		json JSON("Records JSON", doc.c_str(), names.size() * 10);
+		if (indexed)
+			JSON.index_keys();
+
+		uint32_t i = 0;
+		for (auto r = JSON.first_child(JSON.root()); r; r = JSON.next_sibling(r), i++)
+		{
+			oCHECK(i < names.size(), "too many records");
+			oCHECK(JSON.as_int64(JSON.first_child(r, "id")) == i, "record %u has the wrong id", i);
+			oCHECK(!strcmp(JSON.node_value(JSON.first_child(r, "name")), names[i].c_str()), "record %u has the wrong name", i);
+			oCHECK(JSON.as_bool(JSON.first_child(r, "visible")) == !!(i & 1), "record %u has the wrong visibility", i);
+			oCHECK(JSON.value_type(JSON.first_child(r, "parent")) == json_value_type::null, "record %u has the wrong parent", i);
+
+			auto pos = JSON.first_child(r, "pos");
+			uint32_t num_pos = 0;
+			for (auto p = JSON.first_child(pos); p; p = JSON.next_sibling(p), num_pos++)
+				oCHECK(JSON.as_double(p) == strtod(JSON.node_value(p), nullptr), "record %u has a wrong pos", i);
+			oCHECK(num_pos == 3, "record %u has %u pos values", i, num_pos);
+		}
+
+		oCHECK(i == names.size(), "expected %u records, got %u", uint32_t(names.size()), i);
+	}
+}
+
+class json_recorder : public json::visitor
+{
+public:
+	json_recorder(int _MaxEvents = INT_MAX) : MaxEvents(_MaxEvents) {}
+
+	bool object_begin(const char* _Name) override { return record("{", _Name); }
+	bool object_end(const char* _Name) override { return record("}", _Name); }
+	bool array_begin(const char* _Name) override { return record("[", _Name); }
+	bool array_end(const char* _Name) override { return record("]", _Name); }
+	bool value(const char* _Name, json_value_type _Type, const char* _Value) override { s += char('0' + (int)_Type); s += _Value; return record(":", _Name); }
+
+	std::string s;
+	int MaxEvents;
+
+private:
+	bool record(const char* _Event, const char* _Name) { s += _Event; s += _Name; s += "\n"; return --MaxEvents > 0; }
+};
+
+static std::string stream_json(unit_test::services& srv, const std::string& _Doc, size_t _MaxPiece, int _MaxEvents = INT_MAX)
+{
+	json_recorder r(_MaxEvents);
+	json_stream stream(r);
+	for (size_t offset = 0; offset < _Doc.size();)
+	{
+		const size_t n = std::min(_Doc.size() - offset, size_t(srv.rand()) % _MaxPiece);
+		if (!stream.write(_Doc.data() + offset, n))
+			return r.s;
+		offset += n;
+	}
+	stream.finish();
+	return r.s;
+}
+
+oTEST(oString_json_stream)
+{
+	const std::string docs[] =
+	{
+		sJSONTestReferenceResult,
+		"[ [], {}, [ {} ], \"a\\\\\", -0.5e+2 ]",
+		make_records(srv, 2000),
+	};
+
+	// streaming reports what visiting a whole document does, no matter how the
+	// pieces fall
+	for (const auto& doc : docs)
+	{
+		json JSON("Stream JSON", doc.c_str());
+		json_recorder expected;
+		oCHECK0(JSON.visit(expected));
+
+		oCHECK(stream_json(srv, doc, 2) == expected.s, "streamed single bytes differ from visit");
+		oCHECK(stream_json(srv, doc, 100) == expected.s, "streamed small pieces differ from visit");
+		oCHECK(stream_json(srv, doc, 64 * 1024) == expected.s, "streamed large pieces differ from visit");
+
+		size_t offset = 0;
+		json_recorder pulled;
+		json_stream stream(pulled);
+		oCHECK0(stream.read([&](void* dst, size_t dst_size)->size_t
+		{
+			const size_t n = std::min(dst_size, doc.size() - offset);
+			memcpy(dst, doc.data() + offset, n);
+			offset += n;
+			return n;
+		}, 37));
+		oCHECK(pulled.s == expected.s, "pulled pieces differ from visit");
+	}
+
+	// a visitor can stop early
+	const std::string stopped = stream_json(srv, docs[0], 100, 5);
+	oCHECK0(std::count(stopped.begin(), stopped.end(), '\n') == 5);
+
+	// unfinished documents throw when finished
+	static const char* sIncomplete[] = { "{\"a\":1", "{\"a\":\"text", "[1,[2]", "", "[1,]" };
+	for (const char* doc : sIncomplete)
+	{
+		bool threw = false;
+		try { stream_json(srv, doc, 4); }
+		catch (std::exception&) { threw = true; }
+		oCHECK(threw, "incomplete json should throw: %s", doc);
+	}
+}
+
+oBENCHMARK(oString_json_benchmark)
+{
+	const std::string doc = make_records(srv, 400000);
+	const double mb = doc.size() / (1024.0 * 1024.0);
+
+	static const uint32_t nruns = 4;
+	const double best = srv.best_seconds(nruns, [&] { json JSON("Benchmark JSON", doc.c_str(), 400000 * 10); });
+
+	srv.status("%.1f MB/s json parse throughput", srv.trace_rate("json parse", mb, "MB", best));
 }
@@ -3,7 +3,9 @@
 #include <oBase/unit_test.h>
 
 #include <oString/xml.h>
+#include <algorithm>
 #include <memory>
+#include <string>
 
 using namespace ouro;
 
@@ -135,3 +137,89 @@ oTEST(oString_xml)
 	XML->visit(t);
 	oCHECK(!strcmp(t.s.c_str(), sCompactExpectedVisitOrder), "Visit out of order: %s", t.s.c_str());
 }
+
+static const char* sStreamTestXML = {
+	"<?xml version=\"1.0\" ?>\n" \
+	"<catalog title=\"Tom &amp; Jerry\" count='2'>\n" \
+	"	<!-- a comment with <tags> and -- dashes -->\n" \
+	"	<cd id=\"first\"><title>Empire &lt;Burlesque&gt;</title><empty></empty><price value=\"10.90\"/></cd>\n" \
+	"	<cd name=\"second\" attr = \"a > b\" flag>\n" \
+	"		<title>Hide your heart</title>\n" \
+	"		<tracks><track>1</track><track>2</track><track/></tracks>\n" \
+	"	</cd>\n" \
+	"	<cd><title>   </title></cd>\n" \
+	"</catalog>\n"
+};
+
+class record_visitor : public xml::visitor
+{
+public:
+	bool node_begin(const char* _NodeName, const char* _XRef, const attr_type* _pAttributes, size_t _NumAttributes) override
+	{
+		s += "<"; s += _NodeName; s += " "; s += _XRef;
+		for (size_t i = 0; i < _NumAttributes; i++) { s += " "; s += _pAttributes[i].first; s += "="; s += _pAttributes[i].second; }
+		s += "\n";
+		return true;
+	}
+	
+	bool node_end(const char* _NodeName, const char* _XRef) override { s += "/"; s += _NodeName; s += " "; s += _XRef; s += "\n"; return true; }
+	bool node_text(const char* _NodeName, const char* _XRef, const char* _NodeText) override { s += _NodeName; s += ": "; s += _NodeText; s += "\n"; return true; }
+
+	std::string s;
+};
+
+static std::string stream_xml(unit_test::services& srv, const char* _XML, size_t _MaxPiece)
+{
+	record_visitor v;
+	xml_stream stream(v);
+	for (size_t offset = 0, size = strlen(_XML); offset < size;)
+	{
+		const size_t n = std::min(size - offset, size_t(srv.rand()) % _MaxPiece);
+		stream.write(_XML + offset, n);
+		offset += n;
+	}
+	stream.finish();
+	return v.s;
+}
+
+oTEST(oString_xml_stream)
+{
+	// streaming reports what visiting a whole document does, no matter how the 
+	// pieces fall
+	for (const char* doc : { sStreamTestXML, sCompactTestXML })
+	{
+		xml XML("Stream XML", doc);
+		record_visitor expected;
+		XML.visit(expected);
+
+		for (size_t max_piece : { 2, 7, 100, 4096 })
+		{
+			std::string s = stream_xml(srv, doc, max_piece);
+			oCHECK(s == expected.s, "streamed pieces of up to %u bytes differ from visit:\n%s", uint32_t(max_piece), s.c_str());
+		}
+	}
+
+	// every top-level node is visited
+	test_visitor t;
+	xml_stream stream(t);
+	stream.write(sTestXML, strlen(sTestXML));
+	stream.finish();
+	oCHECK(t.s.find("TEST; test, TEST, ") != std::string::npos, "second top-level TEST node not visited: %s", t.s.c_str());
+
+	// CDATA is text as it is
+	std::string s = stream_xml(srv, "<a><b><![CDATA[x < y && ]] z]]></b></a>", 3);
+	oCHECK(s == "<a /1\n<b /1/1\nb: x < y && ]] z\n/b /1/1\n/a /1\n", "CDATA was not reported as text: %s", s.c_str());
+
+	// as are declarations with internal subsets
+	s = stream_xml(srv, "<!DOCTYPE a [ <!ENTITY x \"y\"> ]><a>t</a>", 3);
+	oCHECK(s == "<a /1\na: t\n/a /1\n", "DOCTYPE was not skipped: %s", s.c_str());
+
+	static const char* sIncomplete[] = { "<a><b></b>", "<a><!-- ", "<a></b>", "<a attr=\"" };
+	for (const char* doc : sIncomplete)
+	{
+		bool threw = false;
+		try { stream_xml(srv, doc, 4); }
+		catch (std::exception&) { threw = true; }
+		oCHECK(threw, "incomplete xml should throw: %s", doc);
+	}
+}
@@ -0,0 +1,381 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+#include <oString/xml.h>
+#include <cctype>
+#include <cstdio>
+
+namespace ouro {
+
+static const char* xml_whitespace = " \t\r\n";
+
+xml_stream::xml_stream(xml::visitor& visitor)
+	: visitor_(visitor)
+	, state_(state::text)
+	, quote_(0)
+	, run_(0)
+	, depth_(0)
+	, num_roots_(0)
+	, aborted_(false)
+{
+	text_.reserve(256);
+	unit_.reserve(256);
+	names_.reserve(256);
+	xrefs_.reserve(256);
+	scopes_.reserve(32);
+	attrs_.reserve(16);
+}
+
+// unit_ has the characters after a '<' and grows one at a time until they
+// tell what kind of markup it is
+void xml_stream::classify_markup()
+{
+	static const char sComment[] = "!--";
+	static const char sCData[] = "![CDATA[";
+
+	const char* u = unit_.data();
+	const size_t n = unit_.size();
+
+	if (u[0] == '>')
+		throw text_document_error(text_document_errc::generic_parse_error);
+
+	if (u[0] == '?') // processing instruction
+	{
+		depth_ = 0;
+		state_ = state::declaration;
+		return;
+	}
+
+	if (u[0] != '!')
+	{
+		quote_ = 0;
+		state_ = state::tag;
+		return;
+	}
+
+	if (n < 2)
+		return;
+
+	if (n <= 3 && !memcmp(u, sComment, n))
+	{
+		if (n == 3)
+		{
+			run_ = 0;
+			state_ = state::comment;
+		}
+		return;
+	}
+
+	if (n <= 8 && !memcmp(u, sCData, n))
+	{
+		if (n == 8)
+		{
+			run_ = 0;
+			state_ = state::cdata;
+		}
+		return;
+	}
+
+	// something like <!DOCTYPE, which may already have ended
+	depth_ = 0;
+	state_ = state::declaration;
+	for (size_t i = 1; i < n; i++)
+	{
+		if (u[i] == '[') depth_++;
+		else if (u[i] == ']' && depth_) depth_--;
+		else if (u[i] == '>' && !depth_) { state_ = state::text; break; }
+	}
+}
+
+void xml_stream::start_tag()
+{
+	char* s = unit_.data();
+	char* end = s + unit_.size() - 1; // at the nul terminator
+
+	while (end > s && isspace((unsigned char)end[-1]))
+		end--;
+	const bool self_closing = end > s && end[-1] == '/';
+	if (self_closing)
+		end--;
+	*end = 0;
+
+	char* name = s;
+	s += strcspn(s, xml_whitespace);
+	if (*s)
+		*s++ = 0;
+	if (!*name)
+		throw text_document_error(text_document_errc::generic_parse_error);
+	detail::ampersand_decode(name);
+
+	// like xml, an attribute without a value has its name as its value
+	attrs_.clear();
+	while (*s)
+	{
+		while (*s && *s != '_' && !isalnum((unsigned char)*s))
+			s++;
+		if (!*s)
+			break;
+
+		char* attr_name = s;
+		s += strcspn(s, " \t\r\n=");
+		char* attr_name_end = s;
+		s += strspn(s, xml_whitespace);
+
+		char* attr_value = attr_name;
+		if (*s == '=')
+		{
+			s++;
+			s += strspn(s, xml_whitespace);
+			const char quote = *s;
+			if (quote == '\"' || quote == '\'')
+			{
+				attr_value = ++s;
+				s += strcspn(s, quote == '\"' ? "\"" : "'");
+			}
+			else
+			{
+				attr_value = s;
+				s += strcspn(s, xml_whitespace);
+			}
+
+			if (*s)
+				*s++ = 0;
+		}
+
+		*attr_name_end = 0;
+		detail::ampersand_decode(attr_name);
+		if (attr_value != attr_name)
+			detail::ampersand_decode(attr_value);
+		attrs_.push_back(xml::visitor::attr_type(attr_name, attr_value));
+	}
+
+	// the same xref as xml::make_xref: the parent's, then id or name or the
+	// 1-based sibling index
+	const uint32_t index = scopes_.empty() ? ++num_roots_ : ++scopes_.back().num_children;
+	text_.clear();
+
+	const char* id = xml::find_attr_value(attrs_.data(), attrs_.size(), "id");
+	if (!id)
+		id = xml::find_attr_value(attrs_.data(), attrs_.size(), "name");
+
+	char index_string[16];
+	if (!id)
+	{
+		snprintf(index_string, sizeof(index_string), "%u", index);
+		id = index_string;
+	}
+
+	scope sc;
+	sc.name = static_cast<uint32_t>(names_.size());
+	sc.xref = static_cast<uint32_t>(xrefs_.size());
+	sc.num_children = 0;
+
+	names_.insert(names_.end(), name, name + strlen(name) + 1);
+
+	if (!scopes_.empty())
+		for (uint32_t i = scopes_.back().xref; xrefs_[i]; i++)
+		{
+			const char ch = xrefs_[i];
+			xrefs_.push_back(ch);
+		}
+	xrefs_.push_back('/');
+	xrefs_.insert(xrefs_.end(), id, id + strlen(id) + 1);
+
+	const char* nname = names_.data() + sc.name;
+	const char* xref = xrefs_.data() + sc.xref;
+	aborted_ = !visitor_.node_begin(nname, xref, attrs_.data(), attrs_.size());
+
+	if (self_closing)
+	{
+		if (!aborted_)
+			aborted_ = !visitor_.node_end(nname, xref);
+		names_.resize(sc.name);
+		xrefs_.resize(sc.xref);
+	}
+	else
+		scopes_.push_back(sc);
+}
+
+void xml_stream::end_tag()
+{
+	char* name = unit_.data() + 1;
+	char* end = name + strlen(name);
+	while (end > name && isspace((unsigned char)end[-1]))
+		end--;
+	*end = 0;
+	detail::ampersand_decode(name);
+
+	if (scopes_.empty() || strcmp(name, names_.data() + scopes_.back().name))
+		throw text_document_error(text_document_errc::generic_parse_error);
+
+	const scope sc = scopes_.back();
+	scopes_.pop_back();
+	const char* nname = names_.data() + sc.name;
+	const char* xref = xrefs_.data() + sc.xref;
+
+	// like xml, only text in a node without children is reported
+	if (!sc.num_children && !text_.empty())
+	{
+		text_.push_back(0);
+		detail::ampersand_decode(text_.data());
+		aborted_ = !visitor_.node_text(nname, xref, text_.data());
+	}
+	text_.clear();
+
+	if (!aborted_)
+		aborted_ = !visitor_.node_end(nname, xref);
+
+	names_.resize(sc.name);
+	xrefs_.resize(sc.xref);
+}
+
+bool xml_stream::write(const void* src, size_t src_size)
+{
+	const char* c = static_cast<const char*>(src);
+	const char* end = c + src_size;
+
+	while (c < end && !aborted_)
+	{
+		switch (state_)
+		{
+			case state::text:
+			{
+				const char* run = c;
+				while (c < end && *c != '<')
+					c++;
+				if (keeps_text())
+					text_.insert(text_.end(), run, c);
+				if (c < end)
+				{
+					c++;
+					unit_.clear();
+					state_ = state::markup;
+				}
+				break;
+			}
+
+			case state::markup:
+				unit_.push_back(*c++);
+				classify_markup();
+				break;
+
+			case state::tag:
+			{
+				// ends at a > that isn't in an attribute value
+				const char* run = c;
+				for (; c < end; c++)
+				{
+					if (quote_)
+					{
+						if (*c == quote_)
+							quote_ = 0;
+					}
+					else if (*c == '\"' || *c == '\'')
+						quote_ = *c;
+					else if (*c == '>')
+						break;
+				}
+
+				unit_.insert(unit_.end(), run, c);
+				if (c == end)
+					break;
+				c++;
+
+				unit_.push_back(0);
+				state_ = state::text;
+				if (unit_[0] == '/')
+					end_tag();
+				else
+					start_tag();
+				break;
+			}
+
+			case state::comment:
+				for (; c < end; c++)
+				{
+					if (*c == '>' && run_ >= 2)
+						break;
+					run_ = *c == '-' ? run_ + 1 : 0;
+				}
+
+				if (c < end)
+				{
+					c++;
+					state_ = state::text;
+				}
+				break;
+
+			case state::declaration:
+				for (; c < end; c++)
+				{
+					if (*c == '[') depth_++;
+					else if (*c == ']' && depth_) depth_--;
+					else if (*c == '>' && !depth_) break;
+				}
+
+				if (c < end)
+				{
+					c++;
+					state_ = state::text;
+				}
+				break;
+
+			case state::cdata:
+			{
+				// text is ampersand-decoded when reported, so keep CDATA as it is by
+				// encoding its ampersands
+				const bool keep = keeps_text();
+				for (; c < end; c++)
+				{
+					if (*c == '>' && run_ >= 2)
+						break;
+					run_ = *c == ']' ? run_ + 1 : 0;
+					if (!keep)
+						continue;
+					if (*c == '&')
+						text_.insert(text_.end(), "&amp;", "&amp;" + 5);
+					else
+						text_.push_back(*c);
+				}
+
+				if (c < end)
+				{
+					c++;
+					if (keep)
+						text_.resize(text_.size() - 2); // the ]] of ]]>
+					state_ = state::text;
+				}
+				break;
+			}
+		}
+	}
+
+	return !aborted_;
+}
+
+bool xml_stream::finish()
+{
+	if (aborted_)
+		return false;
+
+	if (state_ == state::comment)
+		throw text_document_error(text_document_errc::unclosed_comment);
+
+	if (state_ != state::text || !scopes_.empty())
+		throw text_document_error(text_document_errc::unclosed_scope);
+
+	return true;
+}
+
+bool xml_stream::read(const read_fn& read, size_t chunk_size)
+{
+	detail::text_buffer::std_vector<char> chunk;
+	chunk.resize(chunk_size);
+
+	for (size_t n = read(chunk.data(), chunk_size); n; n = read(chunk.data(), chunk_size))
+		if (!write(chunk.data(), n))
+			return false;
+
+	return finish();
+}
+
+}
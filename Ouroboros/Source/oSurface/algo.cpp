@@ -1,13 +1,20 @@
 // Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
 
 #include <oSurface/algo.h>
+#include <oConcurrency/concurrency.h>
 #include <oCore/color.h>
 #include <oMath/hlslx.h>
 #include <oMath/quantize.h>
-#include <atomic>
+#include <oMemory/allocate.h>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <emmintrin.h>
 
 using namespace std;
-using namespace std::placeholders;
 
 namespace ouro { namespace surface {
 
@@ -176,189 +183,552 @@ void enumerate_pixels(const info_t& input_info
 	}
 }
 
-typedef void (*rms_enumerator)(const void* oRESTRICT pixel1, const void* oRESTRICT pixel2, void* oRESTRICT out_pixel, atomic<uint32_t>* inout_accum);
+// Image comparisons work on luminance: BT.709 weights applied to the stored 
+// values (not linearized) in 1.15 fixed point. Rows are processed 4 or 16 
+// pixels at a time with SSE2 and rows in parallel with parallel_for_range. All
+// sums are integers so results don't depend on how the work is split.
 
-static void sum_squared_diff_r8_to_r8(const void* oRESTRICT pixel1, const void* oRESTRICT pixel2, void* oRESTRICT out_pixel, atomic<uint32_t>* inout_accum)
+static const int16_t lum_r = 6966;  // 0.2126
+static const int16_t lum_g = 23436; // 0.7152
+static const int16_t lum_b = 2366;  // 0.0722
+static const int lum_bits = 15;
+static const int lum_round = 1 << (lum_bits - 1);
+
+struct lum_layout
+{
+	uint32_t size;     // bytes per pixel: 1, 3 or 4
+	int16_t weight[4]; // per byte
+};
+
+static lum_layout get_lum_layout(const format& f)
 {
-	const uint8_t* p1 = (const uint8_t*)pixel1;
-	const uint8_t* p2 = (const uint8_t*)pixel2;
-	uint8_t absDiff = uint8_t (abs(*p1 - *p2));
-	*(uint8_t*)out_pixel = absDiff;
-	inout_accum->fetch_add(uint32_t(absDiff * absDiff));
+	switch (f)
+	{
+		case format::r8_unorm:       return { 1, { 0, 0, 0, 0 } };
+		case format::b8g8r8_unorm:   return { 3, { lum_b, lum_g, lum_r, 0 } };
+		case format::r8g8b8_unorm:   return { 3, { lum_r, lum_g, lum_b, 0 } };
+		case format::b8g8r8a8_unorm:
+		case format::b8g8r8x8_unorm: return { 4, { lum_b, lum_g, lum_r, 0 } };
+		case format::r8g8b8a8_unorm:
+		case format::r8g8b8x8_unorm: return { 4, { lum_r, lum_g, lum_b, 0 } };
+		default: break;
+	}
+
+	oThrow(std::errc::not_supported, "%s not supported", as_string(f));
 }
 
-static void sum_squared_diff_b8g8r8_to_r8(const void* oRESTRICT pixel1, const void* oRESTRICT pixel2, void* oRESTRICT out_pixel, atomic<uint32_t>* inout_accum)
+static inline int lum(const lum_layout& l, const uint8_t* p)
 {
-	const uint8_t* p = (const uint8_t*)pixel1;
-	argb_channels ch;
-	ch.b = *p++;
-	ch.g = *p++;
-	ch.r = *p++;
-	ch.a = 0xff;
+	return l.size == 1 ? p[0] : ((p[0] * l.weight[0] + p[1] * l.weight[1] + p[2] * l.weight[2] + lum_round) >> lum_bits);
+}
 
-	float4 srgb = truetofloat4(ch.argb);
-	float L1 = srgbtolum(srgb.xyz());
-	
-	p = (const uint8_t*)pixel2;
-	ch.b = *p++;
-	ch.g = *p++;
-	ch.r = *p++;
-
-	srgb = truetofloat4(ch.argb);
-	float L2 = srgbtolum(srgb.xyz());
-	uint8_t absDiff = (uint8_t)f32ton8(abs(L1 - L2));
-	*(uint8_t*)out_pixel = absDiff;
-	inout_accum->fetch_add(uint32_t(absDiff * absDiff));
+static inline __m128i lum_weights(const lum_layout& l)
+{
+	return _mm_setr_epi16(l.weight[0], l.weight[1], l.weight[2], 0, l.weight[0], l.weight[1], l.weight[2], 0);
 }
 
-static void sum_squared_diff_b8g8r8a8_to_r8(const void* oRESTRICT pixel1, const void* oRESTRICT pixel2, void* oRESTRICT out_pixel, atomic<uint32_t>* inout_accum)
+// adds pairs of 32-bit lanes from two registers: { a0+a1, a2+a3, b0+b1, b2+b3 }
+static inline __m128i add_pairs(const __m128i& a, const __m128i& b)
 {
-	const uint8_t* p = (const uint8_t*)pixel1;
-	argb_channels ch;
-	ch.b = *p++;
-	ch.g = *p++;
-	ch.r = *p++;
-	ch.a = *p++;
-
-	float4 srgb = truetofloat4(ch.argb);
-	float L1 = srgbtolum(srgb.xyz());
-
-	p = (const uint8_t*)pixel2;
-	ch.b = *p++;
-	ch.g = *p++;
-	ch.r = *p++;
-	ch.a = *p++;
-
-	srgb = truetofloat4(ch.argb);
-	float L2 = srgbtolum(srgb.xyz());
-	uint8_t absDiff = (uint8_t)f32ton8(abs(L1 - L2));
-	*(uint8_t*)out_pixel = absDiff;
-	inout_accum->fetch_add(uint32_t(absDiff * absDiff));
+	const __m128 fa = _mm_castsi128_ps(a), fb = _mm_castsi128_ps(b);
+	const __m128i even = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(2,0,2,0)));
+	const __m128i odd = _mm_castps_si128(_mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3,1,3,1)));
+	return _mm_add_epi32(even, odd);
 }
 
-static rms_enumerator get_rms_enumerator(format in_format, format out_format)
+// weighted sum of 4 pixels of 4 bytes whose channels have been widened to 16 
+// bits, lo and hi holding 2 pixels each
+static inline __m128i weigh4(const __m128i& lo, const __m128i& hi, const __m128i& weights)
 {
-	#define CASE(i,o) ((uint32_t(i)<<16) | uint32_t(o))
-	uint32_t req = CASE(in_format, out_format);
+	return add_pairs(_mm_madd_epi16(lo, weights), _mm_madd_epi16(hi, weights));
+}
 
-	switch (req)
+static inline uint32_t hsum(const __m128i& v)
+{
+	__m128i s = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1,0,3,2)));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2,3,0,1)));
+	return (uint32_t)_mm_cvtsi128_si32(s);
+}
+
+static inline uint64_t hsum64(const __m128i& v)
+{
+	alignas(16) uint32_t lanes[4];
+	_mm_store_si128((__m128i*)lanes, v);
+	return uint64_t(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+}
+
+static inline uint32_t hmax_epi16(const __m128i& v)
+{
+	__m128i m = _mm_max_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1,0,3,2)));
+	m = _mm_max_epi16(m, _mm_shuffle_epi32(m, _MM_SHUFFLE(2,3,0,1)));
+	m = _mm_max_epi16(m, _mm_srli_epi32(m, 16));
+	return (uint32_t)(_mm_cvtsi128_si32(m) & 0xffff);
+}
+
+struct diff_sums
+{
+	uint64_t sum_sq;
+	uint32_t max_diff;
+};
+
+// luminance of each pixel
+static void lum_row(const lum_layout& l, uint8_t* oRESTRICT dst, const uint8_t* oRESTRICT src, uint32_t n)
+{
+	uint32_t x = 0;
+	if (l.size == 1)
 	{
-		case CASE(format::r8_unorm, format::r8_unorm): return sum_squared_diff_r8_to_r8;
-		case CASE(format::b8g8r8_unorm, format::r8_unorm): return sum_squared_diff_b8g8r8_to_r8;
-		case CASE(format::b8g8r8a8_unorm, format::r8_unorm): return sum_squared_diff_b8g8r8a8_to_r8;
-		default: break;
+		memcpy(dst, src, n);
+		return;
 	}
 
-	oThrow(std::errc::not_supported, "%s -> %s not supported", as_string(in_format), as_string(out_format));
-	#undef CASE
+	if (l.size == 4)
+	{
+		const __m128i w = lum_weights(l);
+		const __m128i round = _mm_set1_epi32(lum_round);
+		const __m128i zero = _mm_setzero_si128();
+		for (; x + 4 <= n; x += 4, src += 16)
+		{
+			const __m128i v = _mm_loadu_si128((const __m128i*)src);
+			__m128i y = weigh4(_mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero), w);
+			y = _mm_srai_epi32(_mm_add_epi32(y, round), lum_bits);
+			y = _mm_packs_epi32(y, y);
+			const int packed = _mm_cvtsi128_si32(_mm_packus_epi16(y, y));
+			memcpy(dst + x, &packed, 4);
+		}
+	}
+
+	for (; x < n; x++, src += l.size)
+		dst[x] = uint8_t(lum(l, src));
 }
 
-float calc_rms(const info_t& info
-	, const const_mapped_subresource& mapped1
-	, const const_mapped_subresource& mapped2)
+// |lum(a) - lum(b)| per pixel, optionally written scaled and clamped to out
+static void diff_row(const lum_layout& l, uint8_t* oRESTRICT out, uint32_t diff_scale, const uint8_t* oRESTRICT a, const uint8_t* oRESTRICT b, uint32_t n, diff_sums* oRESTRICT sums)
 {
-	rms_enumerator en = get_rms_enumerator(info.format, format::r8_unorm);
-	atomic<uint32_t> SumOfSquares(0);
-	uint32_t DummyPixelOut[4]; // largest a pixel can ever be currently
+	const __m128i zero = _mm_setzero_si128();
+	const uint32_t scale_ = min(diff_scale, 255u);
+	const __m128i scale = _mm_set1_epi16(int16_t(scale_));
+	const __m128i clamp = _mm_set1_epi16(int16_t(scale_ ? (255 / scale_ + 1) : 0)); // keeps d*scale positive in 16 bits
+	__m128i sq = zero, mx = zero;
+	uint32_t x = 0;
+
+	if (l.size == 1)
+	{
+		for (; x + 16 <= n; x += 16)
+		{
+			const __m128i va = _mm_loadu_si128((const __m128i*)(a + x));
+			const __m128i vb = _mm_loadu_si128((const __m128i*)(b + x));
+			const __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+			const __m128i lo = _mm_unpacklo_epi8(d, zero), hi = _mm_unpackhi_epi8(d, zero);
+			sq = _mm_add_epi32(sq, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+			mx = _mm_max_epi16(mx, _mm_max_epi16(lo, hi));
+			if (out)
+				_mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(_mm_mullo_epi16(_mm_min_epi16(lo, clamp), scale), _mm_mullo_epi16(_mm_min_epi16(hi, clamp), scale)));
+		}
+	}
 
-	enumerate_pixels(info.dimensions.xy(), info.format
-		, mapped1
-		, mapped2
-		, bind(en, _1, _2, &DummyPixelOut, &SumOfSquares));
+	else if (l.size == 4)
+	{
+		const __m128i w = lum_weights(l);
+		const __m128i round = _mm_set1_epi32(lum_round);
+		for (; x + 4 <= n; x += 4)
+		{
+			const __m128i va = _mm_loadu_si128((const __m128i*)(a + x * 4));
+			const __m128i vb = _mm_loadu_si128((const __m128i*)(b + x * 4));
+			const __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero));
+			const __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero));
+			__m128i d = weigh4(lo, hi, w);
+			const __m128i sign = _mm_srai_epi32(d, 31);
+			d = _mm_sub_epi32(_mm_xor_si128(d, sign), sign);
+			d = _mm_srai_epi32(_mm_add_epi32(d, round), lum_bits);
+			d = _mm_packs_epi32(d, zero); // 4 16-bit diffs
+			sq = _mm_add_epi32(sq, _mm_madd_epi16(d, d));
+			mx = _mm_max_epi16(mx, d);
+			if (out)
+			{
+				const int packed = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_mullo_epi16(_mm_min_epi16(d, clamp), scale), zero));
+				memcpy(out + x, &packed, 4);
+			}
+		}
+	}
 
-	return sqrt(SumOfSquares / float(info.dimensions.x * info.dimensions.y));
+	uint64_t sum_sq = hsum64(sq);
+	uint32_t max_diff = hmax_epi16(mx);
+	a += x * l.size;
+	b += x * l.size;
+	for (; x < n; x++, a += l.size, b += l.size)
+	{
+		int d = l.size == 1 ? (int(*a) - int(*b)) : ((a[0] - b[0]) * l.weight[0] + (a[1] - b[1]) * l.weight[1] + (a[2] - b[2]) * l.weight[2]);
+		if (l.size != 1)
+			d = (abs(d) + lum_round) >> lum_bits;
+		d = abs(d);
+		sum_sq += uint32_t(d * d);
+		max_diff = max(max_diff, uint32_t(d));
+		if (out)
+			out[x] = uint8_t(min(uint32_t(d) * scale_, 255u));
+	}
+
+	sums->sum_sq += sum_sq;
+	sums->max_diff = max(sums->max_diff, max_diff);
 }
 
-float calc_rms(const info_t& input_info
-	, const const_mapped_subresource& mappedInput1
-	, const const_mapped_subresource& mappedInput2
-	, const info_t& output_info
-	, mapped_subresource& mapped_output)
+// sums of x, y, x*x, y*y and x*y over a window of luminance values
+struct window_sums
 {
-	function<void(const void* pixel1, const void* pixel2, void* out_pixel)> Fn;
+	uint32_t x, y, xx, yy, xy;
+};
 
-	rms_enumerator en = get_rms_enumerator(input_info.format, output_info.format);
-	atomic<uint32_t> SumOfSquares(0);
+static window_sums sum_window(const uint8_t* oRESTRICT a, uint32_t a_pitch, const uint8_t* oRESTRICT b, uint32_t b_pitch, uint32_t width, uint32_t height)
+{
+	window_sums s;
+	if (width == 8)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		__m128i sx = zero, sy = zero, sxx = zero, syy = zero, sxy = zero;
+		for (uint32_t r = 0; r < height; r++, a += a_pitch, b += b_pitch)
+		{
+			const __m128i va = _mm_loadl_epi64((const __m128i*)a);
+			const __m128i vb = _mm_loadl_epi64((const __m128i*)b);
+			sx = _mm_add_epi32(sx, _mm_sad_epu8(va, zero));
+			sy = _mm_add_epi32(sy, _mm_sad_epu8(vb, zero));
+			const __m128i wa = _mm_unpacklo_epi8(va, zero), wb = _mm_unpacklo_epi8(vb, zero);
+			sxx = _mm_add_epi32(sxx, _mm_madd_epi16(wa, wa));
+			syy = _mm_add_epi32(syy, _mm_madd_epi16(wb, wb));
+			sxy = _mm_add_epi32(sxy, _mm_madd_epi16(wa, wb));
+		}
+		s.x = (uint32_t)_mm_cvtsi128_si32(sx);
+		s.y = (uint32_t)_mm_cvtsi128_si32(sy);
+		s.xx = hsum(sxx);
+		s.yy = hsum(syy);
+		s.xy = hsum(sxy);
+		return s;
+	}
 
-	enumerate_pixels(input_info
-		, mappedInput1
-		, mappedInput2
-		, output_info
-		, mapped_output
-		, bind(en, _1, _2, _3, &SumOfSquares));
+	memset(&s, 0, sizeof(s));
+	for (uint32_t r = 0; r < height; r++, a += a_pitch, b += b_pitch)
+		for (uint32_t c = 0; c < width; c++)
+		{
+			s.x += a[c];
+			s.y += b[c];
+			s.xx += a[c] * a[c];
+			s.yy += b[c] * b[c];
+			s.xy += a[c] * b[c];
+		}
+	return s;
+}
 
-	return sqrt(SumOfSquares / float(input_info.dimensions.x * input_info.dimensions.y));
+static double ssim(const window_sums& s, uint32_t n)
+{
+	static const double c1 = (0.01 * 255.0) * (0.01 * 255.0);
+	static const double c2 = (0.03 * 255.0) * (0.03 * 255.0);
+	const double inv_n = 1.0 / n;
+	const double mx = s.x * inv_n, my = s.y * inv_n;
+	const double vx = s.xx * inv_n - mx * mx;
+	const double vy = s.yy * inv_n - my * my;
+	const double cxy = s.xy * inv_n - mx * my;
+	return ((2.0 * mx * my + c1) * (2.0 * cxy + c2)) / ((mx * mx + my * my + c1) * (vx + vy + c2));
 }
 
-typedef void (*histogramenumerator)(const void* pixel, atomic<uint32_t>* histogram);
+static void histogram_row8(const uint8_t* oRESTRICT lum, uint32_t n, uint32_t (*oRESTRICT h)[256])
+{
+	// 4 tables so repeated values don't stall on the same counter
+	uint32_t x = 0;
+	for (; x + 4 <= n; x += 4)
+	{
+		h[0][lum[x]]++;
+		h[1][lum[x+1]]++;
+		h[2][lum[x+2]]++;
+		h[3][lum[x+3]]++;
+	}
+	for (; x < n; x++)
+		h[0][lum[x]]++;
+}
 
-static void histogram_r8_unorm_8bit(const void* pixel, atomic<uint32_t>* histogram)
+// Each parallel_for_range subrange borrows a zero-initialized partial result
+// and returns it when done, so there are only as many partials as subranges 
+// that ran at the same time. They are combined once all rows are done.
+template<typename T>
+class partials
 {
-	uint8_t c = *(const uint8_t*)pixel;
-	histogram[c]++;
+public:
+	T* acquire()
+	{
+		lock_guard<mutex> lock(mtx);
+		if (available.empty())
+		{
+			all.emplace_back(new T());
+			return all.back().get();
+		}
+		T* p = available.back();
+		available.pop_back();
+		return p;
+	}
+
+	void release(T* p)
+	{
+		lock_guard<mutex> lock(mtx);
+		available.push_back(p);
+	}
+
+	template<typename FN> void for_each(const FN& fn) const { for (const auto& p : all) fn(*p); }
+
+private:
+	mutex mtx;
+	vector<unique_ptr<T>> all;
+	vector<T*> available;
+};
+
+// calls fn(partial, begin, end) for subranges of rows in parallel
+template<typename T, typename FN>
+static void parallel_for_rows(uint32_t num_rows, partials<T>& p, const FN& fn)
+{
+	parallel_for_range(0, num_rows, [&](size_t begin, size_t end)
+	{
+		T* partial = p.acquire();
+		fn(*partial, uint32_t(begin), uint32_t(end));
+		p.release(partial);
+	});
 }
 
-static void histogram_b8g8r8a8_unorm_8bit(const void* pixel, atomic<uint32_t>* histogram)
+static diff_sums sum_diffs(const info_t& info
+	, const const_mapped_subresource& mapped1
+	, const const_mapped_subresource& mapped2
+	, const mapped_subresource* mapped_output
+	, uint32_t diff_scale)
 {
-	const uint8_t* p = (const uint8_t*)pixel;
-	argb_channels ch;
-	ch.b = *p++;
-	ch.g = *p++;
-	ch.r = *p++;
-	ch.a = 0xff;
-
-	float4 srgb = truetofloat4(ch.argb);
-	float lum = srgbtolum(srgb.xyz());
-	uint8_t index = (uint8_t)f32ton8(lum);
-	histogram[index]++;
+	const lum_layout l = get_lum_layout(info.format);
+	const uint32_t width = info.dimensions.x;
+	const uint32_t height = info.dimensions.y;
+
+	partials<diff_sums> p;
+	parallel_for_rows(height, p, [&](diff_sums& partial, uint32_t begin, uint32_t end)
+	{
+		for (uint32_t y = begin; y < end; y++)
+		{
+			const uint8_t* row1 = (const uint8_t*)mapped1.data + y * mapped1.row_pitch;
+			const uint8_t* row2 = (const uint8_t*)mapped2.data + y * mapped2.row_pitch;
+			uint8_t* out = mapped_output ? ((uint8_t*)mapped_output->data + y * mapped_output->row_pitch) : nullptr;
+			diff_row(l, out, diff_scale, row1, row2, width, &partial);
+		}
+	});
+
+	diff_sums sums = { 0, 0 };
+	p.for_each([&](const diff_sums& partial)
+	{
+		sums.sum_sq += partial.sum_sq;
+		sums.max_diff = max(sums.max_diff, partial.max_diff);
+	});
+
+	return sums;
+}
+
+static diff_stats_t as_stats(const diff_sums& sums, uint32_t num_pixels)
+{
+	const double mse = num_pixels ? (sums.sum_sq / double(num_pixels)) : 0.0;
+
+	diff_stats_t stats;
+	stats.rms = float(sqrt(mse));
+	stats.psnr = mse > 0.0 ? float(10.0 * log10(255.0 * 255.0 / mse)) : numeric_limits<float>::infinity();
+	stats.max_diff = sums.max_diff;
+	return stats;
+}
+
+diff_stats_t calc_diff_stats(const info_t& info
+	, const const_mapped_subresource& mapped1
+	, const const_mapped_subresource& mapped2)
+{
+	return as_stats(sum_diffs(info, mapped1, mapped2, nullptr, 0), info.dimensions.x * info.dimensions.y);
+}
+
+diff_stats_t calc_diff_stats(const info_t& input_info
+	, const const_mapped_subresource& mapped_input1
+	, const const_mapped_subresource& mapped_input2
+	, const info_t& output_info
+	, mapped_subresource& mapped_output
+	, uint32_t diff_scale)
+{
+	if (any(input_info.dimensions.xy() != output_info.dimensions.xy()))
+		oThrow(std::errc::invalid_argument, "Dimensions mismatch In(%dx%d) != Out(%dx%d)"
+			, input_info.dimensions.x
+			, input_info.dimensions.y
+			, output_info.dimensions.x
+			, output_info.dimensions.y);
+
+	if (output_info.format != format::r8_unorm)
+		oThrow(std::errc::not_supported, "%s -> %s not supported", as_string(input_info.format), as_string(output_info.format));
+
+	return as_stats(sum_diffs(input_info, mapped_input1, mapped_input2, &mapped_output, diff_scale), input_info.dimensions.x * input_info.dimensions.y);
 }
 
-static void histogram_r16_unorm_16bit(const void* pixel, atomic<uint32_t>* histogram)
+float calc_rms(const info_t& info
+	, const const_mapped_subresource& mapped1
+	, const const_mapped_subresource& mapped2)
 {
-	uint16_t c = *(const uint16_t*)pixel;
-	histogram[c]++;
+	return calc_diff_stats(info, mapped1, mapped2).rms;
 }
 
-static void histogram_r16_float_16bit(const void* pixel, atomic<uint32_t>* histogram)
+float calc_rms(const info_t& input_info
+	, const const_mapped_subresource& mapped_input1
+	, const const_mapped_subresource& mapped_input2
+	, const info_t& output_info
+	, mapped_subresource& mapped_output
+	, uint32_t diff_scale)
 {
-	float f = f16tof32(*(const uint16_t*)pixel);
-	uint16_t c = static_cast<uint16_t>(round(65535.0f * f));
-	histogram[c]++;
+	return calc_diff_stats(input_info, mapped_input1, mapped_input2, output_info, mapped_output, diff_scale).rms;
 }
 
-histogramenumerator get_histogramenumerator(const format& f, int bitdepth)
+// SSIM is calculated on luminance over 8x8 windows that overlap by half, or 
+// one window covering the whole image if it's smaller than that.
+static const uint32_t ssim_window = 8;
+static const uint32_t ssim_step = 4;
+
+float calc_ssim(const info_t& info
+	, const const_mapped_subresource& mapped1
+	, const const_mapped_subresource& mapped2)
 {
-	#define IO(f,b) ((uint32_t(f) << 16) | uint32_t(b))
-	uint32_t sel = IO(f, bitdepth);
-	switch (sel)
+	const lum_layout l = get_lum_layout(info.format);
+	const uint32_t width = info.dimensions.x;
+	const uint32_t height = info.dimensions.y;
+	if (!width || !height)
+		oThrow(std::errc::invalid_argument, "empty surface");
+
+	// r8 is already luminance, otherwise convert both to a scratch plane each
+	const uint8_t* lum1 = (const uint8_t*)mapped1.data;
+	const uint8_t* lum2 = (const uint8_t*)mapped2.data;
+	uint32_t pitch1 = mapped1.row_pitch;
+	uint32_t pitch2 = mapped2.row_pitch;
+
+	blob scratch;
+	if (l.size != 1)
 	{
-		case IO(format::r8_unorm, 8): return histogram_r8_unorm_8bit;
-		case IO(format::b8g8r8a8_unorm, 8): return histogram_b8g8r8a8_unorm_8bit;
-		case IO(format::r16_unorm, 16): return histogram_r16_unorm_16bit;
-		case IO(format::r16_float, 16): return histogram_r16_float_16bit;
-		default: break;
+		const uint32_t pitch = align(width, 16u);
+		const size_t plane_bytes = size_t(pitch) * height;
+		scratch = default_allocator.scoped_allocate(plane_bytes * 2, "ssim luminance");
+		if (!scratch)
+			oThrow(std::errc::not_enough_memory, "ssim scratch allocation failed");
+
+		uint8_t* dst1 = scratch;
+		uint8_t* dst2 = dst1 + plane_bytes;
+		parallel_for_range(0, height, [&](size_t begin, size_t end)
+		{
+			for (uint32_t y = uint32_t(begin); y < end; y++)
+			{
+				lum_row(l, dst1 + y * pitch, (const uint8_t*)mapped1.data + y * mapped1.row_pitch, width);
+				lum_row(l, dst2 + y * pitch, (const uint8_t*)mapped2.data + y * mapped2.row_pitch, width);
+			}
+		});
+
+		lum1 = dst1;
+		lum2 = dst2;
+		pitch1 = pitch2 = pitch;
 	}
 
-	oThrow(std::errc::not_supported, "%dbit histogram on %s not supported", bitdepth, as_string(f));
-	#undef IO
+	const uint32_t window_w = min(width, ssim_window);
+	const uint32_t window_h = min(height, ssim_window);
+	const uint32_t num_x = (width - window_w) / ssim_step + 1;
+	const uint32_t num_y = (height - window_h) / ssim_step + 1;
+	const uint32_t window_pixels = window_w * window_h;
+
+	// one partial sum per row of windows, added in order so the result is stable
+	vector<double> row_sums(num_y);
+	parallel_for(0, num_y, [&](size_t wy)
+	{
+		const uint32_t y = uint32_t(wy) * ssim_step;
+		const uint8_t* row1 = lum1 + y * pitch1;
+		const uint8_t* row2 = lum2 + y * pitch2;
+		double sum = 0.0;
+		for (uint32_t x = 0; x < num_x * ssim_step; x += ssim_step)
+			sum += ssim(sum_window(row1 + x, pitch1, row2 + x, pitch2, window_w, window_h), window_pixels);
+		row_sums[wy] = sum;
+	});
+
+	double total = 0.0;
+	for (const auto& s : row_sums)
+		total += s;
+
+	return float(total / (double(num_x) * num_y));
+}
+
+void histogram8(const info_t& info, const const_mapped_subresource& mapped, uint32_t histogram[256])
+{
+	const lum_layout l = get_lum_layout(info.format);
+	const uint32_t width = info.dimensions.x;
+	const uint32_t height = info.dimensions.y;
+
+	// each partial counts into its own 4 tables and converts into its own row
+	struct tables_t
+	{
+		tables_t() { memset(h, 0, sizeof(h)); }
+		uint32_t h[4][256];
+		vector<uint8_t> lum;
+	};
+
+	partials<tables_t> p;
+	parallel_for_rows(height, p, [&](tables_t& t, uint32_t begin, uint32_t end)
+	{
+		if (l.size != 1)
+			t.lum.resize(align(width, 16u));
+		for (uint32_t y = begin; y < end; y++)
+		{
+			const uint8_t* row = (const uint8_t*)mapped.data + y * mapped.row_pitch;
+			if (l.size != 1)
+			{
+				lum_row(l, t.lum.data(), row, width);
+				row = t.lum.data();
+			}
+			histogram_row8(row, width, t.h);
+		}
+	});
+
+	memset(histogram, 0, sizeof(uint32_t) * 256);
+	p.for_each([&](const tables_t& t)
+	{
+		for (uint32_t i = 0; i < 4; i++)
+			for (uint32_t v = 0; v < 256; v++)
+				histogram[v] += t.h[i][v];
+	});
 }
 
-void histogram8(const subresource_info_t& subresource_info, const const_mapped_subresource& mapped, uint32_t histogram[256])
+static inline uint16_t f16_to_unorm16(uint16_t h)
 {
-	atomic<uint32_t> H[256];
-	memset(H, 0, sizeof(uint32_t) * 256);
-	histogramenumerator en = get_histogramenumerator(subresource_info.format, 8);
-	enumerate_pixels(subresource_info.dimensions.xy(), subresource_info.format, mapped, bind(en, _1, H));
-	memcpy(histogram, H, sizeof(uint32_t) * 256);
+	const float f = f16tof32(h);
+	return uint16_t(0.5f + 65535.0f * (f > 0.0f ? (f < 1.0f ? f : 1.0f) : 0.0f)); // nan counts as 0
 }
 
-void histogram16(const subresource_info_t& subresource_info, const const_mapped_subresource& mapped, uint32_t histogram[65536])
+void histogram16(const info_t& info, const const_mapped_subresource& mapped, uint32_t histogram[65536])
 {
-	atomic<uint32_t> H[65536];
-	memset(H, 0, sizeof(uint32_t) * 65536);
-	histogramenumerator en = get_histogramenumerator(subresource_info.format, 16);
-	enumerate_pixels(subresource_info.dimensions.xy(), subresource_info.format, mapped, bind(en, _1, H));
-	memcpy(histogram, H, sizeof(uint32_t) * 65536);
+	const bool is_float = info.format == format::r16_float;
+	if (!is_float && info.format != format::r16_unorm)
+		oThrow(std::errc::not_supported, "16bit histogram on %s not supported", as_string(info.format));
+
+	const uint32_t width = info.dimensions.x;
+	const uint32_t height = info.dimensions.y;
+
+	// tables are 256 KB each, so they're only allocated for subranges that run
+	// at the same time rather than for each subrange
+	struct table_t { uint32_t h[65536]; };
+
+	partials<table_t> p;
+	parallel_for_rows(height, p, [&](table_t& t, uint32_t begin, uint32_t end)
+	{
+		uint32_t* h = t.h;
+		for (uint32_t y = begin; y < end; y++)
+		{
+			const uint16_t* row = (const uint16_t*)((const uint8_t*)mapped.data + y * mapped.row_pitch);
+			if (is_float)
+				for (uint32_t x = 0; x < width; x++)
+					h[f16_to_unorm16(row[x])]++;
+			else
+				for (uint32_t x = 0; x < width; x++)
+					h[row[x]]++;
+		}
+	});
+
+	memset(histogram, 0, sizeof(uint32_t) * 65536);
+	p.for_each([&](const table_t& t)
+	{
+		for (uint32_t v = 0; v < 65536; v++)
+			histogram[v] += t.h[v];
+	});
 }
 
 }}
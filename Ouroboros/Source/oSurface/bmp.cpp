@@ -3,6 +3,7 @@
 #include <oSurface/codec.h>
 #include <oSurface/convert.h>
 #include "bmp.h"
+#include "row_codec.h"
 
 namespace ouro { namespace surface {
 
@@ -38,69 +39,118 @@ format required_input_bmp(const format& stored)
 	return format::unknown;
 }
 
-blob encode_bmp(const image& img, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
+// rows are stored bottom-up and padded to 4 bytes
+static uint32_t bmp_row_pitch(const info_t& info)
 {
-	auto info = img.info();
-	if (info.format != surface::format::b8g8r8a8_unorm && info.format != surface::format::b8g8r8_unorm)
-		oThrow(std::errc::invalid_argument, "source must be b8g8r8a8_unorm or b8g8r8_unorm");
+	return align(element_size(info.format) * info.dimensions.x, 4u);
+}
 
-	const uint32_t src_byte_count = element_size(info.format);
+class bmp_row_decoder : public detail::row_decoder
+{
+public:
+	bmp_row_decoder() : bits_(nullptr), row_pitch_(0) {}
 
-	const uint32_t element_size = surface::element_size(info.format);
-	const uint32_t unaligned_row_pitch = element_size * info.dimensions.x;
-	const uint32_t aligned_row_pitch = align(unaligned_row_pitch, 4);
-	const uint32_t buffer_size = aligned_row_pitch * info.dimensions.y;
+	void initialize(const void* buffer, size_t size, const allocator& temp_alloc)
+	{
+		info_ = get_info_bmp(buffer, size);
+		oCheck(info_.format != format::unknown, std::errc::invalid_argument, "invalid bmp buffer");
+
+		auto bfh = (const bmp_header*)buffer;
+		bits_ = (const uint8_t*)buffer + bfh->bfOffBits;
+		row_pitch_ = bmp_row_pitch(info_);
+		oCheck(bfh->bfOffBits + size_t(row_pitch_) * info_.dimensions.y <= size, std::errc::invalid_argument, "truncated bmp buffer");
+	}
 
-	const uint32_t bfOffBits = sizeof(bmp_header) + sizeof(bmp_infoheader);
-	const uint32_t bfSize = bfOffBits + buffer_size;
-	const bool is_32bit = info.format == surface::format::b8g8r8a8_unorm;
+	void read(const mapped_subresource& dst, uint32_t num_rows) override
+	{
+		const uint32_t row_bytes = element_size(info_.format) * info_.dimensions.x;
+		for (uint32_t y = 0; y < num_rows; y++, row_++)
+			memcpy(byte_add(dst.data, y * dst.row_pitch), bits_ + (info_.dimensions.y - 1 - row_) * row_pitch_, row_bytes);
+	}
 
-	blob p = file_alloc.scoped_allocate(bfSize, "encoded bmp");
+private:
+	const uint8_t* bits_;
+	uint32_t row_pitch_;
+};
 
-	auto bfh = (bmp_header*)p;
-	auto bmi = (bmp_info*)&bfh[1];
-	void* bits_ = (uint8_t*)p + bfOffBits;
+class bmp_row_encoder : public detail::row_encoder
+{
+public:
+	bmp_row_encoder() : bits_(nullptr), row_pitch_(0) {}
 
-	bfh->bfType = bmp_signature;
-	bfh->bfSize = bfSize;
-	bfh->bfReserved1 = 0;
-	bfh->bfReserved2 = 0;
-	bfh->bfOffBits = bfOffBits;
+	void initialize(const info_t& info, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
+	{
+		if (info.format != surface::format::b8g8r8a8_unorm && info.format != surface::format::b8g8r8_unorm)
+			oThrow(std::errc::invalid_argument, "source must be b8g8r8a8_unorm or b8g8r8_unorm");
+
+		info_ = info;
+		row_pitch_ = bmp_row_pitch(info);
+		const uint32_t buffer_size = row_pitch_ * info.dimensions.y;
+		const uint32_t bfOffBits = sizeof(bmp_header) + sizeof(bmp_infoheader);
+		const uint32_t bfSize = bfOffBits + buffer_size;
+
+		file_ = file_alloc.scoped_allocate(bfSize, "encoded bmp");
+
+		auto bfh = (bmp_header*)file_;
+		auto bmi = (bmp_info*)&bfh[1];
+		bits_ = (uint8_t*)file_ + bfOffBits;
+
+		bfh->bfType = bmp_signature;
+		bfh->bfSize = bfSize;
+		bfh->bfReserved1 = 0;
+		bfh->bfReserved2 = 0;
+		bfh->bfOffBits = bfOffBits;
 	
-	bmi->bmiHeader.biSize = sizeof(bmp_infoheader);
-	bmi->bmiHeader.biWidth = info.dimensions.x;
-	bmi->bmiHeader.biHeight = info.dimensions.y;
-	bmi->bmiHeader.biPlanes = 1;
-	bmi->bmiHeader.biBitCount = is_32bit ? 32 : 24;
-	bmi->bmiHeader.biCompression = bmp_compression::rgb;
-	bmi->bmiHeader.biSizeImage = buffer_size;
-	bmi->bmiHeader.biXPelsPerMeter = 0x0ec4;
-	bmi->bmiHeader.biYPelsPerMeter = 0x0ec4;
-	bmi->bmiHeader.biClrUsed = 0;
-	bmi->bmiHeader.biClrImportant = 0;
+		bmi->bmiHeader.biSize = sizeof(bmp_infoheader);
+		bmi->bmiHeader.biWidth = info.dimensions.x;
+		bmi->bmiHeader.biHeight = info.dimensions.y;
+		bmi->bmiHeader.biPlanes = 1;
+		bmi->bmiHeader.biBitCount = info.format == surface::format::b8g8r8a8_unorm ? 32 : 24;
+		bmi->bmiHeader.biCompression = bmp_compression::rgb;
+		bmi->bmiHeader.biSizeImage = buffer_size;
+		bmi->bmiHeader.biXPelsPerMeter = 0x0ec4;
+		bmi->bmiHeader.biYPelsPerMeter = 0x0ec4;
+		bmi->bmiHeader.biClrUsed = 0;
+		bmi->bmiHeader.biClrImportant = 0;
+	}
 
-	shared_lock lock(img);
-	
-	uint32_t padding = aligned_row_pitch - unaligned_row_pitch;
-	for (uint32_t y = 0, y1 = info.dimensions.y-1; y < info.dimensions.y; y++, y1--)
+	void write(const const_mapped_subresource& src, uint32_t num_rows) override
 	{
-		auto scanline = y * aligned_row_pitch + (uint8_t*)bits_;
-		auto src = y1 * lock.mapped.row_pitch + (const uint8_t*)lock.mapped.data;
-		for (uint32_t x = 0; x < unaligned_row_pitch; x += element_size)
+		const uint32_t row_bytes = element_size(info_.format) * info_.dimensions.x;
+		for (uint32_t y = 0; y < num_rows; y++, row_++)
 		{
-			*scanline++ = src[0];
-			*scanline++ = src[1];
-			*scanline++ = src[2];
-			if (is_32bit)
-				*scanline++ = src[3];
-			src += src_byte_count;
+			uint8_t* scanline = bits_ + (info_.dimensions.y - 1 - row_) * row_pitch_;
+			memcpy(scanline, byte_add(src.data, y * src.row_pitch), row_bytes);
+			memset(scanline + row_bytes, 0, row_pitch_ - row_bytes);
 		}
-
-		for (uint32_t x = unaligned_row_pitch; x < aligned_row_pitch; x++)
-			*scanline++ = 0;
 	}
 
-	return p;
+	blob finish() override { return std::move(file_); }
+
+private:
+	blob file_;
+	uint8_t* bits_;
+	uint32_t row_pitch_;
+};
+
+detail::row_decoder* new_row_decoder_bmp(const void* buffer, size_t size, const allocator& temp_alloc)
+{
+	return detail::new_row_codec<bmp_row_decoder>(temp_alloc, "bmp row decoder", buffer, size, temp_alloc);
+}
+
+detail::row_encoder* new_row_encoder_bmp(const info_t& info, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
+{
+	return detail::new_row_codec<bmp_row_encoder>(temp_alloc, "bmp row encoder", info, file_alloc, temp_alloc, compression);
+}
+
+blob encode_bmp(const image& img, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
+{
+	auto info = img.info();
+	bmp_row_encoder e;
+	e.initialize(info, file_alloc, temp_alloc, compression);
+	shared_lock lock(img);
+	e.write(lock.mapped, info.dimensions.y);
+	return e.finish();
 }
 
 image decode_bmp(const void* buffer, size_t size, const allocator& texel_alloc, const allocator& temp_alloc, const mip_layout& layout)
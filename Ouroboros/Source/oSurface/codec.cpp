@@ -1,10 +1,12 @@
 // Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
 
+#include <oCore/byte.h>
 #include <oString/string.h>
 #include <oSurface/codec.h>
 #include <oSurface/convert.h>
 #include <oMemory/memory.h>
 #include <oCore/stringize.h>
+#include "row_codec.h"
 
 // _____________________________________________________________________________
 // Boilerplate (don't use directly, they're registered with the functions below)
@@ -33,7 +35,22 @@ namespace ouro { namespace surface {
 #define DECODE(ext) case file_format::##ext: decoded = decode_##ext(buffer, size, texel_alloc, temp_alloc, layout); break;
 #define AS_STRING(ext) case surface::file_format::##ext: return #ext;
 
+		// === ADDING STREAMING TO A FILE FORMAT ===
+		//
+		// add the extension to this list and implement the functions declared by 
+		// DECLARE_ROW_CODEC (see row_codec.h).
+#define FOREACH_STREAMING_EXT(macro) macro(bmp) macro(jpg) macro(png) macro(tga)
+
+#define DECLARE_ROW_CODEC(ext) \
+	detail::row_decoder* new_row_decoder_##ext(const void* buffer, size_t size, const allocator& temp_alloc); \
+	detail::row_encoder* new_row_encoder_##ext(const info_t& info, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression);
+
+#define SUPPORTS_STREAMING(ext) case file_format::##ext: return true;
+#define NEW_ROW_DECODER(ext) case file_format::##ext: impl_ = new_row_decoder_##ext(buffer, size, temp_alloc); break;
+#define NEW_ROW_ENCODER(ext) case file_format::##ext: impl_ = new_row_encoder_##ext(row_info, file_alloc, temp_alloc, compression); break;
+
 		FOREACH_EXT(DECLARE_CODEC)
+		FOREACH_STREAMING_EXT(DECLARE_ROW_CODEC)
 
 }}
 
@@ -95,7 +112,8 @@ blob encode(const image& img
 	, const allocator& file_alloc
 	, const allocator& temp_alloc
 	, const format& desired_format
-	, const compression& compression)
+	, const compression& compression
+	, const bc_quality& quality)
 {
 	auto buffer_format = img.info().format;
 	auto dst_format = desired_format;
@@ -106,24 +124,13 @@ blob encode(const image& img
 	oCheck(dst_format != format::unknown, std::errc::not_supported, "%s encoding does not support desired format %s", as_string(fmt), as_string(desired_format));
 
 	image converted;
-	image converted_for_bc_input;
 	const image* input = &img;
 
-	if (is_block_compressed(dst_format))
-	{
-		// this is a rule particular to the intel compressor, though other compressors have similar rules
-		// so figure out where this should actually be: really close to the codec, in convert, here. Is 
-		// there a way to allow better inspection of the requirements?
-		buffer_format = has_alpha(dst_format) ? format::r8g8b8a8_unorm : format::r8g8b8x8_unorm;
-
-		converted_for_bc_input = input->convert(buffer_format, temp_alloc);
-		input = &converted_for_bc_input;
-	}
-	
+	// block compression converts to the compressor's input format a band at a 
+	// time, so there's no full-size intermediate even for a whole mip chain
 	if (buffer_format != dst_format)
 	{
-		converted = input->convert(dst_format, temp_alloc);
-		converted_for_bc_input = image();
+		converted = input->convert(dst_format, temp_alloc, quality);
 		input = &converted;
 	}
 
@@ -152,5 +159,248 @@ image decode(const void* buffer
 	return decoded;
 }
 
+bool supports_streaming(const file_format& fmt)
+{
+	switch (fmt)
+	{ FOREACH_STREAMING_EXT(SUPPORTS_STREAMING)
+		default: break;
+	}
+	return false;
+}
+
+decoder& decoder::operator=(decoder&& that)
+{
+	if (this != &that)
+	{
+		deinitialize();
+		impl_ = that.impl_; that.impl_ = nullptr;
+		alloc_ = that.alloc_;
+	}
+	return *this;
+}
+
+void decoder::initialize(const void* buffer, size_t size, const allocator& temp_alloc)
+{
+	deinitialize();
+	const file_format fmt = get_file_format(buffer, size);
+	switch (fmt)
+	{ FOREACH_STREAMING_EXT(NEW_ROW_DECODER)
+		default: oThrow(std::errc::not_supported, "%s decoding does not support streaming", as_string(fmt));
+	}
+	alloc_ = temp_alloc;
+}
+
+void decoder::deinitialize()
+{
+	alloc_.destroy(impl_);
+	impl_ = nullptr;
+}
+
+info_t decoder::info() const
+{
+	return impl_ ? impl_->info() : info_t();
+}
+
+uint32_t decoder::row() const
+{
+	return impl_ ? impl_->row() : 0;
+}
+
+uint32_t decoder::read(const mapped_subresource& dst, uint32_t num_rows)
+{
+	oCheck(impl_, std::errc::invalid_argument, "decoder not initialized");
+	const uint32_t n = min(num_rows, impl_->info().dimensions.y - impl_->row());
+	if (n)
+		impl_->read(dst, n);
+	return n;
+}
+
+encoder& encoder::operator=(encoder&& that)
+{
+	if (this != &that)
+	{
+		deinitialize();
+		impl_ = that.impl_; that.impl_ = nullptr;
+		alloc_ = that.alloc_;
+	}
+	return *this;
+}
+
+void encoder::initialize(const file_format& fmt, const info_t& info, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
+{
+	deinitialize();
+
+	info_t row_info;
+	row_info.format = required_input(fmt, info.format);
+	row_info.dimensions = uint3(info.dimensions.x, info.dimensions.y, 1);
+	oCheck(row_info.format != format::unknown, std::errc::not_supported, "%s encoding does not support format %s", as_string(fmt), as_string(info.format));
+
+	switch (fmt)
+	{ FOREACH_STREAMING_EXT(NEW_ROW_ENCODER)
+		default: oThrow(std::errc::not_supported, "%s encoding does not support streaming", as_string(fmt));
+	}
+	alloc_ = temp_alloc;
+}
+
+void encoder::deinitialize()
+{
+	alloc_.destroy(impl_);
+	impl_ = nullptr;
+}
+
+info_t encoder::info() const
+{
+	return impl_ ? impl_->info() : info_t();
+}
+
+uint32_t encoder::row() const
+{
+	return impl_ ? impl_->row() : 0;
+}
+
+void encoder::write(const const_mapped_subresource& src, uint32_t num_rows)
+{
+	oCheck(impl_, std::errc::invalid_argument, "encoder not initialized");
+	oCheck(num_rows <= impl_->info().dimensions.y - impl_->row(), std::errc::invalid_argument, "writing %u rows past the last row", num_rows);
+	if (num_rows)
+		impl_->write(src, num_rows);
+}
+
+blob encoder::finish()
+{
+	oCheck(impl_, std::errc::invalid_argument, "encoder not initialized");
+	oCheck(impl_->row() == impl_->info().dimensions.y, std::errc::invalid_argument, "only %u of %u rows were written", impl_->row(), impl_->info().dimensions.y);
+	return impl_->finish();
+}
+
+blob transcode(const void* buffer, size_t size, const file_format& fmt, const format& desired_format, uint32_t rows_per_band
+	, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
+{
+	decoder dec(buffer, size, temp_alloc);
+	const info_t src_info = dec.info();
+
+	info_t dst_info = src_info;
+	if (desired_format != format::unknown)
+		dst_info.format = desired_format;
+	encoder enc(fmt, dst_info, file_alloc, temp_alloc, compression);
+	dst_info = enc.info();
+
+	rows_per_band = max(1u, min(rows_per_band, src_info.dimensions.y));
+	const bool convert = src_info.format != dst_info.format;
+
+	mapped_subresource band, converted;
+	band.row_pitch = element_size(src_info.format) * src_info.dimensions.x;
+	band.depth_pitch = band.row_pitch * rows_per_band;
+	converted.row_pitch = element_size(dst_info.format) * dst_info.dimensions.x;
+	converted.depth_pitch = convert ? converted.row_pitch * rows_per_band : 0;
+
+	blob bands = temp_alloc.scoped_allocate(band.depth_pitch + converted.depth_pitch, "transcode bands");
+	band.data = bands;
+	converted.data = (uint8_t*)bands + band.depth_pitch;
+
+	while (!dec.done())
+	{
+		const uint32_t n = dec.read(band, rows_per_band);
+		if (convert)
+		{
+			convert_formatted(converted, dst_info.format, band, src_info.format, uint3(src_info.dimensions.x, n, 1), copy_option::none, bc_quality::fast, temp_alloc);
+			enc.write(converted, n);
+		}
+		else
+			enc.write(band, n);
+	}
+
+	return enc.finish();
+}
+
+blob transcode(const void* buffer, size_t size, const file_format& fmt, const uint2& dimensions, const filter& f, const format& desired_format, uint32_t rows_per_band
+	, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
+{
+	decoder dec(buffer, size, temp_alloc);
+	const info_t src_info = dec.info();
+
+	info_t dst_info = src_info;
+	dst_info.dimensions = uint3(dimensions.x, dimensions.y, 1);
+	if (desired_format != format::unknown)
+		dst_info.format = desired_format;
+	encoder enc(fmt, dst_info, file_alloc, temp_alloc, compression);
+	dst_info = enc.info();
+
+	// resizing happens in the encoded format so source rows are converted as 
+	// they're decoded into a window that holds the rows the current band reads
+	info_t window_info = src_info;
+	window_info.format = dst_info.format;
+
+	const uint32_t src_height = src_info.dimensions.y;
+	const uint32_t dst_height = dst_info.dimensions.y;
+	rows_per_band = max(1u, min(rows_per_band, dst_height));
+
+	uint32_t window_rows = 1;
+	for (uint32_t y = 0; y < dst_height; y += rows_per_band)
+	{
+		const uint2 need = resize_source_rows(src_height, dst_height, f, y, min(y + rows_per_band, dst_height));
+		window_rows = max(window_rows, need.y - need.x);
+	}
+
+	const bool convert = src_info.format != dst_info.format;
+
+	mapped_subresource decoded, window, band;
+	decoded.row_pitch = element_size(src_info.format) * src_info.dimensions.x;
+	decoded.depth_pitch = convert ? decoded.row_pitch * window_rows : 0;
+	window.row_pitch = element_size(dst_info.format) * src_info.dimensions.x;
+	window.depth_pitch = window.row_pitch * window_rows;
+	band.row_pitch = element_size(dst_info.format) * dst_info.dimensions.x;
+	band.depth_pitch = band.row_pitch * rows_per_band;
+
+	blob bands = temp_alloc.scoped_allocate(decoded.depth_pitch + window.depth_pitch + band.depth_pitch, "transcode bands");
+	decoded.data = bands;
+	window.data = (uint8_t*)bands + decoded.depth_pitch;
+	band.data = (uint8_t*)window.data + window.depth_pitch;
+
+	uint32_t first = 0, count = 0; // source rows [first, first + count) are in the window
+	for (uint32_t y = 0; y < dst_height; y += rows_per_band)
+	{
+		const uint32_t end = min(y + rows_per_band, dst_height);
+		const uint2 need = resize_source_rows(src_height, dst_height, f, y, end);
+
+		// bands only move down so rows above this band's first tap aren't read again
+		const uint32_t drop = min(count, need.x - first);
+		if (drop)
+		{
+			count -= drop;
+			memmove(window.data, byte_add(window.data, drop * window.row_pitch), count * window.row_pitch);
+			first += drop;
+		}
+
+		// decode up to the band's last tap, discarding any rows no band reads
+		while (first + count < need.y)
+		{
+			const bool skip = first + count < need.x;
+			const uint32_t num_rows = skip ? min(need.x - first, window_rows) : need.y - first - count;
+			mapped_subresource tail = window;
+			tail.data = byte_add(window.data, count * window.row_pitch);
+
+			uint32_t n = 0;
+			if (convert)
+			{
+				n = dec.read(decoded, num_rows);
+				convert_formatted(tail, dst_info.format, decoded, src_info.format, uint3(src_info.dimensions.x, n, 1), copy_option::none, bc_quality::fast, temp_alloc);
+			}
+			else
+				n = dec.read(tail, num_rows);
+
+			if (skip)
+				first += n;
+			else
+				count += n;
+		}
+
+		resize_rows(window_info, window, first, dst_info, band, y, end, f, temp_alloc);
+		enc.write(band, end - y);
+	}
+
+	return enc.finish();
+}
+
 	}
 }
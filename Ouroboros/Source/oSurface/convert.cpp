@@ -2,448 +2,926 @@
 
 #include <oCore/color.h>
 #include <oSurface/convert.h>
+#include <oConcurrency/concurrency.h>
 #include <oMath/hlslx.h>
 #include <oMath/quantize.h>
+#include <oMemory/allocate.h>
 #include <oMemory/memory.h>
 #include <oCore/stringize.h>
+#include <oCore/countof.h>
 #include <ispc_texcomp.h>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
 
 #define oSURF_CHECK(expr, format, ...) oCheck(expr, std::errc::invalid_argument, format, ## __VA_ARGS__)
 
 namespace ouro { namespace surface {
 
-struct half2 { uint16_t x,y; const half2& operator=(const float2& that) { x = f32tof16(that.x); y = f32tof16(that.y); return *this; }};
-struct half3 { uint16_t x,y,z; const half3& operator=(const float3& that) { x = f32tof16(that.x); y = f32tof16(that.y); z = f32tof16(that.z); return *this; }};
-struct half4 { uint16_t x,y,z,w; const half4& operator=(const float4& that) { x = f32tof16(that.x); y = f32tof16(that.y); z = f32tof16(that.z); w = f32tof16(that.w); return *this; }};
-struct udec3 { uint32_t xyzw; };
+// Conversion is driven by a table that describes where each channel lives in a
+// texel and how it's encoded. A row is decoded a chunk at a time into float4
+// lanes and then encoded to the destination format. unorm to unorm is rescaled
+// per channel so it rounds exactly once and 8-bit formats that differ only in
+// channel order are a byte shuffle. Packed formats of 32 bits or less (1010102,
+// 565, 8888, d24s8...), half and float formats have SSE2 kernels; everything
+// else is decoded one channel at a time. Integer channels convert as normalized
+// values and srgb formats convert as the unorm values they store: no gamma is 
+// applied.
+
+enum class lane : uint8_t
+{
+	none,      // not in the format: decodes as 0 for rgb and 1 for alpha
+	x,         // bits in the format that aren't used: decodes as 1, encodes as all 1's
+	unorm,
+	snorm,
+	uint,
+	sint,
+	float32,
+	float16,
+	float11,   // unsigned 5e6
+	float10,   // unsigned 5e5
+	xr_bias,   // [-0.75,1.25] in 10 bits
+	sharedexp, // 9-bit mantissa with an exponent shared by all channels
+	udec3,     // oMath's biased encoding of [-1,1] (see float4toudec3 in quantize.h)
+};
+
+struct channel_layout
+{
+	lane type;
+	uint8_t offset; // in bits from the start of the texel
+	uint8_t bits;
+};
 
-// Here pitch refers to element pitch, or the size of a texel
-#define ELCPY_PARAMS_VOID void* oRESTRICT dst, size_t dst_elem_pitch, const void* oRESTRICT src, size_t src_elem_pitch, size_t num_elements
-#define ELCPY_PARAMS(srcT, dstT) dstT* oRESTRICT dst, size_t dst_elem_pitch, const srcT* oRESTRICT src, size_t src_elem_pitch, size_t num_elements
-#define ELCPY_PARAMS_UINT8 ELCPY_PARAMS(uint8_t, uint8_t)
+struct texel_layout
+{
+	channel_layout channel[4]; // r,g,b,a
+};
 
-typedef void (*elcpy_fn)(ELCPY_PARAMS_VOID);
+#define oCH(type, offset, bits) { lane::type, offset, bits }
+#define oNA oCH(none,0,0)
+#define oNONE {{ oNA, oNA, oNA, oNA }}
 
-static void copy_3bytes(ELCPY_PARAMS_UINT8)
+// formats that are planar, block-compressed, paletted, subsampled or typeless
+// aren't described and can't be converted (other than copied to the same format)
+static const texel_layout sLayouts[] =
 {
-	while (num_elements--)
-	{
-		dst[0] = src[0];
-		dst[1] = src[1];
-		dst[2] = src[2];
-		dst += dst_elem_pitch;
-		src += src_elem_pitch;
-	}
+	oNONE,                                                                           // unknown
+	oNONE,                                                                           // r32g32b32a32_typeless
+	{{ oCH(float32,0,32), oCH(float32,32,32), oCH(float32,64,32), oCH(float32,96,32) }},// r32g32b32a32_float
+	{{ oCH(uint,0,32), oCH(uint,32,32), oCH(uint,64,32), oCH(uint,96,32) }},         // r32g32b32a32_uint
+	{{ oCH(sint,0,32), oCH(sint,32,32), oCH(sint,64,32), oCH(sint,96,32) }},         // r32g32b32a32_sint
+	oNONE,                                                                           // r32g32b32_typeless
+	{{ oCH(float32,0,32), oCH(float32,32,32), oCH(float32,64,32), oNA }},            // r32g32b32_float
+	{{ oCH(uint,0,32), oCH(uint,32,32), oCH(uint,64,32), oNA }},                     // r32g32b32_uint
+	{{ oCH(sint,0,32), oCH(sint,32,32), oCH(sint,64,32), oNA }},                     // r32g32b32_sint
+	oNONE,                                                                           // r16g16b16a16_typeless
+	{{ oCH(float16,0,16), oCH(float16,16,16), oCH(float16,32,16), oCH(float16,48,16) }},// r16g16b16a16_float
+	{{ oCH(unorm,0,16), oCH(unorm,16,16), oCH(unorm,32,16), oCH(unorm,48,16) }},     // r16g16b16a16_unorm
+	{{ oCH(uint,0,16), oCH(uint,16,16), oCH(uint,32,16), oCH(uint,48,16) }},         // r16g16b16a16_uint
+	{{ oCH(snorm,0,16), oCH(snorm,16,16), oCH(snorm,32,16), oCH(snorm,48,16) }},     // r16g16b16a16_snorm
+	{{ oCH(sint,0,16), oCH(sint,16,16), oCH(sint,32,16), oCH(sint,48,16) }},         // r16g16b16a16_sint
+	oNONE,                                                                           // r32g32_typeless
+	{{ oCH(float32,0,32), oCH(float32,32,32), oNA, oNA }},                           // r32g32_float
+	{{ oCH(uint,0,32), oCH(uint,32,32), oNA, oNA }},                                 // r32g32_uint
+	{{ oCH(sint,0,32), oCH(sint,32,32), oNA, oNA }},                                 // r32g32_sint
+	oNONE,                                                                           // r32g8x24_typeless
+	{{ oCH(float32,0,32), oCH(uint,32,8), oNA, oNA }},                               // d32_float_s8x24_uint
+	{{ oCH(float32,0,32), oNA, oNA, oNA }},                                          // r32_float_x8x24_typeless
+	{{ oNA, oCH(uint,32,8), oNA, oNA }},                                             // x32_typeless_g8x24_uint
+	oNONE,                                                                           // r10g10b10a2_typeless
+	{{ oCH(udec3,22,10), oCH(udec3,12,10), oCH(udec3,2,10), oCH(udec3,0,2) }},       // r10g10b10a2_unorm
+	{{ oCH(uint,0,10), oCH(uint,10,10), oCH(uint,20,10), oCH(uint,30,2) }},          // r10g10b10a2_uint
+	{{ oCH(float11,0,11), oCH(float11,11,11), oCH(float10,22,10), oNA }},            // r11g11b10_float
+	oNONE,                                                                           // r8g8b8a8_typeless
+	{{ oCH(unorm,0,8), oCH(unorm,8,8), oCH(unorm,16,8), oCH(unorm,24,8) }},          // r8g8b8a8_unorm
+	{{ oCH(unorm,0,8), oCH(unorm,8,8), oCH(unorm,16,8), oCH(unorm,24,8) }},          // r8g8b8a8_unorm_srgb
+	{{ oCH(uint,0,8), oCH(uint,8,8), oCH(uint,16,8), oCH(uint,24,8) }},              // r8g8b8a8_uint
+	{{ oCH(snorm,0,8), oCH(snorm,8,8), oCH(snorm,16,8), oCH(snorm,24,8) }},          // r8g8b8a8_snorm
+	{{ oCH(sint,0,8), oCH(sint,8,8), oCH(sint,16,8), oCH(sint,24,8) }},              // r8g8b8a8_sint
+	oNONE,                                                                           // r16g16_typeless
+	{{ oCH(float16,0,16), oCH(float16,16,16), oNA, oNA }},                           // r16g16_float
+	{{ oCH(unorm,0,16), oCH(unorm,16,16), oNA, oNA }},                               // r16g16_unorm
+	{{ oCH(uint,0,16), oCH(uint,16,16), oNA, oNA }},                                 // r16g16_uint
+	{{ oCH(snorm,0,16), oCH(snorm,16,16), oNA, oNA }},                               // r16g16_snorm
+	{{ oCH(sint,0,16), oCH(sint,16,16), oNA, oNA }},                                 // r16g16_sint
+	oNONE,                                                                           // r32_typeless
+	{{ oCH(float32,0,32), oNA, oNA, oNA }},                                          // d32_float
+	{{ oCH(float32,0,32), oNA, oNA, oNA }},                                          // r32_float
+	{{ oCH(uint,0,32), oNA, oNA, oNA }},                                             // r32_uint
+	{{ oCH(sint,0,32), oNA, oNA, oNA }},                                             // r32_sint
+	oNONE,                                                                           // r24g8_typeless
+	{{ oCH(unorm,0,24), oCH(uint,24,8), oNA, oNA }},                                 // d24_unorm_s8_uint
+	{{ oCH(unorm,0,24), oNA, oNA, oNA }},                                            // r24_unorm_x8_typeless
+	{{ oNA, oCH(uint,24,8), oNA, oNA }},                                             // x24_typeless_g8_uint
+	oNONE,                                                                           // r8g8_typeless
+	{{ oCH(unorm,0,8), oCH(unorm,8,8), oNA, oNA }},                                  // r8g8_unorm
+	{{ oCH(uint,0,8), oCH(uint,8,8), oNA, oNA }},                                    // r8g8_uint
+	{{ oCH(snorm,0,8), oCH(snorm,8,8), oNA, oNA }},                                  // r8g8_snorm
+	{{ oCH(sint,0,8), oCH(sint,8,8), oNA, oNA }},                                    // r8g8_sint
+	oNONE,                                                                           // r16_typeless
+	{{ oCH(float16,0,16), oNA, oNA, oNA }},                                          // r16_float
+	{{ oCH(unorm,0,16), oNA, oNA, oNA }},                                            // d16_unorm
+	{{ oCH(unorm,0,16), oNA, oNA, oNA }},                                            // r16_unorm
+	{{ oCH(uint,0,16), oNA, oNA, oNA }},                                             // r16_uint
+	{{ oCH(snorm,0,16), oNA, oNA, oNA }},                                            // r16_snorm
+	{{ oCH(sint,0,16), oNA, oNA, oNA }},                                             // r16_sint
+	oNONE,                                                                           // r8_typeless
+	{{ oCH(unorm,0,8), oNA, oNA, oNA }},                                             // r8_unorm
+	{{ oCH(uint,0,8), oNA, oNA, oNA }},                                              // r8_uint
+	{{ oCH(snorm,0,8), oNA, oNA, oNA }},                                             // r8_snorm
+	{{ oCH(sint,0,8), oNA, oNA, oNA }},                                              // r8_sint
+	{{ oNA, oNA, oNA, oCH(unorm,0,8) }},                                             // a8_unorm
+	oNONE,                                                                           // r1_unorm
+	{{ oCH(sharedexp,0,9), oCH(sharedexp,9,9), oCH(sharedexp,18,9), oNA }},          // r9g9b9e5_sharedexp
+	oNONE,                                                                           // r8g8_b8g8_unorm
+	oNONE,                                                                           // g8r8_g8b8_unorm
+	oNONE,                                                                           // bc1_typeless
+	oNONE,                                                                           // bc1_unorm
+	oNONE,                                                                           // bc1_unorm_srgb
+	oNONE,                                                                           // bc2_typeless
+	oNONE,                                                                           // bc2_unorm
+	oNONE,                                                                           // bc2_unorm_srgb
+	oNONE,                                                                           // bc3_typeless
+	oNONE,                                                                           // bc3_unorm
+	oNONE,                                                                           // bc3_unorm_srgb
+	oNONE,                                                                           // bc4_typeless
+	oNONE,                                                                           // bc4_unorm
+	oNONE,                                                                           // bc4_snorm
+	oNONE,                                                                           // bc5_typeless
+	oNONE,                                                                           // bc5_unorm
+	oNONE,                                                                           // bc5_snorm
+	{{ oCH(unorm,11,5), oCH(unorm,5,6), oCH(unorm,0,5), oNA }},                      // b5g6r5_unorm
+	{{ oCH(unorm,10,5), oCH(unorm,5,5), oCH(unorm,0,5), oCH(unorm,15,1) }},          // b5g5r5a1_unorm
+	{{ oCH(unorm,16,8), oCH(unorm,8,8), oCH(unorm,0,8), oCH(unorm,24,8) }},          // b8g8r8a8_unorm
+	{{ oCH(unorm,16,8), oCH(unorm,8,8), oCH(unorm,0,8), oCH(x,24,8) }},              // b8g8r8x8_unorm
+	{{ oCH(xr_bias,0,10), oCH(xr_bias,10,10), oCH(xr_bias,20,10), oCH(unorm,30,2) }},// r10g10b10_xr_bias_a2_unorm
+	oNONE,                                                                           // b8g8r8a8_typeless
+	{{ oCH(unorm,16,8), oCH(unorm,8,8), oCH(unorm,0,8), oCH(unorm,24,8) }},          // b8g8r8a8_unorm_srgb
+	oNONE,                                                                           // b8g8r8x8_typeless
+	{{ oCH(unorm,16,8), oCH(unorm,8,8), oCH(unorm,0,8), oCH(x,24,8) }},              // b8g8r8x8_unorm_srgb
+	oNONE,                                                                           // bc6h_typeless
+	oNONE,                                                                           // bc6h_uf16
+	oNONE,                                                                           // bc6h_sf16
+	oNONE,                                                                           // bc7_typeless
+	oNONE,                                                                           // bc7_unorm
+	oNONE,                                                                           // bc7_unorm_srgb
+	oNONE,                                                                           // ayuv
+	oNONE,                                                                           // y410
+	oNONE,                                                                           // y416
+	oNONE,                                                                           // nv12
+	oNONE,                                                                           // p010
+	oNONE,                                                                           // p016
+	oNONE,                                                                           // opaque_420
+	oNONE,                                                                           // yuy2
+	oNONE,                                                                           // y210
+	oNONE,                                                                           // y216
+	oNONE,                                                                           // nv11
+	oNONE,                                                                           // ai44
+	oNONE,                                                                           // ia44
+	oNONE,                                                                           // p8
+	oNONE,                                                                           // a8p8
+	{{ oCH(unorm,8,4), oCH(unorm,4,4), oCH(unorm,0,4), oCH(unorm,12,4) }},           // b4g4r4a4_unorm
+	{{ oCH(unorm,0,8), oCH(unorm,8,8), oCH(unorm,16,8), oNA }},                      // r8g8b8_unorm
+	{{ oCH(unorm,0,8), oCH(unorm,8,8), oCH(unorm,16,8), oNA }},                      // r8g8b8_unorm_srgb
+	{{ oCH(unorm,0,8), oCH(unorm,8,8), oCH(unorm,16,8), oCH(x,24,8) }},              // r8g8b8x8_unorm
+	{{ oCH(unorm,0,8), oCH(unorm,8,8), oCH(unorm,16,8), oCH(x,24,8) }},              // r8g8b8x8_unorm_srgb
+	{{ oCH(unorm,16,8), oCH(unorm,8,8), oCH(unorm,0,8), oNA }},                      // b8g8r8_unorm
+	{{ oCH(unorm,16,8), oCH(unorm,8,8), oCH(unorm,0,8), oNA }},                      // b8g8r8_unorm_srgb
+	{{ oCH(unorm,24,8), oCH(unorm,16,8), oCH(unorm,8,8), oCH(unorm,0,8) }},          // a8b8g8r8_unorm
+	{{ oCH(unorm,24,8), oCH(unorm,16,8), oCH(unorm,8,8), oCH(unorm,0,8) }},          // a8b8g8r8_unorm_srgb
+	{{ oCH(unorm,24,8), oCH(unorm,16,8), oCH(unorm,8,8), oCH(x,0,8) }},              // x8b8g8r8_unorm
+	{{ oCH(unorm,24,8), oCH(unorm,16,8), oCH(unorm,8,8), oCH(x,0,8) }},              // x8b8g8r8_unorm_srgb
+	oNONE,                                                                           // y8_u8_v8_unorm
+	oNONE,                                                                           // y8_a8_u8_v8_unorm
+	oNONE,                                                                           // ybc4_ubc4_vbc4_unorm
+	oNONE,                                                                           // ybc4_abc4_ubc4_vbc4_unorm
+	oNONE,                                                                           // y8_u8v8_unorm
+	oNONE,                                                                           // y8a8_u8v8_unorm
+	oNONE,                                                                           // ybc4_uvbc5_unorm
+	oNONE,                                                                           // yabc5_uvbc5_unorm
+};
+match_array_e(sLayouts, format);
+
+#undef oNONE
+#undef oNA
+#undef oCH
+
+static const texel_layout& layout(const format& f)
+{
+	return sLayouts[(int)(f < format::count ? f : format::unknown)];
 }
 
-static void copy_3bytes_alpha(ELCPY_PARAMS_UINT8)
+static bool describes(const texel_layout& l)
 {
-	while (num_elements--)
-	{
-		dst[0] = src[0];
-		dst[1] = src[1];
-		dst[2] = src[2];
-		dst[3] = 0xff;
-		dst += dst_elem_pitch;
-		src += src_elem_pitch;
-	}
+	for (const auto& c : l.channel)
+		if (c.type != lane::none)
+			return true;
+	return false;
 }
 
-static void copy_3bytes_alpha_swap_red_blue(ELCPY_PARAMS_UINT8)
+static inline uint32_t bit_mask(uint32_t bits) { return bits >= 32 ? 0xffffffff : ((1u << bits) - 1); }
+
+static inline uint32_t get_bits(const uint8_t* texel, uint32_t offset, uint32_t bits)
 {
-	while (num_elements--)
-	{
-		dst[0] = src[2];
-		dst[1] = src[1];
-		dst[2] = src[0];
-		dst[3] = 0xff;
-		dst += dst_elem_pitch;
-		src += src_elem_pitch;
-	}
+	uint64_t v = 0;
+	memcpy(&v, texel + (offset >> 3), ((offset & 7) + bits + 7) >> 3);
+	return uint32_t(v >> (offset & 7)) & bit_mask(bits);
 }
 
-static void copy_alpha_3bytes(ELCPY_PARAMS_UINT8)
+// whole texels of up to 8 bytes as one little-endian integer
+static inline uint64_t load_texel(const uint8_t* texel, uint32_t size)
 {
-	while (num_elements--)
+	uint64_t v = 0;
+	switch (size)
 	{
-		dst[0] = 0xff;
-		dst[1] = src[0];
-		dst[2] = src[1];
-		dst[3] = src[2];
-		dst += dst_elem_pitch;
-		src += src_elem_pitch;
+		case 1: v = texel[0]; break;
+		case 2: { uint16_t t; memcpy(&t, texel, 2); v = t; break; }
+		case 4: { uint32_t t; memcpy(&t, texel, 4); v = t; break; }
+		case 8: memcpy(&v, texel, 8); break;
+		default: memcpy(&v, texel, size); break;
 	}
+	return v;
 }
 
-static void copy_skip_alpha_3bytes(ELCPY_PARAMS_UINT8)
+static inline void store_texel(uint8_t* texel, uint32_t size, uint64_t v)
 {
-	while (num_elements--)
+	switch (size)
 	{
-		dst[0] = src[1];
-		dst[1] = src[2];
-		dst[2] = src[3];
-		dst += dst_elem_pitch;
-		src += src_elem_pitch;
+		case 1: texel[0] = uint8_t(v); break;
+		case 2: { const uint16_t t = uint16_t(v); memcpy(texel, &t, 2); break; }
+		case 4: { const uint32_t t = uint32_t(v); memcpy(texel, &t, 4); break; }
+		case 8: memcpy(texel, &v, 8); break;
+		default: memcpy(texel, &v, size); break;
 	}
 }
 
-static void copy_4bytes_swap_rotate_alpha(ELCPY_PARAMS_UINT8)
+static inline void set_bits(uint8_t* texel, uint32_t offset, uint32_t bits, uint32_t value)
 {
-	while (num_elements--)
-	{
-		dst[0] = src[1];
-		dst[1] = src[2];
-		dst[2] = src[3];
-		dst[3] = src[0];
-		dst += dst_elem_pitch;
-		src += src_elem_pitch;
-	}
+	const uint32_t nbytes = ((offset & 7) + bits + 7) >> 3;
+	const uint64_t mask = uint64_t(bit_mask(bits)) << (offset & 7);
+	uint64_t v = 0;
+	memcpy(&v, texel + (offset >> 3), nbytes);
+	v = (v & ~mask) | ((uint64_t(value) << (offset & 7)) & mask);
+	memcpy(texel + (offset >> 3), &v, nbytes);
 }
 
-static void copy_3bytes_swap_red_blue(ELCPY_PARAMS_UINT8)
+static inline float as_float(uint32_t u) { float f; memcpy(&f, &u, sizeof(f)); return f; }
+static inline uint32_t as_uint(float f) { uint32_t u; memcpy(&u, &f, sizeof(u)); return u; }
+static inline int32_t sign_extend(uint32_t v, uint32_t bits) { return bits >= 32 ? int32_t(v) : (int32_t(v << (32 - bits)) >> (32 - bits)); }
+static inline double round_half_up(double x) { return floor(x + 0.5); }
+static inline double clamp_nan(double x, double lo, double hi) { return x == x ? (x < lo ? lo : (x > hi ? hi : x)) : 0.0; }
+
+// unsigned small floats with a 5-bit exponent biased by 15 (r11g11b10_float)
+static float ufloat_to_float(uint32_t v, uint32_t mbits)
 {
-	while (num_elements--)
-	{
-		dst[0] = src[2];
-		dst[1] = src[1];
-		dst[2] = src[0];
-		dst += dst_elem_pitch;
-		src += src_elem_pitch;
-	}
+	const uint32_t e = v >> mbits;
+	const uint32_t m = v & bit_mask(mbits);
+	if (e == 0x1f)
+		return m ? as_float(0x7fc00000) : as_float(0x7f800000);
+	if (e == 0)
+		return ldexpf(float(m), -14 - int(mbits));
+	return ldexpf(float(m | (1u << mbits)), int(e) - 15 - int(mbits));
 }
 
-static void copy_4bytes_swap_red_blue(ELCPY_PARAMS_UINT8)
+static uint32_t float_to_ufloat(float f, uint32_t mbits)
 {
-	while (num_elements--)
+	const uint32_t inf = 0x1fu << mbits;
+	if (f != f)
+		return inf | bit_mask(mbits);
+	if (f <= 0.0f)
+		return 0;
+	if (f == as_float(0x7f800000))
+		return inf;
+
+	int e;
+	frexpf(f, &e); // f = [0.5,1) * 2^e
+	e -= 1;
+	if (e < -14)
+		return uint32_t(nearbyintf(ldexpf(f, 14 + int(mbits)))); // rounding up to 1 << mbits is the smallest normal
+
+	uint32_t q = uint32_t(nearbyintf(ldexpf(f, int(mbits) - e)));
+	if (q == (2u << mbits))
 	{
-		dst[0] = src[2];
-		dst[1] = src[1];
-		dst[2] = src[0];
-		dst[3] = src[3];
-		dst += dst_elem_pitch;
-		src += src_elem_pitch;
+		q >>= 1;
+		e++;
 	}
+
+	if (e + 15 > 30)
+		return inf - 1; // largest finite
+	return (uint32_t(e + 15) << mbits) | (q & bit_mask(mbits));
 }
 
-static void copy_rgb_to_lum(ELCPY_PARAMS_UINT8)
+// r9g9b9e5: decode/encode per the D3D spec
+static void sharedexp_to_float3(uint32_t v, float* rgb)
 {
-	while (num_elements--)
-	{
-		argb_channels ch;
-		ch.r = src[0];
-		ch.g = src[1];
-		ch.b = src[2];
-		ch.a = 0xff;
+	const float scale = ldexpf(1.0f, int(v >> 27) - 15 - 9);
+	rgb[0] = float(v & 0x1ff) * scale;
+	rgb[1] = float((v >> 9) & 0x1ff) * scale;
+	rgb[2] = float((v >> 18) & 0x1ff) * scale;
+}
 
-		float4 srgb = truetofloat4(ch.argb);
-		float lum = srgbtolum(srgb.xyz());
-		dst[0] = (uint8_t)f32ton8(saturate(lum));
-		dst += dst_elem_pitch;
-		src += src_elem_pitch;
+static uint32_t float3_to_sharedexp(const float* rgb)
+{
+	const double max_value = (511.0 / 512.0) * 65536.0;
+	const double r = clamp_nan(rgb[0], 0.0, max_value), g = clamp_nan(rgb[1], 0.0, max_value), b = clamp_nan(rgb[2], 0.0, max_value);
+	const double max_channel = r > g ? (r > b ? r : b) : (g > b ? g : b);
+	if (max_channel == 0.0)
+		return 0;
+
+	int exp_shared = int(floor(log2(max_channel)));
+	exp_shared = (exp_shared < -16 ? -16 : exp_shared) + 1 + 15;
+	double denom = ldexp(1.0, exp_shared - 15 - 9);
+	if (uint32_t(round_half_up(max_channel / denom)) == 512)
+	{
+		denom *= 2.0;
+		exp_shared++;
 	}
+
+	return (uint32_t(exp_shared) << 27) | (uint32_t(round_half_up(b / denom)) << 18) | (uint32_t(round_half_up(g / denom)) << 9) | uint32_t(round_half_up(r / denom));
 }
 
-static void copy_bgr_to_lum(ELCPY_PARAMS_UINT8)
+// Giesen's SSE2 half <-> float that match IEEE round-to-nearest-even. h is 4
+// halves in the low 16 bits of each lane.
+static inline __m128 half_to_float4(__m128i h)
 {
-	while (num_elements--)
-	{
-		argb_channels ch;
-		ch.r = src[2];
-		ch.g = src[1];
-		ch.b = src[0];
-		ch.a = 0xff;
+	const __m128i expmant = _mm_and_si128(h, _mm_set1_epi32(0x7fff));
+	const __m128i justsign = _mm_xor_si128(h, expmant);
+	const __m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(expmant, 13)), _mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23)));
+	const __m128i was_infnan = _mm_cmpgt_epi32(expmant, _mm_set1_epi32(0x7bff));
+	const __m128 infnan_exp = _mm_and_ps(_mm_castsi128_ps(was_infnan), _mm_castsi128_ps(_mm_set1_epi32(255 << 23)));
+	return _mm_or_ps(scaled, _mm_or_ps(_mm_castsi128_ps(_mm_slli_epi32(justsign, 16)), infnan_exp));
+}
 
-		float4 srgb = truetofloat4(ch.argb);
-		float lum = srgbtolum(srgb.xyz());
-		dst[0] = (uint8_t)f32ton8(saturate(lum));
-		dst += dst_elem_pitch;
-		src += src_elem_pitch;
-	}
+static inline __m128i float4_to_half(__m128 f)
+{
+	const __m128i min_normal = _mm_set1_epi32((127 - 14) << 23);
+	const __m128i subnorm_magic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+	const __m128i normal_bias = _mm_set1_epi32(0xfff - ((127 - 15) << 23));
+
+	const __m128 justsign = _mm_and_ps(f, _mm_castsi128_ps(_mm_set1_epi32(0x80000000)));
+	const __m128 absf = _mm_xor_ps(f, justsign);
+	const __m128i absf_int = _mm_castps_si128(absf);
+	const __m128i is_regular = _mm_cmpgt_epi32(_mm_set1_epi32((127 + 16) << 23), absf_int);
+	const __m128i nanbit = _mm_and_si128(_mm_castps_si128(_mm_cmpunord_ps(absf, absf)), _mm_set1_epi32(0x200));
+	const __m128i inf_or_nan = _mm_or_si128(nanbit, _mm_set1_epi32(0x7c00));
+	const __m128i is_sub = _mm_cmpgt_epi32(min_normal, absf_int);
+
+	const __m128i subnorm = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absf, _mm_castsi128_ps(subnorm_magic))), subnorm_magic);
+	const __m128i mantodd = _mm_srai_epi32(_mm_slli_epi32(absf_int, 31 - 13), 31);
+	const __m128i normal = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(absf_int, normal_bias), mantodd), 13);
+
+	const __m128i nonspecial = _mm_or_si128(_mm_and_si128(subnorm, is_sub), _mm_andnot_si128(is_sub, normal));
+	const __m128i joined = _mm_or_si128(_mm_and_si128(nonspecial, is_regular), _mm_andnot_si128(is_regular, inf_or_nan));
+	return _mm_or_si128(joined, _mm_srli_epi32(_mm_castps_si128(justsign), 16));
 }
 
-static void copy_float_to_r8(ELCPY_PARAMS(float, uint8_t))
+// unsigned 32-bit ints to float exactly for values representable in 24 bits
+// times a power of 2
+static inline __m128 u32_to_float4(__m128i v)
 {
-	const uint8_t* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
-	{
-		*dst = (uint8_t)f32ton8(*src);
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
-	}
+	const __m128 f = _mm_cvtepi32_ps(v);
+	return _mm_add_ps(f, _mm_and_ps(_mm_castsi128_ps(_mm_cmplt_epi32(v, _mm_setzero_si128())), _mm_set1_ps(4294967296.0f)));
 }
 
-static void copy_float2_to_half2(ELCPY_PARAMS(float2, half2))
+struct conversion;
+typedef void (*convert_fn)(const conversion& c, uint8_t* oRESTRICT dst, size_t dst_pitch, const uint8_t* oRESTRICT src, size_t src_pitch, size_t num_elements);
+typedef void (*decode_fn)(const conversion& c, __m128* oRESTRICT lanes, const uint8_t* oRESTRICT src, size_t src_pitch, size_t num_elements);
+typedef void (*encode_fn)(const conversion& c, uint8_t* oRESTRICT dst, size_t dst_pitch, const __m128* oRESTRICT lanes, size_t num_elements);
+
+struct conversion
 {
-	const half2* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
+	convert_fn convert;
+	decode_fn decode;
+	encode_fn encode;
+	const texel_layout* src;
+	const texel_layout* dst;
+	uint32_t src_size;
+	uint32_t dst_size;
+	uint32_t src_channels; // for float16/float32 kernels
+	uint32_t dst_channels;
+
+	// packed kernels
+	alignas(16) uint32_t src_mask[4];
+	alignas(16) float src_scale[4];
+	alignas(16) float src_divisor[4];
+	alignas(16) float src_bias[4]; // or'ed into missing channels by the float16/float32 kernels
+	alignas(16) float dst_mul[4];
+	alignas(16) float dst_max[4];
+	uint32_t dst_shift[4];
+	uint32_t dst_fill;
+
+	// byte shuffle: dst byte i is src byte shuffle[i] or comes from shuffle_fill
+	int8_t shuffle[4];
+	uint32_t shuffle_fill;
+
+	// unorm rescale: round(k * dst_max / src_max)
+	double unorm_scale[4];
+	double unorm_bias[4];
+};
+
+static float lane_default(uint32_t channel) { return channel == 3 ? 1.0f : 0.0f; }
+
+// === decoders ===
+
+static float decode_channel(const channel_layout& c, const uint8_t* texel, uint32_t channel)
+{
+	if (c.type == lane::none)
+		return lane_default(channel);
+	if (c.type == lane::x)
+		return 1.0f;
+
+	const uint32_t v = get_bits(texel, c.offset, c.bits);
+	switch (c.type)
 	{
-		dst->x = f32tof16(src->x);
-		dst->y = f32tof16(src->y);
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
+		case lane::unorm:
+		case lane::uint:    return float(double(v) / double(bit_mask(c.bits)));
+		case lane::snorm:
+		case lane::sint:    { const float f = float(double(sign_extend(v, c.bits)) / double(bit_mask(c.bits - 1))); return f < -1.0f ? -1.0f : f; }
+		case lane::float32: return as_float(v);
+		case lane::float16: return f16tof32(v);
+		case lane::float11: return ufloat_to_float(v, 6);
+		case lane::float10: return ufloat_to_float(v, 5);
+		case lane::xr_bias: return float(int32_t(v) - 0x180) / 510.0f;
+		case lane::udec3:   return float(v) * (2.0f / float(bit_mask(c.bits))) - 1.0f;
+		default: break;
 	}
+	return 0.0f;
 }
 
-static void copy_half2_to_float2(ELCPY_PARAMS(half2, float2))
+static void decode_any(const conversion& c, __m128* oRESTRICT lanes, const uint8_t* oRESTRICT src, size_t src_pitch, size_t num_elements)
 {
-	const float2* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
+	const texel_layout& l = *c.src;
+	const bool sharedexp = l.channel[0].type == lane::sharedexp;
+	for (size_t i = 0; i < num_elements; i++, src += src_pitch)
 	{
-		dst->x = f16tof32(src->x);
-		dst->y = f16tof32(src->y);
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
+		alignas(16) float f[4];
+		if (sharedexp)
+		{
+			uint32_t v;
+			memcpy(&v, src, sizeof(v));
+			sharedexp_to_float3(v, f);
+			f[3] = 1.0f;
+		}
+		else
+			for (uint32_t ch = 0; ch < 4; ch++)
+				f[ch] = decode_channel(l.channel[ch], src, ch);
+		lanes[i] = _mm_load_ps(f);
 	}
 }
 
-static void copy_half2_to_float3(ELCPY_PARAMS(half2, float3))
+// channels are masked in place, shifted down by scaling by a power of 2 and 
+// divided by their max value so the result is k / max rounded correctly
+static void decode_packed(const conversion& c, __m128* oRESTRICT lanes, const uint8_t* oRESTRICT src, size_t src_pitch, size_t num_elements)
 {
-	const float3* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
+	const __m128i mask = _mm_load_si128((const __m128i*)c.src_mask);
+	const __m128 scale = _mm_load_ps(c.src_scale);
+	const __m128 divisor = _mm_load_ps(c.src_divisor);
+	const __m128 bias = _mm_load_ps(c.src_bias);
+	const uint32_t size = c.src_size;
+	for (size_t i = 0; i < num_elements; i++, src += src_pitch)
 	{
-		dst->x = f16tof32(src->x);
-		dst->y = f16tof32(src->y);
-		dst->y = 0.0f;
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
+		uint32_t v = 0;
+		if (size == 4)
+			v = *(const uint32_t*)src;
+		else
+			memcpy(&v, src, size);
+		const __m128 f = u32_to_float4(_mm_and_si128(_mm_set1_epi32(int(v)), mask));
+		lanes[i] = _mm_add_ps(_mm_div_ps(_mm_mul_ps(f, scale), divisor), bias);
 	}
 }
 
-static void copy_float4_to_3(ELCPY_PARAMS(float4, float3))
+static void decode_float32(const conversion& c, __m128* oRESTRICT lanes, const uint8_t* oRESTRICT src, size_t src_pitch, size_t num_elements)
 {
-	const float3* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
+	if (c.src_channels == 4)
+	{
+		for (size_t i = 0; i < num_elements; i++, src += src_pitch)
+			lanes[i] = _mm_loadu_ps((const float*)src);
+		return;
+	}
+
+	const __m128 bias = _mm_load_ps(c.src_bias);
+	const size_t size = c.src_channels * sizeof(float);
+	for (size_t i = 0; i < num_elements; i++, src += src_pitch)
 	{
-		dst->x = src->x;
-		dst->y = src->y; 
-		dst->z = src->z;
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
+		alignas(16) float f[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		memcpy(f, src, size);
+		lanes[i] = _mm_or_ps(_mm_load_ps(f), bias);
 	}
 }
 
-static void copy_float3_to_2(ELCPY_PARAMS(float3, float2))
+static void decode_float16(const conversion& c, __m128* oRESTRICT lanes, const uint8_t* oRESTRICT src, size_t src_pitch, size_t num_elements)
 {
-	const float2* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
+	const __m128 bias = _mm_load_ps(c.src_bias);
+	const size_t size = c.src_channels * sizeof(uint16_t);
+	for (size_t i = 0; i < num_elements; i++, src += src_pitch)
 	{
-		dst->x = src->x;
-		dst->y = src->y; 
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
+		uint64_t h = 0;
+		memcpy(&h, src, size);
+		const __m128i h4 = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)&h), _mm_setzero_si128());
+		lanes[i] = _mm_or_ps(half_to_float4(h4), bias);
 	}
 }
 
-static void copy_float2_to_3(ELCPY_PARAMS(float2, float3))
+// === encoders ===
+
+static uint32_t encode_channel(const channel_layout& c, float f)
 {
-	const float3* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
+	const uint32_t max = bit_mask(c.bits);
+	switch (c.type)
 	{
-		dst->x = src->x;
-		dst->y = src->y;
-		dst->z = 0.0f;
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
+		case lane::x:       return max;
+		case lane::unorm:
+		case lane::uint:    return uint32_t(round_half_up(clamp_nan(f, 0.0, 1.0) * max));
+		case lane::snorm:
+		case lane::sint:    { const double smax = bit_mask(c.bits - 1); const double v = clamp_nan(f, -1.0, 1.0) * smax; return uint32_t(int32_t(v < 0.0 ? -round_half_up(-v) : round_half_up(v))) & max; }
+		case lane::float32: return as_uint(f);
+		case lane::float16: return f32tof16(f);
+		case lane::float11: return float_to_ufloat(f, 6);
+		case lane::float10: return float_to_ufloat(f, 5);
+		case lane::xr_bias: return uint32_t(clamp_nan(round_half_up(double(f) * 510.0 + 0x180), 0.0, 1023.0));
+		case lane::udec3:   { const float k = 0.5f / float(max); return uint32_t(float(clamp_nan(f, -1.0, 1.0)) * k + k + 0.5f); }
+		default: break;
 	}
+	return 0;
 }
 
-static void copy_ushort2_to_float2(ELCPY_PARAMS(ushort2, float2))
+static void encode_any(const conversion& c, uint8_t* oRESTRICT dst, size_t dst_pitch, const __m128* oRESTRICT lanes, size_t num_elements)
 {
-	const float2* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
+	const texel_layout& l = *c.dst;
+	const bool sharedexp = l.channel[0].type == lane::sharedexp;
+	for (size_t i = 0; i < num_elements; i++, dst += dst_pitch)
 	{
-		dst->x = n16tof32(src->x);
-		dst->y = n16tof32(src->y);
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
+		alignas(16) float f[4];
+		_mm_store_ps(f, lanes[i]);
+		if (sharedexp)
+		{
+			const uint32_t v = float3_to_sharedexp(f);
+			memcpy(dst, &v, sizeof(v));
+			continue;
+		}
+
+		memset(dst, 0, c.dst_size);
+		for (uint32_t ch = 0; ch < 4; ch++)
+			if (l.channel[ch].type != lane::none)
+				set_bits(dst, l.channel[ch].offset, l.channel[ch].bits, encode_channel(l.channel[ch], f[ch]));
 	}
 }
 
-static void copy_float3_to_ushort4(ELCPY_PARAMS(float3, ushort4))
+// lanes are scaled up to integer range, clamped and rounded to nearest then
+// shifted into place
+static void encode_packed(const conversion& c, uint8_t* oRESTRICT dst, size_t dst_pitch, const __m128* oRESTRICT lanes, size_t num_elements)
 {
-	const ushort4* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
+	const __m128 mul = _mm_load_ps(c.dst_mul);
+	const __m128 hi = _mm_load_ps(c.dst_max);
+	const uint32_t s0 = c.dst_shift[0], s1 = c.dst_shift[1], s2 = c.dst_shift[2], s3 = c.dst_shift[3];
+	const uint32_t size = c.dst_size;
+	for (size_t i = 0; i < num_elements; i++, dst += dst_pitch)
 	{
-		dst->x = (uint16_t)f32ton16(src->x);
-		dst->y = (uint16_t)f32ton16(src->y); 
-		dst->z = (uint16_t)f32ton16(src->z);
-		dst->w = 65535;//f32ton16(1.0f);
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
+		// max first so NaN becomes 0
+		const __m128 f = _mm_min_ps(_mm_max_ps(_mm_mul_ps(lanes[i], mul), _mm_setzero_ps()), hi);
+		alignas(16) uint32_t k[4];
+		_mm_store_si128((__m128i*)k, _mm_cvtps_epi32(f));
+		const uint32_t v = c.dst_fill | (k[0] << s0) | (k[1] << s1) | (k[2] << s2) | (k[3] << s3);
+		if (size == 4)
+			*(uint32_t*)dst = v;
+		else
+			memcpy(dst, &v, size);
 	}
 }
 
-static void copy_ushort4_to_float3(ELCPY_PARAMS(ushort4, float3))
+static void encode_float32(const conversion& c, uint8_t* oRESTRICT dst, size_t dst_pitch, const __m128* oRESTRICT lanes, size_t num_elements)
 {
-	const float3* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
+	if (c.dst_channels == 4)
+	{
+		for (size_t i = 0; i < num_elements; i++, dst += dst_pitch)
+			_mm_storeu_ps((float*)dst, lanes[i]);
+		return;
+	}
+
+	const size_t size = c.dst_channels * sizeof(float);
+	for (size_t i = 0; i < num_elements; i++, dst += dst_pitch)
 	{
-		dst->x = n16tof32(src->x);
-		dst->y = n16tof32(src->y); 
-		dst->z = n16tof32(src->z);
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
+		alignas(16) float f[4];
+		_mm_store_ps(f, lanes[i]);
+		memcpy(dst, f, size);
 	}
 }
 
-static void copy_float3_to_half4(ELCPY_PARAMS(float3, half4))
+static void encode_float16(const conversion& c, uint8_t* oRESTRICT dst, size_t dst_pitch, const __m128* oRESTRICT lanes, size_t num_elements)
 {
-	const half4* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
+	const size_t size = c.dst_channels * sizeof(uint16_t);
+	for (size_t i = 0; i < num_elements; i++, dst += dst_pitch)
 	{
-		dst->x = f32tof16(src->x);
-		dst->y = f32tof16(src->y);
-		dst->z = f32tof16(src->z);
-		dst->w = f32tof16(0.0f);
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
+		__m128i h = float4_to_half(lanes[i]);
+		h = _mm_srai_epi32(_mm_slli_epi32(h, 16), 16); // sign-extend so the pack doesn't saturate
+		uint64_t h4;
+		_mm_storel_epi64((__m128i*)&h4, _mm_packs_epi32(h, h));
+		memcpy(dst, &h4, size);
 	}
 }
 
-static void copy_half4_to_float3(ELCPY_PARAMS(half4, float3))
+// === converters ===
+
+static const size_t kChunk = 64;
+
+static void convert_lanes(const conversion& c, uint8_t* oRESTRICT dst, size_t dst_pitch, const uint8_t* oRESTRICT src, size_t src_pitch, size_t num_elements)
 {
-	const float3* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
+	__m128 lanes[kChunk];
+	while (num_elements)
 	{
-		dst->x = f16tof32(src->x);
-		dst->y = f16tof32(src->y);
-		dst->z = f16tof32(src->z);
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
+		const size_t n = num_elements < kChunk ? num_elements : kChunk;
+		c.decode(c, lanes, src, src_pitch, n);
+		c.encode(c, dst, dst_pitch, lanes, n);
+		src += n * src_pitch;
+		dst += n * dst_pitch;
+		num_elements -= n;
 	}
 }
 
-static void copy_float4_to_half4(ELCPY_PARAMS(float4, half4))
+// unorm <-> unorm rescales each channel with integer math so the result is
+// exactly round(k * dst_max / src_max). Going through 16-bit lanes would round
+// twice for channels that aren't 8 or 16 bits.
+static void convert_unorm(const conversion& c, uint8_t* oRESTRICT dst, size_t dst_pitch, const uint8_t* oRESTRICT src, size_t src_pitch, size_t num_elements)
 {
-	const half4* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
+	const texel_layout& s = *c.src;
+	const texel_layout& d = *c.dst;
+	for (size_t i = 0; i < num_elements; i++, src += src_pitch, dst += dst_pitch)
 	{
-		dst->x = f32tof16(src->x);
-		dst->y = f32tof16(src->y);
-		dst->z = f32tof16(src->z);
-		dst->w = f32tof16(src->w);
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
+		const uint64_t in = load_texel(src, c.src_size);
+		uint64_t out = 0;
+		for (uint32_t ch = 0; ch < 4; ch++)
+		{
+			const channel_layout& dc = d.channel[ch];
+			const channel_layout& sc = s.channel[ch];
+			if (dc.type == lane::none)
+				continue;
+
+			const uint32_t dmax = bit_mask(dc.bits);
+			uint32_t v;
+			if (dc.type == lane::x || (sc.type != lane::unorm && (ch == 3 || sc.type == lane::x)))
+				v = dmax;
+			else if (sc.type == lane::unorm)
+			{
+				// k * dmax / smax is a multiple of 1 / smax so nudging it by a quarter of
+				// that keeps exact ties above double rounding error without changing
+				// any other result.
+				const double k = double(uint32_t(in >> sc.offset) & bit_mask(sc.bits));
+				v = uint32_t(k * c.unorm_scale[ch] + c.unorm_bias[ch]);
+			}
+			else
+				v = 0;
+			out |= uint64_t(v) << dc.offset;
+		}
+		store_texel(dst, c.dst_size, out);
 	}
 }
 
-static void copy_half4_to_float4(ELCPY_PARAMS(half4, float4))
+static void shuffle_bytes(const conversion& c, uint8_t* oRESTRICT dst, size_t dst_pitch, const uint8_t* oRESTRICT src, size_t src_pitch, size_t num_elements)
 {
-	const float4* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
+	const int8_t s0 = c.shuffle[0], s1 = c.shuffle[1], s2 = c.shuffle[2], s3 = c.shuffle[3];
+	const uint32_t dst_size = c.dst_size;
+
+	// 4 bytes to 4 bytes: shift each byte into place, 4 texels at a time
+	if (c.src_size == 4 && dst_size == 4 && src_pitch == 4 && dst_pitch == 4)
+	{
+		__m128i count[4], mask[4];
+		bool left[4];
+		for (int i = 0; i < 4; i++)
+		{
+			const int shift = c.shuffle[i] < 0 ? 0 : 8 * (i - c.shuffle[i]);
+			left[i] = shift >= 0;
+			count[i] = _mm_cvtsi32_si128(left[i] ? shift : -shift);
+			mask[i] = _mm_set1_epi32(c.shuffle[i] < 0 ? 0 : int(0xffu << (8 * i)));
+		}
+
+		const __m128i fill = _mm_set1_epi32(int(c.shuffle_fill));
+		const size_t n4 = num_elements & ~size_t(3);
+		for (size_t i = 0; i < n4; i += 4, src += 16, dst += 16)
+		{
+			const __m128i v = _mm_loadu_si128((const __m128i*)src);
+			__m128i r = fill;
+			for (int b = 0; b < 4; b++)
+				r = _mm_or_si128(r, _mm_and_si128(left[b] ? _mm_sll_epi32(v, count[b]) : _mm_srl_epi32(v, count[b]), mask[b]));
+			_mm_storeu_si128((__m128i*)dst, r);
+		}
+		num_elements -= n4;
+	}
+
+	const uint8_t fill[4] = { uint8_t(c.shuffle_fill), uint8_t(c.shuffle_fill >> 8), uint8_t(c.shuffle_fill >> 16), uint8_t(c.shuffle_fill >> 24) };
+	for (size_t i = 0; i < num_elements; i++, src += src_pitch, dst += dst_pitch)
 	{
-		dst->x = f16tof32(src->x);
-		dst->y = f16tof32(src->y);
-		dst->z = f16tof32(src->z);
-		dst->w = f16tof32(src->w);
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
+		dst[0] = s0 < 0 ? fill[0] : src[s0];
+		if (dst_size > 1) dst[1] = s1 < 0 ? fill[1] : src[s1];
+		if (dst_size > 2) dst[2] = s2 < 0 ? fill[2] : src[s2];
+		if (dst_size > 3) dst[3] = s3 < 0 ? fill[3] : src[s3];
 	}
 }
 
-static void copy_float3_to_udec3(ELCPY_PARAMS(float3, udec3))
+// Existing behavior for rgb -> r8_unorm is luminance rather than red
+static void copy_rgb_to_lum(const conversion& c, uint8_t* oRESTRICT dst, size_t dst_pitch, const uint8_t* oRESTRICT src, size_t src_pitch, size_t num_elements)
 {
-	const udec3* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
+	const int r = c.src->channel[0].offset / 8, g = c.src->channel[1].offset / 8, b = c.src->channel[2].offset / 8;
+	while (num_elements--)
 	{
-		dst->xyzw = float4toudec3(float4(*src, 0.0f));
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
+		argb_channels ch;
+		ch.r = src[r];
+		ch.g = src[g];
+		ch.b = src[b];
+		ch.a = 0xff;
+
+		float4 srgb = truetofloat4(ch.argb);
+		float lum = srgbtolum(srgb.xyz());
+		dst[0] = (uint8_t)f32ton8(saturate(lum));
+		dst += dst_pitch;
+		src += src_pitch;
 	}
 }
 
-static void copy_udec3_to_float3(ELCPY_PARAMS(udec3, float3))
+// === selection ===
+
+static bool all_channels(const texel_layout& l, bool (*pred)(const channel_layout& c, uint32_t channel))
+{
+	for (uint32_t ch = 0; ch < 4; ch++)
+		if (l.channel[ch].type != lane::none && !pred(l.channel[ch], ch))
+			return false;
+	return true;
+}
+
+static bool is_packed(const texel_layout& l, uint32_t size)
 {
-	const float3* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
+	return size <= 4 && all_channels(l, [](const channel_layout& c, uint32_t) { return (c.type == lane::unorm || c.type == lane::uint || c.type == lane::x) && c.bits <= 24; });
+}
+
+static bool is_unorm(const texel_layout& l)
+{
+	return all_channels(l, [](const channel_layout& c, uint32_t) { return c.type == lane::unorm || c.type == lane::x; });
+}
+
+static bool is_unorm8(const texel_layout& l)
+{
+	return all_channels(l, [](const channel_layout& c, uint32_t) { return (c.type == lane::unorm || c.type == lane::x) && c.bits == 8 && (c.offset & 7) == 0; });
+}
+
+static uint32_t max_bits(const texel_layout& l)
+{
+	uint32_t bits = 0;
+	for (const auto& c : l.channel)
+		if (c.type != lane::x && c.bits > bits)
+			bits = c.bits;
+	return bits;
+}
+
+// returns the number of leading channels if the format is an array of the
+// specified float type, or 0
+static uint32_t float_channels(const texel_layout& l, lane type)
+{
+	const uint32_t bits = type == lane::float32 ? 32 : 16;
+	uint32_t n = 0;
+	while (n < 4 && l.channel[n].type == type && l.channel[n].offset == n * bits)
+		n++;
+	for (uint32_t ch = n; ch < 4; ch++)
+		if (l.channel[ch].type != lane::none)
+			return 0;
+	return n;
+}
+
+static void init_packed_decode(conversion& c)
+{
+	for (uint32_t ch = 0; ch < 4; ch++)
 	{
-		*dst = udec3tofloat4(src->xyzw).xyz();
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
+		const channel_layout& l = c.src->channel[ch];
+		const bool present = l.type == lane::unorm || l.type == lane::uint;
+		c.src_mask[ch] = present ? bit_mask(l.bits) << l.offset : 0;
+		c.src_scale[ch] = present ? ldexpf(1.0f, -int(l.offset)) : 0.0f;
+		c.src_divisor[ch] = present ? float(bit_mask(l.bits)) : 1.0f;
+		c.src_bias[ch] = present ? 0.0f : (l.type == lane::x ? 1.0f : lane_default(ch));
 	}
 }
 
-static void copy_float4_to_udec3(ELCPY_PARAMS(float4, udec3))
+static void init_packed_encode(conversion& c)
 {
-	const udec3* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
+	c.dst_fill = 0;
+	for (uint32_t ch = 0; ch < 4; ch++)
 	{
-		dst->xyzw = float4toudec3(*src);
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
+		const channel_layout& l = c.dst->channel[ch];
+		const bool present = l.type == lane::unorm || l.type == lane::uint;
+		const uint32_t max = bit_mask(l.bits);
+		c.dst_mul[ch] = present ? float(max) : 0.0f;
+		c.dst_max[ch] = present ? float(max) : 0.0f;
+		c.dst_shift[ch] = present ? l.offset : 0;
+		if (l.type == lane::x)
+			c.dst_fill |= max << l.offset;
 	}
 }
 
-static void copy_udec3_to_float4(ELCPY_PARAMS(udec3, float4))
+static void init_float_bias(conversion& c, uint32_t nchannels)
+{
+	for (uint32_t ch = 0; ch < 4; ch++)
+		c.src_bias[ch] = ch < nchannels ? 0.0f : lane_default(ch);
+}
+
+// returns false if there's no sensible shuffle (i.e. a channel changes size)
+static bool init_shuffle(conversion& c)
 {
-	const float4* oRESTRICT end = byte_add(dst, dst_elem_pitch * num_elements);
-	while (dst < end)
+	if (!is_unorm8(*c.src) || !is_unorm8(*c.dst) || c.src_size > 4 || c.dst_size > 4)
+		return false;
+
+	for (int i = 0; i < 4; i++)
+		c.shuffle[i] = -1;
+	c.shuffle_fill = 0;
+
+	for (uint32_t ch = 0; ch < 4; ch++)
 	{
-		*dst = udec3tofloat4(src->xyzw);
-		dst = byte_add(dst, dst_elem_pitch);
-		src = byte_add(src, src_elem_pitch);
+		const channel_layout& d = c.dst->channel[ch];
+		const channel_layout& s = c.src->channel[ch];
+		if (d.type == lane::none)
+			continue;
+
+		const uint32_t byte = d.offset / 8;
+		if (d.type == lane::x || s.type == lane::x || (s.type == lane::none && ch == 3))
+			c.shuffle_fill |= 0xffu << (8 * byte);
+		else if (s.type == lane::unorm)
+			c.shuffle[byte] = int8_t(s.offset / 8);
+		// else missing rgb stays 0
 	}
+
+	return true;
 }
 
-static elcpy_fn select(format src_format, format dst_format)
+static conversion select(format src_format, format dst_format)
 {
-	#define CASE_(s,d) ((uint32_t(s)<<16) | uint32_t(d))
-	#define CASE(s,d) case CASE_(format::s, format::d)
-	uint32_t sel = CASE_(src_format, dst_format);
-	switch (sel)
+	const texel_layout& s = layout(src_format);
+	const texel_layout& d = layout(dst_format);
+
+	oCheck(describes(s) && describes(d), std::errc::not_supported, "%s -> %s not supported", as_string(src_format), as_string(dst_format));
+
+	conversion c;
+	memset(&c, 0, sizeof(c));
+	c.src = &s;
+	c.dst = &d;
+	c.src_size = element_size(src_format);
+	c.dst_size = element_size(dst_format);
+
+	if (dst_format == format::r8_unorm && is_unorm8(s) && s.channel[0].type == lane::unorm && s.channel[1].type == lane::unorm && s.channel[2].type == lane::unorm)
 	{
-    CASE(r8g8b8a8_unorm,			r8g8b8_unorm):
-    CASE(b8g8r8a8_unorm,			b8g8r8_unorm):		     return (elcpy_fn)copy_3bytes;
-    CASE(b8g8r8_unorm,				b8g8r8a8_unorm):
-    CASE(r8g8b8_unorm,				r8g8b8a8_unorm):
-    CASE(b8g8r8_unorm,				b8g8r8x8_unorm):       return (elcpy_fn)copy_3bytes_alpha;
-		CASE(r8g8b8_unorm,				b8g8r8a8_unorm):
-    CASE(b8g8r8_unorm,				r8g8b8a8_unorm):
-    CASE(b8g8r8_unorm,				r8g8b8x8_unorm):	     return (elcpy_fn)copy_3bytes_alpha_swap_red_blue;
-    CASE(b8g8r8_unorm,				a8b8g8r8_unorm):
-    CASE(b8g8r8_unorm,				x8b8g8r8_unorm):       return (elcpy_fn)copy_alpha_3bytes;
-    CASE(a8b8g8r8_unorm,			b8g8r8_unorm):
-    CASE(x8b8g8r8_unorm,			b8g8r8_unorm):		     return (elcpy_fn)copy_skip_alpha_3bytes;
-		CASE(a8b8g8r8_unorm,			b8g8r8a8_unorm):
-    CASE(x8b8g8r8_unorm,			b8g8r8a8_unorm):	     return (elcpy_fn)copy_4bytes_swap_rotate_alpha;
-		CASE(b8g8r8a8_unorm,			r8g8b8_unorm): 
-    CASE(b8g8r8_unorm,				r8g8b8_unorm): 
-    CASE(r8g8b8_unorm,				b8g8r8_unorm):		     return (elcpy_fn)copy_3bytes_swap_red_blue;
-    CASE(b8g8r8a8_unorm,			r8g8b8a8_unorm):
-    CASE(r8g8b8a8_unorm,			b8g8r8a8_unorm):	     return (elcpy_fn)copy_4bytes_swap_red_blue;
-
-		CASE(r8g8b8_unorm,        r8_unorm):             return (elcpy_fn)copy_rgb_to_lum;
-		CASE(b8g8r8_unorm,        r8_unorm):             return (elcpy_fn)copy_bgr_to_lum;
-
-		CASE(r32_float,           r8_unorm):             return (elcpy_fn)copy_float_to_r8;
-
-		CASE(r32g32_float,        r16g16_float):
-		CASE(r32g32b32_float,     r16g16_float):
-		CASE(r32g32b32a32_float,  r16g16_float):         return (elcpy_fn)copy_float2_to_half2;
-		CASE(r16g16_float,        r32g32_float):         return (elcpy_fn)copy_half2_to_float2;
-		CASE(r16g16_float,        r32g32b32_float):      return (elcpy_fn)copy_half2_to_float3;
-		CASE(r32g32b32a32_float,  r32g32b32_float):      return (elcpy_fn)copy_float4_to_3;
-		CASE(r32g32b32_float,     r32g32_float):         return (elcpy_fn)copy_float3_to_2;
-		CASE(r32g32_float,        r32g32b32_float):      return (elcpy_fn)copy_float2_to_3;
-		CASE(r16g16_uint,         r32g32_float):
-		CASE(r16g16b16a16_uint,   r32g32_float):         return (elcpy_fn)copy_ushort2_to_float2;
-		CASE(r32g32b32_float,     r16g16b16a16_uint):    return (elcpy_fn)copy_float3_to_ushort4;
-		CASE(r16g16b16a16_uint,   r32g32b32_float):      return (elcpy_fn)copy_ushort4_to_float3;
-		CASE(r32g32b32_float,     r16g16b16a16_float):   return (elcpy_fn)copy_float3_to_half4;
-		CASE(r16g16b16a16_float,  r32g32b32_float):      return (elcpy_fn)copy_half4_to_float3;
-		CASE(r32g32b32a32_float,  r16g16b16a16_float):   return (elcpy_fn)copy_float4_to_half4;
-		CASE(r16g16b16a16_float,  r32g32b32a32_float):   return (elcpy_fn)copy_half4_to_float4;
-		CASE(r32g32b32_float,     r10g10b10a2_unorm):    return (elcpy_fn)copy_float3_to_udec3;
-		CASE(r10g10b10a2_unorm,   r32g32b32_float):      return (elcpy_fn)copy_udec3_to_float3;
-		CASE(r32g32b32a32_float,  r10g10b10a2_unorm):    return (elcpy_fn)copy_float4_to_udec3;
-		CASE(r10g10b10a2_unorm,   r32g32b32a32_float):   return (elcpy_fn)copy_udec3_to_float4;
+		c.convert = copy_rgb_to_lum;
+		return c;
+	}
 
-		default: break;
+	if (init_shuffle(c))
+	{
+		c.convert = shuffle_bytes;
+		return c;
 	}
 
-	oThrow(std::errc::not_supported, "%s -> %s not supported", as_string(src_format), as_string(dst_format));
-	#undef CASE
-	#undef CASE_
+	// the float path is exact for unorms as long as the rounding error of 
+	// k / src_max * dst_max stays under the distance to a tie
+	const bool packed = is_packed(s, c.src_size) && is_packed(d, c.dst_size);
+	if (is_unorm(s) && is_unorm(d) && !(packed && max_bits(s) + max_bits(d) <= 22))
+	{
+		for (uint32_t ch = 0; ch < 4; ch++)
+		{
+			const double smax = double(bit_mask(s.channel[ch].bits ? s.channel[ch].bits : 1));
+			c.unorm_scale[ch] = double(bit_mask(d.channel[ch].bits)) / smax;
+			c.unorm_bias[ch] = 0.5 + 0.25 / smax;
+		}
+		c.convert = convert_unorm;
+		return c;
+	}
+
+	c.convert = convert_lanes;
+
+	if (is_packed(s, c.src_size))
+	{
+		c.decode = decode_packed;
+		init_packed_decode(c);
+	}
+	else if ((c.src_channels = float_channels(s, lane::float32)) != 0)
+	{
+		c.decode = decode_float32;
+		init_float_bias(c, c.src_channels);
+	}
+	else if ((c.src_channels = float_channels(s, lane::float16)) != 0)
+	{
+		c.decode = decode_float16;
+		init_float_bias(c, c.src_channels);
+	}
+	else
+		c.decode = decode_any;
+
+	if (is_packed(d, c.dst_size))
+	{
+		c.encode = encode_packed;
+		init_packed_encode(c);
+	}
+	else if ((c.dst_channels = float_channels(d, lane::float32)) != 0)
+		c.encode = encode_float32;
+	else if ((c.dst_channels = float_channels(d, lane::float16)) != 0)
+		c.encode = encode_float16;
+	else
+		c.encode = encode_any;
+
+	return c;
 }
 
 static format expected_bc_source(const format& f, bool bc7alpha)
@@ -460,67 +938,151 @@ static format expected_bc_source(const format& f, bool bc7alpha)
 	return format::unknown;
 }
 
-// dst and src must be 2d buffers (subresources) and dst must be properly allocated to receive the intended format
+// ispc_texcomp settings are plain structs, so pick them once per call rather 
+// than once per band
+struct bc_settings
+{
+	bc6h_enc_settings bc6h;
+	bc7_enc_settings bc7;
+};
+
+static void get_bc_settings(bc_settings* settings, const format& dst_format, bool bc7alpha, const bc_quality& quality)
+{
+	switch (dst_format)
+	{
+		case format::bc6h_uf16:
+			switch (quality)
+			{
+				case bc_quality::ultrafast: GetProfile_bc6h_veryfast(&settings->bc6h); break;
+				case bc_quality::basic: GetProfile_bc6h_basic(&settings->bc6h); break;
+				case bc_quality::slow: GetProfile_bc6h_slow(&settings->bc6h); break;
+				default: GetProfile_bc6h_fast(&settings->bc6h); break;
+			}
+			break;
+
+		case format::bc7_unorm:
+			switch (quality)
+			{
+				case bc_quality::ultrafast: bc7alpha ? GetProfile_alpha_ultrafast(&settings->bc7) : GetProfile_ultrafast(&settings->bc7); break;
+				case bc_quality::basic: bc7alpha ? GetProfile_alpha_basic(&settings->bc7) : GetProfile_basic(&settings->bc7); break;
+				case bc_quality::slow: bc7alpha ? GetProfile_alpha_slow(&settings->bc7) : GetProfile_slow(&settings->bc7); break;
+				default: bc7alpha ? GetProfile_alpha_fast(&settings->bc7) : GetProfile_fast(&settings->bc7); break;
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+static void compress_blocks(rgba_surface* s, uint8_t* dst, const format& dst_format, bc_settings* settings)
+{
+	switch (dst_format)
+	{
+		case format::bc1_unorm: CompressBlocksBC1(s, dst); break;
+		case format::bc3_unorm: CompressBlocksBC3(s, dst); break;
+		case format::bc6h_uf16: CompressBlocksBC6H(s, dst, &settings->bc6h); break;
+		case format::bc7_unorm: CompressBlocksBC7(s, dst, &settings->bc7); break;
+		default: oThrow(std::errc::not_supported, "unsupported block compression format %s", as_string(dst_format));
+	}
+}
+
+// block rows compressed per task
+static const uint32_t bc_band_blocks = 4;
+
+// dst and src must be 2d buffers (subresources) and dst must be properly allocated to receive the intended format.
+// Each depth slice is compressed in parallel bands of bc_band_blocks block rows. If src isn't already in the format
+// ispc_texcomp expects or doesn't fill whole blocks, each band is converted into scratch memory and padded by 
+// repeating the last column and row before it's compressed.
 void convert_formatted_bc(const mapped_subresource& dst, const format& dst_format
 	, const const_mapped_subresource& src, const format& src_format
-	, const uint3& dimensions, const copy_option& option)
+	, const uint3& dimensions, const copy_option& option, const bc_quality& quality
+	, const allocator& temp_alloc)
 {
 	const bool src_has_alpha = has_alpha(src_format);
 	const auto expected_source_format = expected_bc_source(dst_format, src_has_alpha);
 
-	oSURF_CHECK(src_format == expected_source_format, "input to bc compression must be %s", as_string(expected_source_format));
-	oSURF_CHECK(is_block_compressed(dst_format), "non-bc format specified to BC compression");
-	oSURF_CHECK(has_alpha(src_format) == has_alpha(dst_format) || dst_format == format::bc7_typeless || dst_format == format::bc7_unorm || dst_format == format::bc7_unorm_srgb, "BC compression alpha support mismatch");
+	oSURF_CHECK(expected_source_format != format::unknown, "unsupported block compression format %s", as_string(dst_format));
 	oSURF_CHECK(is_unorm(src_format) == is_unorm(dst_format), "BC compression unorm mismatch");
 	oSURF_CHECK(is_srgb(src_format) == is_srgb(dst_format), "BC compression srgb mismatch");
-	oSURF_CHECK((dimensions.x & 0x3) == 0, "width must be a multiple of 4 for BC compression");
-	oSURF_CHECK((dimensions.y & 0x3) == 0, "height must be a multiple of 4 for BC compression");
 	oSURF_CHECK(option == copy_option::none, "cannot flip vertically during BC compression");
 	
-	const uint32_t calculated_src_row_pitch = row_size(src_format, dimensions.x);
-	const uint32_t calculated_dst_row_pitch = row_size(dst_format, dimensions.x);
-	oSURF_CHECK(calculated_src_row_pitch == src.row_pitch, "mip_layout must be 'none' for a BC compression destination buffer");
+	const uint32_t padded_width = (dimensions.x + 3) & ~3u;
+	const uint32_t padded_height = (dimensions.y + 3) & ~3u;
+
+	const uint32_t calculated_dst_row_pitch = row_size(dst_format, padded_width);
 	oSURF_CHECK(calculated_dst_row_pitch == dst.row_pitch, "mip_layout must be 'none' for a BC compression destination buffer");
 
+	bc_settings settings;
+	get_bc_settings(&settings, dst_format, src_has_alpha, quality);
+
+	const uint32_t band_rows = bc_band_blocks * 4;
+	const uint32_t num_bands = (padded_height + band_rows - 1) / band_rows;
 	const uint32_t num_depth_slices = max(1u, dimensions.z);
-	uint8_t* oRESTRICT data = (uint8_t*)dst.data;
-	for (uint32_t d = 0; d < num_depth_slices; d++, data += dst.depth_pitch)
+	const bool direct = src_format == expected_source_format && padded_width == dimensions.x && padded_height == dimensions.y;
+
+	const uint32_t scratch_el = element_size(expected_source_format);
+	const uint32_t scratch_pitch = padded_width * scratch_el;
+
+	parallel_for(0, num_depth_slices * num_bands, [&](size_t index)
 	{
+		const uint32_t d = uint32_t(index / num_bands);
+		const uint32_t y = uint32_t(index % num_bands) * band_rows;
+		const uint32_t nrows = min(band_rows, padded_height - y);
+		const uint8_t* src_band = (const uint8_t*)src.data + d * src.depth_pitch + y * src.row_pitch;
+		uint8_t* dst_band = (uint8_t*)dst.data + d * dst.depth_pitch + (y / 4) * dst.row_pitch;
+
 		rgba_surface s;
-		s.ptr = (uint8_t*)src.data + d * src.depth_pitch;
-		s.width = dimensions.x;
-		s.height = dimensions.y;
-		s.stride = src.row_pitch;
+		s.width = padded_width;
+		s.height = nrows;
 
-		switch (dst_format)
+		if (direct)
 		{
-			case format::bc1_unorm: CompressBlocksBC1(&s, data); break;
-			case format::bc3_unorm: CompressBlocksBC3(&s, data); break;
-			case format::bc6h_uf16:
-			{
-				bc6h_enc_settings settings;
-				GetProfile_bc6h_fast(&settings);
-				CompressBlocksBC6H(&s, data, &settings);
-				break;
-			}
-			
-			case format::bc7_unorm:
+			s.ptr = (uint8_t*)src_band;
+			s.stride = src.row_pitch;
+			compress_blocks(&s, dst_band, dst_format, &settings);
+			return;
+		}
+
+		blob scratch = temp_alloc.scoped_allocate(scratch_pitch * nrows, "bc band");
+		uint8_t* band = scratch;
+		
+		const uint32_t nsrc_rows = min(nrows, dimensions.y - y);
+		mapped_subresource mapped_band;
+		mapped_band.data = band;
+		mapped_band.row_pitch = scratch_pitch;
+		mapped_band.depth_pitch = scratch_pitch * nrows;
+
+		const_mapped_subresource mapped_src;
+		mapped_src.data = src_band;
+		mapped_src.row_pitch = src.row_pitch;
+		mapped_src.depth_pitch = src.row_pitch * nsrc_rows;
+
+		convert_formatted(mapped_band, expected_source_format, mapped_src, src_format, uint3(dimensions.x, nsrc_rows, 1));
+
+		// pad partial blocks by repeating edge texels
+		if (padded_width != dimensions.x)
+			for (uint32_t r = 0; r < nsrc_rows; r++)
 			{
-				bc7_enc_settings settings;
-				src_has_alpha ? GetProfile_alpha_fast(&settings) : GetProfile_fast(&settings);
-				CompressBlocksBC7(&s, data, &settings);
-				break;
+				uint8_t* row = band + r * scratch_pitch;
+				const uint8_t* last = row + (dimensions.x - 1) * scratch_el;
+				for (uint32_t x = dimensions.x; x < padded_width; x++)
+					memcpy(row + x * scratch_el, last, scratch_el);
 			}
 
-			default:
-				oThrow(std::errc::not_supported, "unsupported block compression format %s", as_string(dst_format));
-		}
-	}
+		for (uint32_t r = nsrc_rows; r < nrows; r++)
+			memcpy(band + r * scratch_pitch, band + (nsrc_rows - 1) * scratch_pitch, scratch_pitch);
+
+		s.ptr = band;
+		s.stride = scratch_pitch;
+		compress_blocks(&s, dst_band, dst_format, &settings);
+	});
 }
 
 void convert_formatted(const mapped_subresource& dst, const format& dst_format
 	, const const_mapped_subresource& src, const format& src_format
-	, const uint3& dimensions, const copy_option& option)
+	, const uint3& dimensions, const copy_option& option, const bc_quality& quality
+	, const allocator& temp_alloc)
 {
 	const uint32_t src_elem_pitch = element_size(src_format);
 	const uint32_t dst_elem_pitch = element_size(dst_format);
@@ -543,37 +1105,26 @@ void convert_formatted(const mapped_subresource& dst, const format& dst_format
 
 	if (is_block_compressed(dst_format))
 	{
-		convert_formatted_bc(dst, dst_format, src, src_format, dimensions, option);
+		convert_formatted_bc(dst, dst_format, src, src_format, dimensions, option, quality, temp_alloc);
 		return;
 	}
 
-	elcpy_fn elcpy = select(src_format, dst_format);
-
-	if (option == copy_option::flip_vertically)
-	{
-		for (uint32_t d = 0; d < num_depth_slices; d++)
-		{
-			uint8_t* oRESTRICT dst_data = (uint8_t*)dst.data + d * dst.depth_pitch;
-			const uint8_t* oRESTRICT src_data = (const uint8_t*)src.data + (d+1) * src.depth_pitch;
-
-			for (uint32_t y = dimensions.y-1; y >= 0; y--, dst_data += dst.row_pitch)
-			{
-				src_data -= src.row_pitch;
-				elcpy(dst_data, dst_elem_pitch, src_data, src_elem_pitch, dimensions.x);
-			}
-		}
-	}
+	const conversion c = select(src_format, dst_format);
+	const bool flip = option == copy_option::flip_vertically;
 
-	else
+	// rows are independent so convert them across all depth slices at once
+	parallel_for_range(0, num_depth_slices * dimensions.y, [&](size_t begin, size_t end)
 	{
-		for (uint32_t d = 0; d < num_depth_slices; d++)
+		for (size_t i = begin; i < end; i++)
 		{
-			uint8_t* oRESTRICT dst_data = (uint8_t*)dst.data + d * dst.depth_pitch;
-			const uint8_t* oRESTRICT src_data = (const uint8_t*)src.data + d * src.depth_pitch;
-			for (uint32_t y = 0; y < dimensions.y; y++, dst_data += dst.row_pitch, src_data += src.row_pitch)
-				elcpy(dst_data, dst_elem_pitch, src_data, src_elem_pitch, dimensions.x);
+			const uint32_t d = uint32_t(i / dimensions.y);
+			const uint32_t y = uint32_t(i % dimensions.y);
+			const uint32_t src_y = flip ? dimensions.y - 1 - y : y;
+			uint8_t* oRESTRICT dst_row = (uint8_t*)dst.data + d * dst.depth_pitch + y * dst.row_pitch;
+			const uint8_t* oRESTRICT src_row = (const uint8_t*)src.data + d * src.depth_pitch + src_y * src.row_pitch;
+			c.convert(c, dst_row, dst_elem_pitch, src_row, src_elem_pitch, dimensions.x);
 		}
-	}
+	});
 }
 
 void convert_structured(void* oRESTRICT dst, uint32_t dst_elem_pitch, const format& dst_format, const void* oRESTRICT src, uint32_t src_elem_pitch, const format& src_format, uint32_t num_elements)
@@ -599,8 +1150,8 @@ void convert_structured(void* oRESTRICT dst, uint32_t dst_elem_pitch, const form
 	}
 	else
 	{
-		elcpy_fn elcpy = select(src_format, dst_format);
-		elcpy(dst, dst_elem_pitch, src, src_elem_pitch, num_elements);
+		const conversion c = select(src_format, dst_format);
+		c.convert(c, (uint8_t*)dst, dst_elem_pitch, (const uint8_t*)src, src_elem_pitch, num_elements);
 	}
 }
 
@@ -4,8 +4,13 @@
 #include <oSurface/algo.h>
 #include <oSurface/box.h>
 #include <oSurface/convert.h>
+#include <oConcurrency/concurrency.h>
 #include <oMemory/memory.h>
+#include <cmath>
+#include <limits>
 #include <mutex>
+#include <vector>
+#include <emmintrin.h>
 
 namespace ouro { namespace surface {
 
@@ -13,10 +18,12 @@ image::image(image&& that)
 	: info_(that.info_)
 	, bits_(that.bits_)
 	, alloc_(that.alloc_)
+	, read_only_(that.read_only_)
 {
 	that.bits_ = nullptr;
 	that.info_ = info();
 	that.alloc_ = allocator();
+	that.read_only_ = false;
 }
 
 image& image::operator=(image&& that)
@@ -29,6 +36,7 @@ image& image::operator=(image&& that)
 		bits_ = that.bits_; that.bits_ = nullptr; 
 		info_ = that.info_; that.info_ = info();
 		alloc_ = that.alloc_; that.alloc_ = allocator();
+		read_only_ = that.read_only_; that.read_only_ = false;
 		that.mtx.unlock();
 		mtx.unlock();
 	}
@@ -51,6 +59,12 @@ void image::initialize(const info_t& info, const void* data, const allocator& al
 	alloc_ = alloc;
 }
 
+void image::initialize_read_only(const info_t& info, const void* data, const allocator& alloc)
+{
+	initialize(info, data, alloc);
+	read_only_ = true;
+}
+
 void image::initialize_array(const image* const* sources, uint32_t num_sources, bool mips)
 {
 	deinitialize();
@@ -107,16 +121,24 @@ void image::deinitialize()
 		alloc_.deallocate(bits_);
 	bits_ = nullptr;
 	alloc_ = allocator();
+	read_only_ = false;
+}
+
+void image::check_mutable() const
+{
+	oCheck(!immutable(), std::errc::operation_not_permitted, "image is read-only");
 }
 
 void image::clear()
 {
+	check_mutable();
 	lock_t lock(mtx);
 	memset(bits_, 0, size());
 }
 
 void image::fill(uint32_t argb)
 {
+  check_mutable();
   lock_t lock(mtx);
 
   const uint32_t nsubresources = num_subresources(info_);
@@ -160,6 +182,7 @@ void image::flatten()
 
 void image::update_subresource(uint32_t subresource, const const_mapped_subresource& src, const copy_option& option)
 {
+	check_mutable();
 	uint2 bd;
 	mapped_subresource dst = map_subresource(info_, subresource, bits_, &bd);
 	lock_t lock(mtx);
@@ -168,6 +191,7 @@ void image::update_subresource(uint32_t subresource, const const_mapped_subresou
 
 void image::update_subresource(uint32_t subresource, const box_t& box, const const_mapped_subresource& src, const copy_option& option)
 {
+	check_mutable();
 	if (is_block_compressed(info_.format) || info_.format == format::r1_unorm)
 		oThrow(std::errc::invalid_argument, "block compressed and bit formats not supported");
 
@@ -194,6 +218,7 @@ void image::update_subresource(uint32_t subresource, const box_t& box, const con
 
 void image::map(uint32_t subresource, mapped_subresource* out_mapped, uint2* out_byte_dimensions)
 {
+	check_mutable();
 	mtx.lock();
 	try
 	{
@@ -232,12 +257,12 @@ void image::copy_to(uint32_t subresource, const mapped_subresource& dst, const c
 	memcpy2d(dst.data, dst.row_pitch, src.data, src.row_pitch, bd.x, bd.y, option == copy_option::flip_vertically);
 }
 
-image image::convert(const info_t& dst_info) const
+image image::convert(const info_t& dst_info, const bc_quality& quality) const
 {
-	return convert(dst_info, alloc_);
+	return convert(dst_info, alloc_, quality);
 }
 
-image image::convert(const info_t& dst_info, const allocator& alloc) const
+image image::convert(const info_t& dst_info, const allocator& alloc, const bc_quality& quality) const
 {
 	if (any(dst_info.dimensions != info_.dimensions))
 		oThrow(std::errc::invalid_argument, "dimensions mismatch, implement a resize here");
@@ -246,15 +271,18 @@ image image::convert(const info_t& dst_info, const allocator& alloc) const
 	shared_lock slock(this);
 	lock_guard dlock(converted);
 
+	// subresources don't overlap, so convert them all at once: for mip chains 
+	// this keeps threads busy once the top mip is done
 	const auto nsubresources = num_subresources(info_);
-	for (uint32_t subresource = 0; subresource < nsubresources; subresource++)
+	parallel_for(0, nsubresources, [&](size_t index)
 	{
+		const uint32_t subresource = uint32_t(index);
 		auto subinfo = subresourceinfo(info_, subresource);
 		auto mapped_src = map_const_subresource(info_, subresource, slock.mapped.data);
 		auto mapped_dst = map_subresource(dst_info, subresource, dlock.mapped.data);
 
-		convert_formatted(mapped_dst, dst_info.format, mapped_src, info_.format, subinfo.dimensions);
-	}
+		convert_formatted(mapped_dst, dst_info.format, mapped_src, info_.format, subinfo.dimensions, copy_option::none, quality, alloc);
+	});
 
 	return converted;
 }
@@ -292,82 +320,423 @@ void image::convert_in_place(const format& fmt)
 	info_.format = fmt;
 }
 
-void image::generate_mips(const filter& f)
+// sRGB texels are filtered as 16-bit linear values so that averaging doesn't
+// darken the result and dark gradients don't band
+struct srgb_tables_t
 {
-	lock_t lock(mtx);
+	srgb_tables_t()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			const float s = i / 255.0f;
+			const float l = s <= 0.04045f ? s / 12.92f : powf((s + 0.055f) / 1.055f, 2.4f);
+			to_linear[i] = uint16_t(l * 65535.0f + 0.5f);
+		}
+
+		for (int i = 0; i < 65536; i++)
+		{
+			const float l = i / 65535.0f;
+			const float s = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+			to_srgb[i] = uint8_t(s * 255.0f + 0.5f);
+		}
+	}
+
+	static const srgb_tables_t& get() { static srgb_tables_t t; return t; }
 
-	uint32_t nMips = num_mips(info_);
-	uint32_t nSlices = info_.safe_array_size();
+	uint16_t to_linear[256];
+	uint8_t to_srgb[65536];
+};
 
-	for (uint32_t slice = 0; slice < nSlices; slice++)
+// returns the byte offset of an 8-bit unorm alpha channel in an element or -1
+static int alpha_byte(const format& f)
+{
+	if (!has_alpha(f) || !is_unorm(f) || channel_bits(f).a != 8)
+		return -1;
+	return (f == format::a8b8g8r8_unorm || f == format::a8b8g8r8_unorm_srgb) ? 0 : int(element_size(f)) - 1;
+}
+
+// true if each destination texel is the average of a 2x2 block of the source
+static bool is_half(const uint3& src, const uint3& dst)
+{
+	return (dst.x * 2 == src.x || (src.x == 1 && dst.x == 1)) && (dst.y * 2 == src.y || (src.y == 1 && dst.y == 1));
+}
+
+// box_slice averages each 8- or 16-bit channel as an unsigned integer, so only
+// uncompressed unorm/uint formats whose channels are all that size can use it
+static bool is_box_averageable(const format& f)
+{
+	switch (f)
 	{
-		int mip0subresource = calc_subresource(0, slice, 0, nMips, info_.array_size);
-		const_mapped_subresource mip0 = map_const_subresource(info_, mip0subresource, bits_);
+		case format::r16g16b16a16_uint: case format::r16g16_uint: case format::r16_uint:
+		case format::r8g8b8a8_uint: case format::r8g8_uint: case format::r8_uint:
+			return true;
+		default:
+			break;
+	}
+
+	if (!is_unorm(f) || is_block_compressed(f) || is_planar(f) || is_yuv(f))
+		return false;
+
+	const bit_size b = channel_bits(f);
+	return (b.r == 8 || b.r == 16) && (!b.g || b.g == b.r) && (!b.b || b.b == b.r) && (!b.a || b.a == b.r) && (element_size(f) * 8) % b.r == 0;
+}
+
+// step is the distance between horizontal neighbors: 0 for a 1-texel wide source
+template<typename T>
+static void box_row(const T* oRESTRICT r0, const T* oRESTRICT r1, uint32_t step, uint32_t num_channels, T* oRESTRICT dst, uint32_t dst_width)
+{
+	for (uint32_t x = 0; x < dst_width; x++, r0 += 2 * step, r1 += 2 * step, dst += num_channels)
+		for (uint32_t c = 0; c < num_channels; c++)
+			dst[c] = T((uint32_t(r0[c]) + r0[step + c] + r1[c] + r1[step + c] + 2) >> 2);
+}
+
+// 4 destination texels per iteration: widen to 16-bit, add the rows, then add
+// horizontal neighbors by pairing the 64-bit halves. Rounds like box_row.
+static void box_row_4x8(const uint8_t* oRESTRICT r0, const uint8_t* oRESTRICT r1, uint8_t* oRESTRICT dst, uint32_t dst_width)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
 
-		for (uint32_t mip = 1; mip < nMips; mip++)
+	uint32_t x = 0;
+	for (; x + 4 <= dst_width; x += 4, r0 += 32, r1 += 32, dst += 16)
+	{
+		__m128i sums[2];
+		for (int i = 0; i < 2; i++)
 		{
-			uint32_t subresource = calc_subresource(mip, slice, 0, nMips, info_.array_size);
-			auto subinfo = subresourceinfo(info_, subresource);
+			const __m128i a = _mm_loadu_si128((const __m128i*)r0 + i);
+			const __m128i b = _mm_loadu_si128((const __m128i*)r1 + i);
+			const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+			const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+			const __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+			sums[i] = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+		}
+
+		_mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(sums[0], sums[1]));
+	}
+
+	box_row<uint8_t>(r0, r1, 4, 4, dst, dst_width - x);
+}
+
+static void box_slice(const info_t& src_info, const const_mapped_subresource& src, const info_t& dst_info, const mapped_subresource& dst)
+{
+	const uint32_t elementSize = element_size(src_info.format);
+	const bool unorm16 = channel_bits(src_info.format).r == 16;
+	const uint32_t srcHeight = src_info.dimensions.y;
+	const uint32_t dstWidth = dst_info.dimensions.x;
+	const bool narrow = src_info.dimensions.x == 1;
 
-			mapped_subresource dst = map_subresource(info_, subresource, bits_);
+	parallel_for_range(0, dst_info.dimensions.y, [&](size_t begin, size_t end)
+	{
+		for (size_t y = begin; y < end; y++)
+		{
+			const uint8_t* r0 = (const uint8_t*)byte_add(src.data, (srcHeight == 1 ? 0 : 2 * y) * src.row_pitch);
+			const uint8_t* r1 = srcHeight == 1 ? r0 : byte_add(r0, src.row_pitch);
+			uint8_t* d = (uint8_t*)byte_add(dst.data, y * dst.row_pitch);
 
-			uint32_t nDepthSlices = max(1u, subinfo.dimensions.z);
-			for (uint32_t depth = 0; depth < nDepthSlices; depth++)
+			if (unorm16)
 			{
-				info_t di = info_;
-				di.dimensions = subinfo.dimensions;
-				resize(info_, mip0, di, dst, f);
-				dst.data = byte_add(dst.data, dst.depth_pitch);
+				const uint32_t nc = elementSize / 2;
+				box_row<uint16_t>((const uint16_t*)r0, (const uint16_t*)r1, narrow ? 0 : nc, nc, (uint16_t*)d, dstWidth);
 			}
+
+			else if (elementSize == 4 && !narrow)
+				box_row_4x8(r0, r1, d, dstWidth);
+			else
+				box_row<uint8_t>(r0, r1, narrow ? 0 : elementSize, elementSize, d, dstWidth);
+		}
+	});
+}
+
+static void filter_slice(const info_t& src_info, const const_mapped_subresource& src, const info_t& dst_info, const mapped_subresource& dst, const filter& f)
+{
+	if (f == filter::box && is_half(src_info.dimensions, dst_info.dimensions) && is_box_averageable(src_info.format))
+		box_slice(src_info, src, dst_info, dst);
+	else
+		resize(src_info, src, dst_info, dst, f);
+}
+
+// decodes 8-bit sRGB to 16-bit linear rgba, filters, then re-encodes
+static void filter_srgb_slice(const info_t& src_info, const const_mapped_subresource& src, const info_t& dst_info, const mapped_subresource& dst, const filter& f, int alpha_index)
+{
+	const auto& tables = srgb_tables_t::get();
+	const uint32_t elementSize = element_size(src_info.format);
+
+	info_t lsi = src_info;
+	info_t ldi = dst_info;
+	lsi.format = ldi.format = format::r16g16b16a16_unorm;
+
+	const_mapped_subresource lsrc;
+	mapped_subresource ldst;
+	lsrc.row_pitch = lsi.dimensions.x * 8;
+	lsrc.depth_pitch = lsrc.row_pitch * lsi.dimensions.y;
+	ldst.row_pitch = ldi.dimensions.x * 8;
+	ldst.depth_pitch = ldst.row_pitch * ldi.dimensions.y;
+
+	blob mem = default_allocator.scoped_allocate(lsrc.depth_pitch + ldst.depth_pitch, "generate_mips linear");
+	if (!mem)
+		oThrow(std::errc::not_enough_memory, "generate_mips linear scratch allocation failed");
+
+	uint8_t* p = mem;
+	lsrc.data = p;
+	ldst.data = p + lsrc.depth_pitch;
+
+	for (uint32_t y = 0; y < lsi.dimensions.y; y++)
+	{
+		const uint8_t* s = (const uint8_t*)byte_add(src.data, y * src.row_pitch);
+		uint16_t* l = (uint16_t*)byte_add(lsrc.data, y * lsrc.row_pitch);
+		for (uint32_t x = 0; x < lsi.dimensions.x; x++, s += elementSize, l += 4)
+		{
+			for (uint32_t c = 0; c < elementSize; c++)
+				l[c] = int(c) == alpha_index ? uint16_t(s[c] * 257) : tables.to_linear[s[c]];
+			for (uint32_t c = elementSize; c < 4; c++)
+				l[c] = 0xffff;
+		}
+	}
+
+	filter_slice(lsi, lsrc, ldi, ldst, f);
+
+	for (uint32_t y = 0; y < ldi.dimensions.y; y++)
+	{
+		const uint16_t* l = (const uint16_t*)byte_add(ldst.data, y * ldst.row_pitch);
+		uint8_t* d = (uint8_t*)byte_add(dst.data, y * dst.row_pitch);
+		for (uint32_t x = 0; x < ldi.dimensions.x; x++, d += elementSize, l += 4)
+			for (uint32_t c = 0; c < elementSize; c++)
+				d[c] = int(c) == alpha_index ? uint8_t((l[c] * 255u + 32767u) / 65535u) : tables.to_srgb[l[c]];
+	}
+}
+
+static void alpha_histogram(const info_t& info, uint32_t subresource, const void* bits, int alpha_index, uint32_t histogram[256])
+{
+	memset(histogram, 0, 256 * sizeof(uint32_t));
+	const auto subinfo = subresourceinfo(info, subresource);
+	const uint32_t elementSize = element_size(info.format);
+	const uint32_t nDepthSlices = max(1u, subinfo.dimensions.z);
+	for (uint32_t depth = 0; depth < nDepthSlices; depth++)
+	{
+		const_mapped_subresource m = map_const_subresource(info, subresource, depth, bits);
+		for (uint32_t y = 0; y < subinfo.dimensions.y; y++)
+		{
+			const uint8_t* a = (const uint8_t*)byte_add(m.data, y * m.row_pitch) + alpha_index;
+			for (uint32_t x = 0; x < subinfo.dimensions.x; x++, a += elementSize)
+				histogram[*a]++;
 		}
 	}
 }
 
-float calc_rms(const image& b1, const image& b2)
+// Filtering spreads alpha out so fewer texels pass an alpha test at lower mips
+// and foliage thins out with distance. This rescales a mip's alpha so the 
+// number of texels above ref matches the coverage of the top mip.
+static void preserve_alpha_coverage(const info_t& info, uint32_t subresource, void* bits, int alpha_index, uint8_t ref, float coverage)
 {
-	return calc_rms(b1, b2, nullptr);
+	uint32_t histogram[256];
+	alpha_histogram(info, subresource, bits, alpha_index, histogram);
+
+	const auto subinfo = subresourceinfo(info, subresource);
+	const uint32_t nDepthSlices = max(1u, subinfo.dimensions.z);
+	const uint32_t target = uint32_t(coverage * subinfo.dimensions.x * subinfo.dimensions.y * nDepthSlices + 0.5f);
+
+	// find the smallest threshold that passes no more than target texels
+	uint32_t passing = 0;
+	int threshold = 255;
+	while (threshold > 0 && passing + histogram[threshold] <= target)
+		passing += histogram[threshold--];
+
+	if (threshold == ref)
+		return;
+
+	// values above threshold map to values above ref and the rest don't
+	const float scale = (ref + 0.5f) / (threshold + 0.5f);
+	uint8_t remap[256];
+	for (int i = 0; i < 256; i++)
+		remap[i] = uint8_t(min(255.0f, i * scale + 0.5f));
+
+	const uint32_t elementSize = element_size(info.format);
+	for (uint32_t depth = 0; depth < nDepthSlices; depth++)
+	{
+		mapped_subresource m = map_subresource(info, subresource, depth, bits);
+		for (uint32_t y = 0; y < subinfo.dimensions.y; y++)
+		{
+			uint8_t* a = (uint8_t*)byte_add(m.data, y * m.row_pitch) + alpha_index;
+			for (uint32_t x = 0; x < subinfo.dimensions.x; x++, a += elementSize)
+				*a = remap[*a];
+		}
+	}
 }
 
-float calc_rms(const image& b1, const image& b2, image* out_diffs, int diff_scale, const allocator& alloc)
+void image::generate_mips(const filter& f, float alpha_test_ref)
 {
-	info_t si1 = b1.info();
-	info_t si2 = b2.info();
+	check_mutable();
+	lock_t lock(mtx);
+
+	const uint32_t nMips = num_mips(info_);
+	const uint32_t nSlices = info_.safe_array_size();
+	if (nMips <= 1)
+		return;
+
+	const uint32_t elementSize = element_size(info_.format);
+	const int alphaIndex = alpha_byte(info_.format);
+	const bool srgb = is_srgb(info_.format) && channel_bits(info_.format).r == 8 && (elementSize == 3 || elementSize == 4);
+	const bool alphaTest = alpha_test_ref > 0.0f && alphaIndex >= 0;
+	const uint8_t alphaRef = uint8_t(clamp(alpha_test_ref, 0.0f, 1.0f) * 255.0f + 0.5f);
 
+	std::vector<float> coverage;
+	if (alphaTest)
+	{
+		coverage.resize(nSlices);
+		parallel_for(0, nSlices, [&](size_t slice)
+		{
+			const uint32_t subresource = calc_subresource(0, uint32_t(slice), 0, nMips, info_.array_size);
+			const auto subinfo = subresourceinfo(info_, subresource);
+
+			uint32_t histogram[256];
+			alpha_histogram(info_, subresource, bits_, alphaIndex, histogram);
+			uint32_t passing = 0;
+			for (int i = alphaRef + 1; i < 256; i++)
+				passing += histogram[i];
+			coverage[slice] = passing / float(subinfo.dimensions.x * subinfo.dimensions.y * max(1u, subinfo.dimensions.z));
+		});
+	}
+
+	// each level is filtered from the one above it. All array slices, cube faces 
+	// and depth slices of a level are independent.
+	for (uint32_t mip = 1; mip < nMips; mip++)
+	{
+		const auto srcSubinfo = subresourceinfo(info_, calc_subresource(mip - 1, 0, 0, nMips, info_.array_size));
+		const auto dstSubinfo = subresourceinfo(info_, calc_subresource(mip, 0, 0, nMips, info_.array_size));
+		const uint32_t nSrcDepthSlices = max(1u, srcSubinfo.dimensions.z);
+		const uint32_t nDstDepthSlices = max(1u, dstSubinfo.dimensions.z);
+
+		info_t si = info_;
+		si.dimensions = uint3(srcSubinfo.dimensions.x, srcSubinfo.dimensions.y, 1);
+		si.mip_layout = mip_layout::none;
+		si.array_size = 0;
+
+		info_t di = si;
+		di.dimensions = uint3(dstSubinfo.dimensions.x, dstSubinfo.dimensions.y, 1);
+
+		parallel_for(0, nSlices * nDstDepthSlices, [&](size_t index)
+		{
+			const uint32_t slice = uint32_t(index / nDstDepthSlices);
+			const uint32_t depth = uint32_t(index % nDstDepthSlices);
+
+			// depth is point-sampled: each 2D slice filters from the nearest slice above
+			const uint32_t srcSubresource = calc_subresource(mip - 1, slice, 0, nMips, info_.array_size);
+			const uint32_t dstSubresource = calc_subresource(mip, slice, 0, nMips, info_.array_size);
+			const_mapped_subresource src = map_const_subresource(info_, srcSubresource, min(depth * 2, nSrcDepthSlices - 1), bits_);
+			mapped_subresource dst = map_subresource(info_, dstSubresource, depth, bits_);
+
+			if (srgb)
+				filter_srgb_slice(si, src, di, dst, f, alphaIndex);
+			else
+				filter_slice(si, src, di, dst, f);
+		});
+
+		if (alphaTest)
+			parallel_for(0, nSlices, [&](size_t slice)
+			{
+				preserve_alpha_coverage(info_, calc_subresource(mip, uint32_t(slice), 0, nMips, info_.array_size), bits_, alphaIndex, alphaRef, coverage[slice]);
+			});
+	}
+}
+
+static void check_comparable(const info_t& si1, const info_t& si2)
+{
 	if (any(si1.dimensions != si2.dimensions)) oThrow(std::errc::invalid_argument, "mismatched dimensions");
 	if (si1.format != si2.format) oThrow(std::errc::invalid_argument, "mismatched format");
 	if (si1.array_size != si2.array_size) oThrow(std::errc::invalid_argument, "mismatched array_size");
-	int n1 = num_subresources(si1);
-	int n2 = num_subresources(si2);
-	if (n1 != n2) oThrow(std::errc::invalid_argument, "incompatible layouts");
+	if (num_subresources(si1) != num_subresources(si2)) oThrow(std::errc::invalid_argument, "incompatible layouts");
+}
+
+// returns info for the subresource as if it were the top-level surface
+static info_t subresource_as_info(const info_t& info, uint32_t subresource)
+{
+	info_t si = info;
+	si.dimensions = subresourceinfo(info, subresource).dimensions;
+	return si;
+}
+
+float calc_rms(const image& b1, const image& b2)
+{
+	return calc_diff_stats(b1, b2).rms;
+}
+
+float calc_rms(const image& b1, const image& b2, image* out_diffs, int diff_scale, const allocator& alloc)
+{
+	return calc_diff_stats(b1, b2, out_diffs, diff_scale, alloc).rms;
+}
+
+diff_stats_t calc_diff_stats(const image& b1, const image& b2, image* out_diffs, int diff_scale, const allocator& alloc)
+{
+	const info_t si1 = b1.info();
+	check_comparable(si1, b2.info());
 
-	info_t dsi;
 	if (out_diffs)
 	{
-		dsi = si1;
+		info_t dsi = si1;
 		dsi.format = format::r8_unorm;
-		out_diffs->initialize(dsi);
+		out_diffs->initialize(dsi, alloc);
 	}
 
-	float rms = 0.0f;
-	for (int i = 0; i < n1; i++)
+	// combine the mean squared error of each subresource weighted by its size
+	double sum_sq = 0.0;
+	double num_pixels = 0.0;
+	diff_stats_t stats;
+	stats.max_diff = 0;
+
+	const uint32_t n = num_subresources(si1);
+	for (uint32_t i = 0; i < n; i++)
 	{
-		mapped_subresource msr;
-		if (out_diffs)
-			out_diffs->map(i, &msr);
+		const info_t si = subresource_as_info(si1, i);
 
 		shared_lock lock1(b1, i);
 		shared_lock lock2(b2, i);
-	
+
+		diff_stats_t s;
 		if (out_diffs)
-			rms += calc_rms(si1, lock1.mapped, lock2.mapped, dsi, msr);
+		{
+			info_t dsi = si;
+			dsi.format = format::r8_unorm;
+			lock_guard lockd(*out_diffs, i);
+			s = calc_diff_stats(si, lock1.mapped, lock2.mapped, dsi, lockd.mapped, uint32_t(max(diff_scale, 0)));
+		}
 		else
-			rms += calc_rms(si1, lock1.mapped, lock2.mapped);
+			s = calc_diff_stats(si, lock1.mapped, lock2.mapped);
 
-		if (out_diffs)
-			out_diffs->unmap(i);
+		const double npixels = double(si.dimensions.x) * si.dimensions.y;
+		sum_sq += double(s.rms) * s.rms * npixels;
+		num_pixels += npixels;
+		stats.max_diff = max(stats.max_diff, s.max_diff);
+	}
+
+	const double mse = num_pixels > 0.0 ? (sum_sq / num_pixels) : 0.0;
+	stats.rms = float(sqrt(mse));
+	stats.psnr = mse > 0.0 ? float(10.0 * log10(255.0 * 255.0 / mse)) : std::numeric_limits<float>::infinity();
+	return stats;
+}
+
+float calc_ssim(const image& b1, const image& b2)
+{
+	const info_t si1 = b1.info();
+	check_comparable(si1, b2.info());
+
+	// average of each subresource weighted by its size
+	double sum = 0.0;
+	double num_pixels = 0.0;
+
+	const uint32_t n = num_subresources(si1);
+	for (uint32_t i = 0; i < n; i++)
+	{
+		const info_t si = subresource_as_info(si1, i);
+
+		shared_lock lock1(b1, i);
+		shared_lock lock2(b2, i);
+
+		const double npixels = double(si.dimensions.x) * si.dimensions.y;
+		sum += calc_ssim(si, lock1.mapped, lock2.mapped) * npixels;
+		num_pixels += npixels;
 	}
 
-	return rms / static_cast<float>(n1);
+	return float(sum / num_pixels);
 }
 
 }}
@@ -1,8 +1,10 @@
 // Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
 
 #include <oCore/finally.h>
+#include <oCore/stringize.h>
 #include <oSurface/codec.h>
 #include <oMemory/allocate.h>
+#include "row_codec.h"
 
 #undef  JPEG_LIB_VERSION
 #define JPEG_LIB_VERSION 80
@@ -154,99 +156,183 @@ info_t get_info_jpg(const void* buffer, size_t buffer_size)
 	return si;
 }
 
-blob encode_jpg(const image& img, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
+class jpg_row_decoder : public detail::row_decoder
 {
-	tl_alloc = &file_alloc;
-	oFinally { tl_alloc = nullptr; };
+public:
+	jpg_row_decoder() : created(false) {}
+	~jpg_row_decoder()
+	{
+		if (created)
+		{
+			tl_alloc = &temp_alloc;
+			jpeg_destroy_decompress(&cinfo);
+			tl_alloc = nullptr;
+		}
+	}
 
-	jpeg_compress_struct cinfo;
-	jpeg_error_mgr jerr;
-	cinfo.err = jpeg_std_error(&jerr);
-	jerr.error_exit = error_exit_throw;
-	jerr.output_message = dont_output_message;
-	cinfo.alloc = &s_jalloc;
+	void initialize(const void* buffer, size_t size, const allocator& temp_alloc)
+	{
+		this->temp_alloc = temp_alloc;
+		tl_alloc = &this->temp_alloc;
+		oFinally { tl_alloc = nullptr; };
 
-	jpeg_create_compress(&cinfo);
+		cinfo.err = jpeg_std_error(&jerr);
+		jerr.error_exit = error_exit_throw;
+		jerr.output_message = dont_output_message;
+		cinfo.alloc = &s_jalloc;
 
-	uint8_t* pCompressed = nullptr;
-	unsigned long CompressedSize = 0;
-	oFinally { jpeg_destroy_compress(&cinfo); if (pCompressed) tl_alloc->deallocate(pCompressed); };
+		jpeg_create_decompress(&cinfo);
+		created = true;
+		jpeg_mem_src(&cinfo, (uint8_t*)buffer, static_cast<unsigned long>(size));
+		jpeg_read_header(&cinfo, TRUE);
 
-	info_t si = img.info();
-	cinfo.image_width = si.dimensions.x;
-	cinfo.image_height = si.dimensions.y;
-	cinfo.in_color_space = to_jcs(si.format, &cinfo.input_components);
-	
-	jpeg_set_defaults(&cinfo);
+		info_.format = from_jcs(cinfo.out_color_space);
+		info_.dimensions = int3(cinfo.image_width, cinfo.image_height, 1);
+
+		jpeg_start_decompress(&cinfo);
+	}
 
-	int quality = 100;
-	switch (compression)
+	void read(const mapped_subresource& dst, uint32_t num_rows) override
 	{
-		case compression::none: quality = 100; break;
-		case compression::low: quality = 95; break;
-		case compression::medium: quality = 75; break;
-		case compression::high: quality = 50; break;
-		default: throw std::exception("invalid compression");
+		tl_alloc = &temp_alloc;
+		oFinally { tl_alloc = nullptr; };
+
+		JSAMPROW row[1];
+		for (uint32_t y = 0; y < num_rows; y++, row_++)
+		{
+			row[0] = (JSAMPLE*)byte_add(dst.data, y * dst.row_pitch);
+			jpeg_read_scanlines(&cinfo, row, 1);
+		}
+
+		if (row_ == info_.dimensions.y)
+			jpeg_finish_decompress(&cinfo);
 	}
 
-	jpeg_set_quality(&cinfo, quality, TRUE);
-	jpeg_mem_dest(&cinfo, &pCompressed, &CompressedSize);
-	jpeg_start_compress(&cinfo, true);
+private:
+	jpeg_decompress_struct cinfo;
+	jpeg_error_mgr jerr;
+	allocator temp_alloc;
+	bool created;
+};
+
+class jpg_row_encoder : public detail::row_encoder
+{
+public:
+	jpg_row_encoder() : compressed(nullptr), compressed_size(0), created(false) {}
+	~jpg_row_encoder()
+	{
+		tl_alloc = &file_alloc;
+		if (created)
+			jpeg_destroy_compress(&cinfo);
+		if (compressed)
+			tl_alloc->deallocate(compressed);
+		tl_alloc = nullptr;
+	}
 
+	void initialize(const info_t& info, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
 	{
+		this->file_alloc = file_alloc;
+		tl_alloc = &this->file_alloc;
+		oFinally { tl_alloc = nullptr; };
+
+		info_ = info;
+
+		cinfo.err = jpeg_std_error(&jerr);
+		jerr.error_exit = error_exit_throw;
+		jerr.output_message = dont_output_message;
+		cinfo.alloc = &s_jalloc;
+
+		jpeg_create_compress(&cinfo);
+		created = true;
+
+		cinfo.image_width = info.dimensions.x;
+		cinfo.image_height = info.dimensions.y;
+		cinfo.in_color_space = to_jcs(info.format, &cinfo.input_components);
+		oCheck(cinfo.in_color_space != JCS_UNKNOWN, std::errc::invalid_argument, "unsupported jpg source format %s", as_string(info.format));
+	
+		jpeg_set_defaults(&cinfo);
+
+		int quality = 100;
+		switch (compression)
+		{
+			case compression::none: quality = 100; break;
+			case compression::low: quality = 95; break;
+			case compression::medium: quality = 75; break;
+			case compression::high: quality = 50; break;
+			default: throw std::exception("invalid compression");
+		}
+
+		jpeg_set_quality(&cinfo, quality, TRUE);
+		jpeg_mem_dest(&cinfo, &compressed, &compressed_size);
+		jpeg_start_compress(&cinfo, true);
+	}
+
+	void write(const const_mapped_subresource& src, uint32_t num_rows) override
+	{
+		tl_alloc = &file_alloc;
+		oFinally { tl_alloc = nullptr; };
+
 		JSAMPROW row[1];
-		shared_lock lock(img);
-		while (cinfo.next_scanline < cinfo.image_height)
+		for (uint32_t y = 0; y < num_rows; y++, row_++)
 		{
-			row[0] = (JSAMPLE*)((uint8_t*)lock.mapped.data + cinfo.next_scanline * lock.mapped.row_pitch);
+			row[0] = (JSAMPLE*)byte_add(src.data, y * src.row_pitch);
 			jpeg_write_scanlines(&cinfo, row, 1);
 		}
 	}
 
-	jpeg_finish_compress(&cinfo);
-	blob alloc(pCompressed, CompressedSize, tl_alloc->deallocator());
-	pCompressed = nullptr; // so the finally doesn't kill it
+	blob finish() override
+	{
+		tl_alloc = &file_alloc;
+		oFinally { tl_alloc = nullptr; };
 
-	return alloc;
-}
+		jpeg_finish_compress(&cinfo);
+		blob encoded(compressed, compressed_size, file_alloc.deallocator());
+		compressed = nullptr;
+		return encoded;
+	}
 
-image decode_jpg(const void* buffer, size_t size, const allocator& texel_alloc, const allocator& temp_alloc, const mip_layout& layout)
+private:
+	jpeg_compress_struct cinfo;
+	jpeg_error_mgr jerr;
+	uint8_t* compressed;
+	unsigned long compressed_size;
+	allocator file_alloc;
+	bool created;
+};
+
+detail::row_decoder* new_row_decoder_jpg(const void* buffer, size_t size, const allocator& temp_alloc)
 {
-	tl_alloc = &temp_alloc;
-	//finally reset_alloc([&] { tl_alloc = nullptr; });
+	return detail::new_row_codec<jpg_row_decoder>(temp_alloc, "jpg row decoder", buffer, size, temp_alloc);
+}
 
-	jpeg_decompress_struct cinfo;
-	jpeg_error_mgr jerr;
-	cinfo.err = jpeg_std_error(&jerr);
-	jerr.error_exit = error_exit_throw;
-	jerr.output_message = dont_output_message;
-	cinfo.alloc = &s_jalloc;
+detail::row_encoder* new_row_encoder_jpg(const info_t& info, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
+{
+	return detail::new_row_codec<jpg_row_encoder>(temp_alloc, "jpg row encoder", info, file_alloc, temp_alloc, compression);
+}
 
-	jpeg_create_decompress(&cinfo);
-	oFinally { jpeg_destroy_decompress(&cinfo); };
-	jpeg_mem_src(&cinfo, (uint8_t*)buffer, static_cast<unsigned long>(size));
-	jpeg_read_header(&cinfo, TRUE);
+blob encode_jpg(const image& img, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
+{
+	info_t info = img.info();
+	jpg_row_encoder e;
+	e.initialize(info, file_alloc, temp_alloc, compression);
+	shared_lock lock(img);
+	e.write(lock.mapped, info.dimensions.y);
+	return e.finish();
+}
 
-	info_t si;
-	si.format = from_jcs(cinfo.out_color_space);
-	si.mip_layout = layout;
-	si.dimensions = int3(cinfo.image_width, cinfo.image_height, 1);
+image decode_jpg(const void* buffer, size_t size, const allocator& texel_alloc, const allocator& temp_alloc, const mip_layout& layout)
+{
+	jpg_row_decoder d;
+	d.initialize(buffer, size, temp_alloc);
 
-	image img(si, texel_alloc);
+	info_t info = d.info();
+	info.mip_layout = layout;
+	image img(info, texel_alloc);
 	{
-		JSAMPROW row[1];
 		lock_guard lock(img);
-		jpeg_start_decompress(&cinfo);
-
-		while (cinfo.output_scanline < cinfo.output_height)
-		{
-			row[0] = (JSAMPLE*)((uint8_t*)lock.mapped.data + cinfo.output_scanline * lock.mapped.row_pitch);
-			jpeg_read_scanlines(&cinfo, row, 1);
-		}
+		d.read(lock.mapped, info.dimensions.y);
 	}
 
-	jpeg_finish_decompress(&cinfo);
-
 	if (layout != mip_layout::none)
 		img.generate_mips();
 
@@ -4,6 +4,7 @@
 #include <oCore/finally.h>
 #include <oSurface/codec.h>
 #include <oMemory/allocate.h>
+#include "row_codec.h"
 #include <libpng/png.h>
 #include <zlib/zlib.h>
 #include <vector>
@@ -128,155 +129,250 @@ info_t get_info_png(const void* buffer, size_t size)
 	return info;
 }
 
-blob encode_png(const image& img, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
+class png_row_decoder : public detail::row_decoder
 {
-	tl_alloc = &file_alloc;
-	oFinally { tl_alloc = nullptr; };
+public:
+	png_row_decoder() : png_ptr(nullptr), info_ptr(nullptr), num_passes(1) {}
+	~png_row_decoder() { if (png_ptr) png_destroy_read_struct(&png_ptr, &info_ptr, nullptr); }
 
-	info_t info = img.info();
+	// interlaced images can only be read all at once with read_image()
+	void initialize(const void* buffer, size_t size, const allocator& temp_alloc, bool allow_interlaced = false)
+	{
+		// initialze libpng with user functions pointing to buffer
+		png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+		if (!png_ptr)
+			throw std::exception("png read failed");
+		info_ptr = png_create_info_struct(png_ptr);
+		if (!info_ptr)
+			throw std::exception("png read failed");
+
+		#pragma warning(disable:4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+		if (setjmp(png_jmpbuf(png_ptr)))
+			throw std::exception("png read failed");
+		#pragma warning(default:4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+
+		rs.data = buffer;
+		rs.offset = 0;
+		png_set_read_fn(png_ptr, &rs, user_read_data);
+		png_read_info(png_ptr, info_ptr);
+
+		// Read initial information and configure the decoder accordingly
+		unsigned int w = 0, h = 0;
+		int depth = 0, color_type = 0;
+		png_get_IHDR(png_ptr, info_ptr, &w, &h, &depth, &color_type, nullptr, nullptr, nullptr);
+	
+		if (depth == 16)
+			png_set_strip_16(png_ptr);
 
-	// initialize libpng with user functions pointing to _pBuffer
-	png_infop info_ptr = nullptr;
-	png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-	if (!png_ptr)
-		throw std::exception("png read failed");
-	oFinally { png_destroy_write_struct(&png_ptr, &info_ptr); };
-	info_ptr = png_create_info_struct(png_ptr);
-	if (!info_ptr)
-		throw std::exception("png read failed");
+		png_set_bgr(png_ptr);
 
-	#pragma warning(disable:4611) // interaction between '_setjmp' and C++ object destruction is non-portable
-	if (setjmp(png_jmpbuf(png_ptr)))
-		throw std::exception("png read failed");
-	#pragma warning(default:4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+		info_.dimensions = int3(w, h, 1);
+		switch (color_type)
+		{
+			case PNG_COLOR_TYPE_GRAY:
+				info_.format = format::r8_unorm;
+				if (depth < 8)
+					png_set_expand_gray_1_2_4_to_8(png_ptr);
+				break;
+			case PNG_COLOR_TYPE_PALETTE:
+				info_.format = format::b8g8r8_unorm;
+				png_set_palette_to_rgb(png_ptr);
+				break;
+			case PNG_COLOR_TYPE_RGB:
+				info_.format = format::b8g8r8_unorm;
+				break;
+			case PNG_COLOR_TYPE_RGB_ALPHA:
+				info_.format = format::b8g8r8a8_unorm;
+				break;
+			default:
+			case PNG_COLOR_TYPE_GRAY_ALPHA:
+				throw std::exception("unsupported gray/alpha");
+		}
 
-	write_state ws;
-	ws.capacity = info.dimensions.y * info.dimensions.x * element_size(info.format);
-	ws.capacity += (ws.capacity / 2);
-	ws.data = tl_alloc->allocate(ws.capacity, "libpng"); // use uncompressed size as an estimate to reduce reallocs
-	ws.size = 0;
-	png_set_write_fn(png_ptr, &ws, user_write_data, user_flush_data);
-
-	int zcomp = Z_NO_COMPRESSION;
-	switch (compression)
-	{
-		case compression::none: zcomp = Z_NO_COMPRESSION; break;
-		case compression::low: zcomp = Z_BEST_SPEED; break;
-		case compression::medium: zcomp = Z_DEFAULT_COMPRESSION; break;
-		case compression::high: zcomp = Z_BEST_COMPRESSION; break;
-		default: throw std::exception("invalid compression");
+		num_passes = png_set_interlace_handling(png_ptr);
+		oCheck(allow_interlaced || num_passes == 1, std::errc::not_supported, "interlaced png can't be decoded by rows");
+
+		png_read_update_info(png_ptr, info_ptr);
 	}
-	png_set_compression_level(png_ptr, zcomp);
 
-	int color_type = 0;
-	switch (info.format)
+	void read(const mapped_subresource& dst, uint32_t num_rows) override
 	{
-		case format::r8_unorm: color_type = PNG_COLOR_TYPE_GRAY; break;
-		case format::b8g8r8_unorm: 
-		case format::r8g8b8_unorm: color_type = PNG_COLOR_TYPE_RGB; break;
-		case format::b8g8r8a8_unorm: 
-		case format::r8g8b8a8_unorm: color_type = PNG_COLOR_TYPE_RGB_ALPHA; break;
-		default: throw std::exception("invalid format");
-	}
+		oCheck(num_passes == 1, std::errc::not_supported, "interlaced png can't be decoded by rows");
 
-	// how big a buffer?
-	png_set_IHDR(png_ptr, info_ptr, info.dimensions.x, info.dimensions.y, 8
-		, color_type, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+		#pragma warning(disable:4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+		if (setjmp(png_jmpbuf(png_ptr)))
+			throw std::exception("png read failed");
+		#pragma warning(default:4611) // interaction between '_setjmp' and C++ object destruction is non-portable
 
-	png_write_info(png_ptr, info_ptr);
-	
-	if (info.format == format::b8g8r8_unorm || info.format == format::b8g8r8a8_unorm)
-		png_set_bgr(png_ptr);
+		for (uint32_t y = 0; y < num_rows; y++, row_++)
+			png_read_row(png_ptr, (png_bytep)byte_add(dst.data, y * dst.row_pitch), nullptr);
+	}
 
+	void read_image(const mapped_subresource& dst)
 	{
+		#pragma warning(disable:4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+		if (setjmp(png_jmpbuf(png_ptr)))
+			throw std::exception("png read failed");
+		#pragma warning(default:4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+
 		std::vector<uint8_t*> rows;
-		rows.resize(info.dimensions.y);
-		const_mapped_subresource msr;
-		shared_lock lock(img);
-		rows[0] = (uint8_t*)lock.mapped.data;
-		for (uint32_t y = 1; y < info.dimensions.y; y++)
-			rows[y] = (uint8_t*)rows[y-1] + lock.mapped.row_pitch;
-		png_write_image(png_ptr, rows.data());
-		png_write_end(png_ptr, info_ptr);
+		rows.resize(info_.dimensions.y);
+		rows[0] = (uint8_t*)dst.data;
+		for (uint32_t y = 1; y < info_.dimensions.y; y++)
+			rows[y] = (uint8_t*)rows[y-1] + dst.row_pitch;
+
+		png_read_image(png_ptr, rows.data());
+		row_ = info_.dimensions.y;
 	}
 
-	return blob(ws.data, ws.size, tl_alloc->deallocator());
-}
+private:
+	png_structp png_ptr;
+	png_infop info_ptr;
+	read_state rs;
+	int num_passes;
+};
 
-image decode_png(const void* buffer, size_t size, const allocator& texel_alloc, const allocator& temp_alloc, const mip_layout& layout)
+class png_row_encoder : public detail::row_encoder
 {
-	tl_alloc = &temp_alloc;
-	oFinally { tl_alloc = nullptr; };
+public:
+	png_row_encoder() : png_ptr(nullptr), info_ptr(nullptr) { ws.data = nullptr; ws.size = ws.capacity = 0; }
+	~png_row_encoder()
+	{
+		if (png_ptr)
+			png_destroy_write_struct(&png_ptr, &info_ptr);
+		if (ws.data)
+			file_alloc.deallocate(ws.data);
+	}
 
-	// initialze libpng with user functions pointing to _pBuffer
-	png_infop info_ptr = nullptr;
-	png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-	if (!png_ptr)
-		throw std::exception("png read failed");
-	oFinally { png_destroy_read_struct(&png_ptr, &info_ptr, nullptr); };
-	info_ptr = png_create_info_struct(png_ptr);
-	if (!info_ptr)
-		throw std::exception("png read failed");
+	void initialize(const info_t& info, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
+	{
+		this->file_alloc = file_alloc;
+		tl_alloc = &this->file_alloc;
+		oFinally { tl_alloc = nullptr; };
+
+		info_ = info;
+
+		// initialize libpng with user functions pointing to _pBuffer
+		png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+		if (!png_ptr)
+			throw std::exception("png read failed");
+		info_ptr = png_create_info_struct(png_ptr);
+		if (!info_ptr)
+			throw std::exception("png read failed");
+
+		#pragma warning(disable:4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+		if (setjmp(png_jmpbuf(png_ptr)))
+			throw std::exception("png read failed");
+		#pragma warning(default:4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+
+		// start small: the encoded size isn't known until rows are compressed and 
+		// user_write_data grows the buffer geometrically as libpng fills it
+		static const size_t initial_capacity = 64 * 1024;
+		ws.capacity = min(size_t(info.dimensions.y) * info.dimensions.x * element_size(info.format), initial_capacity);
+		ws.data = tl_alloc->allocate(ws.capacity, "libpng");
+		ws.size = 0;
+		png_set_write_fn(png_ptr, &ws, user_write_data, user_flush_data);
+
+		int zcomp = Z_NO_COMPRESSION;
+		switch (compression)
+		{
+			case compression::none: zcomp = Z_NO_COMPRESSION; break;
+			case compression::low: zcomp = Z_BEST_SPEED; break;
+			case compression::medium: zcomp = Z_DEFAULT_COMPRESSION; break;
+			case compression::high: zcomp = Z_BEST_COMPRESSION; break;
+			default: throw std::exception("invalid compression");
+		}
+		png_set_compression_level(png_ptr, zcomp);
 
-	#pragma warning(disable:4611) // interaction between '_setjmp' and C++ object destruction is non-portable
-	if (setjmp(png_jmpbuf(png_ptr)))
-		throw std::exception("png read failed");
-	#pragma warning(default:4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+		int color_type = 0;
+		switch (info.format)
+		{
+			case format::r8_unorm: color_type = PNG_COLOR_TYPE_GRAY; break;
+			case format::b8g8r8_unorm: 
+			case format::r8g8b8_unorm: color_type = PNG_COLOR_TYPE_RGB; break;
+			case format::b8g8r8a8_unorm: 
+			case format::r8g8b8a8_unorm: color_type = PNG_COLOR_TYPE_RGB_ALPHA; break;
+			default: throw std::exception("invalid format");
+		}
 
-	read_state rs;
-	rs.data = buffer;
-	rs.offset = 0;
-	png_set_read_fn(png_ptr, &rs, user_read_data);
-	png_read_info(png_ptr, info_ptr);
+		// how big a buffer?
+		png_set_IHDR(png_ptr, info_ptr, info.dimensions.x, info.dimensions.y, 8
+			, color_type, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 
-	// Read initial information and configure the decoder accordingly
-	unsigned int w = 0, h = 0;
-	int depth = 0, color_type = 0;
-	png_get_IHDR(png_ptr, info_ptr, &w, &h, &depth, &color_type, nullptr, nullptr, nullptr);
+		png_write_info(png_ptr, info_ptr);
 	
-	if (depth == 16)
-		png_set_strip_16(png_ptr);
+		if (info.format == format::b8g8r8_unorm || info.format == format::b8g8r8a8_unorm)
+			png_set_bgr(png_ptr);
+	}
 
-	png_set_bgr(png_ptr);
+	void write(const const_mapped_subresource& src, uint32_t num_rows) override
+	{
+		tl_alloc = &file_alloc;
+		oFinally { tl_alloc = nullptr; };
 
-	info_t info;
-	info.mip_layout = layout;
-	info.dimensions = int3(w, h, 1);
-	switch (color_type)
+		#pragma warning(disable:4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+		if (setjmp(png_jmpbuf(png_ptr)))
+			throw std::exception("png write failed");
+		#pragma warning(default:4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+
+		for (uint32_t y = 0; y < num_rows; y++, row_++)
+			png_write_row(png_ptr, (png_bytep)byte_add(src.data, y * src.row_pitch));
+	}
+
+	blob finish() override
 	{
-		case PNG_COLOR_TYPE_GRAY:
-			info.format = format::r8_unorm;
-			if (depth < 8)
-				png_set_expand_gray_1_2_4_to_8(png_ptr);
-			break;
-		case PNG_COLOR_TYPE_PALETTE:
-			info.format = format::b8g8r8_unorm;
-			png_set_palette_to_rgb(png_ptr);
-			break;
-		case PNG_COLOR_TYPE_RGB:
-			info.format = format::b8g8r8_unorm;
-			break;
-		case PNG_COLOR_TYPE_RGB_ALPHA:
-			info.format = format::b8g8r8a8_unorm;
-			break;
-		default:
-		case PNG_COLOR_TYPE_GRAY_ALPHA:
-			throw std::exception("unsupported gray/alpha");
+		tl_alloc = &file_alloc;
+		oFinally { tl_alloc = nullptr; };
+
+		#pragma warning(disable:4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+		if (setjmp(png_jmpbuf(png_ptr)))
+			throw std::exception("png write failed");
+		#pragma warning(default:4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+
+		png_write_end(png_ptr, info_ptr);
+		blob encoded(ws.data, ws.size, file_alloc.deallocator());
+		ws.data = nullptr;
+		return encoded;
 	}
 
-	// Set up the surface buffer
-	png_read_update_info(png_ptr, info_ptr);
+private:
+	png_structp png_ptr;
+	png_infop info_ptr;
+	write_state ws;
+	allocator file_alloc;
+};
+
+detail::row_decoder* new_row_decoder_png(const void* buffer, size_t size, const allocator& temp_alloc)
+{
+	return detail::new_row_codec<png_row_decoder>(temp_alloc, "png row decoder", buffer, size, temp_alloc, false);
+}
+
+detail::row_encoder* new_row_encoder_png(const info_t& info, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
+{
+	return detail::new_row_codec<png_row_encoder>(temp_alloc, "png row encoder", info, file_alloc, temp_alloc, compression);
+}
+
+blob encode_png(const image& img, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
+{
+	info_t info = img.info();
+	png_row_encoder e;
+	e.initialize(info, file_alloc, temp_alloc, compression);
+	shared_lock lock(img);
+	e.write(lock.mapped, info.dimensions.y);
+	return e.finish();
+}
+
+image decode_png(const void* buffer, size_t size, const allocator& texel_alloc, const allocator& temp_alloc, const mip_layout& layout)
+{
+	png_row_decoder d;
+	d.initialize(buffer, size, temp_alloc, true);
+
+	info_t info = d.info();
+	info.mip_layout = layout;
 	image img(info, texel_alloc);
 	{
-		std::vector<uint8_t*> rows;
-		rows.resize(info.dimensions.y);
 		lock_guard lock(img);
-
-		rows[0] = (uint8_t*)lock.mapped.data;
-		for (uint32_t y = 1; y < info.dimensions.y; y++)
-			rows[y] = (uint8_t*)rows[y-1] + lock.mapped.row_pitch;
-
-		png_read_image(png_ptr, rows.data());
+		d.read_image(lock.mapped);
 	}
 
 	if (layout != mip_layout::none)
@@ -1,14 +1,87 @@
 // Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
 
+// oimg layout:
+// file_header
+// 'info' chunk: info_t
+// 'subr' chunk: an oimg_range for each subresource
+// 'pad ' chunk: zeros so the bits chunk's data starts 64-byte aligned
+// 'bits' chunk: texels
+//
+// Each range is compressed on its own so they can be decompressed in parallel
+// directly into place. A range that doesn't get smaller is stored as-is.
+// Uncompressed files store the texels exactly as an image lays them out so a
+// mapped file can be used in place. Files written before the range table
+// existed have only 'info' and an unaligned, uncompressed 'bits' chunk.
+
+#include <oBase/compression.h>
 #include <oBase/file_format.h>
+#include <oConcurrency/concurrency.h>
+#include <oCore/byte.h>
+#include <oCore/finally.h>
 #include <oCore/fourcc.h>
 #include <oSurface/codec.h>
+#include <vector>
 
 namespace ouro { namespace surface {
 
 static const fourcc_t oimg_signature = oFOURCC('o','i','m','g');
 static const fourcc_t oimg_info_signature = oFOURCC('i','n','f','o');
+static const fourcc_t oimg_ranges_signature = oFOURCC('s','u','b','r');
+static const fourcc_t oimg_pad_signature = oFOURCC('p','a','d',' ');
 static const fourcc_t oimg_bits_signature = oFOURCC('b','i','t','s');
+static const uint32_t oimg_alignment = 64;
+
+struct oimg_range
+{
+	uint32_t offset; // from the start of the bits chunk's data
+	uint32_t bytes;  // as stored
+	uint32_t uncompressed_offset; // into the image's bits
+	uint32_t uncompressed_bytes;
+
+	bool compressed() const { return bytes != uncompressed_bytes; }
+};
+static_assert(sizeof(oimg_range) == 16, "size mismatch");
+
+static ouro::compression as_algorithm(const compression& c)
+{
+	switch (c)
+	{
+		case compression::none: return ouro::compression::none;
+		case compression::low: return ouro::compression::lz4;
+		case compression::medium: return ouro::compression::gzip;
+		case compression::high: return ouro::compression::lzma;
+		default: break;
+	}
+	oThrow(std::errc::invalid_argument, "invalid compression");
+}
+
+// returns the byte ranges of an image's bits, one per subresource if they tile
+// the bits in order or else one range for everything
+static std::vector<oimg_range> ranges(const info_t& info)
+{
+	const uint32_t bytes = total_size(info);
+	const uint32_t nsubresources = num_subresources(info);
+
+	std::vector<oimg_range> r(nsubresources);
+	uint32_t next = 0;
+	for (uint32_t i = 0; i < nsubresources; i++)
+	{
+		r[i].uncompressed_offset = subresource_offset(info, i);
+		r[i].uncompressed_bytes = subresource_size(info, i);
+		if (r[i].uncompressed_offset != next)
+			break;
+		next += r[i].uncompressed_bytes;
+	}
+
+	if (next != bytes)
+	{
+		r.resize(1);
+		r[0].uncompressed_offset = 0;
+		r[0].uncompressed_bytes = bytes;
+	}
+
+	return r;
+}
 
 bool is_oimg(const void* buffer, size_t size)
 {
@@ -40,18 +113,102 @@ info_t get_info_oimg(const void* buffer, size_t size)
 	return info_t();
 }
 
+bool get_oimg_bits(const void* buffer, size_t size, info_t* out_info, uint64_t* out_offset, uint64_t* out_size)
+{
+	if (!is_oimg(buffer, size))
+		return false;
+
+	auto hdr = (const file_header*)buffer;
+	if (hdr->compression != compression_type::none)
+		return false;
+
+	const info_t info = get_info_oimg(buffer, size);
+	if (info.format == format::unknown)
+		return false;
+
+	// every chunk header has to be in buffer, but not the bits themselves
+	const uint8_t* end = (const uint8_t*)buffer + size;
+	const file_chunk* bits = nullptr;
+	bool has_ranges = false;
+	auto chk = hdr->first_chunk();
+	for (uint32_t i = 0; i < hdr->num_chunks && !bits; i++, chk = chk->next())
+	{
+		if ((const uint8_t*)(chk + 1) > end)
+			return false;
+		if (chk->fourcc == oimg_ranges_signature)
+			has_ranges = true;
+		else if (chk->fourcc == oimg_bits_signature)
+			bits = chk;
+	}
+
+	if (!has_ranges || !bits)
+		return false;
+
+	const uint64_t offset = bits->data<uint8_t>() - (const uint8_t*)buffer;
+	if (offset & (oimg_alignment - 1))
+		return false;
+
+	*out_info = info;
+	*out_offset = offset;
+	*out_size = total_size(info);
+	return true;
+}
+
 blob encode_oimg(const image& img, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
 {
 	const auto& info = img.info();
-	const auto bit_bytes = surface::total_size(info);
-	const auto bytes = sizeof(file_header) + sizeof(file_chunk) + sizeof(info_t) + sizeof(file_chunk) + bit_bytes;
+	const auto algorithm = as_algorithm(compression);
+	auto table = ranges(info);
+	const uint32_t nranges = uint32_t(table.size());
+	const uint32_t table_bytes = nranges * sizeof(oimg_range);
+
+	const_mapped_subresource mapped;
+	img.map_const(0, &mapped);
+	oFinally { img.unmap_const(0); };
+	const uint8_t* src = (const uint8_t*)mapped.data;
+
+	// compress each range into its own scratch buffer
+	std::vector<blob> compressed(nranges);
+	if (algorithm != ouro::compression::none)
+	{
+		parallel_for(0, nranges, [&](size_t i)
+		{
+			auto& r = table[i];
+			const uint8_t* range_src = src + r.uncompressed_offset;
+			const size_t estimate = ouro::compress(algorithm, nullptr, 0, range_src, r.uncompressed_bytes);
+			blob scratch = temp_alloc.scoped_allocate(estimate, "oimg range");
+			const size_t bytes = ouro::compress(algorithm, scratch, estimate, range_src, r.uncompressed_bytes);
+			if (bytes < r.uncompressed_bytes)
+			{
+				r.bytes = uint32_t(bytes);
+				compressed[i] = std::move(scratch);
+			}
+		});
+	}
+
+	// uncompressed bits are the image's own layout, otherwise ranges are packed
+	uint32_t bit_bytes = 0;
+	for (uint32_t i = 0; i < nranges; i++)
+	{
+		auto& r = table[i];
+		if (!compressed[i])
+			r.bytes = r.uncompressed_bytes;
+		r.offset = algorithm == ouro::compression::none ? r.uncompressed_offset : align(bit_bytes, oimg_alignment);
+		bit_bytes = max(bit_bytes, r.offset + r.bytes);
+	}
+
+	const uint32_t pad_offset = uint32_t(sizeof(file_header) + sizeof(file_chunk) + sizeof(info_t) + sizeof(file_chunk) + table_bytes);
+	const uint32_t bits_offset = align(pad_offset + 2 * uint32_t(sizeof(file_chunk)), oimg_alignment);
+	const uint32_t pad_bytes = bits_offset - pad_offset - 2 * uint32_t(sizeof(file_chunk));
+	const size_t bytes = bits_offset + bit_bytes;
 
 	auto mem = file_alloc.allocate(bytes, "encoded image");
+	memset(mem, 0, bits_offset);
 	auto hdr = (file_header*)mem;
 
 	hdr->fourcc = oimg_signature;
-	hdr->num_chunks = 2;
-	hdr->compression = compression_type::none; // not yet implemented, though here's where it gets done
+	hdr->num_chunks = 4;
+	hdr->compression = (compression_type)algorithm;
 	hdr->reserved = 0;
 	hdr->version_hash = 0; // not yet implemented
 
@@ -61,38 +218,96 @@ blob encode_oimg(const image& img, const allocator& file_alloc, const allocator&
 	chk->uncompressed_bytes = chk->chunk_bytes;
 	memcpy(chk->data<info_t>(), &info, sizeof(info_t));
 
+	chk = chk->next();
+	chk->fourcc = oimg_ranges_signature;
+	chk->chunk_bytes = table_bytes;
+	chk->uncompressed_bytes = chk->chunk_bytes;
+	memcpy(chk->data<oimg_range>(), table.data(), table_bytes);
+
+	chk = chk->next();
+	chk->fourcc = oimg_pad_signature;
+	chk->chunk_bytes = pad_bytes;
+	chk->uncompressed_bytes = chk->chunk_bytes;
+
 	chk = chk->next();
 	chk->fourcc = oimg_bits_signature;
 	chk->chunk_bytes = bit_bytes;
-	chk->uncompressed_bytes = chk->chunk_bytes;
-	
-	const_mapped_subresource mapped;
-	img.map_const(0, &mapped);
-	memcpy(chk->data<void>(), mapped.data, bit_bytes); // note: there may need to be a method of zeroing padding bits 
-	img.unmap_const(0);
+	chk->uncompressed_bytes = total_size(info);
+
+	uint8_t* dst = chk->data<uint8_t>();
+	if (algorithm == ouro::compression::none)
+		memcpy(dst, src, bit_bytes); // note: there may need to be a method of zeroing padding bits
+	else
+	{
+		uint32_t end = 0;
+		for (uint32_t i = 0; i < nranges; i++)
+		{
+			const auto& r = table[i];
+			memset(dst + end, 0, r.offset - end);
+			memcpy(dst + r.offset, compressed[i] ? (const uint8_t*)compressed[i] : src + r.uncompressed_offset, r.bytes);
+			end = r.offset + r.bytes;
+		}
+	}
 
 	return blob(mem, bytes, (blob::deleter_fn)file_alloc.deallocator());
 }
 
+// fills dst with the texels in the bits chunk, which must be in range of buffer
+static void read_bits(uint8_t* oRESTRICT dst, uint32_t bytes, const void* buffer, size_t size, const file_chunk* bits)
+{
+	const uint8_t* oRESTRICT src = bits->data<uint8_t>();
+
+	auto hdr = (const file_header*)buffer;
+	auto table_chunk = hdr->find_chunk(oimg_ranges_signature);
+	if (!table_chunk)
+	{
+		oCheck(bytes <= bits->chunk_bytes, std::errc::invalid_argument, "invalid oimg: bits section is smaller than the image");
+		memcpy(dst, src, bytes);
+		return;
+	}
+
+	oCheck(table_chunk->in_range(buffer, size), std::errc::invalid_argument, "invalid oimg: range table out of bounds");
+
+	const auto algorithm = (ouro::compression)hdr->compression;
+	const oimg_range* table = table_chunk->data<oimg_range>();
+	const uint32_t nranges = table_chunk->chunk_bytes / sizeof(oimg_range);
+
+	for (uint32_t i = 0; i < nranges; i++)
+	{
+		const auto& r = table[i];
+		// compared as differences so the sums can't wrap
+		oCheck(r.offset <= bits->chunk_bytes && r.bytes <= bits->chunk_bytes - r.offset
+			&& r.uncompressed_offset <= bytes && r.uncompressed_bytes <= bytes - r.uncompressed_offset
+			, std::errc::invalid_argument, "invalid oimg: range %u out of bounds", i);
+	}
+
+	parallel_for(0, nranges, [&](size_t i)
+	{
+		const auto& r = table[i];
+		if (r.compressed())
+			ouro::decompress(algorithm, dst + r.uncompressed_offset, r.uncompressed_bytes, src + r.offset, r.bytes);
+		else
+			memcpy(dst + r.uncompressed_offset, src + r.offset, r.bytes);
+	});
+}
+
 image decode_oimg(const void* buffer, size_t size, const allocator& texel_alloc, const allocator& temp_alloc, const mip_layout& layout)
 {
 	info_t info = get_info_oimg(buffer, size);
-	
+
 	if (info.format == format::unknown)
 		oThrow(std::errc::invalid_argument, "invalid oimg buffer");
 
-	image img(info, texel_alloc);
-
 	auto hdr = (const file_header*)buffer;
 	auto chk = hdr->find_chunk(oimg_bits_signature);
-	if (!chk)
+	if (!chk || !chk->in_range(buffer, size))
 		oThrow(std::errc::invalid_argument, "invalid oimg: no bits section");
 
-	auto bytes = total_size(info);
-	mapped_subresource mapped;
-	img.map(0, &mapped);
-	memcpy(mapped.data, chk->data<void>(), bytes);
-	img.unmap(0);
+	image img(info, texel_alloc);
+	{
+		lock_guard lock(img);
+		read_bits((uint8_t*)lock.mapped.data, total_size(info), buffer, size, chk);
+	}
 
 	return img;
 }
@@ -2,8 +2,10 @@
 
 #include <oSurface/resize.h>
 #include <oBase/fixed_vector.h>
+#include <oConcurrency/concurrency.h>
 #include <oMemory/memory.h>
 #include <vector>
+#include <emmintrin.h>
 #include <float.h>
 
 #define oSURF_CHECK(expr, format, ...) do { if (!(expr)) oThrow(std::errc::invalid_argument, format, ## __VA_ARGS__); } while(false)
@@ -25,6 +27,25 @@ template<> const char* as_string(const surface::filter& f)
 
 	namespace surface {
 
+// Filtering runs in 16-bit fixed point: weights have fixed_bits fractional bits
+// so a tap is an 8-bit unorm times a 16-bit weight, two taps fit in one 
+// pmaddwd and sums of up to support taps stay well within 32 bits.
+static const int fixed_bits = 14;
+static const int fixed_one = 1 << fixed_bits;
+static const int fixed_round = 1 << (fixed_bits - 1);
+
+static inline uint8_t fixed_to_unorm8(int32_t v)
+{
+	v >>= fixed_bits;
+	return static_cast<uint8_t>(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+// two weights packed for _mm_madd_epi16 against interleaved taps
+static inline int32_t pack_weights(int16_t w0, int16_t w1)
+{
+	return static_cast<int32_t>(uint32_t(uint16_t(w0)) | (uint32_t(uint16_t(w1)) << 16));
+}
+
 template<typename T> T sinc(T x)
 {
 	if (abs(x) > FLT_EPSILON)
@@ -99,6 +120,13 @@ protected:
 	}
 };
 
+// the source pixel whose center is closest to destination pixel i
+static int closest_source(int i, int srcDim, int dstDim)
+{
+	float dstCenter = i / (float)dstDim + 0.5f/dstDim;
+	return static_cast<int>(round((dstCenter - 0.5f/srcDim) * srcDim));
+}
+
 template<typename T>
 struct filter_t : public T
 {
@@ -106,6 +134,7 @@ struct filter_t : public T
 	struct entry_t
 	{
 		fixed_vector<float, support> cache;
+		fixed_vector<int16_t, support> weights; // cache in fixed point
 		int left, right;
 	};
 	std::vector<entry_t> FilterCache;
@@ -126,7 +155,7 @@ struct filter_t : public T
 		for (int i = 0; i < dstDim; i++)
 		{
 			float dstCenter = i / (float)dstDim + halfPixel;
-			int closestSource = static_cast<int>(round((dstCenter - srcHalfPixel) * srcDim));
+			int closestSource = closest_source(i, srcDim, dstDim);
 			
 			auto& entry = FilterCache[i];
 			entry.left = std::max(closestSource - kernel_width, 0);
@@ -165,179 +194,402 @@ struct filter_t : public T
 			{
 				entry.cache[j - entry.left] /= totalWeight;
 			}
+
+			// rounding can leave the fixed-point weights not summing to one, so put 
+			// the difference on the largest weight so flat areas stay flat.
+			int fixedTotal = 0;
+			size_t largest = 0;
+			for (size_t j = 0; j < entry.cache.size(); j++)
+			{
+				const int16_t w = static_cast<int16_t>(round(entry.cache[j] * fixed_one));
+				entry.weights.push_back(w);
+				fixedTotal += w;
+				if (abs(w) > abs(entry.weights[largest]))
+					largest = j;
+			}
+			if (!entry.weights.empty())
+				entry.weights[largest] += static_cast<int16_t>(fixed_one - fixedTotal);
 		}
 	}
 };
 
-template<typename FILTER, size_t ELEMENT_SIZE>
-void resize_horizontal(const info_t& src_info, const const_mapped_subresource& src, const info_t& dst_info, const mapped_subresource& dst)
+// Filters one destination pixel from num_taps adjacent source pixels. This is 
+// the fallback for element sizes that don't fit SSE registers evenly.
+template<int ELEMENT_SIZE>
+struct horizontal_kernel
 {
-	if (src_info.dimensions.y != dst_info.dimensions.y)
-		oThrow(std::errc::invalid_argument, "Horizontal resize assumes y dimensions are the same for source and destination");
+	static void filter(const uint8_t* oRESTRICT src, const int16_t* oRESTRICT weights, int num_taps, uint8_t* oRESTRICT dst)
+	{
+		int32_t acc[ELEMENT_SIZE];
+		for (int i = 0; i < ELEMENT_SIZE; i++)
+			acc[i] = fixed_round;
 
-	FILTER filter;
-	filter.initialize_filter(src_info.dimensions.x, dst_info.dimensions.x);
+		for (int t = 0; t < num_taps; t++, src += ELEMENT_SIZE)
+			for (int i = 0; i < ELEMENT_SIZE; i++)
+				acc[i] += src[i] * weights[t];
 
-	const char* srcData = (char*)src.data;
-	char* dstData = (char*)dst.data;
+		for (int i = 0; i < ELEMENT_SIZE; i++)
+			dst[i] = fixed_to_unorm8(acc[i]);
+	}
+};
 
-	for (uint32_t y = 0; y < dst_info.dimensions.y; y++)
+// 4-channel pixels: two taps are interleaved channel-by-channel so one pmaddwd 
+// applies both weights to all four channels.
+template<>
+struct horizontal_kernel<4>
+{
+	static void filter(const uint8_t* oRESTRICT src, const int16_t* oRESTRICT weights, int num_taps, uint8_t* oRESTRICT dst)
 	{
-		const uint8_t* oRESTRICT srcRow = (uint8_t*)byte_add(srcData, y*src.row_pitch);
-		uint8_t* oRESTRICT dstRow = (uint8_t*)byte_add(dstData, y*dst.row_pitch);
+		const __m128i zero = _mm_setzero_si128();
+		__m128i acc = _mm_set1_epi32(fixed_round);
 
-		for (uint32_t x = 0; x < dst_info.dimensions.x; x++)
+		int t = 0;
+		for (; t + 1 < num_taps; t += 2, src += 8)
 		{
-			auto& filterEntry = filter.FilterCache[x];
-			std::array<float, ELEMENT_SIZE> result;
-			result.fill(0.0f);
+			__m128i px = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)src), zero); // r0 g0 b0 a0 r1 g1 b1 a1
+			px = _mm_unpacklo_epi16(px, _mm_srli_si128(px, 8));                          // r0 r1 g0 g1 b0 b1 a0 a1
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(px, _mm_set1_epi32(pack_weights(weights[t], weights[t+1]))));
+		}
 
-			for (int srcX = filterEntry.left; srcX <= filterEntry.right; srcX++)
-			{
-				for (size_t i = 0; i < ELEMENT_SIZE; i++)
-				{
-					float val = srcRow[srcX*ELEMENT_SIZE + i];
-					val *= filterEntry.cache[srcX - filterEntry.left];
-					result[i] += val;
-				}
-			}
-			
-			for (size_t i = 0; i < ELEMENT_SIZE; i++)
-				dstRow[x*ELEMENT_SIZE + i] = static_cast<uint8_t>(clamp(result[i], 0.0f, 255.0f));
+		if (t < num_taps)
+		{
+			int32_t p;
+			memcpy(&p, src, sizeof(p));
+			__m128i px = _mm_unpacklo_epi8(_mm_cvtsi32_si128(p), zero);
+			px = _mm_unpacklo_epi16(px, zero);
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(px, _mm_set1_epi32(pack_weights(weights[t], 0))));
+		}
+
+		acc = _mm_srai_epi32(acc, fixed_bits);
+		acc = _mm_packs_epi32(acc, acc);
+		acc = _mm_packus_epi16(acc, acc);
+		const int32_t out = _mm_cvtsi128_si32(acc);
+		memcpy(dst, &out, sizeof(out));
+	}
+};
+
+// Filters one destination row from num_taps source rows. The format doesn't 
+// matter since each byte is filtered independently, so 16 bytes are done at a
+// time with taps paired up for pmaddwd. Every source row is read front to back
+// rather than walking down a column one row_pitch per tap.
+static void vertical_kernel(const uint8_t* const* oRESTRICT rows, const int16_t* oRESTRICT weights, int num_taps, uint8_t* oRESTRICT dst, size_t row_bytes)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(fixed_round);
+
+	size_t x = 0;
+	for (; x + 16 <= row_bytes; x += 16)
+	{
+		__m128i acc0 = round, acc1 = round, acc2 = round, acc3 = round;
+		for (int t = 0; t < num_taps; t += 2)
+		{
+			const bool pair = t + 1 < num_taps;
+			const __m128i a = _mm_loadu_si128((const __m128i*)(rows[t] + x));
+			const __m128i b = pair ? _mm_loadu_si128((const __m128i*)(rows[t+1] + x)) : zero;
+			const __m128i w = _mm_set1_epi32(pack_weights(weights[t], pair ? weights[t+1] : 0));
+
+			const __m128i lo = _mm_unpacklo_epi8(a, zero), lob = _mm_unpacklo_epi8(b, zero);
+			const __m128i hi = _mm_unpackhi_epi8(a, zero), hib = _mm_unpackhi_epi8(b, zero);
+			acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi16(lo, lob), w));
+			acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi16(lo, lob), w));
+			acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi16(hi, hib), w));
+			acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi16(hi, hib), w));
 		}
+
+		acc0 = _mm_srai_epi32(acc0, fixed_bits);
+		acc1 = _mm_srai_epi32(acc1, fixed_bits);
+		acc2 = _mm_srai_epi32(acc2, fixed_bits);
+		acc3 = _mm_srai_epi32(acc3, fixed_bits);
+		const __m128i out = _mm_packus_epi16(_mm_packs_epi32(acc0, acc1), _mm_packs_epi32(acc2, acc3));
+		_mm_storeu_si128((__m128i*)(dst + x), out);
+	}
+
+	for (; x < row_bytes; x++)
+	{
+		int32_t acc = fixed_round;
+		for (int t = 0; t < num_taps; t++)
+			acc += rows[t][x] * weights[t];
+		dst[x] = fixed_to_unorm8(acc);
 	}
 }
 
-template<typename FILTER, int ELEMENT_SIZE>
-void resize_vertical(const info_t& src_info, const const_mapped_subresource& src, const info_t& dst_info, const mapped_subresource& dst)
+// Kernels by channel type. Rows are passed as bytes and row_bytes is the 
+// number of bytes to write.
+
+template<int ELEMENT_SIZE>
+struct unorm8_traits
 {
-	if (src_info.dimensions.x != dst_info.dimensions.x)
-		oThrow(std::errc::invalid_argument, "vertical resize assumes x dimensions are the same for source and destination");
+	static const int element_size = ELEMENT_SIZE;
 
-	FILTER filter;
-	filter.initialize_filter(src_info.dimensions.y, dst_info.dimensions.y);
+	static void filter_horizontal(const uint8_t* oRESTRICT src, const int16_t* oRESTRICT weights, int num_taps, uint8_t* oRESTRICT dst) { horizontal_kernel<ELEMENT_SIZE>::filter(src, weights, num_taps, dst); }
+	static void filter_vertical(const uint8_t* const* oRESTRICT rows, const int16_t* oRESTRICT weights, int num_taps, uint8_t* oRESTRICT dst, size_t row_bytes) { vertical_kernel(rows, weights, num_taps, dst, row_bytes); }
+};
+
+static inline uint16_t fixed_to_unorm16(int64_t v)
+{
+	v >>= fixed_bits;
+	return static_cast<uint16_t>(v < 0 ? 0 : (v > 65535 ? 65535 : v));
+}
 
-	const uint8_t* oRESTRICT srcData = (uint8_t*)src.data;
-	uint8_t* oRESTRICT dstData = (uint8_t*)dst.data;
+// 16-bit channels don't fit pmaddwd's signed inputs so these are scalar. This
+// is mostly used for filtering in linear space (see generate_mips).
+template<int NUM_CHANNELS>
+struct unorm16_traits
+{
+	static const int element_size = NUM_CHANNELS * 2;
 
-	for (uint32_t y = 0; y < dst_info.dimensions.y; y++)
+	static void filter_horizontal(const uint8_t* oRESTRICT src, const int16_t* oRESTRICT weights, int num_taps, uint8_t* oRESTRICT dst)
 	{
-		uint8_t* oRESTRICT dstRow = byte_add(dstData, y*dst.row_pitch);
+		const uint16_t* s = (const uint16_t*)src;
+		int64_t acc[NUM_CHANNELS];
+		for (int i = 0; i < NUM_CHANNELS; i++)
+			acc[i] = fixed_round;
+
+		for (int t = 0; t < num_taps; t++, s += NUM_CHANNELS)
+			for (int i = 0; i < NUM_CHANNELS; i++)
+				acc[i] += int64_t(s[i]) * weights[t];
+
+		uint16_t* d = (uint16_t*)dst;
+		for (int i = 0; i < NUM_CHANNELS; i++)
+			d[i] = fixed_to_unorm16(acc[i]);
+	}
 
-		for (uint32_t x = 0; x < dst_info.dimensions.x; x++)
+	static void filter_vertical(const uint8_t* const* oRESTRICT rows, const int16_t* oRESTRICT weights, int num_taps, uint8_t* oRESTRICT dst, size_t row_bytes)
+	{
+		uint16_t* d = (uint16_t*)dst;
+		const size_t n = row_bytes / 2;
+		for (size_t x = 0; x < n; x++)
 		{
-			auto& filterEntry = filter.FilterCache[y];
-			std::array<float, ELEMENT_SIZE> result;
-			result.fill(0.0f);
+			int64_t acc = fixed_round;
+			for (int t = 0; t < num_taps; t++)
+				acc += int64_t(((const uint16_t*)rows[t])[x]) * weights[t];
+			d[x] = fixed_to_unorm16(acc);
+		}
+	}
+};
 
-			for (int srcY = filterEntry.left;srcY <= filterEntry.right; ++srcY)
-			{
-				const uint8_t* oRESTRICT srcElement = byte_add(srcData, srcY*src.row_pitch + x*ELEMENT_SIZE);
+// Destination rows are filtered in parallel with parallel_for_range. Every 
+// destination row is computed the same way regardless of the subrange it lands
+// in, so the result does not depend on how rows are split or on the number of 
+// threads. Subranges that need intermediate rows allocate their own.
+static blob allocate_scratch(const allocator& scratch, size_t bytes)
+{
+	blob mem = scratch.scoped_allocate(bytes, "resize scratch");
+	if (!mem)
+		oThrow(std::errc::not_enough_memory, "resize scratch allocation failed");
+	return mem;
+}
 
-				for (size_t i = 0;i < ELEMENT_SIZE; i++)
-				{
-					float val = srcElement[i];
-					val *= filterEntry.cache[srcY - filterEntry.left];
-					result[i] += val;
-				}
-			}
-			for (size_t i = 0;i < ELEMENT_SIZE; i++)
-			{
-				dstRow[x*ELEMENT_SIZE + i] = static_cast<uint8_t>(clamp(result[i], 0.0f, 255.0f));
-			}
-		}
+template<typename FILTER, typename PIXEL>
+void horizontal_row(const FILTER& filter, const uint8_t* oRESTRICT srcRow, uint8_t* oRESTRICT dstRow, uint32_t width)
+{
+	for (uint32_t x = 0; x < width; x++)
+	{
+		const auto& filterEntry = filter.FilterCache[x];
+		PIXEL::filter_horizontal(srcRow + filterEntry.left*PIXEL::element_size, filterEntry.weights.data(), (int)filterEntry.weights.size(), dstRow + x*PIXEL::element_size);
 	}
 }
 
-template<typename FILTER, int ELEMENT_SIZE>
-void resize_internal(const info_t& src_info, const const_mapped_subresource& src, const info_t& dst_info, const mapped_subresource& dst)
+template<typename FILTER, typename PIXEL>
+void resize_internal(const info_t& src_info, const const_mapped_subresource& src, int srcFirst, const info_t& dst_info, const mapped_subresource& dst, uint32_t dstBegin, uint32_t dstEnd, const allocator& scratch)
 {
 	// Assuming all our filters are separable for now.
+	static const int ELEMENT_SIZE = PIXEL::element_size;
+
+	const uint32_t srcWidth = src_info.dimensions.x;
+	const uint32_t srcHeight = src_info.dimensions.y;
+	const uint32_t dstWidth = dst_info.dimensions.x;
+	const uint32_t dstHeight = dst_info.dimensions.y;
+	const uint8_t* srcData = (const uint8_t*)src.data;
+	uint8_t* dstData = (uint8_t*)dst.data;
+
+	// src begins at source row srcFirst and dst at destination row dstBegin
+	auto srcRowAt = [&](int row) { return byte_add(srcData, (row - srcFirst)*src.row_pitch); };
+	auto dstRowAt = [&](uint32_t y) { return byte_add(dstData, (y - dstBegin)*dst.row_pitch); };
 
 	if (all(src_info.dimensions == dst_info.dimensions)) // no actual resize, just copy
 	{
-		memcpy2d(dst.data, dst.row_pitch, src.data, src.row_pitch, dst_info.dimensions.x*element_size(dst_info.format), dst_info.dimensions.y);
+		memcpy2d(dst.data, dst.row_pitch, srcRowAt(dstBegin), src.row_pitch, dst_info.dimensions.x*element_size(dst_info.format), dstEnd - dstBegin);
 	}
 
 	else if (FILTER::support == 1) // point sampling
-	{		
-		const char* srcData = (char*)src.data;
-		char* dstData = (char*)dst.data;
-
+	{
 		// Bresenham style for x
-		int fixed_step = (src_info.dimensions.x / dst_info.dimensions.x)*ELEMENT_SIZE;
-		int remainder = (src_info.dimensions.x % dst_info.dimensions.x);
+		const int fixed_step = (srcWidth / dstWidth)*ELEMENT_SIZE;
+		const int remainder = (srcWidth % dstWidth);
 
-		for (uint32_t y = 0; y < dst_info.dimensions.y; y++)
+		parallel_for_range(dstBegin, dstEnd, [&](size_t begin, size_t end)
 		{
-			int row = (y * src_info.dimensions.y) / dst_info.dimensions.y;
-			const char* oRESTRICT srcRow = byte_add(srcData, row * src.row_pitch);
-			char* oRESTRICT dstRow = byte_add(dstData, y * dst.row_pitch);
-
-			uint32_t step = 0;
-			for (uint32_t x = 0; x < dst_info.dimensions.x; ++x)
+			for (uint32_t y = uint32_t(begin); y < end; y++)
 			{
-				for (size_t i = 0; i < ELEMENT_SIZE; i++)
-					*dstRow++ = *(srcRow + i);
-				srcRow += fixed_step;
-				step += remainder;
-				if (step >= dst_info.dimensions.x)
+				int row = (y * srcHeight) / dstHeight;
+				const uint8_t* oRESTRICT srcRow = srcRowAt(row);
+				uint8_t* oRESTRICT dstRow = dstRowAt(y);
+
+				uint32_t step = 0;
+				for (uint32_t x = 0; x < dstWidth; ++x)
 				{
-					srcRow += ELEMENT_SIZE;
-					step -= dst_info.dimensions.x;
+					for (size_t i = 0; i < ELEMENT_SIZE; i++)
+						*dstRow++ = *(srcRow + i);
+					srcRow += fixed_step;
+					step += remainder;
+					if (step >= dstWidth)
+					{
+						srcRow += ELEMENT_SIZE;
+						step -= dstWidth;
+					}
 				}
 			}
-		}
+		});
 	}
 	else // have to run a real filter
 	{
-		if (src_info.dimensions.x == dst_info.dimensions.x) // Only need a y filter
-			resize_vertical<FILTER, ELEMENT_SIZE>(src_info, src, dst_info, dst);
-		else if (src_info.dimensions.y == dst_info.dimensions.y) // Only need a x filter
-			resize_horizontal<FILTER, ELEMENT_SIZE>(src_info, src, dst_info, dst);
+		FILTER xfilter, yfilter;
+		if (srcWidth != dstWidth)
+			xfilter.initialize_filter(srcWidth, dstWidth);
+		if (srcHeight != dstHeight)
+			yfilter.initialize_filter(srcHeight, dstHeight);
+
+		if (srcWidth == dstWidth) // Only need a y filter
+		{
+			parallel_for_range(dstBegin, dstEnd, [&](size_t begin, size_t end)
+			{
+				const uint8_t* rows[FILTER::support];
+				for (uint32_t y = uint32_t(begin); y < end; y++)
+				{
+					const auto& filterEntry = yfilter.FilterCache[y];
+					const int numTaps = (int)filterEntry.weights.size();
+					for (int t = 0; t < numTaps; t++)
+						rows[t] = srcRowAt(filterEntry.left + t);
+					PIXEL::filter_vertical(rows, filterEntry.weights.data(), numTaps, dstRowAt(y), dstWidth*ELEMENT_SIZE);
+				}
+			});
+		}
+		else if (srcHeight == dstHeight) // Only need a x filter
+		{
+			parallel_for_range(dstBegin, dstEnd, [&](size_t begin, size_t end)
+			{
+				for (uint32_t y = uint32_t(begin); y < end; y++)
+					horizontal_row<FILTER, PIXEL>(xfilter, srcRowAt(y), dstRowAt(y), dstWidth);
+			});
+		}
 		else if (dst_info.dimensions.x*src_info.dimensions.y <= dst_info.dimensions.y*src_info.dimensions.x) // more efficient to run x filter then y
 		{
-			info_t tempInfo = src_info;
-			tempInfo.dimensions.x = dst_info.dimensions.x;
-			tempInfo.mip_layout = mip_layout::tight;
-			std::vector<char> tempImage;
-			tempImage.resize(total_size(tempInfo));
-
-			mapped_subresource tempMap = map_subresource(tempInfo, 0, tempImage.data());
-			resize_horizontal<FILTER, ELEMENT_SIZE>(src_info, src, tempInfo, tempMap);
-			const_mapped_subresource tempMapConst = tempMap;
-			resize_vertical<FILTER, ELEMENT_SIZE>(tempInfo, tempMapConst, dst_info, dst);
+			// x-filtered source rows go into a ring with a slot per tap. A destination
+			// row's taps are never more than support rows apart and move down as y
+			// increases, so each subrange x-filters each source row it needs about once.
+			const size_t rowBytes = dstWidth * ELEMENT_SIZE;
+			parallel_for_range(dstBegin, dstEnd, [&](size_t begin, size_t end)
+			{
+				blob mem = allocate_scratch(scratch, FILTER::support * rowBytes);
+				uint8_t* ring = mem;
+				const uint8_t* rows[FILTER::support];
+				int validBegin = 0, validEnd = 0; // source rows in the ring
+				for (uint32_t y = uint32_t(begin); y < end; y++)
+				{
+					const auto& filterEntry = yfilter.FilterCache[y];
+					const int numTaps = (int)filterEntry.weights.size();
+					const int left = filterEntry.left;
+
+					if (left < validBegin || left > validEnd)
+						validBegin = validEnd = left;
+
+					for (; validEnd < left + numTaps; validEnd++)
+						horizontal_row<FILTER, PIXEL>(xfilter, srcRowAt(validEnd), ring + (validEnd % FILTER::support)*rowBytes, dstWidth);
+					validBegin = std::max(validBegin, validEnd - FILTER::support);
+
+					for (int t = 0; t < numTaps; t++)
+						rows[t] = ring + ((left + t) % FILTER::support)*rowBytes;
+					PIXEL::filter_vertical(rows, filterEntry.weights.data(), numTaps, dstRowAt(y), rowBytes);
+				}
+			});
 		}
 		else // more efficient to run y filter then x
 		{
-			info_t tempInfo = src_info;
-			tempInfo.dimensions.y = dst_info.dimensions.y;
-			tempInfo.mip_layout = mip_layout::tight;
-			std::vector<char> tempImage; // todo: fix internal allocation
-			tempImage.resize(total_size(tempInfo));
-
-			mapped_subresource tempMap = map_subresource(tempInfo, 0, tempImage.data());
-			resize_vertical<FILTER, ELEMENT_SIZE>(src_info, src, tempInfo, tempMap);
-			const_mapped_subresource tempMapConst = tempMap;
-			resize_horizontal<FILTER, ELEMENT_SIZE>(tempInfo, tempMapConst, dst_info, dst);
+			// each destination row is y-filtered into one row of scratch then x-filtered
+			const size_t rowBytes = srcWidth * ELEMENT_SIZE;
+			parallel_for_range(dstBegin, dstEnd, [&](size_t begin, size_t end)
+			{
+				blob mem = allocate_scratch(scratch, rowBytes);
+				uint8_t* tempRow = mem;
+				const uint8_t* rows[FILTER::support];
+				for (uint32_t y = uint32_t(begin); y < end; y++)
+				{
+					const auto& filterEntry = yfilter.FilterCache[y];
+					const int numTaps = (int)filterEntry.weights.size();
+					for (int t = 0; t < numTaps; t++)
+						rows[t] = srcRowAt(filterEntry.left + t);
+					PIXEL::filter_vertical(rows, filterEntry.weights.data(), numTaps, tempRow, rowBytes);
+					horizontal_row<FILTER, PIXEL>(xfilter, tempRow, dstRowAt(y), dstWidth);
+				}
+			});
 		}
 	}
 }
 
-void resize(const info_t& src_info, const const_mapped_subresource& src, const info_t& dst_info, const mapped_subresource& dst, const filter& f)
+uint2 resize_source_rows(uint32_t src_height, uint32_t dst_height, const filter& f, uint32_t dst_begin, uint32_t dst_end)
+{
+	if (dst_begin >= dst_end)
+		return uint2(0, 0);
+
+	if (src_height == dst_height)
+		return uint2(dst_begin, dst_end);
+
+	if (f == filter::point)
+		return uint2(uint32_t((uint64_t(dst_begin) * src_height) / dst_height), uint32_t((uint64_t(dst_end - 1) * src_height) / dst_height) + 1);
+
+	// a filter's taps are trimmed from closest_source -/+ kernel_width
+	int kernel_width = 0;
+	switch (f)
+	{
+		case filter::box: kernel_width = filter_box::kernel_width; break;
+		case filter::triangle: kernel_width = filter_triangle::kernel_width; break;
+		case filter::lanczos2: kernel_width = filter_lanczos2::kernel_width; break;
+		case filter::lanczos3: kernel_width = filter_lanczos3::kernel_width; break;
+		default: oThrow(std::errc::invalid_argument, "unsupported filter type");
+	}
+
+	const int first = closest_source(dst_begin, src_height, dst_height) - kernel_width;
+	const int last = closest_source(dst_end - 1, src_height, dst_height) + kernel_width;
+	return uint2(uint32_t(std::max(first, 0)), uint32_t(std::min(last + 1, int(src_height))));
+}
+
+void resize(const info_t& src_info, const const_mapped_subresource& src, const info_t& dst_info, const mapped_subresource& dst, const filter& f, const allocator& scratch)
+{
+	resize_rows(src_info, src, 0, dst_info, dst, 0, dst_info.dimensions.y, f, scratch);
+}
+
+void resize_rows(const info_t& src_info, const const_mapped_subresource& src, uint32_t src_first_row, const info_t& dst_info, const mapped_subresource& dst, uint32_t dst_begin, uint32_t dst_end, const filter& f, const allocator& scratch)
 {
 	oSURF_CHECK(src_info.mip_layout == dst_info.mip_layout && src_info.format == dst_info.format, "incompatible surfaces");
+	oSURF_CHECK(dst_begin <= dst_end && dst_end <= dst_info.dimensions.y, "destination rows [%u,%u) are out of range", dst_begin, dst_end);
+	if (dst_begin == dst_end)
+		return;
+	oSURF_CHECK(src_first_row <= resize_source_rows(src_info.dimensions.y, dst_info.dimensions.y, f, dst_begin, dst_end).x, "source row %u is past the first row the destination rows filter", src_first_row);
 	oSURF_CHECK(!is_block_compressed(src_info.format), "block compressed formats cannot be padded");
 
 	const int elementSize = element_size(src_info.format);
+	const bool unorm16 = is_unorm(src_info.format) && channel_bits(src_info.format).r == 16;
 
+	// each filter/channel type/element size combination instantiates its own 
+	// kernels: 8-bit 4-byte elements get the SSE horizontal kernel, the rest a 
+	// scalar fixed-point one
 	#define FILTER_CASE(filter_type) \
 	case filter::filter_type: \
-	{	switch (elementSize) \
-		{	case 1: resize_internal<filter_t<filter_##filter_type>,1>(src_info, src, dst_info, dst); break; \
-			case 2: resize_internal<filter_t<filter_##filter_type>,2>(src_info, src, dst_info, dst); break; \
-			case 3: resize_internal<filter_t<filter_##filter_type>,3>(src_info, src, dst_info, dst); break; \
-			case 4: resize_internal<filter_t<filter_##filter_type>,4>(src_info, src, dst_info, dst); break; \
+	{	if (unorm16) \
+		{	switch (elementSize) \
+			{	case 2: resize_internal<filter_t<filter_##filter_type>,unorm16_traits<1>>(src_info, src, int(src_first_row), dst_info, dst, dst_begin, dst_end, scratch); break; \
+				case 4: resize_internal<filter_t<filter_##filter_type>,unorm16_traits<2>>(src_info, src, int(src_first_row), dst_info, dst, dst_begin, dst_end, scratch); break; \
+				case 8: resize_internal<filter_t<filter_##filter_type>,unorm16_traits<4>>(src_info, src, int(src_first_row), dst_info, dst, dst_begin, dst_end, scratch); break; \
+			} \
+		} \
+		else \
+		{	switch (elementSize) \
+			{	case 1: resize_internal<filter_t<filter_##filter_type>,unorm8_traits<1>>(src_info, src, int(src_first_row), dst_info, dst, dst_begin, dst_end, scratch); break; \
+				case 2: resize_internal<filter_t<filter_##filter_type>,unorm8_traits<2>>(src_info, src, int(src_first_row), dst_info, dst, dst_begin, dst_end, scratch); break; \
+				case 3: resize_internal<filter_t<filter_##filter_type>,unorm8_traits<3>>(src_info, src, int(src_first_row), dst_info, dst, dst_begin, dst_end, scratch); break; \
+				case 4: resize_internal<filter_t<filter_##filter_type>,unorm8_traits<4>>(src_info, src, int(src_first_row), dst_info, dst, dst_begin, dst_end, scratch); break; \
+			} \
 		} \
 		break; \
 	}
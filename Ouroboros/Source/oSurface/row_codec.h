@@ -0,0 +1,63 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+// Interfaces implemented by codecs that can stream scanlines. surface::decoder
+// and surface::encoder own one of these allocated from the temp allocator.
+
+#pragma once
+#include <oSurface/codec.h>
+#include <utility>
+
+namespace ouro { namespace surface { namespace detail {
+
+class row_decoder
+{
+public:
+	row_decoder() : row_(0) {}
+	virtual ~row_decoder() {}
+
+	const info_t& info() const { return info_; }
+	uint32_t row() const { return row_; }
+
+	// decodes num_rows rows starting at row() into dst and advances row().
+	// num_rows will not go past the last row.
+	virtual void read(const mapped_subresource& dst, uint32_t num_rows) = 0;
+
+protected:
+	info_t info_;
+	uint32_t row_;
+};
+
+class row_encoder
+{
+public:
+	row_encoder() : row_(0) {}
+	virtual ~row_encoder() {}
+
+	const info_t& info() const { return info_; }
+	uint32_t row() const { return row_; }
+
+	// encodes num_rows rows starting at row() and advances row(). num_rows will
+	// not go past the last row.
+	virtual void write(const const_mapped_subresource& src, uint32_t num_rows) = 0;
+
+	// called once all rows have been written
+	virtual blob finish() = 0;
+
+protected:
+	info_t info_;
+	uint32_t row_;
+};
+
+// allocates a T from alloc and calls its initialize() with args, cleaning up
+// if that throws
+template<typename T, typename... Args>
+T* new_row_codec(const allocator& alloc, const char* label, Args&&... args)
+{
+	allocator a(alloc);
+	T* codec = a.construct<T>(label);
+	try { codec->initialize(std::forward<Args>(args)...); }
+	catch (...) { a.destroy(codec); throw; }
+	return codec;
+}
+
+}}}
@@ -0,0 +1,244 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+#include <oBase/unit_test.h>
+
+#include <oSurface/algo.h>
+#include <cmath>
+#include <vector>
+
+using namespace ouro;
+using namespace ouro::surface;
+
+// a surface with padded rows so kernels can't rely on tightly packed data
+struct test_surface
+{
+	test_surface(const format& f, uint32_t width, uint32_t height)
+	{
+		info.format = f;
+		info.dimensions = uint3(width, height, 1);
+		pitch = width * element_size(f) + 13;
+		bits.resize(pitch * height, 0xcd);
+	}
+
+	uint8_t* pixel(uint32_t x, uint32_t y) { return &bits[y * pitch + x * element_size(info.format)]; }
+
+	const_mapped_subresource cmapped() const
+	{
+		const_mapped_subresource m;
+		m.data = bits.data();
+		m.row_pitch = pitch;
+		m.depth_pitch = uint32_t(bits.size());
+		return m;
+	}
+
+	mapped_subresource mapped()
+	{
+		mapped_subresource m;
+		m.data = bits.data();
+		m.row_pitch = pitch;
+		m.depth_pitch = uint32_t(bits.size());
+		return m;
+	}
+
+	info_t info;
+	uint32_t pitch;
+	std::vector<uint8_t> bits;
+};
+
+static uint32_t s_seed = 1;
+static uint8_t rand8()
+{
+	s_seed = s_seed * 1664525u + 1013904223u;
+	return uint8_t(s_seed >> 24);
+}
+
+// fills a grey image where every channel of a pixel has the same value
+static void fill_grey(test_surface& s, const test_surface& grey)
+{
+	const uint32_t size = element_size(s.info.format);
+	for (uint32_t y = 0; y < s.info.dimensions.y; y++)
+		for (uint32_t x = 0; x < s.info.dimensions.x; x++)
+			memset(s.pixel(x, y), grey.bits[y * grey.pitch + x], size);
+}
+
+// rms, psnr, max and the diff image on r8 against a scalar reference and grey
+// color images against r8, which should match exactly since the luminance
+// weights sum to one
+static void test_diff_stats(unit_test::services& srv)
+{
+	static const uint32_t w = 37, h = 53, scale = 3;
+
+	test_surface a(format::r8_unorm, w, h), b(format::r8_unorm, w, h);
+	for (uint32_t y = 0; y < h; y++)
+		for (uint32_t x = 0; x < w; x++)
+		{
+			*a.pixel(x, y) = rand8();
+			*b.pixel(x, y) = (x + y) % 5 ? *a.pixel(x, y) : rand8();
+		}
+
+	uint64_t sum_sq = 0;
+	uint32_t max_diff = 0;
+	for (uint32_t y = 0; y < h; y++)
+		for (uint32_t x = 0; x < w; x++)
+		{
+			const uint32_t d = (uint32_t)std::abs(int(*a.pixel(x, y)) - int(*b.pixel(x, y)));
+			sum_sq += d * d;
+			max_diff = max(max_diff, d);
+		}
+	const float expected_rms = float(std::sqrt(sum_sq / double(w * h)));
+
+	test_surface diffs(format::r8_unorm, w, h);
+	auto mdiffs = diffs.mapped();
+	const diff_stats_t stats = calc_diff_stats(a.info, a.cmapped(), b.cmapped(), diffs.info, mdiffs, scale);
+	oCHECK(std::abs(stats.rms - expected_rms) < 0.0001f, "r8 rms %f, expected %f", stats.rms, expected_rms);
+	oCHECK(stats.max_diff == max_diff, "r8 max diff %u, expected %u", stats.max_diff, max_diff);
+	oCHECK(std::abs(stats.psnr - 10.0f * std::log10(255.0f * 255.0f / (expected_rms * expected_rms))) < 0.001f, "r8 psnr %f is off", stats.psnr);
+
+	for (uint32_t y = 0; y < h; y++)
+		for (uint32_t x = 0; x < w; x++)
+		{
+			const uint32_t d = (uint32_t)std::abs(int(*a.pixel(x, y)) - int(*b.pixel(x, y)));
+			oCHECK(*diffs.pixel(x, y) == min(d * scale, 255u), "diff at %u,%u is %u, expected %u", x, y, *diffs.pixel(x, y), min(d * scale, 255u));
+		}
+
+	const diff_stats_t same = calc_diff_stats(a.info, a.cmapped(), a.cmapped());
+	oCHECK(same.rms == 0.0f && same.max_diff == 0 && std::isinf(same.psnr), "identical images should have no difference");
+
+	static const format kColorFormats[] = { format::b8g8r8_unorm, format::r8g8b8_unorm, format::b8g8r8a8_unorm, format::r8g8b8a8_unorm, format::b8g8r8x8_unorm };
+	for (const auto& f : kColorFormats)
+	{
+		test_surface ca(f, w, h), cb(f, w, h), cdiffs(format::r8_unorm, w, h);
+		fill_grey(ca, a);
+		fill_grey(cb, b);
+		auto mcdiffs = cdiffs.mapped();
+		const diff_stats_t cstats = calc_diff_stats(ca.info, ca.cmapped(), cb.cmapped(), cdiffs.info, mcdiffs, scale);
+		oCHECK(cstats.rms == stats.rms && cstats.max_diff == stats.max_diff, "%s: rms %f max %u doesn't match r8 rms %f max %u", as_string(f), cstats.rms, cstats.max_diff, stats.rms, stats.max_diff);
+		for (uint32_t y = 0; y < h; y++)
+			oCHECK(!memcmp(cdiffs.pixel(0, y), diffs.pixel(0, y), w), "%s: diff row %u doesn't match r8", as_string(f), y);
+	}
+
+	// luminance weights green far more than blue
+	test_surface green(format::b8g8r8a8_unorm, 1, 1), blue(format::b8g8r8a8_unorm, 1, 1), black(format::b8g8r8a8_unorm, 1, 1);
+	memcpy(green.pixel(0, 0), "\x00\xff\x00\xff", 4);
+	memcpy(blue.pixel(0, 0), "\xff\x00\x00\xff", 4);
+	memcpy(black.pixel(0, 0), "\x00\x00\x00\xff", 4);
+	const float green_rms = calc_rms(green.info, green.cmapped(), black.cmapped());
+	const float blue_rms = calc_rms(blue.info, blue.cmapped(), black.cmapped());
+	oCHECK(green_rms == 182.0f && blue_rms == 18.0f, "luminance of green %f and blue %f is off", green_rms, blue_rms);
+}
+
+static void test_histograms(unit_test::services& srv)
+{
+	static const uint32_t w = 61, h = 41;
+
+	test_surface grey(format::r8_unorm, w, h);
+	uint32_t expected[256] = {0};
+	for (uint32_t y = 0; y < h; y++)
+		for (uint32_t x = 0; x < w; x++)
+		{
+			const uint8_t v = rand8() & 0xf0; // repeats a lot
+			*grey.pixel(x, y) = v;
+			expected[v]++;
+		}
+
+	uint32_t histogram[256];
+	histogram8(grey.info, grey.cmapped(), histogram);
+	oCHECK(!memcmp(histogram, expected, sizeof(expected)), "r8 histogram is off");
+
+	test_surface color(format::b8g8r8a8_unorm, w, h);
+	fill_grey(color, grey);
+	histogram8(color.info, color.cmapped(), histogram);
+	oCHECK(!memcmp(histogram, expected, sizeof(expected)), "b8g8r8a8 histogram of a grey image should match r8");
+
+	test_surface r16(format::r16_unorm, w, h), f16(format::r16_float, w, h);
+	std::vector<uint32_t> expected16(65536, 0), histogram16_(65536);
+	for (uint32_t y = 0; y < h; y++)
+		for (uint32_t x = 0; x < w; x++)
+		{
+			const uint16_t v = uint16_t((x * 1031 + y * 17) & 0xffff);
+			memcpy(r16.pixel(x, y), &v, 2);
+			expected16[v]++;
+
+			const uint16_t hv = (uint16_t)f32tof16(x / float(w - 1));
+			memcpy(f16.pixel(x, y), &hv, 2);
+		}
+
+	histogram16(r16.info, r16.cmapped(), histogram16_.data());
+	oCHECK(histogram16_ == expected16, "r16 histogram is off");
+
+	histogram16(f16.info, f16.cmapped(), histogram16_.data());
+	oCHECK(histogram16_[0] == h && histogram16_[65535] == h, "r16_float histogram should put 0 and 1 at the ends");
+	uint64_t total = 0;
+	for (const auto& n : histogram16_)
+		total += n;
+	oCHECK(total == w * h, "r16_float histogram counted %u of %u pixels", uint32_t(total), w * h);
+}
+
+static void test_ssim(unit_test::services& srv)
+{
+	static const uint32_t w = 67, h = 45;
+
+	test_surface a(format::b8g8r8a8_unorm, w, h);
+	for (uint32_t y = 0; y < h; y++)
+		for (uint32_t x = 0; x < w; x++)
+			for (uint32_t ch = 0; ch < 4; ch++)
+				a.pixel(x, y)[ch] = uint8_t((x * 4 + y * 3) ^ (ch * 40));
+
+	const float same = calc_ssim(a.info, a.cmapped(), a.cmapped());
+	oCHECK(std::abs(same - 1.0f) < 0.00001f, "identical images have ssim %f", same);
+
+	float last = same;
+	for (uint32_t amplitude = 8; amplitude <= 64; amplitude *= 2)
+	{
+		test_surface b = a;
+		for (auto& v : b.bits)
+			v = uint8_t(clamp(int(v) + int(rand8() % amplitude) - int(amplitude / 2), 0, 255));
+
+		const float ssim = calc_ssim(a.info, a.cmapped(), b.cmapped());
+		oCHECK(ssim < last && ssim > 0.0f, "ssim %f with noise %u should be less than %f", ssim, amplitude, last);
+		last = ssim;
+	}
+
+	// smaller than a window is compared as a whole
+	test_surface small_a(format::r8_unorm, 5, 3), small_b(format::r8_unorm, 5, 3);
+	for (uint32_t i = 0; i < 15; i++)
+	{
+		*small_a.pixel(i % 5, i / 5) = uint8_t(i * 16);
+		*small_b.pixel(i % 5, i / 5) = uint8_t(255 - i * 16);
+	}
+	const float inverted = calc_ssim(small_a.info, small_a.cmapped(), small_b.cmapped());
+	oCHECK(inverted < 0.0f, "inverted image should have negative ssim, got %f", inverted);
+}
+
+oTEST(oSurface_surface_algo)
+{
+	test_diff_stats(srv);
+	test_histograms(srv);
+	test_ssim(srv);
+}
+
+oBENCHMARK(oSurface_surface_algo_benchmark)
+{
+	static const uint32_t w = 2048, h = 2048;
+	const double mpix = w * h / 1000000.0;
+
+	test_surface a(format::b8g8r8a8_unorm, w, h), b(format::b8g8r8a8_unorm, w, h), diffs(format::r8_unorm, w, h);
+	for (size_t i = 0; i < a.bits.size(); i++)
+	{
+		a.bits[i] = rand8();
+		b.bits[i] = (i & 7) ? a.bits[i] : rand8();
+	}
+
+	auto mdiffs = diffs.mapped();
+	diff_stats_t stats;
+	const double diff_rate = srv.trace_rate("diff", mpix, "MPix", srv.best_seconds(1, [&] { stats = calc_diff_stats(a.info, a.cmapped(), b.cmapped(), diffs.info, mdiffs, 4); }));
+
+	float ssim = 0.0f;
+	const double ssim_rate = srv.trace_rate("ssim", mpix, "MPix", srv.best_seconds(1, [&] { ssim = calc_ssim(a.info, a.cmapped(), b.cmapped()); }));
+
+	uint32_t histogram[256];
+	const double histogram_rate = srv.trace_rate("histogram", mpix, "MPix", srv.best_seconds(1, [&] { histogram8(a.info, a.cmapped(), histogram); }));
+
+	srv.trace("rms %.3f psnr %.2f ssim %.4f", stats.rms, stats.psnr, ssim);
+	srv.status("%ux%u b8g8r8a8: diff %.1f MPix/s, ssim %.1f MPix/s, histogram %.1f MPix/s", w, h, diff_rate, ssim_rate, histogram_rate);
+}
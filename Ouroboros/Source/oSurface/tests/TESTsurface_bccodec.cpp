@@ -7,6 +7,7 @@
 #include <oGPU/gpu.h>
 #include <oSurface/surface.h>
 #include <oSurface/codec.h>
+#include <oSurface/subresource.h>
 
 using namespace ouro;
 using namespace ouro::surface;
@@ -58,3 +59,380 @@ oTEST(oSurface_surface_bccodec)
 	convert_and_test(srv, dev, target, format::bc7_unorm, "_BC7", 2);
 	//convert_and_test(srv, dev, target, format::bc6h_uf16, "_BC6HU", 2);
 }
+
+static surface::image make_noise(const uint2& dimensions, const format& fmt, const mip_layout& layout = mip_layout::none)
+{
+	info_t si;
+	si.format = fmt;
+	si.mip_layout = layout;
+	si.dimensions = uint3(dimensions, 1);
+	surface::image img(si);
+
+	// smooth gradients with some noise so the encoders have real work to do
+	lock_guard lock(img);
+	uint32_t seed = 1;
+	for (uint32_t y = 0; y < dimensions.y; y++)
+	{
+		uint8_t* row = (uint8_t*)lock.mapped.data + y * lock.mapped.row_pitch;
+		for (uint32_t x = 0; x < dimensions.x; x++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			const uint32_t n = (seed >> 24) & 0x1f;
+			const uint8_t r = uint8_t((x * 255) / dimensions.x), g = uint8_t((y * 255) / dimensions.y), b = uint8_t(n * 8), a = uint8_t(255 - n);
+			if (fmt == format::r16g16b16a16_float)
+			{
+				uint16_t* h = (uint16_t*)row + x * 4;
+				h[0] = f32tof16(r / 64.0f); h[1] = f32tof16(g / 64.0f); h[2] = f32tof16(b / 64.0f); h[3] = f32tof16(1.0f);
+			}
+			else
+			{
+				uint8_t* c = row + x * 4;
+				c[0] = b; c[1] = g; c[2] = r; c[3] = a;
+			}
+		}
+	}
+
+	return img;
+}
+
+// There's no code in ouro to decode BC formats and the GPU only sees mip 0 in 
+// the test above, so below is a minimal CPU decoder for the formats ouro 
+// encodes to check every mip.
+
+// BC7 partition of each texel, 2 bits per texel: 64 two-subset partitions then 
+// 64 three-subset partitions
+static const uint32_t kBC7Partitions[128] =
+{
+	0x50505050, 0x40404040, 0x54545454, 0x54505040, 0x50404000, 0x55545450, 0x55545040, 0x54504000,
+	0x50400000, 0x55555450, 0x55544000, 0x54400000, 0x55555440, 0x55550000, 0x55555500, 0x55000000,
+	0x55150100, 0x00004054, 0x15010000, 0x00405054, 0x00004050, 0x15050100, 0x05010000, 0x40505054,
+	0x00404050, 0x05010100, 0x14141414, 0x05141450, 0x01155440, 0x00555500, 0x15014054, 0x05414150,
+	0x44444444, 0x55005500, 0x11441144, 0x05055050, 0x05500550, 0x11114444, 0x41144114, 0x44111144,
+	0x15055054, 0x01055040, 0x05041050, 0x05455150, 0x14414114, 0x50050550, 0x41411414, 0x00141400,
+	0x00041504, 0x00105410, 0x10541000, 0x04150400, 0x50410514, 0x41051450, 0x05415014, 0x14054150,
+	0x41050514, 0x41505014, 0x40011554, 0x54150140, 0x50505500, 0x00555050, 0x15151010, 0x54540404,
+	0xaa685050, 0x6a5a5040, 0x5a5a4200, 0x5450a0a8, 0xa5a50000, 0xa0a05050, 0x5555a0a0, 0x5a5a5050,
+	0xaa550000, 0xaa555500, 0xaaaa5500, 0x90909090, 0x94949494, 0xa4a4a4a4, 0xa9a59450, 0x2a0a4250,
+	0xa5945040, 0x0a425054, 0xa5a5a500, 0x55a0a0a0, 0xa8a85454, 0x6a6a4040, 0xa4a45000, 0x1a1a0500,
+	0x0050a4a4, 0xaaa59090, 0x14696914, 0x69691400, 0xa08585a0, 0xaa821414, 0x50a4a450, 0x6a5a0200,
+	0xa9a58000, 0x5090a0a8, 0xa8a09050, 0x24242424, 0x00aa5500, 0x24924924, 0x24499224, 0x50a50a50,
+	0x500aa550, 0xaaaa4444, 0x66660000, 0xa5a0a5a0, 0x50a050a0, 0x69286928, 0x44aaaa44, 0x66666600,
+	0xaa444444, 0x54a854a8, 0x95809580, 0x96969600, 0xa85454a8, 0x80959580, 0xaa141414, 0x96960000,
+	0xaaaa1414, 0xa05050a0, 0xa0a5a5a0, 0x96000000, 0x40804080, 0xa9a8a9a8, 0xaaaaaa44, 0x2a4a5254
+};
+
+// BC7 anchor texels: subset 1's in the high nibble, subset 2's in the low one
+static const uint8_t kBC7Anchors[128] =
+{
+	0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0,
+	0xf0, 0x20, 0x80, 0x20, 0x20, 0x80, 0x80, 0xf0, 0x20, 0x80, 0x20, 0x20, 0x80, 0x80, 0x20, 0x20,
+	0xf0, 0xf0, 0x60, 0x80, 0x20, 0x80, 0xf0, 0xf0, 0x20, 0x80, 0x20, 0x20, 0x20, 0xf0, 0xf0, 0x60,
+	0x60, 0x20, 0x60, 0x80, 0xf0, 0xf0, 0x20, 0x20, 0xf0, 0xf0, 0xf0, 0xf0, 0xf0, 0x20, 0x20, 0xf0,
+	0x3f, 0x38, 0xf8, 0xf3, 0x8f, 0x3f, 0xf3, 0xf8, 0x8f, 0x8f, 0x6f, 0x6f, 0x6f, 0x5f, 0x3f, 0x38,
+	0x3f, 0x38, 0x8f, 0xf3, 0x3f, 0x38, 0x6f, 0xa8, 0x53, 0x8f, 0x86, 0x6a, 0x8f, 0x5f, 0xfa, 0xf8,
+	0x8f, 0xf3, 0x3f, 0x5a, 0x6a, 0xa8, 0x89, 0xfa, 0xf6, 0x3f, 0xf8, 0x5f, 0xf3, 0xf6, 0xf6, 0xf8,
+	0x3f, 0xf3, 0x5f, 0x5f, 0x5f, 0x8f, 0x5f, 0xaf, 0x5f, 0xaf, 0x8f, 0xdf, 0xf3, 0xcf, 0x3f, 0x38
+};
+
+// decodes the color part of a bc1 or bc3 block into 16 b8g8r8a8 texels
+static void decode_bc1_block(const uint8_t* block, bool allow_transparent, uint8_t (*out)[4])
+{
+	const uint32_t c[2] = { block[0] | (uint32_t(block[1]) << 8u), block[2] | (uint32_t(block[3]) << 8u) };
+	uint32_t palette[4][4];
+	for (int i = 0; i < 2; i++)
+	{
+		const uint32_t r = (c[i] >> 11) & 31, g = (c[i] >> 5) & 63, b = c[i] & 31;
+		palette[i][0] = (b << 3) | (b >> 2);
+		palette[i][1] = (g << 2) | (g >> 4);
+		palette[i][2] = (r << 3) | (r >> 2);
+		palette[i][3] = 255;
+	}
+
+	// bc1 has a 3-color mode with transparent black, bc3 colors are always 4
+	const bool four = !allow_transparent || c[0] > c[1];
+	for (int ch = 0; ch < 3; ch++)
+	{
+		palette[2][ch] = four ? (2 * palette[0][ch] + palette[1][ch] + 1) / 3 : (palette[0][ch] + palette[1][ch]) / 2;
+		palette[3][ch] = four ? (palette[0][ch] + 2 * palette[1][ch] + 1) / 3 : 0;
+	}
+	palette[2][3] = 255;
+	palette[3][3] = four ? 255 : 0;
+
+	const uint32_t indices = block[4] | (uint32_t(block[5]) << 8u) | (uint32_t(block[6]) << 16u) | (uint32_t(block[7]) << 24u);
+	for (int i = 0; i < 16; i++)
+		for (int ch = 0; ch < 4; ch++)
+			out[i][ch] = uint8_t(palette[(indices >> (2 * i)) & 3][ch]);
+}
+
+// decodes the alpha part of a bc3 block
+static void decode_bc3_alpha(const uint8_t* block, uint8_t (*out)[4])
+{
+	uint32_t a[8] = { block[0], block[1] };
+	if (a[0] > a[1])
+		for (uint32_t i = 1; i < 7; i++)
+			a[i + 1] = ((7 - i) * a[0] + i * a[1] + 3) / 7;
+	else
+	{
+		for (uint32_t i = 1; i < 5; i++)
+			a[i + 1] = ((5 - i) * a[0] + i * a[1] + 2) / 5;
+		a[6] = 0;
+		a[7] = 255;
+	}
+
+	uint64_t indices = 0;
+	for (int i = 0; i < 6; i++)
+		indices |= uint64_t(block[2 + i]) << (8 * i);
+	for (int i = 0; i < 16; i++)
+		out[i][3] = uint8_t(a[(indices >> (3 * i)) & 7]);
+}
+
+struct bc7_mode_t
+{
+	uint8_t subsets;
+	uint8_t partition_bits;
+	uint8_t rotation_bits;
+	uint8_t index_selection_bits;
+	uint8_t color_bits;
+	uint8_t alpha_bits;
+	uint8_t endpoint_pbits;
+	uint8_t shared_pbits;
+	uint8_t index_bits;
+	uint8_t index2_bits;
+};
+
+static const bc7_mode_t kBC7Modes[8] =
+{
+	{ 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+	{ 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+	{ 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+	{ 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+	{ 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+	{ 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+	{ 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+	{ 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 },
+};
+
+static uint32_t read_bits(const uint8_t* block, uint32_t* pos, uint32_t n)
+{
+	uint32_t v = 0;
+	for (uint32_t i = 0; i < n; i++, (*pos)++)
+		v |= ((block[*pos >> 3] >> (*pos & 7)) & 1) << i;
+	return v;
+}
+
+static uint32_t bc7_interpolate(uint32_t e0, uint32_t e1, uint32_t index, uint32_t bits)
+{
+	static const uint32_t kWeights2[] = { 0, 21, 43, 64 };
+	static const uint32_t kWeights3[] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+	static const uint32_t kWeights4[] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+	const uint32_t w = bits == 2 ? kWeights2[index] : (bits == 3 ? kWeights3[index] : kWeights4[index]);
+	return ((64 - w) * e0 + w * e1 + 32) >> 6;
+}
+
+// decodes a bc7 block into 16 b8g8r8a8 texels
+static void decode_bc7_block(const uint8_t* block, uint8_t (*out)[4])
+{
+	uint32_t mode = 0;
+	while (mode < 8 && !(block[0] & (1 << mode)))
+		mode++;
+
+	if (mode == 8)
+	{
+		memset(out, 0, 16 * 4);
+		return;
+	}
+
+	const bc7_mode_t& m = kBC7Modes[mode];
+	uint32_t pos = mode + 1;
+	const uint32_t partition = read_bits(block, &pos, m.partition_bits);
+	const uint32_t rotation = read_bits(block, &pos, m.rotation_bits);
+	const uint32_t index_selection = read_bits(block, &pos, m.index_selection_bits);
+
+	// rgba per endpoint, two per subset
+	const uint32_t nendpoints = m.subsets * 2u;
+	uint32_t ep[6][4];
+	for (uint32_t ch = 0; ch < 4; ch++)
+		for (uint32_t e = 0; e < nendpoints; e++)
+			ep[e][ch] = ch < 3 ? read_bits(block, &pos, m.color_bits) : (m.alpha_bits ? read_bits(block, &pos, m.alpha_bits) : 255);
+
+	uint32_t pbits[6] = { 0 };
+	if (m.endpoint_pbits)
+		for (uint32_t e = 0; e < nendpoints; e++)
+			pbits[e] = read_bits(block, &pos, 1);
+	if (m.shared_pbits)
+		for (uint32_t s = 0; s < m.subsets; s++)
+			pbits[s * 2] = pbits[s * 2 + 1] = read_bits(block, &pos, 1);
+
+	// expand to 8 bits by replicating the high bits
+	const bool has_pbits = m.endpoint_pbits || m.shared_pbits;
+	for (uint32_t e = 0; e < nendpoints; e++)
+		for (uint32_t ch = 0; ch < 4; ch++)
+		{
+			if (ch == 3 && !m.alpha_bits)
+				continue;
+			uint32_t bits = ch < 3 ? m.color_bits : m.alpha_bits;
+			uint32_t v = ep[e][ch];
+			if (has_pbits)
+			{
+				v = (v << 1) | pbits[e];
+				bits++;
+			}
+			ep[e][ch] = (v << (8 - bits)) | (v >> (2 * bits - 8));
+		}
+
+	const uint32_t pattern = m.subsets == 1 ? 0 : kBC7Partitions[(m.subsets == 3 ? 64 : 0) + partition];
+	const uint32_t anchors = m.subsets == 1 ? 0 : kBC7Anchors[(m.subsets == 3 ? 64 : 0) + partition];
+
+	uint32_t index[16], index2[16];
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		const bool anchor = i == 0 || (m.subsets >= 2 && i == (anchors >> 4u)) || (m.subsets == 3 && i == (anchors & 15u));
+		index[i] = read_bits(block, &pos, m.index_bits - (anchor ? 1 : 0));
+	}
+
+	for (uint32_t i = 0; i < 16; i++)
+		index2[i] = m.index2_bits ? read_bits(block, &pos, m.index2_bits - (i == 0 ? 1 : 0)) : index[i];
+
+	for (uint32_t i = 0; i < 16; i++)
+	{
+		const uint32_t s = (pattern >> (2 * i)) & 3;
+		const uint32_t* e0 = ep[s * 2];
+		const uint32_t* e1 = ep[s * 2 + 1];
+
+		// modes 4 and 5 index color and alpha separately, index_selection swaps them
+		uint32_t ci = index[i], cbits = m.index_bits, ai = index2[i], abits = m.index2_bits ? m.index2_bits : m.index_bits;
+		if (index_selection)
+		{
+			std::swap(ci, ai);
+			std::swap(cbits, abits);
+		}
+
+		uint32_t rgba[4];
+		for (uint32_t ch = 0; ch < 3; ch++)
+			rgba[ch] = bc7_interpolate(e0[ch], e1[ch], ci, cbits);
+		rgba[3] = bc7_interpolate(e0[3], e1[3], ai, abits);
+
+		if (rotation)
+			std::swap(rgba[3], rgba[rotation - 1]);
+
+		out[i][0] = uint8_t(rgba[2]);
+		out[i][1] = uint8_t(rgba[1]);
+		out[i][2] = uint8_t(rgba[0]);
+		out[i][3] = uint8_t(rgba[3]);
+	}
+}
+
+// decodes a bc1, bc3 or bc7 surface into b8g8r8a8_unorm, dropping the texels 
+// of edge blocks that are past dimensions
+static void decode_bc(const format& fmt, const const_mapped_subresource& src, const uint2& dimensions, const mapped_subresource& dst)
+{
+	const uint32_t block_size = fmt == format::bc1_unorm ? 8 : 16;
+	for (uint32_t by = 0; by < dimensions.y; by += 4)
+	{
+		const uint8_t* block = (const uint8_t*)src.data + (by / 4) * src.row_pitch;
+		for (uint32_t bx = 0; bx < dimensions.x; bx += 4, block += block_size)
+		{
+			uint8_t texels[16][4];
+			switch (fmt)
+			{
+				case format::bc1_unorm: decode_bc1_block(block, true, texels); break;
+				case format::bc3_unorm: decode_bc1_block(block + 8, false, texels); decode_bc3_alpha(block, texels); break;
+				case format::bc7_unorm: decode_bc7_block(block, texels); break;
+				default: oThrow(std::errc::not_supported, "%s not supported", as_string(fmt));
+			}
+
+			for (uint32_t y = by; y < min(by + 4, dimensions.y); y++)
+				for (uint32_t x = bx; x < min(bx + 4, dimensions.x); x++)
+					memcpy((uint8_t*)dst.data + y * dst.row_pitch + x * 4, texels[(y - by) * 4 + (x - bx)], 4);
+		}
+	}
+}
+
+// BC compressing mips smaller than a block and sizes that aren't multiples of 4
+oTEST(oSurface_surface_bccodec_mips)
+{
+	auto source = make_noise(uint2(37, 21), format::b8g8r8a8_unorm, mip_layout::tight);
+	source.generate_mips();
+
+	static const format kFormats[] = { format::bc1_unorm, format::bc3_unorm, format::bc7_unorm };
+	for (const auto& f : kFormats)
+	{
+		auto encoded = encode(source, file_format::dds, f);
+		auto info = get_info(encoded);
+		oCHECK(info.format == f, "expected %s, got %s", as_string(f), as_string(info.format));
+		oCHECK(all(info.dimensions == source.info().dimensions), "dimensions mismatch for %s", as_string(f));
+		oCHECK(num_mips(info) == num_mips(source.info()), "%s: expected %u mips, got %u", as_string(f), num_mips(source.info()), num_mips(info));
+
+		auto decoded = decode(encoded);
+		const uint32_t nmips = num_mips(info);
+		for (uint32_t mip = 0; mip < nmips; mip++)
+		{
+			const uint32_t subresource = calc_subresource(mip, 0, 0, nmips, 1);
+
+			info_t mip_info;
+			mip_info.format = format::b8g8r8a8_unorm;
+			mip_info.dimensions = uint3(dimensions(mip_info.format, source.info().dimensions.xy(), mip), 1);
+			surface::image mip_image(mip_info);
+
+			{
+				shared_lock blocks(decoded, subresource);
+				lock_guard texels(mip_image);
+				decode_bc(f, blocks.mapped, mip_info.dimensions.xy(), texels.mapped);
+			}
+
+			shared_lock expected(source, subresource);
+			shared_lock actual(mip_image);
+
+			// A mip smaller than a block is a single block of a 2D gradient and bc1's 
+			// one color line can't follow that, so allow more error there.
+			const bool sub_block = mip_info.dimensions.x < 4 || mip_info.dimensions.y < 4;
+			const float max_rms = sub_block ? 48.0f : 12.0f;
+			const auto stats = calc_diff_stats(mip_info, expected.mapped, actual.mapped);
+			oCHECK(stats.rms <= max_rms, "%s mip %u (%ux%u): rms %.2f exceeds %.2f", as_string(f), mip, mip_info.dimensions.x, mip_info.dimensions.y, stats.rms, max_rms);
+
+			// bc1 is opaque, bc3 and bc7 should keep alpha close
+			if (f != format::bc1_unorm)
+			{
+				uint32_t max_alpha_diff = 0;
+				for (uint32_t y = 0; y < mip_info.dimensions.y; y++)
+				{
+					const uint8_t* e = (const uint8_t*)expected.mapped.data + y * expected.mapped.row_pitch;
+					const uint8_t* a = (const uint8_t*)actual.mapped.data + y * actual.mapped.row_pitch;
+					for (uint32_t x = 0; x < mip_info.dimensions.x; x++)
+						max_alpha_diff = max(max_alpha_diff, uint32_t(abs(int(e[x * 4 + 3]) - int(a[x * 4 + 3]))));
+				}
+
+				oCHECK(max_alpha_diff <= 12, "%s mip %u: alpha differs by up to %u", as_string(f), mip, max_alpha_diff);
+			}
+		}
+	}
+}
+
+oBENCHMARK(oSurface_surface_bccodec_benchmark)
+{
+	static const uint2 kDimensions(2048, 2048);
+	const double mpix = (kDimensions.x * kDimensions.y) / 1000000.0;
+
+	auto ldr = make_noise(kDimensions, format::b8g8r8a8_unorm);
+	auto hdr = make_noise(kDimensions, format::r16g16b16a16_float);
+
+	struct test_t { format fmt; bc_quality quality; const char* name; };
+	static const test_t kTests[] = 
+	{
+		{ format::bc1_unorm, bc_quality::fast, "bc1" },
+		{ format::bc3_unorm, bc_quality::fast, "bc3" },
+		{ format::bc6h_uf16, bc_quality::ultrafast, "bc6h ultrafast" },
+		{ format::bc6h_uf16, bc_quality::fast, "bc6h fast" },
+		{ format::bc7_unorm, bc_quality::ultrafast, "bc7 ultrafast" },
+		{ format::bc7_unorm, bc_quality::fast, "bc7 fast" },
+		{ format::bc7_unorm, bc_quality::basic, "bc7 basic" },
+	};
+
+	for (const auto& t : kTests)
+	{
+		const auto& src = t.fmt == format::bc6h_uf16 ? hdr : ldr;
+		srv.trace_rate(t.name, mpix, "MPix", srv.best_seconds(1, [&] { src.convert(t.fmt, t.quality); }));
+	}
+
+	srv.status("%ux%u BC compression, see trace for MPix/s per format", kDimensions.x, kDimensions.y);
+}
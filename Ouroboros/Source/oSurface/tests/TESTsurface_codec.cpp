@@ -5,9 +5,11 @@
 #include <oCore/color.h>
 #include <oBase/scoped_timer.h>
 #include <oSystem/filesystem.h>
+#include <oSystem/filesystem_util.h>
 #include <oSurface/codec.h>
 #include <oSurface/fill.h>
 #include <oString/fixed_string.h>
+#include <vector>
 
 using namespace ouro;
 
@@ -118,3 +120,167 @@ oTEST(oSurface_codec)
 	compare_checkboards(srv, uint2(11,21), surface::format::b8g8r8a8_unorm, surface::file_format::png, 1.0f);
 	compare_checkboards(srv, uint2(11,21), surface::format::b8g8r8a8_unorm, surface::file_format::tga, 1.0f);
 }
+
+static surface::image make_checkerboard(const uint2& dimensions)
+{
+	surface::info_t si;
+	si.format = surface::format::b8g8r8a8_unorm;
+	si.mip_layout = surface::mip_layout::none;
+	si.dimensions = int3(dimensions, 1);
+	surface::image img(si);
+	surface::lock_guard lock(img);
+	surface::fill_image_t fill;
+	fill.argb_surface = (uint32_t*)lock.mapped.data;
+	fill.row_width    = si.dimensions.x;
+	fill.num_rows     = si.dimensions.y;
+	fill.row_pitch    = lock.mapped.row_pitch;
+	surface::fill_checker(&fill, si.dimensions.x / 4, si.dimensions.y / 4, (uint32_t)color::blue, (uint32_t)color::red);
+	return img;
+}
+
+// decoding in bands should produce exactly what decoding all at once does
+static void compare_streaming_decode(unit_test::services& srv, const blob& encoded, uint32_t rows_per_band)
+{
+	auto whole = surface::decode(encoded);
+	const auto info = whole.info();
+
+	surface::decoder dec(encoded, encoded.size());
+	oCHECK(dec.info().format == info.format && all(dec.info().dimensions == info.dimensions), "decoder info mismatch");
+
+	const uint32_t row_bytes = surface::element_size(info.format) * info.dimensions.x;
+	std::vector<uint8_t> band(row_bytes * rows_per_band);
+	surface::mapped_subresource mapped;
+	mapped.data = band.data();
+	mapped.row_pitch = row_bytes;
+	mapped.depth_pitch = row_bytes * rows_per_band;
+
+	surface::shared_lock lock(whole);
+	uint32_t y = 0;
+	while (!dec.done())
+	{
+		const uint32_t n = dec.read(mapped, rows_per_band);
+		oCHECK(n && n <= rows_per_band, "read returned %u rows", n);
+		for (uint32_t i = 0; i < n; i++, y++)
+			oCHECK(!memcmp(band.data() + i * row_bytes, byte_add(lock.mapped.data, y * lock.mapped.row_pitch), row_bytes), "row %u differs from a full decode", y);
+	}
+
+	oCHECK(y == info.dimensions.y, "decoded %u of %u rows", y, info.dimensions.y);
+	oCHECK(dec.read(mapped, rows_per_band) == 0, "read past the last row");
+}
+
+oTEST(oSurface_codec_streaming)
+{
+	auto known = make_checkerboard(uint2(37, 53));
+
+	const surface::file_format formats[] = { surface::file_format::bmp, surface::file_format::jpg, surface::file_format::png, surface::file_format::tga };
+	for (const auto& ff : formats)
+	{
+		srv.trace("streaming %s", as_string(ff));
+		oCHECK(surface::supports_streaming(ff), "%s should support streaming", as_string(ff));
+		auto encoded = surface::encode(known, ff, surface::format::unknown, surface::compression::none);
+		compare_streaming_decode(srv, encoded, 7);
+	}
+
+	oCHECK(!surface::supports_streaming(surface::file_format::dds), "dds is not stored as scanlines");
+
+	// bmp -> png in bands, converting bgra to rgba along the way
+	auto bmp = surface::encode(known, surface::file_format::bmp, surface::format::unknown, surface::compression::none);
+	auto png = surface::transcode(bmp, bmp.size(), surface::file_format::png, surface::format::r8g8b8a8_unorm, 5);
+	auto decoded = surface::decode(png);
+	oCHECK(decoded.info().format == known.info().format, "transcoded format mismatch");
+	oCHECK(surface::calc_rms(known, decoded) == 0.0f, "transcoding changed the image");
+
+	// resizing in bands should match resizing the whole image. Point sampling 
+	// one row per band down to a fifth of the height skips source rows.
+	struct { uint2 dimensions; surface::filter filter; uint32_t rows_per_band; } resizes[] =
+	{
+		{ uint2(23, 71), surface::filter::lanczos3, 5 },
+		{ uint2(50, 20), surface::filter::triangle, 3 },
+		{ uint2(50, 10), surface::filter::point, 1 },
+	};
+
+	for (const auto& r : resizes)
+	{
+		surface::info_t si = known.info();
+		si.dimensions = uint3(r.dimensions.x, r.dimensions.y, 1);
+		surface::image expected(si);
+		{
+			surface::shared_lock src(known);
+			surface::lock_guard dst(expected);
+			surface::resize(known.info(), src.mapped, si, dst.mapped, r.filter);
+		}
+
+		png = surface::transcode(bmp, bmp.size(), surface::file_format::png, r.dimensions, r.filter, surface::format::r8g8b8a8_unorm, r.rows_per_band);
+		decoded = surface::decode(png);
+		oCHECK(all(decoded.info().dimensions == si.dimensions), "transcoded dimensions mismatch");
+		oCHECK(surface::calc_rms(expected, decoded) == 0.0f, "banded %s resize differs from a whole image resize", as_string(r.filter));
+	}
+
+	// an encoder should refuse to finish an incomplete image
+	{
+		surface::encoder enc(surface::file_format::bmp, known.info());
+		surface::shared_lock lock(known);
+		enc.write(lock.mapped, 10);
+
+		bool ExpectedFail = false;
+		try { enc.finish(); }
+		catch (std::exception&) { ExpectedFail = true; }
+		oCHECK(ExpectedFail, "finish should throw when rows are missing");
+	}
+}
+
+oTEST(oSurface_codec_oimg)
+{
+	// a mip chain with an odd size so subresources don't land on nice boundaries
+	auto checker = make_checkerboard(uint2(37, 53));
+	surface::info_t si = checker.info();
+	si.mip_layout = surface::mip_layout::tight;
+	surface::image known(si);
+	known.copy_from(0, checker, 0);
+	known.generate_mips(surface::filter::box);
+
+	surface::shared_lock lock(known);
+	const size_t bytes = known.size();
+
+	const surface::compression levels[] = { surface::compression::none, surface::compression::low, surface::compression::medium, surface::compression::high };
+	for (const auto& level : levels)
+	{
+		auto encoded = surface::encode(known, surface::file_format::oimg, surface::format::unknown, level);
+		auto decoded = surface::decode(encoded);
+		oCHECK(decoded.info() == si, "oimg info mismatch at compression %d", (int)level);
+
+		surface::shared_lock dlock(decoded);
+		oCHECK(!memcmp(lock.mapped.data, dlock.mapped.data, bytes), "oimg bits mismatch at compression %d", (int)level);
+
+		surface::info_t info;
+		uint64_t offset = 0, size = 0;
+		const bool in_place = surface::get_oimg_bits(encoded, encoded.size(), &info, &offset, &size);
+		oCHECK(in_place == (level == surface::compression::none), "only uncompressed oimg should be usable in place");
+		if (in_place)
+		{
+			oCHECK((offset % 64) == 0 && size == bytes, "uncompressed bits should be 64-byte aligned");
+			oCHECK(!memcmp(byte_add((const void*)encoded, size_t(offset)), lock.mapped.data, bytes), "in-place bits mismatch");
+		}
+
+		// uncompressed files are mapped, others decoded, but the result is the same
+		const path_t path = filesystem::temp_path(true);
+		filesystem::save(path, encoded, encoded.size());
+		{
+			auto mapped = filesystem::map_image(path);
+			surface::shared_lock mlock(mapped);
+			oCHECK(mapped.info() == si && !memcmp(lock.mapped.data, mlock.mapped.data, bytes), "map_image mismatch at compression %d", (int)level);
+			oCHECK(mapped.immutable() == in_place, "only a mapped oimg should be immutable");
+		}
+
+		// the mapping is read-only, so writable access must be refused
+		if (in_place)
+		{
+			auto mapped = filesystem::map_image(path);
+			bool refused = false;
+			try { surface::lock_guard mlock(mapped); }
+			catch (std::exception&) { refused = true; }
+			oCHECK(refused, "map() on a mapped oimg should throw");
+		}
+		filesystem::remove(path);
+	}
+}
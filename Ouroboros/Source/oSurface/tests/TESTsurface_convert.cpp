@@ -0,0 +1,221 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+#include <oBase/unit_test.h>
+
+#include <oCore/snprintf.h>
+#include <oMath/hlsl.h>
+#include <oMath/quantize.h>
+#include <oSurface/convert.h>
+#include <cmath>
+#include <vector>
+
+using namespace ouro;
+using namespace ouro::surface;
+
+static void convert(const format& dst_format, void* dst, const format& src_format, const void* src, uint32_t num_elements)
+{
+	convert_structured(dst, element_size(dst_format), dst_format, src, element_size(src_format), src_format, num_elements);
+}
+
+static bool converts(const format& dst_format, const format& src_format)
+{
+	uint8_t src[16] = {0}, dst[16];
+	try { convert(dst_format, dst, src_format, src, 1); }
+	catch (std::system_error&) { return false; }
+	return true;
+}
+
+// every format that converts to float4 should convert to every other such format
+static void test_all_pairs(unit_test::services& srv)
+{
+	std::vector<format> convertible;
+	for (int i = 0; i < (int)format::count; i++)
+	{
+		const format f = format(i);
+		if (converts(format::r32g32b32a32_float, f))
+		{
+			oCHECK(converts(f, format::r32g32b32a32_float), "float4 -> %s failed", as_string(f));
+			oCHECK(!is_block_compressed(f) && !is_typeless(f) && !is_planar(f), "%s should not be convertible", as_string(f));
+			convertible.push_back(f);
+		}
+	}
+
+	for (const auto& s : convertible)
+		for (const auto& d : convertible)
+			oCHECK(converts(d, s), "%s -> %s failed", as_string(s), as_string(d));
+
+	srv.trace("%u convertible formats", (uint32_t)convertible.size());
+}
+
+static void test_round_trips(unit_test::services& srv)
+{
+	// every 8-bit value should survive a trip through float, half and 16-bit unorm
+	std::vector<uint8_t> rgba(256 * 4), back(256 * 4);
+	for (uint32_t i = 0; i < 256; i++)
+		for (uint32_t ch = 0; ch < 4; ch++)
+			rgba[i * 4 + ch] = uint8_t(i + ch * 64);
+
+	static const format kIntermediates[] = { format::r32g32b32a32_float, format::r16g16b16a16_float, format::r16g16b16a16_unorm, format::b8g8r8a8_unorm, format::a8b8g8r8_unorm };
+	for (const auto& f : kIntermediates)
+	{
+		std::vector<uint8_t> tmp(256 * element_size(f));
+		convert(f, tmp.data(), format::r8g8b8a8_unorm, rgba.data(), 256);
+		convert(format::r8g8b8a8_unorm, back.data(), f, tmp.data(), 256);
+		oCHECK(rgba == back, "r8g8b8a8_unorm -> %s -> r8g8b8a8_unorm isn't lossless", as_string(f));
+	}
+
+	// 8 -> 16 bits replicates the byte exactly
+	uint16_t u16[4];
+	convert(format::r16g16b16a16_unorm, u16, format::r8g8b8a8_unorm, &rgba[0xab * 4], 1);
+	oCHECK(u16[0] == 0xabab, "unorm rescale is off: 0x%04x", u16[0]);
+
+	// missing channels are 0 and alpha is 1
+	const uint8_t rg[2] = { 0x10, 0x20 };
+	uint8_t rgba1[4];
+	convert(format::r8g8b8a8_unorm, rgba1, format::r8g8_unorm, rg, 1);
+	oCHECK(rgba1[0] == 0x10 && rgba1[1] == 0x20 && rgba1[2] == 0 && rgba1[3] == 0xff, "missing channels not defaulted");
+
+	// r10g10b10a2_unorm is oMath's udec3 packing
+	const float4 color(0.25f, 0.5f, 1.0f, 1.0f);
+	uint32_t udec3;
+	float4 decoded;
+	convert(format::r10g10b10a2_unorm, &udec3, format::r32g32b32a32_float, &color, 1);
+	oCHECK(udec3 == float4toudec3(color), "udec3 encoded as 0x%08x, float4toudec3 gives 0x%08x", udec3, float4toudec3(color));
+	const uint32_t packed = 0x89abcdef;
+	convert(format::r32g32b32a32_float, &decoded, format::r10g10b10a2_unorm, &packed, 1);
+	oCHECK(all(decoded.xyz() == udec3tofloat4(packed).xyz()), "udec3 decoded differently than udec3tofloat4");
+
+	// uint channels are normalized
+	const uint16_t u16x4[4] = { 65535, 0, 32768, 65535 };
+	convert(format::r32g32b32a32_float, &decoded, format::r16g16b16a16_uint, u16x4, 1);
+	oCHECK(decoded.x == 1.0f && decoded.y == 0.0f && std::abs(decoded.z - n16tof32(32768)) < 0.000001f && decoded.w == 1.0f, "uint decoded as %f %f %f %f", decoded.x, decoded.y, decoded.z, decoded.w);
+	const float3 half_grey(0.5f, 0.5f, 0.5f);
+	convert(format::r16g16b16a16_uint, u16, format::r32g32b32_float, &half_grey, 1);
+	oCHECK(u16[0] == f32ton16(0.5f) && u16[3] == 65535, "uint encoded as %u, alpha %u", u16[0], u16[3]);
+
+	// 565 rounds to the nearest representable value
+	const uint8_t grey[4] = { 0x80, 0x80, 0x80, 0xff };
+	uint16_t rgb565;
+	convert(format::b5g6r5_unorm, &rgb565, format::r8g8b8a8_unorm, grey, 1);
+	oCHECK(rgb565 == ((16 << 11) | (32 << 5) | 16), "565 encoded as 0x%04x", rgb565);
+
+	// srgb converts the stored values without applying gamma
+	const uint8_t srgb[4] = { 188, 188, 188, 128 };
+	float4 stored;
+	convert(format::r32g32b32a32_float, &stored, format::r8g8b8a8_unorm_srgb, srgb, 1);
+	oCHECK(stored.x == 188.0f / 255.0f && stored.w == 128.0f / 255.0f, "srgb decoded as %f %f", stored.x, stored.w);
+	uint8_t bgra[4];
+	convert(format::b8g8r8a8_unorm, bgra, format::r8g8b8a8_unorm_srgb, srgb, 1);
+	oCHECK(!memcmp(srgb, bgra, 4), "srgb -> unorm changed the values");
+}
+
+// the SSE2 half kernels should match the scalar conversion for every value
+static void test_half(unit_test::services& srv)
+{
+	std::vector<uint16_t> halfs(65536);
+	for (uint32_t i = 0; i < 65536; i++)
+		halfs[i] = uint16_t(i);
+
+	std::vector<float> floats(65536);
+	convert(format::r32_float, floats.data(), format::r16_float, halfs.data(), 65536);
+
+	uint32_t nerrors = 0;
+	for (uint32_t i = 0; i < 65536; i++)
+	{
+		const float expected = f16tof32(i);
+		if (memcmp(&expected, &floats[i], sizeof(float)) && !(std::isnan(expected) && std::isnan(floats[i])))
+			nerrors++;
+	}
+	oCHECK(nerrors == 0, "%u half -> float mismatches", nerrors);
+
+	std::vector<uint16_t> back(65536);
+	convert(format::r16_float, back.data(), format::r32_float, floats.data(), 65536);
+	nerrors = 0;
+	for (uint32_t i = 0; i < 65536; i++)
+		if (back[i] != halfs[i] && !std::isnan(floats[i]))
+			nerrors++;
+	oCHECK(nerrors == 0, "%u float -> half mismatches", nerrors);
+}
+
+static void test_flip(unit_test::services& srv)
+{
+	static const uint32_t w = 3, h = 4;
+	uint8_t src[h][w * 3];
+	for (uint32_t y = 0; y < h; y++)
+		for (uint32_t x = 0; x < w * 3; x++)
+			src[y][x] = uint8_t(y * 16 + x);
+
+	uint8_t dst[h][w * 4];
+	mapped_subresource mdst;
+	mdst.data = dst;
+	mdst.row_pitch = w * 4;
+	mdst.depth_pitch = sizeof(dst);
+
+	const_mapped_subresource msrc;
+	msrc.data = src;
+	msrc.row_pitch = w * 3;
+	msrc.depth_pitch = sizeof(src);
+
+	convert_formatted(mdst, format::b8g8r8a8_unorm, msrc, format::r8g8b8_unorm, uint3(w, h, 1), copy_option::flip_vertically);
+	for (uint32_t y = 0; y < h; y++)
+		oCHECK(dst[y][0] == src[h - 1 - y][2] && dst[y][2] == src[h - 1 - y][0] && dst[y][3] == 0xff, "row %u not flipped", y);
+}
+
+oTEST(oSurface_surface_convert)
+{
+	test_all_pairs(srv);
+	test_round_trips(srv);
+	test_half(srv);
+	test_flip(srv);
+}
+
+oBENCHMARK(oSurface_surface_convert_benchmark)
+{
+	static const uint2 kDimensions(2048, 2048);
+	const uint32_t npixels = kDimensions.x * kDimensions.y;
+	const double mpix = npixels / 1000000.0;
+
+	struct test_t { format src; format dst; };
+	static const test_t kTests[] =
+	{
+		{ format::b8g8r8a8_unorm,     format::r8g8b8a8_unorm },
+		{ format::r8g8b8_unorm,       format::b8g8r8a8_unorm },
+		{ format::r8g8b8a8_unorm,     format::r32g32b32a32_float },
+		{ format::r16g16b16a16_float, format::r32g32b32a32_float },
+		{ format::r32g32b32a32_float, format::r16g16b16a16_float },
+		{ format::r32g32b32a32_float, format::r10g10b10a2_unorm },
+		{ format::r10g10b10a2_unorm,  format::r32g32b32a32_float },
+		{ format::r8g8b8a8_unorm,     format::b5g6r5_unorm },
+		{ format::r16g16b16a16_unorm, format::r8g8b8a8_unorm },
+	};
+
+	std::vector<uint8_t> src(npixels * 16), dst(npixels * 16);
+	uint32_t seed = 1;
+	for (auto& b : src)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		b = uint8_t(seed >> 24) & 0x3f; // keep halfs and floats in a normal range
+	}
+
+	for (const auto& t : kTests)
+	{
+		const uint32_t src_pitch = kDimensions.x * element_size(t.src);
+		const uint32_t dst_pitch = kDimensions.x * element_size(t.dst);
+
+		mapped_subresource mdst;
+		mdst.data = dst.data();
+		mdst.row_pitch = dst_pitch;
+		mdst.depth_pitch = dst_pitch * kDimensions.y;
+
+		const_mapped_subresource msrc;
+		msrc.data = src.data();
+		msrc.row_pitch = src_pitch;
+		msrc.depth_pitch = src_pitch * kDimensions.y;
+
+		char label[64];
+		snprintf(label, "%s -> %s", as_string(t.src), as_string(t.dst));
+		srv.trace_rate(label, mpix, "MPix", srv.best_seconds(1, [&] { convert_formatted(mdst, t.dst, msrc, t.src, uint3(kDimensions, 1)); }));
+	}
+
+	srv.status("%ux%u conversions, see trace for MPix/s per pair", kDimensions.x, kDimensions.y);
+}
@@ -146,3 +146,100 @@ oTEST(oSurface_surface_generate_mips)
 	image = load_test_cube(srv);
 	test_mipchain_layouts(srv, image, kFilter, 18);
 }
+
+static float alpha_coverage(surface::image& img, uint32_t subresource, uint8_t ref)
+{
+	surface::shared_lock lock(img, subresource);
+	uint32_t passing = 0;
+	for (uint32_t y = 0; y < lock.byte_dimensions.y; y++)
+	{
+		const uint8_t* row = (const uint8_t*)byte_add(lock.mapped.data, y * lock.mapped.row_pitch);
+		for (uint32_t x = 3; x < lock.byte_dimensions.x; x += 4)
+			passing += row[x] > ref;
+	}
+	return passing / float(lock.byte_dimensions.y * lock.byte_dimensions.x / 4);
+}
+
+oTEST(oSurface_surface_generate_mips_srgb_alpha)
+{
+	surface::info_t si;
+	si.dimensions = uint3(64, 64, 1);
+	si.mip_layout = surface::mip_layout::tight;
+
+	// a black/white checkerboard averages to 50% linear, which is ~188 in sRGB 
+	// rather than the 128 a gamma-unaware average would give
+	{
+		si.format = surface::format::r8g8b8a8_unorm_srgb;
+		surface::image img(si);
+		{
+			surface::lock_guard lock(img);
+			for (uint32_t y = 0; y < si.dimensions.y; y++)
+			{
+				uint32_t* row = (uint32_t*)byte_add(lock.mapped.data, y * lock.mapped.row_pitch);
+				for (uint32_t x = 0; x < si.dimensions.x; x++)
+					row[x] = ((x ^ y) & 1) ? 0xffffffff : 0xff000000;
+			}
+		}
+
+		img.generate_mips(surface::filter::box);
+
+		surface::shared_lock lock(img, 1);
+		const uint8_t* texel = (const uint8_t*)lock.mapped.data;
+		oCHECK(abs(int(texel[0]) - 188) <= 1 && texel[3] == 255, "srgb mip should be filtered in linear space (got %u, alpha %u)", texel[0], texel[3]);
+	}
+
+	// sparse opaque texels over mostly-transparent ones average out below the 
+	// reference as they're filtered down, so coverage should only hold up when
+	// it's preserved
+	{
+		si.format = surface::format::b8g8r8a8_unorm;
+		surface::image img(si);
+		{
+			surface::lock_guard lock(img);
+			uint32_t seed = 1;
+			for (uint32_t y = 0; y < si.dimensions.y; y++)
+			{
+				uint32_t* row = (uint32_t*)byte_add(lock.mapped.data, y * lock.mapped.row_pitch);
+				for (uint32_t x = 0; x < si.dimensions.x; x++)
+				{
+					seed = seed * 1664525u + 1013904223u;
+					const uint32_t r = seed >> 8;
+					const uint32_t alpha = (r % 5) == 0 ? 255 : (r >> 4) % 101;
+					row[x] = (alpha << 24) | 0x00ff00;
+				}
+			}
+		}
+
+		surface::image plain(si);
+		plain.copy_from(0, img, 0);
+
+		const float ref = 0.5f;
+		const uint8_t ref8 = 128;
+		img.generate_mips(surface::filter::box, ref);
+		plain.generate_mips(surface::filter::box);
+
+		const float coverage0 = alpha_coverage(img, 0, ref8);
+		for (uint32_t mip = 1; mip < 4; mip++)
+		{
+			const float coverage = alpha_coverage(img, mip, ref8);
+			oCHECK(fabs(coverage - coverage0) < 0.05f, "mip %u alpha coverage %.3f should be close to mip 0's %.3f", mip, coverage, coverage0);
+		}
+
+		oCHECK(alpha_coverage(plain, 2, ref8) < coverage0 * 0.5f, "alpha should thin out without coverage preservation");
+	}
+}
+
+oBENCHMARK(oSurface_surface_generate_mips_benchmark)
+{
+	surface::info_t si;
+	si.format = surface::format::b8g8r8a8_unorm;
+	si.mip_layout = surface::mip_layout::tight;
+	si.dimensions = uint3(4096, 4096, 1);
+	surface::image img(si);
+	img.clear();
+
+	const double box_seconds = srv.best_seconds(1, [&] { img.generate_mips(surface::filter::box); });
+	const double lanczos_seconds = srv.best_seconds(1, [&] { img.generate_mips(surface::filter::lanczos2); });
+
+	srv.status("4096x4096 mip chain: box %.2f ms, lanczos2 %.2f ms", box_seconds * 1000.0, lanczos_seconds * 1000.0);
+}
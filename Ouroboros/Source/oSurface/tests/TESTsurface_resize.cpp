@@ -3,8 +3,10 @@
 #include <oBase/unit_test.h>
 
 #include <oBase/scoped_timer.h>
+#include <oCore/timer.h>
 #include <oSurface/resize.h>
 #include <oSurface/codec.h>
+#include <atomic>
 #include <vector>
 
 using namespace ouro;
@@ -39,6 +41,30 @@ static void TESTsurface_resize_test_filter(unit_test::services& srv
 	TESTsurface_resize_test_size(srv, _Buffer, _Filter, _Buffer.info().dimensions / int3(2,2,1), _NthImage+1);
 }
 
+static std::atomic<uint32_t> s_num_scratch_allocations;
+static void* scratch_allocate(size_t bytes, const char* label, const allocate_options& options) { s_num_scratch_allocations++; return default_allocate(bytes, label, options); }
+
+// scratch memory should come from the specified allocator without changing the result
+static void TESTsurface_resize_scratch(unit_test::services& srv, const surface::image& _Buffer)
+{
+	auto srcInfo = _Buffer.info();
+	auto destInfo = srcInfo;
+	destInfo.dimensions = srcInfo.dimensions * int3(3,2,1) / int3(2,3,1);
+	surface::image dst(destInfo), dst2(destInfo);
+	{
+		surface::shared_lock lock(_Buffer);
+		surface::lock_guard lock2(dst);
+		surface::lock_guard lock3(dst2);
+
+		s_num_scratch_allocations = 0;
+		surface::resize(srcInfo, lock.mapped, destInfo, lock2.mapped, surface::filter::lanczos3);
+		surface::resize(srcInfo, lock.mapped, destInfo, lock3.mapped, surface::filter::lanczos3, allocator(scratch_allocate, default_deallocate));
+		oCHECK(s_num_scratch_allocations > 0, "scratch allocator was not used");
+	}
+
+	oCHECK(surface::calc_rms(dst, dst2) == 0.0f, "resize results differ with a different scratch allocator");
+}
+
 oTEST(oSurface_surface_resize)
 {
 	auto b = srv.load_buffer("Test/Textures/lena_1.png");
@@ -50,4 +76,43 @@ oTEST(oSurface_surface_resize)
 		TESTsurface_resize_test_filter(srv, s, (surface::filter)i, NthImage);
 		NthImage += 2;
 	}
+
+	TESTsurface_resize_scratch(srv, s);
+}
+
+// the asset pipeline's common case: 4K down to 1080p with lanczos3
+oBENCHMARK(oSurface_surface_resize_benchmark)
+{
+	surface::info_t si;
+	si.format = surface::format::b8g8r8a8_unorm;
+	si.mip_layout = surface::mip_layout::none;
+	si.dimensions = uint3(3840, 2160, 1);
+	surface::image src(si);
+
+	// a flat image should stay exactly flat through the fixed-point weights
+	{
+		surface::lock_guard lock(src);
+		for (uint32_t y = 0; y < si.dimensions.y; y++)
+			memset(byte_add(lock.mapped.data, y * lock.mapped.row_pitch), 0x7f, si.dimensions.x * 4);
+	}
+
+	auto di = si;
+	di.dimensions = uint3(1920, 1080, 1);
+	surface::image dst(di);
+
+	double seconds = 0.0;
+	{
+		surface::shared_lock lock(src);
+		surface::lock_guard lock2(dst);
+		seconds = srv.best_seconds(1, [&] { surface::resize(si, lock.mapped, di, lock2.mapped, surface::filter::lanczos3); });
+
+		for (uint32_t y = 0; y < di.dimensions.y; y++)
+		{
+			const uint8_t* row = (const uint8_t*)byte_add(lock2.mapped.data, y * lock2.mapped.row_pitch);
+			for (uint32_t x = 0; x < di.dimensions.x * 4; x++)
+				oCHECK(row[x] == 0x7f, "resizing a flat image changed its value at (%u,%u)", x / 4, y);
+		}
+	}
+
+	srv.status("3840x2160 -> 1920x1080 lanczos3: %.2f ms (%.1f MPix/s)", seconds * 1000.0, (3840.0 * 2160.0) / seconds / 1e6);
 }
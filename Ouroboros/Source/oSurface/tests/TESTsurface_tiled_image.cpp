@@ -0,0 +1,211 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+#include <oBase/unit_test.h>
+
+#include <oSurface/image.h>
+#include <oSurface/tiled_image.h>
+#include <atomic>
+#include <vector>
+
+using namespace ouro;
+using namespace ouro::surface;
+
+static std::atomic<int> s_num_committed;
+static void* counting_commit(void* tile, size_t bytes) { s_num_committed++; return heap_tile_storage.commit(tile, bytes); }
+static void counting_decommit(void* tile, size_t bytes) { s_num_committed--; heap_tile_storage.decommit(tile, bytes); }
+static const tile_storage counting_storage = { nullptr, nullptr, counting_commit, counting_decommit, 64 };
+
+static uint32_t texel(uint32_t subresource, uint32_t x, uint32_t y)
+{
+	return (subresource << 28) ^ (y << 14) ^ x ^ 0x5a5a5a5a;
+}
+
+// fills every subresource of an r32_uint image with a pattern that identifies each texel
+static image make_reference(const info_t& info)
+{
+	image img(info);
+	const uint32_t n = num_subresources(info);
+	for (uint32_t s = 0; s < n; s++)
+	{
+		lock_guard lock(img, s);
+		const uint2 dim = subresourceinfo(info, s).dimensions.xy();
+		for (uint32_t y = 0; y < dim.y; y++)
+		{
+			uint32_t* row = (uint32_t*)byte_add(lock.mapped.data, y * lock.mapped.row_pitch);
+			for (uint32_t x = 0; x < dim.x; x++)
+				row[x] = texel(s, x, y);
+		}
+	}
+	return img;
+}
+
+// returns the number of texels in box that don't match the pattern (or 0 if zero is true)
+static uint32_t count_mismatches(const tiled_image& tiled, uint32_t subresource, const box_t& box, bool zero = false)
+{
+	std::vector<uint32_t> texels(box.width() * box.height(), 0xcdcdcdcd);
+	mapped_subresource dst;
+	dst.data = texels.data();
+	dst.row_pitch = box.width() * sizeof(uint32_t);
+	dst.depth_pitch = uint32_t(texels.size() * sizeof(uint32_t));
+	tiled.copy_to(subresource, box, dst);
+
+	uint32_t nmismatches = 0;
+	for (uint32_t y = 0; y < box.height(); y++)
+		for (uint32_t x = 0; x < box.width(); x++)
+			if (texels[y * box.width() + x] != (zero ? 0 : texel(subresource, box.left + x, box.top + y)))
+				nmismatches++;
+	return nmismatches;
+}
+
+static void test_paging(unit_test::services& srv)
+{
+	info_t info;
+	info.format = format::r32_uint;
+	info.mip_layout = mip_layout::right;
+	info.dimensions = uint3(1000, 700, 1);
+	const image ref = make_reference(info);
+
+	const_mapped_subresource bits;
+	ref.map_const(0, &bits); // subresource 0 starts at the front of the image's bits
+	ref.unmap_const(0);
+
+	tiled_image::init_t init;
+	init.info = info;
+	init.tile_dimensions = uint2(64, 64);
+	init.storage = counting_storage;
+	init.loader = image_tile_loader(info, bits.data);
+
+	s_num_committed = 0;
+	{
+		tiled_image tiled(init);
+		oCHECK(tiled.num_tiles() > 16 * 11, "a mip chain should have more tiles than the top mip");
+
+		// a small box in the middle touches only the tiles under it
+		oCHECK(count_mismatches(tiled, 0, box_t(60, 70, 120, 130)) == 0, "paged in texels are wrong");
+		oCHECK(tiled.num_resident_tiles() == 4 && s_num_committed == 4, "%u tiles resident, expected 4", tiled.num_resident_tiles());
+
+		// every mip pages in correctly, including partial tiles at the edges
+		const uint32_t n = num_subresources(info);
+		for (uint32_t s = 0; s < n; s++)
+		{
+			const uint2 dim = subresourceinfo(info, s).dimensions.xy();
+			oCHECK(count_mismatches(tiled, s, box_t(0, dim.x, 0, dim.y)) == 0, "subresource %u is wrong", s);
+		}
+		oCHECK(tiled.num_resident_tiles() == tiled.num_tiles(), "everything read should be resident without a budget");
+	}
+	oCHECK(s_num_committed == 0, "%d tiles leaked", int(s_num_committed));
+
+	// a budget of 6 tiles can still read the whole top mip
+	init.residency_budget = 6 * 64 * 64 * sizeof(uint32_t);
+	{
+		tiled_image tiled(init);
+		oCHECK(count_mismatches(tiled, 0, box_t(0, 1000, 0, 700)) == 0, "reading in batches is wrong");
+		oCHECK(tiled.resident_bytes() <= init.residency_budget, "%u bytes resident is over budget", uint32_t(tiled.resident_bytes()));
+
+		// recently used tiles stay and the oldest go
+		count_mismatches(tiled, 0, box_t(0, 1, 0, 1));
+		count_mismatches(tiled, 0, box_t(999, 1000, 699, 700));
+		oCHECK(tiled.num_resident_tiles() <= 6, "budget was exceeded");
+	}
+	oCHECK(s_num_committed == 0, "%d tiles leaked", int(s_num_committed));
+}
+
+static void test_writes(unit_test::services& srv)
+{
+	info_t info;
+	info.format = format::r32_uint;
+	info.dimensions = uint3(300, 200, 1);
+	const image ref = make_reference(info);
+	shared_lock lock(ref);
+
+	tiled_image::init_t init;
+	init.info = info;
+	init.tile_dimensions = uint2(32, 32);
+	init.storage = counting_storage;
+
+	s_num_committed = 0;
+	tiled_image tiled(init);
+
+	// reading what was never written is 0 and doesn't commit anything
+	oCHECK(count_mismatches(tiled, 0, box_t(0, 300, 0, 200), true) == 0, "unwritten texels should be 0");
+	oCHECK(s_num_committed == 0, "reading unwritten tiles committed %d", int(s_num_committed));
+
+	// writing commits only what's written and keeps the rest of each tile 0
+	const box_t box(40, 100, 10, 50);
+	const_mapped_subresource src = lock.mapped;
+	src.data = byte_add(lock.mapped.data, box.top * lock.mapped.row_pitch + box.left * sizeof(uint32_t));
+	tiled.update_subresource(0, box, src);
+	oCHECK(s_num_committed == 3 * 2, "writing 3x2 tiles committed %d", int(s_num_committed));
+	oCHECK(count_mismatches(tiled, 0, box) == 0, "written texels are wrong");
+	oCHECK(count_mismatches(tiled, 0, box_t(32, 40, 0, 64), true) == 0, "texels next to the write should still be 0");
+
+	// written tiles can't be evicted without a store
+	tiled.evict_all();
+	oCHECK(count_mismatches(tiled, 0, box) == 0, "written texels were lost");
+
+	// map visits each tile once with texels relative to the tile
+	std::atomic<uint32_t> nvisited(0);
+	tiled.map(0, box_t(0, 300, 0, 200), tile_access::write, [&](uint32_t subresource, const tile_info& tile, const mapped_subresource& mapped)
+	{
+		for (uint32_t y = 0; y < tile.dimensions.y; y++)
+		{
+			uint32_t* row = (uint32_t*)byte_add(mapped.data, y * mapped.row_pitch);
+			for (uint32_t x = 0; x < tile.dimensions.x; x++)
+				row[x] = texel(subresource, tile.position.x + x, tile.position.y + y);
+		}
+		nvisited++;
+	});
+	oCHECK(nvisited == tiled.num_tiles(), "visited %u of %u tiles", uint32_t(nvisited), tiled.num_tiles());
+	oCHECK(count_mismatches(tiled, 0, box_t(0, 300, 0, 200)) == 0, "texels written through map are wrong");
+}
+
+// written tiles are stored before eviction and loaded again after
+static void test_store(unit_test::services& srv)
+{
+	info_t info;
+	info.format = format::r32_uint;
+	info.dimensions = uint3(256, 256, 1);
+	image backing(info);
+	{
+		lock_guard lock(backing);
+		memset(lock.mapped.data, 0, lock.mapped.depth_pitch);
+	}
+
+	const_mapped_subresource bits;
+	backing.map_const(0, &bits);
+	backing.unmap_const(0);
+	void* backing_bits = (void*)bits.data;
+
+	std::atomic<uint32_t> nstored(0);
+	tiled_image::init_t init;
+	init.info = info;
+	init.tile_dimensions = uint2(64, 64);
+	init.residency_budget = 2 * 64 * 64 * sizeof(uint32_t);
+	init.loader = image_tile_loader(info, backing_bits);
+	init.store = [&](uint32_t subresource, const tile_info& tile, const const_mapped_subresource& mapped)
+	{
+		uint8_t* dst = (uint8_t*)backing_bits + tile.position.y * 256 * sizeof(uint32_t) + tile.position.x * sizeof(uint32_t);
+		for (uint32_t y = 0; y < tile.dimensions.y; y++)
+			memcpy(dst + y * 256 * sizeof(uint32_t), byte_add(mapped.data, y * mapped.row_pitch), tile.dimensions.x * sizeof(uint32_t));
+		nstored++;
+	};
+
+	tiled_image tiled(init);
+	const image ref = make_reference(info);
+	{
+		shared_lock lock(ref);
+		tiled.update_subresource(0, box_t(0, 256, 0, 256), lock.mapped);
+	}
+
+	oCHECK(tiled.num_resident_tiles() <= 2, "budget was exceeded with a store");
+	tiled.evict_all();
+	oCHECK(tiled.num_resident_tiles() == 0 && nstored == 16, "stored %u of 16 tiles", uint32_t(nstored));
+	oCHECK(count_mismatches(tiled, 0, box_t(0, 256, 0, 256)) == 0, "stored tiles didn't load back");
+}
+
+oTEST(oSurface_surface_tiled_image)
+{
+	test_paging(srv);
+	test_writes(srv);
+	test_store(srv);
+}
@@ -3,6 +3,7 @@
 #include <oSurface/codec.h>
 #include <oSurface/convert.h>
 #include "tga.h"
+#include "row_codec.h"
 
 namespace ouro { namespace surface {
 
@@ -36,30 +37,89 @@ info_t get_info_tga(const void* buffer, size_t size)
 	return si;
 }
 
+// rows are stored bottom-up and unpadded
+class tga_row_decoder : public detail::row_decoder
+{
+public:
+	tga_row_decoder() : bits_(nullptr) {}
+
+	void initialize(const void* buffer, size_t size, const allocator& temp_alloc)
+	{
+		info_ = get_info_tga(buffer, size);
+		oCheck(info_.format != format::unknown, std::errc::invalid_argument, "invalid tga buffer");
+		oCheck(sizeof(tga_header) + size_t(element_size(info_.format)) * info_.dimensions.x * info_.dimensions.y <= size, std::errc::invalid_argument, "truncated tga buffer");
+		bits_ = (const uint8_t*)buffer + sizeof(tga_header);
+	}
+
+	void read(const mapped_subresource& dst, uint32_t num_rows) override
+	{
+		const uint32_t row_bytes = element_size(info_.format) * info_.dimensions.x;
+		for (uint32_t y = 0; y < num_rows; y++, row_++)
+			memcpy(byte_add(dst.data, y * dst.row_pitch), bits_ + (info_.dimensions.y - 1 - row_) * row_bytes, row_bytes);
+	}
+
+private:
+	const uint8_t* bits_;
+};
+
+class tga_row_encoder : public detail::row_encoder
+{
+public:
+	tga_row_encoder() : bits_(nullptr) {}
+
+	void initialize(const info_t& info, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
+	{
+		oCheck(compression == compression::none, std::errc::not_supported, "compression not supported");
+		oCheck(info.format == format::b8g8r8a8_unorm || info.format == format::b8g8r8_unorm, std::errc::invalid_argument, "source must be b8g8r8a8_unorm or b8g8r8_unorm");
+		oCheck(info.dimensions.x <= 0xffff && info.dimensions.y <= 0xffff, std::errc::invalid_argument, "dimensions must be <= 65535");
+
+		info_ = info;
+
+		tga_header h = {0};
+		h.data_type_field = tga_data_type_field::rgb;
+		h.bpp = (uint8_t)bits(info.format);
+		h.width = (uint16_t)info.dimensions.x;
+		h.height = (uint16_t)info.dimensions.y;
+
+		const size_t size = sizeof(tga_header) + h.width * h.height * (h.bpp/8);
+
+		file_ = file_alloc.scoped_allocate(size, "encoded tga");
+		memcpy(file_, &h, sizeof(tga_header));
+		bits_ = (uint8_t*)file_ + sizeof(tga_header);
+	}
+
+	void write(const const_mapped_subresource& src, uint32_t num_rows) override
+	{
+		const uint32_t row_bytes = element_size(info_.format) * info_.dimensions.x;
+		for (uint32_t y = 0; y < num_rows; y++, row_++)
+			memcpy(bits_ + (info_.dimensions.y - 1 - row_) * row_bytes, byte_add(src.data, y * src.row_pitch), row_bytes);
+	}
+
+	blob finish() override { return std::move(file_); }
+
+private:
+	blob file_;
+	uint8_t* bits_;
+};
+
+detail::row_decoder* new_row_decoder_tga(const void* buffer, size_t size, const allocator& temp_alloc)
+{
+	return detail::new_row_codec<tga_row_decoder>(temp_alloc, "tga row decoder", buffer, size, temp_alloc);
+}
+
+detail::row_encoder* new_row_encoder_tga(const info_t& info, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
+{
+	return detail::new_row_codec<tga_row_encoder>(temp_alloc, "tga row encoder", info, file_alloc, temp_alloc, compression);
+}
+
 blob encode_tga(const image& img, const allocator& file_alloc, const allocator& temp_alloc, const compression& compression)
 {
-	oCheck(compression == compression::none, std::errc::not_supported, "compression not supported");
 	auto info = img.info();
-	oCheck(info.format == format::b8g8r8a8_unorm || info.format == format::b8g8r8_unorm, std::errc::invalid_argument, "source must be b8g8r8a8_unorm or b8g8r8_unorm");
-	oCheck(info.dimensions.x <= 0xffff && info.dimensions.y <= 0xffff, std::errc::invalid_argument, "dimensions must be <= 65535");
-
-	tga_header h = {0};
-	h.data_type_field = tga_data_type_field::rgb;
-	h.bpp = (uint8_t)bits(info.format);
-	h.width = (uint16_t)info.dimensions.x;
-	h.height = (uint16_t)info.dimensions.y;
-
-	const size_t size = sizeof(tga_header) + h.width * h.height * (h.bpp/8);
-
-	blob p = file_alloc.scoped_allocate(size, "encoded tga");
-	memcpy(p, &h, sizeof(tga_header));
-	mapped_subresource dst;
-	dst.data = ((uint8_t*)p + sizeof(tga_header));
-	dst.row_pitch = element_size(info.format) * h.width;
-	dst.depth_pitch = dst.row_pitch * h.height;
-
-	img.copy_to(0, dst, copy_option::flip_vertically);
-	return p;
+	tga_row_encoder e;
+	e.initialize(info, file_alloc, temp_alloc, compression);
+	shared_lock lock(img);
+	e.write(lock.mapped, info.dimensions.y);
+	return e.finish();
 }
 
 image decode_tga(const void* buffer, size_t size, const allocator& texel_alloc, const allocator& temp_alloc, const mip_layout& layout)
@@ -49,7 +49,7 @@ static uint32_t best_fit_mip_level(const info_t& info, const uint2& tile_dimensi
 	auto mip = info.dimensions;
 	while (any(mip != uint3(1)))
 	{
-		if (all(info.dimensions.xy() <= tile_dimensions))
+		if (all(mip.xy() <= tile_dimensions))
 			break;
 
 		nth++;
@@ -130,26 +130,23 @@ tile_info get_tile(const info_t& info, const uint2& tile_dimensions, uint32_t ti
 	auto num_tiles_per_slice = num_slice_tiles(info, tile_dimensions);
 	tileinf.dimensions = tile_dimensions;
 	tileinf.array_slice = tileid / num_tiles_per_slice;
-	oSURF_CHECK(::max(1u, tileinf.array_slice) < info.safe_array_size(), "TileID is out of range for the specified mip dimensions");
+	oSURF_CHECK(tileinf.array_slice < info.safe_array_size(), "TileID is out of range for the specified mip dimensions");
 
 	uint32_t firstTileInMip = 0;
 	auto mip_dim = info.dimensions;
 	tileinf.mip_level = 0;
 	uint32_t nthTileIntoSlice = tileid % num_tiles_per_slice; 
 
-	if (nthTileIntoSlice > 0)
+	// walk mips until the one containing the tile
+	while (nthTileIntoSlice >= firstTileInMip + num_tiles(mip_dim, tile_dimensions))
 	{
-		do 
-		{
-			mip_dim = dimensions(info.format, info.dimensions, ++tileinf.mip_level);
-			firstTileInMip += num_tiles(mip_dim, tile_dimensions);
-
-		} while (nthTileIntoSlice < firstTileInMip);
+		firstTileInMip += num_tiles(mip_dim, tile_dimensions);
+		mip_dim = dimensions(info.format, info.dimensions, ++tileinf.mip_level);
 	}
 	
 	auto tileOffsetFromMipStart = nthTileIntoSlice - firstTileInMip;
 	auto mip_tile_dim = dimensions_in_tiles(mip_dim, tile_dimensions);
-	auto positionInTiles = uint2(tileOffsetFromMipStart % mip_tile_dim.x, tileOffsetFromMipStart / mip_tile_dim.y);
+	auto positionInTiles = uint2(tileOffsetFromMipStart % mip_tile_dim.x, tileOffsetFromMipStart / mip_tile_dim.x);
 	tileinf.position = positionInTiles * tile_dimensions;
 	return tileinf;
 }
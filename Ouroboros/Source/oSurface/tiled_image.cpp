@@ -0,0 +1,472 @@
+// Copyright (c) 2016 Antony Arciuolo. See License.txt regarding use.
+
+#include <oSurface/tiled_image.h>
+#include <oConcurrency/concurrency.h>
+#include <oMemory/allocate.h>
+#include <oMemory/memory.h>
+#include <algorithm>
+
+namespace ouro { namespace surface {
+
+static void* heap_commit(void* tile, size_t bytes)
+{
+	return default_allocate(bytes, "tile", allocate_options(memory_alignment::align64));
+}
+
+static void heap_decommit(void* tile, size_t bytes)
+{
+	default_deallocate(tile);
+}
+
+const tile_storage heap_tile_storage = { nullptr, nullptr, heap_commit, heap_decommit, 64 };
+
+tile_fn image_tile_loader(const info_t& info, const void* bits)
+{
+	return [=](uint32_t subresource, const tile_info& tile, const mapped_subresource& mapped)
+	{
+		const uint32_t elsize = element_size(info.format);
+		const auto src = map_const_subresource(info, subresource, bits);
+		const uint8_t* s = (const uint8_t*)src.data + tile.position.y * src.row_pitch + tile.position.x * elsize;
+		memcpy2d(mapped.data, mapped.row_pitch, s, src.row_pitch, tile.dimensions.x * elsize, tile.dimensions.y);
+	};
+}
+
+tiled_image::tiled_image(tiled_image&& that)
+	: base_(nullptr)
+	, tile_bytes_(0)
+	, tile_pitch_(0)
+	, resident_bytes_(0)
+	, lru_head_(nil)
+	, lru_tail_(nil)
+{
+	operator=(std::move(that));
+}
+
+tiled_image& tiled_image::operator=(tiled_image&& that)
+{
+	if (this != &that)
+	{
+		deinitialize();
+		lock_t lock(that.mtx_);
+		init_ = std::move(that.init_);
+		first_tile_ = std::move(that.first_tile_);
+		pages_ = std::move(that.pages_);
+		base_ = that.base_; that.base_ = nullptr;
+		tile_bytes_ = that.tile_bytes_;
+		tile_pitch_ = that.tile_pitch_;
+		resident_bytes_ = that.resident_bytes_; that.resident_bytes_ = 0;
+		lru_head_ = that.lru_head_; that.lru_head_ = nil;
+		lru_tail_ = that.lru_tail_; that.lru_tail_ = nil;
+	}
+
+	return *this;
+}
+
+void tiled_image::initialize(const init_t& init)
+{
+	deinitialize();
+
+	const auto& info = init.info;
+	oCheck(!is_planar(info.format) && !is_block_compressed(info.format) && element_size(info.format), std::errc::not_supported, "%s not supported", as_string(info.format));
+	oCheck(info.dimensions.z <= 1, std::errc::not_supported, "3d surfaces not supported");
+	oCheck(all(init.tile_dimensions != uint2(0, 0)), std::errc::invalid_argument, "invalid tile dimensions");
+	oCheck(init.storage.commit && init.storage.decommit && !(init.storage.reserve && !init.storage.unreserve), std::errc::invalid_argument, "incomplete tile storage");
+
+	const uint32_t nsubresources = num_subresources(info);
+	first_tile_.resize(nsubresources + 1);
+	uint32_t ntiles = 0;
+	for (uint32_t i = 0; i < nsubresources; i++)
+	{
+		first_tile_[i] = ntiles;
+		ntiles += surface::num_tiles(subresourceinfo(info, i).dimensions.xy(), init.tile_dimensions);
+	}
+	first_tile_[nsubresources] = ntiles;
+
+	tile_pitch_ = init.tile_dimensions.x * element_size(info.format);
+	tile_bytes_ = align(size_t(tile_pitch_) * init.tile_dimensions.y, std::max(init.storage.alignment, size_t(1)));
+
+	if (init.storage.reserve)
+	{
+		base_ = init.storage.reserve(tile_bytes_ * ntiles);
+		if (!base_)
+			oThrow(std::errc::not_enough_memory, "failed to reserve %u tiles", ntiles);
+	}
+
+	init_ = init;
+	pages_.resize(ntiles);
+}
+
+void tiled_image::deinitialize()
+{
+	lock_t lock(mtx_);
+
+	for (auto& p : pages_)
+		if (p.bits)
+			init_.storage.decommit(p.bits, tile_bytes_);
+
+	if (base_)
+		init_.storage.unreserve(base_);
+
+	base_ = nullptr;
+	pages_.clear();
+	first_tile_.clear();
+	resident_bytes_ = 0;
+	lru_head_ = lru_tail_ = nil;
+}
+
+uint32_t tiled_image::num_resident_tiles() const
+{
+	lock_t lock(mtx_);
+	return tile_bytes_ ? uint32_t(resident_bytes_ / tile_bytes_) : 0;
+}
+
+size_t tiled_image::resident_bytes() const
+{
+	lock_t lock(mtx_);
+	return resident_bytes_;
+}
+
+tiled_image::tile_ref tiled_image::ref(uint32_t id) const
+{
+	const uint32_t subresource = uint32_t(std::upper_bound(first_tile_.begin(), first_tile_.end(), id) - first_tile_.begin()) - 1;
+	const auto si = subresourceinfo(init_.info, subresource);
+	const uint2 ts = init_.tile_dimensions;
+	const uint2 mip_tiles = dimensions_in_tiles(si.dimensions.xy(), ts);
+	const uint32_t local = id - first_tile_[subresource];
+
+	tile_ref t;
+	t.id = id;
+	t.subresource = subresource;
+	t.info.position = uint2(local % mip_tiles.x, local / mip_tiles.x) * ts;
+	t.info.dimensions = min(ts, si.dimensions.xy() - t.info.position);
+	t.info.mip_level = si.mip_level;
+	t.info.array_slice = si.array_slice;
+	t.covered = false;
+	return t;
+}
+
+void tiled_image::tiles(uint32_t subresource, const box_t& box, std::vector<tile_ref>* out_tiles) const
+{
+	out_tiles->clear();
+	oCheck(subresource + 1 < (uint32_t)first_tile_.size(), std::errc::invalid_argument, "invalid subresource %u", subresource);
+
+	const auto si = subresourceinfo(init_.info, subresource);
+	const uint2 mip = si.dimensions.xy();
+	const uint32_t left = min(box.left, mip.x), right = min(box.right, mip.x);
+	const uint32_t top = min(box.top, mip.y), bottom = min(box.bottom, mip.y);
+	if (left >= right || top >= bottom)
+		return;
+
+	const uint2 ts = init_.tile_dimensions;
+	const uint32_t ntiles_x = dimensions_in_tiles(mip, ts).x;
+	const uint2 first(left / ts.x, top / ts.y);
+	const uint2 last((right - 1) / ts.x, (bottom - 1) / ts.y);
+
+	for (uint32_t ty = first.y; ty <= last.y; ty++)
+		for (uint32_t tx = first.x; tx <= last.x; tx++)
+		{
+			tile_ref t;
+			t.id = first_tile_[subresource] + ty * ntiles_x + tx;
+			t.subresource = subresource;
+			t.info.position = uint2(tx, ty) * ts;
+			t.info.dimensions = min(ts, mip - t.info.position);
+			t.info.mip_level = si.mip_level;
+			t.info.array_slice = si.array_slice;
+			t.covered = left <= t.info.position.x && right >= t.info.position.x + t.info.dimensions.x
+				&& top <= t.info.position.y && bottom >= t.info.position.y + t.info.dimensions.y;
+			out_tiles->push_back(t);
+		}
+}
+
+mapped_subresource tiled_image::mapped(uint32_t id) const
+{
+	mapped_subresource m;
+	m.data = pages_[id].bits;
+	m.row_pitch = tile_pitch_;
+	m.depth_pitch = tile_pitch_ * init_.tile_dimensions.y;
+	return m;
+}
+
+void tiled_image::lru_remove(uint32_t id)
+{
+	page& p = pages_[id];
+	if (p.prev != nil) pages_[p.prev].next = p.next; else lru_head_ = p.next;
+	if (p.next != nil) pages_[p.next].prev = p.prev; else lru_tail_ = p.prev;
+	p.prev = p.next = nil;
+}
+
+void tiled_image::lru_push_front(uint32_t id)
+{
+	page& p = pages_[id];
+	p.prev = nil;
+	p.next = lru_head_;
+	if (lru_head_ != nil) pages_[lru_head_].prev = id;
+	lru_head_ = id;
+	if (lru_tail_ == nil) lru_tail_ = id;
+}
+
+bool tiled_image::evict(uint32_t id)
+{
+	page& p = pages_[id];
+	if (!p.bits || p.pins || (p.dirty && !init_.store))
+		return false;
+
+	if (p.dirty)
+	{
+		const tile_ref t = ref(id);
+		const mapped_subresource m = mapped(id);
+		init_.store(t.subresource, t.info, (const const_mapped_subresource&)m);
+	}
+
+	lru_remove(id);
+	init_.storage.decommit(p.bits, tile_bytes_);
+	p.bits = nullptr;
+	p.dirty = false;
+	resident_bytes_ -= tile_bytes_;
+	return true;
+}
+
+void tiled_image::enforce_budget()
+{
+	if (!init_.residency_budget)
+		return;
+
+	uint32_t id = lru_tail_;
+	while (resident_bytes_ > init_.residency_budget && id != nil)
+	{
+		const uint32_t prev = pages_[id].prev;
+		evict(id);
+		id = prev;
+	}
+}
+
+void tiled_image::acquire(unique_lock_t& lock, const tile_ref* refs, uint32_t num_refs, const tile_access& access)
+{
+	// wait out anyone loading these before pinning any of them so two batches
+	// can't each hold a loading page the other is waiting on
+	loaded_.wait(lock, [&]
+	{
+		for (uint32_t i = 0; i < num_refs; i++)
+			if (pages_[refs[i].id].loading)
+				return false;
+		return true;
+	});
+
+	// commit and pin everything and mark what needs filling as loading, then
+	// fill those in parallel without the lock
+	std::vector<uint32_t> fill;
+
+	// throws away new tiles so they're tried again next time
+	auto abandon = [&](uint32_t num_pinned)
+	{
+		for (const auto& i : fill)
+			pages_[refs[i].id].dirty = false;
+		release(refs, num_pinned);
+		for (const auto& i : fill)
+			evict(refs[i].id);
+	};
+
+	for (uint32_t i = 0; i < num_refs; i++)
+	{
+		const tile_ref& t = refs[i];
+		page& p = pages_[t.id];
+		if (p.bits)
+			lru_remove(t.id);
+		else
+		{
+			void* reserved = base_ ? ((uint8_t*)base_ + t.id * tile_bytes_) : nullptr;
+			p.bits = init_.storage.commit(reserved, tile_bytes_);
+			if (!p.bits)
+			{
+				abandon(i);
+				oThrow(std::errc::not_enough_memory, "failed to commit tile %u", t.id);
+			}
+			resident_bytes_ += tile_bytes_;
+			if (access == tile_access::read || (access == tile_access::write && !t.covered))
+				fill.push_back(i);
+		}
+
+		lru_push_front(t.id);
+		p.pins++;
+		if (access != tile_access::read)
+			p.dirty = true;
+	}
+
+	if (!fill.empty())
+	{
+		// pinned pages aren't evicted and loading ones aren't acquired, so the
+		// tiles being filled are only touched here until they're published
+		for (const auto& i : fill)
+			pages_[refs[i].id].loading = true;
+
+		auto publish = [&]
+		{
+			for (const auto& i : fill)
+				pages_[refs[i].id].loading = false;
+			loaded_.notify_all();
+		};
+
+		lock.unlock();
+		try
+		{
+			parallel_for(0, fill.size(), [&](size_t i)
+			{
+				const tile_ref& t = refs[fill[i]];
+				const mapped_subresource m = mapped(t.id);
+				if (init_.loader)
+					init_.loader(t.subresource, t.info, m);
+				else
+					memset(m.data, 0, tile_bytes_);
+			});
+		}
+
+		catch (std::exception&)
+		{
+			lock.lock();
+			publish();
+			abandon(num_refs);
+			throw;
+		}
+
+		lock.lock();
+		publish();
+	}
+
+	enforce_budget();
+}
+
+void tiled_image::release(const tile_ref* refs, uint32_t num_refs)
+{
+	for (uint32_t i = 0; i < num_refs; i++)
+		pages_[refs[i].id].pins--;
+	enforce_budget();
+}
+
+void tiled_image::process(std::vector<tile_ref>& refs, const tile_access& access, const std::function<void(const tile_ref& t, const mapped_subresource& mapped)>& fn)
+{
+	// with a budget work in batches that fit so a region larger than memory
+	// can be visited
+	const size_t nbatch = init_.residency_budget ? std::max(init_.residency_budget / tile_bytes_, size_t(1)) : refs.size();
+	for (size_t b = 0; b < refs.size(); b += nbatch)
+	{
+		const tile_ref* batch = refs.data() + b;
+		const uint32_t n = uint32_t(std::min(nbatch, refs.size() - b));
+
+		{
+			unique_lock_t lock(mtx_);
+			acquire(lock, batch, n, access);
+		}
+
+		try
+		{
+			parallel_for(0, n, [&](size_t i)
+			{
+				fn(batch[i], mapped(batch[i].id));
+			});
+		}
+
+		catch (std::exception&)
+		{
+			lock_t lock(mtx_);
+			release(batch, n);
+			throw;
+		}
+
+		lock_t lock(mtx_);
+		release(batch, n);
+	}
+}
+
+void tiled_image::map(uint32_t subresource, const box_t& box, const tile_access& access, const tile_fn& fn)
+{
+	std::vector<tile_ref> refs;
+	tiles(subresource, box, &refs);
+
+	// the caller sees the whole tile so only discard says it's all overwritten
+	for (auto& t : refs)
+		t.covered = access == tile_access::write_discard;
+
+	process(refs, access, [&](const tile_ref& t, const mapped_subresource& m) { fn(t.subresource, t.info, m); });
+}
+
+void tiled_image::map_const(uint32_t subresource, const box_t& box, const const_tile_fn& fn) const
+{
+	// paging tiles in doesn't change the surface's contents
+	const_cast<tiled_image*>(this)->map(subresource, box, tile_access::read, [&](uint32_t subresource, const tile_info& tile, const mapped_subresource& m)
+	{
+		fn(subresource, tile, (const const_mapped_subresource&)m);
+	});
+}
+
+// returns the part of box in the tile in texels relative to the box's and the tile's upper left
+static void intersect(const box_t& box, const tile_info& tile, uint2* out_box_offset, uint2* out_tile_offset, uint2* out_dimensions)
+{
+	const uint2 lo = max(uint2(box.left, box.top), tile.position);
+	const uint2 hi = min(uint2(box.right, box.bottom), tile.position + tile.dimensions);
+	*out_box_offset = lo - uint2(box.left, box.top);
+	*out_tile_offset = lo - tile.position;
+	*out_dimensions = hi - lo;
+}
+
+void tiled_image::update_subresource(uint32_t subresource, const box_t& box, const const_mapped_subresource& src)
+{
+	std::vector<tile_ref> refs;
+	tiles(subresource, box, &refs);
+
+	const uint32_t elsize = element_size(init_.info.format);
+	process(refs, tile_access::write, [&](const tile_ref& t, const mapped_subresource& m)
+	{
+		uint2 box_offset, tile_offset, dim;
+		intersect(box, t.info, &box_offset, &tile_offset, &dim);
+		const uint8_t* s = (const uint8_t*)src.data + box_offset.y * src.row_pitch + box_offset.x * elsize;
+		uint8_t* d = (uint8_t*)m.data + tile_offset.y * m.row_pitch + tile_offset.x * elsize;
+		memcpy2d(d, m.row_pitch, s, src.row_pitch, dim.x * elsize, dim.y);
+	});
+}
+
+void tiled_image::copy_to(uint32_t subresource, const box_t& box, const mapped_subresource& dst) const
+{
+	auto& self = *const_cast<tiled_image*>(this);
+	const uint32_t elsize = element_size(init_.info.format);
+
+	std::vector<tile_ref> refs;
+	tiles(subresource, box, &refs);
+
+	// tiles that were never written and can't be loaded are 0 without committing
+	// them. Fill them before unlocking so a concurrent write to one of them
+	// isn't lost to a stale decision.
+	if (!init_.loader)
+	{
+		lock_t lock(mtx_);
+		auto absent = std::stable_partition(refs.begin(), refs.end(), [&](const tile_ref& t) { return !!pages_[t.id].bits; });
+		for (auto it = absent; it != refs.end(); ++it)
+		{
+			uint2 box_offset, tile_offset, dim;
+			intersect(box, it->info, &box_offset, &tile_offset, &dim);
+			memset2d((uint8_t*)dst.data + box_offset.y * dst.row_pitch + box_offset.x * elsize, dst.row_pitch, 0, dim.x * elsize, dim.y);
+		}
+		refs.erase(absent, refs.end());
+	}
+
+	self.process(refs, tile_access::read, [&](const tile_ref& t, const mapped_subresource& m)
+	{
+		uint2 box_offset, tile_offset, dim;
+		intersect(box, t.info, &box_offset, &tile_offset, &dim);
+		const uint8_t* s = (const uint8_t*)m.data + tile_offset.y * m.row_pitch + tile_offset.x * elsize;
+		memcpy2d((uint8_t*)dst.data + box_offset.y * dst.row_pitch + box_offset.x * elsize, dst.row_pitch, s, m.row_pitch, dim.x * elsize, dim.y);
+	});
+}
+
+void tiled_image::evict_all()
+{
+	lock_t lock(mtx_);
+	uint32_t id = lru_tail_;
+	while (id != nil)
+	{
+		const uint32_t prev = pages_[id].prev;
+		evict(id);
+		id = prev;
+	}
+}
+
+}}
@@ -186,6 +186,28 @@ void TESTfilesystem_async2(unit_test::services& services)
 	oCHECK(hash == sExpectedTestFileHash, "Test failed to compute correct hash" );
 }
 
+void TESTfilesystem_async_future(unit_test::services& srv)
+{
+	path_t TestPath = srv.root_path();
+	TestPath /= sTestFile;
+	oCheck(exists(TestPath), std::errc::no_such_file_or_directory, "not found: %s", TestPath.c_str());
+
+	future<uint128> hash = load_async(TestPath).then([](future<blob> f)
+	{
+		blob b = f.get();
+		return murmur3(b, static_cast<unsigned int>(b.size()));
+	});
+
+	oCHECK(hash.wait_for(std::chrono::seconds(10)) == future_status::ready, "timed out");
+	oCHECK(hash.get() == sExpectedTestFileHash, "Test failed to compute correct hash");
+
+	future<blob> missing = load_async(temp_path() / "TESTfilesystem_async_future_missing.bin");
+	bool caught = false;
+	try { missing.get(); }
+	catch (std::system_error&) { caught = true; }
+	oCHECK(caught, "loading a missing file should report an error through the future");
+}
+
 void TESTfilesystem_async_save(unit_test::services& services)
 {
 	const unsigned int TESTAsyncWrite[] = 
@@ -248,5 +270,6 @@ oTEST(oSystem_filesystem)
 	TESTfilesystem_map(srv);
 	TESTfilesystem_async1(srv);
 	TESTfilesystem_async2(srv);
+	TESTfilesystem_async_future(srv);
 	TESTfilesystem_async_save(srv);
 }
@@ -3,25 +3,37 @@
 #include <oCore/assert.h>
 #include <oConcurrency/concurrency.h>
 #include <oConcurrency/threadpool.h>
+#include <oConcurrency/work_stealing_threadpool.h>
 #include <oSystem/process_heap.h>
 #include <oSystem/thread_traits.h>
 #include <oMemory/allocate.h>
 
+// Selects the scheduler behind ouro_context. 1 uses per-worker work-stealing 
+// deques; 0 uses the original threadpool with one mutex-guarded global queue.
+#ifndef oOURO_WORK_STEALING
+	#define oOURO_WORK_STEALING 1
+#endif
+
 namespace ouro {
 
 class ouro_context
 {
 public:
-	typedef process_heap::std_allocator<std::function<void()>> allocator_type;
+	typedef process_heap::std_allocator<inline_task<>> allocator_type;
+#if oOURO_WORK_STEALING == 1
+	typedef work_stealing_threadpool<core_thread_traits, allocator_type> threadpool_type;
+	typedef detail::work_stealing_task_group<core_thread_traits, allocator_type> task_group_type;
+#else
 	typedef threadpool<core_thread_traits, allocator_type> threadpool_type;
 	typedef detail::task_group<core_thread_traits, allocator_type> task_group_type;
+#endif
 
 	static ouro_context& singleton();
 	ouro_context() {}
 	~ouro_context() { tp.join(); }
 	inline threadpool_type& get_threadpool() { return tp; }
-	inline void dispatch(const std::function<void()>& task) { tp.dispatch(task); }
-	inline void parallel_for(size_t begin, size_t end, const std::function<void(size_t index)>& task) { ouro::detail::parallel_for<16>(tp, begin, end, task); }
+	inline void dispatch(inline_task<>&& task) { tp.dispatch(std::move(task)); }
+	inline void parallel_for_range(size_t begin, size_t end, const std::function<void(size_t begin, size_t end)>& task) { ouro::detail::parallel_for_range(tp, begin, end, task); }
 private:
 	threadpool_type tp;
 };
@@ -48,20 +60,22 @@ class task_group_ouro : public task_group
 public:
 	task_group_ouro() : g(ouro_context::singleton().get_threadpool()) {}
 	~task_group_ouro() { wait(); }
-	void run(const std::function<void()>& task) override { g.run(task); }
+	void run(inline_task<>&& task) override { g.run(std::move(task)); }
 	void wait() override { g.wait(); }
 	void cancel() override { g.cancel(); }
 	bool is_canceling() override { return g.is_canceling(); }
 };
 
-ouro::task_group* newtask_group()
+ouro::task_group* new_task_group()
 {
 	void* p = default_allocate(sizeof(task_group_ouro), scheduler_name(), memory_alignment::cacheline);
 	return p ? new (p) task_group_ouro() : nullptr;
 }
 
-void deletetask_group(ouro::task_group* g)
+void delete_task_group(ouro::task_group* g)
 {
+	if (g)
+		g->~task_group();
 	default_deallocate(g);
 }
 
@@ -77,7 +91,11 @@ void commitment_deallocate(void* ptr)
 
 const char* scheduler_name()
 {
+#if oOURO_WORK_STEALING == 1
+	return "ouro_ws";
+#else
 	return "ouro";
+#endif
 }
 
 void ensure_scheduler_initialized()
@@ -85,14 +103,19 @@ void ensure_scheduler_initialized()
 	ouro_context::singleton();
 }
 
-void dispatch(const std::function<void()>& task)
+void dispatch(inline_task<>&& task)
 {
-	ouro_context::singleton().dispatch(task);
+	ouro_context::singleton().dispatch(std::move(task));
 }
 
 void parallel_for(size_t begin, size_t end, const std::function<void(size_t index)>& task)
 {
-	ouro_context::singleton().parallel_for(begin, end, task);
+	ouro_context::singleton().parallel_for_range(begin, end, [&](size_t b, size_t e) { for (; b < e; b++) task(b); });
+}
+
+void parallel_for_range(size_t begin, size_t end, const std::function<void(size_t begin, size_t end)>& task)
+{
+	ouro_context::singleton().parallel_for_range(begin, end, task);
 }
 
 void at_thread_exit(const std::function<void()>& task)
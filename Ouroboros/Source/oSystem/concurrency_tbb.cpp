@@ -32,7 +32,7 @@ public:
 		//delete Observer;
 	}
 
-	inline void dispatch(const std::function<void()>& _Task)
+	inline void dispatch(inline_task<>&& _Task)
 	{
 		// Use task::enqueue for tasks with no dependency to ensure the main thread
 		// never has to participate in TBB threading and prioritizes tasks that are 
@@ -48,7 +48,7 @@ public:
 		// is important, such as in situations where latency of response is more 
 		// important than efficient throughput.
 
-		::tbb::task& taskToSpawn = *new(::tbb::task::allocate_root()) task_adapter(_Task);
+		::tbb::task& taskToSpawn = *new(::tbb::task::allocate_root()) task_adapter(std::move(_Task));
 		::tbb::task::enqueue(taskToSpawn);
 	}
 
@@ -64,12 +64,11 @@ private:
 	class task_adapter : public ::tbb::task
 	{
 	public:
-		task_adapter(const std::function<void()>& _task_adapter) : Task(_task_adapter) {}
-		task_adapter(std::function<void()>&& _task_adapter) { operator=(std::move(_task_adapter)); }
+		task_adapter(inline_task<>&& _task_adapter) : Task(std::move(_task_adapter)) {}
 		task_adapter& operator=(task_adapter&& _That) { if (this != &_That) Task = std::move(_That.Task); return *this; }
 		task* execute() { Task(); return nullptr; }
 	private:
-		std::function<void()> Task;
+		inline_task<> Task;
 		task_adapter(const task_adapter&);
 		const task_adapter& operator=(const task_adapter&);
 	};
@@ -102,7 +101,8 @@ class task_group_tbb : public task_group
 	::tbb::task_group g;
 public:
 	~task_group_tbb() noexcept { wait(); }
-	void run(const std::function<void()>& _Task) override { g.run(_Task); }
+	// tbb copies the functors it runs, so share the move-only task
+	void run(inline_task<>&& _Task) override { auto t = std::make_shared<inline_task<>>(std::move(_Task)); g.run([t] { (*t)(); }); }
 	void wait() override { g.wait(); }
 	void cancel() override { g.cancel(); }
 	bool is_canceling() override { return g.is_canceling(); }
@@ -139,14 +139,19 @@ void ensure_scheduler_initialized()
 	tbb_context::singleton();
 }
 
-void dispatch(const std::function<void()>& _Task)
+void dispatch(inline_task<>&& _Task)
 {
-	tbb_context::singleton().dispatch(_Task);
+	tbb_context::singleton().dispatch(std::move(_Task));
 }
 
 void parallel_for(size_t _Begin, size_t _End, const std::function<void(size_t _Index)>& _Task)
 {
-	::tbb::parallel_for(_Begin, _End, _Task);
+	parallel_for_range(_Begin, _End, [&](size_t b, size_t e) { for (; b < e; b++) _Task(b); });
+}
+
+void parallel_for_range(size_t _Begin, size_t _End, const std::function<void(size_t _Begin, size_t _End)>& _Task)
+{
+	::tbb::parallel_for(::tbb::blocked_range<size_t>(_Begin, _End), [&](const ::tbb::blocked_range<size_t>& r) { _Task(r.begin(), r.end()); }, ::tbb::auto_partitioner());
 }
 
 void at_thread_exit(const std::function<void()>& _Task)
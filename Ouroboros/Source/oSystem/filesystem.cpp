@@ -882,7 +882,8 @@ static void iocp_close(iocp_file* f, uint64_t unused = 0)
 	delete f;
 }
 
-static void iocp_open(iocp_file* f, iocp_file::open op)
+// returns false if the open failed, in which case f has been completed and freed
+static bool iocp_open(iocp_file* f, iocp_file::open op)
 {
 	f->overlapped = nullptr;
 	f->open_type = op;
@@ -905,7 +906,10 @@ static void iocp_open(iocp_file* f, iocp_file::open op)
 	{
 		f->error_code = GetLastError();
 		iocp_close(f);
+		return false;
 	}
+
+	return true;
 }
 
 static uint32_t iocp_allocation_size(const iocp_file* f)
@@ -972,8 +976,7 @@ static void iocp_open_and_read_shared(iocp_file::open _OpenType, void* _pContext
 {
 	iocp_file* f = (iocp_file*)_pContext;
 
-	iocp_open(f, _OpenType);
-	if (!f->error_code)
+	if (iocp_open(f, _OpenType))
 	{
 		f->buffer = std::move(f->allocator.scoped_allocate(iocp_allocation_size(f)));
 		if (f->buffer)
@@ -998,8 +1001,7 @@ static void iocp_open_and_write(void* _pContext, uint64_t unused = 0)
 	iocp_file* f = (iocp_file*)_pContext;
 	if (f->buffer)
 	{
-		iocp_open(f, iocp_file::open_write);
-		if (!f->error_code)
+		if (iocp_open(f, iocp_file::open_write))
 			iocp_write(f, 0);
 	}
 }
@@ -1009,8 +1011,7 @@ static void iocp_open_and_append(void* _pContext, uint64_t unused = 0)
 	iocp_file* f = (iocp_file*)_pContext;
 	if (f->buffer)
 	{
-		iocp_open(f, iocp_file::open_write);
-		if (!f->error_code)
+		if (iocp_open(f, iocp_file::open_write))
 			iocp_write(f);
 	}
 }
@@ -1021,6 +1022,29 @@ void load_async(const path_t& path, completion_fn on_complete, void* user, load_
 	windows::iocp::post(opt == load_option::binary_read ? iocp_open_and_read : iocp_open_and_read_text, r);
 }
 
+static void fulfill_load_promise(const path_t& path, blob& buffer, const std::system_error* syserr, void* user)
+{
+	promise<blob>* p = (promise<blob>*)user;
+	if (syserr)
+		p->set_exception(std::make_exception_ptr(*syserr));
+	else
+		p->set_value(std::move(buffer));
+	delete p;
+}
+
+future<blob> load_async(const path_t& path, load_option opt, const allocator& alloc)
+{
+	promise<blob>* p = new promise<blob>();
+	future<blob> f = p->get_future();
+	try { load_async(path, fulfill_load_promise, p, opt, alloc); }
+	catch (...)
+	{
+		p->set_exception(std::current_exception());
+		delete p;
+	}
+	return f;
+}
+
 void save_async(const path_t& path, blob&& buffer, completion_fn on_complete, void* user, save_option opt)
 {
 	if (opt != save_option::binary_write && opt != save_option::binary_append)
@@ -49,7 +49,7 @@ void golden_image::deinitialize()
 {
 }
 
-void golden_image::test(const char* test_name, const surface::image& img, uint32_t nth_img, float max_rms_error, uint32_t diff_img_multiplier)
+void golden_image::test(const char* test_name, const surface::image& img, uint32_t nth_img, float max_rms_error, uint32_t diff_img_multiplier, float min_ssim)
 {
 	char tmp[64];
 	to_string(tmp, nth_img);
@@ -120,10 +120,11 @@ void golden_image::test(const char* test_name, const surface::image& img, uint32
 
 			// test pixels
 			surface::image diff_img;
-			float rms_err = surface::calc_rms(img, golden_img, &diff_img, diff_img_multiplier);
+			const auto stats = surface::calc_diff_stats(img, golden_img, &diff_img, diff_img_multiplier);
+			const float ssim = min_ssim > 0.0f ? surface::calc_ssim(img, golden_img) : 1.0f;
 
 			// save out test image and diffs if there is a non-similar result
-			if (rms_err > max_rms_error)
+			if (stats.rms > max_rms_error || ssim < min_ssim)
 			{
 				// save failed image
 				try
@@ -145,7 +146,9 @@ void golden_image::test(const char* test_name, const surface::image& img, uint32
 				}
 				catch (std::exception&) { oThrow(std::errc::io_error, "Save failed: (Diff)...%s", dpath); }
 
-				oThrow(std::errc::protocol_error, "Compare failed: %.03f RMS error (threshold %.03f): (Output)...%s != (Golden)...%s", rms_err, max_rms_error, fpath, gpath);
+				if (stats.rms > max_rms_error)
+					oThrow(std::errc::protocol_error, "Compare failed: %.03f RMS error (threshold %.03f, PSNR %.02f dB, max %u): (Output)...%s != (Golden)...%s", stats.rms, max_rms_error, stats.psnr, stats.max_diff, fpath, gpath);
+				oThrow(std::errc::protocol_error, "Compare failed: %.04f SSIM (threshold %.04f, RMS error %.03f): (Output)...%s != (Golden)...%s", ssim, min_ssim, stats.rms, fpath, gpath);
 			}
 
 			return;
@@ -148,6 +148,11 @@ void decommit(void* _Pointer)
 	oVB(VirtualFreeEx(GetCurrentProcess(), _Pointer, 0, MEM_DECOMMIT));
 }
 
+void decommit(void* base_address, size_t size)
+{
+	oVB(VirtualFreeEx(GetCurrentProcess(), base_address, size, MEM_DECOMMIT));
+}
+
 void* reserve_and_commit(void* base_address, size_t size, bool read_write, bool use_large_page_size)
 {
 	return allocate(read_write 
@@ -28,6 +28,18 @@ static bool& thread_local_tracking_enabled()
 	return *enabled;
 }
 
+// The tracker's map grows from inside the CRT alloc hook, so it must not
+// allocate through the CRT.
+static void* process_heap_allocate(size_t bytes, const char* label, const allocate_options& options)
+{
+	return process_heap::allocate(bytes, options.alignment_bytes());
+}
+
+static void process_heap_deallocate(void* pointer)
+{
+	process_heap::deallocate(pointer);
+}
+
 class context : public leak_tracker
 {
 public:
@@ -81,7 +93,7 @@ context::context()
 	static const uint32_t kNumAllocs = 200000;
 	auto req = leak_tracker::calc_size(kNumAllocs);
 	void* mem = process_heap::allocate(req);
-	initialize(i, mem, kNumAllocs);
+	initialize(i, mem, kNumAllocs, allocator(process_heap_allocate, process_heap_deallocate));
 }
 
 context::~context()